@@ -0,0 +1,88 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define POOL_SLAB_MIN 64
+#define POOL_SLAB_MAX 4096
+
+/* Memory accounting. An account counts the bytes charged to it and to every account above
+   it: the query arena and the operators charge their statement's account, which rolls up
+   into the enclosing statement's (a subquery's into its query's) and finally into the
+   process-wide account, which every arena block and pool slab not charged to a statement is
+   charged to. Limits are a budget, not a wall: allocations never fail on them, operators
+   test memory_exceeded and spill to disk instead of growing. */
+typedef struct MemoryAccount {
+    struct MemoryAccount *parent;
+    _Atomic size_t used;
+    _Atomic size_t peak;
+    _Atomic size_t limit; /* 0 for none */
+} MemoryAccount;
+
+void memory_account_init(MemoryAccount *account, MemoryAccount *parent);
+void memory_charge(MemoryAccount *account, size_t bytes);
+void memory_uncharge(MemoryAccount *account, size_t bytes);
+void memory_track(MemoryAccount *account, size_t *charged, size_t bytes);
+bool memory_exceeded(const MemoryAccount *account);
+MemoryAccount *memory_global(void);
+
+/* Bump allocator for memory that dies together: allocations are never freed one by one,
+   the whole arena is released (or rolled back to a mark) at once. Blocks chain backwards
+   from the newest; a request larger than the block size gets a block of its own. */
+typedef struct ArenaBlock {
+    struct ArenaBlock *prev;
+    MemoryAccount *account; /* charged for the block */
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+    size_t block_size;
+    MemoryAccount *account; /* charged for new blocks, NULL for the process-wide account */
+} Arena;
+
+typedef struct {
+    ArenaBlock *block;
+    size_t used;
+} ArenaMark;
+
+void arena_init(Arena *arena, size_t block_size);
+Arena *arena_create(size_t block_size);
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_calloc(Arena *arena, size_t count, size_t size);
+char *arena_strdup(Arena *arena, const char *str);
+void *arena_memdup(Arena *arena, const void *src, size_t size);
+ArenaMark arena_mark(const Arena *arena);
+void arena_release(Arena *arena, ArenaMark mark);
+void arena_reset(Arena *arena);
+void arena_destroy(Arena *arena);
+size_t arena_bytes_used(const Arena *arena);
+
+/* Fixed-size slab allocator for long-lived objects that are freed individually. Freed
+   elements go on an intrusive free list; slabs double from POOL_SLAB_MIN elements up to
+   POOL_SLAB_MAX and are only returned to malloc by pool_destroy. */
+typedef struct PoolSlab {
+    struct PoolSlab *next;
+    max_align_t data[];
+} PoolSlab;
+
+typedef struct {
+    size_t element_size;
+    int next_slab_count;
+    PoolSlab *slabs;
+    void *free_list;
+    int live;
+    size_t bytes; /* in slabs */
+} Pool;
+
+void pool_init(Pool *pool, size_t element_size);
+void *pool_alloc(Pool *pool);
+void pool_free(Pool *pool, void *ptr);
+void pool_destroy(Pool *pool);
+
+#endif
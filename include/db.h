@@ -3,20 +3,34 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include "arena.h"
 #include "arraylist.h"
 
-#define MAX_TABLES 32
-#define MAX_TOKEN_LEN 64
+#define MAX_TABLES 65535 /* table ids are uint16_t, 0 meaning none */
 #define MAX_TABLE_NAME_LEN 64
 #define MAX_COLUMN_NAME_LEN 64
 #define MAX_STRING_LEN 256
 #define MAX_COLUMNS 256
+#define FILTER_BATCH_SIZE 1024
+#define MAX_JOIN_TABLES 8
+#define MAX_INDEX_COLUMNS 16 /* key and INCLUDE columns of one index */
+
+/* Parallel scans hand their workers morsels of PARALLEL_MORSEL_ROWS consecutive rows; a
+   table of fewer than two morsels is scanned serially. */
+#define MAX_PARALLEL_WORKERS 64
+#define PARALLEL_MORSEL_ROWS (4 * FILTER_BATCH_SIZE)
+
+/* Zone maps keep the range of every column over blocks of ZONE_MAP_ROWS rows, one block per
+   parallel morsel. */
+#define ZONE_MAP_ROWS PARALLEL_MORSEL_ROWS
 
 #define COL_FLAG_NULLABLE (1 << 0)
 #define COL_FLAG_PRIMARY_KEY (1 << 1)
 #define COL_FLAG_UNIQUE (1 << 2)
 #define COL_FLAG_FOREIGN_KEY (1 << 3)
 #define COL_FLAG_CHECK (1 << 4)
+#define COL_FLAG_DICTIONARY (1 << 5)
 
 typedef enum {
     TOKEN_KEYWORD,
@@ -58,7 +72,9 @@ typedef enum {
     TOKEN_JOIN,
     TOKEN_INNER,
     TOKEN_LEFT,
-    TOKEN_STRICT
+    TOKEN_STRICT,
+    TOKEN_DOT,
+    TOKEN_PARAM
 } TokenType;
 
 typedef enum { INDEX_TYPE_HASH, INDEX_TYPE_BTREE } IndexType;
@@ -68,9 +84,13 @@ typedef struct {
     TokenType type;
 } KeywordMap;
 
+/* A view of the input: the token starts at offset, and value holds its text (the contents of a
+   quoted literal) NUL-terminated, in the allocation of the token array. */
 typedef struct {
     TokenType type;
-    char value[MAX_TOKEN_LEN];
+    int offset;
+    int length; /* of value */
+    const char *value;
 } Token;
 
 typedef enum {
@@ -86,8 +106,17 @@ typedef enum {
     TYPE_ERROR
 } DataType;
 
+#define VALUE_INLINE_STR_LEN 15
+
+/* How a TYPE_STRING value holds its characters. VALUE_STR_PTR is a char_val owned like any
+   heap value, VALUE_STR_INLINE keeps up to VALUE_INLINE_STR_LEN characters inside the Value,
+   and VALUE_STR_INTERNED points at the shared copy in the string dictionary, which is never
+   freed and compares equal by pointer. Read the characters with value_str(). */
+typedef enum { VALUE_STR_PTR = 0, VALUE_STR_INLINE, VALUE_STR_INTERNED } StringFormat;
+
 typedef struct {
     DataType type;
+    uint8_t str_format; /* StringFormat, TYPE_STRING only */
     union {
         long long int_val;
         double float_val;
@@ -102,6 +131,7 @@ typedef struct {
             unsigned char *data;
         } blob_val;
         char *char_val;
+        char inline_str[VALUE_INLINE_STR_LEN + 1];
         unsigned int time_val;
         unsigned int date_val;
     };
@@ -111,6 +141,7 @@ typedef struct {
     char column_name[MAX_COLUMN_NAME_LEN];
     uint8_t column_id;
     Value value;
+    struct Expr *expr; /* UPDATE SET col = expression, evaluated per row; NULL for value */
 } ColumnValue;
 
 typedef enum {
@@ -120,7 +151,8 @@ typedef enum {
     EXPR_UNARY_OP,
     EXPR_AGGREGATE_FUNC,
     EXPR_SCALAR_FUNC,
-    EXPR_SUBQUERY
+    EXPR_SUBQUERY,
+    EXPR_LIST /* right side of IN */
 } ExprType;
 
 typedef enum {
@@ -141,7 +173,8 @@ typedef enum {
     OP_MODULUS,
     OP_IN,
     OP_NOT_IN,
-    OP_EXISTS
+    OP_EXISTS,
+    OP_NOT_LIKE
 } OperatorType;
 
 typedef enum {
@@ -151,7 +184,9 @@ typedef enum {
     FUNC_MIN,
     FUNC_MAX,
     FUNC_STDDEV,
-    FUNC_VARIANCE
+    FUNC_VARIANCE,
+    FUNC_APPROX_COUNT_DISTINCT, /* see sketch.h */
+    FUNC_APPROX_PERCENTILE      /* APPROX_MEDIAN is its 0.5 */
 } AggFuncType;
 
 typedef enum { AGG_PLAIN, AGG_DISTINCT, AGG_MIN, AGG_MAX } AggType;
@@ -186,7 +221,7 @@ struct ASTNode;
 struct Expr;
 
 typedef struct {
-    uint8_t table_id;
+    uint16_t table_id;
     uint16_t column_id;
 } ReferenceTable;
 
@@ -204,11 +239,112 @@ typedef struct {
     bool strict;
 } TableDef;
 
+typedef enum { STORAGE_ROW, STORAGE_COLUMNAR } StorageType;
+
+struct StorageMap;
+struct MatView;
+
+/* The range of one column over one block of rows. min and max are only kept for INT, FLOAT,
+   DATE and TIME values; ranged is cleared once the block holds anything else. They only ever
+   widen, so after an UPDATE or with old row versions they may be wider than the rows. */
+typedef struct {
+    Value min; /* TYPE_NULL while the block has no non-NULL value */
+    Value max;
+    uint32_t null_count;
+    bool ranged;
+} ColumnZone;
+
+typedef struct ZoneMap {
+    ColumnZone *zones; /* block * column_count + column */
+    int column_count;
+    int row_count; /* rows covered, the last block may be partial */
+    int block_capacity;
+} ZoneMap;
+
+typedef struct {
+    uint64_t blocks_checked;
+    uint64_t blocks_skipped;
+} ZoneMapStats;
+
+/* Commit timestamps of each row version while the table is versioned, see txn.h: row i is
+   visible to a snapshot that sees begin[i] and does not see end[i]. */
+typedef struct {
+    uint64_t *begin;
+    uint64_t *end;
+    int capacity;
+} RowVersions;
+
+/* Rows a DELETE outside any transaction removed but left in place: scans, index lookups and
+   constraint checks skip them until enough pile up to compact away, see table_delete_rows. */
+typedef struct {
+    uint8_t *bits; /* bit i set when row i is deleted */
+    int capacity;  /* rows the bitmap covers, later rows are live */
+    int count;
+} Tombstones;
+
+/* Column vectors seal every full segment of COLUMN_SEGMENT_ROWS rows into an encoding. Each
+   row becomes a 64-bit word (the INT, the FLOAT's bits, the DATE, TIME or BOOLEAN, or a TEXT
+   row's dictionary code) and a segment keeps its words either as their distance from the
+   smallest, in as many bits as the largest needs, or as runs of equal words. */
+#define COLUMN_SEGMENT_ROWS ZONE_MAP_ROWS
+
+typedef enum { COLUMN_ENC_PACKED, COLUMN_ENC_RLE } ColumnEncoding;
+
+typedef struct {
+    uint8_t encoding; /* ColumnEncoding */
+    uint8_t width;    /* COLUMN_ENC_PACKED: bits per row, 0 when every row is base */
+    uint16_t run_count;
+    uint64_t base;      /* COLUMN_ENC_PACKED: the smallest word */
+    uint64_t *words;    /* packed distances from base, or one word per run */
+    uint16_t *run_ends; /* COLUMN_ENC_RLE: the row after each run */
+    uint8_t *nulls;     /* NULL when no row of the segment is */
+    /* TYPE_STRING: the distinct strings the codes number, in strcmp order while sorted */
+    uint32_t *dict_offsets;
+    char *dict_heap;
+    uint32_t dict_count;
+    size_t dict_len;
+    size_t dict_cap;
+    bool dict_sorted;
+} ColumnSegment;
+
+/* One typed vector per column of a STORAGE COLUMNAR table: rows [0, sealed) in encoded
+   segments, the rest in the plain arrays below, which row sealed starts. */
+typedef struct {
+    DataType type;
+    int length;
+    int capacity;
+    int sealed;
+    ColumnSegment *segments; /* sealed / COLUMN_SEGMENT_ROWS of them */
+    uint8_t *nulls;          /* bit i set when row sealed + i is NULL */
+    union {
+        long long *ints;
+        double *floats;
+        bool *bools;
+        unsigned int *packed; /* TYPE_DATE / TYPE_TIME */
+        Value *values;        /* TYPE_DECIMAL / TYPE_BLOB */
+        struct {
+            uint32_t *offsets; /* into heap, NUL terminated */
+            char *heap;
+            size_t heap_len;
+            size_t heap_cap;
+        } strings;
+    };
+    struct StorageMap *map; /* arrays borrowed from a mapped snapshot, NULL when owned */
+} ColumnVector;
+
 typedef struct {
     char name[MAX_TABLE_NAME_LEN];
-    uint8_t table_id;
+    uint16_t table_id;
     TableDef schema;
-    ArrayList rows; /* Row* (ArrayList<Value>) */
+    ArrayList rows; /* Row* (ArrayList<Value>), STORAGE_ROW only */
+    Pool row_pool;  /* Value[column count] backing each Row, see table_row_init */
+    StorageType storage;
+    ColumnVector *vectors; /* one per schema column, STORAGE_COLUMNAR only */
+    int row_count;         /* STORAGE_COLUMNAR only */
+    RowVersions *versions; /* NULL while every row is visible to every snapshot */
+    Tombstones *tombstones; /* NULL while no row is deleted in place */
+    ZoneMap *zones;        /* built by the first filtered scan, then kept up to date */
+    struct MatView *view;  /* set on the table a materialized view keeps its rows in */
 } Table;
 
 typedef enum {
@@ -243,14 +379,69 @@ typedef struct {
     ParseError error;
     bool error_occurred;
     Table *current_table;
+    Table *join_tables[MAX_JOIN_TABLES - 1];
+    int join_table_count;
+    char table_alias[MAX_TABLE_NAME_LEN];
+    char join_aliases[MAX_JOIN_TABLES - 1][MAX_TABLE_NAME_LEN];
+    Arena *arena; /* allocations of the statement being parsed */
+    int param_count;
+    struct ParseScope *outer; /* tables of the query around the subquery being parsed */
 } ParseContext;
 
+/* A LIKE pattern compiled when the statement is parsed. % (or *) matches any run and _ (or ?)
+   one character; a backslash makes the next character literal. Patterns without _ are
+   matched by searching for their literal runs in order, anything else by a backtracking
+   matcher over the decoded pattern. */
+typedef enum {
+    LIKE_EXACT,    /* no wildcards */
+    LIKE_PREFIX,   /* 'abc%' */
+    LIKE_SUFFIX,   /* '%abc' */
+    LIKE_CONTAINS, /* '%abc%' */
+    LIKE_RUNS,     /* any other mix of literal runs and % */
+    LIKE_WILDCARD  /* contains _ */
+} LikeKind;
+
+#define LIKE_ANY_CHAR 256
+#define LIKE_ANY_RUN 257
+
+typedef struct LikeMatcher {
+    LikeKind kind;
+    bool anchored_start; /* no leading % */
+    bool anchored_end;
+    int run_count;
+    const char **runs; /* literal runs between the %s, escapes resolved */
+    uint32_t *run_lens;
+    uint16_t *program; /* LIKE_WILDCARD: a byte, LIKE_ANY_CHAR or LIKE_ANY_RUN per position */
+    int program_len;
+    /* LIKE_PREFIX: prefix <= value < prefix_end bounds a B-tree range scan; prefix_end is
+       NULL when no string sorts after every string with the prefix. */
+    Value prefix;
+    Value *prefix_end;
+} LikeMatcher;
+
+/* Open-addressing set over the values of a long IN list, all of one type. */
+#define IN_LIST_HASH_MIN 8
+
+typedef struct ValueSet {
+    DataType type;
+    bool has_null; /* the list also holds a NULL, so NOT IN is never true */
+    uint32_t mask;
+    uint32_t *slots; /* value index + 1, 0 when empty */
+} ValueSet;
+
+typedef enum {
+    SUBQUERY_SCALAR, /* (SELECT ...): its first value, NULL without rows */
+    SUBQUERY_EXISTS,
+    SUBQUERY_IN, /* operand IN (SELECT column ...) */
+    SUBQUERY_NOT_IN
+} SubqueryKind;
+
 typedef struct Expr {
     ExprType type;
     char alias[MAX_COLUMN_NAME_LEN];
     union {
         struct {
-            uint8_t table_id;
+            uint16_t table_id;
             uint16_t column_id;
         } column;
         Value value;
@@ -258,6 +449,7 @@ typedef struct Expr {
             OperatorType op;
             struct Expr *left;
             struct Expr *right;
+            const LikeMatcher *like; /* OP_LIKE / OP_NOT_LIKE with a literal pattern */
         } binary;
         struct {
             OperatorType op;
@@ -268,6 +460,7 @@ typedef struct Expr {
             struct Expr *operand;
             bool distinct;
             bool count_all;
+            double fraction; /* APPROX_PERCENTILE's, in [0, 1] */
         } aggregate;
         struct {
             ScalarFuncType func_type;
@@ -276,19 +469,35 @@ typedef struct Expr {
         } scalar;
         struct {
             struct ASTNode *subquery;
+            struct Expr *operand; /* left side of [NOT] IN */
+            SubqueryKind kind;
+            struct SubqueryState *state;
         } subquery;
+        struct {
+            Value *values;
+            int count;
+            const ValueSet *set; /* NULL for short lists and lists with parameters */
+        } list;
     };
 } Expr;
 
 typedef enum { JOIN_NONE, JOIN_INNER, JOIN_LEFT } JoinType;
 
 typedef struct {
-    uint8_t left_table_id;
-    uint8_t right_table_id;
+    uint16_t left_table_id;
+    uint16_t right_table_id;
     JoinType type;
     Expr *condition;
 } JoinNode;
 
+/* One JOIN of a SELECT, in query order; its table's columns follow those of the FROM table
+   and the tables joined before it. */
+typedef struct {
+    JoinType type;
+    uint16_t table_id;
+    Expr *condition;
+} JoinClause;
+
 typedef enum {
     AST_CREATE_TABLE,
     AST_INSERT_ROW,
@@ -298,63 +507,144 @@ typedef enum {
     AST_DELETE_ROW,
     AST_CREATE_INDEX,
     AST_DROP_INDEX,
-    AST_JOIN
+    AST_JOIN,
+    AST_ANALYZE,
+    AST_SET,
+    AST_BEGIN,
+    AST_COMMIT,
+    AST_ROLLBACK,
+    AST_COPY,
+    AST_PREPARE,
+    AST_EXECUTE,
+    AST_DEALLOCATE,
+    AST_CREATE_VIEW
 } ASTType;
 
-typedef enum { PLAN_SEQ_SCAN, PLAN_INDEX_SCAN } PlanType;
+typedef enum {
+    PLAN_SEQ_SCAN,
+    PLAN_INDEX_SCAN,
+    PLAN_INDEX_INTERSECT,
+    PLAN_INDEX_ORDER_SCAN,
+    PLAN_INDEX_ONLY_SCAN,
+    PLAN_FILTER,
+    PLAN_HASH_JOIN,
+    PLAN_NESTED_LOOP_JOIN,
+    PLAN_INDEX_NESTED_LOOP_JOIN,
+    PLAN_AGGREGATE,
+    PLAN_HASH_AGGREGATE,
+    PLAN_SORT,
+    PLAN_LIMIT,
+    PLAN_PROJECT
+} PlanType;
 
 typedef struct {
     char table_name[MAX_TABLE_NAME_LEN];
     ArrayList columns; /* ColumnDef* */
     bool strict;
+    StorageType storage;
 } CreateTableNode;
 
 typedef struct {
-    uint8_t table_id;
+    uint16_t table_id;
     ArrayList value_rows; /* ArrayList<ArrayList<Value>> */
     ArrayList columns;    /* ColumnValue* */
 } InsertNode;
 
+/* EXPLAIN prints a SELECT's plan with its estimates; EXPLAIN ANALYZE also runs it and adds
+   what each operator actually did. */
+typedef enum { EXPLAIN_NONE, EXPLAIN_PLAN, EXPLAIN_ANALYZE } ExplainMode;
+
 typedef struct {
-    uint8_t table_id;
+    uint16_t table_id;
     ArrayList expressions; /* Expr* */
     Expr *where_clause;
     ArrayList order_by;      /* Expr* */
     ArrayList order_by_desc; /* Expr* */
     uint32_t order_by_count;
+    ArrayList group_by; /* Expr* */
+    Expr *having;
     uint32_t limit;
-    JoinType join_type;
-    uint8_t join_table_id;
-    Expr *join_condition;
+    JoinClause joins[MAX_JOIN_TABLES - 1];
+    int join_count;
     bool distinct;
+    uint8_t explain; /* ExplainMode */
+    bool sampled;          /* TABLESAMPLE on the FROM table */
+    double sample_percent; /* of its rows read */
+    uint32_t sample_seed;  /* REPEATABLE's, else drawn per statement */
 } SelectNode;
 
 typedef struct {
-    uint8_t table_id;
+    uint16_t table_id;
+    bool view; /* DROP MATERIALIZED VIEW */
 } DropTableNode;
 
 typedef struct {
-    uint8_t table_id;
-    ArrayList column_ids; /* uint16_t* */
+    uint16_t table_id;
+    ArrayList column_ids; /* uint16_t*: the key columns, then the INCLUDE columns */
+    int key_count;
     char index_name[MAX_TABLE_NAME_LEN];
+    IndexType index_type;
 } CreateIndexNode;
 
 typedef struct {
-    uint8_t table_id;
+    uint16_t table_id;
     char index_name[MAX_TABLE_NAME_LEN];
 } DropIndexNode;
 
 typedef struct {
-    uint8_t table_id;
+    uint16_t table_id; /* 0 analyzes every table */
+} AnalyzeNode;
+
+/* SET name = value for a session setting. */
+typedef struct {
+    char name[MAX_COLUMN_NAME_LEN];
+    long long value;
+} SetNode;
+
+typedef struct {
+    uint16_t table_id;
     ArrayList values; /* ColumnValue* */
     Expr *where_clause;
 } UpdateNode;
 
 typedef struct {
-    uint8_t table_id;
+    uint16_t table_id;
     Expr *where_clause;
 } DeleteNode;
 
+/* PREPARE name AS statement keeps the statement's text; it is parsed when PREPARE runs.
+   EXECUTE name [(values)] binds the values to its '?' parameters in order. DEALLOCATE
+   with an empty name drops every prepared statement. */
+typedef struct {
+    char name[MAX_TABLE_NAME_LEN];
+    char *sql;
+} PrepareNode;
+
+typedef struct {
+    char name[MAX_TABLE_NAME_LEN];
+    ArrayList values; /* Value */
+} ExecuteNode;
+
+/* CREATE MATERIALIZED VIEW name AS SELECT ... keeps the SELECT's text, as PREPARE does; it
+   is parsed when the statement runs, and again when the view is loaded from storage. */
+typedef struct {
+    char name[MAX_TABLE_NAME_LEN];
+    char *sql;
+} CreateViewNode;
+
+typedef enum { COPY_FORMAT_CSV, COPY_FORMAT_BINARY } CopyFormat;
+
+/* COPY table [(columns)] FROM | TO 'path' [WITH] [(FORMAT CSV | BINARY, HEADER, DELIMITER 'c')]. */
+typedef struct {
+    uint16_t table_id;
+    ArrayList columns; /* int, schema column of each field; empty for every column */
+    char path[MAX_STRING_LEN];
+    bool to_file;
+    CopyFormat format;
+    bool header;
+    char delimiter;
+} CopyNode;
+
 typedef struct ASTNode {
     ASTType type;
     union {
@@ -364,44 +654,104 @@ typedef struct ASTNode {
         DropTableNode drop_table;
         UpdateNode update;
         DeleteNode delete;
+        CopyNode copy;
+        PrepareNode prepare;
+        ExecuteNode execute;
+        CreateViewNode create_view;
         CreateIndexNode create_index;
         DropIndexNode drop_index;
+        AnalyzeNode analyze;
+        SetNode set;
         JoinNode join;
     };
     struct ASTNode *next;
+    Arena *arena;    /* set on the root node only; holds the whole tree */
+    int param_count; /* root only: '?' placeholders in the tree, see ast_collect_params */
 } ASTNode;
 
 typedef ArrayList Row;
 
-typedef struct IndexEntry {
+/* Hash index slots live in one flat open-addressing array with a parallel control byte per
+   slot (empty, deleted, or the top 7 hash bits). A slot holds one distinct key and its first
+   row inline; further rows with the same key are chained through a flat overflow array. */
+typedef struct {
+    uint64_t hash;
     Value key;
     int row_index;
-    struct IndexEntry *next;
-} IndexEntry;
+    int overflow; /* head of the overflow chain, -1 if none */
+} HashSlot;
+
+typedef struct {
+    int row_index;
+    int next;
+} HashOverflow;
+
+/* B+tree nodes hold BTREE_NODE_KEYS entries, roughly one 4 KiB page for a single-column
+   index. An entry is the index's columns in order, the key columns then the INCLUDE columns,
+   and entries sort lexicographically on the key columns. Leaves hold (entry, row) pairs and
+   are chained in key order; inner nodes hold separators where children[i] covers keys
+   between keys[i - 1] and keys[i]. */
+#define BTREE_NODE_KEYS 128
 
 typedef struct BTreeNode {
-    Value *keys;
-    int *row_indices;
-    struct BTreeNode **children;
-    struct BTreeNode *parent;
-    int key_count;
     bool is_leaf;
+    int key_count;
+    struct BTreeNode *prev; /* leaf chain */
+    struct BTreeNode *next;
+    union {
+        int row_indices[BTREE_NODE_KEYS];
+        struct BTreeNode *children[BTREE_NODE_KEYS + 1];
+    };
+    Value keys[]; /* key_count entries of the index's width */
 } BTreeNode;
 
+/* An ascending scan from lo to hi, tuples over the first lo_width and hi_width key columns;
+   a width of 0 is an open end. Entries with a NULL in key column null_column, when that is
+   not -1, are outside the range. */
+typedef struct {
+    const Value *lo;
+    int lo_width;
+    bool lo_inclusive;
+    const Value *hi;
+    int hi_width;
+    bool hi_inclusive;
+    int null_column;
+} BTreeRange;
+
+typedef struct {
+    const BTreeNode *leaf;
+    int pos;
+    bool desc;
+    int width;               /* values per entry */
+    const BTreeRange *range; /* NULL for a walk of the whole tree */
+} BTreeCursor;
+
 typedef struct {
     char index_name[MAX_TABLE_NAME_LEN];
-    uint8_t table_id;
-    ArrayList columns; /* uint16_t* */
+    uint16_t table_id;
+    ArrayList columns;  /* uint16_t*: the key columns, then the INCLUDE columns */
+    uint16_t key_count; /* key columns among them */
     IndexType type;
-    IndexEntry **buckets;
-    uint32_t bucket_count;
     uint32_t entry_count;
     union {
         struct {
             BTreeNode *root;
-            int order;
+            BTreeNode *first_leaf;
+            BTreeNode *last_leaf;
+            uint32_t leaf_count;
         } btree;
-        IndexEntry **hash_buckets;
+        struct {
+            HashSlot *slots;
+            uint8_t *ctrl;
+            uint32_t capacity; /* power of two */
+            uint32_t used;     /* live plus deleted slots */
+            uint32_t key_count;
+            HashOverflow *overflow;
+            uint32_t overflow_len;
+            uint32_t overflow_cap;
+            int overflow_free;
+            struct StorageMap *map; /* arrays borrowed from a mapped snapshot */
+        } hash;
     } data;
 } Index;
 
@@ -422,67 +772,510 @@ typedef struct {
         } max;
     } data;
     double sum;
+    double mean; /* Welford running mean and sum of squared deviations */
+    double m2;
+    long long int_sum; /* exact sum while only INTs were added and it has not overflowed */
+    bool has_float;
+    bool int_overflow;
     uint32_t count;
+    struct Sketch *sketch; /* of an approximate aggregate */
 } AggState;
 
+/* Numeric summary produced by the aggregate kernels; partial results merge pairwise. While
+   every value is an INT, SUM, MIN and MAX are also kept exactly and come out as INTs. */
+typedef struct {
+    double sum;
+    double min;
+    double max;
+    double mean;
+    double m2;
+    long long count;
+    long long int_sum;
+    long long int_min;
+    long long int_max;
+    bool has_float;    /* a FLOAT was added: every result is a FLOAT */
+    bool int_overflow; /* int_sum overflowed: SUM is a FLOAT */
+} NumericAgg;
+
+#define STATS_HISTOGRAM_BUCKETS 32
+
 typedef struct {
     uint32_t row_count;
-    uint32_t distinct_count;
+    uint32_t null_count;
+    uint32_t distinct_count; /* HyperLogLog estimate */
     double avg_width;
     bool has_stats;
     Value min_val;
     Value max_val;
+    /* Equi-depth bounds: each of the histogram_count - 1 buckets holds the same share of the
+       non-NULL rows. */
+    Value histogram[STATS_HISTOGRAM_BUCKETS + 1];
+    int histogram_count;
 } ColumnStats;
 
 typedef struct {
-    uint8_t table_id;
+    uint16_t table_id;
     uint32_t total_rows;
     uint32_t distinct_values[MAX_COLUMNS];
-    Value min_values[MAX_COLUMNS];
-    Value max_values[MAX_COLUMNS];
     ColumnStats *column_stats;
     int column_count;
     bool has_stats;
 } TableStats;
 
+/* A sampled scan emits only the rows that sample_row_kept picks for its percent and seed. */
 typedef struct SeqScanPlan {
-    uint8_t table_id;
-    Expr *where_clause;
+    uint16_t table_id;
+    const Expr *where_clause;
+    bool sampled;
+    double sample_percent;
+    uint32_t sample_seed;
 } SeqScanPlan;
 
+/* op is OP_EQUALS for a point lookup on search_key, eq_count values of the leading key
+   columns; otherwise the scan covers the B-tree range between lo_key and hi_key, tuples of
+   lo_width and hi_width values: the eq_count equal leading columns, then the bound on the
+   next key column if it has one (an open end without equalities is NULL). An index-only
+   scan also returns outputs, the projected columns, from the index entries. */
 typedef struct IndexScanPlan {
-    uint8_t table_id;
+    uint16_t table_id;
     Index *index;
-    Expr *where_clause;
+    const Expr *where_clause;
     OperatorType op;
     Value *search_key;
+    int eq_count;
+    Value *lo_key;
+    int lo_width;
+    bool lo_inclusive;
+    Value *hi_key;
+    int hi_width;
+    bool hi_inclusive;
+    double selectivity;
+    const ArrayList *outputs; /* Expr*, NULL for all of the table's columns */
 } IndexScanPlan;
 
+/* Walks a B-tree in key order to answer ORDER BY without sorting. NULL keys are not in the
+   tree; they come last ascending and first descending. */
+typedef struct {
+    uint16_t table_id;
+    Index *index;
+    bool desc;
+} IndexOrderScanPlan;
+
+typedef struct {
+    const Expr *predicate;
+} FilterPlan;
+
+/* Joins are left-deep: right reads the single table in slot right_slot of the ExecContext,
+   left either one table (left_slot) or the rows of the joins below (left_slot -1). A hash join
+   keys on key_slot's left_column = the right table's right_column, both counted from their
+   own table's first column, and builds on the side picked by build_left. An index nested
+   loop join has no right input; it probes index with the left key and keeps the fetched rows
+   that pass right_filter. The nested loop join evaluates condition on every pair. */
+typedef struct {
+    JoinType join_type;
+    const Expr *condition;
+    int8_t left_slot;
+    uint8_t right_slot;
+    uint8_t key_slot;
+    uint16_t left_column;
+    uint16_t right_column;
+    bool build_left;
+    Index *index;
+    const Expr *right_filter;
+} JoinPlan;
+
+/* Memory-hungry operators (Sort, Hash Join, Hash Aggregate) hold at most work_mem bytes each,
+   and less once the process is over its memory limit; past that they write their rows to
+   temporary files and finish them a part at a time. A spill file is written and then read
+   back sequentially, SPILL_BLOCK_BYTES at a time. Partitioned spills split on
+   SPILL_FANOUT_BITS of the key hashes per level, from the top bits down, and split a
+   partition again while it does not fit, up to SPILL_MAX_LEVELS deep. */
+#define WORK_MEM_DEFAULT (64 * 1024 * 1024)
+#define WORK_MEM_MIN (64 * 1024)
+#define SPILL_BLOCK_BYTES (64 * 1024)
+#define SPILL_FANOUT_BITS 4
+#define SPILL_FANOUT (1 << SPILL_FANOUT_BITS)
+#define SPILL_MAX_LEVELS 8
+
+typedef struct {
+    FILE *file;
+    uint8_t *block;
+    size_t len; /* bytes in block: written and not yet flushed, or read */
+    size_t pos; /* read position in block */
+    uint64_t bytes;   /* written */
+    uint64_t records; /* counted by the owner */
+    bool reading;
+    bool failed;
+} SpillFile;
+
+/* The hash join radix-partitions its build side so each partition's table fits in the
+   per-core cache (JOIN_PARTITION_BYTES, about an L2). */
+#define JOIN_PARTITION_BYTES (256 * 1024)
+#define JOIN_MIN_PARTITION_BYTES 1024
+#define JOIN_MAX_PARTITION_BITS 10
+
+typedef struct {
+    uint64_t joins;            /* hash joins built */
+    uint64_t partitions;       /* build partitions they used */
+    uint64_t parallel_probes;  /* joins whose probe side ran on the thread pool */
+    uint64_t join_filters;     /* Bloom filters pushed into a probe-side scan */
+    uint64_t filtered_rows;    /* probe rows those filters dropped */
+    uint64_t spilled;          /* joins whose build side outgrew work_mem */
+    uint64_t spill_partitions; /* partition pairs they joined from temporary files */
+} HashJoinStats;
+
+/* Split block Bloom filter: a key sets one bit in each of the 8 words of one 32-byte block,
+   all chosen by its hash, so a lookup reads one cache line. */
+#define BLOOM_BITS_PER_KEY 16
+#define BLOOM_BLOCK_WORDS 8
+
+typedef struct {
+    uint32_t *words; /* (block_mask + 1) * BLOOM_BLOCK_WORDS */
+    uint32_t block_mask;
+} BloomFilter;
+
+/* A hash join's Bloom filter over its build keys, pushed into the scan of the probe table:
+   rows whose column_id cannot match are dropped before they reach the join. */
+typedef struct JoinFilter {
+    BloomFilter bloom;
+    uint16_t column_id;
+    struct JoinFilter *next;
+} JoinFilter;
+
+/* What a scan (or a parallel worker) has seen of its join filters; after JOIN_FILTER_SAMPLE
+   rows a chain that drops less than 1 in JOIN_FILTER_MIN_DROP of them is switched off. */
+#define JOIN_FILTER_SAMPLE 4096
+#define JOIN_FILTER_MIN_DROP 8
+
+typedef struct {
+    uint64_t checked;
+    uint64_t dropped;
+    bool off;
+} JoinFilterProbe;
+
+typedef struct {
+    const ArrayList *expressions; /* Expr* */
+} AggregatePlan;
+
+/* GROUP BY, HAVING and DISTINCT aggregates: rows are folded into an open-addressing table of
+   groups keyed on the group_by columns, with every aggregate's state stored inline in its
+   group. Over a parallel scan each worker folds its morsels into a partial table of its own,
+   and the partials are merged before HAVING filters the groups and ORDER BY sorts them. */
+typedef struct {
+    const ArrayList *expressions; /* Expr* */
+    const ArrayList *group_by;    /* Expr* */
+    const Expr *having;
+    const ArrayList *order_by; /* Expr* */
+    const ArrayList *desc;     /* bool */
+} HashAggregatePlan;
+
+typedef struct {
+    uint64_t aggregates;       /* hash aggregates run */
+    uint64_t groups;           /* groups they produced, before HAVING */
+    uint64_t partials;         /* partial tables they merged, one per worker */
+    uint64_t spilled;          /* aggregates whose groups outgrew work_mem */
+    uint64_t spill_partitions; /* partitions of rows they aggregated from temporary files */
+} HashAggStats;
+
+/* COPY FROM reads its file COPY_CHUNK_BYTES at a time. The complete CSV records of a chunk
+   are cut into parse tasks of about COPY_TASK_BYTES that run on the thread pool, and rows
+   are appended in file order once the whole chunk is parsed. */
+#define COPY_CHUNK_BYTES (4 * 1024 * 1024)
+#define COPY_TASK_BYTES (256 * 1024)
+#define COPY_BINARY_MAGIC "DBCOPY1\n"
+
+typedef struct {
+    uint64_t rows_in;     /* rows appended by COPY FROM */
+    uint64_t rows_out;    /* rows written by COPY TO */
+    uint64_t chunks;      /* file chunks read */
+    uint64_t parse_tasks; /* CSV parse tasks run */
+    uint64_t bulk_loads;  /* loads that built their indexes after appending */
+} CopyStats;
+
+/* A materialized view keeps its SELECT's result in a table of its own, and a group per
+   result row: the group keys, the number of input rows, and an AggState per aggregate. The
+   rows each INSERT, UPDATE, DELETE, COPY or commit adds to or removes from a base table are
+   folded into the groups; a read of the view then rewrites the table from the groups when
+   they changed. A change the groups cannot take back (the MIN or MAX leaving, a row leaving
+   an approximate aggregate's sketch, or a joined change inside a transaction) marks the view
+   for a full refresh on its next read. */
+typedef struct {
+    uint64_t deltas;        /* base rows folded into views */
+    uint64_t refreshes;     /* views recomputed from their base tables */
+    uint64_t rebuilds;      /* view tables rewritten from their groups */
+    uint64_t invalidations; /* changes that left a view to be refreshed */
+} MatViewStats;
+
+/* limit > 0 asks for only the first limit rows (ORDER BY ... LIMIT), kept in a bounded heap
+   instead of sorting the whole input. A full sort spills runs to temporary files once its
+   keys outgrow work_mem. */
+
+typedef struct {
+    const ArrayList *keys; /* Expr* */
+    const ArrayList *desc; /* bool */
+    uint32_t limit;
+} SortPlan;
+
+typedef struct {
+    uint64_t sorts;         /* Sort operators run */
+    uint64_t top_k;         /* of which kept only the first rows */
+    uint64_t runs;          /* runs written to temporary files */
+    uint64_t spilled_bytes; /* bytes written to them */
+} SortStats;
+
+typedef struct {
+    uint32_t count;
+} LimitPlan;
+
+typedef struct {
+    const ArrayList *expressions; /* Expr* */
+    bool select_star;
+} ProjectPlan;
+
+/* A list of expressions lowered to register code (see expr_compile). Registers hold one
+   value per row of a slice of EXPR_LANES rows and each instruction runs over the whole
+   slice, so rows are not interpreted one tree at a time. Constant subtrees are folded into
+   registers filled once, equal subtrees share a register, and operators whose operand types
+   the schema fixes get a typed instruction that falls back to the generic one for a NULL. */
+#define EXPR_LANES 256
+
+typedef enum {
+    EXPR_INS_COLUMN,    /* dst = column */
+    EXPR_INS_INT_ARITH, /* dst = a op b over INT operands */
+    EXPR_INS_FLOAT_ARITH,
+    EXPR_INS_INT_CMP,   /* dst = a op b over INT operands, 1 or 0 */
+    EXPR_INS_FLOAT_CMP,
+    EXPR_INS_BINARY,    /* eval_binary_values */
+    EXPR_INS_UNARY,
+    EXPR_INS_SCALAR,    /* eval_scalar_values over the argument registers */
+    EXPR_INS_MATCH,     /* IN list or compiled LIKE of expr over register a, 1 or 0 */
+    EXPR_INS_TREE       /* anything else, interpreted on the row */
+} ExprInstrType;
+
+typedef struct {
+    uint8_t type;    /* ExprInstrType */
+    uint8_t op;      /* OperatorType or ScalarFuncType */
+    uint8_t arg_count;
+    bool owned;      /* dst holds allocated strings to free after each slice */
+    uint16_t dst;
+    uint16_t args[3];
+    uint16_t column_id;
+    const struct Expr *expr; /* EXPR_INS_TREE / EXPR_INS_MATCH */
+} ExprInstr;
+
+typedef struct {
+    int instr_count;
+    ExprInstr *instrs;
+    int reg_count;
+    int const_count;
+    Value *constants;    /* folded constants, filled into every lane of their register once */
+    uint16_t *const_regs;
+    int output_count;
+    uint16_t *outputs; /* the register of each compiled expression */
+    Value *regs;       /* reg_count * EXPR_LANES */
+} ExprProgram;
+
+typedef struct {
+    uint64_t programs;     /* expression lists compiled */
+    uint64_t instructions; /* instructions they were lowered to */
+    uint64_t folded;       /* constant subtrees evaluated once at compile time */
+    uint64_t shared;       /* subtrees that reused the register of an equal one */
+    uint64_t typed;        /* operators given a typed instruction */
+} ExprCompileStats;
+
+/* Unary nodes read from left; joins read the rows joined so far from left and the next table
+   from right. Expressions are borrowed from the AST the plan was built for, except owned: a
+   predicate the planner rewrote (split, recombined or rebased onto one table's columns). */
 typedef struct PlanNode {
     PlanType type;
     struct PlanNode *left;
     struct PlanNode *right;
     double cost;
     uint32_t estimated_rows;
+    struct Expr *owned;
     union {
         SeqScanPlan seq_scan;
         IndexScanPlan index_scan;
+        IndexOrderScanPlan index_order_scan;
+        FilterPlan filter;
+        JoinPlan join;
+        AggregatePlan aggregate;
+        HashAggregatePlan hash_aggregate;
+        SortPlan sort;
+        LimitPlan limit;
+        ProjectPlan project;
     } plan;
 } PlanNode;
 
+/* Iterates the rows of a table matching a WHERE clause, one batch at a time. When an index
+   applies, batches are drawn from its candidate rows instead of the whole table. */
+typedef struct {
+    const Table *table;
+    const struct Expr *where;
+    int next_row;
+    int row_count;
+    bool use_index;
+    ArrayList candidates; /* int, ascending */
+    const ZoneMap *zones; /* skips blocks of a sequential pass, NULL to read them all */
+    int sel[FILTER_BATCH_SIZE]; /* matching row indices of the current batch */
+    int count;
+    Row scratch;
+} FilterCursor;
+
 typedef struct {
     ArrayList values;       /* Value* */
     ArrayList rows;         /* int* */
     ArrayList column_names; /* char* */
     int col_count;
+    Arena arena; /* column names and string/blob values */
 } QueryResult;
 
+/* One batch of a SELECT read through a QueryCursor, column by column: row i of column j is
+   values[j * capacity + i]. Column values are borrowed from the tables (a string points into
+   its row or column vector) and computed ones live in arena, so nothing is copied out of the
+   tables; either way a batch is only valid until the cursor's next one. */
+typedef struct {
+    int row_count;
+    int col_count;
+    int capacity;
+    Value *values;
+    Arena arena;
+} ResultBatch;
+
+/* How the CLI writes results: the box-drawing table, which measures every row before it
+   prints one, or a format written row by row as the rows arrive. */
+typedef enum { OUTPUT_TABLE, OUTPUT_CSV, OUTPUT_TSV, OUTPUT_JSONL, OUTPUT_BINARY } OutputFormat;
+
+/* Writes one result in a streamed OutputFormat; names are borrowed until result_writer_end. */
+typedef struct {
+    FILE *file;
+    OutputFormat format;
+    int col_count;
+    const char *const *names;
+    long long rows;
+} ResultWriter;
+
+/* A column of the enclosing query that a correlated subquery reads. It is parsed as the
+   value *slot, which is set to the column of the current outer row before each run. */
+typedef struct {
+    uint16_t column_id;
+    Value *slot;
+} OuterRef;
+
+/* A correlated [NOT] EXISTS or [NOT] IN over one table whose outer columns are only compared
+   for equality with expressions of that table runs as a hash semi join (an anti join for the
+   NOT forms): the other conjuncts select the build rows once per statement, their keys are
+   hashed, and each outer row probes the keys with its own columns. */
+#define SEMI_JOIN_MAX_KEYS 4
+
+typedef struct {
+    uint16_t table_id;
+    const Expr *residual; /* NULL: every row */
+    Expr *inner_keys[SEMI_JOIN_MAX_KEYS];
+    uint16_t outer_columns[SEMI_JOIN_MAX_KEYS]; /* outer row column matched by each key */
+    int key_count;
+} SemiJoinPlan;
+
+/* The results of an uncorrelated subquery, and the build side of a semi join, are computed
+   the first time the statement needs them and kept until it ends. */
+typedef struct SubqueryState {
+    const OuterRef *outer;
+    int outer_count;
+    const SemiJoinPlan *semi_join;
+    bool cached;
+    bool exists;
+    QueryResult *result; /* scalar and IN results */
+    Expr list;           /* IN: EXPR_LIST over the result's column */
+    struct KeySet *keys;  /* semi join: key tuples of the build rows */
+    struct KeySet *pairs; /* IN semi join: (keys, column) tuples */
+    Arena *arena;         /* values of the key sets */
+    struct SubqueryState *next_cached;
+} SubqueryState;
+
+typedef struct {
+    uint64_t runs;         /* subquery executions */
+    uint64_t cache_hits;   /* evaluations answered from a cached result */
+    uint64_t semi_joins;   /* semi join key sets built */
+    uint64_t probes;       /* outer rows probed into them */
+    uint64_t bloom_misses; /* probes answered by the semi join's Bloom filter */
+} SubqueryStats;
+
+/* Rows passed between operators. A row is one row id per input table (-1 on the NULL side
+   of a LEFT JOIN), so values are read from the base tables only when an operator needs them;
+   ids[0] alone is a selection vector for the filter kernels. Operators that compute new rows
+   (Aggregate) pass value_count values per row in values instead. */
+typedef struct {
+    int count;
+    int width;      /* 1 below the joins (that scan's table), else the ExecContext's tables */
+    bool ascending; /* ids[0] ascending, as filter_batch requires */
+    int ids[MAX_JOIN_TABLES][FILTER_BATCH_SIZE];
+    int value_count;
+    ArrayList values; /* Value, owned */
+} RowBatch;
+
+/* Per-query state shared by the operators of one plan. A joined row is the FROM table's
+   columns followed by each joined table's in query order, matching the column ids the parser
+   assigns; join output batches carry one row id per table in the same order, -1 for a table
+   not joined yet or on the NULL side of a LEFT JOIN. */
+typedef struct {
+    int table_count;
+    Table *tables[MAX_JOIN_TABLES];
+    int column_offset[MAX_JOIN_TABLES];
+    TableDef *schema; /* tables[0]->schema, or join_schema */
+    TableDef join_schema;
+    Row scratch;
+    QueryResult *result;
+    ResultBatch *stream; /* set by a QueryCursor: Project fills it instead of result's rows */
+    Arena *arena;        /* operators and their buffers, released when the query ends */
+    ArenaMark mark;
+    MemoryAccount account; /* the statement's memory, charged by its arena and operators */
+    MemoryAccount *memory; /* account, also in the copies parallel workers make */
+    MemoryAccount *outer;  /* the arena's account before the statement */
+    bool analyze;      /* EXPLAIN ANALYZE: operators time their calls, see Operator */
+    size_t arena_peak; /* EXPLAIN ANALYZE: most query arena bytes an operator call left in use */
+} ExecContext;
+
+/* A pull-based operator: open, then next until it returns false, then close. state is
+   private to the operator kind. Under EXPLAIN ANALYZE open and next also add their cycles
+   and query arena growth, inputs included, to cycles and alloc_bytes. */
+typedef struct Operator {
+    const PlanNode *plan;
+    ExecContext *ctx;
+    struct Operator *left;
+    struct Operator *right;
+    void *state;
+    uint64_t rows_out;
+    uint64_t batches;
+    uint64_t index_hits; /* row ids an index returned to the operator */
+    uint64_t cycles;
+    uint64_t alloc_bytes;
+    uint64_t spilled_bytes; /* written to temporary files */
+    JoinFilter *join_filters; /* scans: from the hash joins above, see JoinFilter */
+} Operator;
+
+/* A SELECT pulled a batch at a time, see exec_select_open. ctx.result holds the column
+   names and no rows. The cursor has an arena of its own, so other queries may run and end
+   while it is open; none may write the tables it reads. */
+typedef struct {
+    ExecContext ctx;
+    PlanNode *plan;
+    Operator *root;
+    RowBatch out;
+    ResultBatch batch;
+    Arena arena;
+    bool done;
+} QueryCursor;
+
 int time_hour(unsigned int time_val);
 int time_minute(unsigned int time_val);
 int time_second(unsigned int time_val);
 int date_year(unsigned int date_val);
 int date_month(unsigned int date_val);
 int date_day(unsigned int date_val);
+unsigned int make_time(int hour, int minute, int second);
+unsigned int make_date(int year, int month, int day);
+bool parse_date_literal(const char *value, int *year, int *month, int *day);
+bool parse_time_literal(const char *value, int *hour, int *minute, int *second);
 
 Value scalar_coalesce(Value *args, int arg_count);
 Value scalar_nullif(Value *arg1, Value *arg2);
@@ -490,21 +1283,27 @@ Value scalar_case(Value *condition, Value *then_val, Value *else_val);
 
 void agg_init(AggState *state, AggFuncType func_type, bool distinct);
 void agg_add_value(AggState *state, Value *value);
+bool agg_remove_value(AggState *state, const Value *value);
 Value agg_get_result(AggState *state);
 void agg_cleanup(AggState *state);
 
-TableStats *get_table_stats(uint8_t table_id);
-void collect_table_stats(uint8_t table_id);
+TableStats *get_table_stats(uint16_t table_id);
+void collect_table_stats(uint16_t table_id);
+bool analyze_table(uint16_t table_id);
+void drop_table_stats(uint16_t table_id);
 double estimate_selectivity(const TableStats *stats, int col_idx, OperatorType op,
                             const Value *value);
-Index *find_index_by_table_column(uint8_t table_id, uint16_t column_id);
+double estimate_range_selectivity(const TableStats *stats, int col_idx, const Value *lo,
+                                  bool lo_inclusive, const Value *hi, bool hi_inclusive);
+Index *find_index_by_table_column(uint16_t table_id, uint16_t column_id);
 
-PlanNode *optimize_select(uint8_t table_id, Expr *where_clause);
-PlanNode *create_seq_scan_plan(uint8_t table_id, Expr *where_clause);
+PlanNode *optimize_select(uint16_t table_id, const Expr *where_clause);
+PlanNode *create_seq_scan_plan(uint16_t table_id, const Expr *where_clause);
+PlanNode *plan_select(const SelectNode *select);
+const SemiJoinPlan *plan_semi_join(Arena *arena, const Expr *subquery);
 void free_plan(PlanNode *plan);
 
 Index *find_index(const char *index_name);
-ArrayList *btree_find_equals(Index *index, const Value *key);
 void assert_double_almost_eq(double expected, double actual, double tolerance, const char *message);
 
 bool value_equals(const Value *a, const Value *b);
@@ -519,14 +1318,17 @@ void parse_error_report(ParseContext *ctx);
 ASTNode *parse_with_context(ParseContext *ctx, Token *tokens);
 ASTNode *parse(Token *tokens);
 ASTNode *parse_ex(const char *input, Token *tokens);
+void ast_collect_params(ASTNode *ast, Value **slots);
 ParseContext *parse_get_context(void);
 void exec_ast(ASTNode *ast);
 void free_tokens(Token *tokens);
 void free_ast(ASTNode *ast);
 
-void index_table(uint8_t table_id, ArrayList *column_ids, const char *index_name);
+void index_table(uint16_t table_id, ArrayList *column_ids, int key_count, const char *index_name,
+                 IndexType type);
 void drop_index_by_name(const char *index_name);
 int hash_value(const Value *value, int bucket_count);
+uint64_t value_hash(const Value *value);
 void clear_query_result(void);
 
 QueryResult *exec_query(const char *sql);
@@ -0,0 +1,96 @@
+#ifndef DBAPI_H
+#define DBAPI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+
+/* Statements parsed once and run many times. db_prepare tokenizes and parses the SQL, and
+   each '?' in it becomes a parameter numbered from 1 in the order it appears; db_bind_*
+   writes a value into the parsed tree in place of the parameter, so running the statement
+   again only replans it (plans follow the bound values and the current statistics). A
+   statement parsed before a table was created or dropped is parsed again from its text the
+   next time it runs, keeping its bindings.
+
+       DbStatement *stmt = db_prepare("SELECT name FROM users WHERE id = ?;");
+       db_bind_int(stmt, 1, 42);
+       while (db_step(stmt) == DB_ROW)
+           printf("%s\n", repr(db_column_value(stmt, 0)));
+       db_reset(stmt);
+
+   Unbound parameters are NULL. Bindings survive db_reset; a bound string or blob is copied,
+   so the caller's buffer may be reused at once. A statement fails when it logs an error while
+   it runs, e.g. a constraint violation: db_step then returns DB_ERROR and db_error_message
+   says why.
+
+   Statements share the executor's process-wide state, so only one thread at a time may call
+   into this API (the server holds its engine lock around every request). */
+typedef struct DbStatement DbStatement;
+
+typedef enum { DB_DONE, DB_ROW, DB_ERROR } DbStep;
+
+/* db_exec keeps the parsed trees of its last STMT_CACHE_SIZE distinct statements, keyed on
+   their tokens with the literals the plan does not depend on replaced by parameters, so an
+   application that sends the same statement again with other values only tokenizes it: the
+   literals are bound into the cached tree as db_bind_* would. */
+#define STMT_CACHE_SIZE 64
+
+typedef struct {
+    uint64_t hits;       /* db_exec calls served from the cache */
+    uint64_t misses;     /* db_exec calls that parsed their statement */
+    uint64_t evictions;  /* least recently used entries dropped for a new one */
+    uint64_t reprepares; /* statements parsed again after a catalog change */
+    int entries;         /* statements in the cache now */
+} StmtCacheStats;
+
+DbStatement *db_prepare(const char *sql);
+int db_bind_count(const DbStatement *stmt);
+bool db_bind_null(DbStatement *stmt, int index);
+bool db_bind_int(DbStatement *stmt, int index, long long value);
+bool db_bind_float(DbStatement *stmt, int index, double value);
+bool db_bind_bool(DbStatement *stmt, int index, bool value);
+bool db_bind_text(DbStatement *stmt, int index, const char *value);
+bool db_bind_value(DbStatement *stmt, int index, const Value *value);
+DbStep db_step(DbStatement *stmt);
+const ResultBatch *db_step_batch(DbStatement *stmt);
+int db_column_count(const DbStatement *stmt);
+const char *db_column_name(const DbStatement *stmt, int col);
+const Value *db_column_value(const DbStatement *stmt, int col);
+void db_reset(DbStatement *stmt);
+void db_finalize(DbStatement *stmt);
+const char *db_error_message(const DbStatement *stmt);
+long long db_changes(const DbStatement *stmt);
+
+/* A single SELECT is not run up front: db_step and db_step_batch pull its rows through the
+   plan a batch at a time, so the first rows come back before the last are read and no
+   result is gathered. db_step_batch hands out the next whole batch, column by column:
+
+       const ResultBatch *batch;
+       while ((batch = db_step_batch(stmt)) != NULL) {
+           const Value *ids = db_batch_column(batch, 0);
+           for (int i = 0; i < batch->row_count; i++)
+               total += ids[i].int_val;
+       }
+
+   The values are borrowed from the tables, strings included, and stay valid until the next
+   step, db_reset or db_finalize. The SELECT is one statement from its first step to its
+   last, and nothing may write the tables it reads in between. Anything else runs to the
+   end on its first step, and db_step_batch returns NULL for it. */
+static inline const Value *db_batch_column(const ResultBatch *batch, int col) {
+    return batch->values + (size_t)col * (size_t)batch->capacity;
+}
+
+/* The CLI prints every SELECT's result as a table; programs that read results through
+   db_step or the last query result turn that off. */
+void db_set_print_results(bool print);
+
+/* Runs a statement from inside the executor (EXECUTE): no transaction statement brackets of
+   its own, and the result is left as the last query result. */
+bool db_run(DbStatement *stmt);
+
+bool db_exec(const char *sql);
+void db_stmt_cache_clear(void);
+void db_stmt_cache_get_stats(StmtCacheStats *stats);
+
+#endif
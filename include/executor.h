@@ -5,45 +5,175 @@
 #include "arraylist.h"
 
 void exec_ast(ASTNode *ast);
+void exec_statement(ASTNode *node);
+QueryResult *exec_select_query(const SelectNode *select);
+QueryResult *exec_explain_query(const SelectNode *select);
+uint64_t explain_cycles(void);
+void print_query_plan(const QueryResult *result);
+QueryCursor *exec_select_open(const SelectNode *select);
+const ResultBatch *exec_select_next(QueryCursor *cursor);
+void exec_select_close(QueryCursor *cursor);
+void exec_set_print_results(bool print);
 void free_query_result(QueryResult *result);
 
-void free_row_contents(void *ptr);
 Value copy_string_value(const Value *src);
 
 Value get_column_value(const Row *row, const TableDef *schema, const char *column_name);
 Value get_column_value_by_id(const Row *row, uint16_t column_id);
-Value get_column_value_from_join(const Row *row, const TableDef *left_schema,
-                                 const TableDef *right_schema, int left_col_count,
-                                 const char *column_name);
-Value get_column_value_by_id_from_join(const Row *row, int left_col_count,
-                                       uint8_t table_id, uint16_t column_id,
-                                       uint8_t left_table_id, uint8_t right_table_id);
 bool eval_expression(const Expr *expr, const Row *row, const TableDef *schema);
-bool eval_expression_for_join(const Expr *expr, const Row *row, uint8_t left_table_id,
-                              uint8_t right_table_id, int left_col_count);
+bool eval_expression_false(const Expr *expr, const Row *row, const TableDef *schema);
+bool expr_is_match(const Expr *expr);
+bool eval_match_value(const Expr *expr, const Value *left);
 Value eval_select_expression(Expr *expr, const Row *row, const TableDef *schema);
+Value eval_binary_values(OperatorType op, Value left, Value right);
+Value eval_unary_value(OperatorType op, Value operand);
 Value eval_scalar_function(const Expr *expr, const Row *row, const TableDef *schema);
-bool try_index_filter(Table *table, const Expr *where_expr, ArrayList *result);
+Value eval_scalar_values(ScalarFuncType func_type, const Value *args, int arg_count);
+Value eval_subquery(const Expr *expr, const Row *row, const TableDef *schema);
+bool eval_subquery_condition(const Expr *expr, const Row *row, const TableDef *schema);
+void subquery_statement_end(void);
+void subquery_get_stats(SubqueryStats *stats);
+ExprProgram *expr_compile(Arena *arena, const ArrayList *exprs, const TableDef *schema);
+void expr_program_run(ExprProgram *program, ExecContext *ctx, const RowBatch *batch, int first,
+                      int n);
+const Value *expr_program_output(const ExprProgram *program, int expr, int row);
+void expr_program_release(ExprProgram *program, int n);
+void expr_compile_get_stats(ExprCompileStats *stats);
+bool exec_plan_rows(const PlanNode *plan, ArrayList *out);
+void index_scan_range(const IndexScanPlan *scan, BTreeRange *range);
+int filter_batch(const Table *table, const Expr *expr, int *sel, int n, Row *scratch);
+const ZoneMap *filter_zone_map(const Table *table, const Expr *where);
+bool filter_block_may_match(const ZoneMap *zones, const Expr *expr, int block);
+bool sample_row_kept(const SeqScanPlan *scan, int row);
+int sample_select_rows(const SeqScanPlan *scan, int *ids, int n);
+void filter_cursor_init(FilterCursor *cursor, const Table *table, const Expr *where);
+bool filter_cursor_next(FilterCursor *cursor);
+void filter_cursor_close(FilterCursor *cursor);
+void filter_table_rows(const Table *table, const Expr *where, ArrayList *out);
+void numeric_agg_init(NumericAgg *agg);
+void numeric_agg_add(NumericAgg *agg, double x);
+void numeric_agg_add_int(NumericAgg *agg, long long x);
+void numeric_agg_add_run(NumericAgg *agg, double x, long long count);
+void numeric_agg_add_int_run(NumericAgg *agg, long long x, long long count);
+void numeric_agg_merge(NumericAgg *dst, const NumericAgg *src);
+DataType agg_operand_type(const Expr *operand, const TableDef *schema);
+Value numeric_agg_result(AggFuncType func_type, const NumericAgg *agg, DataType type);
+void keep_extreme(AggFuncType func, Value *kept, bool *has_kept, const Value *value);
+void aggregate_int_vector(const long long *vals, const uint8_t *valid, int n, bool moments,
+                          NumericAgg *out);
+void aggregate_float_vector(const double *vals, const uint8_t *valid, int n, bool moments,
+                            NumericAgg *out);
+const char *agg_kernel_name(void);
+void agg_force_scalar_kernels(bool force);
 void print_pretty_result(QueryResult *result);
+bool output_format_parse(const char *name, OutputFormat *format);
+void result_writer_begin(ResultWriter *writer, FILE *file, OutputFormat format, int col_count,
+                         const char *const *names);
+void result_writer_row(ResultWriter *writer, const Value *first, size_t stride);
+void result_writer_batch(ResultWriter *writer, const ResultBatch *batch);
+void result_writer_end(ResultWriter *writer);
 QueryResult *get_last_query_result(void);
 void set_last_query_result(QueryResult *result);
+long long exec_rows_changed(void);
+void exec_note_rows_changed(long long rows);
 
 void exec_create_table_ast(ASTNode *ast);
 void exec_drop_table_ast(ASTNode *ast);
 void exec_create_index_ast(ASTNode *ast);
 void exec_drop_index_ast(ASTNode *ast);
+void exec_analyze_ast(ASTNode *ast);
+void exec_set_ast(ASTNode *ast);
 
 void exec_insert_row_ast(ASTNode *ast);
 void exec_update_row_ast(ASTNode *ast);
 void exec_delete_row_ast(ASTNode *ast);
+void exec_copy_ast(ASTNode *ast);
+void copy_get_stats(CopyStats *stats);
+void copy_write_csv_value(FILE *file, const Value *val, char delimiter);
+void copy_write_binary_header(FILE *file, int field_count);
+void copy_write_binary_value(FILE *file, const Value *val);
+void exec_prepare_ast(ASTNode *ast);
+void exec_execute_ast(ASTNode *ast);
+void exec_deallocate_ast(ASTNode *ast);
+typedef struct MatView MatView;
+void exec_create_view_ast(ASTNode *ast);
+bool matview_attach(uint16_t table_id, const char *sql);
+void matview_free(MatView *view);
+const char *matview_sql(const MatView *view);
+const char *matview_reader(uint16_t table_id);
+bool matview_writable(const Table *table, const char *statement);
+void matview_sync(uint16_t table_id);
+void matview_row_changed(const Table *table, int row_idx, bool added);
+void matview_row_committed(const Table *table, int row_idx, bool added);
+void matview_get_stats(MatViewStats *stats);
 
-uint16_t exec_join_ast(ASTNode *ast);
-void exec_filter_ast(ASTNode *ast, uint8_t table_id);
-void exec_aggregate_ast(ASTNode *ast, uint8_t table_id);
-void exec_project_ast(ASTNode *ast, uint8_t table_id);
+bool exec_context_init(ExecContext *ctx, const SelectNode *select);
+bool exec_context_init_in(ExecContext *ctx, const SelectNode *select, Arena *arena);
+void exec_context_free(ExecContext *ctx);
+const Row *context_row(ExecContext *ctx, const RowBatch *batch, int k);
+Value context_value(const ExecContext *ctx, const RowBatch *batch, int k, uint16_t column_id);
+void row_batch_init(RowBatch *batch);
+void row_batch_reset(RowBatch *batch, int width);
+void row_batch_free(RowBatch *batch);
+
+Operator *operator_build(const PlanNode *plan, ExecContext *ctx);
+bool operator_open(Operator *op);
+bool operator_next(Operator *op, RowBatch *out);
+void operator_close(Operator *op);
+
+bool hash_join_open(Operator *op);
+bool hash_join_next(Operator *op, RowBatch *out);
+void hash_join_close(Operator *op);
+void hash_join_set_partition_bytes(size_t bytes);
+void hash_join_get_stats(HashJoinStats *stats);
+void hash_join_count_filtered(uint64_t rows);
+int join_filter_apply(const JoinFilter *filters, const Table *table, int *ids, int n,
+                      JoinFilterProbe *probe);
+
+bool bloom_init(BloomFilter *bloom, Arena *arena, int keys);
+void bloom_add(BloomFilter *bloom, uint64_t hash);
+bool bloom_may_contain(const BloomFilter *bloom, uint64_t hash);
+bool nested_loop_join_open(Operator *op);
+bool nested_loop_join_next(Operator *op, RowBatch *out);
+void nested_loop_join_close(Operator *op);
+bool index_nested_loop_join_open(Operator *op);
+bool index_nested_loop_join_next(Operator *op, RowBatch *out);
+void index_nested_loop_join_close(Operator *op);
+bool aggregate_open(Operator *op);
+bool aggregate_next(Operator *op, RowBatch *out);
+void aggregate_close(Operator *op);
+bool hash_aggregate_open(Operator *op);
+bool hash_aggregate_next(Operator *op, RowBatch *out);
+void hash_aggregate_close(Operator *op);
+void hash_agg_get_stats(HashAggStats *stats);
+typedef struct ParallelScan ParallelScan;
+typedef void (*MorselConsumer)(void *arg, int worker, int morsel, ExecContext *ctx,
+                               const RowBatch *batch);
+bool expr_parallel_safe(const Expr *expr);
+bool exprs_parallel_safe(const ArrayList *exprs);
+ParallelScan *parallel_scan_open(Operator *input);
+int parallel_scan_morsels(const ParallelScan *scan);
+int parallel_scan_workers(const ParallelScan *scan);
+void parallel_scan_run(ParallelScan *scan, int first, int count, MorselConsumer consume,
+                       void *arg);
+void parallel_scan_close(ParallelScan *scan);
+bool sort_open(Operator *op);
+bool sort_next(Operator *op, RowBatch *out);
+void sort_close(Operator *op);
+void sort_get_stats(SortStats *stats);
+void exec_set_work_mem(size_t bytes);
+size_t exec_work_mem(void);
+void exec_set_memory_limit(size_t bytes);
+bool exec_memory_exceeded(const ExecContext *ctx, size_t held, int share);
+int spill_partition(uint64_t hash, int level);
+bool spill_write(SpillFile *spill, const void *data, size_t size);
+bool spill_rewind(SpillFile *spill);
+bool spill_read(SpillFile *spill, void *data, size_t size);
+void spill_close(SpillFile *spill);
+bool project_open(Operator *op);
+bool project_next(Operator *op, RowBatch *out);
+void project_close(Operator *op);
 
-extern ArrayList g_agg_res;
-extern bool g_in_agg_context;
 extern QueryResult *g_last_result;
 
 #endif
@@ -1,6 +1,8 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <stdbool.h>
+
 #define COLOR_RESET "\x1b[0m"
 #define COLOR_RED "\x1b[31m"
 #define COLOR_GREEN "\x1b[32m"
@@ -21,10 +23,37 @@ typedef enum {
 
 extern LogLevel g_log_level;
 
+/* Messages below LOG_COMPILED_LEVEL are compiled out: release builds drop LOG_DEBUG, `make
+   debug` (-DDEBUG) keeps it. */
+#ifndef LOG_COMPILED_LEVEL
+#ifdef DEBUG
+#define LOG_COMPILED_LEVEL LOG_DEBUG
+#else
+#define LOG_COMPILED_LEVEL LOG_INFO
+#endif
+#endif
+
+#define LOG_ENABLED(level) ((level) >= LOG_COMPILED_LEVEL && (level) >= g_log_level)
+
+/* The level is tested before the arguments are evaluated, so a filtered message costs one
+   comparison and no formatting. Errors always reach log_write, which records them. */
+#define log_msg(level, ...)                                                                    \
+    do {                                                                                       \
+        if (LOG_ENABLED(level) || (level) == LOG_ERROR)                                        \
+            log_write(level, __VA_ARGS__);                                                     \
+    } while (0)
+
 void set_log_level(LogLevel level);
 LogLevel log_level_from_str(const char *level_str);
-void log_msg(LogLevel level, const char *fmt, ...);
+void log_write(LogLevel level, const char *fmt, ...);
 void show_prominent_error(const char *fmt, ...);
+/* The errors logged by the calling thread, printed or not: how many so far and the text of
+   the last one. A statement that logs an error has failed (see db_error_message). */
+unsigned log_error_count(void);
+const char *log_last_error(void);
+/* Drops the calling thread's messages, errors included, until unmuted: for work whose failure
+   is expected and handled, such as a speculative parse. */
+void log_mute(bool mute);
 void suggest_similar(const char *input, const char *candidates[], int candidate_count, char *output,
                      int output_size);
 
@@ -0,0 +1,80 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Process-wide counters and histograms for the hot paths. Every thread adds to a block of
+   its own, so recording is a load and a store to memory no other thread writes; readers sum
+   the blocks of all threads that ever recorded. */
+typedef enum {
+    METRIC_STATEMENTS,       /* statements executed */
+    METRIC_ROWS_SCANNED,     /* row ids read by table scans, serial and parallel */
+    METRIC_INDEX_PROBES,     /* index point lookups and range scans */
+    METRIC_INDEX_ROWS,       /* row ids they returned */
+    METRIC_JOIN_BUILD_ROWS,  /* rows hashed into hash join build sides */
+    METRIC_JOIN_PROBE_ROWS,  /* rows probed into them */
+    METRIC_ARENA_BLOCKS,     /* arena blocks and pool slabs allocated with malloc */
+    METRIC_ARENA_BYTES,      /* bytes in them */
+    METRIC_SPILL_BYTES,      /* bytes operators wrote to temporary files */
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+typedef enum {
+    METRIC_STATEMENT_US,   /* statement latency, microseconds */
+    METRIC_JOIN_BUILD_SIZE, /* rows of each hash join build side */
+    METRIC_QUERY_MEMORY,    /* peak bytes charged to each query */
+    METRIC_HISTOGRAM_COUNT
+} MetricHistogram;
+
+/* Bucket b of a histogram counts the values v with 2^(b-1) <= v < 2^b (bucket 0: v = 0). */
+#define METRIC_BUCKETS 40
+
+typedef struct MetricsBlock {
+    _Atomic uint64_t counters[METRIC_COUNTER_COUNT];
+    _Atomic uint64_t buckets[METRIC_HISTOGRAM_COUNT][METRIC_BUCKETS];
+    _Atomic uint64_t sums[METRIC_HISTOGRAM_COUNT];
+    _Atomic uint64_t maxima[METRIC_HISTOGRAM_COUNT];
+    struct MetricsBlock *next;
+} MetricsBlock;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[METRIC_BUCKETS];
+} HistogramSnapshot;
+
+typedef struct {
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    HistogramSnapshot histograms[METRIC_HISTOGRAM_COUNT];
+    int threads; /* threads that recorded anything */
+} MetricsSnapshot;
+
+extern _Thread_local MetricsBlock *t_metrics;
+MetricsBlock *metrics_thread_block(void);
+
+/* Relaxed load and store: only the owning thread writes its block. */
+static inline void metric_bump(_Atomic uint64_t *slot, uint64_t n) {
+    atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline void metrics_add(MetricCounter counter, uint64_t n) {
+    MetricsBlock *block = t_metrics ? t_metrics : metrics_thread_block();
+    if (block)
+        metric_bump(&block->counters[counter], n);
+}
+
+void metrics_record(MetricHistogram histogram, uint64_t value);
+void metrics_snapshot(MetricsSnapshot *snapshot);
+uint64_t metrics_percentile(const HistogramSnapshot *histogram, double q);
+void metrics_reset(void);
+const char *metrics_counter_name(MetricCounter counter);
+const char *metrics_histogram_name(MetricHistogram histogram);
+void metrics_dump(FILE *file, bool json);
+uint64_t metrics_now_us(void);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A TCP server for many clients at once. One thread runs an epoll loop that accepts
+   connections and reads and writes their sockets without blocking; a pool of workers takes
+   the connections that have whole requests and runs them. The engine runs one statement at a
+   time, so workers take turns executing while the loop keeps every socket moving, and each
+   connection is a session with its own transaction (see txn_detach).
+
+   Every message is a frame: a 4-byte little-endian length of what follows, a 1-byte type and
+   the payload. A client may send any number of requests without waiting for the answers.
+   They are answered one response each, in order, and the responses to the requests that
+   arrived together are written together.
+
+     SERVER_MSG_QUERY   client  SQL text, one or more statements
+     SERVER_MSG_RESULT  server  per statement, in order, a result set: u16 column count, then
+                                per column a u16 name length and the name; u32 row count; the
+                                values row by row, each encoded as COPY ... (FORMAT BINARY)
+                                writes it (a type tag and payload)
+     SERVER_MSG_ERROR   server  a message; a QUERY gets one instead of its RESULT when one of
+                                its statements does not parse or fails, e.g. on a constraint
+                                violation. The statements before it keep their effects and
+                                the ones after it do not run. A request larger than
+                                SERVER_MAX_FRAME also closes the connection once the error is
+                                sent
+
+   A connection buffers at most one SERVER_MAX_FRAME of input; reading from it pauses until a
+   worker has taken what arrived. */
+#define SERVER_MSG_QUERY 'Q'
+#define SERVER_MSG_RESULT 'R'
+#define SERVER_MSG_ERROR 'E'
+#define SERVER_FRAME_HEADER 5
+#define SERVER_MAX_FRAME (16u << 20)
+#define SERVER_DEFAULT_WORKERS 4
+
+typedef struct Server Server;
+
+typedef struct {
+    uint64_t connections; /* accepted */
+    uint64_t requests;    /* frames answered */
+    uint64_t batches;     /* worker turns, each answering every request it found waiting */
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    int open;             /* connections open now */
+} ServerStats;
+
+Server *server_open(const char *address, int workers);
+int server_port(const Server *server);
+void server_run(Server *server);
+void server_stop(Server *server);
+void server_close(Server *server);
+void server_get_stats(Server *server, ServerStats *stats);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+
+/* Mergeable summaries behind the approximate aggregates. APPROX_COUNT_DISTINCT keeps the
+   hashes of its first HLL_SPARSE_HASHES distinct values, then a HyperLogLog sketch of
+   HLL_REGISTERS one-byte registers (about 1.6% standard error). APPROX_PERCENTILE keeps a
+   KLL sketch: levels of sorted samples, each item of level h standing for 2^h inputs, exact
+   below KLL_K values and within about 1.7% of the rank beyond. Two sketches of the same
+   function merge into one of both inputs, in any order, so per-worker partials and partial
+   groups combine as the exact aggregates' states do. */
+#define HLL_PRECISION 12
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+#define HLL_SPARSE_HASHES 64
+#define KLL_K 200
+
+typedef struct Sketch Sketch;
+
+void hll_add(uint8_t *registers, uint64_t hash);
+uint64_t hll_estimate(const uint8_t *registers);
+
+bool sketch_function(AggFuncType func);
+Sketch *sketch_create(AggFuncType func);
+bool sketch_add(Sketch *sketch, const Value *value);
+bool sketch_merge(Sketch *dst, const Sketch *src);
+Value sketch_result(const Sketch *sketch, AggFuncType func, double fraction);
+void sketch_free(Sketch *sketch);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+
+/* Durable storage for the in-memory catalog: a checkpointed snapshot file made of 4 KiB
+   pages, plus a write-ahead log of the changes made since. Every statement becomes one log
+   frame written with a single write() when it finishes; frames are fsynced in groups of up
+   to WAL_GROUP_COMMIT_MAX statements, and a background flusher syncs a smaller group once
+   WAL_GROUP_COMMIT_USEC microseconds have passed since the last fsync. A statement returns
+   before its fsync, so a power loss can drop the statements of about the last
+   WAL_GROUP_COMMIT_USEC; an explicit COMMIT waits for its own fsync, and a process crash
+   loses nothing. */
+#define STORAGE_PAGE_SIZE 4096
+#define WAL_GROUP_COMMIT_MAX 32
+#define WAL_GROUP_COMMIT_USEC 10000
+#define WAL_CHECKPOINT_BYTES (16 * 1024 * 1024)
+
+#define STORAGE_SNAPSHOT_FILE "snapshot.db"
+#define STORAGE_WAL_FILE "wal.log"
+
+/* A snapshot mapped MAP_PRIVATE: columnar vectors and hash indexes point straight into it,
+   so writes in place are copy-on-write and never reach the file. Each borrower holds a
+   reference and moves its arrays to the heap before resizing them; the mapping goes away
+   with the last reference. */
+typedef struct StorageMap {
+    void *base;
+    size_t length;
+    int refs;
+} StorageMap;
+
+typedef struct {
+    uint64_t commits;     /* log frames written */
+    uint64_t syncs;       /* fsyncs of the log */
+    uint64_t unsynced;    /* frames written since the last fsync */
+    uint64_t checkpoints; /* snapshots written */
+    uint64_t replayed;    /* frames applied by the last storage_open */
+    uint64_t mapped;      /* column vectors and indexes the last storage_open mapped */
+    uint64_t wal_bytes;   /* current log size */
+    uint64_t lsn;         /* sequence number of the last frame */
+} StorageStats;
+
+bool storage_open(const char *dir);
+void storage_close(bool checkpoint);
+bool storage_is_open(void);
+void storage_commit(void);
+bool storage_sync(void);
+bool storage_checkpoint(void);
+void storage_set_group_commit(int max_commits, int interval_usec);
+void storage_get_stats(StorageStats *stats);
+void storage_map_release(StorageMap *map);
+
+void wal_log_create_table(const Table *table);
+void wal_log_drop_table(uint16_t table_id);
+void wal_log_create_index(const Index *index);
+void wal_log_drop_index(const char *index_name);
+void wal_log_create_view(const char *name, const char *sql);
+void wal_log_insert(const Table *table, int row_idx);
+void wal_log_update(const Table *table, int row_idx, uint16_t column_id);
+void wal_log_delete(const Table *table, const bool *keep, int row_count);
+void wal_log_delete_in_place(const Table *table, const bool *keep, int row_count);
+
+#endif
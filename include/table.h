@@ -7,24 +7,141 @@
 
 extern ArrayList tables;
 
-Table *get_table_by_id(uint8_t table_id);
+Table *get_table_by_id(uint16_t table_id);
 Table *find_table(const char *table_name);
-uint8_t find_table_id_by_name(const char *table_name);
+uint16_t find_table_id_by_name(const char *table_name);
+uint16_t next_table_id(void);
 void init_tables(void);
+uint64_t catalog_version(void);
+void catalog_changed(void);
+void catalog_indexes_changed(void);
 void free_table_internal(void *ptr);
 void copy_row(Row *dst, const Row *src, int dst_value_offset);
 Row *create_row(int initial_capacity);
 void free_row(Row *row);
 Table *create_table(const char *name, int initial_row_capacity);
 void free_table(Table *table);
-void index_table(uint8_t table_id, ArrayList *column_ids, const char *index_name);
+void index_table(uint16_t table_id, ArrayList *column_ids, int key_count, const char *index_name,
+                 IndexType type);
 void drop_index_by_name(const char *index_name);
-Index *find_index_by_table_column(uint8_t table_id, uint16_t column_id);
+void drop_table_indexes(uint16_t table_id);
+Index *find_index_by_table_column(uint16_t table_id, uint16_t column_id);
+Index *find_index_by_type(uint16_t table_id, uint16_t column_id, IndexType type);
+Index *table_index(uint16_t table_id, int i);
 void lookup_index_values(const Index *index, const Value *key, ArrayList *result);
+void lookup_index_prefix(const Index *index, const Value *key, int width, ArrayList *result);
+void index_entry_values(const Index *index, const Table *table, int row_idx, Value *out);
+
+bool hash_index_init(Index *index);
+void hash_index_free(Index *index);
+bool hash_index_insert(Index *index, const Value *key, int row_index);
+bool hash_index_delete(Index *index, const Value *key, int row_index);
+void hash_index_remap(Index *index, const int *new_rows);
+void hash_index_lookup(const Index *index, const Value *key, ArrayList *out);
+bool hash_index_contains(const Index *index, const Value *key, int exclude_row);
+bool hash_index_relocatable(const Index *index);
+
+void btree_index_free(Index *index);
+bool btree_bulk_load(Index *index, const Table *table);
+bool btree_insert(Index *index, const Value *key, int row_index);
+bool btree_delete(Index *index, const Value *key, int row_index);
+bool btree_remap_rows(Index *index, const int *new_rows);
+void btree_scan(const Index *index, const BTreeRange *range, ArrayList *out);
+void btree_scan_range(const Index *index, const Value *lo, bool lo_inclusive, const Value *hi,
+                      bool hi_inclusive, ArrayList *out);
+ArrayList *btree_find_range(Index *index, const Value *min_key, const Value *max_key);
+ArrayList *btree_find_equals(Index *index, const Value *key);
+void btree_cursor_open(const Index *index, bool desc, BTreeCursor *cursor);
+void btree_cursor_seek(const Index *index, const BTreeRange *range, BTreeCursor *cursor);
+bool btree_cursor_next(BTreeCursor *cursor, int *row_index);
+bool btree_cursor_entry(BTreeCursor *cursor, int *row_index, const Value **entry);
 Value copy_value(const Value *src);
+Value copy_value_to_arena(Arena *arena, const Value *src);
 void free_value(void *ptr);
 bool check_not_null_constraint(Table *table, int col_idx, Value *val);
 bool check_unique_constraint(Table *table, int col_idx, Value *val, int exclude_row_idx);
 bool check_foreign_key_constraint(Table *table, int col_idx, Value *val);
 
+int table_row_count(const Table *table);
+Value table_get_value(const Table *table, int row_idx, uint16_t column_id);
+const Row *table_fetch_row(const Table *table, int row_idx, Row *scratch);
+bool table_row_init(Table *table, Row *row);
+void table_row_free(Table *table, Row *row);
+bool table_append_row(Table *table, Row *row);
+bool table_append_row_unindexed(Table *table, Row *row);
+void table_index_appended_rows(Table *table, int first_row);
+bool table_set_value(Table *table, int row_idx, uint16_t column_id, Value *val);
+void table_compact_rows(Table *table, const bool *keep);
+void table_delete_rows(Table *table, const bool *keep);
+void table_purge_deleted(Table *table);
+int table_live_row_count(const Table *table);
+
+/* A DELETE leaves compacting for later once fewer than one row in this many is deleted. */
+#define TOMBSTONE_COMPACT_FRACTION 4
+
+static inline bool table_row_deleted(const Table *table, int row_idx) {
+    const Tombstones *dead = table->tombstones;
+    return dead && row_idx < dead->capacity && ((dead->bits[row_idx / 8] >> (row_idx % 8)) & 1);
+}
+
+const ZoneMap *zone_map_get(const Table *table);
+void zone_map_append(Table *table);
+void zone_map_update(Table *table, int row_idx, uint16_t column_id, bool was_null);
+void zone_map_free(Table *table);
+const ColumnZone *zone_map_column(const ZoneMap *map, int block, uint16_t column_id);
+int zone_map_block_rows(const ZoneMap *map, int block);
+void zone_map_count_blocks(uint64_t checked, uint64_t skipped);
+void zone_map_get_stats(ZoneMapStats *out);
+
+bool column_store_init(Table *table);
+void column_store_free(Table *table);
+bool column_store_append_row(Table *table, const Row *row);
+Value column_store_get_value(const Table *table, int row_idx, uint16_t column_id);
+bool column_store_set_value(Table *table, int row_idx, uint16_t column_id, const Value *val);
+void column_store_fetch_row(const Table *table, int row_idx, Row *scratch);
+void column_store_compact(Table *table, const bool *keep);
+size_t column_store_element_size(DataType type);
+const void *column_store_vector_data(const ColumnVector *vec);
+void column_store_map_vector(ColumnVector *vec, int length, void *data, uint8_t *nulls,
+                             char *heap, size_t heap_len, struct StorageMap *map);
+bool column_store_unpack(const ColumnVector *vec, ColumnVector *out);
+void column_store_free_vector(ColumnVector *vec);
+size_t column_store_bytes(const Table *table);
+Value column_segment_value(const ColumnVector *vec, const ColumnSegment *seg, uint64_t word);
+uint32_t column_segment_lower_bound(const ColumnSegment *seg, const char *str, bool upper);
+
+/* The run of a COLUMN_ENC_RLE segment that holds row i. */
+static inline int column_segment_run(const ColumnSegment *seg, int i) {
+    int lo = 0;
+    int hi = seg->run_count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (seg->run_ends[mid] <= i)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* The word of row i of a sealed segment, see ColumnSegment. */
+static inline uint64_t column_segment_word(const ColumnSegment *seg, int i) {
+    if (seg->encoding == COLUMN_ENC_RLE)
+        return seg->words[column_segment_run(seg, i)];
+    if (seg->width == 0)
+        return seg->base;
+    size_t bit = (size_t)i * seg->width;
+    unsigned shift = (unsigned)(bit % 64);
+    uint64_t delta = seg->words[bit / 64] >> shift;
+    if (shift + seg->width > 64)
+        delta |= seg->words[bit / 64 + 1] << (64 - shift);
+    if (seg->width < 64)
+        delta &= (UINT64_C(1) << seg->width) - 1;
+    return seg->base + delta;
+}
+
+static inline const char *column_segment_string(const ColumnSegment *seg, uint32_t code) {
+    return seg->dict_heap + seg->dict_offsets[code];
+}
+
 #endif
@@ -0,0 +1,27 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+
+/* A fixed set of worker threads that run numbered tasks. thread_pool_run hands every
+   participant (the caller is worker 0) an equal contiguous range of task numbers; a worker
+   that runs out steals the upper half of the largest remaining range, so uneven tasks still
+   keep every core busy. Runs started from inside a task execute serially on the caller. */
+typedef void (*PoolTask)(void *arg, int worker, int task);
+
+typedef struct {
+    uint64_t runs;   /* runs spread over more than one worker */
+    uint64_t tasks;  /* tasks those runs executed */
+    uint64_t steals; /* task ranges taken from another worker */
+} PoolStats;
+
+void thread_pool_set_workers(int workers);
+int thread_pool_workers(void);
+void thread_pool_run(int task_count, PoolTask task, void *arg);
+void thread_pool_shutdown(void);
+void thread_pool_get_stats(PoolStats *stats);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef TXN_H
+#define TXN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+
+/* Multi-version concurrency control. Every commit takes the next value of a global commit
+   clock, and while any transaction is open each row of a table written to carries the
+   stamps of the commit that created it (begin) and the one that deleted it (end); see
+   RowVersions. A transaction reads the snapshot of the clock at its BEGIN, so it never sees
+   later commits and never waits for another transaction to finish.
+
+   Isolation is between transactions, not threads. Statements still execute one at a time:
+   the catalog, the last result and the parse context are process-wide, so the caller runs
+   statements under one lock (the server's engine lock) and switches sessions with
+   txn_detach and txn_attach. A reader's statement therefore waits for the statement running
+   before it, writer or not, but never for another transaction to commit.
+
+   Changes not yet committed are stamped TXN_PENDING | transaction id, which is above every
+   commit timestamp, and only their own transaction sees them. There is a single writer at a
+   time: a statement that would write while another transaction holds uncommitted changes
+   fails instead of waiting, and an UPDATE or DELETE of a row changed since the snapshot
+   fails with a serialization error. Versions no open snapshot can see any more are removed
+   between statements, and a table drops its stamps altogether once every row is visible to
+   every snapshot, so tables outside transactions keep updating rows in place. */
+#define TXN_PENDING (1ULL << 63)
+#define TXN_INFINITY UINT64_MAX
+
+typedef struct {
+    uint64_t ts;   /* commits up to and including ts are visible */
+    uint64_t self; /* stamp of the reader's own uncommitted changes, 0 for none */
+} Snapshot;
+
+typedef struct Transaction Transaction;
+
+typedef struct {
+    uint64_t commits;   /* transactions and versioned statements committed */
+    uint64_t rollbacks; /* transactions rolled back */
+    uint64_t conflicts; /* writes refused by the single-writer rule or a newer version */
+    uint64_t reclaimed; /* dead row versions removed */
+    uint64_t clock;     /* last commit timestamp */
+    int open;           /* transactions open now */
+} TxnStats;
+
+bool txn_begin(void);
+bool txn_commit(void);
+bool txn_rollback(void);
+Transaction *txn_current(void);
+Transaction *txn_detach(void);
+void txn_attach(Transaction *txn);
+void txn_shutdown(void);
+void txn_get_stats(TxnStats *stats);
+
+void txn_statement_begin(void);
+void txn_statement_end(void);
+const Snapshot *txn_snapshot(void);
+bool txn_write_access(Table *table, Transaction **writer);
+bool txn_insert_row(Transaction *txn, Table *table, Row *row);
+bool txn_delete_row(Transaction *txn, Table *table, int row_idx);
+bool txn_table_busy(const Table *table);
+int txn_write_mark(const Transaction *txn);
+void txn_rollback_to(Transaction *txn, int mark);
+
+void row_versions_append(Table *table);
+void row_versions_compact(Table *table, const bool *keep);
+void row_versions_free(Table *table);
+bool table_row_visible(const Table *table, int row_idx);
+bool table_row_live(const Table *table, int row_idx);
+int table_visible_rows(const Table *table, int *sel, int n);
+
+#endif
@@ -6,11 +6,30 @@
 extern const Value VAL_NULL;
 extern const Value VAL_ERROR;
 
+static inline const char *value_str(const Value *val) {
+    return val->str_format == VALUE_STR_INLINE ? val->inline_str : val->char_val;
+}
+
+Value make_string_value(const char *str);
+Value string_intern(const char *str);
+bool string_intern_find(const char *str, Value *out);
+uint64_t string_intern_hash(const Value *val);
+int string_intern_count(void);
+
 bool is_null(const Value *val);
 const char *repr(const Value *val);
+const char *repr_into(const Value *val, char *buffer, size_t size);
 bool eval_comparison(Value left, Value right, OperatorType op);
 Value compute_aggregate(AggFuncType func_type, AggState *state, DataType return_type);
 Value convert_value(const Value *val, DataType target_type);
 bool try_convert_value(const Value *val, DataType target_type, Value *out_result);
 
+LikeMatcher *like_compile(Arena *arena, const char *pattern);
+bool like_match(const LikeMatcher *m, const char *text, size_t len);
+bool like_match_value(const LikeMatcher *m, const Value *val);
+bool like_match_pattern(const Value *val, const char *pattern);
+const ValueSet *value_set_build(Arena *arena, const Value *values, int count);
+bool in_list_contains(const Expr *list, const Value *val);
+bool eval_in_list(const Expr *list, const Value *val, bool negated);
+
 #endif
\ No newline at end of file
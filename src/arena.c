@@ -0,0 +1,256 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "metrics.h"
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+static MemoryAccount g_memory;
+
+MemoryAccount *memory_global(void) {
+    return &g_memory;
+}
+
+void memory_account_init(MemoryAccount *account, MemoryAccount *parent) {
+    account->parent = parent;
+    atomic_init(&account->used, 0);
+    atomic_init(&account->peak, 0);
+    atomic_init(&account->limit, 0);
+}
+
+void memory_charge(MemoryAccount *account, size_t bytes) {
+    for (; account; account = account->parent) {
+        size_t used = atomic_fetch_add_explicit(&account->used, bytes, memory_order_relaxed);
+        size_t peak = atomic_load_explicit(&account->peak, memory_order_relaxed);
+        while (used + bytes > peak &&
+               !atomic_compare_exchange_weak_explicit(&account->peak, &peak, used + bytes,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            ;
+    }
+}
+
+void memory_uncharge(MemoryAccount *account, size_t bytes) {
+    for (; account; account = account->parent)
+        atomic_fetch_sub_explicit(&account->used, bytes, memory_order_relaxed);
+}
+
+/* For memory an owner measures rather than allocates through an arena: moves its charge,
+   *charged, to bytes. */
+void memory_track(MemoryAccount *account, size_t *charged, size_t bytes) {
+    if (bytes > *charged)
+        memory_charge(account, bytes - *charged);
+    else
+        memory_uncharge(account, *charged - bytes);
+    *charged = bytes;
+}
+
+/* Whether account or any account above it is over its limit. */
+bool memory_exceeded(const MemoryAccount *account) {
+    for (; account; account = account->parent) {
+        size_t limit = atomic_load_explicit(&account->limit, memory_order_relaxed);
+        if (limit > 0 && atomic_load_explicit(&account->used, memory_order_relaxed) > limit)
+            return true;
+    }
+    return false;
+}
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static ArenaBlock *new_block(size_t size, MemoryAccount *account) {
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+    if (!block) {
+        log_msg(LOG_ERROR, "arena_alloc: Failed to allocate a %zu byte block", size);
+        return NULL;
+    }
+    block->prev = NULL;
+    block->account = account ? account : &g_memory;
+    block->size = size;
+    block->used = 0;
+    memory_charge(block->account, sizeof(ArenaBlock) + size);
+    metrics_add(METRIC_ARENA_BLOCKS, 1);
+    metrics_add(METRIC_ARENA_BYTES, sizeof(ArenaBlock) + size);
+    return block;
+}
+
+static void free_block(ArenaBlock *block) {
+    memory_uncharge(block->account, sizeof(ArenaBlock) + block->size);
+    free(block);
+}
+
+void arena_init(Arena *arena, size_t block_size) {
+    arena->head = NULL;
+    arena->block_size = block_size > 0 ? align_up(block_size) : ARENA_BLOCK_SIZE;
+    arena->account = NULL;
+}
+
+/* An arena whose own struct lives at the start of its first block, so short-lived owners
+   such as a parsed statement pay a single malloc. Release it with arena_destroy only; a
+   reset would hand out the memory holding the struct. */
+Arena *arena_create(size_t block_size) {
+    Arena local;
+    arena_init(&local, block_size);
+    Arena *arena = arena_alloc(&local, sizeof(Arena));
+    if (arena)
+        *arena = local;
+    else
+        arena_destroy(&local);
+    return arena;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_up(size > 0 ? size : 1);
+    ArenaBlock *head = arena->head;
+    if (!head || head->size - head->used < size) {
+        ArenaBlock *block = new_block(size > arena->block_size ? size : arena->block_size,
+                                      arena->account);
+        if (!block)
+            return NULL;
+        block->prev = head;
+        arena->head = head = block;
+    }
+    void *ptr = (unsigned char *)head->data + head->used;
+    head->used += size;
+    return ptr;
+}
+
+void *arena_calloc(Arena *arena, size_t count, size_t size) {
+    if (size > 0 && count > SIZE_MAX / size)
+        return NULL;
+    void *ptr = arena_alloc(arena, count * size);
+    if (ptr)
+        memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void *arena_memdup(Arena *arena, const void *src, size_t size) {
+    void *ptr = arena_alloc(arena, size);
+    if (ptr && size > 0)
+        memcpy(ptr, src, size);
+    return ptr;
+}
+
+char *arena_strdup(Arena *arena, const char *str) {
+    return str ? arena_memdup(arena, str, strlen(str) + 1) : NULL;
+}
+
+ArenaMark arena_mark(const Arena *arena) {
+    ArenaMark mark = {arena->head, arena->head ? arena->head->used : 0};
+    return mark;
+}
+
+/* Frees everything allocated since mark. The oldest block is kept for reuse, so an arena
+   that is marked and released around every statement stops calling malloc once it is warm;
+   its charge moves to the process-wide account. */
+void arena_release(Arena *arena, ArenaMark mark) {
+    while (arena->head && arena->head != mark.block) {
+        ArenaBlock *block = arena->head;
+        if (!block->prev && !mark.block && block->size == arena->block_size) {
+            block->used = 0;
+            if (block->account != &g_memory) {
+                memory_uncharge(block->account, sizeof(ArenaBlock) + block->size);
+                block->account = &g_memory;
+                memory_charge(block->account, sizeof(ArenaBlock) + block->size);
+            }
+            return;
+        }
+        arena->head = block->prev;
+        free_block(block);
+    }
+    if (arena->head)
+        arena->head->used = mark.used;
+}
+
+void arena_reset(Arena *arena) {
+    ArenaMark start = {NULL, 0};
+    arena_release(arena, start);
+}
+
+void arena_destroy(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    arena->head = NULL;
+    while (block) {
+        ArenaBlock *prev = block->prev;
+        free_block(block);
+        block = prev;
+    }
+}
+
+size_t arena_bytes_used(const Arena *arena) {
+    size_t used = 0;
+    for (const ArenaBlock *block = arena->head; block; block = block->prev)
+        used += block->used;
+    return used;
+}
+
+void pool_init(Pool *pool, size_t element_size) {
+    if (element_size < sizeof(void *))
+        element_size = sizeof(void *);
+    pool->element_size = align_up(element_size);
+    pool->next_slab_count = POOL_SLAB_MIN;
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->live = 0;
+    pool->bytes = 0;
+}
+
+static bool pool_grow(Pool *pool) {
+    int count = pool->next_slab_count;
+    PoolSlab *slab = malloc(sizeof(PoolSlab) + pool->element_size * (size_t)count);
+    if (!slab) {
+        log_msg(LOG_ERROR, "pool_alloc: Failed to allocate a slab of %d elements", count);
+        return false;
+    }
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->bytes += sizeof(PoolSlab) + pool->element_size * (size_t)count;
+    memory_charge(&g_memory, sizeof(PoolSlab) + pool->element_size * (size_t)count);
+    metrics_add(METRIC_ARENA_BLOCKS, 1);
+    metrics_add(METRIC_ARENA_BYTES, sizeof(PoolSlab) + pool->element_size * (size_t)count);
+    if (pool->next_slab_count < POOL_SLAB_MAX)
+        pool->next_slab_count *= 2;
+
+    unsigned char *base = (unsigned char *)slab->data;
+    for (int i = count - 1; i >= 0; i--) {
+        void **element = (void **)(base + (size_t)i * pool->element_size);
+        *element = pool->free_list;
+        pool->free_list = element;
+    }
+    return true;
+}
+
+void *pool_alloc(Pool *pool) {
+    if (!pool->free_list && !pool_grow(pool))
+        return NULL;
+    void **element = pool->free_list;
+    pool->free_list = *element;
+    pool->live++;
+    return element;
+}
+
+void pool_free(Pool *pool, void *ptr) {
+    if (!ptr)
+        return;
+    *(void **)ptr = pool->free_list;
+    pool->free_list = ptr;
+    pool->live--;
+}
+
+void pool_destroy(Pool *pool) {
+    PoolSlab *slab = pool->slabs;
+    while (slab) {
+        PoolSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->live = 0;
+    memory_uncharge(&g_memory, pool->bytes);
+    pool->bytes = 0;
+}
@@ -0,0 +1,250 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "arraylist.h"
+#include "bench.h"
+#include "db.h"
+#include "dbapi.h"
+#include "logger.h"
+#include "storage.h"
+#include "table.h"
+#include "thread_pool.h"
+#include "txn.h"
+
+double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* False when --only filters the benchmark out; the caller then skips it. */
+bool bench_begin(BenchRun *run, const BenchConfig *config, const char *name,
+                 long long rows_per_op) {
+    if (config->only && strncmp(name, config->only, strlen(config->only)) != 0)
+        return false;
+    memset(run, 0, sizeof(BenchRun));
+    run->name = name;
+    run->rows_per_op = rows_per_op;
+    return true;
+}
+
+/* Whether --only can select anything in the group ("tpch."), so its data is worth loading. */
+bool bench_wanted(const BenchConfig *config, const char *group) {
+    if (!config->only)
+        return true;
+    size_t n = strlen(config->only) < strlen(group) ? strlen(config->only) : strlen(group);
+    return strncmp(config->only, group, n) == 0;
+}
+
+void bench_sample(BenchRun *run, double seconds) {
+    if (run->count == run->capacity) {
+        int capacity = run->capacity > 0 ? run->capacity * 2 : 64;
+        double *samples = realloc(run->samples, sizeof(double) * (size_t)capacity);
+        if (!samples)
+            return;
+        run->samples = samples;
+        run->capacity = capacity;
+    }
+    run->samples[run->count++] = seconds;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double percentile(const double *sorted, int count, double q) {
+    int i = (int)ceil(q * count) - 1;
+    return sorted[i < 0 ? 0 : (i >= count ? count - 1 : i)];
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+void bench_report(BenchRun *run) {
+    if (run->count == 0) {
+        free(run->samples);
+        return;
+    }
+    double total = 0;
+    for (int i = 0; i < run->count; i++)
+        total += run->samples[i];
+    qsort(run->samples, (size_t)run->count, sizeof(double), compare_doubles);
+    double ops_per_sec = total > 0 ? run->count / total : 0;
+    printf("{\"bench\":\"%s\",\"ops\":%d,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+           "\"rows_per_sec\":%.1f,\"mean_us\":%.3f,\"p50_us\":%.3f,\"p95_us\":%.3f,"
+           "\"p99_us\":%.3f,\"max_us\":%.3f,\"peak_rss_kb\":%ld}\n",
+           run->name, run->count, total, ops_per_sec, ops_per_sec * (double)run->rows_per_op,
+           total / run->count * 1e6, percentile(run->samples, run->count, 0.50) * 1e6,
+           percentile(run->samples, run->count, 0.95) * 1e6,
+           percentile(run->samples, run->count, 0.99) * 1e6, run->samples[run->count - 1] * 1e6,
+           peak_rss_kb());
+    fflush(stdout);
+    free(run->samples);
+    run->samples = NULL;
+}
+
+/* splitmix64 seeding a xorshift64* stream. */
+void bench_rng_init(BenchRng *rng, uint64_t seed) {
+    uint64_t z = seed + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    rng->state = (z ^ (z >> 31)) | 1;
+}
+
+uint64_t bench_rand(BenchRng *rng) {
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return rng->state * 0x2545f4914f6cdd1dull;
+}
+
+int bench_rand_int(BenchRng *rng, int n) {
+    return n > 0 ? (int)(bench_rand(rng) % (uint64_t)n) : 0;
+}
+
+double bench_rand_double(BenchRng *rng) {
+    return (double)(bench_rand(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+bool bench_zipf_init(BenchZipf *zipf, int n, double skew) {
+    zipf->n = n > 0 ? n : 1;
+    zipf->cdf = NULL;
+    if (skew <= 0)
+        return true;
+    zipf->cdf = malloc(sizeof(double) * (size_t)zipf->n);
+    if (!zipf->cdf)
+        return false;
+    double sum = 0;
+    for (int k = 0; k < zipf->n; k++) {
+        sum += 1.0 / pow(k + 1, skew);
+        zipf->cdf[k] = sum;
+    }
+    for (int k = 0; k < zipf->n; k++)
+        zipf->cdf[k] /= sum;
+    return true;
+}
+
+int bench_zipf_next(const BenchZipf *zipf, BenchRng *rng) {
+    if (!zipf->cdf)
+        return bench_rand_int(rng, zipf->n);
+    double u = bench_rand_double(rng);
+    int lo = 0;
+    int hi = zipf->n - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (zipf->cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void bench_zipf_free(BenchZipf *zipf) {
+    free(zipf->cdf);
+    zipf->cdf = NULL;
+}
+
+long long bench_run_sql(const char *sql) {
+    DbStatement *stmt = db_prepare(sql);
+    if (!stmt) {
+        log_msg(LOG_ERROR, "bench_run_sql: Cannot prepare '%s'", sql);
+        return -1;
+    }
+    long long rows = 0;
+    bool streamed = false;
+    for (const ResultBatch *batch; (batch = db_step_batch(stmt)) != NULL; streamed = true)
+        rows += batch->row_count;
+    while (!streamed && db_step(stmt) == DB_ROW)
+        rows++;
+    db_finalize(stmt);
+    return rows;
+}
+
+void bench_drop_tables(void) {
+    while (alist_length(&tables) > 0) {
+        char sql[MAX_TABLE_NAME_LEN + 16];
+        snprintf(sql, sizeof(sql), "DROP TABLE %s;",
+                 ((Table *)alist_get(&tables, alist_length(&tables) - 1))->name);
+        if (bench_run_sql(sql) < 0)
+            break;
+    }
+}
+
+static void print_usage(void) {
+    printf("Usage: bench_db [OPTIONS]\n");
+    printf("  Benchmarks of the database engine, one JSON line per result\n\n");
+    printf("Options:\n");
+    printf("  --rows N         Rows in the main generated table (default: 100000)\n");
+    printf("  --cardinality N  Distinct keys in generated key columns (default: 1000)\n");
+    printf("  --skew S         Zipf exponent of key draws, 0 for uniform (default: 0)\n");
+    printf("  --iterations N   Runs of each query benchmark (default: 10)\n");
+    printf("  --seed N         Seed of the data and key generators (default: 42)\n");
+    printf("  --threads N      Scan with N worker threads (default: one per CPU)\n");
+    printf("  --only PREFIX    Run only benchmarks whose name starts with PREFIX\n");
+    printf("  --show-logs      Show debug and info logs\n");
+    printf("  --help, -h       Show this help message\n");
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig config = {100000, 1000, 0.0, 10, 42, NULL};
+    bool show_logs = false;
+
+    init_tables();
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *next = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--show-logs") == 0) {
+            show_logs = true;
+        } else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            print_usage();
+            return 0;
+        } else if (!next) {
+            print_usage();
+            return 1;
+        } else if (strcmp(arg, "--rows") == 0 && atoi(next) > 0) {
+            config.rows = atoi(argv[++i]);
+        } else if (strcmp(arg, "--cardinality") == 0 && atoi(next) > 0) {
+            config.cardinality = atoi(argv[++i]);
+        } else if (strcmp(arg, "--skew") == 0 && atof(next) >= 0) {
+            config.skew = atof(argv[++i]);
+        } else if (strcmp(arg, "--iterations") == 0 && atoi(next) > 0) {
+            config.iterations = atoi(argv[++i]);
+        } else if (strcmp(arg, "--seed") == 0) {
+            config.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--threads") == 0 && atoi(next) > 0) {
+            thread_pool_set_workers(atoi(argv[++i]));
+        } else if (strcmp(arg, "--only") == 0) {
+            config.only = argv[++i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    set_log_level(show_logs ? LOG_DEBUG : LOG_NONE);
+    db_set_print_results(false);
+
+    printf("{\"config\":{\"rows\":%d,\"cardinality\":%d,\"skew\":%g,\"iterations\":%d,"
+           "\"seed\":%llu}}\n",
+           config.rows, config.cardinality, config.skew, config.iterations,
+           (unsigned long long)config.seed);
+    bench_micro(&config);
+    bench_workloads(&config);
+
+    bench_drop_tables();
+    txn_shutdown();
+    thread_pool_shutdown();
+    storage_close(true);
+    alist_destroy(&tables);
+    return 0;
+}
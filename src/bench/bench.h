@@ -0,0 +1,67 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* bin/bench_db: synthetic data, micro-benchmarks of single engine calls and macro workloads
+   (TPC-H-like queries, point-lookup OLTP). Every result is one JSON line on stdout, so runs
+   before and after a change can be diffed or loaded into a script. */
+
+typedef struct {
+    int rows;          /* rows in the main generated table */
+    int cardinality;   /* distinct keys in generated key columns */
+    double skew;       /* Zipf exponent of key draws; 0 is uniform */
+    int iterations;    /* runs of each query benchmark; point operations run 1000x as many */
+    uint64_t seed;     /* the same seed generates the same data and the same key draws */
+    const char *only;  /* run only benchmarks whose name starts with this */
+} BenchConfig;
+
+/* One benchmark: a latency sample per operation, reported as throughput and percentiles. */
+typedef struct {
+    const char *name;
+    long long rows_per_op; /* rows each operation reads or writes, for rows_per_sec */
+    double *samples;       /* seconds */
+    int count;
+    int capacity;
+} BenchRun;
+
+typedef struct {
+    uint64_t state;
+} BenchRng;
+
+/* Draws keys 0..n-1 with probability proportional to 1 / (k + 1)^skew, from a CDF table. */
+typedef struct {
+    int n;
+    double *cdf; /* NULL when uniform */
+} BenchZipf;
+
+double bench_now(void);
+bool bench_begin(BenchRun *run, const BenchConfig *config, const char *name,
+                 long long rows_per_op);
+void bench_sample(BenchRun *run, double seconds);
+void bench_report(BenchRun *run);
+bool bench_wanted(const BenchConfig *config, const char *group);
+
+void bench_rng_init(BenchRng *rng, uint64_t seed);
+uint64_t bench_rand(BenchRng *rng);
+int bench_rand_int(BenchRng *rng, int n);
+double bench_rand_double(BenchRng *rng);
+bool bench_zipf_init(BenchZipf *zipf, int n, double skew);
+int bench_zipf_next(const BenchZipf *zipf, BenchRng *rng);
+void bench_zipf_free(BenchZipf *zipf);
+
+/* Runs a statement to the end without printing it; returns the rows it produced, or -1. */
+long long bench_run_sql(const char *sql);
+
+/* Generators load through COPY FROM a temporary CSV file, so even large tables load fast. */
+bool bench_load_facts(const BenchConfig *config, const char *table, int rows);
+bool bench_load_dims(const BenchConfig *config, const char *table);
+bool bench_load_accounts(const BenchConfig *config, const char *table, int rows);
+bool bench_load_tpch(const BenchConfig *config);
+void bench_drop_tables(void);
+
+void bench_micro(const BenchConfig *config);
+void bench_workloads(const BenchConfig *config);
+
+#endif
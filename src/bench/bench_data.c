@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "logger.h"
+
+/* Generated tables. Key columns draw from BenchZipf over config->cardinality (or the parent
+   table's keys), so --skew moves every join and GROUP BY from uniform to hot keys. */
+
+static FILE *open_csv(char *path) {
+    snprintf(path, 64, "/tmp/bench_db_XXXXXX");
+    int fd = mkstemp(path);
+    FILE *file = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!file)
+        log_msg(LOG_ERROR, "bench: Cannot create a temporary file");
+    return file;
+}
+
+/* Creates the table and loads the CSV into it, removing the file either way. */
+static bool load_csv(FILE *file, const char *path, const char *create, const char *table) {
+    bool ok = fclose(file) == 0 && bench_run_sql(create) >= 0;
+    char sql[128];
+    snprintf(sql, sizeof(sql), "COPY %s FROM '%s';", table, path);
+    ok = ok && bench_run_sql(sql) >= 0;
+    unlink(path);
+    if (!ok)
+        log_msg(LOG_ERROR, "bench: Cannot load '%s'", table);
+    return ok;
+}
+
+static void write_date(FILE *file, BenchRng *rng) {
+    fprintf(file, "%04d-%02d-%02d", 1992 + bench_rand_int(rng, 7), 1 + bench_rand_int(rng, 12),
+            1 + bench_rand_int(rng, 28));
+}
+
+/* facts (id, k, tag, v): k is a skewed key in [0, cardinality), tag one of 64 strings. */
+bool bench_load_facts(const BenchConfig *config, const char *table, int rows) {
+    char path[64];
+    FILE *file = open_csv(path);
+    BenchZipf keys;
+    if (!file || !bench_zipf_init(&keys, config->cardinality, config->skew))
+        return false;
+    BenchRng rng;
+    bench_rng_init(&rng, config->seed);
+    for (int i = 0; i < rows; i++) {
+        int k = bench_zipf_next(&keys, &rng);
+        fprintf(file, "%d,%d,tag-%d,%.2f\n", i, k, k % 64, bench_rand_double(&rng) * 1000);
+    }
+    bench_zipf_free(&keys);
+    char create[128];
+    snprintf(create, sizeof(create), "CREATE TABLE %s (id INT, k INT, tag STRING, v FLOAT);",
+             table);
+    return load_csv(file, path, create, table);
+}
+
+/* dims (d_k, d_name, d_group): one row per key of facts. */
+bool bench_load_dims(const BenchConfig *config, const char *table) {
+    char path[64];
+    FILE *file = open_csv(path);
+    if (!file)
+        return false;
+    for (int k = 0; k < config->cardinality; k++)
+        fprintf(file, "%d,name-%d,%d\n", k, k, k % 10);
+    char create[128];
+    snprintf(create, sizeof(create),
+             "CREATE TABLE %s (d_k INT PRIMARY KEY, d_name STRING, d_group INT);", table);
+    return load_csv(file, path, create, table);
+}
+
+/* accounts (id, owner, branch, balance) for the point-lookup workload. */
+bool bench_load_accounts(const BenchConfig *config, const char *table, int rows) {
+    char path[64];
+    FILE *file = open_csv(path);
+    if (!file)
+        return false;
+    BenchRng rng;
+    bench_rng_init(&rng, config->seed + 1);
+    for (int i = 0; i < rows; i++)
+        fprintf(file, "%d,owner-%d,%d,%d\n", i, i, bench_rand_int(&rng, 100),
+                bench_rand_int(&rng, 100000));
+    char create[160];
+    snprintf(create, sizeof(create),
+             "CREATE TABLE %s (id INT PRIMARY KEY, owner STRING, branch INT, balance INT);",
+             table);
+    return load_csv(file, path, create, table);
+}
+
+/* A TPC-H-shaped schema scaled by config->rows lineitems: a customer per 60 lineitems and
+   an order per 4, with orders drawn over customers and lineitems over orders. */
+bool bench_load_tpch(const BenchConfig *config) {
+    static const char *segments[] = {"AUTOMOBILE", "BUILDING", "FURNITURE", "HOUSEHOLD",
+                                     "MACHINERY"};
+    static const char *priorities[] = {"1-URGENT", "2-HIGH", "3-MEDIUM", "4-NOT SPECIFIED",
+                                       "5-LOW"};
+    int customers = config->rows / 60 > 10 ? config->rows / 60 : 10;
+    int orders = config->rows / 4 > 10 ? config->rows / 4 : 10;
+    BenchRng rng;
+    bench_rng_init(&rng, config->seed + 2);
+
+    char path[64];
+    FILE *file = open_csv(path);
+    if (!file)
+        return false;
+    for (int c = 0; c < customers; c++)
+        fprintf(file, "%d,Customer#%d,%s,%d\n", c, c, segments[bench_rand_int(&rng, 5)],
+                bench_rand_int(&rng, 25));
+    if (!load_csv(file, path,
+                  "CREATE TABLE customer (c_custkey INT PRIMARY KEY, c_name STRING, "
+                  "c_segment STRING, c_nation INT);",
+                  "customer"))
+        return false;
+
+    BenchZipf keys;
+    if (!(file = open_csv(path)) || !bench_zipf_init(&keys, customers, config->skew))
+        return false;
+    for (int o = 0; o < orders; o++) {
+        fprintf(file, "%d,%d,", o, bench_zipf_next(&keys, &rng));
+        write_date(file, &rng);
+        fprintf(file, ",%s,%.2f\n", priorities[bench_rand_int(&rng, 5)],
+                bench_rand_double(&rng) * 500000);
+    }
+    bench_zipf_free(&keys);
+    if (!load_csv(file, path,
+                  "CREATE TABLE orders (o_orderkey INT PRIMARY KEY, o_custkey INT, o_date DATE, "
+                  "o_priority STRING, o_total FLOAT);",
+                  "orders"))
+        return false;
+
+    if (!(file = open_csv(path)) || !bench_zipf_init(&keys, orders, config->skew))
+        return false;
+    static const char flags[] = "ANR";
+    for (int i = 0; i < config->rows; i++) {
+        int quantity = 1 + bench_rand_int(&rng, 50);
+        fprintf(file, "%d,%d,%d,%.2f,%.2f,%.2f,%c,%c,", bench_zipf_next(&keys, &rng),
+                bench_rand_int(&rng, 200000), quantity,
+                quantity * (900 + bench_rand_double(&rng) * 1100), bench_rand_int(&rng, 11) / 100.0,
+                bench_rand_int(&rng, 9) / 100.0, flags[bench_rand_int(&rng, 3)],
+                bench_rand_int(&rng, 2) ? 'F' : 'O');
+        write_date(file, &rng);
+        fputc('\n', file);
+    }
+    bench_zipf_free(&keys);
+    return load_csv(file, path,
+                    "CREATE TABLE lineitem (l_orderkey INT, l_partkey INT, l_quantity INT, "
+                    "l_price FLOAT, l_discount FLOAT, l_tax FLOAT, l_flag STRING, "
+                    "l_status STRING, l_shipdate DATE);",
+                    "lineitem");
+}
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arraylist.h"
+#include "bench.h"
+#include "db.h"
+#include "dbapi.h"
+#include "logger.h"
+#include "table.h"
+
+/* Micro-benchmarks: one engine entry point each, over facts (config->rows rows) and dims
+   (one row per key). */
+
+static const char *PARSE_SQL =
+    "SELECT k, tag, SUM(v) AS total, COUNT(*) FROM facts WHERE v > 10.5 AND tag LIKE 'tag-1%' "
+    "AND k IN (1, 2, 3, 5, 8, 13) GROUP BY k, tag HAVING COUNT(*) > 1 ORDER BY total DESC "
+    "LIMIT 10;";
+
+static void bench_tokenize(const BenchConfig *config) {
+    BenchRun run;
+    if (!bench_begin(&run, config, "micro.tokenize", 0))
+        return;
+    for (int i = 0; i < config->iterations * 1000; i++) {
+        double start = bench_now();
+        free_tokens(tokenize(PARSE_SQL));
+        bench_sample(&run, bench_now() - start);
+    }
+    bench_report(&run);
+}
+
+static void bench_parse(const BenchConfig *config) {
+    BenchRun run;
+    if (!bench_begin(&run, config, "micro.parse", 0))
+        return;
+    Token *tokens = tokenize(PARSE_SQL);
+    for (int i = 0; tokens && i < config->iterations * 1000; i++) {
+        double start = bench_now();
+        free_ast(parse_ex(PARSE_SQL, tokens));
+        bench_sample(&run, bench_now() - start);
+    }
+    free_tokens(tokens);
+    bench_report(&run);
+}
+
+static void bench_index_build(const BenchConfig *config, const char *name, IndexType type) {
+    BenchRun run;
+    if (!bench_begin(&run, config, name, config->rows))
+        return;
+    ArrayList column_ids;
+    alist_init(&column_ids, sizeof(uint16_t), NULL);
+    *(uint16_t *)alist_append(&column_ids) = 1;
+    uint16_t table_id = find_table("facts")->table_id;
+    for (int i = 0; i < config->iterations; i++) {
+        double start = bench_now();
+        index_table(table_id, &column_ids, 1, "bench_build", type);
+        bench_sample(&run, bench_now() - start);
+        drop_index_by_name("bench_build");
+    }
+    alist_destroy(&column_ids);
+    bench_report(&run);
+}
+
+static void bench_index_lookup(const BenchConfig *config, const char *name, IndexType type) {
+    BenchRun run;
+    if (!bench_begin(&run, config, name, 1))
+        return;
+    ArrayList column_ids;
+    alist_init(&column_ids, sizeof(uint16_t), NULL);
+    *(uint16_t *)alist_append(&column_ids) = 1;
+    index_table(find_table("facts")->table_id, &column_ids, 1, "bench_lookup", type);
+    alist_destroy(&column_ids);
+    const Index *index = find_index("bench_lookup");
+
+    BenchZipf keys;
+    BenchRng rng;
+    ArrayList rows;
+    alist_init(&rows, sizeof(int), NULL);
+    bench_rng_init(&rng, config->seed + 10);
+    if (index && bench_zipf_init(&keys, config->cardinality, config->skew)) {
+        Value key = {0};
+        key.type = TYPE_INT;
+        for (int i = 0; i < config->iterations * 1000; i++) {
+            key.int_val = bench_zipf_next(&keys, &rng);
+            double start = bench_now();
+            lookup_index_values(index, &key, &rows);
+            bench_sample(&run, bench_now() - start);
+            alist_clear(&rows);
+        }
+        bench_zipf_free(&keys);
+    }
+    alist_destroy(&rows);
+    drop_index_by_name("bench_lookup");
+    bench_report(&run);
+}
+
+static void bench_query(const BenchConfig *config, const char *name, long long rows_per_op,
+                        const char *sql) {
+    BenchRun run;
+    if (!bench_begin(&run, config, name, rows_per_op))
+        return;
+    for (int i = 0; i < config->iterations; i++) {
+        double start = bench_now();
+        if (bench_run_sql(sql) < 0)
+            break;
+        bench_sample(&run, bench_now() - start);
+    }
+    bench_report(&run);
+}
+
+/* Row-at-a-time INSERTs through one prepared statement, then range DELETEs over them. */
+static void bench_insert_delete(const BenchConfig *config) {
+    if (bench_run_sql("CREATE TABLE scratch (id INT, k INT, tag STRING, v FLOAT);") < 0)
+        return;
+    int rows = config->iterations * 1000;
+    BenchRun run;
+    if (bench_begin(&run, config, "micro.dml.insert", 1)) {
+        DbStatement *stmt = db_prepare("INSERT INTO scratch VALUES (?, ?, ?, ?);");
+        char tag[32];
+        for (int i = 0; stmt && i < rows; i++) {
+            double start = bench_now();
+            snprintf(tag, sizeof(tag), "tag-%d", i % 64);
+            db_bind_int(stmt, 1, i);
+            db_bind_int(stmt, 2, i % config->cardinality);
+            db_bind_text(stmt, 3, tag);
+            db_bind_float(stmt, 4, i * 0.5);
+            db_step(stmt);
+            bench_sample(&run, bench_now() - start);
+            db_reset(stmt);
+        }
+        db_finalize(stmt);
+        bench_report(&run);
+    }
+    if (bench_begin(&run, config, "micro.dml.delete", rows / config->iterations)) {
+        DbStatement *stmt = db_prepare("DELETE FROM scratch WHERE id >= ? AND id < ?;");
+        int chunk = rows / config->iterations;
+        for (int i = 0; stmt && i < config->iterations; i++) {
+            double start = bench_now();
+            db_bind_int(stmt, 1, i * chunk);
+            db_bind_int(stmt, 2, (i + 1) * chunk);
+            db_step(stmt);
+            bench_sample(&run, bench_now() - start);
+            db_reset(stmt);
+        }
+        db_finalize(stmt);
+        bench_report(&run);
+    }
+    bench_run_sql("DROP TABLE scratch;");
+}
+
+static void bench_update(const BenchConfig *config) {
+    BenchRun run;
+    if (!bench_begin(&run, config, "micro.dml.update", config->rows))
+        return;
+    DbStatement *stmt = db_prepare("UPDATE facts SET v = v + 1 WHERE k = ?;");
+    BenchZipf keys;
+    BenchRng rng;
+    bench_rng_init(&rng, config->seed + 11);
+    long long changed = 0;
+    bool ok = true;
+    if (stmt && bench_zipf_init(&keys, config->cardinality, config->skew)) {
+        for (int i = 0; ok && i < config->iterations; i++) {
+            int key = bench_zipf_next(&keys, &rng);
+            double start = bench_now();
+            db_bind_int(stmt, 1, key);
+            ok = db_step(stmt) == DB_DONE;
+            bench_sample(&run, bench_now() - start);
+            changed += db_changes(stmt);
+            db_reset(stmt);
+        }
+        /* Keys are drawn as the rows were, so a run that changed nothing measured nothing. */
+        if (!ok || changed == 0) {
+            log_msg(LOG_ERROR, "bench: micro.dml.update failed or changed no rows; no timing "
+                               "reported");
+            run.count = 0;
+        }
+        bench_zipf_free(&keys);
+    }
+    db_finalize(stmt);
+    bench_report(&run);
+}
+
+void bench_micro(const BenchConfig *config) {
+    if (!bench_wanted(config, "micro."))
+        return;
+    double start = bench_now();
+    if (!bench_load_facts(config, "facts", config->rows) || !bench_load_dims(config, "dims")) {
+        bench_drop_tables();
+        return;
+    }
+    printf("{\"load\":\"facts\",\"rows\":%d,\"seconds\":%.6f}\n", config->rows,
+           bench_now() - start);
+
+    bench_tokenize(config);
+    bench_parse(config);
+    bench_index_build(config, "micro.index_build.hash", INDEX_TYPE_HASH);
+    bench_index_build(config, "micro.index_build.btree", INDEX_TYPE_BTREE);
+    bench_index_lookup(config, "micro.index_lookup.hash", INDEX_TYPE_HASH);
+    bench_index_lookup(config, "micro.index_lookup.btree", INDEX_TYPE_BTREE);
+    bench_query(config, "micro.scan.filter", config->rows,
+                "SELECT id FROM facts WHERE v < 10.0 AND tag = 'tag-7';");
+    bench_query(config, "micro.hash_join", config->rows,
+                "SELECT COUNT(*), SUM(v) FROM facts JOIN dims ON k = d_k WHERE d_group < 5;");
+    bench_query(config, "micro.aggregate", config->rows,
+                "SELECT COUNT(*), SUM(v), MIN(v), MAX(v), AVG(v) FROM facts;");
+    bench_query(config, "micro.group_by", config->rows,
+                "SELECT k, COUNT(*), SUM(v) FROM facts GROUP BY k;");
+    bench_query(config, "micro.sort", config->rows,
+                "SELECT id, v FROM facts ORDER BY v DESC LIMIT 100;");
+    bench_update(config);
+    bench_insert_delete(config);
+    bench_drop_tables();
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "dbapi.h"
+#include "logger.h"
+
+/* Macro workloads: TPC-H-like analytic queries over the lineitem/orders/customer schema, and
+   a point-lookup OLTP mix over accounts through prepared statements. */
+
+/* Pricing summary, TPC-H Q1: a wide scan into a handful of groups. */
+static const char *TPCH_Q1 =
+    "SELECT l_flag, l_status, SUM(l_quantity), SUM(l_price), "
+    "SUM(l_price * (1 - l_discount)), AVG(l_quantity), AVG(l_discount), COUNT(*) "
+    "FROM lineitem WHERE l_shipdate <= '1998-09-02' GROUP BY l_flag, l_status "
+    "ORDER BY l_flag, l_status;";
+
+/* Shipping priority, TPC-H Q3: a three-way join, grouped and cut to the top ten. */
+static const char *TPCH_Q3 =
+    "SELECT o_orderkey, SUM(l_price * (1 - l_discount)) AS revenue, o_date FROM customer "
+    "JOIN orders ON c_custkey = o_custkey JOIN lineitem ON l_orderkey = o_orderkey "
+    "WHERE c_segment = 'BUILDING' AND o_date < '1995-03-15' AND l_shipdate > '1995-03-15' "
+    "GROUP BY o_orderkey, o_date ORDER BY revenue DESC LIMIT 10;";
+
+/* Forecasting revenue change, TPC-H Q6: a selective range filter into one aggregate. */
+static const char *TPCH_Q6 =
+    "SELECT SUM(l_price * l_discount) FROM lineitem WHERE l_shipdate >= '1994-01-01' AND "
+    "l_shipdate < '1995-01-01' AND l_discount >= 0.05 AND l_discount <= 0.07 AND "
+    "l_quantity < 24;";
+
+/* Order priority checking, TPC-H Q4 without its EXISTS: a join and a small GROUP BY. */
+static const char *TPCH_Q4 =
+    "SELECT o_priority, COUNT(*) FROM orders JOIN lineitem ON l_orderkey = o_orderkey "
+    "WHERE o_date >= '1993-07-01' AND o_date < '1993-10-01' AND l_status = 'F' "
+    "GROUP BY o_priority ORDER BY o_priority;";
+
+static void bench_query(const BenchConfig *config, const char *name, const char *sql) {
+    BenchRun run;
+    if (!bench_begin(&run, config, name, config->rows))
+        return;
+    for (int i = 0; i < config->iterations; i++) {
+        double start = bench_now();
+        if (bench_run_sql(sql) < 0)
+            break;
+        bench_sample(&run, bench_now() - start);
+    }
+    bench_report(&run);
+}
+
+static void bench_tpch(const BenchConfig *config) {
+    if (!bench_wanted(config, "tpch."))
+        return;
+    double start = bench_now();
+    if (!bench_load_tpch(config)) {
+        bench_drop_tables();
+        return;
+    }
+    printf("{\"load\":\"tpch\",\"rows\":%d,\"seconds\":%.6f}\n", config->rows,
+           bench_now() - start);
+    bench_run_sql("ANALYZE;");
+    bench_query(config, "tpch.q1", TPCH_Q1);
+    bench_query(config, "tpch.q3", TPCH_Q3);
+    bench_query(config, "tpch.q4", TPCH_Q4);
+    bench_query(config, "tpch.q6", TPCH_Q6);
+    bench_drop_tables();
+}
+
+typedef enum { OLTP_SELECT, OLTP_UPDATE, OLTP_INSERT } OltpOp;
+
+typedef struct {
+    DbStatement *select;
+    DbStatement *update;
+    DbStatement *insert;
+    BenchZipf ids;
+    BenchRng rng;
+    int next_id;
+} Oltp;
+
+/* Runs op once; false unless it succeeded and an UPDATE or INSERT changed exactly one row,
+   so a statement that silently does the wrong thing cannot produce a timing. */
+static bool oltp_run(Oltp *oltp, OltpOp op) {
+    DbStatement *stmt;
+    if (op == OLTP_SELECT) {
+        stmt = oltp->select;
+        db_bind_int(stmt, 1, bench_zipf_next(&oltp->ids, &oltp->rng));
+    } else if (op == OLTP_UPDATE) {
+        stmt = oltp->update;
+        db_bind_int(stmt, 1, bench_rand_int(&oltp->rng, 200) - 100);
+        db_bind_int(stmt, 2, bench_zipf_next(&oltp->ids, &oltp->rng));
+    } else {
+        char owner[32];
+        snprintf(owner, sizeof(owner), "owner-%d", oltp->next_id);
+        stmt = oltp->insert;
+        db_bind_int(stmt, 1, oltp->next_id++);
+        db_bind_text(stmt, 2, owner);
+        db_bind_int(stmt, 3, bench_rand_int(&oltp->rng, 100));
+        db_bind_int(stmt, 4, 0);
+    }
+    DbStep step;
+    while ((step = db_step(stmt)) == DB_ROW)
+        ;
+    bool ok = step == DB_DONE && (op == OLTP_SELECT || db_changes(stmt) == 1);
+    db_reset(stmt);
+    return ok;
+}
+
+/* Runs op every time or, with op < 0, a mix of 80% SELECT, 15% UPDATE and 5% INSERT. */
+static void bench_oltp_run(const BenchConfig *config, Oltp *oltp, const char *name, int op) {
+    BenchRun run;
+    if (!bench_begin(&run, config, name, 1))
+        return;
+    for (int i = 0; i < config->iterations * 1000; i++) {
+        OltpOp next = (OltpOp)op;
+        if (op < 0) {
+            int roll = bench_rand_int(&oltp->rng, 100);
+            next = roll < 80 ? OLTP_SELECT : (roll < 95 ? OLTP_UPDATE : OLTP_INSERT);
+        }
+        double start = bench_now();
+        bool ok = oltp_run(oltp, next);
+        bench_sample(&run, bench_now() - start);
+        if (!ok) {
+            log_msg(LOG_ERROR, "bench: %s did not change exactly one row; no timing reported",
+                    name);
+            run.count = 0;
+            break;
+        }
+    }
+    bench_report(&run);
+}
+
+static void bench_oltp(const BenchConfig *config) {
+    if (!bench_wanted(config, "oltp."))
+        return;
+    if (!bench_load_accounts(config, "accounts", config->rows)) {
+        bench_drop_tables();
+        return;
+    }
+    Oltp oltp;
+    oltp.select = db_prepare("SELECT owner, balance FROM accounts WHERE id = ?;");
+    oltp.update = db_prepare("UPDATE accounts SET balance = balance + ? WHERE id = ?;");
+    oltp.insert = db_prepare("INSERT INTO accounts VALUES (?, ?, ?, ?);");
+    oltp.next_id = config->rows;
+    bench_rng_init(&oltp.rng, config->seed + 20);
+    if (oltp.select && oltp.update && oltp.insert &&
+        bench_zipf_init(&oltp.ids, config->rows, config->skew)) {
+        bench_oltp_run(config, &oltp, "oltp.point_select", OLTP_SELECT);
+        bench_oltp_run(config, &oltp, "oltp.update", OLTP_UPDATE);
+        bench_oltp_run(config, &oltp, "oltp.insert", OLTP_INSERT);
+        bench_oltp_run(config, &oltp, "oltp.mix", -1);
+        bench_zipf_free(&oltp.ids);
+    }
+    db_finalize(oltp.select);
+    db_finalize(oltp.update);
+    db_finalize(oltp.insert);
+    bench_drop_tables();
+}
+
+void bench_workloads(const BenchConfig *config) {
+    bench_tpch(config);
+    bench_oltp(config);
+}
@@ -2,206 +2,516 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arraylist.h"
 #include "db.h"
+#include "logger.h"
+#include "metrics.h"
 #include "table.h"
+#include "utils.h"
+#include "values.h"
+
+/* Leaves are bulk loaded to 90% so the first inserts after CREATE INDEX do not split every
+   leaf. Deletes are lazy: entries are removed from their leaf without rebalancing, and the
+   tree is rebuilt once it falls below a quarter full. */
+#define BTREE_BULK_FILL (BTREE_NODE_KEYS * 9 / 10)
+#define BTREE_MIN_FILL_DIVISOR 4
+
+typedef struct {
+    const Value *key;
+    int key_count;
+    int row_index;
+} BTreeEntry;
+
+#define ENTRY(node, i, width) (&(node)->keys[(size_t)(i) * (size_t)(width)])
+
+/* Values per entry. An index without columns, as the unit tests build, has one. */
+static int entry_width(const Index *index) {
+    int width = alist_length(&index->columns);
+    return width > 0 ? width : 1;
+}
 
-#define BTREE_DEFAULT_ORDER 4
-
-BTreeNode *btree_create_node(int order, bool is_leaf) {
-    BTreeNode *node = malloc(sizeof(BTreeNode));
-    if (!node)
-        return NULL;
+static int key_width(const Index *index) {
+    return index->key_count > 0 ? index->key_count : 1;
+}
 
-    node->is_leaf = is_leaf;
-    node->key_count = 0;
-    node->parent = NULL;
+static int compare_keys(const Value *a, const Value *b, int n) {
+    for (int i = 0; i < n; i++) {
+        int cmp = compare_values(&a[i], &b[i]);
+        if (cmp != 0)
+            return cmp;
+    }
+    return 0;
+}
 
-    int max_keys = 2 * order - 1;
-    node->keys = calloc((size_t)max_keys, sizeof(Value));
-    node->row_indices = calloc((size_t)max_keys, sizeof(int));
+static void copy_entry(Value *dst, const Value *src, int width) {
+    for (int i = 0; i < width; i++)
+        dst[i] = copy_value(&src[i]);
+}
 
-    if (!is_leaf) {
-        node->children = calloc((size_t)(2 * order), sizeof(BTreeNode *));
-    } else {
-        node->children = NULL;
-    }
+static void free_entry(Value *entry, int width) {
+    for (int i = 0; i < width; i++)
+        free_value(&entry[i]);
+}
 
-    if (!node->keys || !node->row_indices || (!is_leaf && !node->children)) {
-        free(node->children);
-        free(node->keys);
-        free(node->row_indices);
-        free(node);
+static BTreeNode *btree_create_node(bool is_leaf, int width) {
+    BTreeNode *node =
+        malloc(sizeof(BTreeNode) + sizeof(Value) * BTREE_NODE_KEYS * (size_t)width);
+    if (!node) {
+        log_msg(LOG_ERROR, "btree_create_node: Failed to allocate node");
         return NULL;
     }
-
+    node->is_leaf = is_leaf;
+    node->key_count = 0;
+    node->prev = NULL;
+    node->next = NULL;
     return node;
 }
 
-void btree_free_node(BTreeNode *node, int order) {
+static void btree_free_node(BTreeNode *node, int width) {
     if (!node)
         return;
-
-    for (int i = 0; i < node->key_count; i++) {
-        free_value(&node->keys[i]);
+    free_entry(node->keys, node->key_count * width);
+    if (!node->is_leaf) {
+        for (int i = 0; i <= node->key_count; i++)
+            btree_free_node(node->children[i], width);
     }
-
-    if (!node->is_leaf && node->children) {
-        for (int i = 0; i <= node->key_count; i++) {
-            if (node->children[i]) {
-                btree_free_node(node->children[i], order);
-            }
-        }
-        free(node->children);
-    }
-
-    free(node->keys);
-    free(node->row_indices);
     free(node);
 }
 
-static void btree_split_child(BTreeNode *parent, int child_idx, int order) {
-    BTreeNode *child = parent->children[child_idx];
-    BTreeNode *new_node = btree_create_node(order, child->is_leaf);
-    if (!new_node) {
-        return;
+void btree_index_free(Index *index) {
+    btree_free_node(index->data.btree.root, entry_width(index));
+    index->data.btree.root = NULL;
+    index->data.btree.first_leaf = NULL;
+    index->data.btree.last_leaf = NULL;
+    index->data.btree.leaf_count = 0;
+    index->entry_count = 0;
+}
+
+/* Number of entries whose first n key columns are strictly below key (lower bound) or not
+   above it (upper bound). */
+static int node_search(const BTreeNode *node, const Value *key, int n, bool upper, int width) {
+    int lo = 0;
+    int hi = node->key_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = compare_keys(ENTRY(node, mid, width), key, n);
+        if (cmp < 0 || (upper && cmp == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    return lo;
+}
 
-    int mid = order - 1;
-    int max_keys = 2 * order - 1;
+static int compare_entries(const void *a, const void *b) {
+    const BTreeEntry *ea = (const BTreeEntry *)a;
+    const BTreeEntry *eb = (const BTreeEntry *)b;
+    int cmp = compare_keys(ea->key, eb->key, ea->key_count);
+    if (cmp != 0)
+        return cmp;
+    return ea->row_index - eb->row_index;
+}
 
-    if (child->key_count != max_keys) {
-        btree_free_node(new_node, order);
-        return;
+/* Builds one level above nodes[0..count), whose first entries are the width-value tuples
+   of mins, returning the new level in place. */
+static int build_inner_level(BTreeNode **nodes, Value *mins, int count, int width) {
+    size_t entry_bytes = sizeof(Value) * (size_t)width;
+    int parent_count = 0;
+    int i = 0;
+    while (i < count) {
+        int take = count - i;
+        if (take > BTREE_BULK_FILL + 1)
+            take = BTREE_BULK_FILL + 1;
+        /* keep the last parent from ending up with a single child */
+        if (count - i - take == 1)
+            take--;
+
+        BTreeNode *parent = btree_create_node(false, width);
+        if (!parent)
+            return -1;
+        for (int k = 0; k < take; k++) {
+            parent->children[k] = nodes[i + k];
+            if (k > 0)
+                memcopy(ENTRY(parent, k - 1, width), &mins[(size_t)(i + k) * width],
+                        entry_bytes);
+        }
+        parent->key_count = take - 1;
+
+        nodes[parent_count] = parent;
+        memmove(&mins[(size_t)parent_count * width], &mins[(size_t)i * width], entry_bytes);
+        parent_count++;
+        i += take;
     }
+    return parent_count;
+}
 
-    new_node->key_count = mid;
+bool btree_bulk_load(Index *index, const Table *table) {
+    btree_index_free(index);
+
+    int width = entry_width(index);
+    int row_count = table_row_count(table);
+    size_t slots = (size_t)(row_count > 0 ? row_count : 1);
+    BTreeEntry *entries = malloc(sizeof(BTreeEntry) * slots);
+    Value *values = malloc(sizeof(Value) * slots * (size_t)width);
+    if (!entries || !values) {
+        log_msg(LOG_ERROR, "btree_bulk_load: Failed to allocate %d entries", row_count);
+        free(entries);
+        free(values);
+        return false;
+    }
 
-    for (int i = 0; i < mid && (i + mid + 1) < max_keys; i++) {
-        new_node->keys[i] = child->keys[i + mid + 1];
-        new_node->row_indices[i] = child->row_indices[i + mid + 1];
+    int entry_count = 0;
+    for (int i = 0; i < row_count; i++) {
+        if (table_row_deleted(table, i))
+            continue;
+        Value *entry = &values[(size_t)entry_count * width];
+        index_entry_values(index, table, i, entry);
+        if (is_null(&entry[0]))
+            continue;
+        entries[entry_count].key = entry;
+        entries[entry_count].key_count = key_width(index);
+        entries[entry_count].row_index = i;
+        entry_count++;
+    }
+    qsort(entries, (size_t)entry_count, sizeof(BTreeEntry), compare_entries);
+
+    int leaf_count = entry_count > 0 ? (entry_count + BTREE_BULK_FILL - 1) / BTREE_BULK_FILL : 1;
+    BTreeNode **nodes = malloc(sizeof(BTreeNode *) * (size_t)leaf_count);
+    Value *mins = malloc(sizeof(Value) * (size_t)leaf_count * (size_t)width);
+    if (!nodes || !mins) {
+        log_msg(LOG_ERROR, "btree_bulk_load: Failed to allocate %d leaves", leaf_count);
+        free(nodes);
+        free(mins);
+        free(entries);
+        free(values);
+        return false;
     }
 
-    if (!child->is_leaf && child->children) {
-        int max_children = 2 * order;
-        for (int i = 0; i <= mid && (i + mid + 1) < max_children; i++) {
-            new_node->children[i] = child->children[i + mid + 1];
+    BTreeNode *prev = NULL;
+    bool ok = true;
+    for (int l = 0; l < leaf_count; l++) {
+        BTreeNode *leaf = btree_create_node(true, width);
+        if (!leaf) {
+            ok = false;
+            leaf_count = l;
+            break;
+        }
+        int start = l * BTREE_BULK_FILL;
+        int end = start + BTREE_BULK_FILL < entry_count ? start + BTREE_BULK_FILL : entry_count;
+        for (int i = start; i < end; i++) {
+            copy_entry(ENTRY(leaf, i - start, width), entries[i].key, width);
+            leaf->row_indices[i - start] = entries[i].row_index;
+        }
+        leaf->key_count = end > start ? end - start : 0;
+        leaf->prev = prev;
+        if (prev)
+            prev->next = leaf;
+        prev = leaf;
+        nodes[l] = leaf;
+        Value *min = &mins[(size_t)l * width];
+        if (leaf->key_count > 0) {
+            copy_entry(min, leaf->keys, width);
+        } else {
+            for (int c = 0; c < width; c++)
+                min[c] = (Value){.type = TYPE_NULL};
         }
     }
-
-    child->key_count = mid;
-
-    for (int i = parent->key_count; i > child_idx; i--) {
-        parent->children[i + 1] = parent->children[i];
+    free(entries);
+    free(values);
+
+    if (leaf_count > 0) {
+        index->data.btree.first_leaf = nodes[0];
+        index->data.btree.last_leaf = nodes[leaf_count - 1];
+        index->data.btree.leaf_count = (uint32_t)leaf_count;
+        index->entry_count = (uint32_t)entry_count;
     }
-    parent->children[child_idx + 1] = new_node;
 
-    for (int i = parent->key_count - 1; i >= child_idx; i--) {
-        parent->keys[i + 1] = parent->keys[i];
-        parent->row_indices[i + 1] = parent->row_indices[i];
+    if (ok) {
+
+        int count = leaf_count;
+        while (count > 1) {
+            count = build_inner_level(nodes, mins, count, width);
+            if (count < 0) {
+                ok = false;
+                break;
+            }
+        }
+        if (ok) {
+            index->data.btree.root = nodes[0];
+            free_entry(mins, width);
+        }
     }
 
-    if (mid < max_keys) {
-        parent->keys[child_idx] = child->keys[mid];
-        parent->row_indices[child_idx] = child->row_indices[mid];
+    if (!ok) {
+        log_msg(LOG_ERROR, "btree_bulk_load: Failed to build index '%s'", index->index_name);
+        /* leaves are reachable through the chain even if the upper levels are not */
+        BTreeNode *leaf = index->data.btree.first_leaf;
+        while (leaf) {
+            BTreeNode *next = leaf->next;
+            btree_free_node(leaf, width);
+            leaf = next;
+        }
+        index->data.btree.root = NULL;
+        index->data.btree.first_leaf = NULL;
+        index->data.btree.last_leaf = NULL;
+        index->entry_count = 0;
     }
-    parent->key_count++;
 
-    new_node->parent = parent;
-    child->parent = parent;
+    free(nodes);
+    free(mins);
+    return ok;
 }
 
-static bool btree_insert_nonfull(BTreeNode *node, const Value *key, int row_index, int order) {
-    int max_keys = 2 * order - 1;
-
-    if (node->key_count >= max_keys) {
-        return false;
-    }
+/* Inserts into the subtree under node. When node splits, the new right sibling and its
+   separator, an entry of width values, are returned through split/split_key. */
+static bool node_insert(Index *index, BTreeNode *node, const Value *key, int row_index,
+                        BTreeNode **split, Value *split_key) {
+    int width = entry_width(index);
+    size_t entry_bytes = sizeof(Value) * (size_t)width;
+    *split = NULL;
+    int pos = node_search(node, key, key_width(index), true, width);
 
     if (node->is_leaf) {
-        int insert_pos = node->key_count;
-        while (insert_pos > 0 && compare_values(key, &node->keys[insert_pos - 1]) < 0) {
-            node->keys[insert_pos] = node->keys[insert_pos - 1];
-            node->row_indices[insert_pos] = node->row_indices[insert_pos - 1];
-            insert_pos--;
+        if (node->key_count < BTREE_NODE_KEYS) {
+            memmove(ENTRY(node, pos + 1, width), ENTRY(node, pos, width),
+                    entry_bytes * (size_t)(node->key_count - pos));
+            memmove(&node->row_indices[pos + 1], &node->row_indices[pos],
+                    sizeof(int) * (size_t)(node->key_count - pos));
+            copy_entry(ENTRY(node, pos, width), key, width);
+            node->row_indices[pos] = row_index;
+            node->key_count++;
+            return true;
         }
 
-        node->keys[insert_pos] = copy_value(key);
-        node->row_indices[insert_pos] = row_index;
+        BTreeNode *right = btree_create_node(true, width);
+        if (!right)
+            return false;
+        int mid = BTREE_NODE_KEYS / 2;
+        right->key_count = BTREE_NODE_KEYS - mid;
+        memcopy(right->keys, ENTRY(node, mid, width), entry_bytes * (size_t)right->key_count);
+        memcopy(right->row_indices, &node->row_indices[mid],
+                sizeof(int) * (size_t)right->key_count);
+        node->key_count = mid;
+
+        right->next = node->next;
+        right->prev = node;
+        if (node->next)
+            node->next->prev = right;
+        else
+            index->data.btree.last_leaf = right;
+        node->next = right;
+        index->data.btree.leaf_count++;
+
+        BTreeNode *target = pos <= mid ? node : right;
+        BTreeNode *unused;
+        node_insert(index, target, key, row_index, &unused, NULL);
+
+        *split = right;
+        copy_entry(split_key, right->keys, width);
+        return true;
+    }
+
+    BTreeNode *child_split;
+    Value child_key[MAX_INDEX_COLUMNS];
+    if (!node_insert(index, node->children[pos], key, row_index, &child_split, child_key))
+        return false;
+    if (!child_split)
+        return true;
+
+    if (node->key_count < BTREE_NODE_KEYS) {
+        memmove(ENTRY(node, pos + 1, width), ENTRY(node, pos, width),
+                entry_bytes * (size_t)(node->key_count - pos));
+        memmove(&node->children[pos + 2], &node->children[pos + 1],
+                sizeof(BTreeNode *) * (size_t)(node->key_count - pos));
+        memcopy(ENTRY(node, pos, width), child_key, entry_bytes);
+        node->children[pos + 1] = child_split;
         node->key_count++;
         return true;
-    } else {
-        int i = node->key_count - 1;
-        while (i >= 0 && compare_values(key, &node->keys[i]) < 0) {
-            i--;
-        }
-        i++;
+    }
 
-        if (node->children[i]->key_count == 2 * order - 1) {
-            btree_split_child(node, i, order);
-            if (compare_values(key, &node->keys[i]) > 0) {
-                i++;
-            }
-        }
+    /* Full inner node: the middle separator moves up, or the new one when it lands in the
+       middle, and the new separator goes into the half it belongs to. */
+    BTreeNode *right = btree_create_node(false, width);
+    if (!right) {
+        free_entry(child_key, width);
+        return false;
+    }
+    int mid = BTREE_NODE_KEYS / 2;
+    if (pos == mid) {
+        right->key_count = BTREE_NODE_KEYS - mid;
+        memcopy(right->keys, ENTRY(node, mid, width), entry_bytes * (size_t)right->key_count);
+        right->children[0] = child_split;
+        memcopy(&right->children[1], &node->children[mid + 1],
+                sizeof(BTreeNode *) * (size_t)right->key_count);
+        node->key_count = mid;
+        memcopy(split_key, child_key, entry_bytes);
+        *split = right;
+        return true;
+    }
 
-        return btree_insert_nonfull(node->children[i], key, row_index, order);
+    right->key_count = BTREE_NODE_KEYS - mid - 1;
+    memcopy(right->keys, ENTRY(node, mid + 1, width), entry_bytes * (size_t)right->key_count);
+    memcopy(right->children, &node->children[mid + 1],
+            sizeof(BTreeNode *) * (size_t)(right->key_count + 1));
+    memcopy(split_key, ENTRY(node, mid, width), entry_bytes);
+    node->key_count = mid;
+
+    BTreeNode *half = node;
+    if (pos > mid) {
+        half = right;
+        pos -= mid + 1;
     }
+    memmove(ENTRY(half, pos + 1, width), ENTRY(half, pos, width),
+            entry_bytes * (size_t)(half->key_count - pos));
+    memmove(&half->children[pos + 2], &half->children[pos + 1],
+            sizeof(BTreeNode *) * (size_t)(half->key_count - pos));
+    memcopy(ENTRY(half, pos, width), child_key, entry_bytes);
+    half->children[pos + 1] = child_split;
+    half->key_count++;
+    *split = right;
+    return true;
 }
 
+/* key is an entry: the index's key columns, then its INCLUDE columns. */
 bool btree_insert(Index *index, const Value *key, int row_index) {
-    if (index->type != INDEX_TYPE_BTREE)
+    if (index->type != INDEX_TYPE_BTREE || is_null(key))
         return false;
 
-    BTreeNode *root = index->data.btree.root;
-    int order = index->data.btree.order;
+    int width = entry_width(index);
+    if (!index->data.btree.root) {
+        BTreeNode *leaf = btree_create_node(true, width);
+        if (!leaf)
+            return false;
+        index->data.btree.root = leaf;
+        index->data.btree.first_leaf = leaf;
+        index->data.btree.last_leaf = leaf;
+        index->data.btree.leaf_count = 1;
+    }
 
-    if (!root) {
-        root = btree_create_node(order, true);
+    BTreeNode *split;
+    Value split_key[MAX_INDEX_COLUMNS];
+    if (!node_insert(index, index->data.btree.root, key, row_index, &split, split_key)) {
+        log_msg(LOG_ERROR, "btree_insert: Failed to insert into index '%s'", index->index_name);
+        return false;
+    }
+
+    if (split) {
+        BTreeNode *root = btree_create_node(false, width);
         if (!root) {
+            free_entry(split_key, width);
             return false;
         }
+        root->children[0] = index->data.btree.root;
+        root->children[1] = split;
+        memcopy(root->keys, split_key, sizeof(Value) * (size_t)width);
+        root->key_count = 1;
         index->data.btree.root = root;
     }
+    index->entry_count++;
+    return true;
+}
 
-    if (root->key_count == 2 * order - 1) {
-        BTreeNode *new_root = btree_create_node(order, false);
-        if (!new_root) {
-            return false;
-        }
-        new_root->children[0] = root;
-        root->parent = new_root;
-        index->data.btree.root = new_root;
+static const BTreeNode *find_leaf(const Index *index, const Value *key, int n, bool upper) {
+    int width = entry_width(index);
+    const BTreeNode *node = index->data.btree.root;
+    while (node && !node->is_leaf)
+        node = node->children[node_search(node, key, n, upper, width)];
+    return node;
+}
 
-        btree_split_child(new_root, 0, order);
-        return btree_insert_nonfull(new_root, key, row_index, order);
-    } else {
-        return btree_insert_nonfull(root, key, row_index, order);
-    }
+bool btree_delete(Index *index, const Value *key, int row_index) {
+    if (index->type != INDEX_TYPE_BTREE || !index->data.btree.root || is_null(key))
+        return false;
 
-    return true;
+    int width = entry_width(index);
+    int keys = key_width(index);
+    BTreeNode *leaf = (BTreeNode *)find_leaf(index, key, keys, false);
+    for (; leaf; leaf = leaf->next) {
+        for (int i = node_search(leaf, key, keys, false, width); i < leaf->key_count; i++) {
+            if (compare_keys(ENTRY(leaf, i, width), key, keys) != 0)
+                return false;
+            if (leaf->row_indices[i] != row_index)
+                continue;
+            free_entry(ENTRY(leaf, i, width), width);
+            memmove(ENTRY(leaf, i, width), ENTRY(leaf, i + 1, width),
+                    sizeof(Value) * (size_t)width * (size_t)(leaf->key_count - i - 1));
+            memmove(&leaf->row_indices[i], &leaf->row_indices[i + 1],
+                    sizeof(int) * (size_t)(leaf->key_count - i - 1));
+            leaf->key_count--;
+            index->entry_count--;
+            return true;
+        }
+    }
+    return false;
 }
 
-static void btree_search_range(BTreeNode *node, const Value *min_key, const Value *max_key,
-                               ArrayList *results) {
-    if (node->is_leaf) {
-        for (int i = 0; i < node->key_count; i++) {
-            if ((!min_key || compare_values(&node->keys[i], min_key) >= 0) &&
-                (!max_key || compare_values(&node->keys[i], max_key) <= 0)) {
-                int *row_idx = (int *)alist_append(results);
-                if (row_idx)
-                    *row_idx = node->row_indices[i];
-            }
-        }
-    } else {
-        for (int i = 0; i <= node->key_count; i++) {
-            if (i < node->key_count && min_key && compare_values(&node->keys[i], min_key) < 0) {
+/* Rewrites row ids after a table compaction (new_rows[old] < 0 for deleted rows). Returns
+   false when the tree has become sparse enough that the caller should bulk load it again. */
+bool btree_remap_rows(Index *index, const int *new_rows) {
+    int width = entry_width(index);
+    for (BTreeNode *leaf = index->data.btree.first_leaf; leaf; leaf = leaf->next) {
+        int dst = 0;
+        for (int i = 0; i < leaf->key_count; i++) {
+            int mapped = new_rows[leaf->row_indices[i]];
+            if (mapped < 0) {
+                free_entry(ENTRY(leaf, i, width), width);
+                index->entry_count--;
                 continue;
             }
-            if (i > 0 && max_key && compare_values(&node->keys[i - 1], max_key) > 0) {
-                break;
-            }
-            btree_search_range(node->children[i], min_key, max_key, results);
+            if (dst != i)
+                memcopy(ENTRY(leaf, dst, width), ENTRY(leaf, i, width),
+                        sizeof(Value) * (size_t)width);
+            leaf->row_indices[dst] = mapped;
+            dst++;
         }
+        leaf->key_count = dst;
+    }
+    uint32_t capacity = index->data.btree.leaf_count * BTREE_NODE_KEYS;
+    return index->entry_count * BTREE_MIN_FILL_DIVISOR >= capacity ||
+           index->data.btree.leaf_count <= 1;
+}
+
+/* Positions cursor on the first entry of range; btree_cursor_entry stops after its last. */
+void btree_cursor_seek(const Index *index, const BTreeRange *range, BTreeCursor *cursor) {
+    cursor->desc = false;
+    cursor->width = entry_width(index);
+    cursor->range = range;
+    cursor->leaf = NULL;
+    cursor->pos = 0;
+    if (index->type != INDEX_TYPE_BTREE || !index->data.btree.root)
+        return;
+    if (range->lo_width == 0) {
+        cursor->leaf = index->data.btree.first_leaf;
+        return;
+    }
+    cursor->leaf = find_leaf(index, range->lo, range->lo_width, !range->lo_inclusive);
+    cursor->pos = node_search(cursor->leaf, range->lo, range->lo_width, !range->lo_inclusive,
+                              cursor->width);
+}
+
+void btree_scan(const Index *index, const BTreeRange *range, ArrayList *out) {
+    if (index->type != INDEX_TYPE_BTREE || !index->data.btree.root)
+        return;
+
+    BTreeCursor cursor;
+    btree_cursor_seek(index, range, &cursor);
+    int before = alist_length(out);
+    metrics_add(METRIC_INDEX_PROBES, 1);
+    int row;
+    const Value *entry;
+    while (btree_cursor_entry(&cursor, &row, &entry)) {
+        int *slot = (int *)alist_append(out);
+        if (slot)
+            *slot = row;
     }
+    metrics_add(METRIC_INDEX_ROWS, (uint64_t)(alist_length(out) - before));
+}
+
+/* A range over the first key column. */
+void btree_scan_range(const Index *index, const Value *lo, bool lo_inclusive, const Value *hi,
+                      bool hi_inclusive, ArrayList *out) {
+    BTreeRange range = {lo, lo ? 1 : 0, lo_inclusive, hi, hi ? 1 : 0, hi_inclusive, -1};
+    btree_scan(index, &range, out);
 }
 
 ArrayList *btree_find_range(Index *index, const Value *min_key, const Value *max_key) {
@@ -218,10 +528,56 @@ ArrayList *btree_find_range(Index *index, const Value *min_key, const Value *max
         return NULL;
     }
 
-    btree_search_range(index->data.btree.root, min_key, max_key, results);
+    btree_scan_range(index, min_key, true, max_key, true, results);
     return results;
 }
 
 ArrayList *btree_find_equals(Index *index, const Value *key) {
     return btree_find_range(index, key, key);
 }
+
+void btree_cursor_open(const Index *index, bool desc, BTreeCursor *cursor) {
+    cursor->desc = desc;
+    cursor->width = entry_width(index);
+    cursor->range = NULL;
+    cursor->leaf = desc ? index->data.btree.last_leaf : index->data.btree.first_leaf;
+    cursor->pos = desc && cursor->leaf ? cursor->leaf->key_count - 1 : 0;
+}
+
+/* The next row and its entry, the index's columns in order. */
+bool btree_cursor_entry(BTreeCursor *cursor, int *row_index, const Value **entry) {
+    const BTreeRange *range = cursor->range;
+    while (cursor->leaf) {
+        if (!cursor->desc && cursor->pos < cursor->leaf->key_count) {
+            int pos = cursor->pos++;
+            const Value *values = ENTRY(cursor->leaf, pos, cursor->width);
+            if (range && range->hi_width > 0) {
+                int cmp = compare_keys(values, range->hi, range->hi_width);
+                if (cmp > 0 || (cmp == 0 && !range->hi_inclusive)) {
+                    cursor->leaf = NULL;
+                    return false;
+                }
+            }
+            if (range && range->null_column >= 0 && is_null(&values[range->null_column]))
+                continue;
+            *row_index = cursor->leaf->row_indices[pos];
+            *entry = values;
+            return true;
+        }
+        if (cursor->desc && cursor->pos >= 0) {
+            int pos = cursor->pos--;
+            *row_index = cursor->leaf->row_indices[pos];
+            *entry = ENTRY(cursor->leaf, pos, cursor->width);
+            return true;
+        }
+        cursor->leaf = cursor->desc ? cursor->leaf->prev : cursor->leaf->next;
+        if (cursor->leaf)
+            cursor->pos = cursor->desc ? cursor->leaf->key_count - 1 : 0;
+    }
+    return false;
+}
+
+bool btree_cursor_next(BTreeCursor *cursor, int *row_index) {
+    const Value *entry;
+    return btree_cursor_entry(cursor, row_index, &entry);
+}
@@ -0,0 +1,910 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "logger.h"
+#include "storage.h"
+#include "table.h"
+#include "utils.h"
+#include "values.h"
+
+#define COLUMN_VECTOR_INITIAL_CAP 64
+
+static size_t element_size(DataType type) {
+    switch (type) {
+    case TYPE_INT:
+        return sizeof(long long);
+    case TYPE_FLOAT:
+        return sizeof(double);
+    case TYPE_BOOLEAN:
+        return sizeof(bool);
+    case TYPE_DATE:
+    case TYPE_TIME:
+        return sizeof(unsigned int);
+    case TYPE_STRING:
+        return sizeof(uint32_t);
+    default:
+        return sizeof(Value);
+    }
+}
+
+static void *vector_data(ColumnVector *vec) {
+    switch (vec->type) {
+    case TYPE_INT:
+        return vec->ints;
+    case TYPE_FLOAT:
+        return vec->floats;
+    case TYPE_BOOLEAN:
+        return vec->bools;
+    case TYPE_DATE:
+    case TYPE_TIME:
+        return vec->packed;
+    case TYPE_STRING:
+        return vec->strings.offsets;
+    default:
+        return vec->values;
+    }
+}
+
+static void set_vector_data(ColumnVector *vec, void *data) {
+    switch (vec->type) {
+    case TYPE_INT:
+        vec->ints = data;
+        break;
+    case TYPE_FLOAT:
+        vec->floats = data;
+        break;
+    case TYPE_BOOLEAN:
+        vec->bools = data;
+        break;
+    case TYPE_DATE:
+    case TYPE_TIME:
+        vec->packed = data;
+        break;
+    case TYPE_STRING:
+        vec->strings.offsets = data;
+        break;
+    default:
+        vec->values = data;
+    }
+}
+
+/* A vector loaded from a snapshot borrows its arrays from the mapping, exactly as long as
+   the data; it moves them to the heap before anything resizes or frees them. */
+static bool vector_detach(ColumnVector *vec) {
+    if (!vec->map)
+        return true;
+    size_t data_bytes = (size_t)vec->capacity * element_size(vec->type);
+    size_t null_bytes = ((size_t)vec->capacity + 7) / 8;
+    bool strings = vec->type == TYPE_STRING;
+    void *data = malloc(data_bytes > 0 ? data_bytes : 1);
+    uint8_t *nulls = malloc(null_bytes > 0 ? null_bytes : 1);
+    char *heap = strings ? malloc(vec->strings.heap_cap > 0 ? vec->strings.heap_cap : 1) : NULL;
+    if (!data || !nulls || (strings && !heap)) {
+        log_msg(LOG_ERROR, "column_store: Failed to copy a mapped column vector");
+        free(data);
+        free(nulls);
+        free(heap);
+        return false;
+    }
+    memcopy(data, vector_data(vec), data_bytes);
+    memcopy(nulls, vec->nulls, null_bytes);
+    if (strings) {
+        memcopy(heap, vec->strings.heap, vec->strings.heap_len);
+        vec->strings.heap = heap;
+    }
+    set_vector_data(vec, data);
+    vec->nulls = nulls;
+    storage_map_release(vec->map);
+    vec->map = NULL;
+    return true;
+}
+
+static bool vector_resize(ColumnVector *vec, int new_cap) {
+    if (!vector_detach(vec))
+        return false;
+    void *data = realloc(vector_data(vec), (size_t)new_cap * element_size(vec->type));
+    if (!data)
+        return false;
+    set_vector_data(vec, data);
+
+    size_t old_bytes = ((size_t)vec->capacity + 7) / 8;
+    size_t new_bytes = ((size_t)new_cap + 7) / 8;
+    uint8_t *nulls = realloc(vec->nulls, new_bytes);
+    if (!nulls)
+        return false;
+    if (new_bytes > old_bytes)
+        memclear(nulls + old_bytes, new_bytes - old_bytes);
+    vec->nulls = nulls;
+
+    vec->capacity = new_cap;
+    return true;
+}
+
+static bool vector_reserve(ColumnVector *vec, int min_capacity) {
+    if (vec->capacity >= min_capacity)
+        return true;
+    int new_cap = vec->capacity > 0 ? vec->capacity : COLUMN_VECTOR_INITIAL_CAP;
+    while (new_cap < min_capacity)
+        new_cap *= 2;
+    return vector_resize(vec, new_cap);
+}
+
+static void set_null_bit(ColumnVector *vec, int idx, bool null) {
+    if (null)
+        vec->nulls[idx / 8] |= (uint8_t)(1u << (idx % 8));
+    else
+        vec->nulls[idx / 8] &= (uint8_t)~(1u << (idx % 8));
+}
+
+static bool heap_append(ColumnVector *vec, const char *str, int idx) {
+    size_t len = strlen(str) + 1;
+    if (vec->strings.heap_len + len > vec->strings.heap_cap) {
+        if (!vector_detach(vec))
+            return false;
+        size_t new_cap = vec->strings.heap_cap > 0 ? vec->strings.heap_cap : 256;
+        while (new_cap < vec->strings.heap_len + len)
+            new_cap *= 2;
+        char *heap = realloc(vec->strings.heap, new_cap);
+        if (!heap)
+            return false;
+        vec->strings.heap = heap;
+        vec->strings.heap_cap = new_cap;
+    }
+    memcopy(vec->strings.heap + vec->strings.heap_len, str, len);
+    vec->strings.offsets[idx] = (uint32_t)vec->strings.heap_len;
+    vec->strings.heap_len += len;
+    return true;
+}
+
+static bool coerce_value(const ColumnVector *vec, const Value *val, Value *out) {
+    *out = *val;
+    if (val->type == vec->type)
+        return true;
+    if (vec->type == TYPE_FLOAT && val->type == TYPE_INT) {
+        out->type = TYPE_FLOAT;
+        out->float_val = (double)val->int_val;
+        return true;
+    }
+    if (vec->type == TYPE_DECIMAL || vec->type == TYPE_BLOB)
+        return true;
+    return false;
+}
+
+static bool store_value(ColumnVector *vec, int idx, const Value *val) {
+    if (!val || val->type == TYPE_NULL) {
+        set_null_bit(vec, idx, true);
+        if (vec->type == TYPE_DECIMAL || vec->type == TYPE_BLOB)
+            vec->values[idx].type = TYPE_NULL;
+        return true;
+    }
+
+    Value v;
+    if (!coerce_value(vec, val, &v)) {
+        log_msg(LOG_ERROR, "column_store: Cannot store %s value in column of type %d",
+                repr(val), vec->type);
+        return false;
+    }
+
+    switch (vec->type) {
+    case TYPE_INT:
+        vec->ints[idx] = v.int_val;
+        break;
+    case TYPE_FLOAT:
+        vec->floats[idx] = v.float_val;
+        break;
+    case TYPE_BOOLEAN:
+        vec->bools[idx] = v.bool_val;
+        break;
+    case TYPE_DATE:
+        vec->packed[idx] = v.date_val;
+        break;
+    case TYPE_TIME:
+        vec->packed[idx] = v.time_val;
+        break;
+    case TYPE_STRING:
+        if (!heap_append(vec, value_str(&v) ? value_str(&v) : "", idx))
+            return false;
+        break;
+    default:
+        vec->values[idx] = copy_value(&v);
+    }
+    set_null_bit(vec, idx, false);
+    return true;
+}
+
+static int tail_length(const ColumnVector *vec) {
+    return vec->length - vec->sealed;
+}
+
+static bool tail_null(const ColumnVector *vec, int idx) {
+    return vec->nulls[idx / 8] & (1u << (idx % 8));
+}
+
+static void compact_string_heap(ColumnVector *vec) {
+    char *heap = malloc(vec->strings.heap_len > 0 ? vec->strings.heap_len : 1);
+    if (!heap)
+        return;
+    size_t heap_len = 0;
+    for (int i = 0; i < tail_length(vec); i++) {
+        if (tail_null(vec, i))
+            continue;
+        const char *str = vec->strings.heap + vec->strings.offsets[i];
+        size_t len = strlen(str) + 1;
+        memcopy(heap + heap_len, str, len);
+        vec->strings.offsets[i] = (uint32_t)heap_len;
+        heap_len += len;
+    }
+    free(vec->strings.heap);
+    vec->strings.heap = heap;
+    vec->strings.heap_len = heap_len;
+    vec->strings.heap_cap = vec->strings.heap_len > 0 ? vec->strings.heap_len : 1;
+}
+
+static void free_segment(ColumnSegment *seg) {
+    free(seg->words);
+    free(seg->run_ends);
+    free(seg->nulls);
+    free(seg->dict_offsets);
+    free(seg->dict_heap);
+    memclear(seg, sizeof(ColumnSegment));
+}
+
+static void free_vector(ColumnVector *vec) {
+    for (int s = 0; s < vec->sealed / COLUMN_SEGMENT_ROWS; s++)
+        free_segment(&vec->segments[s]);
+    free(vec->segments);
+    vec->segments = NULL;
+    vec->sealed = 0;
+    if (vec->map) {
+        storage_map_release(vec->map);
+        memclear(vec, sizeof(ColumnVector));
+        return;
+    }
+    if (vec->type == TYPE_DECIMAL || vec->type == TYPE_BLOB) {
+        for (int i = 0; i < vec->length; i++)
+            free_value(&vec->values[i]);
+    }
+    free(vector_data(vec));
+    if (vec->type == TYPE_STRING)
+        free(vec->strings.heap);
+    free(vec->nulls);
+    memclear(vec, sizeof(ColumnVector));
+}
+
+/* Segments. Sealing turns the first COLUMN_SEGMENT_ROWS rows of the tail into one segment,
+   picking bit packing or runs by whichever is smaller. DECIMAL and BLOB columns hold heap
+   values and stay plain. */
+
+static uint64_t tail_word(const ColumnVector *vec, int idx) {
+    switch (vec->type) {
+    case TYPE_INT:
+        return (uint64_t)vec->ints[idx];
+    case TYPE_FLOAT: {
+        uint64_t bits;
+        memcopy(&bits, &vec->floats[idx], sizeof(bits));
+        return bits;
+    }
+    case TYPE_BOOLEAN:
+        return vec->bools[idx];
+    default:
+        return vec->packed[idx];
+    }
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/* The first code whose string is not below str, or with upper, the first above it. */
+uint32_t column_segment_lower_bound(const ColumnSegment *seg, const char *str, bool upper) {
+    uint32_t lo = 0;
+    uint32_t hi = seg->dict_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(column_segment_string(seg, mid), str);
+        if (cmp < 0 || (upper && cmp == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Gives the TEXT rows [start, start + COLUMN_SEGMENT_ROWS) of the tail a sorted dictionary
+   and writes the code of each row to codes. */
+static bool build_dictionary(const ColumnVector *vec, int start, ColumnSegment *seg,
+                             uint64_t *codes) {
+    const char **sorted = malloc(sizeof(char *) * COLUMN_SEGMENT_ROWS);
+    if (!sorted)
+        return false;
+    int n = 0;
+    for (int i = 0; i < COLUMN_SEGMENT_ROWS; i++) {
+        if (!tail_null(vec, start + i))
+            sorted[n++] = vec->strings.heap + vec->strings.offsets[start + i];
+    }
+    qsort(sorted, (size_t)n, sizeof(char *), compare_strings);
+    int distinct = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < n; i++) {
+        if (distinct > 0 && strcmp(sorted[i], sorted[distinct - 1]) == 0)
+            continue;
+        sorted[distinct++] = sorted[i];
+        bytes += strlen(sorted[i]) + 1;
+    }
+
+    seg->dict_offsets = malloc(sizeof(uint32_t) * (size_t)(distinct > 0 ? distinct : 1));
+    seg->dict_heap = malloc(bytes > 0 ? bytes : 1);
+    if (!seg->dict_offsets || !seg->dict_heap) {
+        free(sorted);
+        return false;
+    }
+    size_t len = 0;
+    for (int d = 0; d < distinct; d++) {
+        size_t size = strlen(sorted[d]) + 1;
+        memcopy(seg->dict_heap + len, sorted[d], size);
+        seg->dict_offsets[d] = (uint32_t)len;
+        len += size;
+    }
+    seg->dict_count = (uint32_t)distinct;
+    seg->dict_len = len;
+    seg->dict_cap = bytes > 0 ? bytes : 1;
+    seg->dict_sorted = true;
+    free(sorted);
+
+    for (int i = 0; i < COLUMN_SEGMENT_ROWS; i++) {
+        codes[i] = tail_null(vec, start + i)
+                       ? 0
+                       : column_segment_lower_bound(
+                             seg, vec->strings.heap + vec->strings.offsets[start + i], false);
+    }
+    return true;
+}
+
+static int bit_width(uint64_t v) {
+    int width = 0;
+    while (v) {
+        width++;
+        v >>= 1;
+    }
+    return width;
+}
+
+static size_t packed_word_count(int width) {
+    return ((size_t)COLUMN_SEGMENT_ROWS * (size_t)width + 63) / 64;
+}
+
+/* INT words are ordered as signed, so that a column of small negative and positive numbers
+   still packs into a few bits. */
+static bool encode_words(ColumnSegment *seg, const uint64_t *words, bool is_signed) {
+    uint64_t lo = words[0];
+    uint64_t hi = words[0];
+    int runs = 1;
+    for (int i = 1; i < COLUMN_SEGMENT_ROWS; i++) {
+        uint64_t w = words[i];
+        if (is_signed ? (int64_t)w < (int64_t)lo : w < lo)
+            lo = w;
+        if (is_signed ? (int64_t)w > (int64_t)hi : w > hi)
+            hi = w;
+        runs += w != words[i - 1];
+    }
+
+    int width = bit_width(hi - lo);
+    size_t packed = packed_word_count(width);
+    if ((size_t)runs * (sizeof(uint64_t) + sizeof(uint16_t)) < packed * sizeof(uint64_t)) {
+        seg->words = malloc(sizeof(uint64_t) * (size_t)runs);
+        seg->run_ends = malloc(sizeof(uint16_t) * (size_t)runs);
+        if (!seg->words || !seg->run_ends)
+            return false;
+        int run = 0;
+        seg->words[0] = words[0];
+        for (int i = 1; i < COLUMN_SEGMENT_ROWS; i++) {
+            if (words[i] == words[i - 1])
+                continue;
+            seg->run_ends[run++] = (uint16_t)i;
+            seg->words[run] = words[i];
+        }
+        seg->run_ends[run] = COLUMN_SEGMENT_ROWS;
+        seg->encoding = COLUMN_ENC_RLE;
+        seg->run_count = (uint16_t)runs;
+        return true;
+    }
+
+    seg->words = calloc(packed > 0 ? packed : 1, sizeof(uint64_t));
+    if (!seg->words)
+        return false;
+    seg->encoding = COLUMN_ENC_PACKED;
+    seg->width = (uint8_t)width;
+    seg->base = lo;
+    for (int i = 0; width > 0 && i < COLUMN_SEGMENT_ROWS; i++) {
+        uint64_t delta = words[i] - lo;
+        size_t bit = (size_t)i * (size_t)width;
+        size_t w = bit / 64;
+        unsigned shift = (unsigned)(bit % 64);
+        seg->words[w] |= delta << shift;
+        if (shift + (unsigned)width > 64)
+            seg->words[w + 1] |= delta >> (64 - shift);
+    }
+    return true;
+}
+
+/* NULL rows take the word before them, so they neither widen the packing nor break runs. */
+static bool seal_segment(ColumnVector *vec, int start, ColumnSegment *seg) {
+    memclear(seg, sizeof(ColumnSegment));
+    uint64_t *words = malloc(sizeof(uint64_t) * COLUMN_SEGMENT_ROWS);
+    bool ok = words != NULL;
+    if (ok && vec->type == TYPE_STRING) {
+        ok = build_dictionary(vec, start, seg, words);
+    } else if (ok) {
+        for (int i = 0; i < COLUMN_SEGMENT_ROWS; i++)
+            words[i] = tail_word(vec, start + i);
+    }
+
+    bool any_null = false;
+    uint64_t fill = 0;
+    for (int i = 0; ok && i < COLUMN_SEGMENT_ROWS; i++) {
+        if (!tail_null(vec, start + i)) {
+            fill = words[i];
+            break;
+        }
+    }
+    for (int i = 0; ok && i < COLUMN_SEGMENT_ROWS; i++) {
+        if (tail_null(vec, start + i)) {
+            words[i] = fill;
+            any_null = true;
+        } else {
+            fill = words[i];
+        }
+    }
+    if (ok && any_null) {
+        seg->nulls = malloc(COLUMN_SEGMENT_ROWS / 8);
+        ok = seg->nulls != NULL;
+        if (ok)
+            memcopy(seg->nulls, vec->nulls + start / 8, COLUMN_SEGMENT_ROWS / 8);
+    }
+    ok = ok && encode_words(seg, words, vec->type == TYPE_INT);
+    free(words);
+    if (!ok)
+        free_segment(seg);
+    return ok;
+}
+
+/* Seals every full segment at the start of the tail and moves the rest of the tail down.
+   A vector that cannot be sealed stays plain, which is slower but just as correct. */
+static void vector_seal(ColumnVector *vec) {
+    int full = tail_length(vec) / COLUMN_SEGMENT_ROWS;
+    if (full == 0 || vec->type == TYPE_DECIMAL || vec->type == TYPE_BLOB ||
+        !vector_detach(vec))
+        return;
+    int count = vec->sealed / COLUMN_SEGMENT_ROWS;
+    ColumnSegment *segments =
+        realloc(vec->segments, sizeof(ColumnSegment) * (size_t)(count + full));
+    if (!segments) {
+        log_msg(LOG_WARN, "column_store: Out of memory sealing a column segment");
+        return;
+    }
+    vec->segments = segments;
+    int done = 0;
+    while (done < full && seal_segment(vec, done * COLUMN_SEGMENT_ROWS, &segments[count + done]))
+        done++;
+    if (done < full)
+        log_msg(LOG_WARN, "column_store: Out of memory sealing a column segment");
+    if (done == 0)
+        return;
+
+    int moved = done * COLUMN_SEGMENT_ROWS;
+    int rest = tail_length(vec) - moved;
+    size_t size = element_size(vec->type);
+    char *data = vector_data(vec);
+    memmove(data, data + (size_t)moved * size, (size_t)rest * size);
+    size_t null_bytes = ((size_t)vec->capacity + 7) / 8;
+    size_t rest_bytes = ((size_t)rest + 7) / 8;
+    memmove(vec->nulls, vec->nulls + moved / 8, rest_bytes);
+    memclear(vec->nulls + rest_bytes, null_bytes - rest_bytes);
+    vec->sealed += moved;
+    if (vec->type == TYPE_STRING)
+        compact_string_heap(vec);
+    int cap = COLUMN_VECTOR_INITIAL_CAP;
+    while (cap < rest)
+        cap *= 2;
+    vector_resize(vec, cap);
+}
+
+Value column_segment_value(const ColumnVector *vec, const ColumnSegment *seg, uint64_t word) {
+    Value val = {0};
+    val.type = vec->type;
+    switch (vec->type) {
+    case TYPE_INT:
+        val.int_val = (long long)word;
+        break;
+    case TYPE_FLOAT:
+        memcopy(&val.float_val, &word, sizeof(word));
+        break;
+    case TYPE_BOOLEAN:
+        val.bool_val = word != 0;
+        break;
+    case TYPE_DATE:
+        val.date_val = (unsigned int)word;
+        break;
+    case TYPE_TIME:
+        val.time_val = (unsigned int)word;
+        break;
+    case TYPE_STRING:
+        val.char_val = (char *)column_segment_string(seg, (uint32_t)word);
+        break;
+    default:
+        val.type = TYPE_NULL;
+    }
+    return val;
+}
+
+/* Writing a sealed row widens its segment to a plain word per row; the next compaction packs
+   it again. A new string joins the end of the dictionary, which then stays sorted only while
+   such strings arrive in order. */
+static bool segment_widen(const ColumnVector *vec, ColumnSegment *seg) {
+    /* Every INT is at least INT64_MIN, which keeps packed rows ordered by their distance. */
+    uint64_t base = vec->type == TYPE_INT ? (uint64_t)INT64_MIN : 0;
+    if (seg->encoding == COLUMN_ENC_PACKED && seg->width == 64 && seg->base == base)
+        return true;
+    uint64_t *words = malloc(sizeof(uint64_t) * COLUMN_SEGMENT_ROWS);
+    if (!words)
+        return false;
+    for (int i = 0; i < COLUMN_SEGMENT_ROWS; i++)
+        words[i] = column_segment_word(seg, i) - base;
+    free(seg->words);
+    free(seg->run_ends);
+    seg->words = words;
+    seg->run_ends = NULL;
+    seg->run_count = 0;
+    seg->encoding = COLUMN_ENC_PACKED;
+    seg->width = 64;
+    seg->base = base;
+    return true;
+}
+
+static bool dictionary_code(ColumnSegment *seg, const char *str, uint64_t *code) {
+    if (seg->dict_sorted) {
+        uint32_t lo = column_segment_lower_bound(seg, str, false);
+        if (lo < seg->dict_count && strcmp(column_segment_string(seg, lo), str) == 0) {
+            *code = lo;
+            return true;
+        }
+    } else {
+        for (uint32_t d = 0; d < seg->dict_count; d++) {
+            if (strcmp(column_segment_string(seg, d), str) == 0) {
+                *code = d;
+                return true;
+            }
+        }
+    }
+
+    size_t size = strlen(str) + 1;
+    if (seg->dict_len + size > seg->dict_cap) {
+        size_t cap = seg->dict_cap > 0 ? seg->dict_cap : 64;
+        while (cap < seg->dict_len + size)
+            cap *= 2;
+        char *heap = realloc(seg->dict_heap, cap);
+        if (!heap)
+            return false;
+        seg->dict_heap = heap;
+        seg->dict_cap = cap;
+    }
+    uint32_t *offsets = realloc(seg->dict_offsets, sizeof(uint32_t) * (seg->dict_count + 1));
+    if (!offsets)
+        return false;
+    seg->dict_offsets = offsets;
+    if (seg->dict_count > 0 && strcmp(column_segment_string(seg, seg->dict_count - 1), str) > 0)
+        seg->dict_sorted = false;
+    memcopy(seg->dict_heap + seg->dict_len, str, size);
+    seg->dict_offsets[seg->dict_count] = (uint32_t)seg->dict_len;
+    seg->dict_len += size;
+    *code = seg->dict_count++;
+    return true;
+}
+
+static bool segment_set(ColumnVector *vec, int row_idx, const Value *val) {
+    ColumnSegment *seg = &vec->segments[row_idx / COLUMN_SEGMENT_ROWS];
+    int i = row_idx % COLUMN_SEGMENT_ROWS;
+    if (!segment_widen(vec, seg))
+        return false;
+    if (!val || val->type == TYPE_NULL) {
+        if (!seg->nulls && !(seg->nulls = calloc(COLUMN_SEGMENT_ROWS / 8, 1)))
+            return false;
+        seg->nulls[i / 8] |= (uint8_t)(1u << (i % 8));
+        return true;
+    }
+
+    Value v;
+    if (!coerce_value(vec, val, &v)) {
+        log_msg(LOG_ERROR, "column_store: Cannot store %s value in column of type %d",
+                repr(val), vec->type);
+        return false;
+    }
+    uint64_t word = 0;
+    switch (vec->type) {
+    case TYPE_INT:
+        word = (uint64_t)v.int_val;
+        break;
+    case TYPE_FLOAT:
+        memcopy(&word, &v.float_val, sizeof(word));
+        break;
+    case TYPE_BOOLEAN:
+        word = v.bool_val;
+        break;
+    case TYPE_DATE:
+        word = v.date_val;
+        break;
+    case TYPE_TIME:
+        word = v.time_val;
+        break;
+    case TYPE_STRING:
+        if (!dictionary_code(seg, value_str(&v) ? value_str(&v) : "", &word))
+            return false;
+        break;
+    default:
+        return false;
+    }
+    seg->words[i] = word - seg->base;
+    if (seg->nulls)
+        seg->nulls[i / 8] &= (uint8_t)~(1u << (i % 8));
+    return true;
+}
+
+static Value vector_get(const ColumnVector *vec, int row_idx) {
+    Value val = {0};
+    val.type = TYPE_NULL;
+    if (row_idx < vec->sealed) {
+        const ColumnSegment *seg = &vec->segments[row_idx / COLUMN_SEGMENT_ROWS];
+        int i = row_idx % COLUMN_SEGMENT_ROWS;
+        if (seg->nulls && (seg->nulls[i / 8] & (1u << (i % 8))))
+            return val;
+        return column_segment_value(vec, seg, column_segment_word(seg, i));
+    }
+
+    int idx = row_idx - vec->sealed;
+    if (tail_null(vec, idx))
+        return val;
+    val.type = vec->type;
+    switch (vec->type) {
+    case TYPE_INT:
+        val.int_val = vec->ints[idx];
+        break;
+    case TYPE_FLOAT:
+        val.float_val = vec->floats[idx];
+        break;
+    case TYPE_BOOLEAN:
+        val.bool_val = vec->bools[idx];
+        break;
+    case TYPE_DATE:
+        val.date_val = vec->packed[idx];
+        break;
+    case TYPE_TIME:
+        val.time_val = vec->packed[idx];
+        break;
+    case TYPE_STRING:
+        val.char_val = vec->strings.heap + vec->strings.offsets[idx];
+        break;
+    default:
+        val = vec->values[idx];
+    }
+    return val;
+}
+
+/* A plain copy of every row of vec, sealed or not, for compaction and snapshots. */
+bool column_store_unpack(const ColumnVector *vec, ColumnVector *out) {
+    memclear(out, sizeof(ColumnVector));
+    out->type = vec->type;
+    if (!vector_reserve(out, vec->length > 0 ? vec->length : 1)) {
+        free_vector(out);
+        return false;
+    }
+    for (int r = 0; r < vec->length; r++) {
+        Value val = vector_get(vec, r);
+        if (!store_value(out, r, &val)) {
+            out->length = r;
+            free_vector(out);
+            return false;
+        }
+        out->length = r + 1;
+    }
+    return true;
+}
+
+void column_store_free_vector(ColumnVector *vec) {
+    free_vector(vec);
+}
+
+static size_t segment_bytes(const ColumnSegment *seg) {
+    size_t words = seg->encoding == COLUMN_ENC_RLE ? seg->run_count : packed_word_count(seg->width);
+    size_t bytes = sizeof(ColumnSegment) + sizeof(uint64_t) * (words > 0 ? words : 1);
+    if (seg->encoding == COLUMN_ENC_RLE)
+        bytes += sizeof(uint16_t) * seg->run_count;
+    if (seg->nulls)
+        bytes += COLUMN_SEGMENT_ROWS / 8;
+    if (seg->dict_heap)
+        bytes += sizeof(uint32_t) * seg->dict_count + seg->dict_cap;
+    return bytes;
+}
+
+/* The bytes a columnar table's vectors hold, not counting DECIMAL and BLOB payloads. */
+size_t column_store_bytes(const Table *table) {
+    size_t bytes = 0;
+    for (int c = 0; table->vectors && c < alist_length(&table->schema.columns); c++) {
+        const ColumnVector *vec = &table->vectors[c];
+        bytes += (size_t)vec->capacity * element_size(vec->type) + ((size_t)vec->capacity + 7) / 8;
+        if (vec->type == TYPE_STRING)
+            bytes += vec->strings.heap_cap;
+        for (int s = 0; s < vec->sealed / COLUMN_SEGMENT_ROWS; s++)
+            bytes += segment_bytes(&vec->segments[s]);
+    }
+    return bytes;
+}
+
+size_t column_store_element_size(DataType type) {
+    return element_size(type);
+}
+
+const void *column_store_vector_data(const ColumnVector *vec) {
+    return vector_data((ColumnVector *)vec);
+}
+
+/* Points an empty vector at arrays inside a mapped snapshot; the caller has taken a
+   reference on map for it. */
+void column_store_map_vector(ColumnVector *vec, int length, void *data, uint8_t *nulls,
+                             char *heap, size_t heap_len, struct StorageMap *map) {
+    set_vector_data(vec, data);
+    vec->nulls = nulls;
+    vec->length = length;
+    vec->capacity = length;
+    if (vec->type == TYPE_STRING) {
+        vec->strings.heap = heap;
+        vec->strings.heap_len = heap_len;
+        vec->strings.heap_cap = heap_len;
+    }
+    vec->map = map;
+}
+
+bool column_store_init(Table *table) {
+    int col_count = alist_length(&table->schema.columns);
+    table->row_count = 0;
+    table->vectors = NULL;
+    if (col_count == 0)
+        return true;
+
+    table->vectors = malloc(sizeof(ColumnVector) * col_count);
+    if (!table->vectors) {
+        log_msg(LOG_ERROR, "column_store_init: Failed to allocate column vectors");
+        return false;
+    }
+    memclear(table->vectors, sizeof(ColumnVector) * col_count);
+
+    for (int i = 0; i < col_count; i++) {
+        ColumnDef *col = (ColumnDef *)alist_get(&table->schema.columns, i);
+        table->vectors[i].type = col->type;
+    }
+    return true;
+}
+
+void column_store_free(Table *table) {
+    if (!table->vectors)
+        return;
+    int col_count = alist_length(&table->schema.columns);
+    for (int i = 0; i < col_count; i++)
+        free_vector(&table->vectors[i]);
+    free(table->vectors);
+    table->vectors = NULL;
+    table->row_count = 0;
+}
+
+bool column_store_append_row(Table *table, const Row *row) {
+    int col_count = alist_length(&table->schema.columns);
+    int idx = table->row_count;
+
+    for (int i = 0; i < col_count; i++) {
+        ColumnVector *vec = &table->vectors[i];
+        if (!vector_reserve(vec, idx - vec->sealed + 1)) {
+            log_msg(LOG_ERROR, "column_store_append_row: Failed to grow column vector");
+            return false;
+        }
+    }
+
+    for (int i = 0; i < col_count; i++) {
+        ColumnVector *vec = &table->vectors[i];
+        Value *val = i < alist_length(row) ? (Value *)alist_get(row, i) : NULL;
+        if (!store_value(vec, idx - vec->sealed, val)) {
+            for (int j = 0; j < i; j++) {
+                ColumnVector *done = &table->vectors[j];
+                if (done->type == TYPE_DECIMAL || done->type == TYPE_BLOB)
+                    free_value(&done->values[idx - done->sealed]);
+            }
+            return false;
+        }
+    }
+
+    for (int i = 0; i < col_count; i++) {
+        table->vectors[i].length = idx + 1;
+        if (tail_length(&table->vectors[i]) >= COLUMN_SEGMENT_ROWS)
+            vector_seal(&table->vectors[i]);
+    }
+    table->row_count++;
+    return true;
+}
+
+Value column_store_get_value(const Table *table, int row_idx, uint16_t column_id) {
+    if (row_idx < 0 || row_idx >= table->row_count ||
+        column_id >= alist_length(&table->schema.columns)) {
+        Value val = {0};
+        val.type = TYPE_NULL;
+        return val;
+    }
+    return vector_get(&table->vectors[column_id], row_idx);
+}
+
+bool column_store_set_value(Table *table, int row_idx, uint16_t column_id, const Value *val) {
+    if (row_idx < 0 || row_idx >= table->row_count ||
+        column_id >= alist_length(&table->schema.columns))
+        return false;
+
+    ColumnVector *vec = &table->vectors[column_id];
+    if (row_idx < vec->sealed)
+        return segment_set(vec, row_idx, val);
+    int idx = row_idx - vec->sealed;
+    if (vec->type == TYPE_DECIMAL || vec->type == TYPE_BLOB)
+        free_value(&vec->values[idx]);
+    return store_value(vec, idx, val);
+}
+
+void column_store_fetch_row(const Table *table, int row_idx, Row *scratch) {
+    int col_count = alist_length(&table->schema.columns);
+    alist_truncate(scratch, 0);
+    for (int i = 0; i < col_count; i++) {
+        Value *slot = (Value *)alist_append(scratch);
+        if (slot)
+            *slot = column_store_get_value(table, row_idx, (uint16_t)i);
+    }
+}
+
+/* Compaction unpacks sealed rows, moves the kept rows down and seals the result again. */
+void column_store_compact(Table *table, const bool *keep) {
+    int col_count = alist_length(&table->schema.columns);
+    int kept = 0;
+
+    for (int c = 0; c < col_count; c++) {
+        ColumnVector *vec = &table->vectors[c];
+        if (vec->sealed > 0) {
+            ColumnVector plain;
+            if (!column_store_unpack(vec, &plain)) {
+                log_msg(LOG_ERROR, "column_store_compact: Failed to unpack a column vector");
+                continue;
+            }
+            free_vector(vec);
+            *vec = plain;
+        }
+        vector_detach(vec);
+        char *data = vector_data(vec);
+        size_t size = element_size(vec->type);
+        int dst = 0;
+        for (int i = 0; i < vec->length; i++) {
+            bool null = tail_null(vec, i);
+            if (!keep[i]) {
+                if (vec->type == TYPE_DECIMAL || vec->type == TYPE_BLOB)
+                    free_value(&vec->values[i]);
+                continue;
+            }
+            if (dst != i)
+                memcopy(data + (size_t)dst * size, data + (size_t)i * size, size);
+            set_null_bit(vec, dst, null);
+            dst++;
+        }
+        for (int i = dst; i < vec->length; i++)
+            set_null_bit(vec, i, false);
+        vec->length = dst;
+        if (vec->type == TYPE_STRING)
+            compact_string_heap(vec);
+        vector_seal(vec);
+        kept = dst;
+    }
+
+    table->row_count = col_count > 0 ? kept : 0;
+}
@@ -0,0 +1,634 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "dbapi.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "txn.h"
+#include "utils.h"
+#include "values.h"
+
+struct DbStatement {
+    char *sql;
+    ASTNode *ast;
+    uint64_t catalog_version;
+    int param_count;
+    Value **slots; /* the parameter markers inside ast */
+    Value *bound;  /* owned copies of the bound values */
+    QueryResult *result;
+    int next_row;
+    bool executed;
+    QueryCursor *cursor; /* a single SELECT, streamed while its rows are read */
+    const ResultBatch *batch;
+    int batch_row;
+    unsigned errors; /* log_error_count() when the run started */
+    bool failed;     /* an error was logged while it ran */
+    long long changes;
+    char error[256];
+};
+
+typedef struct {
+    char *key; /* normalized SQL text */
+    uint64_t hash;
+    uint64_t last_used;
+    DbStatement *stmt;
+} StmtCacheEntry;
+
+static StmtCacheEntry g_cache[STMT_CACHE_SIZE];
+static uint64_t g_cache_tick;
+static StmtCacheStats g_cache_stats;
+
+static ASTNode *parse_sql(const char *sql, bool report) {
+    Token *tokens = tokenize(sql);
+    if (!tokens) {
+        log_msg(LOG_ERROR, "Tokenization failed for input: '%s'", sql);
+        return NULL;
+    }
+    ASTNode *ast = parse_ex(sql, tokens);
+    if (!ast) {
+        log_msg(LOG_ERROR, "Parse failed for input: '%s'", sql);
+        ParseContext *ctx = parse_get_context();
+        if (report && ctx->error_occurred)
+            parse_error_report(ctx);
+    }
+    free_tokens(tokens);
+    return ast;
+}
+
+static void apply_bindings(DbStatement *stmt) {
+    for (int i = 0; i < stmt->param_count; i++)
+        if (stmt->slots[i])
+            *stmt->slots[i] = stmt->bound[i];
+}
+
+/* Adopts a freshly parsed tree: finds its parameter markers and binds the current values. */
+static bool adopt_ast(DbStatement *stmt, ASTNode *ast) {
+    if (stmt->ast && ast->param_count != stmt->param_count) {
+        log_msg(LOG_ERROR, "db_prepare: '%s' now has %d parameters instead of %d", stmt->sql,
+                ast->param_count, stmt->param_count);
+        free_ast(ast);
+        return false;
+    }
+    if (!stmt->ast && ast->param_count > 0) {
+        stmt->slots = calloc((size_t)ast->param_count, sizeof(Value *));
+        stmt->bound = calloc((size_t)ast->param_count, sizeof(Value));
+        if (!stmt->slots || !stmt->bound) {
+            log_msg(LOG_ERROR, "db_prepare: Out of memory for %d parameters", ast->param_count);
+            free_ast(ast);
+            return false;
+        }
+        for (int i = 0; i < ast->param_count; i++)
+            stmt->bound[i].type = TYPE_NULL;
+    }
+    free_ast(stmt->ast);
+    stmt->ast = ast;
+    stmt->param_count = ast->param_count;
+    stmt->catalog_version = catalog_version();
+    memclear(stmt->slots, sizeof(Value *) * (size_t)stmt->param_count);
+    ast_collect_params(ast, stmt->slots);
+    apply_bindings(stmt);
+    return true;
+}
+
+static DbStatement *statement_create(const char *sql, ASTNode *ast) {
+    DbStatement *stmt = calloc(1, sizeof(DbStatement));
+    if (!stmt) {
+        free_ast(ast);
+        return NULL;
+    }
+    stmt->sql = strdup(sql);
+    if (!stmt->sql || !adopt_ast(stmt, ast)) {
+        if (!stmt->sql)
+            free_ast(ast);
+        db_finalize(stmt);
+        return NULL;
+    }
+    return stmt;
+}
+
+DbStatement *db_prepare(const char *sql) {
+    if (!sql) {
+        log_msg(LOG_ERROR, "db_prepare: No SQL given");
+        return NULL;
+    }
+    ASTNode *ast = parse_sql(sql, false);
+    return ast ? statement_create(sql, ast) : NULL;
+}
+
+/* The parsed tree holds table and column ids, so it is parsed again once tables change. */
+static bool statement_validate(DbStatement *stmt) {
+    if (stmt->ast && stmt->catalog_version == catalog_version())
+        return true;
+    g_cache_stats.reprepares++;
+    ASTNode *ast = parse_sql(stmt->sql, false);
+    return ast && adopt_ast(stmt, ast);
+}
+
+int db_bind_count(const DbStatement *stmt) {
+    return stmt ? stmt->param_count : 0;
+}
+
+bool db_bind_value(DbStatement *stmt, int index, const Value *value) {
+    if (!stmt || !value || index < 1 || index > stmt->param_count) {
+        log_msg(LOG_ERROR, "db_bind: Parameter %d out of range (statement has %d)", index,
+                stmt ? stmt->param_count : 0);
+        return false;
+    }
+    if (value->type == TYPE_ERROR) {
+        log_msg(LOG_ERROR, "db_bind: Cannot bind an error value to parameter %d", index);
+        return false;
+    }
+    Value *bound = &stmt->bound[index - 1];
+    free_value(bound);
+    *bound = copy_value(value);
+    if (stmt->slots[index - 1])
+        *stmt->slots[index - 1] = *bound;
+    return true;
+}
+
+bool db_bind_null(DbStatement *stmt, int index) {
+    Value val = {0};
+    val.type = TYPE_NULL;
+    return db_bind_value(stmt, index, &val);
+}
+
+bool db_bind_int(DbStatement *stmt, int index, long long value) {
+    Value val = {0};
+    val.type = TYPE_INT;
+    val.int_val = value;
+    return db_bind_value(stmt, index, &val);
+}
+
+bool db_bind_float(DbStatement *stmt, int index, double value) {
+    Value val = {0};
+    val.type = TYPE_FLOAT;
+    val.float_val = value;
+    return db_bind_value(stmt, index, &val);
+}
+
+bool db_bind_bool(DbStatement *stmt, int index, bool value) {
+    Value val = {0};
+    val.type = TYPE_BOOLEAN;
+    val.bool_val = value;
+    return db_bind_value(stmt, index, &val);
+}
+
+bool db_bind_text(DbStatement *stmt, int index, const char *value) {
+    if (!value)
+        return db_bind_null(stmt, index);
+    Value val = make_string_value(value);
+    bool ok = db_bind_value(stmt, index, &val);
+    free_value(&val);
+    return ok;
+}
+
+bool db_run(DbStatement *stmt) {
+    if (!stmt || !statement_validate(stmt))
+        return false;
+    for (ASTNode *node = stmt->ast; node; node = node->next)
+        exec_statement(node);
+    return true;
+}
+
+/* Marks the statement failed if an error was logged since it started. */
+static bool statement_check(DbStatement *stmt) {
+    if (!stmt->failed && log_error_count() != stmt->errors) {
+        stmt->failed = true;
+        strcopy(stmt->error, sizeof(stmt->error), log_last_error());
+    }
+    return !stmt->failed;
+}
+
+/* A lone SELECT (not EXPLAIN) is opened as a cursor and its rows read a batch at a time; anything else
+   runs to completion on the first step and keeps its result. */
+static bool statement_start(DbStatement *stmt) {
+    stmt->errors = log_error_count();
+    stmt->failed = false;
+    if (!statement_validate(stmt)) {
+        statement_check(stmt);
+        return false;
+    }
+    stmt->executed = true;
+    stmt->next_row = -1;
+    stmt->batch = NULL;
+    stmt->changes = 0;
+    if (stmt->ast->type == AST_SELECT && !stmt->ast->next && !stmt->ast->select.explain) {
+        txn_statement_begin();
+        stmt->cursor = exec_select_open(&stmt->ast->select);
+        if (!stmt->cursor) {
+            subquery_statement_end();
+            txn_statement_end();
+            statement_check(stmt);
+            return false;
+        }
+        return true;
+    }
+    QueryResult *saved_result = g_last_result;
+    g_last_result = NULL;
+    exec_ast(stmt->ast);
+    stmt->changes = exec_rows_changed();
+    stmt->result = g_last_result;
+    g_last_result = saved_result;
+    return statement_check(stmt);
+}
+
+/* Ends the SELECT's statement, keeping the column names for db_column_name. */
+static void statement_finish(DbStatement *stmt) {
+    if (!stmt->cursor)
+        return;
+    stmt->result = stmt->cursor->ctx.result;
+    stmt->cursor->ctx.result = NULL;
+    exec_select_close(stmt->cursor);
+    stmt->cursor = NULL;
+    stmt->batch = NULL;
+    subquery_statement_end();
+    txn_statement_end();
+}
+
+DbStep db_step(DbStatement *stmt) {
+    if (!stmt)
+        return DB_ERROR;
+    if (!stmt->executed && !statement_start(stmt))
+        return DB_ERROR;
+    if (stmt->failed)
+        return DB_ERROR;
+    if (stmt->cursor) {
+        if (stmt->batch && stmt->batch_row + 1 < stmt->batch->row_count) {
+            stmt->batch_row++;
+            return DB_ROW;
+        }
+        stmt->batch = exec_select_next(stmt->cursor);
+        if (!stmt->batch) {
+            statement_finish(stmt);
+            return statement_check(stmt) ? DB_DONE : DB_ERROR;
+        }
+        stmt->batch_row = 0;
+        return DB_ROW;
+    }
+    if (!stmt->result || stmt->next_row + 1 >= alist_length(&stmt->result->rows)) {
+        stmt->next_row = stmt->result ? alist_length(&stmt->result->rows) : 0;
+        return DB_DONE;
+    }
+    stmt->next_row++;
+    return DB_ROW;
+}
+
+const ResultBatch *db_step_batch(DbStatement *stmt) {
+    if (!stmt || (!stmt->executed && !statement_start(stmt)) || !stmt->cursor)
+        return NULL;
+    stmt->batch = exec_select_next(stmt->cursor);
+    if (!stmt->batch) {
+        statement_finish(stmt);
+        statement_check(stmt);
+        return NULL;
+    }
+    stmt->batch_row = stmt->batch->row_count - 1;
+    return stmt->batch;
+}
+
+static const QueryResult *statement_columns(const DbStatement *stmt) {
+    return stmt->cursor ? stmt->cursor->ctx.result : stmt->result;
+}
+
+int db_column_count(const DbStatement *stmt) {
+    const QueryResult *columns = stmt ? statement_columns(stmt) : NULL;
+    return columns ? columns->col_count : 0;
+}
+
+const char *db_column_name(const DbStatement *stmt, int col) {
+    if (col < 0 || col >= db_column_count(stmt))
+        return NULL;
+    return *(char **)alist_get(&statement_columns(stmt)->column_names, col);
+}
+
+const Value *db_column_value(const DbStatement *stmt, int col) {
+    if (col < 0 || col >= db_column_count(stmt))
+        return NULL;
+    if (stmt->cursor) {
+        const ResultBatch *batch = stmt->batch;
+        if (!batch || stmt->batch_row < 0 || stmt->batch_row >= batch->row_count)
+            return NULL;
+        return &batch->values[col * batch->capacity + stmt->batch_row];
+    }
+    if (stmt->next_row < 0 || stmt->next_row >= alist_length(&stmt->result->rows))
+        return NULL;
+    return (const Value *)alist_get(&stmt->result->values,
+                                    stmt->next_row * stmt->result->col_count + col);
+}
+
+void db_reset(DbStatement *stmt) {
+    if (!stmt)
+        return;
+    statement_finish(stmt);
+    free_query_result(stmt->result);
+    stmt->result = NULL;
+    stmt->executed = false;
+    stmt->failed = false;
+    stmt->next_row = -1;
+}
+
+/* Rows the statement's last run inserted, updated, deleted or copied; 0 for a SELECT. */
+long long db_changes(const DbStatement *stmt) {
+    return stmt ? stmt->changes : 0;
+}
+
+/* Why the last step returned DB_ERROR: the last error the run logged. NULL if it has not
+   failed. */
+const char *db_error_message(const DbStatement *stmt) {
+    return stmt && stmt->failed ? stmt->error : NULL;
+}
+
+void db_set_print_results(bool print) {
+    exec_set_print_results(print);
+}
+
+void db_finalize(DbStatement *stmt) {
+    if (!stmt)
+        return;
+    db_reset(stmt);
+    free_ast(stmt->ast);
+    for (int i = 0; stmt->bound && i < stmt->param_count; i++)
+        free_value(&stmt->bound[i]);
+    free(stmt->bound);
+    free(stmt->slots);
+    free(stmt->sql);
+    free(stmt);
+}
+
+/* A statement's cache key: its tokens separated by single spaces, so whitespace and comments
+   do not matter, with its number and string literals replaced by parameters (the values go in
+   literals). Literals that shape the plan instead of feeding it stay in the key: LIMIT counts,
+   TABLESAMPLE arguments, LIKE patterns and IN lists (both built once at parse time) and
+   APPROX_PERCENTILE fractions, as do negative numbers ("a -1" is a subtraction) and literals of
+   anything but a single SELECT, INSERT, UPDATE or DELETE. exact is the key with every literal
+   kept, for statements whose shape does not parse. */
+typedef struct {
+    Token *tokens; /* the literals' text */
+    char *key;
+    char *exact;
+    uint64_t hash;
+    uint64_t exact_hash;
+    Value *literals;
+    int literal_count;
+} StatementShape;
+
+static uint64_t hash_text(const char *text) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const char *p = text; *p; p++)
+        h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    return h;
+}
+
+/* The input a token was read from: its text, plus the quotes around a quoted one. */
+static int token_span(const char *sql, const Token *token) {
+    char c = sql[token->offset];
+    if ((token->type == TOKEN_STRING || token->type == TOKEN_DATE || token->type == TOKEN_TIME ||
+         token->type == TOKEN_IDENTIFIER) &&
+        (c == '\'' || c == '"' || c == '`')) {
+        int end = token->offset + 1 + token->length;
+        return end - token->offset + (sql[end] == c);
+    }
+    return token->length;
+}
+
+static bool token_is(const Token *token, TokenType type, const char *text) {
+    return token->type == type && strcasecmp(token->value, text) == 0;
+}
+
+static bool shapeable(const Token *tokens, int count) {
+    if (count == 0 || !(token_is(&tokens[0], TOKEN_KEYWORD, "SELECT") ||
+                        token_is(&tokens[0], TOKEN_KEYWORD, "INSERT") ||
+                        token_is(&tokens[0], TOKEN_KEYWORD, "UPDATE") ||
+                        token_is(&tokens[0], TOKEN_KEYWORD, "DELETE")))
+        return false;
+    for (int t = 0; t < count; t++)
+        if (tokens[t].type == TOKEN_PARAM || tokens[t].type == TOKEN_SEMICOLON)
+            return false;
+    return true;
+}
+
+static void shape_free(StatementShape *shape) {
+    free_tokens(shape->tokens);
+    free(shape->key);
+    free(shape->exact);
+    free(shape->literals);
+}
+
+static bool statement_shape(const char *sql, StatementShape *shape) {
+    memclear(shape, sizeof(StatementShape));
+    size_t len = strlen(sql);
+    shape->tokens = tokenize(sql);
+    shape->key = malloc(len * 2 + 2);
+    shape->exact = malloc(len * 2 + 2);
+    int count = 0;
+    while (shape->tokens && shape->tokens[count].type != TOKEN_EOF)
+        count++;
+    /* Trailing semicolons end the statement without changing it. */
+    while (count > 0 && shape->tokens[count - 1].type == TOKEN_SEMICOLON)
+        count--;
+    shape->literals = malloc(sizeof(Value) * (size_t)(count + 1));
+    if (!shape->tokens || !shape->key || !shape->exact || !shape->literals) {
+        shape_free(shape);
+        return false;
+    }
+
+    bool literals = shapeable(shape->tokens, count);
+    int depth = 0;
+    int frozen = 0;      /* depth of the parenthesis whose literals stay, 0 for none */
+    bool freeze = false; /* the next parenthesis keeps its literals */
+    bool keep = false;   /* the next token is a literal that stays */
+    size_t n = 0, m = 0;
+    for (int t = 0; t < count; t++) {
+        const Token *token = &shape->tokens[t];
+        if (t > 0) {
+            shape->key[n++] = ' ';
+            shape->exact[m++] = ' ';
+        }
+        int span = token_span(sql, token);
+        memcpy(shape->exact + m, sql + token->offset, (size_t)span);
+        m += (size_t)span;
+        bool number = token->type == TOKEN_NUMBER && token->value[0] != '-';
+        bool string = token->type == TOKEN_STRING && sql[token->offset] == '\'' &&
+                      strcmp(token->value, "*") != 0;
+        if (literals && (number || string) && !keep && !frozen) {
+            Value *val = &shape->literals[shape->literal_count++];
+            memclear(val, sizeof(Value));
+            if (string) {
+                val->type = TYPE_STRING;
+                val->char_val = (char *)token->value;
+            } else if (strchr(token->value, '.')) {
+                val->type = TYPE_FLOAT;
+                val->float_val = atof(token->value);
+            } else {
+                val->type = TYPE_INT;
+                val->int_val = atol(token->value);
+            }
+            shape->key[n++] = '?';
+        } else {
+            memcpy(shape->key + n, sql + token->offset, (size_t)span);
+            n += (size_t)span;
+        }
+
+        keep = token->type == TOKEN_LIKE || token_is(token, TOKEN_KEYWORD, "LIMIT");
+        if (token->type == TOKEN_LPAREN) {
+            depth++;
+            if (freeze && !frozen)
+                frozen = depth;
+            freeze = false;
+        } else if (token->type == TOKEN_RPAREN) {
+            if (frozen == depth)
+                frozen = 0;
+            depth--;
+        }
+        if (token->type == TOKEN_IN || token_is(token, TOKEN_KEYWORD, "TABLESAMPLE") ||
+            token_is(token, TOKEN_IDENTIFIER, "REPEATABLE") ||
+            token_is(token, TOKEN_AGGREGATE_FUNC, "APPROX_PERCENTILE"))
+            freeze = true;
+    }
+    shape->key[n] = '\0';
+    shape->exact[m] = '\0';
+    shape->hash = hash_text(shape->key);
+    shape->exact_hash = hash_text(shape->exact);
+    return true;
+}
+
+static bool cacheable(const ASTNode *ast, int param_count) {
+    if (ast->next || ast->param_count != param_count)
+        return false;
+    return ast->type == AST_SELECT || ast->type == AST_INSERT_ROW ||
+           ast->type == AST_UPDATE_ROW || ast->type == AST_DELETE_ROW;
+}
+
+static void cache_entry_free(StmtCacheEntry *entry) {
+    db_finalize(entry->stmt);
+    free(entry->key);
+    memclear(entry, sizeof(StmtCacheEntry));
+}
+
+static void cache_insert(char *key, uint64_t hash, DbStatement *stmt) {
+    StmtCacheEntry *victim = &g_cache[0];
+    for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+        if (!g_cache[i].stmt) {
+            victim = &g_cache[i];
+            break;
+        }
+        if (g_cache[i].last_used < victim->last_used)
+            victim = &g_cache[i];
+    }
+    if (victim->stmt) {
+        cache_entry_free(victim);
+        g_cache_stats.evictions++;
+    }
+    victim->key = key;
+    victim->hash = hash;
+    victim->last_used = ++g_cache_tick;
+    victim->stmt = stmt;
+}
+
+static StmtCacheEntry *cache_find(const char *key, uint64_t hash) {
+    for (int i = 0; i < STMT_CACHE_SIZE; i++)
+        if (g_cache[i].stmt && g_cache[i].hash == hash && strcmp(g_cache[i].key, key) == 0)
+            return &g_cache[i];
+    return NULL;
+}
+
+/* Parses the statement's shape, whose parameters are its literals, and binds them. NULL if
+   the shape is not a statement the cache keeps or a literal did not become a parameter the
+   tree can be bound through; the text is then cached as written. */
+static DbStatement *shape_prepare(StatementShape *shape) {
+    log_mute(true);
+    ASTNode *ast = parse_sql(shape->key, false);
+    log_mute(false);
+    if (ast && !cacheable(ast, shape->literal_count)) {
+        free_ast(ast);
+        ast = NULL;
+    }
+    DbStatement *stmt = ast ? statement_create(shape->key, ast) : NULL;
+    for (int i = 0; stmt && i < stmt->param_count; i++) {
+        if (!stmt->slots[i]) {
+            db_finalize(stmt);
+            stmt = NULL;
+        }
+    }
+    return stmt;
+}
+
+static void shape_bind(DbStatement *stmt, const StatementShape *shape) {
+    for (int i = 0; i < stmt->param_count; i++)
+        db_bind_value(stmt, i + 1, &shape->literals[i]);
+}
+
+/* Parses and runs SQL text the way the CLI does, reporting parse errors; single SELECT,
+   INSERT, UPDATE and DELETE statements are served from the statement cache, and ones that
+   differ only in their literals share an entry. */
+bool db_exec(const char *sql) {
+    StatementShape shape;
+    if (!statement_shape(sql, &shape)) {
+        log_msg(LOG_ERROR, "db_exec: Out of memory");
+        return false;
+    }
+    StmtCacheEntry *entry = cache_find(shape.key, shape.hash);
+    if (!entry && shape.literal_count > 0)
+        entry = cache_find(shape.exact, shape.exact_hash);
+    if (entry) {
+        g_cache_stats.hits++;
+        entry->last_used = ++g_cache_tick;
+        if (!statement_validate(entry->stmt)) {
+            cache_entry_free(entry);
+            shape_free(&shape);
+            return false;
+        }
+        shape_bind(entry->stmt, &shape);
+        exec_ast(entry->stmt->ast);
+        shape_free(&shape);
+        return true;
+    }
+
+    g_cache_stats.misses++;
+    DbStatement *stmt = shape.literal_count > 0 ? shape_prepare(&shape) : NULL;
+    if (stmt) {
+        shape_bind(stmt, &shape);
+        cache_insert(shape.key, shape.hash, stmt);
+        shape.key = NULL;
+        exec_ast(stmt->ast);
+        shape_free(&shape);
+        return true;
+    }
+    ASTNode *ast = parse_sql(sql, true);
+    if (!ast || !cacheable(ast, 0)) {
+        if (ast) {
+            exec_ast(ast);
+            free_ast(ast);
+        }
+        shape_free(&shape);
+        return ast != NULL;
+    }
+    stmt = statement_create(sql, ast);
+    if (stmt) {
+        cache_insert(shape.exact, shape.exact_hash, stmt);
+        shape.exact = NULL;
+        exec_ast(stmt->ast);
+    }
+    shape_free(&shape);
+    return stmt != NULL;
+}
+
+void db_stmt_cache_clear(void) {
+    for (int i = 0; i < STMT_CACHE_SIZE; i++)
+        if (g_cache[i].stmt)
+            cache_entry_free(&g_cache[i]);
+}
+
+void db_stmt_cache_get_stats(StmtCacheStats *stats) {
+    *stats = g_cache_stats;
+    stats->entries = 0;
+    for (int i = 0; i < STMT_CACHE_SIZE; i++)
+        stats->entries += g_cache[i].stmt != NULL;
+}
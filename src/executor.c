@@ -7,11 +7,14 @@
 #include "db.h"
 #include "executor.h"
 #include "logger.h"
+#include "metrics.h"
+#include "storage.h"
 #include "table.h"
+#include "txn.h"
 
 QueryResult *g_last_result = NULL;
-ArrayList g_agg_res;
-bool g_in_agg_context = false;
+static bool g_print_results = true;
+static long long g_rows_changed;
 
 QueryResult *get_last_query_result(void) {
     return g_last_result;
@@ -20,18 +23,12 @@ void set_last_query_result(QueryResult *result) {
     g_last_result = result;
 }
 
-static bool has_aggregate_expr(ASTNode *ast) {
-    if (!ast || ast->type != AST_SELECT)
-        return false;
-    SelectNode *select = &ast->select;
-    int count = alist_length(&select->expressions);
-    for (int i = 0; i < count; i++) {
-        Expr **expr_ptr = (Expr **)alist_get(&select->expressions, i);
-        if (expr_ptr && *expr_ptr && (*expr_ptr)->type == EXPR_AGGREGATE_FUNC) {
-            return true;
-        }
-    }
-    return false;
+/* Rows the last INSERT, UPDATE, DELETE or COPY wrote; every statement starts it at 0. */
+long long exec_rows_changed(void) {
+    return g_rows_changed;
+}
+void exec_note_rows_changed(long long rows) {
+    g_rows_changed += rows;
 }
 
 void free_query_result(QueryResult *result) {
@@ -40,32 +37,176 @@ void free_query_result(QueryResult *result) {
     alist_destroy(&result->column_names);
     alist_destroy(&result->values);
     alist_destroy(&result->rows);
+    arena_destroy(&result->arena);
     free(result);
 }
 
-static void exec_select_ast(ASTNode *current) {
-    SelectNode *select = &current->select;
-    bool has_agg = has_aggregate_expr(current);
-    bool has_join = select->join_type != JOIN_NONE;
-    uint8_t result_table_id = select->table_id;
-
-    if (has_join) {
-        result_table_id = exec_join_ast(current);
-        if (result_table_id == 0) {
-            log_msg(LOG_ERROR, "exec_ast: JOIN failed");
-            return;
-        }
+/* Plans the SELECT into an operator tree and pulls batches through it; the Project sink at
+   the root collects the rows into the returned result (NULL when the SELECT failed). */
+QueryResult *exec_select_query(const SelectNode *select) {
+    ExecContext ctx;
+    if (!exec_context_init(&ctx, select)) {
+        exec_context_free(&ctx);
+        return NULL;
     }
 
-    if (select->where_clause) {
-        exec_filter_ast(current, result_table_id);
+    PlanNode *plan = plan_select(select);
+    Operator *root = operator_build(plan, &ctx);
+    if (root && operator_open(root)) {
+        RowBatch batch;
+        row_batch_init(&batch);
+        while (operator_next(root, &batch))
+            ;
+        row_batch_free(&batch);
+    }
+    operator_close(root);
+    free_plan(plan);
+
+    QueryResult *result = ctx.result;
+    ctx.result = NULL;
+    exec_context_free(&ctx);
+    return result;
+}
+
+/* Opens the SELECT for exec_select_next to read a batch at a time; NULL when it cannot run.
+   The caller brackets it as one statement (txn_statement_begin and _end) around the
+   cursor's whole life. */
+QueryCursor *exec_select_open(const SelectNode *select) {
+    QueryCursor *cursor = calloc(1, sizeof(QueryCursor));
+    if (!cursor) {
+        log_msg(LOG_ERROR, "exec_select_open: Out of memory");
+        return NULL;
+    }
+    arena_init(&cursor->arena, ARENA_BLOCK_SIZE);
+    arena_init(&cursor->batch.arena, 0);
+    row_batch_init(&cursor->out);
+    bool ok = exec_context_init_in(&cursor->ctx, select, &cursor->arena);
+    if (ok) {
+        cursor->ctx.stream = &cursor->batch;
+        cursor->plan = plan_select(select);
+        cursor->root = operator_build(cursor->plan, &cursor->ctx);
+        ok = cursor->root && operator_open(cursor->root);
+    }
+    if (!ok) {
+        exec_select_close(cursor);
+        return NULL;
     }
+    return cursor;
+}
 
-    if (has_agg) {
-        exec_aggregate_ast(current, result_table_id);
+/* The next batch of rows, NULL once there are no more. */
+const ResultBatch *exec_select_next(QueryCursor *cursor) {
+    while (!cursor->done) {
+        if (!operator_next(cursor->root, &cursor->out))
+            cursor->done = true;
+        else if (cursor->batch.row_count > 0)
+            return &cursor->batch;
     }
+    return NULL;
+}
+
+void exec_select_close(QueryCursor *cursor) {
+    if (!cursor)
+        return;
+    operator_close(cursor->root);
+    free_plan(cursor->plan);
+    row_batch_free(&cursor->out);
+    free_query_result(cursor->ctx.result);
+    cursor->ctx.result = NULL;
+    exec_context_free(&cursor->ctx);
+    arena_destroy(&cursor->arena);
+    arena_destroy(&cursor->batch.arena);
+    free(cursor->batch.values);
+    free(cursor);
+}
+
+/* Programs that read results through the API turn off the table the CLI prints. */
+void exec_set_print_results(bool print) {
+    g_print_results = print;
+}
+
+static void exec_select_ast(ASTNode *current) {
+    QueryResult *result = current->select.explain ? exec_explain_query(&current->select)
+                                                  : exec_select_query(&current->select);
+    if (!result)
+        return;
+    free_query_result(g_last_result);
+    g_last_result = result;
+    if (g_print_results && current->select.explain)
+        print_query_plan(g_last_result);
+    else if (g_print_results)
+        print_pretty_result(g_last_result);
+    Table *table = get_table_by_id(current->select.table_id);
+    log_msg(LOG_INFO, "Projected %d rows from table '%s'", alist_length(&g_last_result->rows),
+            table ? table->name : "?");
+}
 
-    exec_project_ast(current, result_table_id);
+/* Runs one statement of a chain; exec_ast brackets it as a transaction statement. */
+void exec_statement(ASTNode *node) {
+    uint64_t start = metrics_now_us();
+    g_rows_changed = 0;
+    switch (node->type) {
+    case AST_CREATE_TABLE:
+        exec_create_table_ast(node);
+        break;
+    case AST_INSERT_ROW:
+        exec_insert_row_ast(node);
+        break;
+    case AST_SELECT:
+        exec_select_ast(node);
+        break;
+    case AST_DROP_TABLE:
+        exec_drop_table_ast(node);
+        break;
+    case AST_UPDATE_ROW:
+        exec_update_row_ast(node);
+        break;
+    case AST_DELETE_ROW:
+        exec_delete_row_ast(node);
+        break;
+    case AST_COPY:
+        exec_copy_ast(node);
+        break;
+    case AST_CREATE_INDEX:
+        exec_create_index_ast(node);
+        break;
+    case AST_DROP_INDEX:
+        exec_drop_index_ast(node);
+        break;
+    case AST_ANALYZE:
+        exec_analyze_ast(node);
+        break;
+    case AST_SET:
+        exec_set_ast(node);
+        break;
+    case AST_PREPARE:
+        exec_prepare_ast(node);
+        break;
+    case AST_EXECUTE:
+        exec_execute_ast(node);
+        break;
+    case AST_DEALLOCATE:
+        exec_deallocate_ast(node);
+        break;
+    case AST_CREATE_VIEW:
+        exec_create_view_ast(node);
+        break;
+    case AST_BEGIN:
+        txn_begin();
+        break;
+    case AST_COMMIT:
+        txn_commit();
+        break;
+    case AST_ROLLBACK:
+        txn_rollback();
+        break;
+    default:
+        log_msg(LOG_WARN, "exec_ast: Unknown AST node type: %d", node->type);
+        break;
+    }
+    subquery_statement_end();
+    metrics_add(METRIC_STATEMENTS, 1);
+    metrics_record(METRIC_STATEMENT_US, metrics_now_us() - start);
 }
 
 void exec_ast(ASTNode *ast) {
@@ -76,44 +217,18 @@ void exec_ast(ASTNode *ast) {
 
     log_msg(LOG_DEBUG, "exec_ast: executing AST");
 
-    g_in_agg_context = false;
-    alist_init(&g_agg_res, sizeof(Value), free_value);
-
     ASTNode *curr = ast;
     while (curr) {
-        switch (curr->type) {
-        case AST_CREATE_TABLE:
-            exec_create_table_ast(curr);
-            break;
-        case AST_INSERT_ROW:
-            exec_insert_row_ast(curr);
-            break;
-        case AST_SELECT:
-            exec_select_ast(curr);
-            break;
-        case AST_DROP_TABLE:
-            exec_drop_table_ast(curr);
-            break;
-        case AST_UPDATE_ROW:
-            exec_update_row_ast(curr);
-            break;
-        case AST_DELETE_ROW:
-            exec_delete_row_ast(curr);
-            break;
-        case AST_CREATE_INDEX:
-            exec_create_index_ast(curr);
-            break;
-        case AST_DROP_INDEX:
-            exec_drop_index_ast(curr);
-            break;
-        default:
-            log_msg(LOG_WARN, "exec_ast: Unknown AST node type: %d", curr->type);
-            break;
-        }
+        txn_statement_begin();
+        exec_statement(curr);
+        txn_statement_end();
+        storage_commit();
+        /* An explicit COMMIT returns once its changes are on disk. */
+        if (curr->type == AST_COMMIT)
+            storage_sync();
 
         curr = curr->next;
     }
 
-    alist_destroy(&g_agg_res);
     log_msg(LOG_DEBUG, "exec_ast: AST execution completed");
 }
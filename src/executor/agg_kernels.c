@@ -0,0 +1,639 @@
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AGG_KERNELS_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define AGG_KERNELS_NEON 1
+#endif
+
+/* Numeric aggregate kernels. The SIMD paths only ever see dense runs of valid values; the
+   driver below walks the validity bitmap and hands them the fully-set bytes, and every run
+   is folded into the NumericAgg with Chan's parallel Welford merge so STDDEV/VARIANCE stay
+   numerically stable. */
+
+#define AGG_RUN_MAX FILTER_BATCH_SIZE
+
+typedef void (*F64BlockFn)(const double *v, int n, double *sum, double *min, double *max);
+typedef double (*F64M2Fn)(const double *v, int n, double mean);
+typedef void (*I64BlockFn)(const long long *v, int n, long long *sum, long long *min,
+                           long long *max);
+typedef double (*I64M2Fn)(const long long *v, int n, double mean);
+
+/* The SIMD i64_m2 kernels convert with the 2^52 + 2^51 bias trick, exact for values within
+   this bound; add_i64_run falls back to the scalar kernel outside it. */
+#define I64_M2_VECTOR_BOUND (1LL << 51)
+
+typedef struct {
+    const char *name;
+    F64BlockFn f64_block;
+    F64M2Fn f64_m2;
+    I64BlockFn i64_block;
+    I64M2Fn i64_m2;
+} AggKernels;
+
+static void f64_block_scalar(const double *v, int n, double *sum, double *min, double *max) {
+    double s = 0.0;
+    double lo = INFINITY;
+    double hi = -INFINITY;
+    for (int i = 0; i < n; i++) {
+        s += v[i];
+        lo = v[i] < lo ? v[i] : lo;
+        hi = v[i] > hi ? v[i] : hi;
+    }
+    *sum = s;
+    *min = lo;
+    *max = hi;
+}
+
+static double f64_m2_scalar(const double *v, int n, double mean) {
+    double m2 = 0.0;
+    for (int i = 0; i < n; i++) {
+        double d = v[i] - mean;
+        m2 += d * d;
+    }
+    return m2;
+}
+
+static void i64_block_scalar(const long long *v, int n, long long *sum, long long *min,
+                             long long *max) {
+    unsigned long long s = 0; /* wraps; add_i64_run rechecks */
+    long long lo = n > 0 ? v[0] : LLONG_MAX;
+    long long hi = n > 0 ? v[0] : LLONG_MIN;
+    for (int i = 0; i < n; i++) {
+        s += (unsigned long long)v[i];
+        lo = v[i] < lo ? v[i] : lo;
+        hi = v[i] > hi ? v[i] : hi;
+    }
+    *sum = (long long)s;
+    *min = lo;
+    *max = hi;
+}
+
+static double i64_m2_scalar(const long long *v, int n, double mean) {
+    double m2 = 0.0;
+    for (int i = 0; i < n; i++) {
+        double d = (double)v[i] - mean;
+        m2 += d * d;
+    }
+    return m2;
+}
+
+#ifdef AGG_KERNELS_X86
+__attribute__((target("avx2"))) static void f64_block_avx2(const double *v, int n, double *sum,
+                                                            double *min, double *max) {
+    __m256d s = _mm256_setzero_pd();
+    __m256d lo = _mm256_set1_pd(INFINITY);
+    __m256d hi = _mm256_set1_pd(-INFINITY);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(v + i);
+        s = _mm256_add_pd(s, x);
+        lo = _mm256_min_pd(lo, x);
+        hi = _mm256_max_pd(hi, x);
+    }
+    double ts[4], tl[4], th[4];
+    _mm256_storeu_pd(ts, s);
+    _mm256_storeu_pd(tl, lo);
+    _mm256_storeu_pd(th, hi);
+    double rs, rl, rh;
+    f64_block_scalar(v + i, n - i, &rs, &rl, &rh);
+    for (int k = 0; k < 4; k++) {
+        rs += ts[k];
+        rl = tl[k] < rl ? tl[k] : rl;
+        rh = th[k] > rh ? th[k] : rh;
+    }
+    *sum = rs;
+    *min = rl;
+    *max = rh;
+}
+
+__attribute__((target("avx2"))) static double f64_m2_avx2(const double *v, int n, double mean) {
+    __m256d acc = _mm256_setzero_pd();
+    __m256d m = _mm256_set1_pd(mean);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d d = _mm256_sub_pd(_mm256_loadu_pd(v + i), m);
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(d, d));
+    }
+    double t[4];
+    _mm256_storeu_pd(t, acc);
+    return t[0] + t[1] + t[2] + t[3] + f64_m2_scalar(v + i, n - i, mean);
+}
+
+__attribute__((target("avx2"))) static void i64_block_avx2(const long long *v, int n,
+                                                            long long *sum, long long *min,
+                                                            long long *max) {
+    if (n < 4) {
+        i64_block_scalar(v, n, sum, min, max);
+        return;
+    }
+    __m256i s = _mm256_setzero_si256();
+    __m256i lo = _mm256_loadu_si256((const __m256i *)v);
+    __m256i hi = lo;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+        s = _mm256_add_epi64(s, x);
+        lo = _mm256_blendv_epi8(lo, x, _mm256_cmpgt_epi64(lo, x));
+        hi = _mm256_blendv_epi8(hi, x, _mm256_cmpgt_epi64(x, hi));
+    }
+    long long ts[4], tl[4], th[4];
+    _mm256_storeu_si256((__m256i *)ts, s);
+    _mm256_storeu_si256((__m256i *)tl, lo);
+    _mm256_storeu_si256((__m256i *)th, hi);
+    unsigned long long rs = 0;
+    long long rl = tl[0], rh = th[0];
+    for (int k = 0; k < 4; k++) {
+        rs += (unsigned long long)ts[k];
+        rl = tl[k] < rl ? tl[k] : rl;
+        rh = th[k] > rh ? th[k] : rh;
+    }
+    for (; i < n; i++) {
+        rs += (unsigned long long)v[i];
+        rl = v[i] < rl ? v[i] : rl;
+        rh = v[i] > rh ? v[i] : rh;
+    }
+    *sum = (long long)rs;
+    *min = rl;
+    *max = rh;
+}
+
+__attribute__((target("avx2"))) static double i64_m2_avx2(const long long *v, int n,
+                                                          double mean) {
+    __m256d bias = _mm256_set1_pd(6755399441055744.0); /* 2^52 + 2^51 */
+    __m256i bias_bits = _mm256_castpd_si256(bias);
+    __m256d acc = _mm256_setzero_pd();
+    __m256d m = _mm256_set1_pd(mean);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(v + i)), bias_bits);
+        __m256d d = _mm256_sub_pd(_mm256_sub_pd(_mm256_castsi256_pd(x), bias), m);
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(d, d));
+    }
+    double t[4];
+    _mm256_storeu_pd(t, acc);
+    return t[0] + t[1] + t[2] + t[3] + i64_m2_scalar(v + i, n - i, mean);
+}
+
+__attribute__((target("sse4.2"))) static void f64_block_sse4(const double *v, int n, double *sum,
+                                                              double *min, double *max) {
+    __m128d s = _mm_setzero_pd();
+    __m128d lo = _mm_set1_pd(INFINITY);
+    __m128d hi = _mm_set1_pd(-INFINITY);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(v + i);
+        s = _mm_add_pd(s, x);
+        lo = _mm_min_pd(lo, x);
+        hi = _mm_max_pd(hi, x);
+    }
+    double ts[2], tl[2], th[2];
+    _mm_storeu_pd(ts, s);
+    _mm_storeu_pd(tl, lo);
+    _mm_storeu_pd(th, hi);
+    double rs, rl, rh;
+    f64_block_scalar(v + i, n - i, &rs, &rl, &rh);
+    for (int k = 0; k < 2; k++) {
+        rs += ts[k];
+        rl = tl[k] < rl ? tl[k] : rl;
+        rh = th[k] > rh ? th[k] : rh;
+    }
+    *sum = rs;
+    *min = rl;
+    *max = rh;
+}
+
+__attribute__((target("sse4.2"))) static double f64_m2_sse4(const double *v, int n, double mean) {
+    __m128d acc = _mm_setzero_pd();
+    __m128d m = _mm_set1_pd(mean);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d d = _mm_sub_pd(_mm_loadu_pd(v + i), m);
+        acc = _mm_add_pd(acc, _mm_mul_pd(d, d));
+    }
+    double t[2];
+    _mm_storeu_pd(t, acc);
+    return t[0] + t[1] + f64_m2_scalar(v + i, n - i, mean);
+}
+
+__attribute__((target("sse4.2"))) static void i64_block_sse4(const long long *v, int n,
+                                                              long long *sum, long long *min,
+                                                              long long *max) {
+    if (n < 2) {
+        i64_block_scalar(v, n, sum, min, max);
+        return;
+    }
+    __m128i s = _mm_setzero_si128();
+    __m128i lo = _mm_loadu_si128((const __m128i *)v);
+    __m128i hi = lo;
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+        s = _mm_add_epi64(s, x);
+        lo = _mm_blendv_epi8(lo, x, _mm_cmpgt_epi64(lo, x));
+        hi = _mm_blendv_epi8(hi, x, _mm_cmpgt_epi64(x, hi));
+    }
+    long long ts[2], tl[2], th[2];
+    _mm_storeu_si128((__m128i *)ts, s);
+    _mm_storeu_si128((__m128i *)tl, lo);
+    _mm_storeu_si128((__m128i *)th, hi);
+    unsigned long long rs = (unsigned long long)ts[0] + (unsigned long long)ts[1];
+    long long rl = tl[0] < tl[1] ? tl[0] : tl[1];
+    long long rh = th[0] > th[1] ? th[0] : th[1];
+    for (; i < n; i++) {
+        rs += (unsigned long long)v[i];
+        rl = v[i] < rl ? v[i] : rl;
+        rh = v[i] > rh ? v[i] : rh;
+    }
+    *sum = (long long)rs;
+    *min = rl;
+    *max = rh;
+}
+
+__attribute__((target("sse4.2"))) static double i64_m2_sse4(const long long *v, int n,
+                                                            double mean) {
+    __m128d bias = _mm_set1_pd(6755399441055744.0); /* 2^52 + 2^51 */
+    __m128i bias_bits = _mm_castpd_si128(bias);
+    __m128d acc = _mm_setzero_pd();
+    __m128d m = _mm_set1_pd(mean);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i x = _mm_add_epi64(_mm_loadu_si128((const __m128i *)(v + i)), bias_bits);
+        __m128d d = _mm_sub_pd(_mm_sub_pd(_mm_castsi128_pd(x), bias), m);
+        acc = _mm_add_pd(acc, _mm_mul_pd(d, d));
+    }
+    double t[2];
+    _mm_storeu_pd(t, acc);
+    return t[0] + t[1] + i64_m2_scalar(v + i, n - i, mean);
+}
+#endif
+
+#ifdef AGG_KERNELS_NEON
+static void f64_block_neon(const double *v, int n, double *sum, double *min, double *max) {
+    float64x2_t s = vdupq_n_f64(0.0);
+    float64x2_t lo = vdupq_n_f64(INFINITY);
+    float64x2_t hi = vdupq_n_f64(-INFINITY);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        float64x2_t x = vld1q_f64(v + i);
+        s = vaddq_f64(s, x);
+        lo = vminq_f64(lo, x);
+        hi = vmaxq_f64(hi, x);
+    }
+    double rs, rl, rh;
+    f64_block_scalar(v + i, n - i, &rs, &rl, &rh);
+    rs += vaddvq_f64(s);
+    rl = vminvq_f64(lo) < rl ? vminvq_f64(lo) : rl;
+    rh = vmaxvq_f64(hi) > rh ? vmaxvq_f64(hi) : rh;
+    *sum = rs;
+    *min = rl;
+    *max = rh;
+}
+
+static double f64_m2_neon(const double *v, int n, double mean) {
+    float64x2_t acc = vdupq_n_f64(0.0);
+    float64x2_t m = vdupq_n_f64(mean);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        float64x2_t d = vsubq_f64(vld1q_f64(v + i), m);
+        acc = vfmaq_f64(acc, d, d);
+    }
+    return vaddvq_f64(acc) + f64_m2_scalar(v + i, n - i, mean);
+}
+
+static void i64_block_neon(const long long *v, int n, long long *sum, long long *min,
+                           long long *max) {
+    if (n < 2) {
+        i64_block_scalar(v, n, sum, min, max);
+        return;
+    }
+    int64x2_t s = vdupq_n_s64(0);
+    int64x2_t lo = vld1q_s64((const int64_t *)v);
+    int64x2_t hi = lo;
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        int64x2_t x = vld1q_s64((const int64_t *)(v + i));
+        s = vaddq_s64(s, x);
+        lo = vbslq_s64(vcgtq_s64(lo, x), x, lo);
+        hi = vbslq_s64(vcgtq_s64(x, hi), x, hi);
+    }
+    unsigned long long rs = (unsigned long long)vaddvq_s64(s);
+    long long l0 = vgetq_lane_s64(lo, 0), l1 = vgetq_lane_s64(lo, 1);
+    long long h0 = vgetq_lane_s64(hi, 0), h1 = vgetq_lane_s64(hi, 1);
+    long long rl = l0 < l1 ? l0 : l1;
+    long long rh = h0 > h1 ? h0 : h1;
+    for (; i < n; i++) {
+        rs += (unsigned long long)v[i];
+        rl = v[i] < rl ? v[i] : rl;
+        rh = v[i] > rh ? v[i] : rh;
+    }
+    *sum = (long long)rs;
+    *min = rl;
+    *max = rh;
+}
+
+static double i64_m2_neon(const long long *v, int n, double mean) {
+    float64x2_t acc = vdupq_n_f64(0.0);
+    float64x2_t m = vdupq_n_f64(mean);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        float64x2_t d = vsubq_f64(vcvtq_f64_s64(vld1q_s64((const int64_t *)(v + i))), m);
+        acc = vfmaq_f64(acc, d, d);
+    }
+    return vaddvq_f64(acc) + i64_m2_scalar(v + i, n - i, mean);
+}
+#endif
+
+static const AggKernels scalar_kernels = {"scalar", f64_block_scalar, f64_m2_scalar,
+                                          i64_block_scalar, i64_m2_scalar};
+static const AggKernels *active_kernels = NULL;
+
+static const AggKernels *select_kernels(void) {
+    if (active_kernels)
+        return active_kernels;
+
+    active_kernels = &scalar_kernels;
+#if defined(AGG_KERNELS_X86)
+    static const AggKernels avx2_kernels = {"avx2", f64_block_avx2, f64_m2_avx2,
+                                            i64_block_avx2, i64_m2_avx2};
+    static const AggKernels sse4_kernels = {"sse4.2", f64_block_sse4, f64_m2_sse4,
+                                            i64_block_sse4, i64_m2_sse4};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        active_kernels = &avx2_kernels;
+    else if (__builtin_cpu_supports("sse4.2"))
+        active_kernels = &sse4_kernels;
+#elif defined(AGG_KERNELS_NEON)
+    static const AggKernels neon_kernels = {"neon", f64_block_neon, f64_m2_neon,
+                                            i64_block_neon, i64_m2_neon};
+    active_kernels = &neon_kernels;
+#endif
+    log_msg(LOG_DEBUG, "select_kernels: Using %s aggregate kernels", active_kernels->name);
+    return active_kernels;
+}
+
+const char *agg_kernel_name(void) {
+    return select_kernels()->name;
+}
+
+void agg_force_scalar_kernels(bool force) {
+    active_kernels = force ? &scalar_kernels : NULL;
+}
+
+void numeric_agg_init(NumericAgg *agg) {
+    agg->sum = 0.0;
+    agg->min = INFINITY;
+    agg->max = -INFINITY;
+    agg->mean = 0.0;
+    agg->m2 = 0.0;
+    agg->count = 0;
+    agg->int_sum = 0;
+    agg->int_min = LLONG_MAX;
+    agg->int_max = LLONG_MIN;
+    agg->has_float = false;
+    agg->int_overflow = false;
+}
+
+static void add_double(NumericAgg *agg, double x) {
+    agg->count++;
+    agg->sum += x;
+    agg->min = x < agg->min ? x : agg->min;
+    agg->max = x > agg->max ? x : agg->max;
+    double delta = x - agg->mean;
+    agg->mean += delta / (double)agg->count;
+    agg->m2 += delta * (x - agg->mean);
+}
+
+void numeric_agg_add(NumericAgg *agg, double x) {
+    add_double(agg, x);
+    agg->has_float = true;
+}
+
+static void add_exact(NumericAgg *agg, long long sum, long long min, long long max) {
+    agg->int_overflow = agg->int_overflow || __builtin_add_overflow(agg->int_sum, sum, &agg->int_sum);
+    agg->int_min = min < agg->int_min ? min : agg->int_min;
+    agg->int_max = max > agg->int_max ? max : agg->int_max;
+}
+
+void numeric_agg_add_int(NumericAgg *agg, long long x) {
+    add_double(agg, (double)x);
+    add_exact(agg, x, x, x);
+}
+
+/* count copies of x, e.g. one run of an RLE segment. */
+void numeric_agg_add_run(NumericAgg *agg, double x, long long count) {
+    NumericAgg run = {x * (double)count, x, x, x, 0.0, count, 0, LLONG_MAX, LLONG_MIN, true,
+                      false};
+    numeric_agg_merge(agg, &run);
+}
+
+void numeric_agg_add_int_run(NumericAgg *agg, long long x, long long count) {
+    double d = (double)x;
+    NumericAgg run = {d * (double)count, d, d, d, 0.0, count, 0, x, x, false, false};
+    run.int_overflow = __builtin_mul_overflow(x, count, &run.int_sum);
+    numeric_agg_merge(agg, &run);
+}
+
+void numeric_agg_merge(NumericAgg *dst, const NumericAgg *src) {
+    if (src->count == 0)
+        return;
+    if (dst->count == 0) {
+        *dst = *src;
+        return;
+    }
+    dst->has_float = dst->has_float || src->has_float;
+    dst->int_overflow = dst->int_overflow || src->int_overflow;
+    add_exact(dst, src->int_sum, src->int_min, src->int_max);
+    double n = (double)(dst->count + src->count);
+    double delta = src->mean - dst->mean;
+    dst->mean += delta * (double)src->count / n;
+    dst->m2 += src->m2 + delta * delta * (double)dst->count * (double)src->count / n;
+    dst->sum += src->sum;
+    dst->min = src->min < dst->min ? src->min : dst->min;
+    dst->max = src->max > dst->max ? src->max : dst->max;
+    dst->count += src->count;
+}
+
+static void add_f64_run(const AggKernels *k, const double *v, int n, bool moments,
+                        NumericAgg *agg) {
+    NumericAgg run;
+    numeric_agg_init(&run);
+    run.has_float = true;
+    k->f64_block(v, n, &run.sum, &run.min, &run.max);
+    run.count = n;
+    run.mean = run.sum / n;
+    if (moments)
+        run.m2 = k->f64_m2(v, n, run.mean);
+    numeric_agg_merge(agg, &run);
+}
+
+static void add_i64_run(const AggKernels *k, const long long *v, int n, bool moments,
+                        NumericAgg *agg) {
+    NumericAgg run;
+    numeric_agg_init(&run);
+    long long sum, min, max;
+    k->i64_block(v, n, &sum, &min, &max);
+    /* The kernels' sum wraps; values this small cannot. */
+    long long bound = LLONG_MAX / n;
+    if (min < -bound || max > bound) {
+        sum = 0;
+        for (int i = 0; i < n && !run.int_overflow; i++)
+            run.int_overflow = __builtin_add_overflow(sum, v[i], &sum);
+    }
+    run.sum = (double)sum;
+    if (run.int_overflow) {
+        run.sum = 0.0;
+        for (int i = 0; i < n; i++)
+            run.sum += (double)v[i];
+    }
+    run.int_sum = sum;
+    run.int_min = min;
+    run.int_max = max;
+    run.min = (double)min;
+    run.max = (double)max;
+    run.count = n;
+    run.mean = run.sum / n;
+    if (moments) {
+        bool vector = min >= -I64_M2_VECTOR_BOUND && max <= I64_M2_VECTOR_BOUND;
+        run.m2 = (vector ? k->i64_m2 : i64_m2_scalar)(v, n, run.mean);
+    }
+    numeric_agg_merge(agg, &run);
+}
+
+/* Length of the run of valid values starting at i (a multiple of 8), or 0 when the byte at
+   i is only partially set. */
+static int dense_run_length(const uint8_t *valid, int i, int n) {
+    int len = 0;
+    while (i + len < n && len < AGG_RUN_MAX) {
+        int remaining = n - (i + len);
+        uint8_t full = remaining >= 8 ? 0xFF : (uint8_t)((1u << remaining) - 1);
+        if (valid && valid[(i + len) / 8] != full)
+            break;
+        len += remaining >= 8 ? 8 : remaining;
+    }
+    return len;
+}
+
+/* The numeric aggregate of the valid values. Only VARIANCE and STDDEV read m2, so the runs
+   skip that pass unless moments is set. */
+void aggregate_float_vector(const double *vals, const uint8_t *valid, int n, bool moments,
+                            NumericAgg *out) {
+    const AggKernels *k = select_kernels();
+    int i = 0;
+    while (i < n) {
+        int run = dense_run_length(valid, i, n);
+        if (run > 0) {
+            add_f64_run(k, vals + i, run, moments, out);
+            i += run;
+            continue;
+        }
+        int end = i + 8 < n ? i + 8 : n;
+        for (; i < end; i++) {
+            if (valid[i / 8] & (1u << (i % 8)))
+                numeric_agg_add(out, vals[i]);
+        }
+    }
+}
+
+void aggregate_int_vector(const long long *vals, const uint8_t *valid, int n, bool moments,
+                          NumericAgg *out) {
+    const AggKernels *k = select_kernels();
+    int i = 0;
+    while (i < n) {
+        int run = dense_run_length(valid, i, n);
+        if (run > 0) {
+            add_i64_run(k, vals + i, run, moments, out);
+            i += run;
+            continue;
+        }
+        int end = i + 8 < n ? i + 8 : n;
+        for (; i < end; i++) {
+            if (valid[i / 8] & (1u << (i % 8)))
+                numeric_agg_add_int(out, vals[i]);
+        }
+    }
+}
+
+/* The declared type of an aggregate's operand: a column's comes from the schema, arithmetic
+   is an INT on INTs and a FLOAT otherwise, and TYPE_ERROR means the schema does not say. */
+DataType agg_operand_type(const Expr *operand, const TableDef *schema) {
+    if (!operand)
+        return TYPE_ERROR;
+    switch (operand->type) {
+    case EXPR_COLUMN:
+        if (!schema || operand->column.column_id >= alist_length(&schema->columns))
+            return TYPE_ERROR;
+        return ((const ColumnDef *)alist_get(&schema->columns, operand->column.column_id))->type;
+    case EXPR_VALUE:
+        return operand->value.type == TYPE_NULL ? TYPE_ERROR : operand->value.type;
+    case EXPR_BINARY_OP: {
+        if (operand->binary.op < OP_ADD || operand->binary.op > OP_MODULUS)
+            return TYPE_ERROR;
+        DataType left = agg_operand_type(operand->binary.left, schema);
+        DataType right = agg_operand_type(operand->binary.right, schema);
+        if (left == TYPE_INT && right == TYPE_INT)
+            return TYPE_INT;
+        bool numeric = (left == TYPE_INT || left == TYPE_FLOAT || left == TYPE_DECIMAL) &&
+                       (right == TYPE_INT || right == TYPE_FLOAT || right == TYPE_DECIMAL);
+        return numeric ? TYPE_FLOAT : TYPE_ERROR;
+    }
+    default:
+        return TYPE_ERROR;
+    }
+}
+
+/* The value of an aggregate over the folded inputs, NULL over none. SUM, MIN and MAX of INTs
+   are INTs, unless type, the operand's declared type (see agg_operand_type), is FLOAT or
+   DECIMAL: a FLOAT column holding whole numbers still sums to a FLOAT. VARIANCE and STDDEV
+   are sample statistics and NULL below two values. */
+Value numeric_agg_result(AggFuncType func_type, const NumericAgg *agg, DataType type) {
+    Value result = {0};
+    result.type = agg->count > 0 ? TYPE_FLOAT : TYPE_NULL;
+    if (agg->count == 0)
+        return result;
+
+    bool exact = !agg->has_float && type != TYPE_FLOAT && type != TYPE_DECIMAL;
+    switch (func_type) {
+    case FUNC_SUM:
+        if (exact && !agg->int_overflow) {
+            result.type = TYPE_INT;
+            result.int_val = agg->int_sum;
+        } else {
+            result.float_val = agg->sum;
+        }
+        break;
+    case FUNC_AVG:
+        result.float_val = agg->sum / (double)agg->count;
+        break;
+    case FUNC_MIN:
+    case FUNC_MAX:
+        if (exact) {
+            result.type = TYPE_INT;
+            result.int_val = func_type == FUNC_MIN ? agg->int_min : agg->int_max;
+        } else {
+            result.float_val = func_type == FUNC_MIN ? agg->min : agg->max;
+        }
+        break;
+    case FUNC_VARIANCE:
+    case FUNC_STDDEV:
+        if (agg->count < 2) {
+            result.type = TYPE_NULL;
+            break;
+        }
+        result.float_val = agg->m2 / (double)(agg->count - 1);
+        if (func_type == FUNC_STDDEV)
+            result.float_val = sqrt(result.float_val);
+        break;
+    default:
+        result.float_val = 0;
+    }
+    return result;
+}
@@ -0,0 +1,68 @@
+#include <stdlib.h>
+
+#include "arena.h"
+#include "db.h"
+#include "executor.h"
+#include "table.h"
+#include "values.h"
+
+/* Split block Bloom filters, as in Parquet: the high half of a key's hash picks its block,
+   and the low half times each of eight odd salts picks one bit of each word. At 16 bits per
+   key about 1 in 1000 absent keys gets through. */
+static const uint32_t BLOOM_SALT[BLOOM_BLOCK_WORDS] = {0x47b6137bu, 0x44974d91u, 0x8824ad5bu,
+                                                       0xa2b7289du, 0x705495c7u, 0x2df1424bu,
+                                                       0x9efc4947u, 0x5c6bfb31u};
+
+bool bloom_init(BloomFilter *bloom, Arena *arena, int keys) {
+    uint64_t bits = (uint64_t)(keys > 0 ? keys : 1) * BLOOM_BITS_PER_KEY;
+    uint32_t blocks = 1;
+    while ((uint64_t)blocks * BLOOM_BLOCK_WORDS * 32 < bits && blocks < (1u << 26))
+        blocks *= 2;
+    bloom->words = arena_calloc(arena, (size_t)blocks * BLOOM_BLOCK_WORDS, sizeof(uint32_t));
+    bloom->block_mask = blocks - 1;
+    return bloom->words != NULL;
+}
+
+static uint32_t *bloom_block(const BloomFilter *bloom, uint64_t hash) {
+    return bloom->words + (size_t)((uint32_t)(hash >> 32) & bloom->block_mask) * BLOOM_BLOCK_WORDS;
+}
+
+void bloom_add(BloomFilter *bloom, uint64_t hash) {
+    uint32_t *block = bloom_block(bloom, hash);
+    uint32_t key = (uint32_t)hash;
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++)
+        block[i] |= 1u << ((key * BLOOM_SALT[i]) >> 27);
+}
+
+bool bloom_may_contain(const BloomFilter *bloom, uint64_t hash) {
+    const uint32_t *block = bloom_block(bloom, hash);
+    uint32_t key = (uint32_t)hash;
+    uint32_t miss = 0;
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++)
+        miss |= ~block[i] & (1u << ((key * BLOOM_SALT[i]) >> 27));
+    return miss == 0;
+}
+
+/* Keeps the ids[0..n) whose keys may be in every filter of the chain; a NULL key never joins.
+   probe decides, from the first JOIN_FILTER_SAMPLE rows, whether the chain is worth it. */
+int join_filter_apply(const JoinFilter *filters, const Table *table, int *ids, int n,
+                      JoinFilterProbe *probe) {
+    if (!filters || probe->off)
+        return n;
+    int m = 0;
+    for (int k = 0; k < n; k++) {
+        bool keep = true;
+        for (const JoinFilter *f = filters; keep && f; f = f->next) {
+            Value key = table_get_value(table, ids[k], f->column_id);
+            keep = !is_null(&key) && bloom_may_contain(&f->bloom, value_hash(&key));
+        }
+        ids[m] = ids[k];
+        m += keep;
+    }
+    probe->checked += (uint64_t)n;
+    probe->dropped += (uint64_t)(n - m);
+    if (probe->checked >= JOIN_FILTER_SAMPLE &&
+        probe->dropped * JOIN_FILTER_MIN_DROP < probe->checked)
+        probe->off = true;
+    return m;
+}
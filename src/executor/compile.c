@@ -0,0 +1,472 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "utils.h"
+#include "values.h"
+
+#define TYPE_UNKNOWN TYPE_ERROR
+
+/* One compiled subtree: the register holding its value, for reuse by an equal subtree. */
+typedef struct {
+    const Expr *expr;
+    uint16_t reg;
+} CompiledNode;
+
+typedef struct {
+    Arena *arena;
+    const TableDef *schema;
+    ArrayList instrs;    /* ExprInstr */
+    ArrayList nodes;     /* CompiledNode */
+    ArrayList reg_types; /* DataType of each register, TYPE_UNKNOWN if not known statically */
+    ArrayList reg_const; /* int: index into constants, -1 for a computed register */
+    ArrayList constants; /* Value, strings in arena */
+} Compiler;
+
+static ExprCompileStats g_compile_stats;
+
+static bool is_numeric_type(DataType type) {
+    return type == TYPE_INT || type == TYPE_FLOAT;
+}
+
+static bool is_arithmetic(OperatorType op) {
+    return op == OP_ADD || op == OP_SUBTRACT || op == OP_MULTIPLY;
+}
+
+static bool is_comparison(OperatorType op) {
+    return op == OP_EQUALS || op == OP_NOT_EQUALS || op == OP_LESS || op == OP_LESS_EQUAL ||
+           op == OP_GREATER || op == OP_GREATER_EQUAL;
+}
+
+static bool exprs_equal(const Expr *a, const Expr *b) {
+    if (a == b)
+        return true;
+    if (!a || !b || a->type != b->type)
+        return false;
+    switch (a->type) {
+    case EXPR_COLUMN:
+        return a->column.table_id == b->column.table_id &&
+               a->column.column_id == b->column.column_id;
+    case EXPR_VALUE:
+        return a->value.type == b->value.type &&
+               (a->value.type == TYPE_NULL || compare_values(&a->value, &b->value) == 0);
+    case EXPR_BINARY_OP:
+        return a->binary.op == b->binary.op && exprs_equal(a->binary.left, b->binary.left) &&
+               exprs_equal(a->binary.right, b->binary.right);
+    case EXPR_UNARY_OP:
+        return a->unary.op == b->unary.op && exprs_equal(a->unary.operand, b->unary.operand);
+    case EXPR_SCALAR_FUNC:
+        if (a->scalar.func_type != b->scalar.func_type ||
+            a->scalar.arg_count != b->scalar.arg_count)
+            return false;
+        for (int i = 0; i < a->scalar.arg_count; i++)
+            if (!exprs_equal(a->scalar.args[i], b->scalar.args[i]))
+                return false;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int new_register(Compiler *c, DataType type, int constant) {
+    int reg = alist_length(&c->reg_types);
+    if (reg >= UINT16_MAX)
+        return -1;
+    *(DataType *)alist_append(&c->reg_types) = type;
+    *(int *)alist_append(&c->reg_const) = constant;
+    return reg;
+}
+
+static DataType reg_type(const Compiler *c, int reg) {
+    return *(const DataType *)alist_get(&c->reg_types, reg);
+}
+
+static const Value *reg_constant(const Compiler *c, int reg) {
+    int k = *(const int *)alist_get(&c->reg_const, reg);
+    return k < 0 ? NULL : (const Value *)alist_get(&c->constants, k);
+}
+
+static int add_constant(Compiler *c, const Value *val) {
+    *(Value *)alist_append(&c->constants) = copy_value_to_arena(c->arena, val);
+    return new_register(c, val->type, alist_length(&c->constants) - 1);
+}
+
+static Value eval_instr_values(const ExprInstr *ins, const Value *args) {
+    switch (ins->type) {
+    case EXPR_INS_UNARY:
+        return eval_unary_value((OperatorType)ins->op, args[0]);
+    case EXPR_INS_SCALAR:
+        return eval_scalar_values((ScalarFuncType)ins->op, args, ins->arg_count);
+    case EXPR_INS_MATCH: {
+        Value result = {0};
+        result.type = TYPE_INT;
+        result.int_val = eval_match_value(ins->expr, &args[0]) ? 1 : 0;
+        return result;
+    }
+    default:
+        return eval_binary_values((OperatorType)ins->op, args[0], args[1]);
+    }
+}
+
+/* Emits ins, or evaluates it now when every argument is a constant. */
+static int emit(Compiler *c, ExprInstr *ins, DataType type) {
+    bool constant = true;
+    Value args[3];
+    for (int i = 0; i < ins->arg_count && constant; i++) {
+        const Value *val = reg_constant(c, ins->args[i]);
+        constant = val != NULL;
+        if (val)
+            args[i] = *val;
+    }
+    if (constant && ins->type != EXPR_INS_COLUMN && ins->type != EXPR_INS_TREE) {
+        Value folded = eval_instr_values(ins, args);
+        int reg = add_constant(c, &folded);
+        free_value(&folded);
+        g_compile_stats.folded++;
+        return reg;
+    }
+    int reg = new_register(c, type, -1);
+    if (reg < 0)
+        return -1;
+    ins->dst = (uint16_t)reg;
+    *(ExprInstr *)alist_append(&c->instrs) = *ins;
+    if (ins->type >= EXPR_INS_INT_ARITH && ins->type <= EXPR_INS_FLOAT_CMP)
+        g_compile_stats.typed++;
+    return reg;
+}
+
+/* Picks a typed instruction when the operand types are known to be numeric. */
+static DataType lower_binary(Compiler *c, ExprInstr *ins, OperatorType op) {
+    DataType left = reg_type(c, ins->args[0]);
+    DataType right = reg_type(c, ins->args[1]);
+    bool both_int = left == TYPE_INT && right == TYPE_INT;
+    bool numeric = is_numeric_type(left) && is_numeric_type(right);
+    ins->type = EXPR_INS_BINARY;
+    if (is_arithmetic(op) && numeric) {
+        ins->type = both_int ? EXPR_INS_INT_ARITH : EXPR_INS_FLOAT_ARITH;
+        return both_int ? TYPE_INT : TYPE_FLOAT;
+    }
+    if (is_comparison(op) && numeric) {
+        ins->type = both_int ? EXPR_INS_INT_CMP : EXPR_INS_FLOAT_CMP;
+    }
+    if (is_comparison(op) || op == OP_AND || op == OP_OR || op == OP_LIKE)
+        return TYPE_INT;
+    return TYPE_UNKNOWN;
+}
+
+static int compile_node(Compiler *c, const Expr *expr) {
+    if (!expr)
+        return -1;
+    for (int i = 0; i < alist_length(&c->nodes); i++) {
+        const CompiledNode *node = (const CompiledNode *)alist_get(&c->nodes, i);
+        if (exprs_equal(node->expr, expr)) {
+            g_compile_stats.shared++;
+            return node->reg;
+        }
+    }
+
+    ExprInstr ins;
+    memclear(&ins, sizeof(ins));
+    DataType type = TYPE_UNKNOWN;
+    int reg = -1;
+    switch (expr->type) {
+    case EXPR_VALUE:
+        reg = add_constant(c, &expr->value);
+        break;
+    case EXPR_COLUMN: {
+        const ColumnDef *col = expr->column.column_id < alist_length(&c->schema->columns)
+                                   ? (const ColumnDef *)alist_get(&c->schema->columns,
+                                                                  expr->column.column_id)
+                                   : NULL;
+        ins.type = EXPR_INS_COLUMN;
+        ins.column_id = expr->column.column_id;
+        reg = emit(c, &ins, col ? col->type : TYPE_UNKNOWN);
+        break;
+    }
+    case EXPR_BINARY_OP: {
+        if (expr_is_match(expr)) {
+            int operand = compile_node(c, expr->binary.left);
+            if (operand < 0)
+                return -1;
+            ins.type = EXPR_INS_MATCH;
+            ins.arg_count = 1;
+            ins.args[0] = (uint16_t)operand;
+            ins.expr = expr;
+            reg = emit(c, &ins, TYPE_INT);
+            break;
+        }
+        int left = compile_node(c, expr->binary.left);
+        int right = left < 0 ? -1 : compile_node(c, expr->binary.right);
+        if (right < 0)
+            return -1;
+        ins.op = (uint8_t)expr->binary.op;
+        ins.arg_count = 2;
+        ins.args[0] = (uint16_t)left;
+        ins.args[1] = (uint16_t)right;
+        type = lower_binary(c, &ins, expr->binary.op);
+        reg = emit(c, &ins, type);
+        break;
+    }
+    case EXPR_UNARY_OP: {
+        int operand = compile_node(c, expr->unary.operand);
+        if (operand < 0)
+            return -1;
+        ins.type = EXPR_INS_UNARY;
+        ins.op = (uint8_t)expr->unary.op;
+        ins.arg_count = 1;
+        ins.args[0] = (uint16_t)operand;
+        reg = emit(c, &ins, expr->unary.op == OP_NOT ? TYPE_INT : reg_type(c, operand));
+        break;
+    }
+    case EXPR_SCALAR_FUNC:
+        ins.type = EXPR_INS_SCALAR;
+        ins.op = (uint8_t)expr->scalar.func_type;
+        ins.arg_count = (uint8_t)expr->scalar.arg_count;
+        ins.owned = true;
+        for (int i = 0; i < expr->scalar.arg_count; i++) {
+            int arg = compile_node(c, expr->scalar.args[i]);
+            if (arg < 0)
+                return -1;
+            ins.args[i] = (uint16_t)arg;
+        }
+        reg = emit(c, &ins, TYPE_UNKNOWN);
+        break;
+    case EXPR_SUBQUERY:
+        ins.type = EXPR_INS_TREE;
+        ins.owned = true;
+        ins.expr = expr;
+        reg = emit(c, &ins, TYPE_UNKNOWN);
+        break;
+    default:
+        return -1; /* aggregates are computed by their operators */
+    }
+    if (reg >= 0) {
+        CompiledNode *node = (CompiledNode *)alist_append(&c->nodes);
+        node->expr = expr;
+        node->reg = (uint16_t)reg;
+    }
+    return reg;
+}
+
+static void *copy_list(Arena *arena, ArrayList *list) {
+    size_t bytes = list->element_size * (size_t)alist_length(list);
+    void *copy = arena_alloc(arena, bytes > 0 ? bytes : 1);
+    if (copy && bytes > 0)
+        memcopy(copy, alist_data(list), bytes);
+    return copy;
+}
+
+static void compiler_free(Compiler *c) {
+    alist_destroy(&c->instrs);
+    alist_destroy(&c->nodes);
+    alist_destroy(&c->reg_types);
+    alist_destroy(&c->reg_const);
+    alist_destroy(&c->constants);
+}
+
+/* Lowers exprs (Expr*) into one program whose registers live in arena. Returns NULL when an
+   expression cannot be compiled (an aggregate), leaving the caller to interpret the trees. */
+ExprProgram *expr_compile(Arena *arena, const ArrayList *exprs, const TableDef *schema) {
+    Compiler c;
+    c.arena = arena;
+    c.schema = schema;
+    alist_init(&c.instrs, sizeof(ExprInstr), NULL);
+    alist_init(&c.nodes, sizeof(CompiledNode), NULL);
+    alist_init(&c.reg_types, sizeof(DataType), NULL);
+    alist_init(&c.reg_const, sizeof(int), NULL);
+    alist_init(&c.constants, sizeof(Value), NULL);
+
+    int count = alist_length(exprs);
+    ExprProgram *program = arena_calloc(arena, 1, sizeof(ExprProgram));
+    uint16_t *outputs = arena_calloc(arena, (size_t)(count > 0 ? count : 1), sizeof(uint16_t));
+    if (!program || !outputs) {
+        compiler_free(&c);
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        int reg = compile_node(&c, *(Expr **)alist_get(exprs, i));
+        if (reg < 0) {
+            compiler_free(&c);
+            return NULL;
+        }
+        outputs[i] = (uint16_t)reg;
+    }
+
+    program->output_count = count;
+    program->outputs = outputs;
+    program->reg_count = alist_length(&c.reg_types);
+    program->instr_count = alist_length(&c.instrs);
+    program->const_count = alist_length(&c.constants);
+    program->instrs = copy_list(arena, &c.instrs);
+    program->constants = copy_list(arena, &c.constants);
+    program->const_regs = arena_calloc(arena, (size_t)program->const_count + 1, sizeof(uint16_t));
+    program->regs = arena_alloc(arena, sizeof(Value) * EXPR_LANES * (size_t)program->reg_count);
+    if (!program->instrs || !program->constants || !program->const_regs || !program->regs) {
+        compiler_free(&c);
+        return NULL;
+    }
+    for (int r = 0; r < program->reg_count; r++) {
+        int k = *(int *)alist_get(&c.reg_const, r);
+        if (k < 0)
+            continue;
+        program->const_regs[k] = (uint16_t)r;
+        for (int i = 0; i < EXPR_LANES; i++)
+            program->regs[r * EXPR_LANES + i] = program->constants[k];
+    }
+
+    g_compile_stats.programs++;
+    g_compile_stats.instructions += (uint64_t)program->instr_count;
+    log_msg(LOG_DEBUG, "expr_compile: %d expressions, %d instructions, %d registers", count,
+            program->instr_count, program->reg_count);
+    compiler_free(&c);
+    return program;
+}
+
+static Value *lane(const ExprProgram *program, int reg) {
+    return &program->regs[reg * EXPR_LANES];
+}
+
+static long long int_arith(OperatorType op, long long a, long long b) {
+    switch (op) {
+    case OP_ADD:
+        return a + b;
+    case OP_SUBTRACT:
+        return a - b;
+    default:
+        return a * b;
+    }
+}
+
+static double float_arith(OperatorType op, double a, double b) {
+    switch (op) {
+    case OP_ADD:
+        return a + b;
+    case OP_SUBTRACT:
+        return a - b;
+    default:
+        return a * b;
+    }
+}
+
+static bool cmp_holds(OperatorType op, int cmp) {
+    switch (op) {
+    case OP_EQUALS:
+        return cmp == 0;
+    case OP_NOT_EQUALS:
+        return cmp != 0;
+    case OP_LESS:
+        return cmp < 0;
+    case OP_LESS_EQUAL:
+        return cmp <= 0;
+    case OP_GREATER:
+        return cmp > 0;
+    default:
+        return cmp >= 0;
+    }
+}
+
+static double as_double(const Value *val) {
+    return val->type == TYPE_INT ? (double)val->int_val : val->float_val;
+}
+
+static void run_typed(const ExprInstr *ins, Value *dst, const Value *a, const Value *b, int n) {
+    OperatorType op = (OperatorType)ins->op;
+    for (int i = 0; i < n; i++) {
+        bool ints = a[i].type == TYPE_INT && b[i].type == TYPE_INT;
+        bool numeric = is_numeric_type(a[i].type) && is_numeric_type(b[i].type);
+        if (ins->type == EXPR_INS_INT_ARITH && ints) {
+            dst[i].type = TYPE_INT;
+            dst[i].int_val = int_arith(op, a[i].int_val, b[i].int_val);
+        } else if (ins->type == EXPR_INS_FLOAT_ARITH && numeric && !ints) {
+            dst[i].type = TYPE_FLOAT;
+            dst[i].float_val = float_arith(op, as_double(&a[i]), as_double(&b[i]));
+        } else if ((ins->type == EXPR_INS_INT_CMP || ins->type == EXPR_INS_FLOAT_CMP) && ints) {
+            int cmp = a[i].int_val < b[i].int_val ? -1 : a[i].int_val > b[i].int_val;
+            dst[i].type = TYPE_INT;
+            dst[i].int_val = cmp_holds(op, cmp);
+        } else if (ins->type == EXPR_INS_FLOAT_CMP && numeric) {
+            double l = as_double(&a[i]), r = as_double(&b[i]);
+            dst[i].type = TYPE_INT;
+            dst[i].int_val = cmp_holds(op, l < r ? -1 : l > r);
+        } else {
+            dst[i] = eval_binary_values(op, a[i], b[i]);
+        }
+    }
+}
+
+/* Evaluates the program for rows [first, first + n) of batch, n <= EXPR_LANES. */
+void expr_program_run(ExprProgram *program, ExecContext *ctx, const RowBatch *batch, int first,
+                      int n) {
+    for (int p = 0; p < program->instr_count; p++) {
+        const ExprInstr *ins = &program->instrs[p];
+        Value *dst = lane(program, ins->dst);
+        const Value *a = ins->arg_count > 0 ? lane(program, ins->args[0]) : NULL;
+        const Value *b = ins->arg_count > 1 ? lane(program, ins->args[1]) : NULL;
+        switch (ins->type) {
+        case EXPR_INS_COLUMN:
+            for (int i = 0; i < n; i++)
+                dst[i] = context_value(ctx, batch, first + i, ins->column_id);
+            break;
+        case EXPR_INS_INT_ARITH:
+        case EXPR_INS_FLOAT_ARITH:
+        case EXPR_INS_INT_CMP:
+        case EXPR_INS_FLOAT_CMP:
+            run_typed(ins, dst, a, b, n);
+            break;
+        case EXPR_INS_BINARY:
+            for (int i = 0; i < n; i++)
+                dst[i] = eval_binary_values((OperatorType)ins->op, a[i], b[i]);
+            break;
+        case EXPR_INS_UNARY:
+            for (int i = 0; i < n; i++)
+                dst[i] = eval_unary_value((OperatorType)ins->op, a[i]);
+            break;
+        case EXPR_INS_SCALAR:
+            for (int i = 0; i < n; i++) {
+                Value args[3];
+                for (int j = 0; j < ins->arg_count; j++)
+                    args[j] = lane(program, ins->args[j])[i];
+                dst[i] = eval_scalar_values((ScalarFuncType)ins->op, args, ins->arg_count);
+            }
+            break;
+        case EXPR_INS_MATCH:
+            for (int i = 0; i < n; i++) {
+                dst[i].type = TYPE_INT;
+                dst[i].int_val = eval_match_value(ins->expr, &a[i]) ? 1 : 0;
+            }
+            break;
+        case EXPR_INS_TREE:
+            for (int i = 0; i < n; i++) {
+                const Row *row = context_row(ctx, batch, first + i);
+                dst[i] = eval_select_expression((Expr *)ins->expr, row, ctx->schema);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+const Value *expr_program_output(const ExprProgram *program, int expr, int row) {
+    return &program->regs[program->outputs[expr] * EXPR_LANES + row];
+}
+
+/* Frees the strings the last run allocated for its first n rows. */
+void expr_program_release(ExprProgram *program, int n) {
+    for (int p = 0; p < program->instr_count; p++) {
+        if (!program->instrs[p].owned)
+            continue;
+        Value *dst = lane(program, program->instrs[p].dst);
+        for (int i = 0; i < n; i++)
+            free_value(&dst[i]);
+    }
+}
+
+void expr_compile_get_stats(ExprCompileStats *stats) {
+    *stats = g_compile_stats;
+}
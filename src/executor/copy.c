@@ -0,0 +1,1012 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "storage.h"
+#include "table.h"
+#include "thread_pool.h"
+#include "txn.h"
+#include "utils.h"
+#include "values.h"
+
+/* COPY moves whole files of rows in and out of a table without going through the
+   tokenizer and parser. COPY FROM reads COPY_CHUNK_BYTES at a time; the complete CSV
+   records of a chunk are found in one serial pass that only tracks quotes, then parsed
+   into typed values by the thread pool, and the rows are appended on the calling thread
+   in file order. A table without UNIQUE columns loaded outside a transaction is appended
+   without touching its indexes, which are brought up to date once at the end. A load that
+   fails takes back every row it added, so COPY never leaves part of a file behind. */
+
+static CopyStats g_copy_stats;
+
+typedef struct {
+    Table *table;
+    int field_count;
+    int fields[MAX_COLUMNS]; /* schema column of each field of a record */
+    DataType types[MAX_COLUMNS];
+    char delimiter;
+} CopyLayout;
+
+typedef struct {
+    Table *table;
+    Transaction *txn;
+    bool bulk; /* append unindexed and index the new rows at the end */
+    long long loaded;
+} CopyLoader;
+
+typedef struct {
+    const char *start;
+    const char *end;
+    long long first_record; /* record number in the file, counting the header */
+    int record_count;
+    int parsed; /* records parsed before the first malformed one */
+    Value *values;
+    char error[128];
+} CsvTask;
+
+typedef struct {
+    const CopyLayout *layout;
+    CsvTask *tasks;
+} CsvJob;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} FieldBuf;
+
+void copy_get_stats(CopyStats *stats) {
+    *stats = g_copy_stats;
+}
+
+static bool copy_layout_init(CopyLayout *layout, Table *table, const CopyNode *copy) {
+    layout->table = table;
+    layout->delimiter = copy->delimiter;
+    int column_count = alist_length(&table->schema.columns);
+    int listed = alist_length(&copy->columns);
+    layout->field_count = listed > 0 ? listed : column_count;
+    for (int f = 0; f < layout->field_count; f++) {
+        int col = listed > 0 ? *(int *)alist_get(&copy->columns, f) : f;
+        if (col < 0 || col >= column_count) {
+            log_msg(LOG_ERROR, "exec_copy_ast: Column %d is not in table '%s'", col, table->name);
+            return false;
+        }
+        layout->fields[f] = col;
+        layout->types[f] = ((ColumnDef *)alist_get(&table->schema.columns, col))->type;
+    }
+    return true;
+}
+
+/* Rows can skip per-row index maintenance unless a check needs the rows loaded so far in
+   an index: a UNIQUE column, or a foreign key into the table itself. Transactions keep the
+   regular path so the rows get versions. */
+static bool copy_can_bulk_load(const Table *table, const Transaction *txn) {
+    if (txn)
+        return false;
+    for (int c = 0; c < alist_length(&table->schema.columns); c++) {
+        const ColumnDef *col = (const ColumnDef *)alist_get(&table->schema.columns, c);
+        if (col->flags & (COL_FLAG_UNIQUE | COL_FLAG_PRIMARY_KEY))
+            return false;
+        if ((col->flags & COL_FLAG_FOREIGN_KEY) && col->reference.table_id == table->table_id)
+            return false;
+    }
+    return true;
+}
+
+/* Appends one record; its values are moved out of fields, which are left NULL. */
+static bool load_row(CopyLoader *loader, const CopyLayout *layout, Value *fields,
+                     long long record) {
+    Table *table = loader->table;
+    int column_count = alist_length(&table->schema.columns);
+    Row row;
+    if (!table_row_init(table, &row))
+        return false;
+    for (int c = 0; c < column_count; c++)
+        ((Value *)alist_append(&row))->type = TYPE_NULL;
+    for (int f = 0; f < layout->field_count; f++) {
+        Value *val = (Value *)alist_get(&row, layout->fields[f]);
+        free_value(val);
+        *val = fields[f];
+        fields[f].type = TYPE_NULL;
+    }
+
+    for (int c = 0; c < column_count; c++) {
+        Value *val = (Value *)alist_get(&row, c);
+        if (!check_not_null_constraint(table, c, val) ||
+            (!loader->bulk && !check_unique_constraint(table, c, val, -1)) ||
+            !check_foreign_key_constraint(table, c, val)) {
+            log_msg(LOG_ERROR, "COPY aborted at record %lld due to constraint violation", record);
+            table_row_free(table, &row);
+            return false;
+        }
+    }
+
+    if (loader->txn) {
+        if (!txn_insert_row(loader->txn, table, &row))
+            return false;
+    } else {
+        bool ok = loader->bulk ? table_append_row_unindexed(table, &row)
+                               : table_append_row(table, &row);
+        if (!ok)
+            return false;
+        wal_log_insert(table, table_row_count(table) - 1);
+        matview_row_changed(table, table_row_count(table) - 1, true);
+    }
+    loader->loaded++;
+    return true;
+}
+
+/* Removes the rows a failed load appended outside a transaction, as a DELETE would. The
+   chunks already committed to the log are followed by the delete. */
+static void undo_load(Table *table, int first_row) {
+    int row_count = table_row_count(table);
+    if (row_count == first_row)
+        return;
+    bool *keep = malloc(sizeof(bool) * (size_t)row_count);
+    if (!keep) {
+        log_msg(LOG_ERROR, "COPY: Out of memory taking back the rows loaded into '%s'",
+                table->name);
+        return;
+    }
+    for (int i = 0; i < row_count; i++) {
+        keep[i] = i < first_row;
+        if (!keep[i])
+            matview_row_changed(table, i, false);
+    }
+    wal_log_delete_in_place(table, keep, row_count);
+    table_delete_rows(table, keep);
+    free(keep);
+}
+
+/* CSV fields */
+
+static bool field_push(FieldBuf *buf, char c) {
+    if (buf->len + 1 >= buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity * 2 : MAX_STRING_LEN;
+        char *data = realloc(buf->data, capacity);
+        if (!data)
+            return false;
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+    buf->data[buf->len++] = c;
+    return true;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* [-]digits[.digits] into a DECIMAL whose scale is the number of fractional digits. */
+static bool parse_decimal_text(const char *text, Value *out) {
+    const char *p = text;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+')
+        p++;
+    long long value = 0;
+    int digits = 0;
+    int scale = 0;
+    bool fraction = false;
+    for (; *p; p++) {
+        if (*p == '.' && !fraction) {
+            fraction = true;
+            continue;
+        }
+        if (*p < '0' || *p > '9' || digits >= 18)
+            return false;
+        value = value * 10 + (*p - '0');
+        digits++;
+        if (fraction)
+            scale++;
+    }
+    if (digits == 0)
+        return false;
+    out->type = TYPE_DECIMAL;
+    out->decimal_val.value = negative ? -value : value;
+    out->decimal_val.scale = scale;
+    out->decimal_val.precision = digits;
+    return true;
+}
+
+static bool parse_blob_text(const char *text, size_t len, Value *out) {
+    if (len >= 2 && text[0] == '\\' && (text[1] == 'x' || text[1] == 'X')) {
+        text += 2;
+        len -= 2;
+    }
+    if (len % 2 != 0)
+        return false;
+    out->type = TYPE_BLOB;
+    out->blob_val.length = len / 2;
+    out->blob_val.data = NULL;
+    if (len == 0)
+        return true;
+    out->blob_val.data = malloc(len / 2);
+    if (!out->blob_val.data)
+        return false;
+    for (size_t i = 0; i < len / 2; i++) {
+        int hi = hex_digit(text[2 * i]);
+        int lo = hex_digit(text[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            free(out->blob_val.data);
+            out->type = TYPE_NULL;
+            return false;
+        }
+        out->blob_val.data[i] = (unsigned char)(hi << 4 | lo);
+    }
+    return true;
+}
+
+/* Converts the text of one field to the column's type. An empty unquoted field is NULL;
+   a quoted one is an empty string. */
+static bool csv_field_value(const FieldBuf *field, bool quoted, DataType type, Value *out) {
+    const char *text = field->data;
+    out->type = TYPE_NULL;
+    if (field->len == 0 && !quoted)
+        return true;
+
+    char *end = NULL;
+    errno = 0;
+    switch (type) {
+    case TYPE_INT:
+        out->int_val = strtoll(text, &end, 10);
+        if (end == text || *end || errno == ERANGE)
+            return false;
+        out->type = TYPE_INT;
+        return true;
+    case TYPE_FLOAT:
+        out->float_val = strtod(text, &end);
+        if (end == text || *end)
+            return false;
+        out->type = TYPE_FLOAT;
+        return true;
+    case TYPE_BOOLEAN:
+        if (strcasecmp(text, "true") == 0 || strcasecmp(text, "t") == 0 || strcmp(text, "1") == 0)
+            out->bool_val = true;
+        else if (strcasecmp(text, "false") == 0 || strcasecmp(text, "f") == 0 ||
+                 strcmp(text, "0") == 0)
+            out->bool_val = false;
+        else
+            return false;
+        out->type = TYPE_BOOLEAN;
+        return true;
+    case TYPE_DATE: {
+        int year, month, day;
+        if (!parse_date_literal(text, &year, &month, &day))
+            return false;
+        out->type = TYPE_DATE;
+        out->date_val = make_date(year, month, day);
+        return true;
+    }
+    case TYPE_TIME: {
+        int hour, minute, second;
+        if (!parse_time_literal(text, &hour, &minute, &second))
+            return false;
+        out->type = TYPE_TIME;
+        out->time_val = make_time(hour, minute, second);
+        return true;
+    }
+    case TYPE_DECIMAL:
+        return parse_decimal_text(text, out);
+    case TYPE_BLOB:
+        return parse_blob_text(text, field->len, out);
+    case TYPE_STRING:
+        if (field->len >= MAX_STRING_LEN)
+            return false;
+        *out = make_string_value(text);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Parses the record at *pos into one value per field and advances *pos past it. */
+static bool parse_csv_record(const CopyLayout *layout, const char **pos, const char *end,
+                             Value *out, FieldBuf *field, char *error, size_t error_size) {
+    const char *p = *pos;
+    int f = 0;
+    for (;;) {
+        field->len = 0;
+        bool quoted = p < end && *p == '"';
+        bool ok = true;
+        if (quoted) {
+            p++;
+            for (;;) {
+                if (p >= end) {
+                    string_format(error, error_size, "unterminated quoted field");
+                    goto fail;
+                }
+                if (*p == '"') {
+                    if (p + 1 < end && p[1] == '"') {
+                        ok = ok && field_push(field, '"');
+                        p += 2;
+                        continue;
+                    }
+                    p++;
+                    break;
+                }
+                ok = ok && field_push(field, *p++);
+            }
+            if (p < end && *p == '\r' && p + 1 < end && p[1] == '\n')
+                p++;
+            if (p < end && *p != layout->delimiter && *p != '\n') {
+                string_format(error, error_size, "unexpected character after quoted field %d",
+                              f + 1);
+                goto fail;
+            }
+        } else {
+            while (p < end && *p != layout->delimiter && *p != '\n') {
+                if (*p == '"') {
+                    string_format(error, error_size, "quote inside unquoted field %d", f + 1);
+                    goto fail;
+                }
+                ok = ok && field_push(field, *p++);
+            }
+            if ((p >= end || *p == '\n') && field->len > 0 && field->data[field->len - 1] == '\r')
+                field->len--;
+        }
+        if (!ok || !field_push(field, '\0')) {
+            string_format(error, error_size, "out of memory");
+            goto fail;
+        }
+        field->len--;
+
+        if (f >= layout->field_count) {
+            string_format(error, error_size, "more than %d fields", layout->field_count);
+            goto fail;
+        }
+        if (!csv_field_value(field, quoted, layout->types[f], &out[f])) {
+            ColumnDef *col =
+                (ColumnDef *)alist_get(&layout->table->schema.columns, layout->fields[f]);
+            string_format(error, error_size, "invalid value '%.32s' for column '%s'", field->data,
+                          col->name);
+            goto fail;
+        }
+        f++;
+        if (p < end && *p == layout->delimiter) {
+            p++;
+            continue;
+        }
+        if (p < end)
+            p++; /* the newline */
+        break;
+    }
+    if (f < layout->field_count) {
+        string_format(error, error_size, "%d fields, expected %d", f, layout->field_count);
+        goto fail;
+    }
+    *pos = p;
+    return true;
+
+fail:
+    for (int i = 0; i < f; i++)
+        free_value(&out[i]);
+    return false;
+}
+
+static bool blank_line(const char *p, const char *end) {
+    return p < end && (*p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n'));
+}
+
+static void parse_csv_task(void *arg, int worker, int task_idx) {
+    (void)worker;
+    CsvJob *job = (CsvJob *)arg;
+    const CopyLayout *layout = job->layout;
+    CsvTask *task = &job->tasks[task_idx];
+    if (task->record_count == 0)
+        return;
+    task->values = malloc(sizeof(Value) * (size_t)task->record_count * layout->field_count);
+    if (!task->values) {
+        string_format(task->error, sizeof(task->error), "out of memory");
+        return;
+    }
+    FieldBuf field = {0};
+    const char *p = task->start;
+    for (int r = 0; r < task->record_count; r++) {
+        while (blank_line(p, task->end))
+            p += *p == '\n' ? 1 : 2;
+        if (!parse_csv_record(layout, &p, task->end, task->values + (size_t)r * layout->field_count,
+                              &field, task->error, sizeof(task->error)))
+            break;
+        task->parsed++;
+    }
+    free(field.data);
+}
+
+static CsvTask *add_task(ArrayList *tasks, const char *start, long long first_record) {
+    CsvTask *task = (CsvTask *)alist_append(tasks);
+    if (!task)
+        return NULL;
+    memclear(task, sizeof(*task));
+    task->start = start;
+    task->end = start;
+    task->first_record = first_record;
+    return task;
+}
+
+/* Cuts buf into parse tasks of whole records and returns how much of it they cover; a
+   record the chunk ends in the middle of is left for the next chunk unless eof. Blank
+   lines are skipped, and so is the first record when *skip_header. */
+static size_t split_csv_chunk(const char *buf, size_t len, bool eof, ArrayList *tasks,
+                              long long *record_no, bool *skip_header) {
+    CsvTask *task = add_task(tasks, buf, *record_no);
+    if (!task)
+        return 0;
+    bool quoted = false;
+    bool content = false;
+    size_t record_start = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = buf[i];
+        if (c == '"') {
+            quoted = !quoted;
+            content = true;
+        } else if (c == '\n' && !quoted) {
+            if (content) {
+                (*record_no)++;
+                if (*skip_header) {
+                    *skip_header = false;
+                    task->start = buf + i + 1;
+                    task->first_record = *record_no;
+                } else {
+                    task->record_count++;
+                }
+            }
+            content = false;
+            record_start = i + 1;
+            task->end = buf + record_start;
+            if (task->end - task->start >= COPY_TASK_BYTES) {
+                task = add_task(tasks, task->end, *record_no);
+                if (!task)
+                    return 0;
+            }
+        } else if (c != '\r') {
+            content = true;
+        }
+    }
+    if (eof) {
+        if (content && !*skip_header) {
+            (*record_no)++;
+            task->record_count++;
+        }
+        task->end = buf + len;
+        record_start = len;
+    }
+    if (task->record_count == 0)
+        alist_remove(tasks, alist_length(tasks) - 1);
+    return record_start;
+}
+
+static bool copy_from_csv(FILE *file, const CopyNode *copy, const CopyLayout *layout,
+                          CopyLoader *loader) {
+    size_t capacity = COPY_CHUNK_BYTES;
+    char *buf = malloc(capacity);
+    if (!buf) {
+        log_msg(LOG_ERROR, "exec_copy_ast: Failed to allocate the read buffer");
+        return false;
+    }
+    ArrayList tasks;
+    alist_init(&tasks, sizeof(CsvTask), NULL);
+    long long record_no = 0;
+    bool skip_header = copy->header;
+    bool eof = false;
+    bool ok = true;
+    size_t len = 0;
+    while (ok && !eof) {
+        if (len == capacity) {
+            char *grown = realloc(buf, capacity * 2);
+            if (!grown) {
+                log_msg(LOG_ERROR, "exec_copy_ast: Record larger than %zu bytes", capacity);
+                ok = false;
+                break;
+            }
+            buf = grown;
+            capacity *= 2;
+        }
+        size_t n = fread(buf + len, 1, capacity - len, file);
+        if (n < capacity - len) {
+            if (ferror(file)) {
+                log_msg(LOG_ERROR, "exec_copy_ast: Failed to read '%s'", copy->path);
+                ok = false;
+                break;
+            }
+            eof = true;
+        }
+        len += n;
+        g_copy_stats.chunks++;
+
+        alist_clear(&tasks);
+        size_t done = split_csv_chunk(buf, len, eof, &tasks, &record_no, &skip_header);
+        int task_count = alist_length(&tasks);
+        CsvJob job = {layout, (CsvTask *)tasks.data};
+        if (task_count > 0)
+            thread_pool_run(task_count, parse_csv_task, &job);
+        g_copy_stats.parse_tasks += (uint64_t)task_count;
+
+        for (int t = 0; t < task_count; t++) {
+            CsvTask *task = &job.tasks[t];
+            for (int r = 0; ok && r < task->parsed; r++)
+                ok = load_row(loader, layout, task->values + (size_t)r * layout->field_count,
+                              task->first_record + r + 1);
+            if (ok && task->error[0]) {
+                log_msg(LOG_ERROR, "COPY: Record %lld of '%s': %s",
+                        task->first_record + task->parsed + 1, copy->path, task->error);
+                ok = false;
+            }
+            for (size_t v = 0; task->values && v < (size_t)task->parsed * layout->field_count;
+                 v++)
+                free_value(&task->values[v]);
+            free(task->values);
+        }
+        memmove(buf, buf + done, len - done);
+        len -= done;
+        if (!loader->txn)
+            storage_commit();
+    }
+    alist_destroy(&tasks);
+    free(buf);
+    return ok;
+}
+
+/* Binary format: COPY_BINARY_MAGIC, a u16 field count, then for every field of every
+   record a u8 DataType tag (TYPE_NULL for NULL) and its little-endian payload: i64 for
+   INT, f64 for FLOAT, u8 for BOOLEAN, u32 for DATE and TIME, i32 precision, i32 scale
+   and i64 for DECIMAL, and a u32 length and the bytes for STRING and BLOB. */
+
+static uint64_t load_le(const unsigned char *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static void store_le(unsigned char *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (unsigned char)v;
+        v >>= 8;
+    }
+}
+
+/* Payload size of a value with tag at p, or -1 while avail bytes do not tell yet. */
+static long binary_payload_size(uint8_t tag, const unsigned char *p, size_t avail) {
+    switch (tag) {
+    case TYPE_NULL:
+        return 0;
+    case TYPE_INT:
+    case TYPE_FLOAT:
+        return 8;
+    case TYPE_BOOLEAN:
+        return 1;
+    case TYPE_DATE:
+    case TYPE_TIME:
+        return 4;
+    case TYPE_DECIMAL:
+        return 16;
+    case TYPE_STRING:
+    case TYPE_BLOB:
+        return avail < 4 ? -1 : 4 + (long)load_le(p, 4);
+    default:
+        return 0;
+    }
+}
+
+/* Decodes one record; returns the bytes it took, 0 if buf ends inside it, -1 if it is
+   malformed. */
+static long decode_binary_record(const CopyLayout *layout, const unsigned char *buf, size_t len,
+                                 Value *out, char *error, size_t error_size) {
+    size_t off = 0;
+    for (int f = 0; f < layout->field_count; f++) {
+        if (off >= len)
+            return 0;
+        uint8_t tag = buf[off];
+        if (tag != TYPE_NULL && tag != layout->types[f]) {
+            string_format(error, error_size, "field %d has type tag %d, expected %d", f + 1, tag,
+                          layout->types[f]);
+            return -1;
+        }
+        long size = binary_payload_size(tag, buf + off + 1, len - off - 1);
+        if (size == -1 || off + 1 + (size_t)size > len)
+            return 0;
+        if (tag == TYPE_STRING && size - 4 >= MAX_STRING_LEN) {
+            string_format(error, error_size, "string of field %d is too long", f + 1);
+            return -1;
+        }
+        off += 1 + (size_t)size;
+    }
+
+    off = 0;
+    for (int f = 0; f < layout->field_count; f++) {
+        uint8_t tag = buf[off++];
+        const unsigned char *p = buf + off;
+        Value *val = &out[f];
+        memclear(val, sizeof(*val));
+        val->type = (DataType)tag;
+        switch (tag) {
+        case TYPE_INT:
+            val->int_val = (long long)load_le(p, 8);
+            off += 8;
+            break;
+        case TYPE_FLOAT: {
+            uint64_t bits = load_le(p, 8);
+            memcopy(&val->float_val, &bits, sizeof(bits));
+            off += 8;
+            break;
+        }
+        case TYPE_BOOLEAN:
+            val->bool_val = p[0] != 0;
+            off += 1;
+            break;
+        case TYPE_DATE:
+            val->date_val = (unsigned int)load_le(p, 4);
+            off += 4;
+            break;
+        case TYPE_TIME:
+            val->time_val = (unsigned int)load_le(p, 4);
+            off += 4;
+            break;
+        case TYPE_DECIMAL:
+            val->decimal_val.precision = (int)(int32_t)load_le(p, 4);
+            val->decimal_val.scale = (int)(int32_t)load_le(p + 4, 4);
+            val->decimal_val.value = (long long)load_le(p + 8, 8);
+            off += 16;
+            break;
+        case TYPE_STRING:
+        case TYPE_BLOB: {
+            size_t n = (size_t)load_le(p, 4);
+            off += 4 + n;
+            if (tag == TYPE_STRING) {
+                char text[MAX_STRING_LEN];
+                memcopy(text, p + 4, n);
+                text[n] = '\0';
+                *val = make_string_value(text);
+            } else {
+                val->blob_val.length = n;
+                val->blob_val.data = n ? malloc(n) : NULL;
+                if (n && val->blob_val.data)
+                    memcopy(val->blob_val.data, p + 4, n);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return (long)off;
+}
+
+static bool copy_from_binary(FILE *file, const CopyNode *copy, const CopyLayout *layout,
+                             CopyLoader *loader) {
+    unsigned char header[sizeof(COPY_BINARY_MAGIC) + 1];
+    size_t magic_len = sizeof(COPY_BINARY_MAGIC) - 1;
+    if (fread(header, 1, magic_len + 2, file) != magic_len + 2 ||
+        memcmp(header, COPY_BINARY_MAGIC, magic_len) != 0) {
+        log_msg(LOG_ERROR, "exec_copy_ast: '%s' is not a binary COPY file", copy->path);
+        return false;
+    }
+    int field_count = (int)load_le(header + magic_len, 2);
+    if (field_count != layout->field_count) {
+        log_msg(LOG_ERROR, "exec_copy_ast: '%s' has %d fields per record, expected %d",
+                copy->path, field_count, layout->field_count);
+        return false;
+    }
+
+    size_t capacity = COPY_CHUNK_BYTES;
+    unsigned char *buf = malloc(capacity);
+    Value *values = malloc(sizeof(Value) * (size_t)layout->field_count);
+    if (!buf || !values) {
+        log_msg(LOG_ERROR, "exec_copy_ast: Failed to allocate the read buffer");
+        free(buf);
+        free(values);
+        return false;
+    }
+    long long record_no = 0;
+    bool eof = false;
+    bool ok = true;
+    size_t len = 0;
+    while (ok && !eof) {
+        size_t n = fread(buf + len, 1, capacity - len, file);
+        if (n < capacity - len) {
+            if (ferror(file)) {
+                log_msg(LOG_ERROR, "exec_copy_ast: Failed to read '%s'", copy->path);
+                ok = false;
+                break;
+            }
+            eof = true;
+        }
+        len += n;
+        g_copy_stats.chunks++;
+
+        size_t off = 0;
+        char error[128] = "";
+        while (ok && off < len) {
+            long used = decode_binary_record(layout, buf + off, len - off, values, error,
+                                             sizeof(error));
+            if (used == 0)
+                break;
+            record_no++;
+            if (used < 0) {
+                log_msg(LOG_ERROR, "COPY: Record %lld of '%s': %s", record_no, copy->path, error);
+                ok = false;
+                break;
+            }
+            ok = load_row(loader, layout, values, record_no);
+            for (int f = 0; f < layout->field_count; f++)
+                free_value(&values[f]);
+            off += (size_t)used;
+        }
+        if (ok && eof && off < len) {
+            log_msg(LOG_ERROR, "COPY: '%s' ends inside record %lld", copy->path, record_no + 1);
+            ok = false;
+        }
+        memmove(buf, buf + off, len - off);
+        len -= off;
+        if (ok && len == capacity) {
+            unsigned char *grown = realloc(buf, capacity * 2);
+            if (!grown) {
+                log_msg(LOG_ERROR, "exec_copy_ast: Record larger than %zu bytes", capacity);
+                ok = false;
+            } else {
+                buf = grown;
+                capacity *= 2;
+            }
+        }
+        if (!loader->txn)
+            storage_commit();
+    }
+    free(values);
+    free(buf);
+    return ok;
+}
+
+/* COPY TO */
+
+static bool csv_needs_quotes(const char *text, char delimiter) {
+    if (!*text)
+        return true;
+    for (const char *p = text; *p; p++)
+        if (*p == delimiter || *p == '"' || *p == '\n' || *p == '\r')
+            return true;
+    return false;
+}
+
+/* Formats without printf: COPY TO and the CLI's output formats write millions of these. */
+static void write_int(FILE *file, long long v) {
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    unsigned long long mag = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do {
+        *--p = (char)('0' + mag % 10);
+        mag /= 10;
+    } while (mag > 0);
+    if (v < 0)
+        *--p = '-';
+    fwrite(p, 1, (size_t)(buf + sizeof(buf) - p), file);
+}
+
+/* A value as COPY TO writes it in CSV: empty for NULL, strings quoted only when needed. */
+void copy_write_csv_value(FILE *file, const Value *val, char delimiter) {
+    switch (val->type) {
+    case TYPE_NULL:
+        break;
+    case TYPE_INT:
+        write_int(file, val->int_val);
+        break;
+    case TYPE_FLOAT:
+        fprintf(file, "%.17g", val->float_val);
+        break;
+    case TYPE_BOOLEAN:
+        fputs(val->bool_val ? "true" : "false", file);
+        break;
+    case TYPE_DATE:
+        fprintf(file, "%04d-%02d-%02d", date_year(val->date_val), date_month(val->date_val),
+                date_day(val->date_val));
+        break;
+    case TYPE_TIME:
+        fprintf(file, "%02d:%02d:%02d", time_hour(val->time_val), time_minute(val->time_val),
+                time_second(val->time_val));
+        break;
+    case TYPE_DECIMAL: {
+        long long v = val->decimal_val.value;
+        unsigned long long mag = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+        int scale = val->decimal_val.scale;
+        unsigned long long pow10 = 1;
+        for (int i = 0; i < scale; i++)
+            pow10 *= 10;
+        fprintf(file, "%s%llu", v < 0 ? "-" : "", mag / pow10);
+        if (scale > 0)
+            fprintf(file, ".%0*llu", scale, mag % pow10);
+        break;
+    }
+    case TYPE_BLOB:
+        fputs("\\x", file);
+        for (size_t i = 0; i < val->blob_val.length; i++)
+            fprintf(file, "%02x", val->blob_val.data[i]);
+        break;
+    case TYPE_STRING: {
+        const char *text = value_str(val);
+        if (!csv_needs_quotes(text, delimiter)) {
+            fputs(text, file);
+            break;
+        }
+        fputc('"', file);
+        for (const char *p = text; *p; p++) {
+            if (*p == '"')
+                fputc('"', file);
+            fputc(*p, file);
+        }
+        fputc('"', file);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void copy_write_binary_value(FILE *file, const Value *val) {
+    unsigned char buf[17];
+    buf[0] = (unsigned char)val->type;
+    size_t n = 1;
+    switch (val->type) {
+    case TYPE_INT:
+        store_le(buf + 1, (uint64_t)val->int_val, 8);
+        n += 8;
+        break;
+    case TYPE_FLOAT: {
+        uint64_t bits;
+        memcopy(&bits, &val->float_val, sizeof(bits));
+        store_le(buf + 1, bits, 8);
+        n += 8;
+        break;
+    }
+    case TYPE_BOOLEAN:
+        buf[1] = val->bool_val ? 1 : 0;
+        n += 1;
+        break;
+    case TYPE_DATE:
+        store_le(buf + 1, val->date_val, 4);
+        n += 4;
+        break;
+    case TYPE_TIME:
+        store_le(buf + 1, val->time_val, 4);
+        n += 4;
+        break;
+    case TYPE_DECIMAL:
+        store_le(buf + 1, (uint32_t)val->decimal_val.precision, 4);
+        store_le(buf + 5, (uint32_t)val->decimal_val.scale, 4);
+        store_le(buf + 9, (uint64_t)val->decimal_val.value, 8);
+        n += 16;
+        break;
+    case TYPE_STRING:
+    case TYPE_BLOB: {
+        const void *data = val->type == TYPE_STRING ? (const void *)value_str(val)
+                                                    : (const void *)val->blob_val.data;
+        size_t len = val->type == TYPE_STRING ? strlen(value_str(val)) : val->blob_val.length;
+        store_le(buf + 1, len, 4);
+        fwrite(buf, 1, 5, file);
+        if (len)
+            fwrite(data, 1, len, file);
+        return;
+    }
+    default:
+        buf[0] = TYPE_NULL;
+        break;
+    }
+    fwrite(buf, 1, n, file);
+}
+
+void copy_write_binary_header(FILE *file, int field_count) {
+    unsigned char count[2];
+    store_le(count, (uint64_t)field_count, 2);
+    fputs(COPY_BINARY_MAGIC, file);
+    fwrite(count, 1, 2, file);
+}
+
+/* Writes the rows visible to the statement's snapshot. */
+static bool copy_to_file(FILE *file, const CopyNode *copy, const CopyLayout *layout) {
+    const Table *table = layout->table;
+    if (copy->format == COPY_FORMAT_BINARY) {
+        copy_write_binary_header(file, layout->field_count);
+    } else if (copy->header) {
+        for (int f = 0; f < layout->field_count; f++) {
+            ColumnDef *col = (ColumnDef *)alist_get(&table->schema.columns, layout->fields[f]);
+            if (f > 0)
+                fputc(copy->delimiter, file);
+            fputs(col->name, file);
+        }
+        fputc('\n', file);
+    }
+
+    long long written = 0;
+    int row_count = table_row_count(table);
+    for (int r = 0; r < row_count; r++) {
+        if (!table_row_visible(table, r))
+            continue;
+        for (int f = 0; f < layout->field_count; f++) {
+            Value val = table_get_value(table, r, (uint16_t)layout->fields[f]);
+            if (copy->format == COPY_FORMAT_BINARY) {
+                copy_write_binary_value(file, &val);
+            } else {
+                if (f > 0)
+                    fputc(copy->delimiter, file);
+                copy_write_csv_value(file, &val, copy->delimiter);
+            }
+        }
+        if (copy->format == COPY_FORMAT_CSV)
+            fputc('\n', file);
+        written++;
+    }
+    g_copy_stats.rows_out += (uint64_t)written;
+    log_msg(LOG_INFO, "Copied %lld rows from table '%s' to '%s'", written, table->name,
+            copy->path);
+    return !ferror(file);
+}
+
+void exec_copy_ast(ASTNode *ast) {
+    CopyNode *copy = &ast->copy;
+    Table *table = get_table_by_id(copy->table_id);
+    if (!table) {
+        log_msg(LOG_ERROR, "Table with ID %d not found", copy->table_id);
+        return;
+    }
+    CopyLayout layout;
+    if (!copy_layout_init(&layout, table, copy))
+        return;
+
+    if (copy->to_file) {
+        matview_sync(table->table_id);
+        FILE *file = fopen(copy->path, "wb");
+        if (!file) {
+            log_msg(LOG_ERROR, "exec_copy_ast: Cannot create '%s': %s", copy->path,
+                    strerror(errno));
+            return;
+        }
+        bool ok = copy_to_file(file, copy, &layout);
+        if (fclose(file) != 0 || !ok)
+            log_msg(LOG_ERROR, "exec_copy_ast: Failed to write '%s'", copy->path);
+        return;
+    }
+
+    CopyLoader loader = {0};
+    loader.table = table;
+    if (!matview_writable(table, "COPY") || !txn_write_access(table, &loader.txn))
+        return;
+    FILE *file = fopen(copy->path, "rb");
+    if (!file) {
+        log_msg(LOG_ERROR, "exec_copy_ast: Cannot open '%s': %s", copy->path, strerror(errno));
+        return;
+    }
+    loader.bulk = copy_can_bulk_load(table, loader.txn);
+    int first_row = table_row_count(table);
+    int mark = loader.txn ? txn_write_mark(loader.txn) : 0;
+
+    bool ok = copy->format == COPY_FORMAT_BINARY ? copy_from_binary(file, copy, &layout, &loader)
+                                                 : copy_from_csv(file, copy, &layout, &loader);
+    fclose(file);
+
+    if (loader.bulk) {
+        table_index_appended_rows(table, first_row);
+        g_copy_stats.bulk_loads++;
+    }
+    if (!ok) {
+        if (loader.txn)
+            txn_rollback_to(loader.txn, mark);
+        else
+            undo_load(table, first_row);
+        log_msg(LOG_ERROR, "COPY into '%s' failed; the %lld rows loaded before the error were "
+                "taken back", table->name, loader.loaded);
+        return;
+    }
+    g_copy_stats.rows_in += (uint64_t)loader.loaded;
+    exec_note_rows_changed(loader.loaded);
+    log_msg(LOG_INFO, "Copied %lld rows into table '%s'", loader.loaded, table->name);
+}
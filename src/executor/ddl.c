@@ -1,32 +1,54 @@
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "arraylist.h"
 #include "db.h"
 #include "executor.h"
 #include "logger.h"
+#include "storage.h"
+#include "thread_pool.h"
+#include "txn.h"
 #include "utils.h"
 #include "table.h"
 
-void free_row_contents(void *ptr) {
-    ArrayList *row = (ArrayList *)ptr;
-    if (!row)
-        return;
-    alist_destroy(row);
-}
-
 Value copy_string_value(const Value *src) {
     Value copy = {0};
     if (!src)
         return copy;
-    copy = *src;
-    if (src->type == TYPE_STRING && src->char_val) {
-        copy.char_val = malloc(strlen(src->char_val) + 1);
-        if (copy.char_val) {
-            strcopy(copy.char_val, strlen(src->char_val) + 1, src->char_val);
+    if (src->type == TYPE_STRING)
+        return copy_value(src);
+    return *src;
+}
+
+static void ensure_hash_index(Table *table, uint16_t column_id, const char *prefix) {
+    if (find_index_by_table_column(table->table_id, column_id))
+        return;
+    ColumnDef *col = (ColumnDef *)alist_get(&table->schema.columns, column_id);
+    char name[MAX_TABLE_NAME_LEN];
+    string_format(name, sizeof(name), "%s_%s_%s", prefix, table->name, col ? col->name : "col");
+    ArrayList column_ids;
+    alist_init(&column_ids, sizeof(uint16_t), NULL);
+    *(uint16_t *)alist_append(&column_ids) = column_id;
+    index_table(table->table_id, &column_ids, 1, name, INDEX_TYPE_HASH);
+    alist_destroy(&column_ids);
+}
+
+/* UNIQUE and PRIMARY KEY columns get a hash index, and so does any column a FOREIGN KEY
+   references, so constraint checks are single probes instead of table scans. */
+static void create_constraint_indexes(Table *table) {
+    for (int i = 0; i < alist_length(&table->schema.columns); i++) {
+        ColumnDef *col = (ColumnDef *)alist_get(&table->schema.columns, i);
+        if (col->flags & (COL_FLAG_PRIMARY_KEY | COL_FLAG_UNIQUE))
+            ensure_hash_index(table, (uint16_t)i,
+                              col->flags & COL_FLAG_PRIMARY_KEY ? "pk" : "uq");
+        if (col->flags & COL_FLAG_FOREIGN_KEY) {
+            Table *ref_table = get_table_by_id(col->reference.table_id);
+            if (ref_table)
+                ensure_hash_index(ref_table, col->reference.column_id, "fk");
         }
     }
-    return copy;
 }
 
 void exec_create_table_ast(ASTNode *ast) {
@@ -37,7 +59,8 @@ void exec_create_table_ast(ASTNode *ast) {
         return;
     }
 
-    if (alist_length(&tables) >= MAX_TABLES) {
+    uint16_t table_id = next_table_id();
+    if (table_id == 0) {
         log_msg(LOG_ERROR, "create_table: Maximum table limit (%d) reached", MAX_TABLES);
         return;
     }
@@ -48,8 +71,9 @@ void exec_create_table_ast(ASTNode *ast) {
         return;
     }
 
+    memclear(table, sizeof(Table));
     strcopy(table->name, sizeof(table->name), ct->table_name);
-    alist_init(&table->rows, sizeof(Row), free_row_contents);
+    alist_init(&table->rows, sizeof(Row), NULL);
     alist_init(&table->schema.columns, sizeof(ColumnDef), NULL);
     table->schema.strict = ct->strict;
 
@@ -63,13 +87,26 @@ void exec_create_table_ast(ASTNode *ast) {
         }
     }
 
-    table->table_id = alist_length(&tables) + 1;
+    table->storage = ct->storage;
+    if (table->storage == STORAGE_COLUMNAR && !column_store_init(table)) {
+        alist_destroy(&table->rows);
+        alist_destroy(&table->schema.columns);
+        free(table);
+        return;
+    }
+
+    table->table_id = table_id;
     Table *t = (Table *)alist_append(&tables);
-    if (t)
+    if (t) {
         *t = *table;
+        catalog_changed();
+        wal_log_create_table(t);
+        create_constraint_indexes(t);
+    }
 
-    log_msg(LOG_INFO, "Created table '%s' with %d columns (STRICT=%s) table_id=%d", ct->table_name, col_count,
-            ct->strict ? "true" : "false", table->table_id);
+    log_msg(LOG_INFO, "Created table '%s' with %d columns (STRICT=%s, STORAGE=%s) table_id=%d",
+            ct->table_name, col_count, ct->strict ? "true" : "false",
+            ct->storage == STORAGE_COLUMNAR ? "COLUMNAR" : "ROW", table->table_id);
 
     free(table);
 }
@@ -79,6 +116,23 @@ void exec_drop_table_ast(ASTNode *ast) {
     Table *table = get_table_by_id(drop->table_id);
     if (!table)
         return;
+    if (drop->view != (table->view != NULL)) {
+        log_msg(LOG_ERROR, drop->view ? "'%s' is not a materialized view"
+                                      : "'%s' is a materialized view, use DROP MATERIALIZED VIEW",
+                table->name);
+        return;
+    }
+    const char *reader = matview_reader(table->table_id);
+    if (reader) {
+        log_msg(LOG_ERROR, "Cannot drop table '%s' while materialized view '%s' reads it",
+                table->name, reader);
+        return;
+    }
+    if (txn_table_busy(table)) {
+        log_msg(LOG_ERROR, "Cannot drop table '%s' while a transaction sees its row versions",
+                table->name);
+        return;
+    }
 
     char table_name[MAX_TABLE_NAME_LEN];
     strcopy(table_name, sizeof(table_name), table->name);
@@ -87,9 +141,13 @@ void exec_drop_table_ast(ASTNode *ast) {
         Table *t = (Table *)alist_get(&tables, i);
         if (t && t->table_id == drop->table_id) {
             alist_remove(&tables, i);
+            catalog_changed();
             break;
         }
     }
+    drop_table_indexes(drop->table_id);
+    drop_table_stats(drop->table_id);
+    wal_log_drop_table(drop->table_id);
 
     log_msg(LOG_INFO, "Dropped table '%s'", table_name);
 }
@@ -101,16 +159,75 @@ void exec_create_index_ast(ASTNode *ast) {
         log_msg(LOG_ERROR, "Table not found for index creation");
         return;
     }
+    if (!matview_writable(table, "CREATE INDEX"))
+        return;
 
     if (alist_length(&ci->column_ids) == 0) {
         log_msg(LOG_ERROR, "No columns specified for index creation");
         return;
     }
 
-    index_table(ci->table_id, &ci->column_ids, ci->index_name);
+    index_table(ci->table_id, &ci->column_ids, ci->key_count, ci->index_name, ci->index_type);
+    Index *index = find_index(ci->index_name);
+    if (index)
+        wal_log_create_index(index);
 }
 
 void exec_drop_index_ast(ASTNode *ast) {
     DropIndexNode *di = &ast->drop_index;
     drop_index_by_name(di->index_name);
+    wal_log_drop_index(di->index_name);
+}
+
+/* Session settings SET can change; value 0 restores a setting's default. */
+typedef struct {
+    const char *name;
+    void (*apply)(int value);
+    int max;
+} Setting;
+
+/* Memory settings are in KiB. */
+static void set_work_mem(int kb) {
+    exec_set_work_mem((size_t)kb * 1024);
+}
+
+static void set_memory_limit(int kb) {
+    exec_set_memory_limit((size_t)kb * 1024);
+}
+
+static const Setting settings[] = {
+    {"max_parallel_workers", thread_pool_set_workers, MAX_PARALLEL_WORKERS},
+    {"work_mem", set_work_mem, INT_MAX},
+    {"memory_limit", set_memory_limit, INT_MAX},
+};
+
+void exec_set_ast(ASTNode *ast) {
+    SetNode *sn = &ast->set;
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+        if (strcasecmp(settings[i].name, sn->name) != 0)
+            continue;
+        if (sn->value < 0 || sn->value > settings[i].max) {
+            log_msg(LOG_ERROR, "exec_set_ast: %s must be between 0 and %d", sn->name,
+                    settings[i].max);
+            return;
+        }
+        settings[i].apply((int)sn->value);
+        log_msg(LOG_INFO, "Set %s to %lld", settings[i].name, sn->value);
+        return;
+    }
+    log_msg(LOG_ERROR, "exec_set_ast: Unknown setting '%s'", sn->name);
+}
+
+void exec_analyze_ast(ASTNode *ast) {
+    AnalyzeNode *an = &ast->analyze;
+    if (an->table_id != 0) {
+        analyze_table(an->table_id);
+        return;
+    }
+
+    for (int i = 0; i < alist_length(&tables); i++) {
+        Table *t = (Table *)alist_get(&tables, i);
+        if (t)
+            analyze_table(t->table_id);
+    }
 }
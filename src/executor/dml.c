@@ -1,19 +1,52 @@
+#include <stdlib.h>
+
 #include "arraylist.h"
 #include "db.h"
 #include "executor.h"
 #include "logger.h"
+#include "storage.h"
 #include "table.h"
+#include "txn.h"
+
+/* NOT NULL, UNIQUE / PRIMARY KEY and FOREIGN KEY checks for a value about to be stored in
+   col_idx; exclude_row_idx is the row being updated, or -1 for an INSERT. The UNIQUE and
+   FOREIGN KEY checks probe the hash indexes CREATE TABLE builds for key columns. */
+static bool check_column_constraints(Table *table, int col_idx, Value *val, int exclude_row_idx) {
+    return check_not_null_constraint(table, col_idx, val) &&
+           check_unique_constraint(table, col_idx, val, exclude_row_idx) &&
+           check_foreign_key_constraint(table, col_idx, val);
+}
 
-static bool insert_row_with_columns(Table *table, ArrayList *value_row, int schema_col_count,
-                                    int value_count, ArrayList *columns) {
-    Row *row = (Row *)alist_append(&table->rows);
-    if (!row)
+/* Checks every column of a new row; columns the INSERT left out are NULL. A row written
+   for a transaction (txn != NULL) is logged when it commits. */
+static bool insert_checked_row(Table *table, Row *row, Transaction *txn) {
+    Value null_val = {0};
+    null_val.type = TYPE_NULL;
+    for (int c = 0; c < alist_length(&table->schema.columns); c++) {
+        Value *val = c < alist_length(row) ? (Value *)alist_get(row, c) : &null_val;
+        if (!check_column_constraints(table, c, val, -1)) {
+            log_msg(LOG_ERROR, "INSERT aborted due to constraint violation");
+            table_row_free(table, row);
+            return false;
+        }
+    }
+    if (txn)
+        return txn_insert_row(txn, table, row);
+    if (!table_append_row(table, row))
         return false;
+    wal_log_insert(table, table_row_count(table) - 1);
+    matview_row_changed(table, table_row_count(table) - 1, true);
+    return true;
+}
 
-    alist_init(row, sizeof(Value), free_value);
+static bool insert_row_with_columns(Table *table, ArrayList *value_row, int schema_col_count,
+                                    int value_count, ArrayList *columns, Transaction *txn) {
+    Row row;
+    if (!table_row_init(table, &row))
+        return false;
 
     for (int i = 0; i < schema_col_count; i++) {
-        Value *val = (Value *)alist_append(row);
+        Value *val = (Value *)alist_append(&row);
         val->type = TYPE_NULL;
     }
 
@@ -27,48 +60,37 @@ static bool insert_row_with_columns(Table *table, ArrayList *value_row, int sche
         if (!cv)
             continue;
 
-        Value *val = (Value *)alist_get(row, col_idx);
+        Value *val = (Value *)alist_get(&row, col_idx);
         if (!val)
             continue;
 
-        Value new_val = copy_string_value(&cv->value);
-        *val = new_val;
-
-        if (!check_foreign_key_constraint(table, col_idx, val)) {
-            log_msg(LOG_ERROR, "INSERT aborted due to foreign key constraint violation");
-            alist_destroy(row);
-            alist_remove(&table->rows, alist_length(&table->rows) - 1);
-            return false;
-        }
+        *val = copy_string_value(&cv->value);
     }
 
-    return true;
+    return insert_checked_row(table, &row, txn);
 }
 
-static bool insert_row_without_columns(Table *table, ArrayList *value_row, int value_count) {
-    Row *row = (Row *)alist_append(&table->rows);
-    if (!row)
+static bool insert_row_without_columns(Table *table, ArrayList *value_row, int value_count,
+                                       Transaction *txn) {
+    if (value_count > alist_length(&table->schema.columns)) {
+        log_msg(LOG_ERROR, "INSERT has %d values but table '%s' has %d columns", value_count,
+                table->name, alist_length(&table->schema.columns));
+        return false;
+    }
+    Row row;
+    if (!table_row_init(table, &row))
         return false;
-
-    alist_init(row, sizeof(Value), free_value);
 
     for (int i = 0; i < value_count; i++) {
         ColumnValue *cv = (ColumnValue *)alist_get(value_row, i);
         if (!cv)
             continue;
 
-        Value *val = (Value *)alist_append(row);
+        Value *val = (Value *)alist_append(&row);
         *val = copy_string_value(&cv->value);
-
-        if (!check_foreign_key_constraint(table, i, val)) {
-            log_msg(LOG_ERROR, "INSERT aborted due to foreign key constraint violation");
-            alist_destroy(row);
-            alist_remove(&table->rows, alist_length(&table->rows) - 1);
-            return false;
-        }
     }
 
-    return true;
+    return insert_checked_row(table, &row, txn);
 }
 
 void exec_insert_row_ast(ASTNode *ast) {
@@ -84,6 +106,10 @@ void exec_insert_row_ast(ASTNode *ast) {
     if (row_count == 0)
         return;
 
+    Transaction *txn;
+    if (!matview_writable(table, "INSERT") || !txn_write_access(table, &txn))
+        return;
+
     int specified_col_count = alist_length(&ins->columns);
     bool has_columns = specified_col_count > 0;
 
@@ -100,90 +126,212 @@ void exec_insert_row_ast(ASTNode *ast) {
         bool success;
         if (has_columns) {
             success = insert_row_with_columns(table, value_row, schema_col_count, value_count,
-                                              &ins->columns);
+                                              &ins->columns, txn);
         } else {
-            success = insert_row_without_columns(table, value_row, value_count);
+            success = insert_row_without_columns(table, value_row, value_count, txn);
         }
 
         if (success)
             inserted++;
     }
 
+    exec_note_rows_changed(inserted);
     log_msg(LOG_INFO, "Inserted %d rows into table '%s'", inserted, table->name);
 }
 
+/* SET col = expression stores the result as the column's type, so arithmetic with a FLOAT
+   operand on an INT column is truncated back to INT. */
+static Value assigned_value(const Table *table, const ColumnValue *cv, const Row *old_row) {
+    if (!cv->expr)
+        return copy_value(&cv->value);
+    Value val = eval_select_expression(cv->expr, old_row, &table->schema);
+    const ColumnDef *col = (const ColumnDef *)alist_get(&table->schema.columns, cv->column_id);
+    if (col && col->type == TYPE_FLOAT && val.type == TYPE_INT) {
+        double f = (double)val.int_val;
+        val.type = TYPE_FLOAT;
+        val.float_val = f;
+    } else if (col && col->type == TYPE_INT && val.type == TYPE_FLOAT) {
+        long long i = (long long)val.float_val;
+        val.type = TYPE_INT;
+        val.int_val = i;
+    }
+    return val;
+}
+
+/* Fills assigned[j] with what values[j] stores in row_idx, checking its constraints. Every
+   expression reads the row as it was before the UPDATE, so SET a = b, b = a swaps. */
+static bool assign_row_values(Table *table, int row_idx, const ArrayList *values,
+                              Row *scratch, Value *assigned) {
+    const Row *old_row = table_fetch_row(table, row_idx, scratch);
+    int count = alist_length(values);
+    for (int j = 0; j < count; j++)
+        assigned[j] = assigned_value(table, (const ColumnValue *)alist_get(values, j), old_row);
+    for (int j = 0; j < count; j++) {
+        const ColumnValue *cv = (const ColumnValue *)alist_get(values, j);
+        if (cv->column_id < alist_length(&table->schema.columns) &&
+            !check_column_constraints(table, cv->column_id, &assigned[j], row_idx)) {
+            log_msg(LOG_ERROR, "UPDATE aborted due to constraint violation");
+            for (int k = 0; k < count; k++)
+                free_value(&assigned[k]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Under a transaction an UPDATE never changes a row another snapshot may be reading: it
+   ends the row's version and appends the updated copy as a new one. */
+static bool update_row_version(Table *table, int row_idx, const ArrayList *values,
+                               Value *assigned, Transaction *txn) {
+    Row row;
+    if (!table_row_init(table, &row)) {
+        for (int j = 0; j < alist_length(values); j++)
+            free_value(&assigned[j]);
+        return false;
+    }
+    int col_count = alist_length(&table->schema.columns);
+    for (int c = 0; c < col_count; c++) {
+        Value val = table_get_value(table, row_idx, (uint16_t)c);
+        *(Value *)alist_append(&row) = copy_value(&val);
+    }
+    for (int j = 0; j < alist_length(values); j++) {
+        ColumnValue *cv = (ColumnValue *)alist_get(values, j);
+        Value *val = (Value *)alist_get(&row, cv->column_id);
+        if (!val) {
+            free_value(&assigned[j]);
+            continue;
+        }
+        free_value(val);
+        *val = assigned[j];
+    }
+    if (!txn_delete_row(txn, table, row_idx)) {
+        table_row_free(table, &row);
+        return false;
+    }
+    return txn_insert_row(txn, table, &row);
+}
+
 void exec_update_row_ast(ASTNode *ast) {
     UpdateNode *update = &ast->update;
     Table *table = get_table_by_id(update->table_id);
     if (!table)
         return;
 
-    int updated = 0;
-    int row_count = alist_length(&table->rows);
-    for (int i = 0; i < row_count; i++) {
-        Row *row = (Row *)alist_get(&table->rows, i);
-        if (!row)
-            continue;
+    Transaction *txn;
+    if (!matview_writable(table, "UPDATE") || !txn_write_access(table, &txn))
+        return;
+
+    ArrayList matches;
+    alist_init(&matches, sizeof(int), NULL);
+    filter_table_rows(table, update->where_clause, &matches);
 
-        if (!eval_expression(update->where_clause, row, &table->schema))
+    int value_count = alist_length(&update->values);
+    Value *assigned = malloc(sizeof(Value) * (size_t)(value_count > 0 ? value_count : 1));
+    if (!assigned) {
+        log_msg(LOG_ERROR, "UPDATE: Out of memory");
+        alist_destroy(&matches);
+        return;
+    }
+    Row scratch;
+    alist_init(&scratch, sizeof(Value), NULL);
+
+    int updated = 0;
+    int match_count = alist_length(&matches);
+    for (int m = 0; m < match_count; m++) {
+        int i = *(int *)alist_get(&matches, m);
+        if (!assign_row_values(table, i, &update->values, &scratch, assigned))
+            break;
+        if (txn) {
+            if (!update_row_version(table, i, &update->values, assigned, txn))
+                break;
+            updated++;
             continue;
-        for (int j = 0; j < alist_length(&update->values); j++) {
+        }
+        matview_row_changed(table, i, false);
+        for (int j = 0; j < value_count; j++) {
             ColumnValue *cv = (ColumnValue *)alist_get(&update->values, j);
-            if (!cv)
+            if (cv->column_id >= alist_length(&table->schema.columns)) {
+                free_value(&assigned[j]);
                 continue;
-
-            Value *row_val = (Value *)alist_get(row, cv->column_id);
-        Value new_val = copy_value(&cv->value);
-
-        if (!check_foreign_key_constraint(table, cv->column_id, &new_val)) {
-                log_msg(LOG_ERROR, "UPDATE aborted due to foreign key constraint violation");
-                free_value(&new_val);
-                return;
             }
-
-            free_value(row_val);
-            *row_val = new_val;
+            if (table_set_value(table, i, cv->column_id, &assigned[j]))
+                wal_log_update(table, i, cv->column_id);
         }
+        matview_row_changed(table, i, true);
         updated++;
     }
 
+    alist_destroy(&scratch);
+    free(assigned);
+    alist_destroy(&matches);
+    exec_note_rows_changed(updated);
     log_msg(LOG_INFO, "Updated %d rows in table '%s'", updated, table->name);
 }
 
+/* Ends the version of every matching row; the rows go away once no snapshot sees them. */
+static void delete_row_versions(Table *table, const Expr *where, Transaction *txn) {
+    int deleted_rows = 0;
+    bool ok = true;
+    FilterCursor cursor;
+    filter_cursor_init(&cursor, table, where);
+    while (ok && filter_cursor_next(&cursor)) {
+        for (int k = 0; k < cursor.count && ok; k++) {
+            ok = txn_delete_row(txn, table, cursor.sel[k]);
+            deleted_rows += ok;
+        }
+    }
+    filter_cursor_close(&cursor);
+    exec_note_rows_changed(deleted_rows);
+    log_msg(LOG_INFO, "Deleted %d rows from table '%s'", deleted_rows, table->name);
+}
+
 void exec_delete_row_ast(ASTNode *ast) {
     DeleteNode *del = &ast->delete;
     Table *table = get_table_by_id(del->table_id);
     if (!table)
         return;
 
-    ArrayList kept_rows;
-    alist_init(&kept_rows, sizeof(Row), free_row_contents);
+    Transaction *txn;
+    if (!matview_writable(table, "DELETE") || !txn_write_access(table, &txn))
+        return;
+    if (txn) {
+        delete_row_versions(table, del->where_clause, txn);
+        return;
+    }
 
-    int deleted_rows = 0;
-    int row_count = alist_length(&table->rows);
-    for (int i = 0; i < row_count; i++) {
-        Row *row = (Row *)alist_get(&table->rows, i);
-        if (!row)
-            continue;
+    int row_count = table_row_count(table);
+    if (row_count == 0) {
+        log_msg(LOG_INFO, "Deleted 0 rows from table '%s'", table->name);
+        return;
+    }
 
-        if (eval_expression(del->where_clause, row, &table->schema)) {
-            deleted_rows++;
-        } else {
-            Row *kept = (Row *)alist_append(&kept_rows);
-            if (!kept)
-                continue;
-            alist_init(kept, sizeof(Value), free_value);
-            int src_len = alist_length(row);
-            for (int k = 0; k < src_len; k++) {
-                Value *src_val = (Value *)alist_get(row, k);
-                Value *dst_val = (Value *)alist_append(kept);
-                *dst_val = copy_string_value(src_val);
-            }
+    bool *keep = malloc(sizeof(bool) * row_count);
+    if (!keep) {
+        log_msg(LOG_ERROR, "exec_delete_row_ast: Failed to allocate row mask");
+        return;
+    }
+    for (int i = 0; i < row_count; i++)
+        keep[i] = true;
+
+    int deleted_rows = 0;
+    FilterCursor cursor;
+    filter_cursor_init(&cursor, table, del->where_clause);
+    while (filter_cursor_next(&cursor)) {
+        for (int k = 0; k < cursor.count; k++) {
+            matview_row_changed(table, cursor.sel[k], false);
+            keep[cursor.sel[k]] = false;
         }
+        deleted_rows += cursor.count;
+    }
+    filter_cursor_close(&cursor);
+
+    if (deleted_rows > 0) {
+        wal_log_delete_in_place(table, keep, row_count);
+        table_delete_rows(table, keep);
     }
 
-    alist_destroy(&table->rows);
-    table->rows = kept_rows;
+    free(keep);
 
+    exec_note_rows_changed(deleted_rows);
     log_msg(LOG_INFO, "Deleted %d rows from table '%s'", deleted_rows, table->name);
 }
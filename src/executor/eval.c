@@ -9,51 +9,42 @@
 #include "table.h"
 #include "values.h"
 
-static bool is_indexable_equality(const Expr *expr, uint16_t *col_id, Value *key_value) {
-    if (!expr || expr->type != EXPR_BINARY_OP)
+/* IN lists and LIKE with a compiled pattern only evaluate their left operand. */
+bool expr_is_match(const Expr *expr) {
+    if (expr->type != EXPR_BINARY_OP)
         return false;
-    if (expr->binary.op != OP_EQUALS)
-        return false;
-
-    Expr *left = expr->binary.left;
-    Expr *right = expr->binary.right;
-
-    if (left->type == EXPR_COLUMN && right->type == EXPR_VALUE) {
-        *col_id = left->column.column_id;
-        *key_value = copy_value(&right->value);
-        return true;
-    }
-    if (left->type == EXPR_VALUE && right->type == EXPR_COLUMN) {
-        *col_id = right->column.column_id;
-        *key_value = copy_value(&left->value);
-        return true;
-    }
-    return false;
+    OperatorType op = expr->binary.op;
+    return op == OP_IN || op == OP_NOT_IN ||
+           ((op == OP_LIKE || op == OP_NOT_LIKE) && expr->binary.like);
 }
 
-bool try_index_filter(Table *table, const Expr *where_expr, ArrayList *result) {
-    if (!table || !where_expr || !result)
+bool eval_match_value(const Expr *expr, const Value *left) {
+    switch (expr->binary.op) {
+    case OP_IN:
+    case OP_NOT_IN:
+        return eval_in_list(expr->binary.right, left, expr->binary.op == OP_NOT_IN);
+    case OP_LIKE:
+        return like_match_value(expr->binary.like, left);
+    case OP_NOT_LIKE:
+        return !is_null(left) && !like_match_value(expr->binary.like, left);
+    default:
         return false;
-
-    uint16_t col_id = 0;
-    Value key_value = {0};
-
-    if (is_indexable_equality(where_expr, &col_id, &key_value)) {
-        Index *index = find_index_by_table_column(table->table_id, col_id);
-        if (index) {
-            log_msg(LOG_DEBUG, "try_index_filter: Using index on table_id=%d col_id=%d", table->table_id, col_id);
-            lookup_index_values(index, &key_value, result);
-            free_value(&key_value);
-            return true;
-        }
-        free_value(&key_value);
     }
-    return false;
 }
 
-bool eval_cmp_expression(const Expr *expr, const Row *row, const TableDef *schema __attribute__((unused))) {
+bool eval_cmp_expression(const Expr *expr, const Row *row, const TableDef *schema) {
     Expr *left = expr->binary.left;
     Expr *right = expr->binary.right;
+    if (expr_is_match(expr)) {
+        if (left->type == EXPR_COLUMN) {
+            Value val = get_column_value_by_id(row, left->column.column_id);
+            return eval_match_value(expr, &val);
+        }
+        Value val = eval_select_expression(left, row, schema);
+        bool match = eval_match_value(expr, &val);
+        free_value(&val);
+        return match;
+    }
     if (left->type == EXPR_COLUMN && right->type == EXPR_VALUE) {
         return eval_comparison(get_column_value_by_id(row, left->column.column_id), right->value,
                                expr->binary.op);
@@ -66,7 +57,78 @@ bool eval_cmp_expression(const Expr *expr, const Row *row, const TableDef *schem
         return eval_comparison(get_column_value_by_id(row, left->column.column_id),
                                get_column_value_by_id(row, right->column.column_id), expr->binary.op);
     }
-    return false;
+    /* Arithmetic and function operands are evaluated to values first. */
+    Value lval = eval_select_expression(left, row, schema);
+    Value rval = eval_select_expression(right, row, schema);
+    bool match = eval_comparison(lval, rval, expr->binary.op);
+    free_value(&lval);
+    free_value(&rval);
+    return match;
+}
+
+/* SQL's three truth values. A condition only passes when TRUE; NOT tells FALSE from
+   UNKNOWN, which a comparison with a NULL operand evaluates to. */
+typedef enum { TRUTH_FALSE, TRUTH_TRUE, TRUTH_UNKNOWN } Truth;
+
+static bool operand_null(const Expr *operand, const Row *row, const TableDef *schema) {
+    if (operand->type == EXPR_COLUMN) {
+        Value val = get_column_value_by_id(row, operand->column.column_id);
+        return is_null(&val);
+    }
+    if (operand->type == EXPR_VALUE)
+        return is_null(&operand->value);
+    Value val = eval_select_expression((Expr *)operand, row, schema);
+    bool null = is_null(&val);
+    free_value(&val);
+    return null;
+}
+
+static Truth eval_truth(const Expr *expr, const Row *row, const TableDef *schema) {
+    if (!expr)
+        return TRUTH_TRUE;
+    switch (expr->type) {
+    case EXPR_COLUMN:
+    case EXPR_VALUE:
+        return operand_null(expr, row, schema) ? TRUTH_UNKNOWN : TRUTH_TRUE;
+    case EXPR_BINARY_OP: {
+        OperatorType op = expr->binary.op;
+        if (op == OP_AND || op == OP_OR) {
+            Truth decided = op == OP_AND ? TRUTH_FALSE : TRUTH_TRUE;
+            Truth left = eval_truth(expr->binary.left, row, schema);
+            if (left == decided)
+                return decided;
+            Truth right = eval_truth(expr->binary.right, row, schema);
+            if (right == decided)
+                return decided;
+            return left == TRUTH_UNKNOWN || right == TRUTH_UNKNOWN ? TRUTH_UNKNOWN : left;
+        }
+        if (eval_expression(expr, row, schema))
+            return TRUTH_TRUE;
+        bool comparison = op == OP_EQUALS || op == OP_NOT_EQUALS || op == OP_LESS ||
+                          op == OP_LESS_EQUAL || op == OP_GREATER || op == OP_GREATER_EQUAL ||
+                          op == OP_LIKE || op == OP_NOT_LIKE || op == OP_IN || op == OP_NOT_IN;
+        if (!comparison)
+            return TRUTH_FALSE;
+        /* A match (IN, compiled LIKE) only evaluates its left operand. */
+        bool null = operand_null(expr->binary.left, row, schema) ||
+                    (!expr_is_match(expr) && operand_null(expr->binary.right, row, schema));
+        return null ? TRUTH_UNKNOWN : TRUTH_FALSE;
+    }
+    case EXPR_UNARY_OP:
+        if (expr->unary.op == OP_NOT) {
+            Truth operand = eval_truth(expr->unary.operand, row, schema);
+            return operand == TRUTH_UNKNOWN ? TRUTH_UNKNOWN
+                                            : (operand == TRUTH_TRUE ? TRUTH_FALSE : TRUTH_TRUE);
+        }
+        return TRUTH_FALSE;
+    default:
+        return eval_expression(expr, row, schema) ? TRUTH_TRUE : TRUTH_FALSE;
+    }
+}
+
+/* Whether the condition is FALSE for row, as opposed to TRUE or UNKNOWN. */
+bool eval_expression_false(const Expr *expr, const Row *row, const TableDef *schema) {
+    return eval_truth(expr, row, schema) == TRUTH_FALSE;
 }
 
 bool eval_expression(const Expr *expr, const Row *row, const TableDef *schema) {
@@ -81,14 +143,13 @@ bool eval_expression(const Expr *expr, const Row *row, const TableDef *schema) {
     case EXPR_VALUE:
         return !is_null(&expr->value);
     case EXPR_BINARY_OP: {
-        bool left_val = eval_expression(expr->binary.left, row, schema);
-        bool right_val = eval_expression(expr->binary.right, row, schema);
-
         switch (expr->binary.op) {
         case OP_AND:
-            return left_val && right_val;
+            return eval_expression(expr->binary.left, row, schema) &&
+                   eval_expression(expr->binary.right, row, schema);
         case OP_OR:
-            return left_val || right_val;
+            return eval_expression(expr->binary.left, row, schema) ||
+                   eval_expression(expr->binary.right, row, schema);
         case OP_EQUALS:
         case OP_NOT_EQUALS:
         case OP_LESS:
@@ -96,94 +157,19 @@ bool eval_expression(const Expr *expr, const Row *row, const TableDef *schema) {
         case OP_GREATER:
         case OP_GREATER_EQUAL:
         case OP_LIKE:
+        case OP_NOT_LIKE:
+        case OP_IN:
+        case OP_NOT_IN:
             return eval_cmp_expression(expr, row, schema);
         default:
             return false;
         }
     }
-    case EXPR_UNARY_OP: {
-        bool operand_val = eval_expression(expr->unary.operand, row, schema);
-        return expr->unary.op == OP_NOT ? !operand_val : false;
-    }
-    default:
-        return false;
-    }
-}
-
-static bool eval_cmp_operation(const Expr *expr, const Row *row, uint8_t left_table_id,
-                               uint8_t right_table_id, int left_col_count) {
-    Expr *left = expr->binary.left;
-    Expr *right = expr->binary.right;
-    if (left->type == EXPR_COLUMN && right->type == EXPR_VALUE) {
-        return eval_comparison(get_column_value_by_id_from_join(row, left_col_count,
-                                                          left->column.table_id, left->column.column_id,
-                                                          left_table_id, right_table_id),
-                               right->value, expr->binary.op);
-    }
-    if (left->type == EXPR_VALUE && right->type == EXPR_COLUMN) {
-        return eval_comparison(left->value,
-                               get_column_value_by_id_from_join(row, left_col_count,
-                                                          right->column.table_id, right->column.column_id,
-                                                          left_table_id, right_table_id),
-                               expr->binary.op);
-    }
-    if (left->type == EXPR_COLUMN && right->type == EXPR_COLUMN) {
-        return eval_comparison(get_column_value_by_id_from_join(row, left_col_count,
-                                                          left->column.table_id, left->column.column_id,
-                                                          left_table_id, right_table_id),
-                               get_column_value_by_id_from_join(row, left_col_count,
-                                                          right->column.table_id, right->column.column_id,
-                                                          left_table_id, right_table_id),
-                               expr->binary.op);
-    }
-    return false;
-}
-static bool eval_binary_operation(const Expr *expr, const Row *row, uint8_t left_table_id,
-                                  uint8_t right_table_id, int left_col_count) {
-    bool left_val =
-        eval_expression_for_join(expr->binary.left, row, left_table_id, right_table_id, left_col_count);
-    bool right_val = eval_expression_for_join(expr->binary.right, row, left_table_id, right_table_id,
-                                              left_col_count);
-
-    switch (expr->binary.op) {
-    case OP_AND:
-        return left_val && right_val;
-    case OP_OR:
-        return left_val || right_val;
-    case OP_EQUALS:
-    case OP_NOT_EQUALS:
-    case OP_LESS:
-    case OP_LESS_EQUAL:
-    case OP_GREATER:
-    case OP_GREATER_EQUAL:
-        return eval_cmp_operation(expr, row, left_table_id, right_table_id, left_col_count);
-    default:
-        return false;
-    }
-}
-
-bool eval_expression_for_join(const Expr *expr, const Row *row, uint8_t left_table_id,
-                              uint8_t right_table_id, int left_col_count) {
-    if (!expr)
-        return true;
-
-    switch (expr->type) {
-    case EXPR_COLUMN: {
-        Value val = get_column_value_by_id_from_join(row, left_col_count,
-                                               expr->column.table_id, expr->column.column_id,
-                                               left_table_id, right_table_id);
-        return !is_null(&val);
-    }
-    case EXPR_VALUE:
-        return !is_null(&expr->value);
-    case EXPR_BINARY_OP:
-        return eval_binary_operation(expr, row, left_table_id, right_table_id, left_col_count);
-
-    case EXPR_UNARY_OP: {
-        bool operand_val = eval_expression_for_join(expr->unary.operand, row, left_table_id,
-                                                    right_table_id, left_col_count);
-        return expr->unary.op == OP_NOT ? !operand_val : false;
-    }
+    case EXPR_UNARY_OP:
+        return expr->unary.op == OP_NOT &&
+               eval_truth(expr->unary.operand, row, schema) == TRUTH_FALSE;
+    case EXPR_SUBQUERY:
+        return eval_subquery_condition(expr, row, schema);
     default:
         return false;
     }
@@ -288,53 +274,17 @@ static Value eval_comparison_op(OperatorType op, Value left, Value right) {
     return result;
 }
 
-static Value eval_subquery(const Expr *expr) {
-    Value result = {0};
-    result.type = TYPE_NULL;
-
-    if (!expr || expr->type != EXPR_SUBQUERY || !expr->subquery.subquery) {
-        log_msg(LOG_DEBUG, "eval_subquery: early return, expr=%p", expr);
-        return result;
-    }
-
-    log_msg(LOG_DEBUG, "eval_subquery: executing subquery");
-
-    ASTNode *subquery_ast = expr->subquery.subquery;
-
-    QueryResult *saved_result = get_last_query_result();
-    set_last_query_result(NULL);
-
-    exec_ast(subquery_ast);
-
-    QueryResult *last_result = get_last_query_result();
-    if (last_result && alist_length(&last_result->rows) > 0) {
-        int col_count = last_result->col_count;
-        if (col_count > 0) {
-            Value *val = (Value *)alist_get(&last_result->values, 0);
-            if (val)
-                result = copy_string_value(val);
-        }
-    }
-
-    free_query_result(last_result);
-    set_last_query_result(saved_result);
-
-    return result;
-}
-
 Value eval_scalar_function(const Expr *expr, const Row *row, const TableDef *schema);
 
-static Value eval_binary_op(Expr *expr, const Row *row, const TableDef *schema) {
-    Value left = eval_select_expression(expr->binary.left, row, schema);
-    Value right = eval_select_expression(expr->binary.right, row, schema);
-
-    switch (expr->binary.op) {
+/* Applies an arithmetic or comparison operator to two evaluated operands. */
+Value eval_binary_values(OperatorType op, Value left, Value right) {
+    switch (op) {
     case OP_ADD:
     case OP_SUBTRACT:
     case OP_MULTIPLY:
     case OP_DIVIDE:
     case OP_MODULUS:
-        return eval_arithmetic_op(expr->binary.op, left, right);
+        return eval_arithmetic_op(op, left, right);
     case OP_EQUALS:
     case OP_NOT_EQUALS:
     case OP_LESS:
@@ -342,9 +292,10 @@ static Value eval_binary_op(Expr *expr, const Row *row, const TableDef *schema)
     case OP_GREATER:
     case OP_GREATER_EQUAL:
     case OP_LIKE:
+    case OP_NOT_LIKE:
     case OP_AND:
     case OP_OR:
-        return eval_comparison_op(expr->binary.op, left, right);
+        return eval_comparison_op(op, left, right);
     default:
         break;
     }
@@ -353,10 +304,23 @@ static Value eval_binary_op(Expr *expr, const Row *row, const TableDef *schema)
     return result;
 }
 
-static Value eval_unary_op(Expr *expr, const Row *row, const TableDef *schema) {
+static Value eval_binary_op(Expr *expr, const Row *row, const TableDef *schema) {
+    if (expr_is_match(expr)) {
+        Value operand = eval_select_expression(expr->binary.left, row, schema);
+        Value result = {0};
+        result.type = TYPE_INT;
+        result.int_val = eval_match_value(expr, &operand) ? 1 : 0;
+        free_value(&operand);
+        return result;
+    }
+    Value left = eval_select_expression(expr->binary.left, row, schema);
+    Value right = eval_select_expression(expr->binary.right, row, schema);
+    return eval_binary_values(expr->binary.op, left, right);
+}
+
+Value eval_unary_value(OperatorType op, Value operand) {
     Value result = {0};
-    Value operand = eval_select_expression(expr->unary.operand, row, schema);
-    if (expr->unary.op == OP_NOT) {
+    if (op == OP_NOT) {
         result.type = TYPE_INT;
         result.int_val = (operand.type == TYPE_NULL) ? 1 : 0;
     } else {
@@ -365,6 +329,11 @@ static Value eval_unary_op(Expr *expr, const Row *row, const TableDef *schema) {
     return result;
 }
 
+static Value eval_unary_op(Expr *expr, const Row *row, const TableDef *schema) {
+    return eval_unary_value(expr->unary.op,
+                            eval_select_expression(expr->unary.operand, row, schema));
+}
+
 Value eval_select_expression(Expr *expr, const Row *row, const TableDef *schema) {
     Value result = {0};
     result.type = TYPE_NULL;
@@ -390,7 +359,7 @@ Value eval_select_expression(Expr *expr, const Row *row, const TableDef *schema)
     case EXPR_SCALAR_FUNC:
         return eval_scalar_function(expr, row, schema);
     case EXPR_SUBQUERY:
-        return eval_subquery(expr);
+        return eval_subquery(expr, row, schema);
     default:
         log_msg(LOG_WARN, "eval_select_expression: Unknown expression type %d", expr->type);
     }
@@ -0,0 +1,494 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "utils.h"
+#include "values.h"
+
+#define EXPLAIN_LINE_LEN 512
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* The time stamp counter where there is one, so timing every operator call costs a few
+   cycles; EXPLAIN ANALYZE converts cycles to time against the wall clock of the whole run. */
+uint64_t explain_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return monotonic_ns();
+#endif
+}
+
+typedef struct {
+    QueryResult *result;
+    const ExecContext *ctx;
+    bool analyze;
+    double ns_per_cycle;
+} ExplainWriter;
+
+static void append(char *line, const char *text) {
+    str_append(line, EXPLAIN_LINE_LEN, text);
+}
+
+static void appendf(char *line, const char *fmt, ...) {
+    char part[EXPLAIN_LINE_LEN];
+    va_list args;
+    va_start(args, fmt);
+    string_format_v(part, sizeof(part), fmt, args);
+    va_end(args);
+    append(line, part);
+}
+
+static const char *operator_symbol(OperatorType op) {
+    switch (op) {
+    case OP_EQUALS:
+        return "=";
+    case OP_NOT_EQUALS:
+        return "!=";
+    case OP_LESS:
+        return "<";
+    case OP_LESS_EQUAL:
+        return "<=";
+    case OP_GREATER:
+        return ">";
+    case OP_GREATER_EQUAL:
+        return ">=";
+    case OP_AND:
+        return "AND";
+    case OP_OR:
+        return "OR";
+    case OP_NOT:
+        return "NOT";
+    case OP_LIKE:
+        return "LIKE";
+    case OP_NOT_LIKE:
+        return "NOT LIKE";
+    case OP_ADD:
+        return "+";
+    case OP_SUBTRACT:
+        return "-";
+    case OP_MULTIPLY:
+        return "*";
+    case OP_DIVIDE:
+        return "/";
+    case OP_MODULUS:
+        return "%";
+    case OP_IN:
+        return "IN";
+    case OP_NOT_IN:
+        return "NOT IN";
+    case OP_EXISTS:
+        return "EXISTS";
+    }
+    return "?";
+}
+
+static const char *aggregate_name(AggFuncType func) {
+    static const char *names[] = {"COUNT", "SUM",    "AVG",      "MIN",
+                                  "MAX",   "STDDEV", "VARIANCE", "APPROX_COUNT_DISTINCT",
+                                  "APPROX_PERCENTILE"};
+    return func <= FUNC_APPROX_PERCENTILE ? names[func] : "?";
+}
+
+static const char *scalar_name(ScalarFuncType func) {
+    static const char *names[] = {"ABS",    "SQRT",   "MOD",      "POW",    "ROUND", "FLOOR",
+                                  "CEIL",   "UPPER",  "LOWER",    "LEN",    "MID",   "LEFT",
+                                  "RIGHT",  "CONCAT", "COALESCE", "NULLIF", "CASE",  "HOUR",
+                                  "MINUTE", "SECOND", "YEAR",     "MONTH",  "DAY"};
+    return func <= FUNC_DATE_DAY ? names[func] : "?";
+}
+
+static void append_column(char *line, const TableDef *schema, uint16_t column_id) {
+    const ColumnDef *col = schema && column_id < alist_length(&schema->columns)
+                               ? (const ColumnDef *)alist_get(&schema->columns, column_id)
+                               : NULL;
+    if (col)
+        append(line, col->name);
+    else
+        appendf(line, "#%u", column_id);
+}
+
+static void append_value(char *line, const Value *value) {
+    char text[64];
+    repr_into(value, text, sizeof(text));
+    bool quoted = value->type == TYPE_STRING || value->type == TYPE_DATE ||
+                  value->type == TYPE_TIME;
+    appendf(line, quoted ? "'%s'" : "%s", text);
+}
+
+/* SQL-like text of an expression over schema's columns, for plan lines only. */
+static void append_expr(char *line, const Expr *expr, const TableDef *schema) {
+    if (!expr) {
+        append(line, "?");
+        return;
+    }
+    switch (expr->type) {
+    case EXPR_COLUMN:
+        append_column(line, schema, expr->column.column_id);
+        break;
+    case EXPR_VALUE:
+        append_value(line, &expr->value);
+        break;
+    case EXPR_BINARY_OP:
+        append(line, "(");
+        append_expr(line, expr->binary.left, schema);
+        appendf(line, " %s ", operator_symbol(expr->binary.op));
+        append_expr(line, expr->binary.right, schema);
+        append(line, ")");
+        break;
+    case EXPR_UNARY_OP:
+        append(line, expr->unary.op == OP_NOT ? "NOT " : operator_symbol(expr->unary.op));
+        append_expr(line, expr->unary.operand, schema);
+        break;
+    case EXPR_AGGREGATE_FUNC:
+        appendf(line, "%s(%s", aggregate_name(expr->aggregate.func_type),
+                expr->aggregate.distinct ? "DISTINCT " : "");
+        if (expr->aggregate.count_all || !expr->aggregate.operand)
+            append(line, "*");
+        else
+            append_expr(line, expr->aggregate.operand, schema);
+        if (expr->aggregate.func_type == FUNC_APPROX_PERCENTILE)
+            appendf(line, ", %g", expr->aggregate.fraction);
+        append(line, ")");
+        break;
+    case EXPR_SCALAR_FUNC:
+        appendf(line, "%s(", scalar_name(expr->scalar.func_type));
+        for (int i = 0; i < expr->scalar.arg_count && i < 3; i++) {
+            if (i > 0)
+                append(line, ", ");
+            append_expr(line, expr->scalar.args[i], schema);
+        }
+        append(line, ")");
+        break;
+    case EXPR_SUBQUERY:
+        if (expr->subquery.operand) {
+            append_expr(line, expr->subquery.operand, schema);
+            append(line, expr->subquery.kind == SUBQUERY_NOT_IN ? " NOT IN " : " IN ");
+        } else if (expr->subquery.kind == SUBQUERY_EXISTS) {
+            append(line, "EXISTS ");
+        }
+        append(line, "(subquery)");
+        break;
+    case EXPR_LIST:
+        append(line, "(");
+        for (int i = 0; i < expr->list.count; i++) {
+            if (i == 4) {
+                appendf(line, ", ... %d values", expr->list.count);
+                break;
+            }
+            if (i > 0)
+                append(line, ", ");
+            append_value(line, &expr->list.values[i]);
+        }
+        append(line, ")");
+        break;
+    }
+}
+
+static void append_exprs(char *line, const ArrayList *exprs, const TableDef *schema) {
+    for (int i = 0; exprs && i < alist_length(exprs); i++) {
+        if (i > 0)
+            append(line, ", ");
+        append_expr(line, *(Expr **)alist_get(exprs, i), schema);
+    }
+}
+
+static const TableDef *table_schema(uint16_t table_id) {
+    Table *table = get_table_by_id(table_id);
+    return table ? &table->schema : NULL;
+}
+
+static void append_table(char *line, uint16_t table_id) {
+    Table *table = get_table_by_id(table_id);
+    appendf(line, " on %s", table ? table->name : "?");
+}
+
+static uint16_t key_column(const IndexScanPlan *scan, int k) {
+    return *(uint16_t *)alist_get(&scan->index->columns, k);
+}
+
+/* The equalities on the leading key columns, then the bounds on the next one. */
+static void append_index_key(char *line, const IndexScanPlan *scan) {
+    const TableDef *schema = table_schema(scan->table_id);
+    const Value *eq = scan->op == OP_EQUALS ? scan->search_key : scan->lo_key;
+    append(line, " (");
+    for (int k = 0; k < scan->eq_count; k++) {
+        if (k > 0)
+            append(line, " AND ");
+        append_column(line, schema, key_column(scan, k));
+        append(line, " = ");
+        append_value(line, &eq[k]);
+    }
+    if (scan->op != OP_EQUALS) {
+        uint16_t column_id = key_column(scan, scan->eq_count);
+        bool lo = scan->lo_width > scan->eq_count, hi = scan->hi_width > scan->eq_count;
+        if (lo) {
+            if (scan->eq_count > 0)
+                append(line, " AND ");
+            append_column(line, schema, column_id);
+            append(line, scan->lo_inclusive ? " >= " : " > ");
+            append_value(line, &scan->lo_key[scan->eq_count]);
+        }
+        if (hi) {
+            if (lo || scan->eq_count > 0)
+                append(line, " AND ");
+            append_column(line, schema, column_id);
+            append(line, scan->hi_inclusive ? " <= " : " < ");
+            append_value(line, &scan->hi_key[scan->eq_count]);
+        }
+    }
+    append(line, ")");
+}
+
+static void append_join(char *line, const PlanNode *plan, const ExecContext *ctx) {
+    const JoinPlan *join = &plan->plan.join;
+    const char *kind = plan->type == PLAN_HASH_JOIN        ? "Hash Join"
+                       : plan->type == PLAN_NESTED_LOOP_JOIN ? "Nested Loop Join"
+                                                             : "Index Nested Loop Join";
+    appendf(line, "%s%s", join->join_type == JOIN_LEFT ? "Left " : "", kind);
+    if (plan->type == PLAN_NESTED_LOOP_JOIN) {
+        if (join->condition) {
+            append(line, " (");
+            append_expr(line, join->condition, ctx->schema);
+            append(line, ")");
+        }
+        return;
+    }
+    const Table *left = ctx->tables[join->key_slot];
+    const Table *right = ctx->tables[join->right_slot];
+    append(line, " (");
+    appendf(line, "%s.", left->name);
+    append_column(line, &left->schema, join->left_column);
+    appendf(line, " = %s.", right->name);
+    append_column(line, &right->schema, join->right_column);
+    append(line, ")");
+    if (plan->type == PLAN_HASH_JOIN) {
+        appendf(line, " build %s", join->build_left ? "left" : "right");
+        return;
+    }
+    appendf(line, " using %s", join->index->index_name);
+    if (join->right_filter) {
+        append(line, " filter ");
+        append_expr(line, join->right_filter, &right->schema);
+    }
+}
+
+static void describe_node(char *line, const PlanNode *plan, const ExecContext *ctx) {
+    switch (plan->type) {
+    case PLAN_SEQ_SCAN:
+        append(line, "Seq Scan");
+        append_table(line, plan->plan.seq_scan.table_id);
+        if (plan->plan.seq_scan.sampled)
+            appendf(line, " sample %g%%", plan->plan.seq_scan.sample_percent);
+        break;
+    case PLAN_INDEX_SCAN: {
+        const IndexScanPlan *scan = &plan->plan.index_scan;
+        appendf(line, "%s using %s", scan->op == OP_EQUALS ? "Index Scan" : "Index Range Scan",
+                scan->index->index_name);
+        append_table(line, scan->table_id);
+        append_index_key(line, scan);
+        break;
+    }
+    case PLAN_INDEX_ONLY_SCAN: {
+        const IndexScanPlan *scan = &plan->plan.index_scan;
+        appendf(line, "Index Only Scan using %s", scan->index->index_name);
+        append_table(line, scan->table_id);
+        append_index_key(line, scan);
+        break;
+    }
+    case PLAN_INDEX_INTERSECT:
+        append(line, "Index Intersect");
+        break;
+    case PLAN_INDEX_ORDER_SCAN: {
+        const IndexOrderScanPlan *scan = &plan->plan.index_order_scan;
+        appendf(line, "Index Order Scan using %s", scan->index->index_name);
+        append_table(line, scan->table_id);
+        if (scan->desc)
+            append(line, " DESC");
+        break;
+    }
+    case PLAN_FILTER:
+        append(line, "Filter ");
+        append_expr(line, plan->plan.filter.predicate, ctx->schema);
+        break;
+    case PLAN_HASH_JOIN:
+    case PLAN_NESTED_LOOP_JOIN:
+    case PLAN_INDEX_NESTED_LOOP_JOIN:
+        append_join(line, plan, ctx);
+        break;
+    case PLAN_AGGREGATE:
+        append(line, "Aggregate ");
+        append_exprs(line, plan->plan.aggregate.expressions, ctx->schema);
+        break;
+    case PLAN_HASH_AGGREGATE:
+        append(line, "Hash Aggregate");
+        if (plan->plan.hash_aggregate.group_by &&
+            alist_length(plan->plan.hash_aggregate.group_by) > 0) {
+            append(line, " by ");
+            append_exprs(line, plan->plan.hash_aggregate.group_by, ctx->schema);
+        }
+        if (plan->plan.hash_aggregate.having) {
+            append(line, " having ");
+            append_expr(line, plan->plan.hash_aggregate.having, ctx->schema);
+        }
+        break;
+    case PLAN_SORT:
+        append(line, "Sort ");
+        append_exprs(line, plan->plan.sort.keys, ctx->schema);
+        if (plan->plan.sort.limit > 0)
+            appendf(line, " top %u", plan->plan.sort.limit);
+        break;
+    case PLAN_LIMIT:
+        appendf(line, "Limit %u", plan->plan.limit.count);
+        break;
+    case PLAN_PROJECT:
+        append(line, "Project ");
+        if (plan->plan.project.select_star)
+            append(line, "*");
+        else
+            append_exprs(line, plan->plan.project.expressions, ctx->schema);
+        break;
+    }
+}
+
+static bool reads_index(PlanType type) {
+    return type == PLAN_INDEX_SCAN || type == PLAN_INDEX_INTERSECT ||
+           type == PLAN_INDEX_ORDER_SCAN || type == PLAN_INDEX_ONLY_SCAN ||
+           type == PLAN_INDEX_NESTED_LOOP_JOIN;
+}
+
+static void add_line(ExplainWriter *writer, const char *line) {
+    Value value = {0};
+    value.type = TYPE_STRING;
+    value.char_val = (char *)line;
+    QueryResult *result = writer->result;
+    int row = alist_length(&result->rows);
+    *(Value *)alist_append(&result->values) = copy_value_to_arena(&result->arena, &value);
+    *(int *)alist_append(&result->rows) = row;
+}
+
+/* One line per plan node, children indented below their parent. op is the node's operator
+   under ANALYZE; the inputs of an Index Intersect have none, exec_plan_rows runs them. */
+static void explain_node(ExplainWriter *writer, const PlanNode *plan, const Operator *op,
+                         int depth) {
+    char line[EXPLAIN_LINE_LEN];
+    string_format(line, sizeof(line), "%*s%s", depth * 2, "", depth > 0 ? "-> " : "");
+    describe_node(line, plan, writer->ctx);
+    appendf(line, "  (cost=%.2f rows=%u)", plan->cost, plan->estimated_rows);
+    if (op) {
+        appendf(line, " (actual rows=%llu batches=%llu time=%.3f ms alloc=%llu B",
+                (unsigned long long)op->rows_out, (unsigned long long)op->batches,
+                (double)op->cycles * writer->ns_per_cycle / 1e6,
+                (unsigned long long)op->alloc_bytes);
+        if (reads_index(plan->type))
+            appendf(line, " index hits=%llu", (unsigned long long)op->index_hits);
+        if (op->spilled_bytes > 0)
+            appendf(line, " spilled=%llu B", (unsigned long long)op->spilled_bytes);
+        append(line, ")");
+    }
+    add_line(writer, line);
+
+    if (plan->left)
+        explain_node(writer, plan->left, op ? op->left : NULL, depth + 1);
+    if (plan->right)
+        explain_node(writer, plan->right, op ? op->right : NULL, depth + 1);
+}
+
+static QueryResult *explain_result(void) {
+    QueryResult *result = malloc(sizeof(QueryResult));
+    if (!result)
+        return NULL;
+    memclear(result, sizeof(QueryResult));
+    result->col_count = 1;
+    arena_init(&result->arena, 0);
+    alist_init(&result->column_names, sizeof(char *), NULL);
+    alist_init(&result->values, sizeof(Value), NULL);
+    alist_init(&result->rows, sizeof(int), NULL);
+    *(char **)alist_append(&result->column_names) = arena_strdup(&result->arena, "QUERY PLAN");
+    return result;
+}
+
+/* EXPLAIN: the plan the SELECT would run, one line per node with the optimizer's estimates,
+   as a one-column result. EXPLAIN ANALYZE runs it first, discarding its rows, and adds what
+   every operator did: rows and batches out, time, query arena bytes, index row ids read and
+   bytes spilled to temporary files, then the statement's peak memory: the most charged to it
+   or held in the query arena at once, whichever is larger. Times and bytes include the
+   operator's inputs. */
+QueryResult *exec_explain_query(const SelectNode *select) {
+    ExecContext ctx;
+    if (!exec_context_init(&ctx, select)) {
+        exec_context_free(&ctx);
+        return NULL;
+    }
+    QueryResult *result = NULL;
+    PlanNode *plan = plan_select(select);
+    ExplainWriter writer = {NULL, &ctx, select->explain == EXPLAIN_ANALYZE, 1.0};
+    Operator *root = NULL;
+    uint64_t wall_ns = 0;
+    size_t arena_base = 0;
+    if (plan && writer.analyze) {
+        ctx.analyze = true;
+        arena_base = ctx.arena_peak = arena_bytes_used(ctx.arena);
+        uint64_t start_ns = monotonic_ns();
+        uint64_t start = explain_cycles();
+        root = operator_build(plan, &ctx);
+        if (root && operator_open(root)) {
+            RowBatch batch;
+            row_batch_init(&batch);
+            while (operator_next(root, &batch))
+                ;
+            row_batch_free(&batch);
+        }
+        operator_close(root);
+        uint64_t cycles = explain_cycles() - start;
+        wall_ns = monotonic_ns() - start_ns;
+        writer.ns_per_cycle = cycles > 0 ? (double)wall_ns / (double)cycles : 0;
+        free_query_result(ctx.result);
+        ctx.result = NULL;
+    }
+    if (plan && (!writer.analyze || root)) {
+        result = writer.result = explain_result();
+        if (result) {
+            explain_node(&writer, plan, root, 0);
+            if (writer.analyze) {
+                /* A warm query arena block is not charged to the statement again, so the
+                   arena's own high water counts what the operators allocated in it. */
+                size_t peak = atomic_load(&ctx.account.peak);
+                if (ctx.arena_peak - arena_base > peak)
+                    peak = ctx.arena_peak - arena_base;
+                char line[EXPLAIN_LINE_LEN];
+                string_format(line, sizeof(line), "Peak memory: %zu kB", (peak + 1023) / 1024);
+                add_line(&writer, line);
+                string_format(line, sizeof(line), "Execution time: %.3f ms", wall_ns / 1e6);
+                add_line(&writer, line);
+            }
+        }
+    }
+    if (!plan)
+        log_msg(LOG_ERROR, "exec_explain_query: Failed to plan the SELECT");
+    free_plan(plan);
+    exec_context_free(&ctx);
+    return result;
+}
+
+/* The CLI prints a plan as its lines, since the table would center away the indentation. */
+void print_query_plan(const QueryResult *result) {
+    for (int i = 0; i < alist_length(&result->values); i++)
+        printf("%s\n", value_str((const Value *)alist_get(&result->values, i)));
+}
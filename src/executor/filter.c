@@ -0,0 +1,724 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "metrics.h"
+#include "table.h"
+#include "txn.h"
+#include "utils.h"
+#include "values.h"
+
+/* Batch WHERE evaluation. A batch is a selection vector of ascending row indices; every
+   operator narrows it in place, so AND is just two passes and no per-row Expr dispatch is
+   needed for column <op> constant predicates. */
+
+static bool cmp_matches(int cmp, OperatorType op) {
+    switch (op) {
+    case OP_EQUALS:
+        return cmp == 0;
+    case OP_NOT_EQUALS:
+        return cmp != 0;
+    case OP_LESS:
+        return cmp < 0;
+    case OP_LESS_EQUAL:
+        return cmp <= 0;
+    case OP_GREATER:
+        return cmp > 0;
+    case OP_GREATER_EQUAL:
+        return cmp >= 0;
+    default:
+        return false;
+    }
+}
+
+static OperatorType flip_op(OperatorType op) {
+    switch (op) {
+    case OP_LESS:
+        return OP_GREATER;
+    case OP_LESS_EQUAL:
+        return OP_GREATER_EQUAL;
+    case OP_GREATER:
+        return OP_LESS;
+    case OP_GREATER_EQUAL:
+        return OP_LESS_EQUAL;
+    default:
+        return op;
+    }
+}
+
+#define IS_NULL_BIT(nulls, r) ((nulls)[(r) / 8] & (1u << ((r) % 8)))
+
+/* Row r of a vector's plain tail is element r - base of its arrays. */
+#define KERNEL_LOOP(COND)                                                                          \
+    for (int k = 0; k < n; k++) {                                                                  \
+        int r = sel[k];                                                                            \
+        int i = r - base;                                                                          \
+        bool keep = !IS_NULL_BIT(nulls, i) && (COND);                                              \
+        sel[m] = r;                                                                                \
+        m += keep;                                                                                 \
+    }
+
+#define DEFINE_CMP_KERNEL(NAME, ELEM_T, CONST_T)                                                   \
+    static int NAME(const ELEM_T *vals, const uint8_t *nulls, int base, OperatorType op,          \
+                    CONST_T c, int *sel, int n) {                                                  \
+        int m = 0;                                                                                 \
+        switch (op) {                                                                              \
+        case OP_EQUALS:                                                                            \
+            KERNEL_LOOP(vals[i] == c);                                                             \
+            break;                                                                                 \
+        case OP_NOT_EQUALS:                                                                        \
+            KERNEL_LOOP(vals[i] != c);                                                             \
+            break;                                                                                 \
+        case OP_LESS:                                                                              \
+            KERNEL_LOOP(vals[i] < c);                                                              \
+            break;                                                                                 \
+        case OP_LESS_EQUAL:                                                                        \
+            KERNEL_LOOP(vals[i] <= c);                                                             \
+            break;                                                                                 \
+        case OP_GREATER:                                                                           \
+            KERNEL_LOOP(vals[i] > c);                                                              \
+            break;                                                                                 \
+        case OP_GREATER_EQUAL:                                                                     \
+            KERNEL_LOOP(vals[i] >= c);                                                             \
+            break;                                                                                 \
+        default:                                                                                   \
+            break;                                                                                 \
+        }                                                                                          \
+        return m;                                                                                  \
+    }
+
+DEFINE_CMP_KERNEL(filter_int_int, long long, long long)
+DEFINE_CMP_KERNEL(filter_int_float, long long, double)
+DEFINE_CMP_KERNEL(filter_float_float, double, double)
+DEFINE_CMP_KERNEL(filter_packed, unsigned int, unsigned int)
+
+static bool is_kernel_constant(const Value *c) {
+    return c->type == TYPE_INT || c->type == TYPE_FLOAT || c->type == TYPE_DATE ||
+           c->type == TYPE_TIME;
+}
+
+static bool vector_kernel_types(const ColumnVector *vec, const Value *c) {
+    switch (vec->type) {
+    case TYPE_INT:
+    case TYPE_FLOAT:
+        return c->type == TYPE_INT || c->type == TYPE_FLOAT;
+    case TYPE_DATE:
+    case TYPE_TIME:
+        return c->type == vec->type;
+    default:
+        return false;
+    }
+}
+
+static int filter_tail(const ColumnVector *vec, OperatorType op, const Value *c, int *sel,
+                       int n) {
+    int base = vec->sealed;
+    if (vec->type == TYPE_INT && c->type == TYPE_INT)
+        return filter_int_int(vec->ints, vec->nulls, base, op, c->int_val, sel, n);
+    if (vec->type == TYPE_INT)
+        return filter_int_float(vec->ints, vec->nulls, base, op, c->float_val, sel, n);
+    if (vec->type == TYPE_FLOAT)
+        return filter_float_float(vec->floats, vec->nulls, base, op,
+                                  c->type == TYPE_INT ? (double)c->int_val : c->float_val, sel, n);
+    return filter_packed(vec->packed, vec->nulls, base, op,
+                         vec->type == TYPE_DATE ? c->date_val : c->time_val, sel, n);
+}
+
+static bool typed_compare(const Value *v, const Value *c, int *cmp);
+
+#define SEGMENT_NULL(seg, i) ((seg)->nulls && IS_NULL_BIT((seg)->nulls, i))
+
+static bool segment_word_matches(const ColumnVector *vec, const ColumnSegment *seg,
+                                 uint64_t word, OperatorType op, const Value *c) {
+    Value v = column_segment_value(vec, seg, word);
+    int cmp;
+    return typed_compare(&v, c, &cmp) && cmp_matches(cmp, op);
+}
+
+/* Rows of one sealed segment, compared without decoding them to values where the encoding
+   allows: a run is compared once, and packed INT, DATE and TIME rows compare their distance
+   from the segment base with the constant's. */
+static int filter_segment(const ColumnVector *vec, const ColumnSegment *seg, int first,
+                          OperatorType op, const Value *c, int *sel, int n) {
+    int m = 0;
+    if (seg->encoding == COLUMN_ENC_RLE) {
+        int run = -1;
+        bool run_keep = false;
+        for (int k = 0; k < n; k++) {
+            int r = sel[k];
+            int i = r - first;
+            if (run < 0 || i >= seg->run_ends[run] || (run > 0 && i < seg->run_ends[run - 1])) {
+                run = column_segment_run(seg, i);
+                run_keep = segment_word_matches(vec, seg, seg->words[run], op, c);
+            }
+            sel[m] = r;
+            m += run_keep && !SEGMENT_NULL(seg, i);
+        }
+        return m;
+    }
+
+    bool packed_int = vec->type == TYPE_INT && c->type == TYPE_INT;
+    if (packed_int || vec->type == TYPE_DATE || vec->type == TYPE_TIME) {
+        uint64_t target = packed_int                 ? (uint64_t)c->int_val
+                          : vec->type == TYPE_DATE ? c->date_val
+                                                   : c->time_val;
+        bool below = packed_int ? c->int_val < (long long)seg->base : target < seg->base;
+        uint64_t distance = target - seg->base;
+        for (int k = 0; k < n; k++) {
+            int r = sel[k];
+            int i = r - first;
+            uint64_t delta = column_segment_word(seg, i) - seg->base;
+            int cmp = below ? 1 : (delta < distance ? -1 : (delta > distance ? 1 : 0));
+            sel[m] = r;
+            m += !SEGMENT_NULL(seg, i) && cmp_matches(cmp, op);
+        }
+        return m;
+    }
+
+    for (int k = 0; k < n; k++) {
+        int r = sel[k];
+        int i = r - first;
+        sel[m] = r;
+        m += !SEGMENT_NULL(seg, i) &&
+             segment_word_matches(vec, seg, column_segment_word(seg, i), op, c);
+    }
+    return m;
+}
+
+/* Splits the batch into the pieces that fall in one sealed segment or in the tail. */
+static bool filter_vector(const ColumnVector *vec, OperatorType op, const Value *c, int *sel,
+                          int n, int *out_count) {
+    if (!vector_kernel_types(vec, c))
+        return false;
+    int m = 0;
+    int k = 0;
+    while (k < n) {
+        int segment = sel[k] < vec->sealed ? sel[k] / COLUMN_SEGMENT_ROWS : -1;
+        int end = k + 1;
+        while (end < n && (segment < 0 ? sel[end] >= vec->sealed
+                                       : sel[end] / COLUMN_SEGMENT_ROWS == segment &&
+                                             sel[end] < vec->sealed))
+            end++;
+        int kept = segment < 0 ? filter_tail(vec, op, c, sel + k, end - k)
+                               : filter_segment(vec, &vec->segments[segment],
+                                                segment * COLUMN_SEGMENT_ROWS, op, c, sel + k,
+                                                end - k);
+        memmove(sel + m, sel + k, sizeof(int) * (size_t)kept);
+        m += kept;
+        k = end;
+    }
+    *out_count = m;
+    return true;
+}
+
+/* TEXT rows against a string constant. A sorted dictionary turns the constant into the codes
+   [lo, hi) of the strings equal to it, and each row's code orders it against the constant. */
+static int filter_strings(const ColumnVector *vec, OperatorType op, const Value *c, int *sel,
+                          int n) {
+    const char *target = value_str(c);
+    int segment = -1;
+    uint32_t lo = 0;
+    uint32_t hi = 0;
+    int m = 0;
+    for (int k = 0; k < n; k++) {
+        int r = sel[k];
+        bool keep;
+        if (r >= vec->sealed) {
+            int i = r - vec->sealed;
+            keep = !IS_NULL_BIT(vec->nulls, i) &&
+                   cmp_matches(strcmp(vec->strings.heap + vec->strings.offsets[i], target), op);
+        } else {
+            const ColumnSegment *seg = &vec->segments[r / COLUMN_SEGMENT_ROWS];
+            int i = r % COLUMN_SEGMENT_ROWS;
+            if (segment != r / COLUMN_SEGMENT_ROWS && seg->dict_sorted) {
+                lo = column_segment_lower_bound(seg, target, false);
+                hi = column_segment_lower_bound(seg, target, true);
+            }
+            segment = r / COLUMN_SEGMENT_ROWS;
+            uint32_t code = (uint32_t)column_segment_word(seg, i);
+            if (SEGMENT_NULL(seg, i)) {
+                keep = false;
+            } else {
+                int cmp = seg->dict_sorted ? (code < lo ? -1 : (code >= hi ? 1 : 0))
+                                           : strcmp(column_segment_string(seg, code), target);
+                keep = cmp_matches(cmp, op);
+            }
+        }
+        sel[m] = r;
+        m += keep;
+    }
+    return m;
+}
+
+static bool typed_compare(const Value *v, const Value *c, int *cmp) {
+    if (v->type == TYPE_INT && c->type == TYPE_INT) {
+        *cmp = v->int_val < c->int_val ? -1 : (v->int_val > c->int_val ? 1 : 0);
+    } else if ((v->type == TYPE_INT || v->type == TYPE_FLOAT) &&
+               (c->type == TYPE_INT || c->type == TYPE_FLOAT)) {
+        double l = v->type == TYPE_INT ? (double)v->int_val : v->float_val;
+        double r = c->type == TYPE_INT ? (double)c->int_val : c->float_val;
+        *cmp = l < r ? -1 : (l > r ? 1 : 0);
+    } else if (v->type == TYPE_DATE && c->type == TYPE_DATE) {
+        *cmp = v->date_val < c->date_val ? -1 : (v->date_val > c->date_val ? 1 : 0);
+    } else if (v->type == TYPE_TIME && c->type == TYPE_TIME) {
+        *cmp = v->time_val < c->time_val ? -1 : (v->time_val > c->time_val ? 1 : 0);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static int filter_row_values(const Table *table, uint16_t column_id, OperatorType op,
+                             const Value *c, int *sel, int n) {
+    int m = 0;
+    for (int k = 0; k < n; k++) {
+        int r = sel[k];
+        Row *row = (Row *)alist_get(&table->rows, r);
+        Value *v = row ? (Value *)alist_get(row, column_id) : NULL;
+        bool keep;
+        int cmp;
+        if (!v || v->type == TYPE_NULL)
+            keep = false;
+        else if (typed_compare(v, c, &cmp))
+            keep = cmp_matches(cmp, op);
+        else
+            keep = eval_comparison(*v, *c, op);
+        sel[m] = r;
+        m += keep;
+    }
+    return m;
+}
+
+/* = and != on a DICTIONARY column: the constant is looked up once, then every row is a
+   pointer compare. A constant that was never interned matches no row. */
+static int filter_dictionary(const Table *table, uint16_t column_id, OperatorType op,
+                             const Value *c, int *sel, int n) {
+    Value key;
+    bool known = string_intern_find(value_str(c), &key);
+    int m = 0;
+    for (int k = 0; k < n; k++) {
+        int r = sel[k];
+        Row *row = (Row *)alist_get(&table->rows, r);
+        Value *v = row ? (Value *)alist_get(row, column_id) : NULL;
+        bool keep;
+        if (!v || v->type != TYPE_STRING)
+            keep = false;
+        else if (v->str_format == VALUE_STR_INTERNED)
+            keep = (known && v->char_val == key.char_val) == (op == OP_EQUALS);
+        else
+            keep = (strcmp(value_str(v), value_str(c)) == 0) == (op == OP_EQUALS);
+        sel[m] = r;
+        m += keep;
+    }
+    return m;
+}
+
+static bool filter_column_constant(const Table *table, const Expr *expr, int *sel, int n,
+                                   int *out_count) {
+    OperatorType op = expr->binary.op;
+    if (op != OP_EQUALS && op != OP_NOT_EQUALS && op != OP_LESS && op != OP_LESS_EQUAL &&
+        op != OP_GREATER && op != OP_GREATER_EQUAL)
+        return false;
+
+    const Expr *left = expr->binary.left;
+    const Expr *right = expr->binary.right;
+    const Expr *column;
+    const Value *constant;
+    if (left->type == EXPR_COLUMN && right->type == EXPR_VALUE) {
+        column = left;
+        constant = &right->value;
+    } else if (left->type == EXPR_VALUE && right->type == EXPR_COLUMN) {
+        column = right;
+        constant = &left->value;
+        op = flip_op(op);
+    } else {
+        return false;
+    }
+
+    uint16_t column_id = column->column.column_id;
+    if (column_id >= alist_length(&table->schema.columns))
+        return false;
+
+    const ColumnDef *col = (const ColumnDef *)alist_get(&table->schema.columns, column_id);
+    if (table->storage == STORAGE_ROW && (col->flags & COL_FLAG_DICTIONARY) &&
+        constant->type == TYPE_STRING && (op == OP_EQUALS || op == OP_NOT_EQUALS)) {
+        *out_count = filter_dictionary(table, column_id, op, constant, sel, n);
+        return true;
+    }
+    if (table->storage == STORAGE_COLUMNAR && constant->type == TYPE_STRING &&
+        table->vectors[column_id].type == TYPE_STRING) {
+        *out_count = filter_strings(&table->vectors[column_id], op, constant, sel, n);
+        return true;
+    }
+    if (!is_kernel_constant(constant))
+        return false;
+
+    if (table->storage == STORAGE_COLUMNAR)
+        return filter_vector(&table->vectors[column_id], op, constant, sel, n, out_count);
+
+    *out_count = filter_row_values(table, column_id, op, constant, sel, n);
+    return true;
+}
+
+/* column IN (...) and column LIKE 'pattern' read the column in place: the row's Value, or the
+   string heap and int vector of a columnar table, without assembling the row. */
+static bool filter_column_match(const Table *table, const Expr *expr, int *sel, int n,
+                                int *out_count) {
+    const Expr *left = expr->binary.left;
+    if (!expr_is_match(expr) || left->type != EXPR_COLUMN ||
+        left->column.column_id >= alist_length(&table->schema.columns))
+        return false;
+    uint16_t column_id = left->column.column_id;
+    OperatorType op = expr->binary.op;
+    int m = 0;
+
+    if (table->storage == STORAGE_ROW) {
+        for (int k = 0; k < n; k++) {
+            int r = sel[k];
+            Row *row = (Row *)alist_get(&table->rows, r);
+            Value *v = row ? (Value *)alist_get(row, column_id) : NULL;
+            sel[m] = r;
+            m += v && eval_match_value(expr, v);
+        }
+        *out_count = m;
+        return true;
+    }
+
+    const ColumnVector *vec = &table->vectors[column_id];
+    const LikeMatcher *like = expr->binary.like;
+    if (vec->type == TYPE_STRING && like) {
+        /* A sealed segment matches each dictionary string once. */
+        bool negated = op == OP_NOT_LIKE;
+        int8_t matches[COLUMN_SEGMENT_ROWS];
+        int segment = -1;
+        for (int k = 0; k < n; k++) {
+            int r = sel[k];
+            bool keep;
+            if (r >= vec->sealed) {
+                int i = r - vec->sealed;
+                const char *text = vec->strings.heap + vec->strings.offsets[i];
+                keep = !IS_NULL_BIT(vec->nulls, i) &&
+                       like_match(like, text, strlen(text)) != negated;
+            } else {
+                const ColumnSegment *seg = &vec->segments[r / COLUMN_SEGMENT_ROWS];
+                int i = r % COLUMN_SEGMENT_ROWS;
+                if (segment != r / COLUMN_SEGMENT_ROWS) {
+                    segment = r / COLUMN_SEGMENT_ROWS;
+                    memset(matches, -1, sizeof(matches));
+                }
+                uint32_t code = (uint32_t)column_segment_word(seg, i);
+                if (SEGMENT_NULL(seg, i)) {
+                    keep = false;
+                } else if (code >= COLUMN_SEGMENT_ROWS || matches[code] < 0) {
+                    const char *text = column_segment_string(seg, code);
+                    bool match = like_match(like, text, strlen(text)) != negated;
+                    if (code < COLUMN_SEGMENT_ROWS)
+                        matches[code] = match;
+                    keep = match;
+                } else {
+                    keep = matches[code];
+                }
+            }
+            sel[m] = r;
+            m += keep;
+        }
+    } else if (vec->type == TYPE_INT && !like) {
+        for (int k = 0; k < n; k++) {
+            int r = sel[k];
+            Value probe = column_store_get_value(table, r, column_id);
+            sel[m] = r;
+            m += !is_null(&probe) && eval_match_value(expr, &probe);
+        }
+    } else {
+        return false;
+    }
+    *out_count = m;
+    return true;
+}
+
+static int filter_generic(const Table *table, const Expr *expr, int *sel, int n, Row *scratch) {
+    int m = 0;
+    for (int k = 0; k < n; k++) {
+        const Row *row = table_fetch_row(table, sel[k], scratch);
+        if (row && eval_expression(expr, row, &table->schema))
+            sel[m++] = sel[k];
+    }
+    return m;
+}
+
+/* Writes the rows of all[0..n) that are not in subset[0..m) (both ascending) to out. */
+static int sel_difference(const int *all, int n, const int *subset, int m, int *out) {
+    int j = 0;
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        while (j < m && subset[j] < all[i])
+            j++;
+        if (j < m && subset[j] == all[i])
+            continue;
+        out[count++] = all[i];
+    }
+    return count;
+}
+
+static int sel_union(const int *a, int na, const int *b, int nb, int *out) {
+    int i = 0;
+    int j = 0;
+    int count = 0;
+    while (i < na && j < nb)
+        out[count++] = a[i] < b[j] ? a[i++] : b[j++];
+    while (i < na)
+        out[count++] = a[i++];
+    while (j < nb)
+        out[count++] = b[j++];
+    return count;
+}
+
+static bool comparison_operands(const Expr *expr, uint16_t *column_id, const Value **constant,
+                                OperatorType *op);
+
+/* Keeps the rows of sel for which expr is FALSE, not TRUE or UNKNOWN, so NOT (v = 5) leaves
+   out the rows where v is NULL. AND and OR follow De Morgan; a comparison's FALSE rows are
+   those it does not match less those with a NULL operand. */
+static int filter_batch_false(const Table *table, const Expr *expr, int *sel, int n,
+                              Row *scratch) {
+    if (!expr || n == 0)
+        return 0;
+    if (expr->type == EXPR_UNARY_OP && expr->unary.op == OP_NOT)
+        return filter_batch(table, expr->unary.operand, sel, n, scratch);
+    if (expr->type == EXPR_BINARY_OP && expr->binary.op == OP_OR) {
+        n = filter_batch_false(table, expr->binary.left, sel, n, scratch);
+        return filter_batch_false(table, expr->binary.right, sel, n, scratch);
+    }
+    if (expr->type == EXPR_BINARY_OP && expr->binary.op == OP_AND) {
+        int left_sel[FILTER_BATCH_SIZE];
+        int rest[FILTER_BATCH_SIZE];
+        memcpy(left_sel, sel, sizeof(int) * n);
+        int left_count = filter_batch_false(table, expr->binary.left, left_sel, n, scratch);
+        int rest_count = sel_difference(sel, n, left_sel, left_count, rest);
+        rest_count = filter_batch_false(table, expr->binary.right, rest, rest_count, scratch);
+        return sel_union(left_sel, left_count, rest, rest_count, sel);
+    }
+
+    /* A comparison against a constant is FALSE where it does not match and the column is not
+       NULL; anything else decides each row once, so subqueries are not probed twice. */
+    uint16_t column_id;
+    const Value *constant;
+    OperatorType op;
+    int m = 0;
+    if (comparison_operands(expr, &column_id, &constant, &op)) {
+        int matched[FILTER_BATCH_SIZE];
+        int count;
+        memcpy(matched, sel, sizeof(int) * n);
+        if (filter_column_constant(table, expr, matched, n, &count)) {
+            n = sel_difference(sel, n, matched, count, sel);
+            for (int k = 0; k < n; k++) {
+                Value val = table_get_value(table, sel[k], column_id);
+                sel[m] = sel[k];
+                m += !is_null(&val);
+            }
+            return m;
+        }
+    }
+    for (int k = 0; k < n; k++) {
+        const Row *row = table_fetch_row(table, sel[k], scratch);
+        if (row && eval_expression_false(expr, row, &table->schema))
+            sel[m++] = sel[k];
+    }
+    return m;
+}
+
+int filter_batch(const Table *table, const Expr *expr, int *sel, int n, Row *scratch) {
+    if (!expr || n == 0)
+        return n;
+
+    if (expr->type == EXPR_BINARY_OP) {
+        int count;
+        switch (expr->binary.op) {
+        case OP_AND:
+            n = filter_batch(table, expr->binary.left, sel, n, scratch);
+            return filter_batch(table, expr->binary.right, sel, n, scratch);
+        case OP_OR: {
+            int left_sel[FILTER_BATCH_SIZE];
+            int rest[FILTER_BATCH_SIZE];
+            memcpy(left_sel, sel, sizeof(int) * n);
+            int left_count = filter_batch(table, expr->binary.left, left_sel, n, scratch);
+            int rest_count = sel_difference(sel, n, left_sel, left_count, rest);
+            rest_count = filter_batch(table, expr->binary.right, rest, rest_count, scratch);
+            return sel_union(left_sel, left_count, rest, rest_count, sel);
+        }
+        default:
+            if (filter_column_constant(table, expr, sel, n, &count) ||
+                filter_column_match(table, expr, sel, n, &count))
+                return count;
+            break;
+        }
+    } else if (expr->type == EXPR_UNARY_OP && expr->unary.op == OP_NOT) {
+        return filter_batch_false(table, expr->unary.operand, sel, n, scratch);
+    }
+
+    return filter_generic(table, expr, sel, n, scratch);
+}
+
+/* Zone map pruning. Only trees of AND and OR over column <op> constant comparisons can rule
+   a block out; anything else may match any block. */
+static bool comparison_operands(const Expr *expr, uint16_t *column_id, const Value **constant,
+                                OperatorType *op) {
+    if (expr->type != EXPR_BINARY_OP)
+        return false;
+    *op = expr->binary.op;
+    if (*op != OP_EQUALS && *op != OP_NOT_EQUALS && *op != OP_LESS && *op != OP_LESS_EQUAL &&
+        *op != OP_GREATER && *op != OP_GREATER_EQUAL)
+        return false;
+    const Expr *left = expr->binary.left;
+    const Expr *right = expr->binary.right;
+    if (left->type == EXPR_COLUMN && right->type == EXPR_VALUE) {
+        *column_id = left->column.column_id;
+        *constant = &right->value;
+    } else if (left->type == EXPR_VALUE && right->type == EXPR_COLUMN) {
+        *column_id = right->column.column_id;
+        *constant = &left->value;
+        *op = flip_op(*op);
+    } else {
+        return false;
+    }
+    return is_kernel_constant(*constant);
+}
+
+static bool expr_prunable(const Expr *expr) {
+    uint16_t column_id;
+    const Value *constant;
+    OperatorType op;
+    if (!expr || expr->type != EXPR_BINARY_OP)
+        return false;
+    if (expr->binary.op == OP_AND)
+        return expr_prunable(expr->binary.left) || expr_prunable(expr->binary.right);
+    if (expr->binary.op == OP_OR)
+        return expr_prunable(expr->binary.left) && expr_prunable(expr->binary.right);
+    return comparison_operands(expr, &column_id, &constant, &op);
+}
+
+/* The zone map of a table for scans filtered by where, or NULL when where cannot skip blocks
+   or the table is too small for skipping to pay for the map. */
+const ZoneMap *filter_zone_map(const Table *table, const Expr *where) {
+    if (!table || !expr_prunable(where) || table_row_count(table) < 2 * ZONE_MAP_ROWS)
+        return NULL;
+    return zone_map_get(table);
+}
+
+static bool zone_may_match(const ColumnZone *zone, int rows, OperatorType op, const Value *c) {
+    if ((int)zone->null_count >= rows)
+        return false;
+    int lo, hi;
+    if (!zone->ranged || !typed_compare(&zone->min, c, &lo) || !typed_compare(&zone->max, c, &hi))
+        return true;
+    switch (op) {
+    case OP_EQUALS:
+        return lo <= 0 && hi >= 0;
+    case OP_NOT_EQUALS:
+        return lo != 0 || hi != 0;
+    case OP_LESS:
+        return lo < 0;
+    case OP_LESS_EQUAL:
+        return lo <= 0;
+    case OP_GREATER:
+        return hi > 0;
+    case OP_GREATER_EQUAL:
+        return hi >= 0;
+    default:
+        return true;
+    }
+}
+
+/* False only when no row of the block can satisfy expr. */
+bool filter_block_may_match(const ZoneMap *zones, const Expr *expr, int block) {
+    if (!zones || !expr || expr->type != EXPR_BINARY_OP)
+        return true;
+    if (expr->binary.op == OP_AND)
+        return filter_block_may_match(zones, expr->binary.left, block) &&
+               filter_block_may_match(zones, expr->binary.right, block);
+    if (expr->binary.op == OP_OR)
+        return filter_block_may_match(zones, expr->binary.left, block) ||
+               filter_block_may_match(zones, expr->binary.right, block);
+
+    uint16_t column_id;
+    const Value *constant;
+    OperatorType op;
+    if (!comparison_operands(expr, &column_id, &constant, &op))
+        return true;
+    const ColumnZone *zone = zone_map_column(zones, block, column_id);
+    return !zone || zone_may_match(zone, zone_map_block_rows(zones, block), op, constant);
+}
+
+void filter_cursor_init(FilterCursor *cursor, const Table *table, const Expr *where) {
+    cursor->table = table;
+    cursor->where = where;
+    cursor->next_row = 0;
+    cursor->count = 0;
+    alist_init(&cursor->scratch, sizeof(Value), NULL);
+    alist_init(&cursor->candidates, sizeof(int), NULL);
+
+    cursor->use_index = false;
+    if (where) {
+        PlanNode *plan = optimize_select(table->table_id, where);
+        cursor->use_index = exec_plan_rows(plan, &cursor->candidates);
+        free_plan(plan);
+    }
+    cursor->row_count =
+        cursor->use_index ? alist_length(&cursor->candidates) : table_row_count(table);
+    cursor->zones = cursor->use_index ? NULL : filter_zone_map(table, where);
+}
+
+bool filter_cursor_next(FilterCursor *cursor) {
+    while (cursor->next_row < cursor->row_count) {
+        if (cursor->zones && cursor->next_row % ZONE_MAP_ROWS == 0) {
+            bool may_match = filter_block_may_match(cursor->zones, cursor->where,
+                                                    cursor->next_row / ZONE_MAP_ROWS);
+            zone_map_count_blocks(1, may_match ? 0 : 1);
+            if (!may_match) {
+                cursor->next_row += ZONE_MAP_ROWS;
+                continue;
+            }
+        }
+        int n = cursor->row_count - cursor->next_row;
+        if (n > FILTER_BATCH_SIZE)
+            n = FILTER_BATCH_SIZE;
+        if (cursor->use_index) {
+            memcopy(cursor->sel, (int *)cursor->candidates.data + cursor->next_row,
+                    sizeof(int) * (size_t)n);
+        } else {
+            for (int k = 0; k < n; k++)
+                cursor->sel[k] = cursor->next_row + k;
+            metrics_add(METRIC_ROWS_SCANNED, (uint64_t)n);
+        }
+        cursor->next_row += n;
+        n = table_visible_rows(cursor->table, cursor->sel, n);
+
+        cursor->count = filter_batch(cursor->table, cursor->where, cursor->sel, n,
+                                     &cursor->scratch);
+        if (cursor->count > 0)
+            return true;
+    }
+    cursor->count = 0;
+    return false;
+}
+
+void filter_cursor_close(FilterCursor *cursor) {
+    alist_destroy(&cursor->scratch);
+    alist_destroy(&cursor->candidates);
+}
+
+void filter_table_rows(const Table *table, const Expr *where, ArrayList *out) {
+    FilterCursor cursor;
+    filter_cursor_init(&cursor, table, where);
+    while (filter_cursor_next(&cursor)) {
+        for (int k = 0; k < cursor.count; k++) {
+            int *slot = (int *)alist_append(out);
+            if (slot)
+                *slot = cursor.sel[k];
+        }
+    }
+    filter_cursor_close(&cursor);
+}
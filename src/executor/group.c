@@ -0,0 +1,1082 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "sketch.h"
+#include "table.h"
+#include "utils.h"
+#include "values.h"
+
+/* Hash aggregation. A group is one fixed-size record in a flat array: a header, the group's
+   key values, then one AggSlot per aggregate or carried expression, so folding a row touches
+   a single record. An open-addressing slot array maps key hashes to records and grows at half
+   load. DISTINCT aggregates record each (group, slot, value) once in a second open-addressing
+   set shared by all groups. Over a parallel scan every worker folds its morsels into a
+   partial table of its own and the partials are merged into the first when the input ends;
+   groups remember their first row so the merged output keeps the serial order. HAVING, the
+   SELECT list and ORDER BY are then evaluated once per group.
+
+   A table that outgrows its share of work_mem stops adding groups: rows of the groups it
+   holds still fold in, the others are written with their input position to SPILL_FANOUT
+   temporary files on the top bits of their key hashes. Each partition is then aggregated on
+   its own, starting from the groups of the table that fall in it, and may spill again on the
+   next bits; the finished groups are put back in input order before ORDER BY. */
+#define GROUP_MIN_SLOTS 64
+
+typedef enum {
+    SLOT_FIRST,    /* a non-aggregate expression: its value on the group's first row */
+    SLOT_AGGREGATE /* an aggregate function */
+} SlotKind;
+
+typedef struct {
+    const Expr *expr;
+    SlotKind kind;
+} SlotDef;
+
+typedef struct {
+    long long non_null;
+    NumericAgg numeric;
+    Value value; /* SLOT_FIRST's value, or the MIN/MAX of non-numeric input */
+    bool has_value;
+    Sketch *sketch; /* of an approximate aggregate, once it has a value */
+} AggSlot;
+
+typedef struct {
+    uint64_t hash;
+    long long rows;
+    int64_t first; /* position of the group's first input row */
+} GroupHeader;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t group;
+    uint32_t slot;
+    Value value;
+} DistinctEntry;
+
+typedef struct {
+    DistinctEntry *entries;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *slots; /* entry index + 1, 0 when empty */
+    uint32_t mask;
+} DistinctSet;
+
+typedef struct {
+    uint8_t *groups; /* count records of the state's stride bytes */
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *slots; /* group index + 1, 0 when empty */
+    uint32_t mask;
+    DistinctSet distinct;
+} GroupTable;
+
+/* One worker's partial groups and the key row it folds with. */
+typedef struct {
+    GroupTable table;
+    Value *keys; /* the row being folded, borrowed from the tables */
+    long long rows;
+    bool failed;
+    int share;        /* of work_mem: 1 / share */
+    int level;        /* of the partitions it spills to */
+    int width;        /* row ids per spilled row */
+    SpillFile *spill; /* SPILL_FANOUT files once the table is full */
+    size_t charged;   /* table, against the statement's memory */
+} GroupPartial;
+
+typedef struct {
+    RowBatch input;
+    const HashAggregatePlan *plan;
+    const TableDef *schema; /* of the input, for the aggregates' result types */
+    int key_count;
+    uint16_t *key_columns;
+    SlotDef *slots;
+    int slot_count;
+    int out_count;
+    int order_count;
+    size_t slot_offset;
+    size_t stride;
+    GroupPartial partials[MAX_PARALLEL_WORKERS];
+    int partial_count;
+    ParallelScan *parallel;
+    Value *rows; /* per output row: out_count values, then order_count sort keys */
+    int64_t *firsts; /* per output row: its group's first input position */
+    int *order;
+    int row_count;
+    int row_cap;
+    int spill_width; /* row ids per spilled row */
+    int next;
+    bool spilled;
+    bool done;
+    bool failed;
+} HashAggState;
+
+static HashAggStats g_hash_agg_stats;
+
+void hash_agg_get_stats(HashAggStats *stats) {
+    *stats = g_hash_agg_stats;
+}
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t hash_keys(const Value *keys, int count) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < count; i++)
+        hash = mix64(hash ^ value_hash(&keys[i]));
+    return hash;
+}
+
+static Value null_value(void) {
+    Value val = {0};
+    val.type = TYPE_NULL;
+    return val;
+}
+
+/* Slots. */
+
+static int key_index(const HashAggState *state, const Expr *expr) {
+    if (expr->type != EXPR_COLUMN)
+        return -1;
+    for (int i = 0; i < state->key_count; i++)
+        if (state->key_columns[i] == expr->column.column_id)
+            return i;
+    return -1;
+}
+
+static int find_slot(const HashAggState *state, const Expr *expr) {
+    for (int i = 0; i < state->slot_count; i++) {
+        const Expr *slot = state->slots[i].expr;
+        if (slot == expr)
+            return i;
+        if (expr->type == EXPR_COLUMN && slot->type == EXPR_COLUMN &&
+            slot->column.column_id == expr->column.column_id)
+            return i;
+    }
+    return -1;
+}
+
+static int count_nodes(const Expr *expr) {
+    if (!expr)
+        return 0;
+    switch (expr->type) {
+    case EXPR_BINARY_OP:
+        return 1 + count_nodes(expr->binary.left) + count_nodes(expr->binary.right);
+    case EXPR_UNARY_OP:
+        return 1 + count_nodes(expr->unary.operand);
+    default:
+        return 1;
+    }
+}
+
+/* Gives every aggregate its own slot and every column that is not a group key a SLOT_FIRST;
+   other expressions without a slot of their own are taken from the group's first row. */
+static void collect_slots(HashAggState *state, const Expr *expr) {
+    if (!expr)
+        return;
+    switch (expr->type) {
+    case EXPR_VALUE:
+        return;
+    case EXPR_BINARY_OP:
+        collect_slots(state, expr->binary.left);
+        collect_slots(state, expr->binary.right);
+        return;
+    case EXPR_UNARY_OP:
+        collect_slots(state, expr->unary.operand);
+        return;
+    default:
+        break;
+    }
+    if (key_index(state, expr) >= 0 || find_slot(state, expr) >= 0)
+        return;
+    SlotDef *def = &state->slots[state->slot_count++];
+    def->expr = expr;
+    def->kind = expr->type == EXPR_AGGREGATE_FUNC ? SLOT_AGGREGATE : SLOT_FIRST;
+}
+
+static GroupHeader *group_header(const HashAggState *state, const GroupTable *table, uint32_t g) {
+    return (GroupHeader *)(table->groups + (size_t)g * state->stride);
+}
+
+static Value *group_keys(GroupHeader *header) {
+    return (Value *)(header + 1);
+}
+
+static AggSlot *group_slots(const HashAggState *state, GroupHeader *header) {
+    return (AggSlot *)((uint8_t *)header + state->slot_offset);
+}
+
+/* Group table. */
+
+static bool group_table_init(GroupTable *table) {
+    memclear(table, sizeof(GroupTable));
+    table->slots = calloc(GROUP_MIN_SLOTS, sizeof(uint32_t));
+    table->mask = GROUP_MIN_SLOTS - 1;
+    table->distinct.slots = calloc(GROUP_MIN_SLOTS, sizeof(uint32_t));
+    table->distinct.mask = GROUP_MIN_SLOTS - 1;
+    return table->slots && table->distinct.slots;
+}
+
+static void group_table_free(const HashAggState *state, GroupTable *table) {
+    for (uint32_t g = 0; g < table->count; g++) {
+        GroupHeader *header = group_header(state, table, g);
+        Value *keys = group_keys(header);
+        for (int i = 0; i < state->key_count; i++)
+            free_value(&keys[i]);
+        AggSlot *slots = group_slots(state, header);
+        for (int s = 0; s < state->slot_count; s++) {
+            if (slots[s].has_value)
+                free_value(&slots[s].value);
+            sketch_free(slots[s].sketch);
+        }
+    }
+    for (uint32_t e = 0; e < table->distinct.count; e++)
+        free_value(&table->distinct.entries[e].value);
+    free(table->groups);
+    free(table->slots);
+    free(table->distinct.entries);
+    free(table->distinct.slots);
+    memclear(table, sizeof(GroupTable));
+}
+
+static bool rehash(uint32_t **slots, uint32_t *mask, uint32_t count, const void *items,
+                   size_t item_size) {
+    uint32_t cap = (*mask + 1) * 2;
+    uint32_t *fresh = calloc(cap, sizeof(uint32_t));
+    if (!fresh)
+        return false;
+    for (uint32_t i = 0; i < count; i++) {
+        /* Groups and distinct entries both start with their hash. */
+        uint64_t hash = *(const uint64_t *)((const uint8_t *)items + (size_t)i * item_size);
+        uint32_t idx = (uint32_t)hash & (cap - 1);
+        while (fresh[idx])
+            idx = (idx + 1) & (cap - 1);
+        fresh[idx] = i + 1;
+    }
+    free(*slots);
+    *slots = fresh;
+    *mask = cap - 1;
+    return true;
+}
+
+static bool keys_equal(const Value *a, const Value *b, int count) {
+    for (int i = 0; i < count; i++)
+        if (!value_equals(&a[i], &b[i]))
+            return false;
+    return true;
+}
+
+static size_t group_table_bytes(const HashAggState *state, const GroupTable *table) {
+    return (size_t)table->cap * state->stride + ((size_t)table->mask + 1) * sizeof(uint32_t) +
+           (size_t)table->distinct.cap * sizeof(DistinctEntry) +
+           ((size_t)table->distinct.mask + 1) * sizeof(uint32_t);
+}
+
+/* The group for keys, -1 when the table does not hold it. */
+static int64_t lookup_group(const HashAggState *state, const GroupTable *table,
+                            const Value *keys, uint64_t hash) {
+    uint32_t idx = (uint32_t)hash & table->mask;
+    while (table->slots[idx]) {
+        uint32_t g = table->slots[idx] - 1;
+        GroupHeader *header = group_header(state, table, g);
+        if (header->hash == hash && keys_equal(group_keys(header), keys, state->key_count))
+            return g;
+        idx = (idx + 1) & table->mask;
+    }
+    return -1;
+}
+
+/* Returns the group for keys, adding it when new: copied from borrowed keys, or moved out of
+   keys when take is set. -1 when out of memory. */
+static int64_t find_group(const HashAggState *state, GroupTable *table, Value *keys,
+                          uint64_t hash, bool take) {
+    uint32_t idx = (uint32_t)hash & table->mask;
+    while (table->slots[idx]) {
+        uint32_t g = table->slots[idx] - 1;
+        GroupHeader *header = group_header(state, table, g);
+        if (header->hash == hash && keys_equal(group_keys(header), keys, state->key_count))
+            return g;
+        idx = (idx + 1) & table->mask;
+    }
+
+    if (table->count == table->cap) {
+        uint32_t cap = table->cap > 0 ? table->cap * 2 : GROUP_MIN_SLOTS;
+        uint8_t *groups = realloc(table->groups, (size_t)cap * state->stride);
+        if (!groups)
+            return -1;
+        table->groups = groups;
+        table->cap = cap;
+    }
+    uint32_t g = table->count++;
+    GroupHeader *header = group_header(state, table, g);
+    memclear(header, state->stride);
+    header->hash = hash;
+    Value *group = group_keys(header);
+    for (int i = 0; i < state->key_count; i++) {
+        group[i] = take ? keys[i] : copy_value(&keys[i]);
+        if (take)
+            keys[i] = null_value();
+    }
+    AggSlot *slots = group_slots(state, header);
+    for (int s = 0; s < state->slot_count; s++)
+        numeric_agg_init(&slots[s].numeric);
+    table->slots[idx] = g + 1;
+
+    if ((uint64_t)table->count * 2 > table->mask &&
+        !rehash(&table->slots, &table->mask, table->count, table->groups, state->stride))
+        return -1;
+    return g;
+}
+
+/* Adds value to the set of slot's values in group unless already there; the set keeps value
+   when it is added. Returns false when out of memory. */
+static bool distinct_insert(DistinctSet *set, uint32_t group, uint32_t slot, const Value *value,
+                            bool *inserted) {
+    uint64_t hash = mix64(value_hash(value) + (((uint64_t)group << 16) | slot));
+    uint32_t idx = (uint32_t)hash & set->mask;
+    while (set->slots[idx]) {
+        const DistinctEntry *entry = &set->entries[set->slots[idx] - 1];
+        if (entry->hash == hash && entry->group == group && entry->slot == slot &&
+            value_equals(&entry->value, value)) {
+            *inserted = false;
+            return true;
+        }
+        idx = (idx + 1) & set->mask;
+    }
+
+    if (set->count == set->cap) {
+        uint32_t cap = set->cap > 0 ? set->cap * 2 : GROUP_MIN_SLOTS;
+        DistinctEntry *entries = realloc(set->entries, (size_t)cap * sizeof(DistinctEntry));
+        if (!entries)
+            return false;
+        set->entries = entries;
+        set->cap = cap;
+    }
+    DistinctEntry *entry = &set->entries[set->count];
+    entry->hash = hash;
+    entry->group = group;
+    entry->slot = slot;
+    entry->value = *value;
+    set->slots[idx] = ++set->count;
+    *inserted = true;
+
+    if ((uint64_t)set->count * 2 > set->mask &&
+        !rehash(&set->slots, &set->mask, set->count, set->entries, sizeof(DistinctEntry)))
+        return false;
+    return true;
+}
+
+/* Folding. */
+
+/* MIN and MAX keep non-numeric input (strings, dates) as a value; numbers use NumericAgg. */
+void keep_extreme(AggFuncType func, Value *kept, bool *has_kept, const Value *value) {
+    if (func != FUNC_MIN && func != FUNC_MAX)
+        return;
+    int cmp = *has_kept ? compare_values(value, kept) : 0;
+    if (*has_kept && (func == FUNC_MIN ? cmp >= 0 : cmp <= 0))
+        return;
+    if (*has_kept)
+        free_value(kept);
+    *kept = copy_value(value);
+    *has_kept = true;
+}
+
+/* False when out of memory for a sketch. */
+static bool slot_add(const Expr *expr, AggSlot *slot, const Value *value) {
+    AggFuncType func = expr->aggregate.func_type;
+    slot->non_null++;
+    if (func == FUNC_COUNT)
+        return true;
+    if (sketch_function(func))
+        return (slot->sketch || (slot->sketch = sketch_create(func))) &&
+               sketch_add(slot->sketch, value);
+    if (value->type == TYPE_INT)
+        numeric_agg_add_int(&slot->numeric, value->int_val);
+    else if (value->type == TYPE_FLOAT)
+        numeric_agg_add(&slot->numeric, value->float_val);
+    else
+        keep_extreme(func, &slot->value, &slot->has_value, value);
+    return true;
+}
+
+static Value eval_row(ExecContext *ctx, const RowBatch *batch, int k, const Expr *expr) {
+    if (expr->type == EXPR_COLUMN) {
+        Value val = context_value(ctx, batch, k, expr->column.column_id);
+        return copy_value(&val);
+    }
+    const Row *row = context_row(ctx, batch, k);
+    return row ? eval_select_expression((Expr *)expr, row, ctx->schema) : null_value();
+}
+
+/* earlier: the row comes before every row the group has seen. */
+static void fold_slot(const HashAggState *state, ExecContext *ctx, const RowBatch *batch, int k,
+                      GroupPartial *partial, uint32_t g, int s, AggSlot *slot, bool earlier) {
+    const Expr *expr = state->slots[s].expr;
+    if (state->slots[s].kind == SLOT_FIRST) {
+        if (earlier) {
+            if (slot->has_value)
+                free_value(&slot->value);
+            slot->value = eval_row(ctx, batch, k, expr);
+            slot->has_value = true;
+        }
+        return;
+    }
+
+    const Expr *operand = expr->aggregate.operand;
+    if (expr->aggregate.count_all || !operand)
+        return;
+    Value val = eval_row(ctx, batch, k, operand);
+    if (is_null(&val))
+        return;
+    bool inserted = false;
+    if (expr->aggregate.distinct) {
+        if (!distinct_insert(&partial->table.distinct, g, (uint32_t)s, &val, &inserted)) {
+            partial->failed = true;
+            free_value(&val);
+            return;
+        }
+        if (!inserted) {
+            free_value(&val);
+            return;
+        }
+    }
+    if (!slot_add(expr, slot, &val))
+        partial->failed = true;
+    if (!inserted)
+        free_value(&val);
+}
+
+static bool spill_row(GroupPartial *partial, const RowBatch *batch, int k, int64_t pos,
+                      uint64_t hash) {
+    SpillFile *file = &partial->spill[spill_partition(hash, partial->level)];
+    int ids[MAX_JOIN_TABLES];
+    for (int t = 0; t < batch->width; t++)
+        ids[t] = batch->ids[t][k];
+    partial->width = batch->width;
+    file->records++;
+    return spill_write(file, &pos, sizeof(pos)) &&
+           spill_write(file, ids, sizeof(int) * (size_t)batch->width);
+}
+
+/* Rows of table-ordered batches are placed by their row id, others by arrival, unless
+   positions gives them (rows read back from a spill). A worker may steal an earlier morsel
+   after a later one, so a group's first row is the lowest seen. */
+static void fold_batch(const HashAggState *state, ExecContext *ctx, const RowBatch *batch,
+                       GroupPartial *partial, const int64_t *positions) {
+    bool by_id = batch->width == 1 && batch->ascending;
+    Value *keys = partial->keys;
+    for (int k = 0; k < batch->count && !partial->failed; k++) {
+        for (int i = 0; i < state->key_count; i++) {
+            keys[i] = context_value(ctx, batch, k, state->key_columns[i]);
+            if (is_null(&keys[i]))
+                keys[i] = null_value();
+        }
+        uint64_t hash = hash_keys(keys, state->key_count);
+        int64_t pos = positions ? positions[k] : by_id ? batch->ids[0][k] : partial->rows + k;
+        int64_t g = partial->spill ? lookup_group(state, &partial->table, keys, hash) : -1;
+        if (g < 0 && partial->spill) {
+            if (!spill_row(partial, batch, k, pos, hash))
+                partial->failed = true;
+            continue;
+        }
+        if (g < 0)
+            g = find_group(state, &partial->table, keys, hash, false);
+        if (g < 0) {
+            partial->failed = true;
+            return;
+        }
+        GroupHeader *header = group_header(state, &partial->table, (uint32_t)g);
+        bool earlier = header->rows++ == 0 || pos < header->first;
+        if (earlier)
+            header->first = pos;
+        AggSlot *slots = group_slots(state, header);
+        for (int s = 0; s < state->slot_count; s++)
+            fold_slot(state, ctx, batch, k, partial, (uint32_t)g, s, &slots[s], earlier);
+    }
+    partial->rows += batch->count;
+
+    size_t bytes = group_table_bytes(state, &partial->table);
+    memory_track(ctx->memory, &partial->charged, bytes);
+    if (!partial->spill && partial->level < SPILL_MAX_LEVELS &&
+        exec_memory_exceeded(ctx, bytes, partial->share)) {
+        partial->spill = calloc(SPILL_FANOUT, sizeof(SpillFile));
+        if (!partial->spill)
+            partial->failed = true;
+    }
+}
+
+static void fold_morsel_batch(void *arg, int worker, int morsel, ExecContext *ctx,
+                              const RowBatch *batch) {
+    HashAggState *state = arg;
+    (void)morsel;
+    fold_batch(state, ctx, batch, &state->partials[worker], NULL);
+}
+
+/* Merging partials. */
+
+/* earlier: src's group saw its first row before dst's did. False when out of memory. */
+static bool merge_slot(const SlotDef *def, AggSlot *dst, AggSlot *src, bool earlier) {
+    if (def->kind == SLOT_FIRST) {
+        if (src->has_value && (earlier || !dst->has_value)) {
+            if (dst->has_value)
+                free_value(&dst->value);
+            dst->value = src->value;
+            dst->has_value = true;
+            src->has_value = false;
+        }
+        return true;
+    }
+    /* DISTINCT slots are rebuilt from the merged value sets. */
+    if (def->expr->aggregate.distinct)
+        return true;
+    dst->non_null += src->non_null;
+    numeric_agg_merge(&dst->numeric, &src->numeric);
+    if (src->has_value)
+        keep_extreme(def->expr->aggregate.func_type, &dst->value, &dst->has_value, &src->value);
+    if (src->sketch && !dst->sketch) {
+        dst->sketch = src->sketch;
+        src->sketch = NULL;
+    } else if (src->sketch) {
+        return sketch_merge(dst->sketch, src->sketch);
+    }
+    return true;
+}
+
+/* Moves the groups of src into dst, only those of partition part at level when part >= 0. */
+static bool merge_partial(HashAggState *state, GroupTable *dst, GroupTable *src, int level,
+                          int part) {
+    uint32_t *map = malloc(((size_t)src->count + 1) * sizeof(uint32_t));
+    if (!map)
+        return false;
+    for (uint32_t g = 0; g < src->count; g++) {
+        GroupHeader *from = group_header(state, src, g);
+        map[g] = UINT32_MAX;
+        if (part >= 0 && spill_partition(from->hash, level) != part)
+            continue;
+        int64_t d = find_group(state, dst, group_keys(from), from->hash, true);
+        if (d < 0) {
+            free(map);
+            return false;
+        }
+        map[g] = (uint32_t)d;
+        GroupHeader *to = group_header(state, dst, (uint32_t)d);
+        bool earlier = to->rows == 0 || from->first < to->first;
+        if (earlier)
+            to->first = from->first;
+        to->rows += from->rows;
+        AggSlot *dst_slots = group_slots(state, to);
+        AggSlot *src_slots = group_slots(state, from);
+        for (int s = 0; s < state->slot_count; s++) {
+            if (!merge_slot(&state->slots[s], &dst_slots[s], &src_slots[s], earlier)) {
+                free(map);
+                return false;
+            }
+        }
+    }
+
+    for (uint32_t e = 0; e < src->distinct.count; e++) {
+        DistinctEntry *entry = &src->distinct.entries[e];
+        uint32_t g = map[entry->group];
+        if (g == UINT32_MAX)
+            continue;
+        bool inserted;
+        if (!distinct_insert(&dst->distinct, g, entry->slot, &entry->value, &inserted)) {
+            free(map);
+            return false;
+        }
+        if (!inserted)
+            continue;
+        AggSlot *slot = &group_slots(state, group_header(state, dst, g))[entry->slot];
+        bool added = slot_add(state->slots[entry->slot].expr, slot, &entry->value);
+        entry->value = null_value();
+        if (!added) {
+            free(map);
+            return false;
+        }
+    }
+    free(map);
+    return true;
+}
+
+/* Output. */
+
+static bool value_truthy(const Value *value) {
+    if (is_null(value))
+        return false;
+    switch (value->type) {
+    case TYPE_INT:
+        return value->int_val != 0;
+    case TYPE_FLOAT:
+        return value->float_val != 0;
+    case TYPE_BOOLEAN:
+        return value->bool_val;
+    default:
+        return true;
+    }
+}
+
+static Value slot_result(const HashAggState *state, GroupHeader *header, int s) {
+    const AggSlot *slot = &group_slots(state, header)[s];
+    const Expr *expr = state->slots[s].expr;
+    if (state->slots[s].kind == SLOT_FIRST)
+        return slot->has_value ? copy_value(&slot->value) : null_value();
+
+    if (expr->aggregate.func_type == FUNC_COUNT) {
+        Value result = {0};
+        result.type = TYPE_INT;
+        bool count_rows = expr->aggregate.count_all || !expr->aggregate.operand;
+        result.int_val = count_rows ? header->rows : slot->non_null;
+        return result;
+    }
+    if (sketch_function(expr->aggregate.func_type))
+        return sketch_result(slot->sketch, expr->aggregate.func_type, expr->aggregate.fraction);
+    if (slot->numeric.count > 0)
+        return numeric_agg_result(expr->aggregate.func_type, &slot->numeric,
+                                  agg_operand_type(expr->aggregate.operand, state->schema));
+    return slot->has_value ? copy_value(&slot->value) : null_value();
+}
+
+/* Evaluates expr for a finished group: group keys and slots are its leaves. */
+static Value eval_group(const HashAggState *state, GroupHeader *header, const Expr *expr) {
+    if (!expr)
+        return null_value();
+    switch (expr->type) {
+    case EXPR_VALUE:
+        return copy_value(&expr->value);
+    case EXPR_BINARY_OP: {
+        Value left = eval_group(state, header, expr->binary.left);
+        Value right = eval_group(state, header, expr->binary.right);
+        Value result = {0};
+        if (expr->binary.op == OP_AND || expr->binary.op == OP_OR) {
+            bool l = value_truthy(&left), r = value_truthy(&right);
+            result.type = TYPE_INT;
+            result.int_val = expr->binary.op == OP_AND ? (l && r) : (l || r);
+        } else {
+            result = eval_binary_values(expr->binary.op, left, right);
+        }
+        free_value(&left);
+        free_value(&right);
+        return result;
+    }
+    case EXPR_UNARY_OP: {
+        Value operand = eval_group(state, header, expr->unary.operand);
+        if (expr->unary.op != OP_NOT)
+            return operand;
+        Value result = {0};
+        result.type = TYPE_INT;
+        result.int_val = !value_truthy(&operand);
+        free_value(&operand);
+        return result;
+    }
+    default:
+        break;
+    }
+    int k = key_index(state, expr);
+    if (k >= 0)
+        return copy_value(&group_keys(header)[k]);
+    int s = find_slot(state, expr);
+    return s >= 0 ? slot_result(state, header, s) : null_value();
+}
+
+static int compare_rows(const HashAggState *state, int a, int b) {
+    int width = state->out_count + state->order_count;
+    const Value *ra = &state->rows[(size_t)a * width + state->out_count];
+    const Value *rb = &state->rows[(size_t)b * width + state->out_count];
+    for (int j = 0; j < state->order_count; j++) {
+        bool na = is_null(&ra[j]), nb = is_null(&rb[j]);
+        int cmp = na || nb ? (int)na - (int)nb : compare_values(&ra[j], &rb[j]);
+        if (cmp != 0) {
+            bool desc = *(bool *)alist_get(state->plan->desc, j);
+            return desc ? -cmp : cmp;
+        }
+    }
+    return 0;
+}
+
+/* Stable merge sort of the output row indices on their ORDER BY keys. */
+static void sort_rows(const HashAggState *state, int *order, int *tmp, int n) {
+    if (n < 2)
+        return;
+    int half = n / 2;
+    sort_rows(state, order, tmp, half);
+    sort_rows(state, order + half, tmp, n - half);
+    int i = 0, j = half, out = 0;
+    while (i < half && j < n)
+        tmp[out++] = compare_rows(state, order[j], order[i]) < 0 ? order[j++] : order[i++];
+    while (i < half)
+        tmp[out++] = order[i++];
+    while (j < n)
+        tmp[out++] = order[j++];
+    memcopy(order, tmp, (size_t)n * sizeof(int));
+}
+
+typedef struct {
+    int64_t first;
+    uint32_t group;
+} GroupOrder;
+
+static int compare_first(const void *a, const void *b) {
+    int64_t fa = ((const GroupOrder *)a)->first, fb = ((const GroupOrder *)b)->first;
+    return (fa > fb) - (fa < fb);
+}
+
+/* Merged groups reach the first partial in worker order; sorting them on their first row
+   restores the order a serial fold would have produced. */
+static GroupOrder *groups_in_input_order(const HashAggState *state, const GroupTable *table) {
+    GroupOrder *order = malloc(((size_t)table->count + 1) * sizeof(GroupOrder));
+    if (!order)
+        return NULL;
+    for (uint32_t g = 0; g < table->count; g++) {
+        order[g].first = group_header(state, table, g)->first;
+        order[g].group = g;
+    }
+    if (state->partial_count > 1 || state->spilled)
+        qsort(order, table->count, sizeof(GroupOrder), compare_first);
+    return order;
+}
+
+static bool reserve_rows(HashAggState *state, uint32_t more) {
+    int width = state->out_count + state->order_count;
+    size_t need = (size_t)state->row_count + more;
+    if (need <= (size_t)state->row_cap)
+        return true;
+    size_t cap = state->row_cap ? (size_t)state->row_cap * 2 : 16;
+    while (cap < need)
+        cap *= 2;
+    Value *rows = realloc(state->rows, (cap * width + 1) * sizeof(Value));
+    if (rows)
+        state->rows = rows;
+    int64_t *firsts = realloc(state->firsts, cap * sizeof(int64_t));
+    if (firsts)
+        state->firsts = firsts;
+    if (!rows || !firsts)
+        return false;
+    state->row_cap = (int)cap;
+    return true;
+}
+
+/* Applies HAVING to the merged groups and appends their SELECT list and ORDER BY keys. */
+static bool finish_groups(HashAggState *state, GroupTable *table) {
+    Value *no_keys = state->partials[0].keys;
+    if (table->count == 0 && state->key_count == 0 && !state->spilled &&
+        find_group(state, table, no_keys, hash_keys(no_keys, 0), false) < 0)
+        return false;
+
+    int width = state->out_count + state->order_count;
+    GroupOrder *groups = groups_in_input_order(state, table);
+    if (!groups || !reserve_rows(state, table->count)) {
+        free(groups);
+        return false;
+    }
+    g_hash_agg_stats.groups += table->count;
+
+    for (uint32_t i = 0; i < table->count; i++) {
+        GroupHeader *header = group_header(state, table, groups[i].group);
+        if (state->plan->having) {
+            Value keep = eval_group(state, header, state->plan->having);
+            bool truthy = value_truthy(&keep);
+            free_value(&keep);
+            if (!truthy)
+                continue;
+        }
+        Value *row = &state->rows[(size_t)state->row_count * width];
+        for (int i = 0; i < state->out_count; i++)
+            row[i] = eval_group(state, header, *(Expr **)alist_get(state->plan->expressions, i));
+        for (int j = 0; j < state->order_count; j++)
+            row[state->out_count + j] =
+                eval_group(state, header, *(Expr **)alist_get(state->plan->order_by, j));
+        state->firsts[state->row_count] = header->first;
+        state->row_count++;
+    }
+    free(groups);
+    return true;
+}
+
+/* Puts the rows of spilled partitions back in input order, then sorts them for ORDER BY. */
+static bool order_rows(HashAggState *state) {
+    state->order = malloc(((size_t)state->row_count + 1) * sizeof(int));
+    if (!state->order)
+        return false;
+    if (state->spilled) {
+        GroupOrder *rows = malloc(((size_t)state->row_count + 1) * sizeof(GroupOrder));
+        if (!rows)
+            return false;
+        for (int r = 0; r < state->row_count; r++) {
+            rows[r].first = state->firsts[r];
+            rows[r].group = (uint32_t)r;
+        }
+        qsort(rows, (size_t)state->row_count, sizeof(GroupOrder), compare_first);
+        for (int r = 0; r < state->row_count; r++)
+            state->order[r] = (int)rows[r].group;
+        free(rows);
+    } else {
+        for (int r = 0; r < state->row_count; r++)
+            state->order[r] = r;
+    }
+
+    if (state->order_count > 0) {
+        int *tmp = malloc(((size_t)state->row_count + 1) * sizeof(int));
+        if (!tmp)
+            return false;
+        sort_rows(state, state->order, tmp, state->row_count);
+        free(tmp);
+    }
+    return true;
+}
+
+bool hash_aggregate_open(Operator *op) {
+    const HashAggregatePlan *plan = &op->plan->plan.hash_aggregate;
+    HashAggState *state = arena_calloc(op->ctx->arena, 1, sizeof(HashAggState));
+    if (!state)
+        return false;
+    op->state = state;
+    row_batch_init(&state->input);
+    state->plan = plan;
+    state->schema = op->ctx->schema;
+    state->key_count = alist_length(plan->group_by);
+    state->out_count = alist_length(plan->expressions);
+    state->order_count = alist_length(plan->order_by);
+
+    state->key_columns = arena_calloc(op->ctx->arena, (size_t)state->key_count + 1,
+                                      sizeof(uint16_t));
+    if (!state->key_columns)
+        return false;
+    for (int i = 0; i < state->key_count; i++) {
+        const Expr *expr = *(Expr **)alist_get(plan->group_by, i);
+        if (expr->type != EXPR_COLUMN) {
+            log_msg(LOG_ERROR, "hash_aggregate_open: GROUP BY supports columns only");
+            return false;
+        }
+        state->key_columns[i] = expr->column.column_id;
+    }
+
+    int nodes = count_nodes(plan->having);
+    for (int i = 0; i < state->out_count; i++)
+        nodes += count_nodes(*(Expr **)alist_get(plan->expressions, i));
+    for (int j = 0; j < state->order_count; j++)
+        nodes += count_nodes(*(Expr **)alist_get(plan->order_by, j));
+    state->slots = arena_calloc(op->ctx->arena, (size_t)nodes + 1, sizeof(SlotDef));
+    if (!state->slots)
+        return false;
+    for (int i = 0; i < state->out_count; i++)
+        collect_slots(state, *(Expr **)alist_get(plan->expressions, i));
+    collect_slots(state, plan->having);
+    for (int j = 0; j < state->order_count; j++)
+        collect_slots(state, *(Expr **)alist_get(plan->order_by, j));
+
+    state->slot_offset = sizeof(GroupHeader) + (size_t)state->key_count * sizeof(Value);
+    state->stride = state->slot_offset + (size_t)state->slot_count * sizeof(AggSlot);
+
+    bool safe = exprs_parallel_safe(plan->expressions) && exprs_parallel_safe(plan->order_by) &&
+                expr_parallel_safe(plan->having);
+    state->parallel = safe ? parallel_scan_open(op->left) : NULL;
+    state->partial_count = state->parallel ? parallel_scan_workers(state->parallel) : 1;
+    for (int p = 0; p < state->partial_count; p++) {
+        GroupPartial *partial = &state->partials[p];
+        partial->keys = arena_calloc(op->ctx->arena, (size_t)state->key_count + 1, sizeof(Value));
+        if (!partial->keys || !group_table_init(&partial->table))
+            return false;
+        partial->share = state->partial_count;
+    }
+    return true;
+}
+
+static void close_spill(SpillFile *files) {
+    if (!files)
+        return;
+    for (int p = 0; p < SPILL_FANOUT; p++)
+        spill_close(&files[p]);
+    free(files);
+}
+
+static bool aggregate_partition(HashAggState *state, Operator *op, GroupTable *table,
+                                SpillFile **files, int count, int level);
+
+/* Splits table on the hash bits of level and aggregates each part with the rows spilled to
+   that partition of every spills[i]. Frees table. */
+static bool aggregate_partitions(HashAggState *state, Operator *op, GroupTable *table,
+                                 SpillFile **spills, int count, int level) {
+    bool ok = true;
+    for (int p = 0; p < SPILL_FANOUT && ok; p++) {
+        SpillFile *inputs[MAX_PARALLEL_WORKERS];
+        int n = 0;
+        for (int i = 0; i < count; i++)
+            if (spills[i])
+                inputs[n++] = &spills[i][p];
+        GroupTable part;
+        ok = group_table_init(&part) && merge_partial(state, &part, table, level, p) &&
+             aggregate_partition(state, op, &part, inputs, n, level);
+        group_table_free(state, &part);
+    }
+    group_table_free(state, table);
+    return ok;
+}
+
+static bool read_spilled(HashAggState *state, SpillFile *file, uint64_t *left,
+                         int64_t *positions) {
+    RowBatch *batch = &state->input;
+    row_batch_reset(batch, state->spill_width);
+    while (batch->count < FILTER_BATCH_SIZE && *left > 0) {
+        int ids[MAX_JOIN_TABLES];
+        if (!spill_read(file, &positions[batch->count], sizeof(int64_t)) ||
+            !spill_read(file, ids, sizeof(int) * (size_t)batch->width))
+            return false;
+        for (int t = 0; t < batch->width; t++)
+            batch->ids[t][batch->count] = ids[t];
+        batch->count++;
+        (*left)--;
+    }
+    return true;
+}
+
+/* Folds the rows spilled to one partition into table, which holds the partition's groups
+   that stayed in memory, then finishes them. A table that fills up again spills the groups
+   it does not hold on the next bits of their hashes. Takes over table. */
+static bool aggregate_partition(HashAggState *state, Operator *op, GroupTable *table,
+                                SpillFile **files, int count, int level) {
+    GroupPartial part = {0};
+    part.table = *table;
+    memclear(table, sizeof(GroupTable));
+    part.keys = state->partials[0].keys;
+    part.share = 1;
+    part.level = level + 1;
+    int64_t positions[FILTER_BATCH_SIZE];
+    uint64_t records = 0;
+    for (int i = 0; i < count; i++) {
+        SpillFile *file = files[i];
+        uint64_t left = file->records;
+        records += left;
+        op->spilled_bytes += file->bytes;
+        if (left > 0 && !spill_rewind(file))
+            part.failed = true;
+        while (left > 0 && !part.failed) {
+            if (!read_spilled(state, file, &left, positions))
+                part.failed = true;
+            else
+                fold_batch(state, op->ctx, &state->input, &part, positions);
+        }
+        spill_close(file);
+    }
+    if (records > 0)
+        g_hash_agg_stats.spill_partitions++;
+
+    bool ok = !part.failed;
+    if (ok && part.spill) {
+        ok = aggregate_partitions(state, op, &part.table, &part.spill, 1, level + 1);
+    } else {
+        ok = ok && finish_groups(state, &part.table);
+        group_table_free(state, &part.table);
+    }
+    memory_track(op->ctx->memory, &part.charged, 0);
+    close_spill(part.spill);
+    return ok;
+}
+
+static bool aggregate_input(HashAggState *state, Operator *op) {
+    GroupPartial *first = &state->partials[0];
+    if (state->parallel) {
+        parallel_scan_run(state->parallel, 0, parallel_scan_morsels(state->parallel),
+                          fold_morsel_batch, state);
+        parallel_scan_close(state->parallel);
+        state->parallel = NULL;
+    } else {
+        while (!first->failed && operator_next(op->left, &state->input))
+            fold_batch(state, op->ctx, &state->input, first, NULL);
+    }
+    bool failed = first->failed;
+    SpillFile *spills[MAX_PARALLEL_WORKERS];
+    for (int p = 0; p < state->partial_count; p++) {
+        GroupPartial *partial = &state->partials[p];
+        if (p > 0) {
+            failed = failed || partial->failed ||
+                     !merge_partial(state, &first->table, &partial->table, 0, -1);
+            first->rows += partial->rows;
+            group_table_free(state, &partial->table);
+        }
+        memory_track(op->ctx->memory, &partial->charged, 0);
+        spills[p] = partial->spill;
+        state->spilled = state->spilled || partial->spill;
+        if (partial->width > state->spill_width)
+            state->spill_width = partial->width;
+    }
+    if (failed)
+        return false;
+
+    g_hash_agg_stats.aggregates++;
+    g_hash_agg_stats.partials += (uint64_t)state->partial_count;
+    log_msg(LOG_INFO, "Aggregated %lld rows into %u groups in memory", first->rows,
+            first->table.count);
+    bool ok;
+    if (state->spilled) {
+        g_hash_agg_stats.spilled++;
+        ok = aggregate_partitions(state, op, &first->table, spills, state->partial_count, 0);
+    } else {
+        ok = finish_groups(state, &first->table);
+        group_table_free(state, &first->table);
+    }
+    return ok && order_rows(state);
+}
+
+/* Emits the groups that pass HAVING, FILTER_BATCH_SIZE rows of values at a time. */
+bool hash_aggregate_next(Operator *op, RowBatch *out) {
+    HashAggState *state = op->state;
+    if (!state->done) {
+        state->done = true;
+        if (!aggregate_input(state, op)) {
+            log_msg(LOG_ERROR, "hash_aggregate_next: Out of memory building groups");
+            state->failed = true;
+        }
+    }
+    if (state->failed || state->next >= state->row_count)
+        return false;
+
+    row_batch_reset(out, 0);
+    out->value_count = state->out_count;
+    int width = state->out_count + state->order_count;
+    int n = state->row_count - state->next;
+    if (n > FILTER_BATCH_SIZE)
+        n = FILTER_BATCH_SIZE;
+    for (int r = 0; r < n; r++) {
+        Value *row = &state->rows[(size_t)state->order[state->next + r] * width];
+        for (int i = 0; i < state->out_count; i++) {
+            Value *slot = (Value *)alist_append(&out->values);
+            if (!slot)
+                return false;
+            *slot = row[i];
+            row[i] = null_value();
+        }
+    }
+    out->count = n;
+    state->next += n;
+    return true;
+}
+
+void hash_aggregate_close(Operator *op) {
+    HashAggState *state = op->state;
+    if (!state)
+        return;
+    parallel_scan_close(state->parallel);
+    for (int p = 0; p < state->partial_count; p++) {
+        group_table_free(state, &state->partials[p].table);
+        memory_track(op->ctx->memory, &state->partials[p].charged, 0);
+        close_spill(state->partials[p].spill);
+    }
+    if (state->rows) {
+        size_t total = (size_t)state->row_count * (state->out_count + state->order_count);
+        for (size_t i = 0; i < total; i++)
+            free_value(&state->rows[i]);
+    }
+    free(state->rows);
+    free(state->firsts);
+    free(state->order);
+    row_batch_free(&state->input);
+}
@@ -0,0 +1,916 @@
+#include <stdlib.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "metrics.h"
+#include "table.h"
+#include "thread_pool.h"
+#include "txn.h"
+#include "utils.h"
+#include "values.h"
+
+/* Writes the next row of out: the left row, which is left_id of the table in left_slot or row
+   k of left when that carries the rows of earlier joins, and right_id in right_slot. Tables
+   joined further up stay -1. */
+static void emit_joined(RowBatch *out, const JoinPlan *join, const RowBatch *left, int k,
+                        int left_id, int right_id) {
+    int n = out->count++;
+    if (join->left_slot < 0) {
+        for (int t = 0; t < out->width; t++)
+            out->ids[t][n] = left->ids[t][k];
+    } else {
+        for (int t = 0; t < out->width; t++)
+            out->ids[t][n] = -1;
+        out->ids[join->left_slot][n] = left_id;
+    }
+    out->ids[join->right_slot][n] = right_id;
+}
+
+/* Drains a width-1 input into ids. */
+static bool drain_ids(Operator *input, RowBatch *batch, ArrayList *ids) {
+    while (operator_next(input, batch)) {
+        for (int k = 0; k < batch->count; k++) {
+            int *slot = (int *)alist_append(ids);
+            if (!slot)
+                return false;
+            *slot = batch->ids[0][k];
+        }
+    }
+    return true;
+}
+
+/* Hash join. The build side is radix-partitioned on the low bits of its key hashes into
+   partitions of at most JOIN_PARTITION_BYTES, and every partition is bucketed on the next bits
+   into its own flat array (CSR layout): entries of bucket b live in rows[start[b]..start[b+1])
+   next to their full hashes, so most mismatches are rejected without reading the key and a
+   probe only touches one cache-sized partition. Hashing and the per-partition builds run on
+   the thread pool. Over a large sequential scan the probe does too, morsel by morsel, and each
+   morsel's (left, right) row id pairs are emitted in morsel order, as a serial probe would.
+   Only a single-table left side is ever built on; the rows of earlier joins are probed.
+
+   A build side whose table would outgrow work_mem makes it a grace hash join: the build row
+   ids and then the probe rows are written to SPILL_FANOUT pairs of temporary files on the top
+   bits of their key hashes, and each pair is joined in turn with the usual table built from
+   the build file, alone in memory. A build file still too large is split again on the next
+   bits first. Rows then come out partition by partition rather than in probe order. */
+#define JOIN_ENTRY_BYTES (sizeof(int) * 2 + sizeof(uint64_t))
+#define JOIN_HASH_CHUNK PARALLEL_MORSEL_ROWS
+/* What a build row costs in a built table: its id, hash and scratch copies, and buckets. */
+#define JOIN_BUILD_ROW_BYTES 48
+
+typedef struct {
+    int offset; /* first entry */
+    int count;
+    uint32_t mask; /* buckets - 1 */
+    int *start;    /* buckets + 1 entry offsets */
+} JoinPartition;
+
+/* A partition of a grace hash join: build row ids, and probe rows as ids of every table the
+   probe batches carry. */
+typedef struct {
+    SpillFile build;
+    SpillFile probe;
+    int level;
+} SpillPair;
+
+typedef struct {
+    RowBatch input;
+    ArrayList build_ids; /* int */
+    size_t charged;      /* build_ids, against the statement's memory */
+    int partition_bits;
+    JoinPartition *partitions;
+    int *rows;
+    uint64_t *hashes;
+    /* build scratch */
+    uint64_t *row_hash;
+    uint8_t *null_key;
+    int *scratch_rows;
+    uint64_t *scratch_hashes;
+    const Table *build_table;
+    const Table *probe_table;
+    uint16_t build_column;
+    uint16_t probe_column;
+    Operator *probe;
+    int probe_index; /* of the key table's ids in a probe batch */
+    bool probe_is_left;
+    bool is_left_join;
+    /* serial probe position */
+    int probe_k;
+    int entry;
+    int entry_end;
+    uint64_t probe_hash;
+    Value probe_key;
+    bool matched;
+    bool in_bucket;
+    /* parallel probe: pairs of the current wave's morsels */
+    bool started;
+    ParallelScan *parallel;
+    int morsel_count;
+    int wave_first;
+    int wave_size;
+    int wave_cap;
+    ArrayList *pairs; /* per morsel: int left, int right */
+    int emit_morsel;
+    int emit_pos;
+    /* grace hash join */
+    bool spilled;
+    bool failed;
+    SpillPair *pending; /* partitions still to join, a stack */
+    int pending_count;
+    int pending_cap;
+    SpillPair current; /* the partition being probed */
+    int probe_width;
+    Arena partition_arena; /* the current partition's table */
+} HashJoinState;
+
+static size_t g_partition_bytes = JOIN_PARTITION_BYTES;
+static HashJoinStats g_hash_join_stats;
+
+void hash_join_set_partition_bytes(size_t bytes) {
+    if (bytes == 0)
+        bytes = JOIN_PARTITION_BYTES;
+    g_partition_bytes = bytes < JOIN_MIN_PARTITION_BYTES ? JOIN_MIN_PARTITION_BYTES : bytes;
+}
+
+void hash_join_get_stats(HashJoinStats *stats) {
+    *stats = g_hash_join_stats;
+}
+
+void hash_join_count_filtered(uint64_t rows) {
+    g_hash_join_stats.filtered_rows += rows;
+}
+
+static int partition_bits_for(int n) {
+    int bits = 0;
+    while (bits < JOIN_MAX_PARTITION_BITS &&
+           ((size_t)n * JOIN_ENTRY_BYTES >> bits) > g_partition_bytes)
+        bits++;
+    return bits;
+}
+
+static const JoinPartition *partition_of(const HashJoinState *state, uint64_t hash) {
+    return &state->partitions[hash & ((1u << state->partition_bits) - 1)];
+}
+
+static uint32_t bucket_of(const HashJoinState *state, const JoinPartition *part, uint64_t hash) {
+    return (uint32_t)(hash >> state->partition_bits) & part->mask;
+}
+
+static void hash_build_chunk(void *arg, int worker, int task) {
+    HashJoinState *state = arg;
+    (void)worker;
+    const int *ids = (const int *)state->build_ids.data;
+    int n = alist_length(&state->build_ids);
+    int end = (task + 1) * JOIN_HASH_CHUNK < n ? (task + 1) * JOIN_HASH_CHUNK : n;
+    for (int i = task * JOIN_HASH_CHUNK; i < end; i++) {
+        Value key = table_get_value(state->build_table, ids[i], state->build_column);
+        state->null_key[i] = is_null(&key);
+        if (!state->null_key[i])
+            state->row_hash[i] = value_hash(&key);
+    }
+}
+
+/* Counting-sorts one partition's entries by bucket, through its slice of the scratch. */
+static void build_partition(void *arg, int worker, int task) {
+    HashJoinState *state = arg;
+    (void)worker;
+    JoinPartition *part = &state->partitions[task];
+    int *rows = state->scratch_rows + part->offset;
+    uint64_t *hashes = state->scratch_hashes + part->offset;
+    memcopy(rows, state->rows + part->offset, sizeof(int) * (size_t)part->count);
+    memcopy(hashes, state->hashes + part->offset, sizeof(uint64_t) * (size_t)part->count);
+
+    uint32_t buckets = part->mask + 1;
+    for (int i = 0; i < part->count; i++)
+        part->start[bucket_of(state, part, hashes[i]) + 1]++;
+    part->start[0] = part->offset;
+    for (uint32_t b = 0; b < buckets; b++)
+        part->start[b + 1] += part->start[b];
+    /* start[b + 1] is the fill cursor of bucket b until the loop below moves it to b's end. */
+    for (uint32_t b = buckets; b > 0; b--)
+        part->start[b] = part->start[b - 1];
+    for (int i = 0; i < part->count; i++) {
+        int pos = part->start[bucket_of(state, part, hashes[i]) + 1]++;
+        state->rows[pos] = rows[i];
+        state->hashes[pos] = hashes[i];
+    }
+}
+
+static bool build_hash_table(HashJoinState *state, Arena *arena) {
+    int n = alist_length(&state->build_ids);
+    state->row_hash = arena_alloc(arena, sizeof(uint64_t) * ((size_t)n + 1));
+    state->null_key = arena_alloc(arena, (size_t)n + 1);
+    state->rows = arena_alloc(arena, sizeof(int) * ((size_t)n + 1));
+    state->hashes = arena_alloc(arena, sizeof(uint64_t) * ((size_t)n + 1));
+    state->scratch_rows = arena_alloc(arena, sizeof(int) * ((size_t)n + 1));
+    state->scratch_hashes = arena_alloc(arena, sizeof(uint64_t) * ((size_t)n + 1));
+    state->partition_bits = partition_bits_for(n);
+    int partition_count = 1 << state->partition_bits;
+    state->partitions = arena_calloc(arena, (size_t)partition_count, sizeof(JoinPartition));
+    if (!state->row_hash || !state->null_key || !state->rows || !state->hashes ||
+        !state->scratch_rows || !state->scratch_hashes || !state->partitions)
+        return false;
+    thread_pool_run((n + JOIN_HASH_CHUNK - 1) / JOIN_HASH_CHUNK, hash_build_chunk, state);
+
+    /* Radix pass: a histogram of the partitions, then one scatter into partition order. */
+    uint32_t part_mask = (uint32_t)partition_count - 1;
+    for (int i = 0; i < n; i++)
+        if (!state->null_key[i])
+            state->partitions[state->row_hash[i] & part_mask].count++;
+    int offset = 0;
+    for (int p = 0; p < partition_count; p++) {
+        JoinPartition *part = &state->partitions[p];
+        part->offset = offset;
+        offset += part->count;
+        uint32_t buckets = 16;
+        while (buckets < (uint32_t)part->count)
+            buckets *= 2;
+        part->mask = buckets - 1;
+        part->start = arena_calloc(arena, (size_t)buckets + 1, sizeof(int));
+        if (!part->start)
+            return false;
+        part->count = 0;
+    }
+    const int *ids = (const int *)state->build_ids.data;
+    for (int i = 0; i < n; i++) {
+        if (state->null_key[i])
+            continue;
+        JoinPartition *part = &state->partitions[state->row_hash[i] & part_mask];
+        int pos = part->offset + part->count++;
+        state->rows[pos] = ids[i];
+        state->hashes[pos] = state->row_hash[i];
+    }
+    thread_pool_run(partition_count, build_partition, state);
+
+    g_hash_join_stats.partitions += (uint64_t)partition_count;
+    metrics_add(METRIC_JOIN_BUILD_ROWS, (uint64_t)n);
+    metrics_record(METRIC_JOIN_BUILD_SIZE, (uint64_t)n);
+    return true;
+}
+
+/* The scan under input that reads slot's rows after this join is built, when every join on
+   the way is an inner join that pulls them: there a row whose key is not in the build side can
+   never reach the output. Sides that are drained when their join opens are out of reach. */
+static Operator *join_filter_target(Operator *op, int slot) {
+    switch (op->plan->type) {
+    case PLAN_SEQ_SCAN:
+    case PLAN_INDEX_SCAN:
+    case PLAN_INDEX_INTERSECT:
+        return op;
+    case PLAN_FILTER:
+        return join_filter_target(op->left, slot);
+    case PLAN_HASH_JOIN:
+    case PLAN_NESTED_LOOP_JOIN:
+    case PLAN_INDEX_NESTED_LOOP_JOIN: {
+        const JoinPlan *join = &op->plan->plan.join;
+        bool hash_build_left = op->plan->type == PLAN_HASH_JOIN && join->build_left;
+        if (join->join_type == JOIN_LEFT)
+            return NULL;
+        if (slot == join->right_slot)
+            return hash_build_left ? join_filter_target(op->right, slot) : NULL;
+        return hash_build_left ? NULL : join_filter_target(op->left, slot);
+    }
+    default:
+        return NULL;
+    }
+}
+
+/* Pushes a Bloom filter of the build keys into the probe table's scan. A LEFT join keeps its
+   unmatched probe rows, so it has none. */
+static void push_join_filter(Operator *op, HashJoinState *state, int probe_slot) {
+    bool filtered = !state->is_left_join && !state->spilled;
+    Operator *scan = filtered ? join_filter_target(state->probe, probe_slot) : NULL;
+    if (!scan)
+        return;
+    int keys = 0;
+    for (int p = 0; p < 1 << state->partition_bits; p++)
+        keys += state->partitions[p].count;
+    JoinFilter *filter = arena_calloc(op->ctx->arena, 1, sizeof(JoinFilter));
+    if (!filter || !bloom_init(&filter->bloom, op->ctx->arena, keys))
+        return;
+    for (int i = 0; i < keys; i++)
+        bloom_add(&filter->bloom, state->hashes[i]);
+    filter->column_id = state->probe_column;
+    filter->next = scan->join_filters;
+    scan->join_filters = filter;
+    g_hash_join_stats.join_filters++;
+    log_msg(LOG_DEBUG, "hash_join_open: Bloom filter of %d keys pushed into the scan of '%s'",
+            keys, state->probe_table->name);
+}
+
+/* Grace hash join. */
+
+static int key_partition(const Table *table, int row, uint16_t column, int level) {
+    Value key = table_get_value(table, row, column);
+    return is_null(&key) ? 0 : spill_partition(value_hash(&key), level);
+}
+
+static SpillPair *push_pairs(HashJoinState *state, int level) {
+    if (state->pending_count + SPILL_FANOUT > state->pending_cap) {
+        int cap = state->pending_cap > 0 ? state->pending_cap * 2 : 2 * SPILL_FANOUT;
+        SpillPair *pending = realloc(state->pending, sizeof(SpillPair) * (size_t)cap);
+        if (!pending)
+            return NULL;
+        state->pending = pending;
+        state->pending_cap = cap;
+    }
+    SpillPair *pairs = &state->pending[state->pending_count];
+    memclear(pairs, sizeof(SpillPair) * SPILL_FANOUT);
+    for (int p = 0; p < SPILL_FANOUT; p++)
+        pairs[p].level = level;
+    state->pending_count += SPILL_FANOUT;
+    return pairs;
+}
+
+static bool write_build_row(const HashJoinState *state, SpillPair *pairs, int level, int row) {
+    SpillFile *file =
+        &pairs[key_partition(state->build_table, row, state->build_column, level)].build;
+    file->records++;
+    return spill_write(file, &row, sizeof(row));
+}
+
+static bool write_probe_row(const HashJoinState *state, SpillPair *pairs, int level,
+                            const int *ids) {
+    int row = ids[state->probe_index];
+    SpillFile *file =
+        &pairs[key_partition(state->probe_table, row, state->probe_column, level)].probe;
+    file->records++;
+    return spill_write(file, ids, sizeof(int) * (size_t)state->probe_width);
+}
+
+static bool finish_file(Operator *op, SpillFile *file) {
+    op->spilled_bytes += file->bytes;
+    return spill_rewind(file);
+}
+
+/* Drains the build side; past work_mem its ids go to the first level of partitions instead. */
+static bool drain_build(Operator *op, HashJoinState *state, Operator *build) {
+    SpillPair *pairs = NULL;
+    while (operator_next(build, &state->input)) {
+        RowBatch *batch = &state->input;
+        for (int k = 0; k < batch->count; k++) {
+            if (pairs) {
+                if (!write_build_row(state, pairs, 0, batch->ids[0][k]))
+                    return false;
+                continue;
+            }
+            int *slot = (int *)alist_append(&state->build_ids);
+            if (!slot)
+                return false;
+            *slot = batch->ids[0][k];
+        }
+        if (pairs)
+            continue;
+        size_t n = (size_t)alist_length(&state->build_ids);
+        memory_track(op->ctx->memory, &state->charged, n * sizeof(int));
+        if (!exec_memory_exceeded(op->ctx, n * JOIN_BUILD_ROW_BYTES, 1))
+            continue;
+        pairs = push_pairs(state, 0);
+        if (!pairs)
+            return false;
+        state->spilled = true;
+        g_hash_join_stats.spilled++;
+        const int *ids = (const int *)state->build_ids.data;
+        for (size_t i = 0; i < n; i++)
+            if (!write_build_row(state, pairs, 0, ids[i]))
+                return false;
+        alist_destroy(&state->build_ids);
+        memory_track(op->ctx->memory, &state->charged, 0);
+    }
+    for (int p = 0; pairs && p < SPILL_FANOUT; p++)
+        if (!finish_file(op, &pairs[p].build))
+            return false;
+    return true;
+}
+
+/* Writes the whole probe side to the first level's probe files. */
+static bool partition_probe(Operator *op, HashJoinState *state) {
+    int ids[MAX_JOIN_TABLES];
+    while (operator_next(state->probe, &state->input)) {
+        RowBatch *batch = &state->input;
+        metrics_add(METRIC_JOIN_PROBE_ROWS, (uint64_t)batch->count);
+        state->probe_width = batch->width;
+        for (int k = 0; k < batch->count; k++) {
+            for (int t = 0; t < batch->width; t++)
+                ids[t] = batch->ids[t][k];
+            Value key = table_get_value(state->probe_table, ids[state->probe_index],
+                                        state->probe_column);
+            /* A NULL key matches nothing; only a LEFT join keeps the row. */
+            if (is_null(&key) && !state->is_left_join)
+                continue;
+            if (!write_probe_row(state, state->pending, 0, ids))
+                return false;
+        }
+    }
+    for (int p = 0; p < SPILL_FANOUT; p++)
+        if (!finish_file(op, &state->pending[p].probe))
+            return false;
+    return true;
+}
+
+/* Splits pair on the next bits of its hashes into pending partitions. */
+static bool repartition(Operator *op, HashJoinState *state, SpillPair *pair) {
+    int level = pair->level + 1;
+    SpillPair *pairs = push_pairs(state, level);
+    if (!pairs)
+        return false;
+    int row;
+    while (spill_read(&pair->build, &row, sizeof(row)))
+        if (!write_build_row(state, pairs, level, row))
+            return false;
+    int ids[MAX_JOIN_TABLES];
+    while (spill_read(&pair->probe, ids, sizeof(int) * (size_t)state->probe_width))
+        if (!write_probe_row(state, pairs, level, ids))
+            return false;
+    for (int p = 0; p < SPILL_FANOUT; p++)
+        if (!finish_file(op, &pairs[p].build) || !finish_file(op, &pairs[p].probe))
+            return false;
+    return !pair->build.failed && !pair->probe.failed;
+}
+
+/* Makes the next pending partition current, built and ready to probe; false when none are
+   left. Partitions nothing can come out of are skipped. */
+static bool next_partition(Operator *op, HashJoinState *state) {
+    for (;;) {
+        spill_close(&state->current.build);
+        spill_close(&state->current.probe);
+        if (state->pending_count == 0 || state->failed)
+            return false;
+        state->current = state->pending[--state->pending_count];
+        SpillPair *pair = &state->current;
+        if (pair->probe.records == 0 || (pair->build.records == 0 && !state->is_left_join))
+            continue;
+        size_t held = (size_t)pair->build.records * JOIN_BUILD_ROW_BYTES;
+        if (exec_memory_exceeded(op->ctx, held, 1) && pair->level + 1 < SPILL_MAX_LEVELS) {
+            if (!repartition(op, state, pair))
+                state->failed = true;
+            continue;
+        }
+
+        alist_clear(&state->build_ids);
+        int row;
+        while (spill_read(&pair->build, &row, sizeof(row))) {
+            int *slot = (int *)alist_append(&state->build_ids);
+            if (!slot)
+                break;
+            *slot = row;
+        }
+        arena_reset(&state->partition_arena);
+        if (alist_length(&state->build_ids) != (int)pair->build.records ||
+            !build_hash_table(state, &state->partition_arena)) {
+            state->failed = true;
+            return false;
+        }
+        g_hash_join_stats.spill_partitions++;
+        return true;
+    }
+}
+
+/* The next batch of probe rows: from the probe input, or from the current partition's file
+   once the join spilled. */
+static bool next_probe_batch(Operator *op, HashJoinState *state) {
+    if (!state->spilled) {
+        if (!operator_next(state->probe, &state->input))
+            return false;
+        metrics_add(METRIC_JOIN_PROBE_ROWS, (uint64_t)state->input.count);
+        return true;
+    }
+    RowBatch *batch = &state->input;
+    int ids[MAX_JOIN_TABLES];
+    size_t size = sizeof(int) * (size_t)state->probe_width;
+    for (;;) {
+        row_batch_reset(batch, state->probe_width);
+        while (batch->count < FILTER_BATCH_SIZE && spill_read(&state->current.probe, ids, size)) {
+            for (int t = 0; t < state->probe_width; t++)
+                batch->ids[t][batch->count] = ids[t];
+            batch->count++;
+        }
+        if (batch->count > 0)
+            return true;
+        if (!next_partition(op, state))
+            return false;
+    }
+}
+
+bool hash_join_open(Operator *op) {
+    const JoinPlan *join = &op->plan->plan.join;
+    HashJoinState *state = arena_calloc(op->ctx->arena, 1, sizeof(HashJoinState));
+    if (!state)
+        return false;
+    op->state = state;
+    row_batch_init(&state->input);
+    alist_init(&state->build_ids, sizeof(int), NULL);
+    arena_init(&state->partition_arena, 0);
+    state->partition_arena.account = op->ctx->memory;
+    state->probe_width = 1;
+
+    state->is_left_join = join->join_type == JOIN_LEFT;
+    state->probe_is_left = !join->build_left;
+    Operator *build = join->build_left ? op->left : op->right;
+    state->probe = join->build_left ? op->right : op->left;
+    const Table *left_table = op->ctx->tables[join->key_slot];
+    const Table *right_table = op->ctx->tables[join->right_slot];
+    state->build_table = join->build_left ? left_table : right_table;
+    state->probe_table = join->build_left ? right_table : left_table;
+    state->build_column = join->build_left ? join->left_column : join->right_column;
+    state->probe_column = join->build_left ? join->right_column : join->left_column;
+    state->probe_index = join->build_left || join->left_slot >= 0 ? 0 : join->key_slot;
+
+    g_hash_join_stats.joins++;
+    if (!drain_build(op, state, build) ||
+        (!state->spilled && !build_hash_table(state, op->ctx->arena))) {
+        log_msg(LOG_ERROR, "hash_join_open: Failed to build the hash table");
+        return false;
+    }
+    if (state->spilled)
+        log_msg(LOG_INFO, "hash_join_open: Spilled the build side on '%s' to %d partitions",
+                state->build_table->name, SPILL_FANOUT);
+    else
+        log_msg(LOG_DEBUG,
+                "hash_join_open: Built hash table on '%s' with %d rows in %d partitions",
+                state->build_table->name, alist_length(&state->build_ids),
+                1 << state->partition_bits);
+    push_join_filter(op, state, join->build_left ? join->right_slot : join->key_slot);
+    row_batch_reset(&state->input, 1);
+    return true;
+}
+
+static void add_pair(ArrayList *pairs, int left, int right) {
+    int *slot = (int *)alist_append(pairs);
+    if (!slot)
+        return;
+    slot[0] = left;
+    slot[1] = right;
+}
+
+/* Appends every pair of probe_row to pairs; the probe side of the parallel path. */
+static void probe_row_pairs(const HashJoinState *state, int probe_row, ArrayList *pairs) {
+    Value key = table_get_value(state->probe_table, probe_row, state->probe_column);
+    bool matched = false;
+    if (!is_null(&key)) {
+        uint64_t hash = value_hash(&key);
+        const JoinPartition *part = partition_of(state, hash);
+        uint32_t b = bucket_of(state, part, hash);
+        for (int e = part->start[b]; e < part->start[b + 1]; e++) {
+            if (state->hashes[e] != hash)
+                continue;
+            int build_row = state->rows[e];
+            Value build_key = table_get_value(state->build_table, build_row, state->build_column);
+            if (!value_equals(&key, &build_key))
+                continue;
+            matched = true;
+            if (state->probe_is_left)
+                add_pair(pairs, probe_row, build_row);
+            else
+                add_pair(pairs, build_row, probe_row);
+        }
+    }
+    if (!matched && state->is_left_join)
+        add_pair(pairs, probe_row, -1);
+}
+
+static void probe_morsel_batch(void *arg, int worker, int morsel, ExecContext *ctx,
+                               const RowBatch *batch) {
+    HashJoinState *state = arg;
+    (void)worker;
+    (void)ctx;
+    ArrayList *pairs = &state->pairs[morsel - state->wave_first];
+    metrics_add(METRIC_JOIN_PROBE_ROWS, (uint64_t)batch->count);
+    for (int k = 0; k < batch->count; k++)
+        probe_row_pairs(state, batch->ids[0][k], pairs);
+}
+
+static bool start_parallel_probe(Operator *op, HashJoinState *state) {
+    ParallelScan *parallel = parallel_scan_open(state->probe);
+    if (!parallel)
+        return false;
+    state->wave_cap = parallel_scan_workers(parallel) * 2;
+    state->pairs = arena_calloc(op->ctx->arena, (size_t)state->wave_cap, sizeof(ArrayList));
+    if (!state->pairs) {
+        parallel_scan_close(parallel);
+        return false;
+    }
+    for (int m = 0; m < state->wave_cap; m++)
+        alist_init(&state->pairs[m], sizeof(int) * 2, NULL);
+    state->parallel = parallel;
+    state->morsel_count = parallel_scan_morsels(parallel);
+    g_hash_join_stats.parallel_probes++;
+    return true;
+}
+
+static bool hash_join_next_parallel(const JoinPlan *join, HashJoinState *state, RowBatch *out) {
+    for (;;) {
+        while (state->emit_morsel < state->wave_size && out->count < FILTER_BATCH_SIZE) {
+            const ArrayList *pairs = &state->pairs[state->emit_morsel];
+            int count = alist_length(pairs);
+            const int *pair = (const int *)pairs->data;
+            while (state->emit_pos < count && out->count < FILTER_BATCH_SIZE) {
+                emit_joined(out, join, NULL, 0, pair[state->emit_pos * 2],
+                            pair[state->emit_pos * 2 + 1]);
+                state->emit_pos++;
+            }
+            if (state->emit_pos == count) {
+                state->emit_morsel++;
+                state->emit_pos = 0;
+            }
+        }
+        int next = state->wave_first + state->wave_size;
+        if (out->count > 0 || next >= state->morsel_count)
+            return out->count > 0;
+
+        state->wave_first = next;
+        state->wave_size = state->morsel_count - next < state->wave_cap ? state->morsel_count - next
+                                                                        : state->wave_cap;
+        for (int m = 0; m < state->wave_size; m++)
+            alist_clear(&state->pairs[m]);
+        state->emit_morsel = 0;
+        state->emit_pos = 0;
+        parallel_scan_run(state->parallel, next, state->wave_size, probe_morsel_batch, state);
+    }
+}
+
+bool hash_join_next(Operator *op, RowBatch *out) {
+    HashJoinState *state = op->state;
+    const JoinPlan *join = &op->plan->plan.join;
+    row_batch_reset(out, op->ctx->table_count);
+    if (!state->started) {
+        state->started = true;
+        if (!state->spilled)
+            start_parallel_probe(op, state);
+        else if (!partition_probe(op, state))
+            state->failed = true;
+    }
+    if (state->parallel)
+        return hash_join_next_parallel(join, state, out);
+
+    while (out->count < FILTER_BATCH_SIZE && !state->failed) {
+        if (state->probe_k >= state->input.count) {
+            if (!next_probe_batch(op, state))
+                break;
+            state->probe_k = 0;
+            state->in_bucket = false;
+        }
+
+        int probe_row = state->input.ids[state->probe_index][state->probe_k];
+        if (!state->in_bucket) {
+            state->probe_key = table_get_value(state->probe_table, probe_row, state->probe_column);
+            state->matched = false;
+            state->in_bucket = true;
+            state->entry = state->entry_end = 0;
+            if (!is_null(&state->probe_key)) {
+                state->probe_hash = value_hash(&state->probe_key);
+                const JoinPartition *part = partition_of(state, state->probe_hash);
+                uint32_t b = bucket_of(state, part, state->probe_hash);
+                state->entry = part->start[b];
+                state->entry_end = part->start[b + 1];
+            }
+        }
+
+        while (state->entry < state->entry_end && out->count < FILTER_BATCH_SIZE) {
+            int e = state->entry++;
+            if (state->hashes[e] != state->probe_hash)
+                continue;
+            int build_row = state->rows[e];
+            Value build_key = table_get_value(state->build_table, build_row, state->build_column);
+            if (!value_equals(&state->probe_key, &build_key))
+                continue;
+            state->matched = true;
+            if (state->probe_is_left)
+                emit_joined(out, join, &state->input, state->probe_k, probe_row, build_row);
+            else
+                emit_joined(out, join, NULL, 0, build_row, probe_row);
+        }
+        if (state->entry < state->entry_end)
+            break;
+
+        if (!state->matched && state->is_left_join) {
+            if (out->count >= FILTER_BATCH_SIZE)
+                break;
+            emit_joined(out, join, &state->input, state->probe_k, probe_row, -1);
+        }
+        state->probe_k++;
+        state->in_bucket = false;
+    }
+    return out->count > 0;
+}
+
+void hash_join_close(Operator *op) {
+    HashJoinState *state = op->state;
+    if (!state)
+        return;
+    parallel_scan_close(state->parallel);
+    state->parallel = NULL;
+    for (int m = 0; state->pairs && m < state->wave_cap; m++)
+        alist_destroy(&state->pairs[m]);
+    if (state->failed)
+        log_msg(LOG_ERROR, "hash_join: Failed to join the spilled partitions");
+    row_batch_free(&state->input);
+    alist_destroy(&state->build_ids);
+    memory_track(op->ctx->memory, &state->charged, 0);
+    spill_close(&state->current.build);
+    spill_close(&state->current.probe);
+    for (int p = 0; p < state->pending_count; p++) {
+        spill_close(&state->pending[p].build);
+        spill_close(&state->pending[p].probe);
+    }
+    free(state->pending);
+    arena_destroy(&state->partition_arena);
+}
+
+/* Evaluates the join condition over every pair; the right side is materialized once. */
+typedef struct {
+    RowBatch input;
+    RowBatch pair;
+    ArrayList right_ids; /* int */
+    int left_k;
+    int right_k;
+    bool matched;
+} NestedLoopState;
+
+bool nested_loop_join_open(Operator *op) {
+    NestedLoopState *state = arena_calloc(op->ctx->arena, 1, sizeof(NestedLoopState));
+    if (!state)
+        return false;
+    op->state = state;
+    row_batch_init(&state->input);
+    row_batch_init(&state->pair);
+    alist_init(&state->right_ids, sizeof(int), NULL);
+    if (!drain_ids(op->right, &state->input, &state->right_ids)) {
+        log_msg(LOG_ERROR, "nested_loop_join_open: Failed to materialize the joined table");
+        return false;
+    }
+    row_batch_reset(&state->input, 1);
+    row_batch_reset(&state->pair, op->ctx->table_count);
+    return true;
+}
+
+bool nested_loop_join_next(Operator *op, RowBatch *out) {
+    NestedLoopState *state = op->state;
+    const JoinPlan *join = &op->plan->plan.join;
+    const int *right_ids = (const int *)state->right_ids.data;
+    int right_count = alist_length(&state->right_ids);
+    row_batch_reset(out, op->ctx->table_count);
+
+    while (out->count < FILTER_BATCH_SIZE) {
+        if (state->left_k >= state->input.count) {
+            if (!operator_next(op->left, &state->input))
+                break;
+            state->left_k = 0;
+            state->right_k = 0;
+            state->matched = false;
+        }
+
+        int left_row = state->input.ids[0][state->left_k];
+        while (state->right_k < right_count && out->count < FILTER_BATCH_SIZE) {
+            int right_row = right_ids[state->right_k++];
+            if (join->condition) {
+                state->pair.count = 0;
+                emit_joined(&state->pair, join, &state->input, state->left_k, left_row,
+                            right_row);
+                const Row *row = context_row(op->ctx, &state->pair, 0);
+                if (!eval_expression(join->condition, row, op->ctx->schema))
+                    continue;
+            }
+            state->matched = true;
+            emit_joined(out, join, &state->input, state->left_k, left_row, right_row);
+        }
+        if (state->right_k < right_count)
+            break;
+
+        if (!state->matched && join->join_type == JOIN_LEFT) {
+            if (out->count >= FILTER_BATCH_SIZE)
+                break;
+            emit_joined(out, join, &state->input, state->left_k, left_row, -1);
+        }
+        state->left_k++;
+        state->right_k = 0;
+        state->matched = false;
+    }
+    return out->count > 0;
+}
+
+void nested_loop_join_close(Operator *op) {
+    NestedLoopState *state = op->state;
+    if (!state)
+        return;
+    row_batch_free(&state->input);
+    row_batch_free(&state->pair);
+    alist_destroy(&state->right_ids);
+}
+
+/* For every left row, looks its key up in an index of the right table and emits the matching
+   rows in row id order, after the right table's own predicate. Nothing of the right table is
+   read except the rows the index returns, which suits a small outer side. */
+typedef struct {
+    RowBatch input;
+    const Table *key_table;
+    const Table *table;
+    ArrayList candidates; /* int, ascending */
+    int sel[FILTER_BATCH_SIZE];
+    int sel_count;
+    int sel_pos;
+    int cand_pos;
+    int left_k;
+    bool in_row;
+    bool matched;
+    Row scratch;
+} IndexJoinState;
+
+bool index_nested_loop_join_open(Operator *op) {
+    const JoinPlan *join = &op->plan->plan.join;
+    IndexJoinState *state = arena_calloc(op->ctx->arena, 1, sizeof(IndexJoinState));
+    if (!state)
+        return false;
+    op->state = state;
+    row_batch_init(&state->input);
+    alist_init(&state->candidates, sizeof(int), NULL);
+    alist_init(&state->scratch, sizeof(Value), NULL);
+    state->key_table = op->ctx->tables[join->key_slot];
+    state->table = op->ctx->tables[join->right_slot];
+    log_msg(LOG_DEBUG, "index_nested_loop_join_open: Probing index '%s' of '%s'",
+            join->index->index_name, state->table->name);
+    return true;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/* Fills sel with the next candidates that pass the right table's predicate. */
+static bool next_candidates(const JoinPlan *join, IndexJoinState *state) {
+    int count = alist_length(&state->candidates);
+    const int *ids = (const int *)state->candidates.data;
+    while (state->cand_pos < count) {
+        int n = count - state->cand_pos < FILTER_BATCH_SIZE ? count - state->cand_pos
+                                                           : FILTER_BATCH_SIZE;
+        memcopy(state->sel, ids + state->cand_pos, sizeof(int) * (size_t)n);
+        state->cand_pos += n;
+        n = table_visible_rows(state->table, state->sel, n);
+        state->sel_count = filter_batch(state->table, join->right_filter, state->sel, n,
+                                        &state->scratch);
+        state->sel_pos = 0;
+        if (state->sel_count > 0)
+            return true;
+    }
+    return false;
+}
+
+bool index_nested_loop_join_next(Operator *op, RowBatch *out) {
+    IndexJoinState *state = op->state;
+    const JoinPlan *join = &op->plan->plan.join;
+    int key_index = join->left_slot < 0 ? join->key_slot : 0;
+    row_batch_reset(out, op->ctx->table_count);
+
+    while (out->count < FILTER_BATCH_SIZE) {
+        if (state->left_k >= state->input.count) {
+            if (!operator_next(op->left, &state->input))
+                break;
+            state->left_k = 0;
+            state->in_row = false;
+        }
+
+        int left_row = state->input.ids[key_index][state->left_k];
+        if (!state->in_row) {
+            state->in_row = true;
+            state->matched = false;
+            state->sel_count = state->sel_pos = state->cand_pos = 0;
+            alist_clear(&state->candidates);
+            Value key = table_get_value(state->key_table, left_row, join->left_column);
+            if (!is_null(&key)) {
+                lookup_index_values(join->index, &key, &state->candidates);
+                op->index_hits += (uint64_t)alist_length(&state->candidates);
+                qsort(state->candidates.data, (size_t)alist_length(&state->candidates),
+                      sizeof(int), compare_ids);
+            }
+        }
+
+        while (out->count < FILTER_BATCH_SIZE &&
+               (state->sel_pos < state->sel_count || next_candidates(join, state))) {
+            state->matched = true;
+            emit_joined(out, join, &state->input, state->left_k, left_row,
+                        state->sel[state->sel_pos++]);
+        }
+        if (state->sel_pos < state->sel_count || state->cand_pos < alist_length(&state->candidates))
+            break;
+
+        if (!state->matched && join->join_type == JOIN_LEFT) {
+            if (out->count >= FILTER_BATCH_SIZE)
+                break;
+            emit_joined(out, join, &state->input, state->left_k, left_row, -1);
+        }
+        state->left_k++;
+        state->in_row = false;
+    }
+    return out->count > 0;
+}
+
+void index_nested_loop_join_close(Operator *op) {
+    IndexJoinState *state = op->state;
+    if (!state)
+        return;
+    row_batch_free(&state->input);
+    alist_destroy(&state->candidates);
+    alist_destroy(&state->scratch);
+}
@@ -0,0 +1,879 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "sketch.h"
+#include "storage.h"
+#include "table.h"
+#include "txn.h"
+#include "utils.h"
+#include "values.h"
+
+/* Materialized views, see MatViewStats. A view reads one table, or two joined on an INNER
+   JOIN, and either groups them (GROUP BY columns and aggregates over them) or, without
+   aggregates, keeps the matching rows' columns: then every distinct row is a group and its
+   row count the number of copies in the view. The view reads the latest commits, as a
+   statement outside a transaction does. */
+
+/* One aggregate of the SELECT; COUNT(*) has no operand and counts the group's rows. */
+typedef struct {
+    AggFuncType func;
+    const Expr *operand;
+    double fraction; /* APPROX_PERCENTILE's */
+    DataType type;   /* of its column */
+} ViewAgg;
+
+/* A column of the view table: a group key or an aggregate, by number. */
+typedef struct {
+    bool key;
+    int index;
+} ViewColumn;
+
+typedef struct {
+    Value *keys;    /* key_count values, owned */
+    AggState *aggs; /* agg_count states */
+    long long rows; /* input rows in the group */
+} ViewGroup;
+
+struct MatView {
+    uint16_t table_id;
+    char *sql;
+    ASTNode *ast; /* the parsed SELECT; the expressions below point into it */
+    const SelectNode *select;
+    uint16_t bases[2]; /* the FROM table, then the joined one */
+    int base_count;
+    TableDef join_schema; /* a joined row: the FROM table's columns, then the other's */
+    int offset;     /* the joined table's first column in a joined row */
+    int join_left;  /* an equality join condition's columns in a joined row, else -1 */
+    int join_right;
+    const Expr **keys;
+    int key_count;
+    ViewAgg *aggs;
+    int agg_count;
+    ViewColumn *columns;
+    int column_count;
+    bool multiset; /* no aggregates: a group is a distinct row, its rows the copies */
+    ViewGroup *groups;
+    int group_count;
+    int group_cap;
+    int empty_groups;
+    uint32_t *slots; /* group index + 1, 0 when empty */
+    uint32_t slot_mask;
+    Value *values; /* the keys, then an operand per aggregate, of the row being folded */
+    Expr one;      /* stands in for the operand of COUNT(*) in a refresh */
+    Row scratch;
+    bool stale; /* the groups must be recomputed from the base tables */
+    bool dirty; /* the table must be rewritten from the groups */
+};
+
+#define VIEW_INITIAL_SLOTS 16
+
+static ArrayList g_views; /* MatView* */
+static MatViewStats g_stats;
+
+static const char *const agg_names[] = {"count", "sum", "avg", "min", "max", "stddev",
+                                        "variance", "approx_count_distinct",
+                                        "approx_percentile"};
+
+void matview_get_stats(MatViewStats *stats) {
+    *stats = g_stats;
+}
+
+/* The columns of the rows the view reads; looked up each time, as tables move in the catalog. */
+static const TableDef *view_schema(const MatView *view) {
+    if (view->base_count == 2)
+        return &view->join_schema;
+    const Table *table = get_table_by_id(view->bases[0]);
+    return table ? &table->schema : NULL;
+}
+
+static void invalidate(MatView *view) {
+    if (view->stale)
+        return;
+    view->stale = true;
+    g_stats.invalidations++;
+}
+
+/* Groups. */
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t hash_keys(const Value *keys, int count) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < count; i++)
+        hash = mix64(hash ^ value_hash(&keys[i]));
+    return hash;
+}
+
+static bool keys_equal(const Value *a, const Value *b, int count) {
+    for (int i = 0; i < count; i++)
+        if (!value_equals(&a[i], &b[i]))
+            return false;
+    return true;
+}
+
+static uint32_t *probe_slot(const MatView *view, const Value *keys) {
+    uint32_t i = (uint32_t)hash_keys(keys, view->key_count) & view->slot_mask;
+    while (view->slots[i] &&
+           !keys_equal(view->groups[view->slots[i] - 1].keys, keys, view->key_count))
+        i = (i + 1) & view->slot_mask;
+    return &view->slots[i];
+}
+
+static bool rehash_groups(MatView *view, uint32_t capacity) {
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+    if (!slots) {
+        log_msg(LOG_ERROR, "Materialized view: Out of memory for %u group slots", capacity);
+        return false;
+    }
+    free(view->slots);
+    view->slots = slots;
+    view->slot_mask = capacity - 1;
+    for (int g = 0; g < view->group_count; g++)
+        *probe_slot(view, view->groups[g].keys) = (uint32_t)g + 1;
+    return true;
+}
+
+static void free_group(MatView *view, ViewGroup *group) {
+    for (int k = 0; k < view->key_count; k++)
+        free_value(&group->keys[k]);
+    for (int a = 0; a < view->agg_count; a++)
+        agg_cleanup(&group->aggs[a]);
+    free(group->keys);
+    free(group->aggs);
+}
+
+static ViewGroup *find_group(MatView *view, const Value *keys, bool create) {
+    uint32_t *slot = probe_slot(view, keys);
+    if (*slot)
+        return &view->groups[*slot - 1];
+    if (!create)
+        return NULL;
+    if ((uint32_t)(view->group_count + 1) * 2 > view->slot_mask + 1) {
+        if (!rehash_groups(view, (view->slot_mask + 1) * 2))
+            return NULL;
+        slot = probe_slot(view, keys);
+    }
+    if (view->group_count == view->group_cap) {
+        int cap = view->group_cap > 0 ? view->group_cap * 2 : VIEW_INITIAL_SLOTS;
+        ViewGroup *groups = realloc(view->groups, sizeof(ViewGroup) * (size_t)cap);
+        if (!groups)
+            return NULL;
+        view->groups = groups;
+        view->group_cap = cap;
+    }
+    ViewGroup *group = &view->groups[view->group_count];
+    group->keys = calloc((size_t)(view->key_count > 0 ? view->key_count : 1), sizeof(Value));
+    group->aggs = calloc((size_t)(view->agg_count > 0 ? view->agg_count : 1), sizeof(AggState));
+    if (!group->keys || !group->aggs) {
+        free(group->keys);
+        free(group->aggs);
+        return NULL;
+    }
+    for (int k = 0; k < view->key_count; k++)
+        group->keys[k] = copy_value(&keys[k]);
+    for (int a = 0; a < view->agg_count; a++)
+        agg_init(&group->aggs[a], view->aggs[a].func, false);
+    group->rows = 0;
+    *slot = (uint32_t)++view->group_count;
+    view->empty_groups++;
+    return group;
+}
+
+/* Empties the groups; a view without GROUP BY keys always has its one. */
+static void clear_groups(MatView *view) {
+    for (int g = 0; g < view->group_count; g++)
+        free_group(view, &view->groups[g]);
+    view->group_count = 0;
+    view->empty_groups = 0;
+    memclear(view->slots, sizeof(uint32_t) * (view->slot_mask + 1));
+    if (!view->multiset && view->key_count == 0)
+        find_group(view, NULL, true);
+}
+
+/* Drops the groups left without rows once they are half of them. */
+static void compact_groups(MatView *view) {
+    if (view->key_count == 0 || view->empty_groups * 2 <= view->group_count)
+        return;
+    int kept = 0;
+    for (int g = 0; g < view->group_count; g++) {
+        if (view->groups[g].rows == 0)
+            free_group(view, &view->groups[g]);
+        else
+            view->groups[kept++] = view->groups[g];
+    }
+    view->group_count = kept;
+    view->empty_groups = 0;
+    uint32_t capacity = VIEW_INITIAL_SLOTS;
+    while ((uint32_t)kept * 2 > capacity)
+        capacity *= 2;
+    if (!rehash_groups(view, capacity))
+        invalidate(view);
+}
+
+/* Folds view->values, the keys and operands of one input row, into or out of its group;
+   false when the group cannot take the row back out. */
+static bool fold_values(MatView *view, int sign) {
+    ViewGroup *group = find_group(view, view->values, sign > 0);
+    if (!group || group->rows + sign < 0)
+        return false;
+    group->rows += sign;
+    view->empty_groups += group->rows == 0 ? 1 : (group->rows == 1 && sign > 0 ? -1 : 0);
+    Value *operands = view->values + view->key_count;
+    for (int a = 0; a < view->agg_count; a++) {
+        if (!view->aggs[a].operand)
+            continue;
+        if (sign > 0)
+            agg_add_value(&group->aggs[a], &operands[a]);
+        else if (!agg_remove_value(&group->aggs[a], &operands[a]))
+            return false;
+    }
+    view->dirty = true;
+    return true;
+}
+
+/* Deltas. */
+
+static Value eval_value(const Expr *expr, const Row *row, const TableDef *schema) {
+    if (expr->type == EXPR_COLUMN) {
+        Value val = get_column_value_by_id(row, expr->column.column_id);
+        return copy_value(&val);
+    }
+    return eval_select_expression((Expr *)expr, row, schema);
+}
+
+/* Folds one input row in or out when it passes condition (the join's) and the WHERE. */
+static void fold_row(MatView *view, const Row *row, const Expr *condition, int sign) {
+    const Expr *where = view->select->where_clause;
+    const TableDef *schema = view_schema(view);
+    if (view->stale || (condition && !eval_expression(condition, row, schema)) ||
+        (where && !eval_expression(where, row, schema)))
+        return;
+    Value null_val = {0};
+    null_val.type = TYPE_NULL;
+    for (int k = 0; k < view->key_count; k++)
+        view->values[k] = eval_value(view->keys[k], row, schema);
+    for (int a = 0; a < view->agg_count; a++) {
+        const Expr *operand = view->aggs[a].operand;
+        view->values[view->key_count + a] =
+            operand ? eval_value(operand, row, schema) : null_val;
+    }
+    bool ok = fold_values(view, sign);
+    for (int v = 0; v < view->key_count + view->agg_count; v++)
+        free_value(&view->values[v]);
+    if (ok)
+        g_stats.deltas++;
+    else
+        invalidate(view);
+}
+
+static const Row *joined_row(MatView *view, const Table *const pair[2], const int rows[2]) {
+    Row *row = &view->scratch;
+    alist_truncate(row, 0);
+    for (int t = 0; t < 2; t++)
+        for (int c = 0; c < alist_length(&pair[t]->schema.columns); c++)
+            *(Value *)alist_append(row) = table_get_value(pair[t], rows[t], (uint16_t)c);
+    return row;
+}
+
+/* Pairs the changed row with every live row of the other table it may join: those an index
+   on the other side of an equality condition finds, or else all of them. */
+static void fold_join(MatView *view, const Table *table, int row_idx, int sign) {
+    int side = table->table_id == view->bases[0] ? 0 : 1;
+    const Table *other = get_table_by_id(view->bases[1 - side]);
+    if (!other || view->bases[0] == view->bases[1]) {
+        invalidate(view);
+        return;
+    }
+    const Table *pair[2];
+    int rows[2];
+    pair[side] = table;
+    pair[1 - side] = other;
+    rows[side] = row_idx;
+
+    ArrayList matches;
+    alist_init(&matches, sizeof(int), NULL);
+    bool probed = false;
+    if (view->join_left >= 0) {
+        int mine = side == 0 ? view->join_left : view->join_right - view->offset;
+        int theirs = side == 0 ? view->join_right - view->offset : view->join_left;
+        Index *index = find_index_by_table_column(other->table_id, (uint16_t)theirs);
+        if (index) {
+            Value key = table_get_value(table, row_idx, (uint16_t)mine);
+            if (!is_null(&key))
+                lookup_index_values(index, &key, &matches);
+            probed = true;
+        }
+    }
+    int count = probed ? alist_length(&matches) : table_row_count(other);
+    for (int i = 0; i < count && !view->stale; i++) {
+        int r = probed ? *(int *)alist_get(&matches, i) : i;
+        if (!table_row_live(other, r))
+            continue;
+        rows[1 - side] = r;
+        fold_row(view, joined_row(view, pair, rows), view->select->joins[0].condition, sign);
+    }
+    alist_destroy(&matches);
+}
+
+/* A join view cannot tell at commit which of the other table's rows were there before the
+   transaction, so it is refreshed instead. */
+static void row_changed(const Table *table, int row_idx, bool added, bool committed) {
+    for (int i = 0; i < alist_length(&g_views); i++) {
+        MatView *view = *(MatView **)alist_get(&g_views, i);
+        if (view->stale ||
+            (view->bases[0] != table->table_id &&
+             (view->base_count < 2 || view->bases[1] != table->table_id)))
+            continue;
+        if (view->base_count == 2 && committed) {
+            invalidate(view);
+        } else if (view->base_count == 2) {
+            fold_join(view, table, row_idx, added ? 1 : -1);
+        } else {
+            const Row *row = table_fetch_row(table, row_idx, &view->scratch);
+            if (row)
+                fold_row(view, row, NULL, added ? 1 : -1);
+        }
+    }
+}
+
+/* Called by INSERT, UPDATE, DELETE and COPY for each row they change in place: after a row
+   is added and before one is removed. */
+void matview_row_changed(const Table *table, int row_idx, bool added) {
+    if (alist_length(&g_views) > 0)
+        row_changed(table, row_idx, added, false);
+}
+
+/* Called at commit for each row version the transaction added or ended. */
+void matview_row_committed(const Table *table, int row_idx, bool added) {
+    if (alist_length(&g_views) > 0)
+        row_changed(table, row_idx, added, true);
+}
+
+/* Reads. */
+
+/* Recomputes the groups by running the SELECT without its grouping: the keys and the
+   aggregates' operands of every input row. It reads the latest commits, whichever
+   transaction asks. */
+static bool refresh(MatView *view) {
+    SelectNode core = *view->select;
+    alist_init(&core.expressions, sizeof(Expr *), NULL);
+    alist_init(&core.group_by, sizeof(Expr *), NULL);
+    alist_init(&core.order_by, sizeof(Expr *), NULL);
+    alist_init(&core.order_by_desc, sizeof(bool), NULL);
+    core.order_by_count = 0;
+    for (int k = 0; k < view->key_count; k++)
+        *(const Expr **)alist_append(&core.expressions) = view->keys[k];
+    for (int a = 0; a < view->agg_count; a++)
+        *(const Expr **)alist_append(&core.expressions) =
+            view->aggs[a].operand ? view->aggs[a].operand : &view->one;
+
+    Transaction *txn = txn_current() ? txn_detach() : NULL;
+    QueryResult *result = exec_select_query(&core);
+    if (txn)
+        txn_attach(txn);
+    alist_destroy(&core.expressions);
+    alist_destroy(&core.group_by);
+    alist_destroy(&core.order_by);
+    alist_destroy(&core.order_by_desc);
+    if (!result) {
+        log_msg(LOG_ERROR, "Materialized view: Failed to recompute '%s'", view->sql);
+        return false;
+    }
+
+    clear_groups(view);
+    int width = view->key_count + view->agg_count;
+    bool ok = true;
+    for (int r = 0; r < alist_length(&result->rows) && ok; r++) {
+        for (int v = 0; v < width; v++)
+            view->values[v] = *(Value *)alist_get(&result->values, r * result->col_count + v);
+        ok = fold_values(view, 1);
+    }
+    free_query_result(result);
+    if (!ok) {
+        log_msg(LOG_ERROR, "Materialized view: Out of memory recomputing '%s'", view->sql);
+        return false;
+    }
+    view->stale = false;
+    view->dirty = true;
+    g_stats.refreshes++;
+    return true;
+}
+
+/* What an aggregate gives for its group, as the GROUP BY operator (or, for the one group
+   of a view without keys, the Aggregate operator) would. */
+static Value agg_value(const MatView *view, const ViewGroup *group, int a) {
+    const ViewAgg *agg = &view->aggs[a];
+    const AggState *state = &group->aggs[a];
+    Value result = {0};
+    if (agg->func == FUNC_COUNT) {
+        result.type = TYPE_INT;
+        result.int_val = agg->operand ? (long long)state->count : group->rows;
+        return result;
+    }
+    if (sketch_function(agg->func))
+        return sketch_result(state->sketch, agg->func, agg->fraction);
+    if (state->count == 0) {
+        result.type = TYPE_NULL;
+        return result;
+    }
+    if (agg->func == FUNC_MIN || agg->func == FUNC_MAX) {
+        result = copy_value(agg->func == FUNC_MIN ? &state->data.min.min_val
+                                                  : &state->data.max.max_val);
+        if (agg->type == TYPE_FLOAT && result.type == TYPE_INT) {
+            result.type = TYPE_FLOAT;
+            result.float_val = (double)result.int_val;
+        }
+        return result;
+    }
+    result.type = TYPE_FLOAT;
+    if (agg->func == FUNC_SUM && agg->type == TYPE_INT && !state->has_float &&
+        !state->int_overflow) {
+        result.type = TYPE_INT;
+        result.int_val = state->int_sum;
+    } else if (agg->func == FUNC_SUM) {
+        result.float_val = state->sum;
+    } else if (agg->func == FUNC_AVG) {
+        result.float_val = state->sum / state->count;
+    } else if (state->count < 2) {
+        result.type = TYPE_NULL;
+    } else {
+        result.float_val = state->m2 / (state->count - 1);
+        if (agg->func == FUNC_STDDEV)
+            result.float_val = sqrt(result.float_val);
+    }
+    return result;
+}
+
+/* Rewrites the view's table from its groups. */
+static bool rebuild(MatView *view, Table *table) {
+    compact_groups(view);
+    int old_count = table_row_count(table);
+    if (old_count > 0) {
+        bool *keep = calloc((size_t)old_count, sizeof(bool));
+        if (!keep) {
+            log_msg(LOG_ERROR, "Materialized view: Out of memory rewriting '%s'", table->name);
+            return false;
+        }
+        table_compact_rows(table, keep);
+        free(keep);
+    }
+    for (int g = 0; g < view->group_count; g++) {
+        const ViewGroup *group = &view->groups[g];
+        long long copies = view->multiset ? group->rows : (group->rows > 0 || !view->key_count);
+        for (long long c = 0; c < copies; c++) {
+            Row row;
+            if (!table_row_init(table, &row))
+                return false;
+            for (int i = 0; i < view->column_count; i++) {
+                const ViewColumn *col = &view->columns[i];
+                *(Value *)alist_append(&row) = col->key ? copy_value(&group->keys[col->index])
+                                                        : agg_value(view, group, col->index);
+            }
+            if (!table_append_row(table, &row))
+                return false;
+        }
+    }
+    view->dirty = false;
+    g_stats.rebuilds++;
+    return true;
+}
+
+/* Brings table_id's rows up to date before a query reads it, when it holds a view. */
+void matview_sync(uint16_t table_id) {
+    Table *table = get_table_by_id(table_id);
+    MatView *view = table ? table->view : NULL;
+    if (!view || (!view->stale && !view->dirty))
+        return;
+    if (view->stale && !refresh(view)) {
+        invalidate(view);
+        return;
+    }
+    table = get_table_by_id(table_id);
+    if (table && !rebuild(view, table))
+        invalidate(view);
+}
+
+/* Definition. */
+
+static void reject(const char *name, const char *reason) {
+    log_msg(LOG_ERROR, "Cannot create materialized view '%s': %s", name, reason);
+}
+
+/* No aggregate and no subquery anywhere in expr. */
+static bool expr_plain(const Expr *expr) {
+    if (!expr)
+        return true;
+    switch (expr->type) {
+    case EXPR_AGGREGATE_FUNC:
+    case EXPR_SUBQUERY:
+        return false;
+    case EXPR_BINARY_OP:
+        return expr_plain(expr->binary.left) && expr_plain(expr->binary.right);
+    case EXPR_UNARY_OP:
+        return expr_plain(expr->unary.operand);
+    case EXPR_SCALAR_FUNC:
+        for (int i = 0; i < expr->scalar.arg_count; i++)
+            if (!expr_plain(expr->scalar.args[i]))
+                return false;
+        return true;
+    default:
+        return true;
+    }
+}
+
+static bool is_star(const Expr *expr) {
+    return expr->type == EXPR_VALUE && expr->value.type == TYPE_STRING &&
+           strcmp(value_str(&expr->value), "*") == 0;
+}
+
+static bool bind_tables(MatView *view, const char *name) {
+    const SelectNode *select = view->select;
+    if (select->join_count > 1 ||
+        (select->join_count == 1 && select->joins[0].type != JOIN_INNER)) {
+        reject(name, "a view reads one table or two joined by an INNER JOIN");
+        return false;
+    }
+    view->bases[0] = select->table_id;
+    view->base_count = 1 + select->join_count;
+    if (select->join_count == 1)
+        view->bases[1] = select->joins[0].table_id;
+    const Table *tables[2] = {NULL, NULL};
+    for (int t = 0; t < view->base_count; t++) {
+        tables[t] = get_table_by_id(view->bases[t]);
+        if (!tables[t] || tables[t]->view) {
+            reject(name, tables[t] ? "a view cannot read another materialized view"
+                                   : "its table does not exist");
+            return false;
+        }
+    }
+    view->join_left = view->join_right = -1;
+    if (view->base_count == 1)
+        return true;
+
+    alist_init(&view->join_schema.columns, sizeof(ColumnDef), NULL);
+    alist_init(&view->join_schema.check_constraints, sizeof(Expr *), NULL);
+    for (int t = 0; t < 2; t++)
+        for (int c = 0; c < alist_length(&tables[t]->schema.columns); c++)
+            *(ColumnDef *)alist_append(&view->join_schema.columns) =
+                *(const ColumnDef *)alist_get(&tables[t]->schema.columns, c);
+    view->offset = alist_length(&tables[0]->schema.columns);
+    const Expr *cond = select->joins[0].condition;
+    if (cond && cond->type == EXPR_BINARY_OP && cond->binary.op == OP_EQUALS &&
+        cond->binary.left->type == EXPR_COLUMN && cond->binary.right->type == EXPR_COLUMN) {
+        int a = cond->binary.left->column.column_id;
+        int b = cond->binary.right->column.column_id;
+        if ((a < view->offset) != (b < view->offset)) {
+            view->join_left = a < b ? a : b;
+            view->join_right = a < b ? b : a;
+        }
+    }
+    return true;
+}
+
+static bool add_column(MatView *view, const char *name, const Expr *expr, ViewColumn col,
+                       DataType type, ArrayList *defs) {
+    const char *col_name = expr->alias;
+    if (!col_name[0] && expr->type == EXPR_COLUMN)
+        col_name = ((const ColumnDef *)alist_get(&view_schema(view)->columns,
+                                                 expr->column.column_id))->name;
+    else if (!col_name[0])
+        col_name = agg_names[expr->aggregate.func_type];
+    for (int i = 0; i < alist_length(defs); i++) {
+        if (strcasecmp(((const ColumnDef *)alist_get(defs, i))->name, col_name) == 0) {
+            log_msg(LOG_ERROR, "Cannot create materialized view '%s': two columns are named "
+                    "'%s', rename one with AS", name, col_name);
+            return false;
+        }
+    }
+    ColumnDef *def = (ColumnDef *)alist_append(defs);
+    memclear(def, sizeof(ColumnDef));
+    strcopy(def->name, sizeof(def->name), col_name);
+    def->type = type;
+    view->columns[view->column_count++] = col;
+    return true;
+}
+
+static DataType column_type(const MatView *view, const Expr *expr) {
+    const TableDef *schema = view_schema(view);
+    return ((const ColumnDef *)alist_get(&schema->columns, expr->column.column_id))->type;
+}
+
+/* The SELECT's outputs become the view table's columns, defs (ColumnDef). */
+static bool bind_outputs(MatView *view, const char *name, ArrayList *defs) {
+    const SelectNode *select = view->select;
+    Arena *arena = view->ast->arena;
+    ArrayList outputs = select->expressions;
+    int count = alist_length(&outputs);
+    const Expr *first = count > 0 ? *(Expr **)alist_get(&outputs, 0) : NULL;
+    const Expr **exprs;
+    if (first && is_star(first)) {
+        count = alist_length(&view_schema(view)->columns);
+        exprs = arena_calloc(arena, (size_t)count, sizeof(Expr *));
+        for (int c = 0; exprs && c < count; c++) {
+            Expr *col = arena_calloc(arena, 1, sizeof(Expr));
+            if (!col)
+                return false;
+            col->type = EXPR_COLUMN;
+            col->column.table_id = view->bases[view->base_count == 2 && c >= view->offset];
+            col->column.column_id = (uint16_t)c;
+            exprs[c] = col;
+        }
+    } else {
+        exprs = arena_calloc(arena, (size_t)(count > 0 ? count : 1), sizeof(Expr *));
+        for (int i = 0; exprs && i < count; i++)
+            exprs[i] = *(Expr **)alist_get(&outputs, i);
+    }
+    int group_count = alist_length(&select->group_by);
+    view->keys = arena_calloc(arena, (size_t)(count + group_count + 1), sizeof(Expr *));
+    view->aggs = arena_calloc(arena, (size_t)(count + 1), sizeof(ViewAgg));
+    view->columns = arena_calloc(arena, (size_t)(count + 1), sizeof(ViewColumn));
+    if (!exprs || !view->keys || !view->aggs || !view->columns)
+        return false;
+
+    bool grouped = group_count > 0;
+    for (int i = 0; i < count; i++)
+        grouped |= exprs[i]->type == EXPR_AGGREGATE_FUNC;
+    view->multiset = !grouped;
+    for (int g = 0; g < group_count; g++) {
+        const Expr *key = *(Expr **)alist_get(&select->group_by, g);
+        if (key->type != EXPR_COLUMN) {
+            reject(name, "GROUP BY takes columns");
+            return false;
+        }
+        view->keys[view->key_count++] = key;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const Expr *expr = exprs[i];
+        if (expr->type == EXPR_AGGREGATE_FUNC) {
+            const Expr *operand = expr->aggregate.count_all ? NULL : expr->aggregate.operand;
+            AggFuncType func = expr->aggregate.func_type;
+            if (expr->aggregate.distinct || !expr_plain(operand) ||
+                (!operand && func != FUNC_COUNT)) {
+                reject(name, "aggregates take a plain expression and no DISTINCT");
+                return false;
+            }
+            /* As the operator types them; see numeric_agg_result. */
+            DataType operand_type = agg_operand_type(operand, view_schema(view));
+            DataType type = TYPE_FLOAT;
+            if (func == FUNC_COUNT || func == FUNC_APPROX_COUNT_DISTINCT)
+                type = TYPE_INT;
+            else if ((func == FUNC_MIN || func == FUNC_MAX) && operand_type != TYPE_ERROR)
+                type = operand_type;
+            else if (func == FUNC_SUM && operand_type == TYPE_INT)
+                type = TYPE_INT;
+            view->aggs[view->agg_count] =
+                (ViewAgg){func, operand, expr->aggregate.fraction, type};
+            if (!add_column(view, name, expr, (ViewColumn){false, view->agg_count++}, type,
+                            defs))
+                return false;
+            continue;
+        }
+        if (expr->type != EXPR_COLUMN) {
+            reject(name, "its columns are table columns and aggregates");
+            return false;
+        }
+        int k = 0;
+        while (k < view->key_count && view->keys[k]->column.column_id != expr->column.column_id)
+            k++;
+        if (grouped && k == view->key_count) {
+            log_msg(LOG_ERROR, "Cannot create materialized view '%s': column '%s' must be in "
+                    "GROUP BY or an aggregate", name,
+                    ((const ColumnDef *)alist_get(&view_schema(view)->columns,
+                                                  expr->column.column_id))->name);
+            return false;
+        }
+        if (!grouped)
+            view->keys[view->key_count++] = expr;
+        if (!add_column(view, name, expr, (ViewColumn){true, grouped ? k : view->key_count - 1},
+                        column_type(view, expr), defs))
+            return false;
+    }
+    return true;
+}
+
+static void view_close(MatView *view) {
+    if (!view)
+        return;
+    if (view->slots)
+        clear_groups(view);
+    for (int g = 0; g < view->group_count; g++)
+        free_group(view, &view->groups[g]);
+    free(view->groups);
+    free(view->slots);
+    free(view->values);
+    alist_destroy(&view->scratch);
+    if (view->join_schema.columns.data) {
+        alist_destroy(&view->join_schema.columns);
+        alist_destroy(&view->join_schema.check_constraints);
+    }
+    free_ast(view->ast);
+    free(view->sql);
+    free(view);
+}
+
+/* Parses and checks the view's SELECT, filling defs with the columns of its table. The view
+   starts out stale: its first read computes it. */
+static MatView *view_open(const char *name, const char *sql, ArrayList *defs) {
+    MatView *view = calloc(1, sizeof(MatView));
+    if (!view)
+        return NULL;
+    alist_init(&view->scratch, sizeof(Value), NULL);
+    view->sql = strdup(sql);
+    Token *tokens = view->sql ? tokenize(sql) : NULL;
+    view->ast = tokens ? parse_ex(sql, tokens) : NULL;
+    free_tokens(tokens);
+    if (!view->ast || view->ast->type != AST_SELECT || view->ast->next) {
+        reject(name, "its query must be a single SELECT");
+        view_close(view);
+        return NULL;
+    }
+    view->select = &view->ast->select;
+    const SelectNode *select = view->select;
+    if (select->distinct || select->having || alist_length(&select->order_by) > 0 ||
+        select->limit > 0 || view->ast->param_count > 0) {
+        reject(name, "DISTINCT, HAVING, ORDER BY, LIMIT and parameters are not supported");
+        view_close(view);
+        return NULL;
+    }
+    if (!bind_tables(view, name)) {
+        view_close(view);
+        return NULL;
+    }
+    if (!expr_plain(select->where_clause) ||
+        (select->join_count == 1 && !expr_plain(select->joins[0].condition))) {
+        reject(name, "its conditions cannot hold subqueries or aggregates");
+        view_close(view);
+        return NULL;
+    }
+    if (!bind_outputs(view, name, defs)) {
+        view_close(view);
+        return NULL;
+    }
+    view->one.type = EXPR_VALUE;
+    view->one.value.type = TYPE_INT;
+    view->one.value.int_val = 1;
+    view->values = calloc((size_t)(view->key_count + view->agg_count), sizeof(Value));
+    if (!view->values || !rehash_groups(view, VIEW_INITIAL_SLOTS)) {
+        view_close(view);
+        return NULL;
+    }
+    clear_groups(view);
+    view->stale = true;
+    return view;
+}
+
+static void register_view(MatView *view, Table *table) {
+    if (!g_views.data)
+        alist_init(&g_views, sizeof(MatView *), NULL);
+    view->table_id = table->table_id;
+    table->view = view;
+    *(MatView **)alist_append(&g_views) = view;
+}
+
+void exec_create_view_ast(ASTNode *ast) {
+    CreateViewNode *cv = &ast->create_view;
+    if (find_table_id_by_name(cv->name) != 0) {
+        log_msg(LOG_WARN, "Table '%s' already exists", cv->name);
+        return;
+    }
+    uint16_t table_id = next_table_id();
+    if (table_id == 0) {
+        log_msg(LOG_ERROR, "create_view: Maximum table limit (%d) reached", MAX_TABLES);
+        return;
+    }
+    ArrayList defs;
+    alist_init(&defs, sizeof(ColumnDef), NULL);
+    MatView *view = view_open(cv->name, cv->sql, &defs);
+    Table *table = view ? (Table *)alist_append(&tables) : NULL;
+    if (!table) {
+        alist_destroy(&defs);
+        view_close(view);
+        return;
+    }
+
+    memclear(table, sizeof(Table));
+    strcopy(table->name, sizeof(table->name), cv->name);
+    table->table_id = table_id;
+    table->storage = STORAGE_ROW;
+    alist_init(&table->rows, sizeof(Row), NULL);
+    alist_init(&table->schema.columns, sizeof(ColumnDef), NULL);
+    for (int i = 0; i < alist_length(&defs); i++)
+        *(ColumnDef *)alist_append(&table->schema.columns) = *(ColumnDef *)alist_get(&defs, i);
+    alist_destroy(&defs);
+    register_view(view, table);
+    catalog_changed();
+    wal_log_create_view(cv->name, view->sql);
+    log_msg(LOG_INFO, "Created materialized view '%s' with %d columns over %d table%s "
+            "table_id=%d", cv->name, view->column_count, view->base_count,
+            view->base_count > 1 ? "s" : "", table_id);
+}
+
+/* Puts a view loaded from a snapshot back on its table. */
+bool matview_attach(uint16_t table_id, const char *sql) {
+    Table *table = get_table_by_id(table_id);
+    if (!table)
+        return false;
+    ArrayList defs;
+    alist_init(&defs, sizeof(ColumnDef), NULL);
+    MatView *view = view_open(table->name, sql, &defs);
+    bool ok = view && alist_length(&defs) == alist_length(&table->schema.columns);
+    alist_destroy(&defs);
+    if (!ok) {
+        view_close(view);
+        log_msg(LOG_ERROR, "Materialized view '%s' no longer matches its table", table->name);
+        return false;
+    }
+    register_view(view, get_table_by_id(table_id));
+    return true;
+}
+
+/* Called as the view's table is freed. */
+void matview_free(MatView *view) {
+    for (int i = 0; i < alist_length(&g_views); i++) {
+        if (*(MatView **)alist_get(&g_views, i) == view) {
+            alist_remove(&g_views, i);
+            break;
+        }
+    }
+    view_close(view);
+}
+
+const char *matview_sql(const MatView *view) {
+    return view->sql;
+}
+
+/* The name of a view that reads table_id, NULL when none does. */
+const char *matview_reader(uint16_t table_id) {
+    for (int i = 0; i < alist_length(&g_views); i++) {
+        const MatView *view = *(MatView **)alist_get(&g_views, i);
+        if (view->bases[0] == table_id || (view->base_count == 2 && view->bases[1] == table_id)) {
+            const Table *table = get_table_by_id(view->table_id);
+            return table ? table->name : "?";
+        }
+    }
+    return NULL;
+}
+
+/* Only the view itself writes its table. */
+bool matview_writable(const Table *table, const char *statement) {
+    if (!table->view)
+        return true;
+    log_msg(LOG_ERROR, "%s: '%s' is a materialized view and cannot be written", statement,
+            table->name);
+    return false;
+}
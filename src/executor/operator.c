@@ -0,0 +1,765 @@
+#include <stdlib.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "metrics.h"
+#include "table.h"
+#include "txn.h"
+#include "utils.h"
+#include "values.h"
+
+static bool init_join_schema(ExecContext *ctx) {
+    TableDef *schema = &ctx->join_schema;
+    alist_init(&schema->columns, sizeof(ColumnDef), NULL);
+    alist_init(&schema->check_constraints, sizeof(Expr *), NULL);
+    schema->strict = false;
+
+    for (int t = 0; t < ctx->table_count; t++) {
+        const ArrayList *columns = &ctx->tables[t]->schema.columns;
+        ctx->column_offset[t] = alist_length(&schema->columns);
+        for (int i = 0; i < alist_length(columns); i++) {
+            ColumnDef *slot = (ColumnDef *)alist_append(&schema->columns);
+            if (!slot)
+                return false;
+            *slot = *(ColumnDef *)alist_get(columns, i);
+        }
+    }
+    ctx->schema = schema;
+    return true;
+}
+
+/* Shared by every query: each context rolls it back to where it found it, so nested
+   subqueries release only their own allocations and a warm arena stops calling malloc. */
+static Arena g_query_arena;
+
+bool exec_context_init(ExecContext *ctx, const SelectNode *select) {
+    if (g_query_arena.block_size == 0)
+        arena_init(&g_query_arena, ARENA_BLOCK_SIZE);
+    return exec_context_init_in(ctx, select, &g_query_arena);
+}
+
+/* As exec_context_init, with the operators allocated from arena instead of the shared one. */
+bool exec_context_init_in(ExecContext *ctx, const SelectNode *select, Arena *arena) {
+    /* Materialized views are brought up to date as they are read. */
+    matview_sync(select->table_id);
+    for (int j = 0; j < select->join_count; j++)
+        matview_sync(select->joins[j].table_id);
+    memclear(ctx, sizeof(ExecContext));
+    alist_init(&ctx->scratch, sizeof(Value), NULL);
+    ctx->arena = arena;
+    ctx->mark = arena_mark(ctx->arena);
+    /* A subquery's statement is charged to the query running it. */
+    ctx->outer = arena->account;
+    memory_account_init(&ctx->account, ctx->outer ? ctx->outer : memory_global());
+    ctx->memory = &ctx->account;
+    arena->account = ctx->memory;
+
+    ctx->tables[0] = get_table_by_id(select->table_id);
+    if (!ctx->tables[0]) {
+        log_msg(LOG_ERROR, "exec_context_init: Table with ID %d not found", select->table_id);
+        return false;
+    }
+    ctx->table_count = 1;
+    ctx->schema = &ctx->tables[0]->schema;
+    if (select->join_count == 0)
+        return true;
+
+    for (int j = 0; j < select->join_count; j++) {
+        ctx->tables[j + 1] = get_table_by_id(select->joins[j].table_id);
+        if (!ctx->tables[j + 1]) {
+            log_msg(LOG_ERROR, "exec_context_init: Joined table with ID %d not found",
+                    select->joins[j].table_id);
+            return false;
+        }
+    }
+    ctx->table_count = select->join_count + 1;
+    if (!init_join_schema(ctx)) {
+        log_msg(LOG_ERROR, "exec_context_init: Failed to allocate the joined schema");
+        return false;
+    }
+    return true;
+}
+
+void exec_context_free(ExecContext *ctx) {
+    if (ctx->schema == &ctx->join_schema) {
+        alist_destroy(&ctx->join_schema.columns);
+        alist_destroy(&ctx->join_schema.check_constraints);
+    }
+    alist_destroy(&ctx->scratch);
+    if (!ctx->arena)
+        return;
+    arena_release(ctx->arena, ctx->mark);
+    ctx->arena->account = ctx->outer;
+    if (!ctx->outer)
+        metrics_record(METRIC_QUERY_MEMORY, atomic_load(&ctx->account.peak));
+}
+
+static void append_row_values(Row *row, const Table *table, int row_id) {
+    int cols = alist_length(&table->schema.columns);
+    for (int c = 0; c < cols; c++) {
+        Value *slot = (Value *)alist_append(row);
+        if (!slot)
+            return;
+        if (row_id < 0) {
+            memclear(slot, sizeof(Value));
+            slot->type = TYPE_NULL;
+        } else {
+            *slot = table_get_value(table, row_id, (uint16_t)c);
+        }
+    }
+}
+
+/* Assembles row k of a batch in the context's scratch row. The values are borrowed from the
+   base tables, so the row is only valid until the next call. */
+const Row *context_row(ExecContext *ctx, const RowBatch *batch, int k) {
+    if (batch->width == 1)
+        return table_fetch_row(ctx->tables[0], batch->ids[0][k], &ctx->scratch);
+    alist_clear(&ctx->scratch);
+    for (int t = 0; t < batch->width; t++)
+        append_row_values(&ctx->scratch, ctx->tables[t], batch->ids[t][k]);
+    return &ctx->scratch;
+}
+
+Value context_value(const ExecContext *ctx, const RowBatch *batch, int k, uint16_t column_id) {
+    int t = batch->width - 1;
+    while (t > 0 && column_id < ctx->column_offset[t])
+        t--;
+    int row_id = batch->ids[t][k];
+    if (row_id < 0) {
+        Value null_val = {0};
+        null_val.type = TYPE_NULL;
+        return null_val;
+    }
+    return table_get_value(ctx->tables[t], row_id, (uint16_t)(column_id - ctx->column_offset[t]));
+}
+
+void row_batch_init(RowBatch *batch) {
+    batch->count = 0;
+    batch->width = 0;
+    batch->ascending = false;
+    batch->value_count = 0;
+    alist_init(&batch->values, sizeof(Value), free_value);
+}
+
+void row_batch_reset(RowBatch *batch, int width) {
+    batch->count = 0;
+    batch->width = width;
+    batch->ascending = false;
+    batch->value_count = 0;
+    alist_clear(&batch->values);
+}
+
+void row_batch_free(RowBatch *batch) {
+    alist_destroy(&batch->values);
+}
+
+/* Table scans: a sequential scan counts through the table, an index plan materializes its
+   ascending candidate ids at open. Both emit width-1 batches in row id order. */
+typedef struct {
+    const Table *table;
+    bool use_ids;
+    ArrayList ids; /* int */
+    int next;
+    int count;
+    const Expr *where;     /* of a sequential scan with a zone map */
+    const ZoneMap *zones;
+    const SeqScanPlan *sample; /* of a sampled sequential scan */
+    JoinFilterProbe join_probe;
+} ScanState;
+
+/* Whether a sampled scan keeps row: a hash of the seed and the row id falls below its
+   percent, so every worker, and every run with the same seed, picks the same rows. Rows
+   rather than blocks keep a small table's sample near its percent. */
+bool sample_row_kept(const SeqScanPlan *scan, int row) {
+    if (!scan->sampled)
+        return true;
+    uint64_t x = (((uint64_t)scan->sample_seed << 32) | (uint32_t)row) + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return (double)(x >> 11) * (100.0 / 9007199254740992.0) < scan->sample_percent;
+}
+
+/* Keeps the sampled ones of the n ids in place; returns how many are left. */
+int sample_select_rows(const SeqScanPlan *scan, int *ids, int n) {
+    if (!scan || !scan->sampled)
+        return n;
+    int kept = 0;
+    for (int k = 0; k < n; k++) {
+        ids[kept] = ids[k];
+        kept += sample_row_kept(scan, ids[k]);
+    }
+    return kept;
+}
+
+static uint16_t scan_table_id(const PlanNode *plan) {
+    switch (plan->type) {
+    case PLAN_SEQ_SCAN:
+        return plan->plan.seq_scan.table_id;
+    case PLAN_INDEX_SCAN:
+        return plan->plan.index_scan.table_id;
+    case PLAN_INDEX_ORDER_SCAN:
+        return plan->plan.index_order_scan.table_id;
+    case PLAN_INDEX_ONLY_SCAN:
+        return plan->plan.index_scan.table_id;
+    default:
+        return scan_table_id(plan->left);
+    }
+}
+
+static bool scan_open(Operator *op) {
+    ScanState *state = arena_calloc(op->ctx->arena, 1, sizeof(ScanState));
+    if (!state)
+        return false;
+    op->state = state;
+
+    state->table = get_table_by_id(scan_table_id(op->plan));
+    if (!state->table) {
+        log_msg(LOG_ERROR, "scan_open: Table for plan type %d not found", op->plan->type);
+        return false;
+    }
+    alist_init(&state->ids, sizeof(int), NULL);
+    state->use_ids = exec_plan_rows(op->plan, &state->ids);
+    state->count = state->use_ids ? alist_length(&state->ids) : table_row_count(state->table);
+    if (state->use_ids)
+        op->index_hits = (uint64_t)state->count;
+    if (op->plan->type == PLAN_SEQ_SCAN) {
+        state->where = op->plan->plan.seq_scan.where_clause;
+        state->zones = filter_zone_map(state->table, state->where);
+        if (op->plan->plan.seq_scan.sampled)
+            state->sample = &op->plan->plan.seq_scan;
+    }
+    return true;
+}
+
+static bool scan_next(Operator *op, RowBatch *out) {
+    ScanState *state = op->state;
+    row_batch_reset(out, 1);
+    out->ascending = true;
+    while (state->next < state->count) {
+        /* Blocks the filter above would reject entirely are never read. */
+        if (state->zones && state->next % ZONE_MAP_ROWS == 0) {
+            bool may_match = filter_block_may_match(state->zones, state->where,
+                                                    state->next / ZONE_MAP_ROWS);
+            zone_map_count_blocks(1, may_match ? 0 : 1);
+            if (!may_match) {
+                state->next += ZONE_MAP_ROWS;
+                continue;
+            }
+        }
+        int n = state->count - state->next;
+        if (n > FILTER_BATCH_SIZE)
+            n = FILTER_BATCH_SIZE;
+        if (state->use_ids) {
+            memcopy(out->ids[0], (int *)state->ids.data + state->next, sizeof(int) * (size_t)n);
+        } else {
+            for (int k = 0; k < n; k++)
+                out->ids[0][k] = state->next + k;
+            metrics_add(METRIC_ROWS_SCANNED, (uint64_t)n);
+        }
+        state->next += n;
+        n = sample_select_rows(state->sample, out->ids[0], n);
+        n = table_visible_rows(state->table, out->ids[0], n);
+        out->count = join_filter_apply(op->join_filters, state->table, out->ids[0], n,
+                                       &state->join_probe);
+        hash_join_count_filtered((uint64_t)(n - out->count));
+        if (out->count > 0)
+            return true;
+    }
+    return false;
+}
+
+static void scan_close(Operator *op) {
+    ScanState *state = op->state;
+    if (state)
+        alist_destroy(&state->ids);
+}
+
+/* Walks the B-tree leaf chain; rows with a NULL key are not in the tree, so they are
+   emitted from a table pass before the walk (DESC) or after it (ASC). */
+typedef enum { ORDER_PHASE_NULLS_FIRST, ORDER_PHASE_TREE, ORDER_PHASE_NULLS_LAST, ORDER_PHASE_DONE } OrderPhase;
+
+typedef struct {
+    const Table *table;
+    uint16_t column_id;
+    BTreeCursor cursor;
+    OrderPhase phase;
+    int next_row;
+} IndexOrderState;
+
+static bool index_order_open(Operator *op) {
+    const IndexOrderScanPlan *scan = &op->plan->plan.index_order_scan;
+    IndexOrderState *state = arena_calloc(op->ctx->arena, 1, sizeof(IndexOrderState));
+    if (!state)
+        return false;
+    op->state = state;
+
+    state->table = get_table_by_id(scan->table_id);
+    if (!state->table) {
+        log_msg(LOG_ERROR, "index_order_open: Table with ID %d not found", scan->table_id);
+        return false;
+    }
+    log_msg(LOG_DEBUG, "index_order_open: ORDER BY through index '%s'", scan->index->index_name);
+    state->column_id = *(uint16_t *)alist_get(&scan->index->columns, 0);
+    btree_cursor_open(scan->index, scan->desc, &state->cursor);
+    state->phase = scan->desc ? ORDER_PHASE_NULLS_FIRST : ORDER_PHASE_TREE;
+    return true;
+}
+
+static void emit_null_keys(IndexOrderState *state, RowBatch *out) {
+    int row_count = table_row_count(state->table);
+    while (out->count < FILTER_BATCH_SIZE && state->next_row < row_count) {
+        int row = state->next_row++;
+        Value key = table_get_value(state->table, row, state->column_id);
+        if (is_null(&key) && table_row_visible(state->table, row))
+            out->ids[0][out->count++] = row;
+    }
+    if (state->next_row >= row_count) {
+        state->phase = state->phase == ORDER_PHASE_NULLS_FIRST ? ORDER_PHASE_TREE : ORDER_PHASE_DONE;
+        state->next_row = 0;
+    }
+}
+
+static bool index_order_next(Operator *op, RowBatch *out) {
+    IndexOrderState *state = op->state;
+    const IndexOrderScanPlan *scan = &op->plan->plan.index_order_scan;
+    row_batch_reset(out, 1);
+    while (out->count < FILTER_BATCH_SIZE && state->phase != ORDER_PHASE_DONE) {
+        if (state->phase == ORDER_PHASE_TREE) {
+            int row;
+            if (!btree_cursor_next(&state->cursor, &row)) {
+                state->phase = scan->desc ? ORDER_PHASE_DONE : ORDER_PHASE_NULLS_LAST;
+                continue;
+            }
+            op->index_hits++;
+            if (table_row_visible(state->table, row))
+                out->ids[0][out->count++] = row;
+        } else {
+            emit_null_keys(state, out);
+        }
+    }
+    return out->count > 0;
+}
+
+static void index_order_close(Operator *op) {
+    (void)op;
+}
+
+/* Returns the projected columns straight from the B-tree entries of an index scan whose
+   index holds them all. Rows come in key order, as value batches (see RowBatch) that also
+   carry the row ids. */
+typedef struct {
+    const Table *table;
+    BTreeRange range;
+    BTreeCursor cursor;
+    int output_count;
+    int *positions; /* in the index entry, per output */
+} IndexOnlyState;
+
+static int entry_position(const Index *index, uint16_t column_id) {
+    for (int i = 0; i < alist_length(&index->columns); i++)
+        if (*(uint16_t *)alist_get(&index->columns, i) == column_id)
+            return i;
+    return 0;
+}
+
+static bool index_only_open(Operator *op) {
+    const IndexScanPlan *scan = &op->plan->plan.index_scan;
+    IndexOnlyState *state = arena_calloc(op->ctx->arena, 1, sizeof(IndexOnlyState));
+    if (!state)
+        return false;
+    op->state = state;
+
+    state->table = get_table_by_id(scan->table_id);
+    if (!state->table) {
+        log_msg(LOG_ERROR, "index_only_open: Table with ID %d not found", scan->table_id);
+        return false;
+    }
+    state->output_count = scan->outputs ? alist_length(scan->outputs)
+                                        : alist_length(&state->table->schema.columns);
+    state->positions = arena_calloc(op->ctx->arena, (size_t)state->output_count, sizeof(int));
+    if (!state->positions)
+        return false;
+    for (int j = 0; j < state->output_count; j++) {
+        uint16_t column_id =
+            scan->outputs ? (*(Expr **)alist_get(scan->outputs, j))->column.column_id
+                          : (uint16_t)j;
+        state->positions[j] = entry_position(scan->index, column_id);
+    }
+    log_msg(LOG_DEBUG, "index_only_open: Reading index '%s' only", scan->index->index_name);
+    index_scan_range(scan, &state->range);
+    btree_cursor_seek(scan->index, &state->range, &state->cursor);
+    metrics_add(METRIC_INDEX_PROBES, 1);
+    return true;
+}
+
+static bool index_only_next(Operator *op, RowBatch *out) {
+    IndexOnlyState *state = op->state;
+    row_batch_reset(out, 1);
+    out->value_count = state->output_count;
+    int row;
+    const Value *entry;
+    while (out->count < FILTER_BATCH_SIZE && btree_cursor_entry(&state->cursor, &row, &entry)) {
+        op->index_hits++;
+        metrics_add(METRIC_INDEX_ROWS, 1);
+        if (!table_row_visible(state->table, row))
+            continue;
+        for (int j = 0; j < state->output_count; j++) {
+            Value *slot = (Value *)alist_append(&out->values);
+            if (!slot)
+                return false;
+            *slot = copy_value(&entry[state->positions[j]]);
+        }
+        out->ids[0][out->count++] = row;
+    }
+    return out->count > 0;
+}
+
+static void index_only_close(Operator *op) {
+    (void)op;
+}
+
+/* Ascending single-table batches go through the vectorized filter kernels; join output and
+   index-ordered rows are evaluated row by row and compacted in place. A filter over a large
+   sequential scan instead runs waves of morsels on the thread pool and emits the matching
+   ids morsel by morsel, so its output keeps table order and LIMIT still stops the scan. */
+typedef struct {
+    const Table *table; /* of a width-1 input, which below a join need not be the FROM table */
+    Row scratch;
+    bool started;
+    ParallelScan *parallel;
+    int morsel_count;
+    int wave_first; /* first morsel of the current wave */
+    int wave_size;
+    int wave_cap;
+    int *ids;    /* wave_cap morsels of PARALLEL_MORSEL_ROWS ids */
+    int *counts; /* matches per morsel of the wave */
+    int emit_morsel;
+    int emit_pos;
+} FilterState;
+
+static bool filter_open(Operator *op) {
+    FilterState *state = arena_calloc(op->ctx->arena, 1, sizeof(FilterState));
+    if (!state)
+        return false;
+    alist_init(&state->scratch, sizeof(Value), NULL);
+    op->state = state;
+    state->table = get_table_by_id(scan_table_id(op->plan));
+    return state->table != NULL;
+}
+
+static void filter_morsel_batch(void *arg, int worker, int morsel, ExecContext *ctx,
+                                const RowBatch *batch) {
+    FilterState *state = arg;
+    (void)worker;
+    (void)ctx;
+    int local = morsel - state->wave_first;
+    int *ids = state->ids + (size_t)local * PARALLEL_MORSEL_ROWS + state->counts[local];
+    memcopy(ids, batch->ids[0], sizeof(int) * (size_t)batch->count);
+    state->counts[local] += batch->count;
+}
+
+static bool filter_start_parallel(Operator *op, FilterState *state) {
+    ParallelScan *parallel = parallel_scan_open(op);
+    if (!parallel)
+        return false;
+    int workers = parallel_scan_workers(parallel);
+    state->wave_cap = workers * 2;
+    state->ids = arena_alloc(op->ctx->arena, sizeof(int) * (size_t)state->wave_cap *
+                                                 PARALLEL_MORSEL_ROWS);
+    state->counts = arena_alloc(op->ctx->arena, sizeof(int) * (size_t)state->wave_cap);
+    if (!state->ids || !state->counts) {
+        parallel_scan_close(parallel);
+        return false;
+    }
+    state->parallel = parallel;
+    state->morsel_count = parallel_scan_morsels(parallel);
+    return true;
+}
+
+static bool filter_next_parallel(Operator *op, FilterState *state, RowBatch *out) {
+    row_batch_reset(out, 1);
+    out->ascending = true;
+    for (;;) {
+        while (state->emit_morsel < state->wave_size && out->count < FILTER_BATCH_SIZE) {
+            int left = state->counts[state->emit_morsel] - state->emit_pos;
+            int n = FILTER_BATCH_SIZE - out->count < left ? FILTER_BATCH_SIZE - out->count : left;
+            const int *ids = state->ids + (size_t)state->emit_morsel * PARALLEL_MORSEL_ROWS;
+            memcopy(out->ids[0] + out->count, ids + state->emit_pos, sizeof(int) * (size_t)n);
+            out->count += n;
+            state->emit_pos += n;
+            if (state->emit_pos == state->counts[state->emit_morsel]) {
+                state->emit_morsel++;
+                state->emit_pos = 0;
+            }
+        }
+        int next = state->wave_first + state->wave_size;
+        if (out->count > 0 || next >= state->morsel_count)
+            return out->count > 0;
+
+        state->wave_first = next;
+        state->wave_size = state->morsel_count - next < state->wave_cap ? state->morsel_count - next
+                                                                        : state->wave_cap;
+        memclear(state->counts, sizeof(int) * (size_t)state->wave_size);
+        state->emit_morsel = 0;
+        state->emit_pos = 0;
+        /* The scan credits this operator with every match; it counts what it emits. */
+        uint64_t emitted = op->rows_out;
+        parallel_scan_run(state->parallel, next, state->wave_size, filter_morsel_batch, state);
+        op->rows_out = emitted;
+    }
+}
+
+static bool filter_next(Operator *op, RowBatch *out) {
+    FilterState *state = op->state;
+    if (!state->started) {
+        state->started = true;
+        filter_start_parallel(op, state);
+    }
+    if (state->parallel)
+        return filter_next_parallel(op, state, out);
+
+    const Expr *predicate = op->plan->plan.filter.predicate;
+    while (operator_next(op->left, out)) {
+        if (out->width == 1 && out->ascending) {
+            out->count = filter_batch(state->table, predicate, out->ids[0], out->count,
+                                      &state->scratch);
+        } else {
+            int kept = 0;
+            for (int k = 0; k < out->count; k++) {
+                const Row *row = context_row(op->ctx, out, k);
+                if (!eval_expression(predicate, row, op->ctx->schema))
+                    continue;
+                for (int t = 0; t < out->width; t++)
+                    out->ids[t][kept] = out->ids[t][k];
+                kept++;
+            }
+            out->count = kept;
+        }
+        if (out->count > 0)
+            return true;
+    }
+    return false;
+}
+
+static void filter_close(Operator *op) {
+    FilterState *state = op->state;
+    if (!state)
+        return;
+    alist_destroy(&state->scratch);
+    parallel_scan_close(state->parallel);
+    state->parallel = NULL;
+}
+
+/* Stops pulling from its input once count rows have passed, so the scans below never read
+   the rest of the table. */
+static bool limit_open(Operator *op) {
+    op->state = NULL;
+    return true;
+}
+
+static bool limit_next(Operator *op, RowBatch *out) {
+    uint64_t limit = op->plan->plan.limit.count;
+    if (op->rows_out >= limit || !operator_next(op->left, out))
+        return false;
+    if (op->rows_out + (uint64_t)out->count > limit)
+        out->count = (int)(limit - op->rows_out);
+    return true;
+}
+
+static void limit_close(Operator *op) {
+    (void)op;
+}
+
+Operator *operator_build(const PlanNode *plan, ExecContext *ctx) {
+    if (!plan)
+        return NULL;
+    Operator *op = arena_calloc(ctx->arena, 1, sizeof(Operator));
+    if (!op) {
+        log_msg(LOG_ERROR, "operator_build: Failed to allocate operator");
+        return NULL;
+    }
+    op->plan = plan;
+    op->ctx = ctx;
+
+    /* Index plans are leaves to the executor: exec_plan_rows drives their children. */
+    bool scan = plan->type == PLAN_SEQ_SCAN || plan->type == PLAN_INDEX_SCAN ||
+                plan->type == PLAN_INDEX_INTERSECT || plan->type == PLAN_INDEX_ORDER_SCAN ||
+                plan->type == PLAN_INDEX_ONLY_SCAN;
+    if (!scan) {
+        op->left = operator_build(plan->left, ctx);
+        op->right = operator_build(plan->right, ctx);
+        if ((plan->left && !op->left) || (plan->right && !op->right)) {
+            operator_close(op);
+            return NULL;
+        }
+    }
+    return op;
+}
+
+static bool open_operator(Operator *op) {
+    if ((op->left && !operator_open(op->left)) || (op->right && !operator_open(op->right)))
+        return false;
+
+    switch (op->plan->type) {
+    case PLAN_SEQ_SCAN:
+    case PLAN_INDEX_SCAN:
+    case PLAN_INDEX_INTERSECT:
+        return scan_open(op);
+    case PLAN_INDEX_ORDER_SCAN:
+        return index_order_open(op);
+    case PLAN_INDEX_ONLY_SCAN:
+        return index_only_open(op);
+    case PLAN_FILTER:
+        return filter_open(op);
+    case PLAN_HASH_JOIN:
+        return hash_join_open(op);
+    case PLAN_NESTED_LOOP_JOIN:
+        return nested_loop_join_open(op);
+    case PLAN_INDEX_NESTED_LOOP_JOIN:
+        return index_nested_loop_join_open(op);
+    case PLAN_AGGREGATE:
+        return aggregate_open(op);
+    case PLAN_HASH_AGGREGATE:
+        return hash_aggregate_open(op);
+    case PLAN_SORT:
+        return sort_open(op);
+    case PLAN_LIMIT:
+        return limit_open(op);
+    case PLAN_PROJECT:
+        return project_open(op);
+    }
+    return false;
+}
+
+/* Charges the time and query arena growth since start to op. */
+static void operator_account(Operator *op, uint64_t start, size_t used) {
+    op->cycles += explain_cycles() - start;
+    size_t now = arena_bytes_used(op->ctx->arena);
+    if (now > used)
+        op->alloc_bytes += now - used;
+    if (now > op->ctx->arena_peak)
+        op->ctx->arena_peak = now;
+}
+
+bool operator_open(Operator *op) {
+    if (!op->ctx->analyze)
+        return open_operator(op);
+    uint64_t start = explain_cycles();
+    size_t used = arena_bytes_used(op->ctx->arena);
+    bool ok = open_operator(op);
+    operator_account(op, start, used);
+    return ok;
+}
+
+static bool next_batch(Operator *op, RowBatch *out) {
+    bool more = false;
+    switch (op->plan->type) {
+    case PLAN_SEQ_SCAN:
+    case PLAN_INDEX_SCAN:
+    case PLAN_INDEX_INTERSECT:
+        more = scan_next(op, out);
+        break;
+    case PLAN_INDEX_ORDER_SCAN:
+        more = index_order_next(op, out);
+        break;
+    case PLAN_INDEX_ONLY_SCAN:
+        more = index_only_next(op, out);
+        break;
+    case PLAN_FILTER:
+        more = filter_next(op, out);
+        break;
+    case PLAN_HASH_JOIN:
+        more = hash_join_next(op, out);
+        break;
+    case PLAN_NESTED_LOOP_JOIN:
+        more = nested_loop_join_next(op, out);
+        break;
+    case PLAN_INDEX_NESTED_LOOP_JOIN:
+        more = index_nested_loop_join_next(op, out);
+        break;
+    case PLAN_AGGREGATE:
+        more = aggregate_next(op, out);
+        break;
+    case PLAN_HASH_AGGREGATE:
+        more = hash_aggregate_next(op, out);
+        break;
+    case PLAN_SORT:
+        more = sort_next(op, out);
+        break;
+    case PLAN_LIMIT:
+        more = limit_next(op, out);
+        break;
+    case PLAN_PROJECT:
+        more = project_next(op, out);
+        break;
+    }
+    if (more) {
+        op->rows_out += (uint64_t)out->count;
+        op->batches++;
+    }
+    return more;
+}
+
+/* Fills out with the operator's next batch; returns false once the input is exhausted. A
+   returned batch is never empty. */
+bool operator_next(Operator *op, RowBatch *out) {
+    if (!op->ctx->analyze)
+        return next_batch(op, out);
+    uint64_t start = explain_cycles();
+    size_t used = arena_bytes_used(op->ctx->arena);
+    bool more = next_batch(op, out);
+    operator_account(op, start, used);
+    return more;
+}
+
+/* Releases what the operator and its inputs hold outside the query arena. Safe on a
+   partially opened tree. */
+void operator_close(Operator *op) {
+    if (!op)
+        return;
+    switch (op->plan->type) {
+    case PLAN_SEQ_SCAN:
+    case PLAN_INDEX_SCAN:
+    case PLAN_INDEX_INTERSECT:
+        scan_close(op);
+        break;
+    case PLAN_INDEX_ORDER_SCAN:
+        index_order_close(op);
+        break;
+    case PLAN_INDEX_ONLY_SCAN:
+        index_only_close(op);
+        break;
+    case PLAN_FILTER:
+        filter_close(op);
+        break;
+    case PLAN_HASH_JOIN:
+        hash_join_close(op);
+        break;
+    case PLAN_NESTED_LOOP_JOIN:
+        nested_loop_join_close(op);
+        break;
+    case PLAN_INDEX_NESTED_LOOP_JOIN:
+        index_nested_loop_join_close(op);
+        break;
+    case PLAN_AGGREGATE:
+        aggregate_close(op);
+        break;
+    case PLAN_HASH_AGGREGATE:
+        hash_aggregate_close(op);
+        break;
+    case PLAN_SORT:
+        sort_close(op);
+        break;
+    case PLAN_LIMIT:
+        limit_close(op);
+        break;
+    case PLAN_PROJECT:
+        project_close(op);
+        break;
+    }
+    operator_close(op->left);
+    operator_close(op->right);
+}
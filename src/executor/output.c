@@ -1,9 +1,11 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "arraylist.h"
 #include "db.h"
+#include "executor.h"
 #include "logger.h"
 #include "values.h"
 
@@ -158,3 +160,181 @@ void print_pretty_result(QueryResult *result) {
 
     free(col_widths);
 }
+
+/* Streamed formats. Each row is written as it arrives through the file's own buffer, so
+   nothing is measured first and no cell goes through printf unless it is a float. CSV
+   matches COPY TO (empty for NULL), TSV escapes tabs, newlines and backslashes and writes
+   NULL as \N, JSONL is one object per row, and BINARY is COPY's binary format, so COPY
+   FROM ... (FORMAT BINARY) loads it back. */
+
+bool output_format_parse(const char *name, OutputFormat *format) {
+    static const struct {
+        const char *name;
+        OutputFormat format;
+    } formats[] = {{"table", OUTPUT_TABLE}, {"csv", OUTPUT_CSV},       {"tsv", OUTPUT_TSV},
+                   {"jsonl", OUTPUT_JSONL}, {"binary", OUTPUT_BINARY}};
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (strcmp(name, formats[i].name) == 0) {
+            *format = formats[i].format;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void write_json_string(FILE *file, const char *text) {
+    fputc('"', file);
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', file);
+            fputc(*p, file);
+        } else if (*p == '\n') {
+            fputs("\\n", file);
+        } else if (*p == '\t') {
+            fputs("\\t", file);
+        } else if (*p < 0x20) {
+            fprintf(file, "\\u%04x", *p);
+        } else {
+            fputc(*p, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void write_json_value(FILE *file, const Value *val) {
+    switch (val->type) {
+    case TYPE_STRING:
+        write_json_string(file, value_str(val));
+        break;
+    case TYPE_INT:
+    case TYPE_BOOLEAN:
+    case TYPE_DECIMAL:
+        copy_write_csv_value(file, val, ',');
+        break;
+    case TYPE_FLOAT:
+        if (isfinite(val->float_val))
+            copy_write_csv_value(file, val, ',');
+        else
+            fputs("null", file);
+        break;
+    case TYPE_BLOB:
+        fputs("\"\\\\x", file);
+        for (size_t i = 0; i < val->blob_val.length; i++)
+            fprintf(file, "%02x", val->blob_val.data[i]);
+        fputc('"', file);
+        break;
+    case TYPE_DATE:
+    case TYPE_TIME:
+        fputc('"', file);
+        copy_write_csv_value(file, val, ',');
+        fputc('"', file);
+        break;
+    default:
+        fputs("null", file);
+        break;
+    }
+}
+
+static char tsv_escape(char c) {
+    switch (c) {
+    case '\t':
+        return 't';
+    case '\n':
+        return 'n';
+    case '\r':
+        return 'r';
+    case '\\':
+        return '\\';
+    default:
+        return 0;
+    }
+}
+
+static void write_tsv_value(FILE *file, const Value *val) {
+    if (is_null(val)) {
+        fputs("\\N", file);
+        return;
+    }
+    if (val->type != TYPE_STRING) {
+        copy_write_csv_value(file, val, '\t');
+        return;
+    }
+    const char *text = value_str(val);
+    const char *run = text;
+    for (const char *p = text;; p++) {
+        char escape = tsv_escape(*p);
+        if (!escape && *p)
+            continue;
+        fwrite(run, 1, (size_t)(p - run), file);
+        if (!*p)
+            break;
+        fputc('\\', file);
+        fputc(escape, file);
+        run = p + 1;
+    }
+}
+
+void result_writer_begin(ResultWriter *writer, FILE *file, OutputFormat format, int col_count,
+                         const char *const *names) {
+    writer->file = file;
+    writer->format = format;
+    writer->col_count = col_count;
+    writer->names = names;
+    writer->rows = 0;
+    if (format == OUTPUT_BINARY) {
+        copy_write_binary_header(file, col_count);
+    } else if (format == OUTPUT_CSV || format == OUTPUT_TSV) {
+        for (int j = 0; j < col_count; j++) {
+            if (j > 0)
+                fputc(format == OUTPUT_CSV ? ',' : '\t', file);
+            fputs(names[j], file);
+        }
+        fputc('\n', file);
+    }
+}
+
+/* Writes one row whose column j is first[j * stride]. */
+void result_writer_row(ResultWriter *writer, const Value *first, size_t stride) {
+    FILE *file = writer->file;
+    for (int j = 0; j < writer->col_count; j++) {
+        const Value *val = first + (size_t)j * stride;
+        switch (writer->format) {
+        case OUTPUT_CSV:
+            if (j > 0)
+                fputc(',', file);
+            copy_write_csv_value(file, val, ',');
+            break;
+        case OUTPUT_TSV:
+            if (j > 0)
+                fputc('\t', file);
+            write_tsv_value(file, val);
+            break;
+        case OUTPUT_JSONL:
+            fputc(j == 0 ? '{' : ',', file);
+            write_json_string(file, writer->names[j]);
+            fputc(':', file);
+            write_json_value(file, val);
+            break;
+        case OUTPUT_BINARY:
+            copy_write_binary_value(file, val);
+            break;
+        default:
+            break;
+        }
+    }
+    if (writer->format == OUTPUT_JSONL)
+        fputs(writer->col_count > 0 ? "}\n" : "{}\n", file);
+    else if (writer->format != OUTPUT_BINARY)
+        fputc('\n', file);
+    writer->rows++;
+}
+
+void result_writer_batch(ResultWriter *writer, const ResultBatch *batch) {
+    for (int i = 0; i < batch->row_count; i++)
+        result_writer_row(writer, batch->values + i, (size_t)batch->capacity);
+}
+
+void result_writer_end(ResultWriter *writer) {
+    fflush(writer->file);
+    log_msg(LOG_INFO, "Wrote %lld rows", writer->rows);
+}
@@ -0,0 +1,218 @@
+#include <stdlib.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "metrics.h"
+#include "table.h"
+#include "thread_pool.h"
+#include "txn.h"
+#include "utils.h"
+
+/* Morsel-driven scans. A sequential scan, with the filter above it, is cut into morsels of
+   PARALLEL_MORSEL_ROWS rows that the thread pool spreads over its workers. Each worker
+   filters its morsels batch by batch with private scratch space and hands every non-empty
+   batch to the consumer together with the morsel number, so consumers that need table
+   order (the Filter operator) can reassemble it and the others (the aggregates) can fold
+   into per-worker state. */
+typedef struct {
+    ExecContext ctx; /* the query's, with a private scratch row */
+    Row scratch;     /* for filter_batch */
+    RowBatch batch;
+    uint64_t scanned;
+    uint64_t matched;
+    uint64_t blocks_checked;
+    uint64_t blocks_skipped;
+    JoinFilterProbe join_probe;
+} ParallelWorker;
+
+struct ParallelScan {
+    Operator *input;
+    const Table *table;
+    const Expr *predicate;
+    const ZoneMap *zones; /* morsels are zone map blocks */
+    const SeqScanPlan *plan;
+    const JoinFilter *join_filters;
+    int row_count;
+    int morsel_count;
+    int worker_count;
+    ParallelWorker *workers;
+    MorselConsumer consume;
+    void *arg;
+    int first_morsel;
+    uint64_t scanned; /* already credited to the operators */
+    uint64_t matched;
+    uint64_t blocks_checked;
+    uint64_t blocks_skipped;
+    uint64_t filtered;
+};
+
+/* Subqueries run whole queries through the shared arena and must stay on the calling
+   thread; everything else only reads the tables. */
+bool expr_parallel_safe(const Expr *expr) {
+    if (!expr)
+        return true;
+    switch (expr->type) {
+    case EXPR_SUBQUERY:
+        return false;
+    case EXPR_BINARY_OP:
+        return expr_parallel_safe(expr->binary.left) && expr_parallel_safe(expr->binary.right);
+    case EXPR_UNARY_OP:
+        return expr_parallel_safe(expr->unary.operand);
+    case EXPR_AGGREGATE_FUNC:
+        return expr_parallel_safe(expr->aggregate.operand);
+    case EXPR_SCALAR_FUNC:
+        for (int i = 0; i < expr->scalar.arg_count; i++)
+            if (!expr_parallel_safe(expr->scalar.args[i]))
+                return false;
+        return true;
+    default:
+        return true;
+    }
+}
+
+bool exprs_parallel_safe(const ArrayList *exprs) {
+    for (int i = 0; exprs && i < alist_length(exprs); i++)
+        if (!expr_parallel_safe(*(Expr **)alist_get(exprs, i)))
+            return false;
+    return true;
+}
+
+/* Returns a parallel scan for input when it is a sequential scan, or a filter over one, of a
+   table of at least two morsels and more than one worker is configured; NULL otherwise. */
+ParallelScan *parallel_scan_open(Operator *input) {
+    if (!input || thread_pool_workers() < 2)
+        return NULL;
+    const PlanNode *plan = input->plan;
+    const Expr *predicate = NULL;
+    if (plan->type == PLAN_FILTER && plan->left && plan->left->type == PLAN_SEQ_SCAN) {
+        predicate = plan->plan.filter.predicate;
+        plan = plan->left;
+    }
+    if (plan->type != PLAN_SEQ_SCAN || !expr_parallel_safe(predicate))
+        return NULL;
+    const Table *table = get_table_by_id(plan->plan.seq_scan.table_id);
+    int row_count = table ? table_row_count(table) : 0;
+    if (row_count < 2 * PARALLEL_MORSEL_ROWS)
+        return NULL;
+
+    ExecContext *ctx = input->ctx;
+    ParallelScan *scan = arena_calloc(ctx->arena, 1, sizeof(ParallelScan));
+    int worker_count = thread_pool_workers();
+    ParallelWorker *workers = arena_calloc(ctx->arena, (size_t)worker_count,
+                                           sizeof(ParallelWorker));
+    if (!scan || !workers)
+        return NULL;
+    scan->input = input;
+    scan->table = table;
+    scan->predicate = predicate;
+    scan->plan = &plan->plan.seq_scan;
+    scan->zones = filter_zone_map(table, predicate);
+    scan->join_filters = (input->left ? input->left : input)->join_filters;
+    scan->row_count = row_count;
+    scan->morsel_count = (row_count + PARALLEL_MORSEL_ROWS - 1) / PARALLEL_MORSEL_ROWS;
+    scan->worker_count = worker_count;
+    scan->workers = workers;
+    for (int w = 0; w < worker_count; w++) {
+        workers[w].ctx = *ctx;
+        alist_init(&workers[w].ctx.scratch, sizeof(Value), NULL);
+        alist_init(&workers[w].scratch, sizeof(Value), NULL);
+        row_batch_init(&workers[w].batch);
+    }
+    /* Picked here so the workers do not race to choose the aggregate kernels. */
+    (void)agg_kernel_name();
+    return scan;
+}
+
+int parallel_scan_morsels(const ParallelScan *scan) {
+    return scan->morsel_count;
+}
+
+int parallel_scan_workers(const ParallelScan *scan) {
+    return scan->worker_count;
+}
+
+static void scan_morsel(void *arg, int worker, int task) {
+    ParallelScan *scan = arg;
+    ParallelWorker *w = &scan->workers[worker];
+    int morsel = scan->first_morsel + task;
+    int start = morsel * PARALLEL_MORSEL_ROWS;
+    int end = start + PARALLEL_MORSEL_ROWS < scan->row_count ? start + PARALLEL_MORSEL_ROWS
+                                                              : scan->row_count;
+    if (scan->zones) {
+        w->blocks_checked++;
+        if (!filter_block_may_match(scan->zones, scan->predicate, morsel)) {
+            w->blocks_skipped++;
+            return;
+        }
+    }
+    for (int row = start; row < end; row += FILTER_BATCH_SIZE) {
+        int n = end - row < FILTER_BATCH_SIZE ? end - row : FILTER_BATCH_SIZE;
+        RowBatch *batch = &w->batch;
+        row_batch_reset(batch, 1);
+        batch->ascending = true;
+        for (int k = 0; k < n; k++)
+            batch->ids[0][k] = row + k;
+        w->scanned += (uint64_t)n;
+        metrics_add(METRIC_ROWS_SCANNED, (uint64_t)n);
+        n = sample_select_rows(scan->plan, batch->ids[0], n);
+        n = table_visible_rows(scan->table, batch->ids[0], n);
+        n = join_filter_apply(scan->join_filters, scan->table, batch->ids[0], n,
+                              &w->join_probe);
+        if (scan->predicate)
+            n = filter_batch(scan->table, scan->predicate, batch->ids[0], n, &w->scratch);
+        batch->count = n;
+        w->matched += (uint64_t)n;
+        if (n > 0)
+            scan->consume(scan->arg, worker, morsel, &w->ctx, batch);
+    }
+}
+
+/* Scans morsels [first, first + count) on the pool; consume runs on the workers, concurrently
+   for different workers but never for the same one. The rows are then credited to the scan
+   and filter operators the workers stood in for. */
+void parallel_scan_run(ParallelScan *scan, int first, int count, MorselConsumer consume,
+                       void *arg) {
+    scan->first_morsel = first;
+    scan->consume = consume;
+    scan->arg = arg;
+    thread_pool_run(count, scan_morsel, scan);
+
+    uint64_t scanned = 0, matched = 0, checked = 0, skipped = 0;
+    for (int w = 0; w < scan->worker_count; w++) {
+        scanned += scan->workers[w].scanned;
+        matched += scan->workers[w].matched;
+        checked += scan->workers[w].blocks_checked;
+        skipped += scan->workers[w].blocks_skipped;
+    }
+    uint64_t filtered = 0;
+    for (int w = 0; w < scan->worker_count; w++)
+        filtered += scan->workers[w].join_probe.dropped;
+    zone_map_count_blocks(checked - scan->blocks_checked, skipped - scan->blocks_skipped);
+    hash_join_count_filtered(filtered - scan->filtered);
+    scan->blocks_checked = checked;
+    scan->blocks_skipped = skipped;
+    scan->filtered = filtered;
+    Operator *filter = scan->input->left ? scan->input : NULL;
+    Operator *seq_scan = filter ? filter->left : scan->input;
+    seq_scan->rows_out += scanned - scan->scanned;
+    if (filter)
+        filter->rows_out += matched - scan->matched;
+    scan->scanned = scanned;
+    scan->matched = matched;
+}
+
+void parallel_scan_close(ParallelScan *scan) {
+    if (!scan)
+        return;
+    for (int w = 0; w < scan->worker_count; w++) {
+        ParallelWorker *worker = &scan->workers[w];
+        alist_destroy(&worker->ctx.scratch);
+        alist_destroy(&worker->scratch);
+        row_batch_free(&worker->batch);
+    }
+    log_msg(LOG_DEBUG, "parallel_scan_close: %d morsels of '%s' on %d workers", scan->morsel_count,
+            scan->table->name, scan->worker_count);
+    scan->worker_count = 0;
+}
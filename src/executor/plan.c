@@ -0,0 +1,87 @@
+#include <stdlib.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+
+static int compare_row_ids(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+static void sort_row_ids(ArrayList *rows) {
+    qsort(rows->data, (size_t)alist_length(rows), sizeof(int), compare_row_ids);
+}
+
+/* Keeps the rows of out that also appear in other; both are sorted ascending. */
+static void intersect_row_ids(ArrayList *out, const ArrayList *other) {
+    int *a = (int *)out->data;
+    const int *b = (const int *)other->data;
+    int na = alist_length(out), nb = alist_length(other);
+    int i = 0, j = 0, kept = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            if (kept == 0 || a[kept - 1] != a[i])
+                a[kept++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    out->length = kept;
+}
+
+/* The B-tree range of an index scan: the equality prefix, widened by the bounds on the next
+   key column, whose NULLs sort first and must be skipped when only the prefix bounds lo. */
+void index_scan_range(const IndexScanPlan *scan, BTreeRange *range) {
+    if (scan->op == OP_EQUALS) {
+        *range = (BTreeRange){scan->search_key, scan->eq_count, true, scan->search_key,
+                              scan->eq_count, true, -1};
+        return;
+    }
+    *range = (BTreeRange){scan->lo_key, scan->lo_width, scan->lo_inclusive, scan->hi_key,
+                          scan->hi_width, scan->hi_inclusive, scan->eq_count};
+}
+
+static void exec_index_scan(const IndexScanPlan *scan, ArrayList *out) {
+    if (scan->op == OP_EQUALS) {
+        log_msg(LOG_DEBUG, "exec_plan_rows: Probing index '%s'", scan->index->index_name);
+        lookup_index_prefix(scan->index, scan->search_key, scan->eq_count, out);
+    } else {
+        log_msg(LOG_DEBUG, "exec_plan_rows: Range scan on index '%s'", scan->index->index_name);
+        BTreeRange range;
+        index_scan_range(scan, &range);
+        btree_scan(scan->index, &range, out);
+    }
+    sort_row_ids(out);
+}
+
+/* Produces the candidate rows of an index plan in ascending order. The candidates are a
+   superset of the matching rows; callers still evaluate the full WHERE clause on them.
+   Returns false for a sequential scan. */
+bool exec_plan_rows(const PlanNode *plan, ArrayList *out) {
+    if (!plan)
+        return false;
+
+    switch (plan->type) {
+    case PLAN_INDEX_SCAN:
+        exec_index_scan(&plan->plan.index_scan, out);
+        return true;
+    case PLAN_INDEX_INTERSECT: {
+        if (!exec_plan_rows(plan->left, out))
+            return false;
+        ArrayList other;
+        alist_init(&other, sizeof(int), NULL);
+        if (exec_plan_rows(plan->right, &other))
+            intersect_row_ids(out, &other);
+        alist_destroy(&other);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
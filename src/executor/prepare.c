@@ -0,0 +1,89 @@
+#include <string.h>
+#include <strings.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "dbapi.h"
+#include "executor.h"
+#include "logger.h"
+#include "utils.h"
+
+/* Statements named by PREPARE, for the life of the process (or until DEALLOCATE). */
+typedef struct {
+    char name[MAX_TABLE_NAME_LEN];
+    DbStatement *stmt;
+} NamedStatement;
+
+static ArrayList g_named;
+
+static int find_named(const char *name) {
+    for (int i = 0; i < alist_length(&g_named); i++)
+        if (strcasecmp(((NamedStatement *)alist_get(&g_named, i))->name, name) == 0)
+            return i;
+    return -1;
+}
+
+static void remove_named(int i) {
+    db_finalize(((NamedStatement *)alist_get(&g_named, i))->stmt);
+    alist_remove(&g_named, i);
+}
+
+void exec_prepare_ast(ASTNode *ast) {
+    PrepareNode *prep = &ast->prepare;
+    if (!g_named.data)
+        alist_init(&g_named, sizeof(NamedStatement), NULL);
+    if (find_named(prep->name) >= 0) {
+        log_msg(LOG_ERROR, "Prepared statement '%s' already exists", prep->name);
+        return;
+    }
+    DbStatement *stmt = db_prepare(prep->sql);
+    if (!stmt) {
+        log_msg(LOG_ERROR, "Cannot prepare '%s': %s", prep->name, prep->sql);
+        return;
+    }
+    NamedStatement *named = (NamedStatement *)alist_append(&g_named);
+    if (!named) {
+        db_finalize(stmt);
+        return;
+    }
+    strcopy(named->name, sizeof(named->name), prep->name);
+    named->stmt = stmt;
+    log_msg(LOG_INFO, "Prepared '%s' with %d parameters", prep->name, db_bind_count(stmt));
+}
+
+void exec_execute_ast(ASTNode *ast) {
+    ExecuteNode *exe = &ast->execute;
+    int i = g_named.data ? find_named(exe->name) : -1;
+    if (i < 0) {
+        log_msg(LOG_ERROR, "Prepared statement '%s' does not exist", exe->name);
+        return;
+    }
+    DbStatement *stmt = ((NamedStatement *)alist_get(&g_named, i))->stmt;
+    int count = alist_length(&exe->values);
+    if (count != db_bind_count(stmt)) {
+        log_msg(LOG_ERROR, "EXECUTE %s: expected %d parameters, got %d", exe->name,
+                db_bind_count(stmt), count);
+        return;
+    }
+    for (int p = 0; p < count; p++)
+        if (!db_bind_value(stmt, p + 1, (const Value *)alist_get(&exe->values, p)))
+            return;
+    db_run(stmt);
+}
+
+void exec_deallocate_ast(ASTNode *ast) {
+    const char *name = ast->prepare.name;
+    if (!g_named.data)
+        return;
+    if (name[0] == '\0') {
+        while (alist_length(&g_named) > 0)
+            remove_named(alist_length(&g_named) - 1);
+        return;
+    }
+    int i = find_named(name);
+    if (i < 0) {
+        log_msg(LOG_ERROR, "Prepared statement '%s' does not exist", name);
+        return;
+    }
+    remove_named(i);
+}
@@ -8,6 +8,12 @@
 #include "table.h"
 #include "values.h"
 
+static int compare_scalars(double a, double b) {
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+/* Total order used by sorting and the B-tree: NULL first, INT/FLOAT compared numerically,
+   otherwise values of different types are ordered by type. */
 int compare_values(const Value *a, const Value *b) {
     if (is_null(a) && is_null(b))
         return 0;
@@ -17,6 +23,12 @@ int compare_values(const Value *a, const Value *b) {
         return 1;
 
     if (a->type != b->type) {
+        if ((a->type == TYPE_INT || a->type == TYPE_FLOAT) &&
+            (b->type == TYPE_INT || b->type == TYPE_FLOAT)) {
+            double l = a->type == TYPE_INT ? (double)a->int_val : a->float_val;
+            double r = b->type == TYPE_INT ? (double)b->int_val : b->float_val;
+            return compare_scalars(l, r);
+        }
         return (int)a->type - (int)b->type;
     }
 
@@ -34,7 +46,24 @@ int compare_values(const Value *a, const Value *b) {
             return 1;
         return 0;
     case TYPE_STRING:
-        return strcmp(a->char_val, b->char_val);
+        return strcmp(value_str(a), value_str(b));
+    case TYPE_BOOLEAN:
+        return (int)a->bool_val - (int)b->bool_val;
+    case TYPE_DATE:
+        return a->date_val < b->date_val ? -1 : (a->date_val > b->date_val ? 1 : 0);
+    case TYPE_TIME:
+        return a->time_val < b->time_val ? -1 : (a->time_val > b->time_val ? 1 : 0);
+    case TYPE_DECIMAL:
+        return compare_scalars((double)a->decimal_val.value / pow(10, a->decimal_val.scale),
+                               (double)b->decimal_val.value / pow(10, b->decimal_val.scale));
+    case TYPE_BLOB: {
+        size_t len = a->blob_val.length < b->blob_val.length ? a->blob_val.length
+                                                             : b->blob_val.length;
+        int cmp = len > 0 ? memcmp(a->blob_val.data, b->blob_val.data, len) : 0;
+        if (cmp != 0)
+            return cmp;
+        return compare_scalars((double)a->blob_val.length, (double)b->blob_val.length);
+    }
     default:
         return 0;
     }
@@ -43,10 +72,10 @@ int compare_values(const Value *a, const Value *b) {
 static Value eval_string_func_upper(const Value *arg1) {
     Value result = {0};
     result.type = TYPE_STRING;
-    if (arg1->type == TYPE_STRING && arg1->char_val) {
-        result.char_val = malloc(strlen(arg1->char_val) + 1);
-        for (size_t i = 0; i <= strlen(arg1->char_val); i++) {
-            result.char_val[i] = toupper((unsigned char)arg1->char_val[i]);
+    if (arg1->type == TYPE_STRING && value_str(arg1)) {
+        result.char_val = malloc(strlen(value_str(arg1)) + 1);
+        for (size_t i = 0; i <= strlen(value_str(arg1)); i++) {
+            result.char_val[i] = toupper((unsigned char)value_str(arg1)[i]);
         }
     } else {
         result.char_val = malloc(1);
@@ -83,10 +112,10 @@ Value scalar_case(Value *condition, Value *then_val, Value *else_val) {
 static Value eval_string_func_lower(const Value *arg1) {
     Value result = {0};
     result.type = TYPE_STRING;
-    if (arg1->type == TYPE_STRING && arg1->char_val) {
-        result.char_val = malloc(strlen(arg1->char_val) + 1);
-        for (size_t i = 0; i <= strlen(arg1->char_val); i++) {
-            result.char_val[i] = tolower((unsigned char)arg1->char_val[i]);
+    if (arg1->type == TYPE_STRING && value_str(arg1)) {
+        result.char_val = malloc(strlen(value_str(arg1)) + 1);
+        for (size_t i = 0; i <= strlen(value_str(arg1)); i++) {
+            result.char_val[i] = tolower((unsigned char)value_str(arg1)[i]);
         }
     } else {
         result.char_val = malloc(1);
@@ -98,22 +127,22 @@ static Value eval_string_func_lower(const Value *arg1) {
 static Value eval_string_func_len(const Value *arg1) {
     Value result = {0};
     result.type = TYPE_INT;
-    result.int_val = (arg1->type == TYPE_STRING && arg1->char_val) ? strlen(arg1->char_val) : 0;
+    result.int_val = (arg1->type == TYPE_STRING && value_str(arg1)) ? strlen(value_str(arg1)) : 0;
     return result;
 }
 
 static Value eval_string_func_mid(const Value *arg1, const Value *arg2, const Value *arg3) {
     Value result = {0};
     result.type = TYPE_STRING;
-    if (arg1->type == TYPE_STRING && arg1->char_val) {
+    if (arg1->type == TYPE_STRING && value_str(arg1)) {
         int start = arg2->type == TYPE_INT ? arg2->int_val : 0;
         int len = arg3->type == TYPE_INT ? arg3->int_val : 0;
-        int src_len = strlen(arg1->char_val);
+        int src_len = strlen(value_str(arg1));
         if (start < src_len) {
             int copy_len = (start + len > src_len) ? (src_len - start) : len;
             result.char_val = malloc(copy_len + 1);
             if (copy_len > 0) {
-                memcopy(result.char_val, arg1->char_val + start, (size_t)copy_len);
+                memcopy(result.char_val, value_str(arg1) + start, (size_t)copy_len);
             }
             result.char_val[copy_len] = '\0';
         } else {
@@ -130,13 +159,13 @@ static Value eval_string_func_mid(const Value *arg1, const Value *arg2, const Va
 static Value eval_string_func_left(const Value *arg1, const Value *arg2) {
     Value result = {0};
     result.type = TYPE_STRING;
-    if (arg1->type == TYPE_STRING && arg1->char_val) {
+    if (arg1->type == TYPE_STRING && value_str(arg1)) {
         int len = arg2->type == TYPE_INT ? arg2->int_val : 0;
-        int src_len = strlen(arg1->char_val);
+        int src_len = strlen(value_str(arg1));
         int copy_len = len < src_len ? len : src_len;
         result.char_val = malloc(copy_len + 1);
         if (copy_len > 0) {
-            memcopy(result.char_val, arg1->char_val, (size_t)copy_len);
+            memcopy(result.char_val, value_str(arg1), (size_t)copy_len);
         }
         result.char_val[copy_len] = '\0';
     } else {
@@ -149,15 +178,15 @@ static Value eval_string_func_left(const Value *arg1, const Value *arg2) {
 static Value eval_string_func_right(const Value *arg1, const Value *arg2) {
     Value result = {0};
     result.type = TYPE_STRING;
-    if (arg1->type == TYPE_STRING && arg1->char_val) {
+    if (arg1->type == TYPE_STRING && value_str(arg1)) {
         int len = arg2->type == TYPE_INT ? arg2->int_val : 0;
-        int src_len = strlen(arg1->char_val);
+        int src_len = strlen(value_str(arg1));
         int start = src_len - len;
         if (start < 0)
             start = 0;
         int copy_len = src_len - start;
         result.char_val = malloc(copy_len + 1);
-        memcopy(result.char_val, arg1->char_val + start, copy_len);
+        memcopy(result.char_val, value_str(arg1) + start, copy_len);
         result.char_val[copy_len] = '\0';
     } else {
         result.char_val = malloc(1);
@@ -166,71 +195,48 @@ static Value eval_string_func_right(const Value *arg1, const Value *arg2) {
     return result;
 }
 
-static Value eval_string_func_concat(const Expr *expr, const Row *row, const TableDef *schema) {
+static Value eval_string_func_concat(const Value *args, int arg_count) {
     Value result = {0};
     result.type = TYPE_STRING;
     size_t total_len = 0;
 
-    for (int i = 0; i < expr->scalar.arg_count; i++) {
-        Value arg = eval_select_expression(expr->scalar.args[i], row, schema);
-        if (arg.type == TYPE_STRING && arg.char_val) {
-            total_len += strlen(arg.char_val);
+    for (int i = 0; i < arg_count; i++) {
+        if (args[i].type == TYPE_STRING && value_str(&args[i])) {
+            total_len += strlen(value_str(&args[i]));
         }
     }
     size_t capacity = total_len + 1;
     result.char_val = malloc(capacity);
     result.char_val[0] = '\0';
-    for (int i = 0; i < expr->scalar.arg_count; i++) {
-        Value arg = eval_select_expression(expr->scalar.args[i], row, schema);
-        if (arg.type == TYPE_STRING && arg.char_val) {
-            str_append(result.char_val, capacity, arg.char_val);
+    for (int i = 0; i < arg_count; i++) {
+        if (args[i].type == TYPE_STRING && value_str(&args[i])) {
+            str_append(result.char_val, capacity, value_str(&args[i]));
         }
     }
     return result;
 }
 
-static Value eval_string_function(const Expr *expr, const Row *row, const TableDef *schema) {
-    Value arg1 = {0};
-    if (expr->scalar.arg_count > 0) {
-        arg1 = eval_select_expression(expr->scalar.args[0], row, schema);
-    }
-    if (arg1.type == TYPE_NULL) {
-        Value null_result = {0};
-        null_result.type = TYPE_NULL;
-        return null_result;
-    }
+static Value eval_string_function(ScalarFuncType func_type, const Value *args, int arg_count) {
+    Value none = {0};
+    const Value *arg1 = arg_count > 0 ? &args[0] : &none;
+    const Value *arg2 = arg_count >= 2 ? &args[1] : &none;
+    const Value *arg3 = arg_count >= 3 ? &args[2] : &none;
 
-    switch (expr->scalar.func_type) {
+    switch (func_type) {
     case FUNC_UPPER:
-        return eval_string_func_upper(&arg1);
+        return eval_string_func_upper(arg1);
     case FUNC_LOWER:
-        return eval_string_func_lower(&arg1);
+        return eval_string_func_lower(arg1);
     case FUNC_LEN:
-        return eval_string_func_len(&arg1);
-    case FUNC_MID: {
-        Value arg2 = {0}, arg3 = {0};
-        if (expr->scalar.arg_count >= 3) {
-            arg2 = eval_select_expression(expr->scalar.args[1], row, schema);
-            arg3 = eval_select_expression(expr->scalar.args[2], row, schema);
-        }
-        return eval_string_func_mid(&arg1, &arg2, &arg3);
-    }
-    case FUNC_LEFT: {
-        Value arg2 = {0};
-        if (expr->scalar.arg_count >= 2) {
-            arg2 = eval_select_expression(expr->scalar.args[1], row, schema);
-        }
-        return eval_string_func_left(&arg1, &arg2);
-    }
-    case FUNC_RIGHT: {
-        Value arg2 = {0};
-        if (expr->scalar.arg_count >= 2) {
-            arg2 = eval_select_expression(expr->scalar.args[1], row, schema);
-        }
-        return eval_string_func_right(&arg1, &arg2);
-    }
+        return eval_string_func_len(arg1);
+    case FUNC_MID:
+        return eval_string_func_mid(arg1, arg_count >= 3 ? arg2 : &none, arg3);
+    case FUNC_LEFT:
+        return eval_string_func_left(arg1, arg2);
+    case FUNC_RIGHT:
+        return eval_string_func_right(arg1, arg2);
     case FUNC_CONCAT:
-        return eval_string_func_concat(expr, row, schema);
+        return eval_string_func_concat(args, arg_count);
     default:
         break;
     }
@@ -305,32 +311,22 @@ static Value eval_math_func_ceil(const Value *arg) {
     return result;
 }
 
-static Value eval_math_function(const Expr *expr, const Row *row, const TableDef *schema) {
-    Value arg = {0};
-    if (expr->scalar.arg_count > 0) {
-        arg = eval_select_expression(expr->scalar.args[0], row, schema);
-    }
-    if (arg.type == TYPE_NULL) {
-        Value null_result = {0};
-        null_result.type = TYPE_NULL;
-        return null_result;
-    }
-
-    switch (expr->scalar.func_type) {
+static Value eval_math_function(ScalarFuncType func_type, const Value *arg) {
+    switch (func_type) {
     case FUNC_ABS:
-        return eval_math_func_abs(&arg);
+        return eval_math_func_abs(arg);
     case FUNC_SQRT:
-        return eval_math_func_sqrt(&arg);
+        return eval_math_func_sqrt(arg);
     case FUNC_MOD:
-        return eval_math_func_mod(&arg);
+        return eval_math_func_mod(arg);
     case FUNC_POW:
-        return eval_math_func_pow(&arg);
+        return eval_math_func_pow(arg);
     case FUNC_ROUND:
-        return eval_math_func_round(&arg);
+        return eval_math_func_round(arg);
     case FUNC_FLOOR:
-        return eval_math_func_floor(&arg);
+        return eval_math_func_floor(arg);
     case FUNC_CEIL:
-        return eval_math_func_ceil(&arg);
+        return eval_math_func_ceil(arg);
     default:
         break;
     }
@@ -339,10 +335,30 @@ static Value eval_math_function(const Expr *expr, const Row *row, const TableDef
     return err;
 }
 
-Value eval_scalar_function(const Expr *expr, const Row *row, const TableDef *schema) {
-    Value result = eval_math_function(expr, row, schema);
+/* Applies a scalar function to evaluated arguments; a NULL first argument gives NULL. */
+Value eval_scalar_values(ScalarFuncType func_type, const Value *args, int arg_count) {
+    Value none = {0};
+    const Value *arg1 = arg_count > 0 ? &args[0] : &none;
+    if (arg1->type == TYPE_NULL) {
+        Value null_result = {0};
+        null_result.type = TYPE_NULL;
+        return null_result;
+    }
+    Value result = eval_math_function(func_type, arg1);
     if (result.type != TYPE_ERROR) {
         return result;
     }
-    return eval_string_function(expr, row, schema);
+    return eval_string_function(func_type, args, arg_count);
+}
+
+Value eval_scalar_function(const Expr *expr, const Row *row, const TableDef *schema) {
+    Value args[3];
+    memclear(args, sizeof(args));
+    int arg_count = expr->scalar.arg_count;
+    for (int i = 0; i < arg_count; i++)
+        args[i] = eval_select_expression(expr->scalar.args[i], row, schema);
+    Value result = eval_scalar_values(expr->scalar.func_type, args, arg_count);
+    for (int i = 0; i < arg_count; i++)
+        free_value(&args[i]);
+    return result;
 }
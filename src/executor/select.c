@@ -9,824 +9,488 @@
 #include "executor.h"
 #include "logger.h"
 #include "utils.h"
+#include "sketch.h"
 #include "table.h"
 #include "values.h"
 
-static void copy_columns_to_result(Table *result, Table *source, int col_count);
-static Row *create_joined_row(ArrayList *left, ArrayList *right, int left_cols, int right_cols);
-static Row *create_left_join_null_row(ArrayList *left, int right_cols);
-static void collect_filtered_indices(Table *table, SelectNode *select, int row_count,
-                                     ArrayList *filtered_indices);
-static void compute_aggregates(Table *table, ArrayList *filtered_indices, int loop_count,
-                               SelectNode *select, int expr_count);
-static Value compute_single_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                      SelectNode *select, AggFuncType func_type, Expr *operand,
-                                      bool count_all);
-static bool init_join_result_table(Table *result_table, SelectNode *select, Table *left_table,
-                                   Table *right_table);
-static void process_join_rows(Table *result_table, SelectNode *select, Table *left_table,
-                              Table *right_table, int left_cols, int right_cols);
-static void copy_result_to_global_tables(Table *result_table);
-static Value compute_count_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                     SelectNode *select, Expr *operand, bool count_all);
-static Value compute_sum_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                   SelectNode *select, Expr *operand);
-static Value compute_avg_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                   SelectNode *select, Expr *operand);
-static Value compute_min_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                   SelectNode *select, Expr *operand);
-static Value compute_max_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                   SelectNode *select, Expr *operand);
-static void setup_query_result(QueryResult **result, Table *table, SelectNode *select,
-                               bool is_select_star, int col_count);
-static void process_aggregate_result_rows(QueryResult *result, ArrayList *agg_results,
-                                          SelectNode *select, int col_count);
-static void process_regular_result_rows(QueryResult *result, Table *table, SelectNode *select,
-                                        bool is_select_star, int col_count);
-static void print_query_output(QueryResult *result);
-static void free_string_ptr(void *ptr);
-
+/* Streaming accumulator for one SELECT expression. Aggregates fold every input row; other
+   expressions keep their value on the first row. */
 typedef struct {
-    Value key;
-    ArrayList rows;
-} HashBucket;
-
+    const Expr *expr;
+    long long rows;
+    long long non_null;
+    NumericAgg numeric;
+    Sketch *sketch; /* of an approximate aggregate, once it has a value */
+    Value extreme;  /* of MIN/MAX over strings and dates */
+    bool has_extreme;
+    Value first;
+    bool has_first;
+    int64_t first_pos; /* input position of the row first came from */
+} AggAccumulator;
+
+/* One set of accumulators per worker: over a parallel scan each worker folds its own
+   morsels and the sets are merged into the first when the input ends. */
 typedef struct {
-    HashBucket *buckets;
-    int bucket_count;
-    int total_rows;
-} HashJoinTable;
-
-static HashJoinTable *create_hash_table(int bucket_count) {
-    HashJoinTable *ht = malloc(sizeof(HashJoinTable));
-    if (!ht)
-        return NULL;
-    ht->bucket_count = bucket_count > 0 ? bucket_count : 64;
-    ht->buckets = calloc(ht->bucket_count, sizeof(HashBucket));
-    if (!ht->buckets) {
-        free(ht);
-        return NULL;
-    }
-    ht->total_rows = 0;
-    return ht;
-}
-
-static void free_hash_table(HashJoinTable *ht) {
-    if (!ht)
-        return;
-    if (ht->buckets) {
-        for (int i = 0; i < ht->bucket_count; i++) {
-            alist_destroy(&ht->buckets[i].rows);
-        }
-        free(ht->buckets);
-    }
-    free(ht);
-}
-
-static int get_bucket_index(const Value *key, int bucket_count) {
-    int hash = hash_value(key, bucket_count);
-    hash = (hash < 0) ? -hash : hash;
-    return hash % bucket_count;
-}
-
-static void build_hash_table(HashJoinTable *ht, Table *table, uint16_t col_id) {
-    int row_count = alist_length(&table->rows);
-
-    for (int i = 0; i < row_count; i++) {
-        Row *row = (Row *)alist_get(&table->rows, i);
-        if (!row)
-            continue;
-
-        Value *key_val = (Value *)alist_get(row, col_id);
-        if (!key_val)
-            continue;
-
-        int bucket_idx = get_bucket_index(key_val, ht->bucket_count);
-        int *row_idx = (int *)alist_append(&ht->buckets[bucket_idx].rows);
-        if (row_idx)
-            *row_idx = i;
-        ht->total_rows++;
-    }
-}
-
-static void probe_hash_table(const HashJoinTable *ht, Table *probe_table,
-                             uint16_t probe_col_id, Table *build_table,
-                             Table *result_table, bool is_left_join,
-                             int left_cols, int right_cols) {
-    int probe_rows = alist_length(&probe_table->rows);
-
-    for (int i = 0; i < probe_rows; i++) {
-        Row *probe_row = (Row *)alist_get(&probe_table->rows, i);
-        if (!probe_row)
-            continue;
-
-        Value *probe_key = (Value *)alist_get(probe_row, probe_col_id);
-        if (!probe_key)
-            continue;
-
-        int bucket_idx = get_bucket_index(probe_key, ht->bucket_count);
-        ArrayList *bucket_rows = &ht->buckets[bucket_idx].rows;
-        int bucket_row_count = alist_length(bucket_rows);
-
-        if (bucket_row_count == 0) {
-            if (is_left_join) {
-                Row *new_row = create_left_join_null_row(probe_row, right_cols);
-                if (new_row) {
-                    Row *slot = (Row *)alist_append(&result_table->rows);
-                    if (slot) {
-                        alist_init(slot, sizeof(Value), free_value);
-                        for (int k = 0; k < alist_length(new_row); k++) {
-                            Value *src_val = (Value *)alist_get(new_row, k);
-                            Value *dst_val = (Value *)alist_append(slot);
-                            *dst_val = copy_string_value(src_val);
-                        }
-                    }
-                    free(new_row);
-                }
-            }
-            continue;
-        }
-
-        for (int j = 0; j < bucket_row_count; j++) {
-            int *build_row_idx = (int *)alist_get(bucket_rows, j);
-            if (!build_row_idx)
-                continue;
-
-            Row *build_row = (Row *)alist_get(&build_table->rows, *build_row_idx);
-            if (!build_row)
-                continue;
+    AggAccumulator *accs;
+    long long rows;
+    long long ints[FILTER_BATCH_SIZE];
+    double floats[FILTER_BATCH_SIZE];
+    uint8_t valid[FILTER_BATCH_SIZE / 8];
+    bool failed; /* out of memory for a sketch */
+} AggWorker;
 
-            Row *new_row = create_joined_row(probe_row, build_row, left_cols, right_cols);
-            if (new_row) {
-                Row *slot = (Row *)alist_append(&result_table->rows);
-                if (slot) {
-                    alist_init(slot, sizeof(Value), free_value);
-                    for (int k = 0; k < alist_length(new_row); k++) {
-                        Value *src_val = (Value *)alist_get(new_row, k);
-                        Value *dst_val = (Value *)alist_append(slot);
-                        *dst_val = copy_string_value(src_val);
-                    }
-                }
-                free(new_row);
-            }
-        }
-    }
-}
-
-static bool try_hash_join(Table *result_table, SelectNode *select, Table *left_table,
-                          Table *right_table, int left_cols, int right_cols) {
-    if (!select->join_condition)
+typedef struct {
+    RowBatch input;
+    int acc_count;
+    AggWorker *workers;
+    int worker_count;
+    ParallelScan *parallel;
+    bool done;
+} AggregateState;
+
+bool aggregate_open(Operator *op) {
+    const ArrayList *exprs = op->plan->plan.aggregate.expressions;
+    AggregateState *state = arena_calloc(op->ctx->arena, 1, sizeof(AggregateState));
+    if (!state)
         return false;
+    op->state = state;
+    row_batch_init(&state->input);
 
-    uint16_t left_col_id;
-    uint16_t right_col_id;
-
-    Expr *left = select->join_condition->binary.left;
-    Expr *right = select->join_condition->binary.right;
-
-    if (left->type == EXPR_COLUMN && right->type == EXPR_COLUMN) {
-        if (left->column.table_id == left_table->table_id) {
-            left_col_id = left->column.column_id;
-            right_col_id = right->column.column_id;
-        } else {
-            left_col_id = right->column.column_id;
-            right_col_id = left->column.column_id;
-        }
-    } else {
+    state->parallel = exprs_parallel_safe(exprs) ? parallel_scan_open(op->left) : NULL;
+    state->worker_count = state->parallel ? parallel_scan_workers(state->parallel) : 1;
+    state->workers = arena_calloc(op->ctx->arena, (size_t)state->worker_count, sizeof(AggWorker));
+    if (!state->workers)
         return false;
-    }
-
-    int left_row_count = alist_length(&left_table->rows);
-    int right_row_count = alist_length(&right_table->rows);
-
-    bool is_left_join = (select->join_type == JOIN_LEFT);
-
-    if (left_row_count == 0 || right_row_count == 0) {
-        if (is_left_join && right_row_count == 0) {
-            for (int i = 0; i < left_row_count; i++) {
-                Row *left_row = (Row *)alist_get(&left_table->rows, i);
-                if (!left_row)
-                    continue;
-                Row *new_row = create_left_join_null_row(left_row, right_cols);
-                if (new_row) {
-                    Row *slot = (Row *)alist_append(&result_table->rows);
-                    if (slot) {
-                        memclear(slot, sizeof(Row));
-                        alist_init(slot, sizeof(Value), free_value);
-                        for (int k = 0; k < alist_length(new_row); k++) {
-                            Value *src_val = (Value *)alist_get(new_row, k);
-                            Value *dst_val = (Value *)alist_append(slot);
-                            *dst_val = copy_string_value(src_val);
-                        }
-                    }
-                    free(new_row);
-                }
-            }
+    state->acc_count = alist_length(exprs);
+    for (int w = 0; w < state->worker_count; w++) {
+        AggWorker *worker = &state->workers[w];
+        worker->accs = arena_calloc(op->ctx->arena, (size_t)state->acc_count + 1,
+                                    sizeof(AggAccumulator));
+        if (!worker->accs)
+            return false;
+        for (int i = 0; i < state->acc_count; i++) {
+            worker->accs[i].expr = *(Expr **)alist_get(exprs, i);
+            numeric_agg_init(&worker->accs[i].numeric);
         }
-        return true;
     }
-
-    HashJoinTable *ht = create_hash_table(64);
-    if (!ht)
-        return false;
-
-    Table *build_table;
-    Table *probe_table;
-    uint16_t build_col_id;
-    uint16_t probe_col_id;
-
-    if (left_row_count <= right_row_count) {
-        build_table = left_table;
-        probe_table = right_table;
-        build_col_id = left_col_id;
-        probe_col_id = right_col_id;
-    } else {
-        build_table = right_table;
-        probe_table = left_table;
-        build_col_id = right_col_id;
-        probe_col_id = left_col_id;
-    }
-
-    build_hash_table(ht, build_table, build_col_id);
-    probe_hash_table(ht, probe_table, probe_col_id, build_table, result_table,
-                     is_left_join, left_cols, right_cols);
-
-    free_hash_table(ht);
     return true;
 }
 
-uint16_t exec_join_ast(ASTNode *ast) {
-    SelectNode *select = &ast->select;
-    Table *left_table = get_table_by_id(select->table_id);
-    Table *right_table = get_table_by_id(select->join_table_id);
-
-    if (!left_table || !right_table) {
-        log_msg(LOG_ERROR, "JOIN failed: tables not found");
-        return 0;
-    }
-
-    static uint16_t join_counter = 0;
-    join_counter++;
-    uint16_t result_id = join_counter;
-
-    Table result_table;
-    memclear(&result_table, sizeof(Table));
-
-    if (!init_join_result_table(&result_table, select, left_table, right_table)) {
-        log_msg(LOG_ERROR, "JOIN failed: unable to initialize result table");
-        return 0;
-    }
-
-    int left_cols = alist_length(&left_table->schema.columns);
-    int right_cols = alist_length(&right_table->schema.columns);
-
-    process_join_rows(&result_table, select, left_table, right_table, left_cols, right_cols);
-
-    copy_result_to_global_tables(&result_table);
-
-    log_msg(LOG_INFO, "Created join table '%s' with %d rows", result_table.name,
-            alist_length(&result_table.rows));
-
-    alist_destroy(&result_table.rows);
-    alist_destroy(&result_table.schema.columns);
-    return result_id;
-}
-
-static bool init_join_result_table(Table *result_table, SelectNode *select, Table *left_table,
-                                   Table *right_table) {
-    string_format(result_table->name, MAX_TABLE_NAME_LEN, "_join_%d_%d", select->table_id,
-                  select->join_table_id);
-    result_table->table_id = 0;
-    alist_init(&result_table->rows, sizeof(Row), free_row_contents);
-    alist_init(&result_table->schema.columns, sizeof(ColumnDef), NULL);
-    result_table->schema.strict = false;
-    if (!result_table->rows.data || !result_table->schema.columns.data) {
-        alist_destroy(&result_table->rows);
-        alist_destroy(&result_table->schema.columns);
+/* Gathers a columnar INT/FLOAT column for the batch so the SIMD kernels can fold it. The
+   rows of a batch that fall in one run of a sealed segment are folded as a single run. */
+static bool accumulate_column_vector(AggWorker *worker, const ExecContext *ctx,
+                                     const RowBatch *batch, uint16_t column_id,
+                                     AggAccumulator *acc) {
+    const Table *table = ctx->tables[0];
+    if (batch->width != 1 || table->storage != STORAGE_COLUMNAR ||
+        column_id >= alist_length(&table->schema.columns))
+        return false;
+    const ColumnVector *vec = &table->vectors[column_id];
+    if (vec->type != TYPE_INT && vec->type != TYPE_FLOAT)
         return false;
-    }
-
-    int left_cols = alist_length(&left_table->schema.columns);
-    int right_cols = alist_length(&right_table->schema.columns);
-
-    copy_columns_to_result(result_table, left_table, left_cols);
-    copy_columns_to_result(result_table, right_table, right_cols);
-    return true;
-}
-
-static void process_join_rows(Table *result_table, SelectNode *select, Table *left_table,
-                              Table *right_table, int left_cols, int right_cols) {
-    int left_rows = alist_length(&left_table->rows);
-    int right_rows = alist_length(&right_table->rows);
-
-    if (left_rows > 0 && right_rows > 0) {
-        if (try_hash_join(result_table, select, left_table, right_table, left_cols, right_cols)) {
-            log_msg(LOG_DEBUG, "process_join_rows: Used hash join");
-            return;
-        }
-    }
-
-    for (int i = 0; i < left_rows; i++) {
-        Row *left_row = (Row *)alist_get(&left_table->rows, i);
-        if (!left_row)
-            continue;
 
-        bool had_match = false;
-        for (int j = 0; j < right_rows; j++) {
-            Row *right_row = (Row *)alist_get(&right_table->rows, j);
-            if (!right_row)
+    long long before = acc->numeric.count;
+    const int *rows = batch->ids[0];
+    int n = 0;
+    memclear(worker->valid, sizeof(worker->valid));
+    for (int k = 0; k < batch->count; k++) {
+        int row = rows[k];
+        if (row < vec->sealed) {
+            const ColumnSegment *seg = &vec->segments[row / COLUMN_SEGMENT_ROWS];
+            int i = row % COLUMN_SEGMENT_ROWS;
+            if (seg->nulls && (seg->nulls[i / 8] & (1u << (i % 8))))
                 continue;
-
-            bool match = true;
-            if (select->join_condition) {
-                match =
-                    eval_expression_for_join(select->join_condition, left_row, left_table->table_id,
-                                             right_table->table_id, left_cols);
-            }
-
-            if (match) {
-                had_match = true;
-                Row *new_row = create_joined_row(left_row, right_row, left_cols, right_cols);
-                if (new_row) {
-                    Row *slot = (Row *)alist_append(&result_table->rows);
-                    if (slot) {
-                        alist_init(slot, sizeof(Value), free_value);
-                        int src_len = alist_length(new_row);
-                        for (int k = 0; k < src_len; k++) {
-                            Value *src_val = (Value *)alist_get(new_row, k);
-                            Value *dst_val = (Value *)alist_append(slot);
-                            *dst_val = copy_string_value(src_val);
-                        }
-                    }
-                    free(new_row);
-                }
-            }
-        }
-
-        if (!had_match && select->join_type == JOIN_LEFT) {
-            Row *new_row = create_left_join_null_row(left_row, right_cols);
-            if (new_row) {
-                Row *slot = (Row *)alist_append(&result_table->rows);
-                if (slot) {
-                    memclear(slot, sizeof(Row));
-                    alist_init(slot, sizeof(Value), free_value);
-                    int src_len = alist_length(new_row);
-                    for (int k = 0; k < src_len; k++) {
-                        Value *src_val = (Value *)alist_get(new_row, k);
-                        Value *dst_val = (Value *)alist_append(slot);
-                        *dst_val = copy_string_value(src_val);
-                    }
+            if (seg->encoding == COLUMN_ENC_RLE) {
+                int run = column_segment_run(seg, i);
+                int count = 1;
+                while (k + 1 < batch->count && rows[k + 1] == row + count &&
+                       i + count < seg->run_ends[run] &&
+                       !(seg->nulls && (seg->nulls[(i + count) / 8] & (1u << ((i + count) % 8))))) {
+                    count++;
+                    k++;
                 }
-                free(new_row);
-            }
-        }
-    }
-}
-
-static void copy_result_to_global_tables(Table *result_table) {
-    Table *t = (Table *)alist_append(&tables);
-    if (t) {
-        memclear(t, sizeof(Table));
-        strcopy(t->name, sizeof(t->name), result_table->name);
-        t->table_id = result_table->table_id;
-        t->schema.strict = result_table->schema.strict;
-        alist_init(&t->rows, sizeof(Row), free_row_contents);
-        alist_init(&t->schema.columns, sizeof(ColumnDef), NULL);
-        copy_columns_to_result(t, result_table, alist_length(&result_table->schema.columns));
-
-        int row_count = alist_length(&result_table->rows);
-        for (int i = 0; i < row_count; i++) {
-            Row *src_row = (Row *)alist_get(&result_table->rows, i);
-            if (!src_row)
+                Value val = column_segment_value(vec, seg, seg->words[run]);
+                if (vec->type == TYPE_INT)
+                    numeric_agg_add_int_run(&acc->numeric, val.int_val, count);
+                else
+                    numeric_agg_add_run(&acc->numeric, val.float_val, count);
                 continue;
-            Row *dst_row = (Row *)alist_append(&t->rows);
-            if (dst_row) {
-                alist_init(dst_row, sizeof(Value), free_value);
-                int val_count = alist_length(src_row);
-                for (int j = 0; j < val_count; j++) {
-                    Value *src_val = (Value *)alist_get(src_row, j);
-                    Value *dst_val = (Value *)alist_append(dst_row);
-                    *dst_val = copy_string_value(src_val);
-                }
             }
+            Value val = column_segment_value(vec, seg, column_segment_word(seg, i));
+            if (vec->type == TYPE_INT)
+                worker->ints[n] = val.int_val;
+            else
+                worker->floats[n] = val.float_val;
+        } else {
+            int i = row - vec->sealed;
+            if (vec->nulls[i / 8] & (1u << (i % 8)))
+                continue;
+            if (vec->type == TYPE_INT)
+                worker->ints[n] = vec->ints[i];
+            else
+                worker->floats[n] = vec->floats[i];
         }
+        worker->valid[n / 8] |= (uint8_t)(1u << (n % 8));
+        n++;
     }
+    AggFuncType func = acc->expr->aggregate.func_type;
+    bool moments = func == FUNC_VARIANCE || func == FUNC_STDDEV;
+    if (vec->type == TYPE_INT)
+        aggregate_int_vector(worker->ints, worker->valid, n, moments, &acc->numeric);
+    else
+        aggregate_float_vector(worker->floats, worker->valid, n, moments, &acc->numeric);
+    acc->non_null += acc->numeric.count - before;
+    return true;
 }
 
-static void copy_columns_to_result(Table *result, Table *source, int col_count) {
-    for (int i = 0; i < col_count; i++) {
-        ColumnDef *col = (ColumnDef *)alist_get(&source->schema.columns, i);
-        if (col) {
-            ColumnDef *new_col = (ColumnDef *)alist_append(&result->schema.columns);
-            if (new_col)
-                *new_col = *col;
-        }
-    }
+static void accumulate_value(AggAccumulator *acc, const Value *val) {
+    acc->non_null++;
+    if (val->type == TYPE_INT)
+        numeric_agg_add_int(&acc->numeric, val->int_val);
+    else if (val->type == TYPE_FLOAT)
+        numeric_agg_add(&acc->numeric, val->float_val);
+    else
+        keep_extreme(acc->expr->aggregate.func_type, &acc->extreme, &acc->has_extreme, val);
 }
 
-static Row *create_joined_row(ArrayList *left, ArrayList *right, int left_cols, int right_cols) {
-    (void)left_cols;
-    (void)right_cols;
-    Row *row = malloc(sizeof(Row));
-    if (!row)
-        return NULL;
-
-    alist_init(row, sizeof(Value), free_value);
-
-    int left_count = alist_length(left);
-    for (int i = 0; i < left_count; i++) {
-        Value *val = (Value *)alist_append(row);
-        *val = *(Value *)alist_get(left, i);
-    }
-
-    int right_count = alist_length(right);
-    for (int i = 0; i < right_count; i++) {
-        Value *val = (Value *)alist_append(row);
-        *val = *(Value *)alist_get(right, i);
+/* An aggregate over an expression, SUM(price * qty), evaluates it row by row. */
+static void accumulate_expression(AggAccumulator *acc, ExecContext *ctx, const RowBatch *batch,
+                                  const Expr *operand) {
+    for (int k = 0; k < batch->count; k++) {
+        const Row *row = context_row(ctx, batch, k);
+        Value val = eval_select_expression((Expr *)operand, row, ctx->schema);
+        if (!is_null(&val))
+            accumulate_value(acc, &val);
+        free_value(&val);
     }
-
-    return row;
 }
 
-static Row *create_left_join_null_row(ArrayList *left, int right_cols) {
-    Row *row = malloc(sizeof(Row));
-    if (!row)
-        return NULL;
-
-    alist_init(row, sizeof(Value), free_value);
-
-    int left_count = alist_length(left);
-    for (int i = 0; i < left_count; i++) {
-        Value *val = (Value *)alist_append(row);
-        *val = *(Value *)alist_get(left, i);
+/* Approximate aggregates fold every non-NULL value into the accumulator's sketch. */
+static void accumulate_sketch(AggWorker *worker, AggAccumulator *acc, ExecContext *ctx,
+                              const RowBatch *batch, const Expr *operand) {
+    if (!acc->sketch && !(acc->sketch = sketch_create(acc->expr->aggregate.func_type))) {
+        worker->failed = true;
+        return;
     }
-
-    for (int k = 0; k < right_cols; k++) {
-        Value *val = (Value *)alist_append(row);
-        val->type = TYPE_NULL;
+    bool column = operand->type == EXPR_COLUMN;
+    for (int k = 0; k < batch->count && !worker->failed; k++) {
+        Value val = column ? context_value(ctx, batch, k, operand->column.column_id)
+                           : eval_select_expression((Expr *)operand, context_row(ctx, batch, k),
+                                                    ctx->schema);
+        if (!is_null(&val)) {
+            acc->non_null++;
+            worker->failed = !sketch_add(acc->sketch, &val);
+        }
+        if (!column)
+            free_value(&val);
     }
-    return row;
 }
 
-void exec_filter_ast(ASTNode *ast, uint8_t table_id) {
-    SelectNode *select = &ast->select;
-    Table *table = get_table_by_id(table_id);
-    if (!table)
-        return;
-
-    int row_count = alist_length(&table->rows);
-    int match_count = 0;
-
-    ArrayList matching_rows;
-    alist_init(&matching_rows, sizeof(int), NULL);
-
-    bool used_index = try_index_filter(table, select->where_clause, &matching_rows);
-
-    if (used_index) {
-        match_count = alist_length(&matching_rows);
-        if (match_count > 0 && match_count < row_count) {
-            for (int i = row_count - 1; i >= 0; i--) {
-                bool keep = false;
-                for (int j = 0; j < match_count; j++) {
-                    int *match_idx = (int *)alist_get(&matching_rows, j);
-                    if (*match_idx == i) {
-                        keep = true;
-                        break;
-                    }
-                }
-                if (!keep) {
-                    alist_remove(&table->rows, i);
-                }
-            }
-        }
-        alist_destroy(&matching_rows);
-    } else {
-        for (int i = 0; i < row_count; i++) {
-            Row *row = (Row *)alist_get(&table->rows, i);
-            if (!row)
-                continue;
-
-            if (eval_expression(select->where_clause, row, &table->schema)) {
-                match_count++;
+static void accumulate_batch(AggregateState *state, AggWorker *worker, ExecContext *ctx,
+                             const RowBatch *batch) {
+    for (int i = 0; i < state->acc_count; i++) {
+        AggAccumulator *acc = &worker->accs[i];
+        const Expr *expr = acc->expr;
+        acc->rows += batch->count;
+
+        if (expr->type != EXPR_AGGREGATE_FUNC) {
+            /* Workers may steal an earlier morsel after a later one. */
+            int64_t pos = batch->width == 1 && batch->ascending ? batch->ids[0][0] : worker->rows;
+            if (!acc->has_first || pos < acc->first_pos) {
+                if (acc->has_first)
+                    free_value(&acc->first);
+                const Row *row = context_row(ctx, batch, 0);
+                acc->first = eval_select_expression((Expr *)expr, row, ctx->schema);
+                acc->has_first = true;
+                acc->first_pos = pos;
             }
+            continue;
         }
-    }
-
-    alist_destroy(&matching_rows);
-
-    log_msg(LOG_INFO, "Filtered table '%s' to %d rows", table->name, match_count);
-}
-
-void exec_aggregate_ast(ASTNode *ast, uint8_t table_id) {
-    SelectNode *select = &ast->select;
-    Table *table = get_table_by_id(table_id);
-    if (!table)
-        return;
-
-    int row_count = alist_length(&table->rows);
-    if (row_count == 0)
-        return;
 
-    int expr_count = alist_length(&select->expressions);
-    if (expr_count == 0)
-        return;
-
-    g_in_agg_context = true;
-    alist_clear(&g_agg_res);
-
-    ArrayList filtered_indices;
-    alist_init(&filtered_indices, sizeof(int), NULL);
-
-    collect_filtered_indices(table, select, row_count, &filtered_indices);
-
-    int filtered_count = alist_length(&filtered_indices);
-    int loop_count = select->where_clause ? filtered_count : row_count;
-
-    compute_aggregates(table, &filtered_indices, loop_count, select, expr_count);
-
-    alist_destroy(&filtered_indices);
-    log_msg(LOG_INFO, "Aggregated table '%s' to 1 row", table->name);
-}
-
-static void collect_filtered_indices(Table *table, SelectNode *select, int row_count,
-                                     ArrayList *filtered_indices) {
-    if (!select->where_clause)
-        return;
-
-    for (int i = 0; i < row_count; i++) {
-        Row *row = (Row *)alist_get(&table->rows, i);
-        if (row && eval_expression(select->where_clause, row, &table->schema)) {
-            int *idx = (int *)alist_append(filtered_indices);
-            *idx = i;
+        const Expr *operand = expr->aggregate.operand;
+        if (expr->aggregate.count_all || !operand)
+            continue;
+        if (sketch_function(expr->aggregate.func_type)) {
+            accumulate_sketch(worker, acc, ctx, batch, operand);
+            continue;
         }
-    }
-}
-
-static void compute_aggregates(Table *table, ArrayList *filtered_indices, int loop_count,
-                               SelectNode *select, int expr_count) {
-    for (int expr_idx = 0; expr_idx < expr_count; expr_idx++) {
-        Expr **expr = (Expr **)alist_get(&select->expressions, expr_idx);
-        if (!expr || !*expr)
+        if (operand->type != EXPR_COLUMN) {
+            accumulate_expression(acc, ctx, batch, operand);
             continue;
-        if ((*expr)->type != EXPR_AGGREGATE_FUNC)
+        }
+        uint16_t column_id = operand->column.column_id;
+        bool numeric = expr->aggregate.func_type != FUNC_COUNT;
+        if (numeric && accumulate_column_vector(worker, ctx, batch, column_id, acc))
             continue;
 
-        AggFuncType func_type = (*expr)->aggregate.func_type;
-        Expr *operand = (*expr)->aggregate.operand;
-        bool count_all = (*expr)->aggregate.count_all;
-
-        Value result = compute_single_aggregate(table, filtered_indices, loop_count, select,
-                                                func_type, operand, count_all);
-
-        Value result_copy = result;
-        void *slot = alist_append(&g_agg_res);
-        *(Value *)slot = result_copy;
+        for (int k = 0; k < batch->count; k++) {
+            Value val = context_value(ctx, batch, k, column_id);
+            if (!is_null(&val))
+                accumulate_value(acc, &val);
+        }
     }
+    worker->rows += batch->count;
 }
 
-static Value compute_single_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                      SelectNode *select, AggFuncType func_type, Expr *operand,
-                                      bool count_all) {
-    Value result = {0};
-    result.type = TYPE_FLOAT;
-    result.char_val = NULL;
-
-    switch (func_type) {
-    case FUNC_COUNT:
-        result = compute_count_aggregate(table, filtered_indices, loop_count, select, operand,
-                                         count_all);
-        break;
-    case FUNC_SUM:
-        result = compute_sum_aggregate(table, filtered_indices, loop_count, select, operand);
-        break;
-    case FUNC_AVG:
-        result = compute_avg_aggregate(table, filtered_indices, loop_count, select, operand);
-        break;
-    case FUNC_MIN:
-        result = compute_min_aggregate(table, filtered_indices, loop_count, select, operand);
-        break;
-    case FUNC_MAX:
-        result = compute_max_aggregate(table, filtered_indices, loop_count, select, operand);
-        break;
-    default:
-        result.float_val = 0;
-    }
-    return result;
+static void accumulate_morsel_batch(void *arg, int worker, int morsel, ExecContext *ctx,
+                                    const RowBatch *batch) {
+    AggregateState *state = arg;
+    (void)morsel;
+    accumulate_batch(state, &state->workers[worker], ctx, batch);
 }
 
-static Value compute_count_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                     SelectNode *select, Expr *operand, bool count_all) {
-    Value result = {0};
-    result.type = TYPE_INT;
-    result.int_val = loop_count;
-    if (!count_all && operand && operand->type == EXPR_COLUMN) {
-        int null_count = 0;
-        for (int idx = 0; idx < loop_count; idx++) {
-            int i = select->where_clause ? *(int *)alist_get(filtered_indices, idx) : idx;
-            Row *row = (Row *)alist_get(&table->rows, i);
-            if (row) {
-                Value val = get_column_value_by_id(row, operand->column.column_id);
-                if (is_null(&val))
-                    null_count++;
-            }
-        }
-        result.int_val = loop_count - null_count;
+/* False when out of memory merging the sketches. */
+static bool merge_accumulator(AggAccumulator *dst, AggAccumulator *src) {
+    dst->rows += src->rows;
+    dst->non_null += src->non_null;
+    numeric_agg_merge(&dst->numeric, &src->numeric);
+    if (src->has_extreme)
+        keep_extreme(dst->expr->aggregate.func_type, &dst->extreme, &dst->has_extreme,
+                     &src->extreme);
+    if (src->sketch && !dst->sketch) {
+        dst->sketch = src->sketch;
+        src->sketch = NULL;
+    } else if (src->sketch && !sketch_merge(dst->sketch, src->sketch)) {
+        return false;
     }
-    return result;
-}
-
-static Value compute_sum_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                   SelectNode *select, Expr *operand) {
-    Value result = {0};
-    result.type = TYPE_FLOAT;
-    double sum = 0.0;
-    if (operand && operand->type == EXPR_COLUMN) {
-        for (int idx = 0; idx < loop_count; idx++) {
-            int i = select->where_clause ? *(int *)alist_get(filtered_indices, idx) : idx;
-            Row *row = (Row *)alist_get(&table->rows, i);
-            if (row) {
-                Value val = get_column_value_by_id(row, operand->column.column_id);
-                if (val.type == TYPE_INT)
-                    sum += val.int_val;
-                else if (val.type == TYPE_FLOAT)
-                    sum += val.float_val;
-            }
-        }
+    if (src->has_first && (!dst->has_first || src->first_pos < dst->first_pos)) {
+        if (dst->has_first)
+            free_value(&dst->first);
+        dst->first = src->first;
+        dst->first_pos = src->first_pos;
+        dst->has_first = true;
+        src->has_first = false;
     }
-    result.float_val = sum;
-    return result;
+    return true;
 }
 
-static Value compute_avg_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                   SelectNode *select, Expr *operand) {
-    Value result = {0};
-    result.type = TYPE_FLOAT;
-    double sum = 0.0;
-    int count = 0;
-    if (operand && operand->type == EXPR_COLUMN) {
-        for (int idx = 0; idx < loop_count; idx++) {
-            int i = select->where_clause ? *(int *)alist_get(filtered_indices, idx) : idx;
-            Row *row = (Row *)alist_get(&table->rows, i);
-            if (row) {
-                Value val = get_column_value_by_id(row, operand->column.column_id);
-                if (val.type == TYPE_INT) {
-                    sum += val.int_val;
-                    count++;
-                } else if (val.type == TYPE_FLOAT) {
-                    sum += val.float_val;
-                    count++;
-                }
-            }
+static Value finish_accumulator(AggAccumulator *acc, const TableDef *schema) {
+    const Expr *expr = acc->expr;
+    if (expr->type != EXPR_AGGREGATE_FUNC) {
+        Value result = acc->first;
+        acc->has_first = false;
+        if (acc->rows == 0) {
+            memclear(&result, sizeof(Value));
+            result.type = TYPE_NULL;
         }
+        return result;
     }
-    result.float_val = count > 0 ? sum / count : 0;
+    if (expr->aggregate.func_type == FUNC_COUNT) {
+        Value result = {0};
+        result.type = TYPE_INT;
+        bool count_rows = expr->aggregate.count_all || !expr->aggregate.operand;
+        result.int_val = count_rows ? acc->rows : acc->non_null;
+        return result;
+    }
+    if (sketch_function(expr->aggregate.func_type))
+        return sketch_result(acc->sketch, expr->aggregate.func_type, expr->aggregate.fraction);
+    if (acc->numeric.count > 0 || !acc->has_extreme)
+        return numeric_agg_result(expr->aggregate.func_type, &acc->numeric,
+                                  agg_operand_type(expr->aggregate.operand, schema));
+    Value result = acc->extreme;
+    acc->has_extreme = false;
     return result;
 }
 
-static Value compute_min_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                   SelectNode *select, Expr *operand) {
-    Value result = {0};
-    result.type = TYPE_FLOAT;
-    double min_val = INFINITY;
-    if (operand && operand->type == EXPR_COLUMN) {
-        for (int idx = 0; idx < loop_count; idx++) {
-            int i = select->where_clause ? *(int *)alist_get(filtered_indices, idx) : idx;
-            Row *row = (Row *)alist_get(&table->rows, i);
-            if (row) {
-                Value val = get_column_value_by_id(row, operand->column.column_id);
-                if (val.type == TYPE_INT && val.int_val < min_val)
-                    min_val = val.int_val;
-                else if (val.type == TYPE_FLOAT && val.float_val < min_val)
-                    min_val = val.float_val;
-            }
-        }
+/* Folds the whole input into a single row of values, one per SELECT expression. */
+bool aggregate_next(Operator *op, RowBatch *out) {
+    AggregateState *state = op->state;
+    if (state->done)
+        return false;
+    state->done = true;
+
+    AggWorker *first = &state->workers[0];
+    if (state->parallel) {
+        parallel_scan_run(state->parallel, 0, parallel_scan_morsels(state->parallel),
+                          accumulate_morsel_batch, state);
+        parallel_scan_close(state->parallel);
+        state->parallel = NULL;
+    } else {
+        while (operator_next(op->left, &state->input))
+            accumulate_batch(state, first, op->ctx, &state->input);
+    }
+    bool failed = first->failed;
+    for (int w = 1; w < state->worker_count; w++) {
+        failed = failed || state->workers[w].failed;
+        for (int i = 0; i < state->acc_count; i++)
+            failed = !merge_accumulator(&first->accs[i], &state->workers[w].accs[i]) || failed;
+        first->rows += state->workers[w].rows;
+    }
+    if (failed) {
+        log_msg(LOG_ERROR, "aggregate_next: Out of memory for the approximate aggregates");
+        return false;
     }
-    result.float_val = min_val == INFINITY ? 0 : min_val;
-    return result;
-}
 
-static Value compute_max_aggregate(Table *table, ArrayList *filtered_indices, int loop_count,
-                                   SelectNode *select, Expr *operand) {
-    Value result = {0};
-    result.type = TYPE_FLOAT;
-    double max_val = -INFINITY;
-    if (operand && operand->type == EXPR_COLUMN) {
-        for (int idx = 0; idx < loop_count; idx++) {
-            int i = select->where_clause ? *(int *)alist_get(filtered_indices, idx) : idx;
-            Row *row = (Row *)alist_get(&table->rows, i);
-            if (row) {
-                Value val = get_column_value_by_id(row, operand->column.column_id);
-                if (val.type == TYPE_INT && val.int_val > max_val)
-                    max_val = val.int_val;
-                else if (val.type == TYPE_FLOAT && val.float_val > max_val)
-                    max_val = val.float_val;
-            }
-        }
+    row_batch_reset(out, 0);
+    out->value_count = state->acc_count;
+    for (int i = 0; i < state->acc_count; i++) {
+        Value *slot = (Value *)alist_append(&out->values);
+        if (!slot)
+            return false;
+        *slot = finish_accumulator(&first->accs[i], op->ctx->schema);
     }
-    result.float_val = max_val == -INFINITY ? 0 : max_val;
-    return result;
+    out->count = 1;
+    log_msg(LOG_INFO, "Aggregated %lld rows to 1 row", first->rows);
+    return true;
 }
 
-static void free_string_ptr(void *ptr) {
-    void **str_ptr = (void **)ptr;
-    free(*str_ptr);
+void aggregate_close(Operator *op) {
+    AggregateState *state = op->state;
+    if (!state)
+        return;
+    parallel_scan_close(state->parallel);
+    for (int w = 0; state->workers && w < state->worker_count; w++)
+        for (int i = 0; state->workers[w].accs && i < state->acc_count; i++) {
+            AggAccumulator *acc = &state->workers[w].accs[i];
+            if (acc->has_first)
+                free_value(&acc->first);
+            if (acc->has_extreme)
+                free_value(&acc->extreme);
+            sketch_free(acc->sketch);
+        }
+    row_batch_free(&state->input);
 }
 
-static void setup_query_result(QueryResult **result, Table *table, SelectNode *select,
-                               bool is_select_star, int col_count) {
-    *result = malloc(sizeof(QueryResult));
-    if (!*result)
-        return;
+static QueryResult *setup_query_result(const TableDef *schema, const ProjectPlan *project,
+                                       int col_count) {
+    QueryResult *result = malloc(sizeof(QueryResult));
+    if (!result)
+        return NULL;
 
-    memclear(*result, sizeof(QueryResult));
-    (*result)->col_count = col_count;
-    alist_init(&(*result)->column_names, sizeof(char *), free_string_ptr);
-    alist_init(&(*result)->values, sizeof(Value), free_value);
-    alist_init(&(*result)->rows, sizeof(int), NULL);
+    memclear(result, sizeof(QueryResult));
+    result->col_count = col_count;
+    arena_init(&result->arena, 0);
+    alist_init(&result->column_names, sizeof(char *), NULL);
+    alist_init(&result->values, sizeof(Value), NULL);
+    alist_init(&result->rows, sizeof(int), NULL);
 
     for (int i = 0; i < col_count; i++) {
         const char *name;
-        if (is_select_star) {
-            ColumnDef *col = (ColumnDef *)alist_get(&table->schema.columns, i);
+        if (project->select_star) {
+            ColumnDef *col = (ColumnDef *)alist_get(&schema->columns, i);
             name = col ? col->name : "unknown";
         } else {
-            Expr **expr = (Expr **)alist_get(&select->expressions, i);
+            Expr **expr = (Expr **)alist_get(project->expressions, i);
             const char *alias = expr[0]->alias;
             if (alias && alias[0]) {
                 name = alias;
             } else if (expr[0]->type == EXPR_COLUMN) {
-                ColumnDef *col = (ColumnDef *)alist_get(&table->schema.columns, expr[0]->column.column_id);
+                ColumnDef *col = (ColumnDef *)alist_get(&schema->columns, expr[0]->column.column_id);
                 name = col ? col->name : "unknown";
             } else {
                 name = "expr";
             }
         }
-        char *name_copy = malloc(strlen(name) + 1);
+        char *name_copy = arena_strdup(&result->arena, name);
         if (!name_copy) {
             log_msg(LOG_ERROR, "setup_query_result: Failed to allocate memory for column name");
             continue;
         }
-        strcopy(name_copy, strlen(name) + 1, name);
-        char **slot = (char **)alist_append(&(*result)->column_names);
+        char **slot = (char **)alist_append(&result->column_names);
         *slot = name_copy;
     }
+    return result;
 }
 
-static void process_aggregate_result_rows(QueryResult *result, ArrayList *agg_results,
-                                          SelectNode *select, int col_count) {
-    int agg_count = alist_length(agg_results);
-    int limit = select->limit > 0 ? select->limit : 1;
+/* The pipeline's sink: appends every input row to the context's QueryResult. String and
+   blob values are copied into the result's arena, so freeing the result is one release. */
+typedef struct {
+    RowBatch input;
+    int col_count;
+    ExprProgram *program; /* the expressions compiled, when any is computed */
+} ProjectState;
+
+bool project_open(Operator *op) {
+    const ProjectPlan *project = &op->plan->plan.project;
+    ProjectState *state = arena_calloc(op->ctx->arena, 1, sizeof(ProjectState));
+    if (!state)
+        return false;
+    op->state = state;
+    row_batch_init(&state->input);
 
-    for (int i = 0; i < 1 && i < agg_count && alist_length(&result->rows) < limit; i++) {
-        int *row_idx = (int *)alist_append(&result->rows);
-        *row_idx = i;
+    int expr_count = alist_length(project->expressions);
+    state->col_count =
+        project->select_star ? alist_length(&op->ctx->schema->columns) : expr_count;
+    if (expr_count == 0 || state->col_count <= 0)
+        return false;
 
-        for (int j = 0; j < col_count && j < agg_count; j++) {
-            Value *agg_val = (Value *)alist_get(agg_results, j);
-            Value val;
-            if (agg_val) {
-                val = copy_string_value(agg_val);
-            } else {
-                val.type = TYPE_NULL;
-                val.char_val = NULL;
-                val.int_val = 0;
-                val.float_val = 0;
-                val.date_val = 0;
-                val.time_val = 0;
-            }
+    if (!project->select_star) {
+        bool computed = false;
+        for (int j = 0; j < expr_count && !computed; j++)
+            computed = (*(Expr **)alist_get(project->expressions, j))->type != EXPR_COLUMN;
+        if (computed)
+            state->program = expr_compile(op->ctx->arena, project->expressions, op->ctx->schema);
+    }
+
+    op->ctx->result = setup_query_result(op->ctx->schema, project, state->col_count);
+    return op->ctx->result != NULL;
+}
+
+static void project_values(QueryResult *result, const RowBatch *batch, int col_count) {
+    for (int k = 0; k < batch->count; k++) {
+        int *slot = (int *)alist_append(&result->rows);
+        *slot = alist_length(&result->rows) - 1;
+        for (int j = 0; j < col_count; j++) {
+            Value val = {0};
+            val.type = TYPE_NULL;
+            if (j < batch->value_count)
+                val = copy_value_to_arena(&result->arena,
+                                          (Value *)alist_get(&batch->values,
+                                                             k * batch->value_count + j));
             Value *val_slot = (Value *)alist_append(&result->values);
             *val_slot = val;
         }
     }
 }
 
-static void process_regular_result_rows(QueryResult *result, Table *table, SelectNode *select,
-                                        bool is_select_star, int col_count) {
-    int row_count = alist_length(&table->rows);
-    uint32_t limit = select->limit > 0 ? select->limit : (uint32_t)row_count;
-
-    for (int i = 0; i < row_count && (uint32_t)alist_length(&result->rows) < limit; i++) {
-        Row *row = (Row *)alist_get(&table->rows, i);
-        if (!row || alist_length(row) == 0)
-            continue;
-
-        if (select->where_clause) {
-            if (!eval_expression(select->where_clause, row, &table->schema)) {
-                continue;
+/* Runs the compiled expressions over the batch a slice of EXPR_LANES rows at a time. */
+static void project_compiled(Operator *op, ExprProgram *program, const RowBatch *batch,
+                             int col_count) {
+    QueryResult *result = op->ctx->result;
+    for (int first = 0; first < batch->count; first += EXPR_LANES) {
+        int n = batch->count - first < EXPR_LANES ? batch->count - first : EXPR_LANES;
+        expr_program_run(program, op->ctx, batch, first, n);
+        for (int k = 0; k < n; k++) {
+            int *slot = (int *)alist_append(&result->rows);
+            *slot = batch->width == 1 ? batch->ids[0][first + k] : alist_length(&result->rows) - 1;
+            for (int j = 0; j < col_count; j++) {
+                Value *val_slot = (Value *)alist_append(&result->values);
+                *val_slot = copy_value_to_arena(&result->arena,
+                                                expr_program_output(program, j, k));
             }
         }
+        expr_program_release(program, n);
+    }
+}
 
-        int *row_idx = (int *)alist_append(&result->rows);
-        *row_idx = i;
+static void project_rows(Operator *op, const RowBatch *batch, int col_count) {
+    const ProjectPlan *project = &op->plan->plan.project;
+    QueryResult *result = op->ctx->result;
+    for (int k = 0; k < batch->count; k++) {
+        const Row *row = context_row(op->ctx, batch, k);
+        if (!row || alist_length(row) == 0)
+            continue;
+        int *slot = (int *)alist_append(&result->rows);
+        *slot = batch->width == 1 ? batch->ids[0][k] : alist_length(&result->rows) - 1;
 
         for (int j = 0; j < col_count; j++) {
             Value val;
-            if (is_select_star) {
-                Value *row_val = (Value *)alist_get(row, j);
-                val = copy_string_value(row_val);
+            Expr **expr = project->select_star ? NULL : (Expr **)alist_get(project->expressions, j);
+            if (!expr) {
+                const Value *col_val = (const Value *)alist_get(row, j);
+                if (col_val) {
+                    val = copy_value_to_arena(&result->arena, col_val);
+                } else {
+                    memclear(&val, sizeof(Value));
+                    val.type = TYPE_NULL;
+                }
+            } else if (expr[0]->type == EXPR_COLUMN) {
+                Value col_val = get_column_value_by_id(row, expr[0]->column.column_id);
+                val = copy_value_to_arena(&result->arena, &col_val);
             } else {
-                Expr **expr = (Expr **)alist_get(&select->expressions, j);
-                val = eval_select_expression(expr[0], row, &table->schema);
+                Value computed = eval_select_expression(expr[0], row, op->ctx->schema);
+                val = copy_value_to_arena(&result->arena, &computed);
+                free_value(&computed);
             }
             Value *val_slot = (Value *)alist_append(&result->values);
             *val_slot = val;
@@ -834,44 +498,99 @@ static void process_regular_result_rows(QueryResult *result, Table *table, Selec
     }
 }
 
-static void print_query_output(QueryResult *result) {
-    print_pretty_result(result);
+static bool reserve_stream(ResultBatch *stream, int col_count, int rows) {
+    stream->row_count = 0;
+    stream->col_count = col_count;
+    arena_reset(&stream->arena);
+    if (rows <= stream->capacity)
+        return true;
+    Value *values = realloc(stream->values, sizeof(Value) * (size_t)rows * (size_t)col_count);
+    if (!values) {
+        log_msg(LOG_ERROR, "project_next: Failed to allocate a batch of %d rows", rows);
+        return false;
+    }
+    stream->values = values;
+    stream->capacity = rows;
+    return true;
 }
 
-void exec_project_ast(ASTNode *ast, uint8_t table_id) {
-    SelectNode *select = &ast->select;
-    Table *table = get_table_by_id(table_id);
-    if (!table)
-        return;
-
-    int expr_count = alist_length(&select->expressions);
-    if (expr_count == 0)
-        return;
-
-    Expr **first_expr = (Expr **)alist_get(&select->expressions, 0);
-    bool is_select_star =
-        (first_expr && first_expr[0]->type == EXPR_VALUE && first_expr[0]->value.char_val &&
-         strcmp(first_expr[0]->value.char_val, "*") == 0);
-
-    int col_count = is_select_star ? alist_length(&table->schema.columns) : expr_count;
-    if (col_count <= 0)
-        return;
-
-    free_query_result(g_last_result);
-    g_last_result = NULL;
-
-    setup_query_result(&g_last_result, table, select, is_select_star, col_count);
-    if (!g_last_result)
-        return;
-
-    if (g_in_agg_context) {
-        process_aggregate_result_rows(g_last_result, &g_agg_res, select, col_count);
+/* Fills the cursor's batch column by column. Column references are read straight from the
+   tables and aggregates from the input batch; only computed values are copied. */
+static bool project_stream(Operator *op, const RowBatch *batch, int col_count) {
+    ProjectState *state = op->state;
+    const ProjectPlan *project = &op->plan->plan.project;
+    ResultBatch *stream = op->ctx->stream;
+    if (!reserve_stream(stream, col_count, batch->count))
+        return false;
+    Value null_val = {0};
+    null_val.type = TYPE_NULL;
+
+    if (batch->value_count > 0) {
+        for (int j = 0; j < col_count; j++)
+            for (int k = 0; k < batch->count; k++)
+                stream->values[j * stream->capacity + k] =
+                    j < batch->value_count
+                        ? *(Value *)alist_get(&batch->values, k * batch->value_count + j)
+                        : null_val;
+    } else if (state->program) {
+        for (int first = 0; first < batch->count; first += EXPR_LANES) {
+            int n = batch->count - first < EXPR_LANES ? batch->count - first : EXPR_LANES;
+            expr_program_run(state->program, op->ctx, batch, first, n);
+            for (int j = 0; j < col_count; j++) {
+                const Expr *expr = *(Expr **)alist_get(project->expressions, j);
+                Value *column = stream->values + j * stream->capacity + first;
+                for (int k = 0; k < n; k++)
+                    column[k] = expr->type == EXPR_COLUMN
+                                    ? context_value(op->ctx, batch, first + k,
+                                                    expr->column.column_id)
+                                    : copy_value_to_arena(&stream->arena,
+                                                          expr_program_output(state->program,
+                                                                              j, k));
+            }
+            expr_program_release(state->program, n);
+        }
     } else {
-        process_regular_result_rows(g_last_result, table, select, is_select_star, col_count);
+        for (int j = 0; j < col_count; j++) {
+            Expr **expr = project->select_star ? NULL : (Expr **)alist_get(project->expressions, j);
+            Value *column = stream->values + j * stream->capacity;
+            for (int k = 0; k < batch->count; k++) {
+                if (!expr) {
+                    column[k] = context_value(op->ctx, batch, k, (uint16_t)j);
+                } else if (expr[0]->type == EXPR_COLUMN) {
+                    column[k] = context_value(op->ctx, batch, k, expr[0]->column.column_id);
+                } else {
+                    Value computed = eval_select_expression(
+                        expr[0], context_row(op->ctx, batch, k), op->ctx->schema);
+                    column[k] = copy_value_to_arena(&stream->arena, &computed);
+                    free_value(&computed);
+                }
+            }
+        }
     }
+    stream->row_count = batch->count;
+    return true;
+}
 
-    print_query_output(g_last_result);
+bool project_next(Operator *op, RowBatch *out) {
+    ProjectState *state = op->state;
+    if (!operator_next(op->left, &state->input))
+        return false;
+    row_batch_reset(out, 0);
+    out->count = state->input.count;
+    if (op->ctx->stream)
+        return project_stream(op, &state->input, state->col_count);
+    if (state->input.value_count > 0)
+        project_values(op->ctx->result, &state->input, state->col_count);
+    else if (state->program)
+        project_compiled(op, state->program, &state->input, state->col_count);
+    else
+        project_rows(op, &state->input, state->col_count);
+    return true;
+}
 
-    log_msg(LOG_INFO, "Projected %d rows from table '%s'", alist_length(&g_last_result->rows),
-            table->name);
+void project_close(Operator *op) {
+    ProjectState *state = op->state;
+    if (!state)
+        return;
+    row_batch_free(&state->input);
 }
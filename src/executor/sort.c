@@ -0,0 +1,581 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "utils.h"
+#include "values.h"
+
+/* ORDER BY evaluates each row's keys once and encodes them into one normalized byte string
+   whose memcmp order is the sort order, so sorting never dispatches on value types. Every
+   key is a type tag followed by a fixed-width or terminated payload, and DESC keys have all
+   their bytes inverted. NULLs take the highest tag: last ascending, first descending.
+
+   With a LIMIT the operator keeps only the best rows in a bounded max-heap. Otherwise rows
+   collect in memory until they exceed work_mem; each full buffer is sorted and written to a
+   temporary file as a run, and the runs are merged when the input ends. */
+#define KEY_TAG_NULL 0xFF
+#define KEY_PREFIX_BYTES 8
+
+typedef struct {
+    uint64_t prefix; /* first key bytes, big-endian, so most comparisons stop here */
+    size_t key_off;
+    uint32_t key_len;
+    int64_t seq; /* input position, breaking ties so equal keys keep their order */
+    int ids[MAX_JOIN_TABLES];
+} SortEntry;
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} KeyBuf;
+
+typedef struct {
+    SpillFile file;
+    KeyBuf key;
+    int ids[MAX_JOIN_TABLES];
+} SortRun;
+
+typedef struct {
+    RowBatch input;
+    int width;
+    int key_count;
+    bool *desc;
+    uint32_t limit; /* top-K size, 0 for a full sort */
+    KeyBuf keys;
+    SortEntry *entries;
+    int entry_count;
+    int entry_cap;
+    size_t live_key_bytes;
+    SortRun *runs;
+    int run_count;
+    int *heap; /* run indices, a min-heap on their current record */
+    int heap_len;
+    long long row_count;
+    int next;
+    size_t charged; /* to the statement's memory account */
+    bool sorted;
+    bool failed;
+} SortState;
+
+static SortStats g_sort_stats;
+
+void sort_get_stats(SortStats *stats) {
+    *stats = g_sort_stats;
+}
+
+/* Key encoding. */
+
+static bool key_reserve(KeyBuf *buf, size_t extra) {
+    if (buf->len + extra <= buf->cap)
+        return true;
+    size_t cap = buf->cap > 0 ? buf->cap : 256;
+    while (cap < buf->len + extra)
+        cap *= 2;
+    uint8_t *data = realloc(buf->data, cap);
+    if (!data) {
+        buf->failed = true;
+        return false;
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return true;
+}
+
+static void key_put(KeyBuf *buf, const void *bytes, size_t n) {
+    if (!key_reserve(buf, n))
+        return;
+    memcopy(buf->data + buf->len, bytes, n);
+    buf->len += n;
+}
+
+static void key_put_u8(KeyBuf *buf, uint8_t byte) {
+    key_put(buf, &byte, 1);
+}
+
+static void key_put_u64(KeyBuf *buf, uint64_t bits) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++)
+        bytes[i] = (uint8_t)(bits >> (56 - 8 * i));
+    key_put(buf, bytes, 8);
+}
+
+static void key_put_int(KeyBuf *buf, int64_t val) {
+    key_put_u64(buf, (uint64_t)val ^ (1ULL << 63));
+}
+
+/* Orders like <: negative doubles have every bit flipped, positive ones only the sign. */
+static void key_put_double(KeyBuf *buf, double val) {
+    if (val == 0)
+        val = 0; /* -0.0 equals 0.0 */
+    if (isnan(val))
+        val = NAN;
+    uint64_t bits;
+    memcopy(&bits, &val, sizeof(bits));
+    key_put_u64(buf, bits >> 63 ? ~bits : bits | (1ULL << 63));
+}
+
+/* INT and FLOAT values compare numerically with each other, as compare_values does: the key
+   is the value as a double, then the part of an INT the double could not hold. */
+static void key_put_numeric(KeyBuf *buf, const Value *val) {
+    if (val->type == TYPE_FLOAT) {
+        key_put_double(buf, val->float_val);
+        key_put_int(buf, 0);
+        return;
+    }
+    double approx = (double)val->int_val;
+    int64_t whole = approx >= 9223372036854775807.0 ? INT64_MAX : (int64_t)approx;
+    key_put_double(buf, approx);
+    key_put_int(buf, (int64_t)val->int_val - whole);
+}
+
+static uint8_t key_tag(DataType type) {
+    return (uint8_t)(1 + (type == TYPE_FLOAT ? TYPE_INT : type));
+}
+
+static void encode_key(KeyBuf *buf, const Value *val, bool desc) {
+    size_t start = buf->len;
+    if (is_null(val)) {
+        key_put_u8(buf, KEY_TAG_NULL);
+    } else {
+        key_put_u8(buf, key_tag(val->type));
+        switch (val->type) {
+        case TYPE_INT:
+        case TYPE_FLOAT:
+            key_put_numeric(buf, val);
+            break;
+        case TYPE_STRING: {
+            const char *str = value_str(val) ? value_str(val) : "";
+            key_put(buf, str, strlen(str) + 1);
+            break;
+        }
+        case TYPE_BOOLEAN:
+            key_put_u8(buf, val->bool_val ? 1 : 0);
+            break;
+        case TYPE_DATE:
+            key_put_int(buf, val->date_val);
+            break;
+        case TYPE_TIME:
+            key_put_int(buf, val->time_val);
+            break;
+        case TYPE_DECIMAL:
+            key_put_double(buf,
+                           (double)val->decimal_val.value / pow(10, val->decimal_val.scale));
+            break;
+        case TYPE_BLOB:
+            /* 0x00 is escaped as 0x00 0xFF and the end marked by 0x00 0x00, so a blob
+               orders before every blob it is a prefix of. */
+            for (size_t i = 0; i < val->blob_val.length; i++) {
+                uint8_t byte = ((const uint8_t *)val->blob_val.data)[i];
+                key_put_u8(buf, byte);
+                if (byte == 0)
+                    key_put_u8(buf, 0xFF);
+            }
+            key_put_u8(buf, 0);
+            key_put_u8(buf, 0);
+            break;
+        default:
+            break;
+        }
+    }
+    if (desc && buf->data)
+        for (size_t i = start; i < buf->len; i++)
+            buf->data[i] = (uint8_t)~buf->data[i];
+}
+
+static uint64_t key_prefix(const uint8_t *key, uint32_t len) {
+    uint64_t prefix = 0;
+    for (int i = 0; i < KEY_PREFIX_BYTES; i++)
+        prefix = (prefix << 8) | (i < (int)len ? key[i] : 0);
+    return prefix;
+}
+
+static int compare_keys(const uint8_t *a, uint32_t a_len, const uint8_t *b, uint32_t b_len) {
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (cmp != 0)
+        return cmp;
+    return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+static int compare_entries(const SortState *state, const SortEntry *a, const SortEntry *b) {
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+    int cmp = compare_keys(state->keys.data + a->key_off, a->key_len,
+                           state->keys.data + b->key_off, b->key_len);
+    if (cmp != 0)
+        return cmp;
+    return a->seq < b->seq ? -1 : (a->seq > b->seq ? 1 : 0);
+}
+
+/* In-memory runs. */
+
+static void merge_sort_entries(const SortState *state, SortEntry *entries, SortEntry *tmp,
+                               int n) {
+    for (int width = 1; width < n; width *= 2) {
+        for (int lo = 0; lo < n; lo += 2 * width) {
+            int mid = lo + width < n ? lo + width : n;
+            int hi = lo + 2 * width < n ? lo + 2 * width : n;
+            int i = lo, j = mid, k = lo;
+            while (i < mid && j < hi)
+                tmp[k++] = compare_entries(state, &entries[j], &entries[i]) < 0 ? entries[j++]
+                                                                               : entries[i++];
+            while (i < mid)
+                tmp[k++] = entries[i++];
+            while (j < hi)
+                tmp[k++] = entries[j++];
+        }
+        memcopy(entries, tmp, sizeof(SortEntry) * (size_t)n);
+    }
+}
+
+static bool sort_entries(SortState *state) {
+    if (state->entry_count < 2)
+        return true;
+    SortEntry *tmp = malloc(sizeof(SortEntry) * (size_t)state->entry_count);
+    if (!tmp)
+        return false;
+    merge_sort_entries(state, state->entries, tmp, state->entry_count);
+    free(tmp);
+    return true;
+}
+
+static SortEntry *append_entry(SortState *state) {
+    if (state->entry_count == state->entry_cap) {
+        int cap = state->entry_cap > 0 ? state->entry_cap * 2 : 256;
+        SortEntry *entries = realloc(state->entries, sizeof(SortEntry) * (size_t)cap);
+        if (!entries)
+            return NULL;
+        state->entries = entries;
+        state->entry_cap = cap;
+    }
+    return &state->entries[state->entry_count++];
+}
+
+static size_t memory_used(const SortState *state) {
+    return state->keys.len + sizeof(SortEntry) * (size_t)state->entry_count;
+}
+
+static size_t memory_held(const SortState *state) {
+    return state->keys.cap + sizeof(SortEntry) * (size_t)state->entry_cap;
+}
+
+/* Top-K: entries[0..entry_count) is a max-heap holding the best rows seen so far. A
+   newcomer comes after every row already seen with an equal key, so it only enters when its
+   key is strictly smaller than the worst one kept. */
+
+static void heap_sift_down(SortState *state, int pos) {
+    SortEntry *heap = state->entries;
+    int n = state->entry_count;
+    for (;;) {
+        int largest = pos, left = 2 * pos + 1, right = left + 1;
+        if (left < n && compare_entries(state, &heap[left], &heap[largest]) > 0)
+            largest = left;
+        if (right < n && compare_entries(state, &heap[right], &heap[largest]) > 0)
+            largest = right;
+        if (largest == pos)
+            return;
+        SortEntry tmp = heap[pos];
+        heap[pos] = heap[largest];
+        heap[largest] = tmp;
+        pos = largest;
+    }
+}
+
+static void heap_sift_up(SortState *state, int pos) {
+    SortEntry *heap = state->entries;
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (compare_entries(state, &heap[pos], &heap[parent]) <= 0)
+            return;
+        SortEntry tmp = heap[pos];
+        heap[pos] = heap[parent];
+        heap[parent] = tmp;
+        pos = parent;
+    }
+}
+
+/* Evicted rows leave their keys behind; copy the live ones out once they are outnumbered. */
+static bool compact_keys(SortState *state) {
+    if (state->keys.len < 2 * state->live_key_bytes + 4096)
+        return true;
+    KeyBuf fresh = {0};
+    if (!key_reserve(&fresh, state->live_key_bytes))
+        return false;
+    for (int i = 0; i < state->entry_count; i++) {
+        SortEntry *entry = &state->entries[i];
+        memcopy(fresh.data + fresh.len, state->keys.data + entry->key_off, entry->key_len);
+        entry->key_off = fresh.len;
+        fresh.len += entry->key_len;
+    }
+    free(state->keys.data);
+    state->keys = fresh;
+    return true;
+}
+
+/* Adds the row just encoded at keys[key_off..len) to the heap, or drops it. */
+static bool top_k_add(SortState *state, size_t key_off, const int *ids) {
+    SortEntry candidate = {0};
+    candidate.key_off = key_off;
+    candidate.key_len = (uint32_t)(state->keys.len - key_off);
+    candidate.prefix = key_prefix(state->keys.data + key_off, candidate.key_len);
+    candidate.seq = state->row_count;
+    memcopy(candidate.ids, ids, sizeof(candidate.ids));
+
+    if ((uint32_t)state->entry_count < state->limit) {
+        SortEntry *slot = append_entry(state);
+        if (!slot)
+            return false;
+        *slot = candidate;
+        state->live_key_bytes += candidate.key_len;
+        heap_sift_up(state, state->entry_count - 1);
+        return true;
+    }
+    if (compare_entries(state, &candidate, &state->entries[0]) >= 0) {
+        state->keys.len = key_off;
+        return true;
+    }
+    state->live_key_bytes = state->live_key_bytes - state->entries[0].key_len + candidate.key_len;
+    state->entries[0] = candidate;
+    heap_sift_down(state, 0);
+    return compact_keys(state);
+}
+
+/* External runs. */
+
+static bool write_run(Operator *op, SortState *state) {
+    if (!sort_entries(state))
+        return false;
+    SortRun *runs = realloc(state->runs, sizeof(SortRun) * (size_t)(state->run_count + 1));
+    if (!runs)
+        return false;
+    state->runs = runs;
+    SortRun *run = &runs[state->run_count++];
+    memclear(run, sizeof(SortRun));
+    size_t id_bytes = sizeof(int) * (size_t)state->width;
+    bool ok = true;
+    for (int i = 0; i < state->entry_count && ok; i++) {
+        const SortEntry *entry = &state->entries[i];
+        ok = spill_write(&run->file, &entry->key_len, sizeof(entry->key_len)) &&
+             spill_write(&run->file, state->keys.data + entry->key_off, entry->key_len) &&
+             spill_write(&run->file, entry->ids, id_bytes);
+    }
+    if (!ok || !spill_rewind(&run->file)) {
+        log_msg(LOG_ERROR, "sort: Failed to write a sort run");
+        return false;
+    }
+    g_sort_stats.runs++;
+    g_sort_stats.spilled_bytes += run->file.bytes;
+    op->spilled_bytes += run->file.bytes;
+
+    state->entry_count = 0;
+    state->keys.len = 0;
+    return true;
+}
+
+static bool read_run(SortState *state, SortRun *run) {
+    uint32_t key_len;
+    if (!spill_read(&run->file, &key_len, sizeof(key_len)))
+        return false;
+    run->key.len = 0;
+    size_t id_bytes = sizeof(int) * (size_t)state->width;
+    if (!key_reserve(&run->key, key_len) || !spill_read(&run->file, run->key.data, key_len) ||
+        !spill_read(&run->file, run->ids, id_bytes)) {
+        log_msg(LOG_ERROR, "sort: Failed to read a sort run");
+        return false;
+    }
+    run->key.len = key_len;
+    return true;
+}
+
+/* Ties go to the earlier run, which holds the earlier input rows. */
+static bool run_before(const SortState *state, int a, int b) {
+    const SortRun *ra = &state->runs[a], *rb = &state->runs[b];
+    int cmp = compare_keys(ra->key.data, (uint32_t)ra->key.len, rb->key.data,
+                           (uint32_t)rb->key.len);
+    return cmp < 0 || (cmp == 0 && a < b);
+}
+
+static void run_heap_sift_down(SortState *state, int pos) {
+    int *heap = state->heap;
+    for (;;) {
+        int best = pos, left = 2 * pos + 1, right = left + 1;
+        if (left < state->heap_len && run_before(state, heap[left], heap[best]))
+            best = left;
+        if (right < state->heap_len && run_before(state, heap[right], heap[best]))
+            best = right;
+        if (best == pos)
+            return;
+        int tmp = heap[pos];
+        heap[pos] = heap[best];
+        heap[best] = tmp;
+        pos = best;
+    }
+}
+
+static bool start_merge(Operator *op, SortState *state) {
+    if (state->entry_count > 0 && !write_run(op, state))
+        return false;
+    free(state->entries);
+    state->entries = NULL;
+    state->entry_cap = 0;
+    free(state->keys.data);
+    memclear(&state->keys, sizeof(state->keys));
+    memory_track(op->ctx->memory, &state->charged, 0);
+
+    state->heap = malloc(sizeof(int) * (size_t)state->run_count);
+    if (!state->heap)
+        return false;
+    for (int i = 0; i < state->run_count; i++) {
+        if (read_run(state, &state->runs[i]))
+            state->heap[state->heap_len++] = i;
+    }
+    for (int i = state->heap_len / 2 - 1; i >= 0; i--)
+        run_heap_sift_down(state, i);
+    return true;
+}
+
+static bool merge_next(SortState *state, int *ids) {
+    if (state->heap_len == 0)
+        return false;
+    SortRun *run = &state->runs[state->heap[0]];
+    memcopy(ids, run->ids, sizeof(int) * (size_t)state->width);
+    if (!read_run(state, run))
+        state->heap[0] = state->heap[--state->heap_len];
+    run_heap_sift_down(state, 0);
+    return true;
+}
+
+/* The operator. */
+
+bool sort_open(Operator *op) {
+    const SortPlan *sort = &op->plan->plan.sort;
+    SortState *state = arena_calloc(op->ctx->arena, 1, sizeof(SortState));
+    if (!state)
+        return false;
+    op->state = state;
+    row_batch_init(&state->input);
+    state->limit = sort->limit;
+
+    state->key_count = alist_length(sort->keys);
+    state->desc = arena_calloc(op->ctx->arena, (size_t)state->key_count, sizeof(bool));
+    if (!state->desc)
+        return false;
+    for (int i = 0; i < state->key_count; i++) {
+        bool *desc = (bool *)alist_get(sort->desc, i);
+        state->desc[i] = desc && *desc;
+    }
+    return true;
+}
+
+static bool add_row(Operator *op, SortState *state, const RowBatch *batch, int k) {
+    const ArrayList *keys = op->plan->plan.sort.keys;
+    const Row *row = context_row(op->ctx, batch, k);
+    size_t key_off = state->keys.len;
+    for (int i = 0; i < state->key_count; i++) {
+        Value val = eval_select_expression(*(Expr **)alist_get(keys, i), row, op->ctx->schema);
+        encode_key(&state->keys, &val, state->desc[i]);
+        free_value(&val);
+    }
+    if (state->keys.failed)
+        return false;
+    int ids[MAX_JOIN_TABLES] = {0};
+    for (int t = 0; t < batch->width; t++)
+        ids[t] = batch->ids[t][k];
+    if (state->limit > 0) {
+        bool ok = top_k_add(state, key_off, ids);
+        state->row_count++;
+        return ok;
+    }
+
+    SortEntry *entry = append_entry(state);
+    if (!entry)
+        return false;
+    entry->key_off = key_off;
+    entry->key_len = (uint32_t)(state->keys.len - key_off);
+    entry->prefix = key_prefix(state->keys.data + key_off, entry->key_len);
+    entry->seq = state->row_count++;
+    memcopy(entry->ids, ids, sizeof(entry->ids));
+    if (exec_memory_exceeded(op->ctx, memory_used(state), 1))
+        return write_run(op, state);
+    return true;
+}
+
+static bool load_sort_input(Operator *op, SortState *state) {
+    while (operator_next(op->left, &state->input)) {
+        RowBatch *batch = &state->input;
+        state->width = batch->width;
+        for (int k = 0; k < batch->count; k++)
+            if (!add_row(op, state, batch, k))
+                return false;
+        memory_track(op->ctx->memory, &state->charged, memory_held(state));
+    }
+
+    g_sort_stats.sorts++;
+    if (state->run_count > 0) {
+        log_msg(LOG_INFO, "Sorted %lld rows in %d runs", state->row_count,
+                state->run_count + (state->entry_count > 0));
+        return start_merge(op, state);
+    }
+    if (state->limit > 0) {
+        g_sort_stats.top_k++;
+        log_msg(LOG_INFO, "Kept the first %d of %lld sorted rows", state->entry_count,
+                state->row_count);
+    } else {
+        log_msg(LOG_INFO, "Sorted %lld rows", state->row_count);
+    }
+    return sort_entries(state);
+}
+
+bool sort_next(Operator *op, RowBatch *out) {
+    SortState *state = op->state;
+    if (!state->sorted) {
+        state->sorted = true;
+        if (!load_sort_input(op, state)) {
+            log_msg(LOG_ERROR, "sort_next: Failed to sort the input");
+            state->failed = true;
+        }
+    }
+
+    row_batch_reset(out, state->width);
+    if (state->failed)
+        return false;
+    int ids[MAX_JOIN_TABLES];
+    while (out->count < FILTER_BATCH_SIZE) {
+        if (state->run_count > 0) {
+            if (!merge_next(state, ids))
+                break;
+        } else if (state->next < state->entry_count) {
+            memcopy(ids, state->entries[state->next++].ids, sizeof(ids));
+        } else {
+            break;
+        }
+        for (int t = 0; t < state->width; t++)
+            out->ids[t][out->count] = ids[t];
+        out->count++;
+    }
+    return out->count > 0;
+}
+
+void sort_close(Operator *op) {
+    SortState *state = op->state;
+    if (!state)
+        return;
+    row_batch_free(&state->input);
+    free(state->entries);
+    free(state->keys.data);
+    memory_track(op->ctx->memory, &state->charged, 0);
+    for (int i = 0; i < state->run_count; i++) {
+        spill_close(&state->runs[i].file);
+        free(state->runs[i].key.data);
+    }
+    free(state->runs);
+    free(state->heap);
+}
@@ -0,0 +1,135 @@
+#include <stdlib.h>
+
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "metrics.h"
+#include "utils.h"
+
+static _Atomic size_t g_work_mem = WORK_MEM_DEFAULT;
+
+/* 0 restores the default; tiny budgets are raised so a spill holds more than a few rows. */
+void exec_set_work_mem(size_t bytes) {
+    if (bytes == 0)
+        bytes = WORK_MEM_DEFAULT;
+    atomic_store(&g_work_mem, bytes < WORK_MEM_MIN ? WORK_MEM_MIN : bytes);
+}
+
+size_t exec_work_mem(void) {
+    return atomic_load(&g_work_mem);
+}
+
+/* The process-wide limit past which every operator spills; 0 for none. */
+void exec_set_memory_limit(size_t bytes) {
+    atomic_store(&memory_global()->limit, bytes);
+}
+
+/* Whether an operator holding held bytes in one of share equal parts of its budget (one per
+   parallel worker) should spill rather than grow: past work_mem, or past WORK_MEM_MIN while
+   the statement or the process is over its limit. */
+bool exec_memory_exceeded(const ExecContext *ctx, size_t held, int share) {
+    size_t parts = (size_t)(share > 0 ? share : 1);
+    if (held <= WORK_MEM_MIN / parts)
+        return false;
+    return held > exec_work_mem() / parts || memory_exceeded(ctx->memory);
+}
+
+/* The partition of a row with hash at a level of a partitioned spill. The top bits go first,
+   since the in-memory tables built from a partition bucket on the low ones. */
+int spill_partition(uint64_t hash, int level) {
+    return (int)(hash >> (64 - SPILL_FANOUT_BITS * (level + 1))) & (SPILL_FANOUT - 1);
+}
+
+static bool spill_flush(SpillFile *spill) {
+    if (spill->len == 0)
+        return true;
+    if (fwrite(spill->block, 1, spill->len, spill->file) != spill->len) {
+        log_msg(LOG_ERROR, "spill: Failed to write %zu bytes to a temporary file", spill->len);
+        spill->failed = true;
+        return false;
+    }
+    metrics_add(METRIC_SPILL_BYTES, spill->len);
+    spill->len = 0;
+    return true;
+}
+
+/* Appends to the file, creating it on the first write. */
+bool spill_write(SpillFile *spill, const void *data, size_t size) {
+    if (spill->failed)
+        return false;
+    if (!spill->file) {
+        spill->file = tmpfile();
+        spill->block = malloc(SPILL_BLOCK_BYTES);
+        if (!spill->file || !spill->block) {
+            log_msg(LOG_ERROR, "spill: Cannot create a temporary file");
+            spill->failed = true;
+            return false;
+        }
+    }
+    const uint8_t *bytes = data;
+    while (size > 0) {
+        if (spill->len == SPILL_BLOCK_BYTES && !spill_flush(spill))
+            return false;
+        size_t n = SPILL_BLOCK_BYTES - spill->len;
+        if (n > size)
+            n = size;
+        memcopy(spill->block + spill->len, bytes, n);
+        spill->len += n;
+        spill->bytes += n;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* Ends the writing and moves to the start for reading. The block is dropped until the
+   first read, so the files of a partitioned spill waiting their turn hold no buffer. */
+bool spill_rewind(SpillFile *spill) {
+    if (spill->failed)
+        return false;
+    if (spill->file && (!spill_flush(spill) || fflush(spill->file) != 0)) {
+        spill->failed = true;
+        return false;
+    }
+    if (spill->file)
+        rewind(spill->file);
+    free(spill->block);
+    spill->block = NULL;
+    spill->len = spill->pos = 0;
+    spill->reading = true;
+    return true;
+}
+
+/* Reads the next size bytes; false at the end of the file or on an error. */
+bool spill_read(SpillFile *spill, void *data, size_t size) {
+    if (spill->failed || !spill->file)
+        return false;
+    uint8_t *bytes = data;
+    while (size > 0) {
+        if (spill->pos == spill->len) {
+            if (!spill->block && !(spill->block = malloc(SPILL_BLOCK_BYTES))) {
+                spill->failed = true;
+                return false;
+            }
+            spill->len = fread(spill->block, 1, SPILL_BLOCK_BYTES, spill->file);
+            spill->pos = 0;
+            if (spill->len == 0)
+                return false;
+        }
+        size_t n = spill->len - spill->pos;
+        if (n > size)
+            n = size;
+        memcopy(bytes, spill->block + spill->pos, n);
+        spill->pos += n;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+void spill_close(SpillFile *spill) {
+    if (spill->file)
+        fclose(spill->file);
+    free(spill->block);
+    memclear(spill, sizeof(SpillFile));
+}
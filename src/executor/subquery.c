@@ -0,0 +1,392 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "utils.h"
+#include "values.h"
+
+/* Open-addressing set of key tuples of width values, each with flags. */
+#define KEY_HAS_NULL_VALUE 1 /* an IN build row with these keys had a NULL column */
+
+typedef struct KeySet {
+    int width;
+    int count;
+    uint32_t mask;
+    uint32_t *slots; /* tuple index + 1, 0 when empty */
+    Value *keys;     /* count * width, copied into the state's arena */
+    uint8_t *flags;
+    int capacity; /* tuples keys and flags have room for */
+    BloomFilter bloom; /* of the semi join keys once built, words NULL before */
+} KeySet;
+
+static SubqueryStats g_subquery_stats;
+
+/* States with a cached result, released when the statement ends. */
+static SubqueryState *g_cached_states;
+
+void subquery_get_stats(SubqueryStats *stats) {
+    *stats = g_subquery_stats;
+}
+
+/* value_equals does not coerce, so whole floats are keyed as ints and meet equal ints. */
+static Value normalize_key(Value val) {
+    if (val.type == TYPE_FLOAT && fabs(val.float_val) < 9.2e18 &&
+        (double)(long long)val.float_val == val.float_val) {
+        val.type = TYPE_INT;
+        val.int_val = (long long)val.float_val;
+    }
+    return val;
+}
+
+static uint64_t tuple_hash64(const Value *keys, int width) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < width; i++)
+        h = (h ^ value_hash(&keys[i])) * 0x100000001b3ULL;
+    return h;
+}
+
+static uint32_t tuple_hash(const Value *keys, int width) {
+    uint64_t h = tuple_hash64(keys, width);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static bool tuple_equals(const Value *a, const Value *b, int width) {
+    for (int i = 0; i < width; i++)
+        if (!value_equals(&a[i], &b[i]))
+            return false;
+    return true;
+}
+
+static KeySet *keyset_create(int width) {
+    KeySet *set = calloc(1, sizeof(KeySet));
+    uint32_t *slots = calloc(64, sizeof(uint32_t));
+    if (!set || !slots) {
+        free(set);
+        free(slots);
+        return NULL;
+    }
+    set->width = width;
+    set->mask = 63;
+    set->slots = slots;
+    return set;
+}
+
+static void keyset_free(KeySet *set) {
+    if (!set)
+        return;
+    free(set->slots);
+    free(set->keys);
+    free(set->flags);
+    free(set);
+}
+
+static int keyset_find(const KeySet *set, const Value *keys) {
+    uint32_t slot = tuple_hash(keys, set->width) & set->mask;
+    while (set->slots[slot]) {
+        int entry = (int)set->slots[slot] - 1;
+        if (tuple_equals(&set->keys[(size_t)entry * set->width], keys, set->width))
+            return entry;
+        slot = (slot + 1) & set->mask;
+    }
+    return -1;
+}
+
+static bool keyset_grow(KeySet *set) {
+    if (set->count == set->capacity) {
+        int capacity = set->capacity ? set->capacity * 2 : 32;
+        Value *keys = realloc(set->keys, sizeof(Value) * (size_t)capacity * set->width);
+        if (keys)
+            set->keys = keys;
+        uint8_t *flags = keys ? realloc(set->flags, (size_t)capacity) : NULL;
+        if (!flags)
+            return false;
+        set->flags = flags;
+        set->capacity = capacity;
+    }
+    if ((uint32_t)set->count * 2 < set->mask + 1)
+        return true;
+    uint32_t mask = set->mask * 2 + 1;
+    uint32_t *slots = calloc((size_t)mask + 1, sizeof(uint32_t));
+    if (!slots)
+        return false;
+    for (int i = 0; i < set->count; i++) {
+        uint32_t slot = tuple_hash(&set->keys[(size_t)i * set->width], set->width) & mask;
+        while (slots[slot])
+            slot = (slot + 1) & mask;
+        slots[slot] = (uint32_t)i + 1;
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->mask = mask;
+    return true;
+}
+
+/* The entry of keys, added (with its values copied into arena) when it is new; -1 when out
+   of memory. */
+static int keyset_insert(KeySet *set, Arena *arena, const Value *keys) {
+    int entry = keyset_find(set, keys);
+    if (entry >= 0)
+        return entry;
+    if (!keyset_grow(set))
+        return -1;
+    entry = set->count++;
+    for (int i = 0; i < set->width; i++)
+        set->keys[(size_t)entry * set->width + i] = copy_value_to_arena(arena, &keys[i]);
+    set->flags[entry] = 0;
+    uint32_t slot = tuple_hash(keys, set->width) & set->mask;
+    while (set->slots[slot])
+        slot = (slot + 1) & set->mask;
+    set->slots[slot] = (uint32_t)entry + 1;
+    return entry;
+}
+
+static void release_state(SubqueryState *state) {
+    free_query_result(state->result);
+    state->result = NULL;
+    keyset_free(state->keys);
+    keyset_free(state->pairs);
+    state->keys = state->pairs = NULL;
+    if (state->arena)
+        arena_destroy(state->arena);
+    state->arena = NULL;
+    state->cached = false;
+}
+
+void subquery_statement_end(void) {
+    while (g_cached_states) {
+        SubqueryState *state = g_cached_states;
+        g_cached_states = state->next_cached;
+        state->next_cached = NULL;
+        release_state(state);
+    }
+}
+
+static void mark_cached(SubqueryState *state) {
+    state->cached = true;
+    state->next_cached = g_cached_states;
+    g_cached_states = state;
+}
+
+/* Runs the subquery with its outer values taken from row. The values are borrowed from the
+   outer row, which does not change while the subquery runs. */
+static QueryResult *run_subquery(const Expr *expr, const Row *row) {
+    const SubqueryState *state = expr->subquery.state;
+    for (int i = 0; i < state->outer_count; i++)
+        *state->outer[i].slot = get_column_value_by_id(row, state->outer[i].column_id);
+    QueryResult *result = exec_select_query(&expr->subquery.subquery->select);
+    for (int i = 0; i < state->outer_count; i++) {
+        memclear(state->outer[i].slot, sizeof(Value));
+        state->outer[i].slot->type = TYPE_NULL;
+    }
+    g_subquery_stats.runs++;
+    return result;
+}
+
+/* Keeps what the kind of subquery needs of result in state; an IN result becomes a value
+   list over its column, hashed when it is long enough. */
+static void keep_result(const Expr *expr, SubqueryState *state, QueryResult *result) {
+    int rows = result ? alist_length(&result->rows) : 0;
+    state->exists = rows > 0;
+    if (expr->subquery.kind == SUBQUERY_EXISTS) {
+        free_query_result(result);
+        result = NULL;
+    }
+    state->result = result;
+    memclear(&state->list, sizeof(Expr));
+    state->list.type = EXPR_LIST;
+    if (result && (expr->subquery.kind == SUBQUERY_IN || expr->subquery.kind == SUBQUERY_NOT_IN) &&
+        result->col_count == 1) {
+        state->list.list.values = (Value *)alist_data(&result->values);
+        state->list.list.count = alist_length(&result->values);
+        state->list.list.set =
+            value_set_build(&result->arena, state->list.list.values, state->list.list.count);
+    }
+}
+
+static Value first_value(const SubqueryState *state) {
+    if (state->result && alist_length(&state->result->values) > 0)
+        return copy_string_value((const Value *)alist_get(&state->result->values, 0));
+    return VAL_NULL;
+}
+
+static bool answer(const Expr *expr, const SubqueryState *state, const Row *row,
+                   const TableDef *schema) {
+    if (expr->subquery.kind == SUBQUERY_EXISTS)
+        return state->exists;
+    Value operand = eval_select_expression(expr->subquery.operand, row, schema);
+    bool match = eval_in_list(&state->list, &operand, expr->subquery.kind == SUBQUERY_NOT_IN);
+    free_value(&operand);
+    return match;
+}
+
+/* The build side of the semi join: the key tuple of every subquery row that passes the
+   residual filter (keys with a NULL never match and are left out) and, for IN, the tuple
+   extended by the subquery's column. */
+static bool build_semi_join(const Expr *expr, SubqueryState *state) {
+    const SemiJoinPlan *plan = state->semi_join;
+    matview_sync(plan->table_id);
+    Table *table = get_table_by_id(plan->table_id);
+    if (!table)
+        return false;
+    bool in = expr->subquery.kind != SUBQUERY_EXISTS;
+    Expr *column = in ? *(Expr **)alist_get(&expr->subquery.subquery->select.expressions, 0)
+                      : NULL;
+    int width = plan->key_count;
+    state->arena = arena_create(ARENA_BLOCK_SIZE);
+    state->keys = keyset_create(width);
+    state->pairs = in ? keyset_create(width + 1) : NULL;
+    mark_cached(state);
+    if (!state->arena || !state->keys || (in && !state->pairs))
+        return false;
+
+    bool ok = true;
+    Value tuple[SEMI_JOIN_MAX_KEYS + 1];
+    FilterCursor cursor;
+    filter_cursor_init(&cursor, table, plan->residual);
+    while (ok && filter_cursor_next(&cursor)) {
+        for (int k = 0; ok && k < cursor.count; k++) {
+            const Row *row = table_fetch_row(table, cursor.sel[k], &cursor.scratch);
+            if (!row)
+                continue;
+            bool null_key = false;
+            for (int i = 0; i < width; i++) {
+                Value key = eval_select_expression(plan->inner_keys[i], row, &table->schema);
+                tuple[i] = normalize_key(key);
+                null_key = null_key || is_null(&tuple[i]);
+            }
+            int entry = null_key ? -1 : keyset_insert(state->keys, state->arena, tuple);
+            ok = null_key || entry >= 0;
+            if (ok && in && !null_key) {
+                tuple[width] = normalize_key(eval_select_expression(column, row, &table->schema));
+                if (is_null(&tuple[width]))
+                    state->keys->flags[entry] |= KEY_HAS_NULL_VALUE;
+                else
+                    ok = keyset_insert(state->pairs, state->arena, tuple) >= 0;
+                free_value(&tuple[width]);
+            }
+            for (int i = 0; i < width; i++)
+                free_value(&tuple[i]);
+        }
+    }
+    filter_cursor_close(&cursor);
+    /* Most outer rows of a selective semi join miss; the Bloom filter answers those from one
+       cache line instead of the key set's slots and keys. */
+    if (ok && bloom_init(&state->keys->bloom, state->arena, state->keys->count)) {
+        for (int i = 0; i < state->keys->count; i++)
+            bloom_add(&state->keys->bloom,
+                      tuple_hash64(&state->keys->keys[(size_t)i * width], width));
+    }
+    g_subquery_stats.semi_joins++;
+    log_msg(LOG_DEBUG, "build_semi_join: %d key tuples from table '%s'", state->keys->count,
+            table->name);
+    return ok;
+}
+
+/* Probes the outer row's keys: EXISTS holds when some build row has them, IN when one also
+   has operand as its column. NOT IN holds when no build row has the keys, and otherwise
+   only when operand is not NULL, not among their columns and none of those is NULL. */
+static bool probe_semi_join(const Expr *expr, const SubqueryState *state, const Row *row,
+                            const TableDef *schema) {
+    const SemiJoinPlan *plan = state->semi_join;
+    Value tuple[SEMI_JOIN_MAX_KEYS + 1];
+    bool null_key = false;
+    for (int i = 0; i < plan->key_count; i++) {
+        tuple[i] = normalize_key(get_column_value_by_id(row, plan->outer_columns[i]));
+        null_key = null_key || is_null(&tuple[i]);
+    }
+    g_subquery_stats.probes++;
+    SubqueryKind kind = expr->subquery.kind;
+    const BloomFilter *bloom = &state->keys->bloom;
+    bool absent = null_key || (bloom->words &&
+                               !bloom_may_contain(bloom, tuple_hash64(tuple, plan->key_count)));
+    g_subquery_stats.bloom_misses += absent && !null_key;
+    int entry = absent ? -1 : keyset_find(state->keys, tuple);
+    if (kind == SUBQUERY_EXISTS)
+        return entry >= 0;
+    if (entry < 0)
+        return kind == SUBQUERY_NOT_IN;
+
+    Value operand = eval_select_expression(expr->subquery.operand, row, schema);
+    bool match = false;
+    if (!is_null(&operand)) {
+        tuple[plan->key_count] = normalize_key(operand);
+        bool found = keyset_find(state->pairs, tuple) >= 0;
+        match = kind == SUBQUERY_IN
+                    ? found
+                    : !found && !(state->keys->flags[entry] & KEY_HAS_NULL_VALUE);
+    }
+    free_value(&operand);
+    return match;
+}
+
+/* EXISTS and [NOT] IN. Uncorrelated subqueries run once per statement; correlated ones probe
+   their semi join when they have one and run for each outer row otherwise. */
+bool eval_subquery_condition(const Expr *expr, const Row *row, const TableDef *schema) {
+    SubqueryState *state = expr->subquery.state;
+    if (!state || !expr->subquery.subquery)
+        return false;
+    if (expr->subquery.kind == SUBQUERY_SCALAR) {
+        Value val = eval_subquery(expr, row, schema);
+        bool truth = !is_null(&val);
+        free_value(&val);
+        return truth;
+    }
+
+    if (state->semi_join) {
+        if (state->cached) {
+            g_subquery_stats.cache_hits++;
+        } else if (!build_semi_join(expr, state)) {
+            log_msg(LOG_WARN, "Failed to build the semi join of a subquery, running it per row");
+            state->semi_join = NULL;
+            return eval_subquery_condition(expr, row, schema);
+        }
+        return probe_semi_join(expr, state, row, schema);
+    }
+    if (state->outer_count == 0) {
+        if (state->cached) {
+            g_subquery_stats.cache_hits++;
+        } else {
+            keep_result(expr, state, run_subquery(expr, row));
+            mark_cached(state);
+        }
+        return answer(expr, state, row, schema);
+    }
+
+    SubqueryState once = {0};
+    keep_result(expr, &once, run_subquery(expr, row));
+    bool match = answer(expr, &once, row, schema);
+    free_query_result(once.result);
+    return match;
+}
+
+/* A scalar subquery's first value (NULL without rows); EXISTS and IN give 1 or 0. */
+Value eval_subquery(const Expr *expr, const Row *row, const TableDef *schema) {
+    SubqueryState *state = expr->subquery.state;
+    if (!state || !expr->subquery.subquery)
+        return VAL_NULL;
+    if (expr->subquery.kind != SUBQUERY_SCALAR) {
+        Value result = {0};
+        result.type = TYPE_INT;
+        result.int_val = eval_subquery_condition(expr, row, schema) ? 1 : 0;
+        return result;
+    }
+
+    if (state->outer_count == 0) {
+        if (state->cached) {
+            g_subquery_stats.cache_hits++;
+        } else {
+            keep_result(expr, state, run_subquery(expr, row));
+            mark_cached(state);
+        }
+        return first_value(state);
+    }
+    SubqueryState once = {0};
+    once.result = run_subquery(expr, row);
+    Value val = first_value(&once);
+    free_query_result(once.result);
+    return val;
+}
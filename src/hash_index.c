@@ -0,0 +1,522 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "logger.h"
+#include "storage.h"
+#include "table.h"
+#include "utils.h"
+#include "values.h"
+
+/* Open-addressing hash index with linear probing. ctrl[i] is HASH_CTRL_EMPTY,
+   HASH_CTRL_DELETED or 0x80 | the top 7 hash bits, so most probes reject a slot without
+   touching its key. The table doubles once live plus deleted slots pass 7/8 of capacity;
+   stored hashes make a resize a pass over the slots with no key rehashing. */
+#define HASH_CTRL_EMPTY 0x00
+#define HASH_CTRL_DELETED 0x01
+#define HASH_CTRL_FULL 0x80
+#define HASH_MIN_CAPACITY 16
+
+/* wyhash (final v4) constants and primitives. */
+static const uint64_t WY_P0 = 0xa0761d6478bd642full;
+static const uint64_t WY_P1 = 0xe7037ed1a0b428dbull;
+static const uint64_t WY_P2 = 0x8ebc6af09c88c6e3ull;
+static const uint64_t WY_P3 = 0x589965cc75374cc3ull;
+
+static void wy_mum(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 wy_u128;
+    wy_u128 r = (wy_u128)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t lo = t + (rm1 << 32);
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static uint64_t wy_mix(uint64_t a, uint64_t b) {
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t wy_read8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t wy_read4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t wy_read3(const uint8_t *p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+static uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t a, b;
+    seed ^= wy_mix(seed ^ WY_P0, WY_P1);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wy_read4(p) << 32) | wy_read4(p + ((len >> 3) << 2));
+            b = (wy_read4(p + len - 4) << 32) | wy_read4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wy_read3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wy_mix(wy_read8(p) ^ WY_P1, wy_read8(p + 8) ^ seed);
+                see1 = wy_mix(wy_read8(p + 16) ^ WY_P2, wy_read8(p + 24) ^ see1);
+                see2 = wy_mix(wy_read8(p + 32) ^ WY_P3, wy_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_read8(p) ^ WY_P1, wy_read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wy_read8(p + i - 16);
+        b = wy_read8(p + i - 8);
+    }
+
+    a ^= WY_P1;
+    b ^= seed;
+    wy_mum(&a, &b);
+    return wy_mix(a ^ WY_P0 ^ len, b ^ WY_P1);
+}
+
+static uint64_t hash_u64(uint64_t x, uint64_t seed) {
+    return wy_mix(x ^ WY_P0, seed ^ WY_P1);
+}
+
+/* Hash consistent with value_equals: equal values of the same type hash equally. The type
+   seeds the hash so INT 1 and DATE 1 land in different slots. */
+uint64_t value_hash(const Value *value) {
+    if (!value || value->type == TYPE_NULL)
+        return hash_u64(0, TYPE_NULL);
+
+    uint64_t seed = (uint64_t)value->type;
+    switch (value->type) {
+    case TYPE_INT:
+        return hash_u64((uint64_t)value->int_val, seed);
+    case TYPE_FLOAT: {
+        double d = value->float_val;
+        if (d == 0.0)
+            d = 0.0; /* -0.0 == 0.0 */
+        else if (isnan(d))
+            d = NAN;
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        return hash_u64(bits, seed);
+    }
+    case TYPE_BOOLEAN:
+        return hash_u64(value->bool_val ? 1 : 0, seed);
+    case TYPE_DECIMAL:
+        return hash_u64((uint64_t)value->decimal_val.value,
+                        hash_u64(((uint64_t)(uint32_t)value->decimal_val.precision << 32) |
+                                     (uint32_t)value->decimal_val.scale,
+                                 seed));
+    case TYPE_BLOB:
+        return hash_bytes(value->blob_val.data, value->blob_val.data ? value->blob_val.length : 0,
+                          seed);
+    case TYPE_STRING: {
+        if (value->str_format == VALUE_STR_INTERNED)
+            return string_intern_hash(value);
+        const char *str = value_str(value);
+        return hash_bytes(str, str ? strlen(str) : 0, seed);
+    }
+    case TYPE_TIME:
+        return hash_u64(value->time_val, seed);
+    case TYPE_DATE:
+        return hash_u64(value->date_val, seed);
+    default:
+        return hash_u64(0, seed);
+    }
+}
+
+/* Keys of a composite index are tuples of key_count values. A slot stores only the first;
+   the rest are compared on the slot's first row in the table. */
+static int key_width(const Index *index) {
+    return index->key_count > 0 ? index->key_count : 1;
+}
+
+static uint64_t key_hash(const Index *index, const Value *key) {
+    uint64_t hash = value_hash(&key[0]);
+    for (int i = 1; i < key_width(index); i++)
+        hash = hash_u64(value_hash(&key[i]), hash);
+    return hash;
+}
+
+static bool slot_matches(const Index *index, const HashSlot *slot, const Value *key) {
+    if (!value_equals(&slot->key, &key[0]))
+        return false;
+    int width = key_width(index);
+    if (width == 1)
+        return true;
+    const Table *table = get_table_by_id(index->table_id);
+    if (!table)
+        return false;
+    for (int i = 1; i < width; i++) {
+        uint16_t column_id = *(uint16_t *)alist_get(&index->columns, i);
+        Value stored = table_get_value(table, slot->row_index, column_id);
+        if (!value_equals(&stored, &key[i]))
+            return false;
+    }
+    return true;
+}
+
+static uint8_t ctrl_tag(uint64_t hash) {
+    return (uint8_t)(HASH_CTRL_FULL | (hash >> 57));
+}
+
+static bool hash_alloc_table(Index *index, uint32_t capacity) {
+    HashSlot *slots = malloc(sizeof(HashSlot) * capacity);
+    uint8_t *ctrl = calloc(capacity, sizeof(uint8_t));
+    if (!slots || !ctrl) {
+        log_msg(LOG_ERROR, "hash_index: Failed to allocate %u slots", capacity);
+        free(slots);
+        free(ctrl);
+        return false;
+    }
+    index->data.hash.slots = slots;
+    index->data.hash.ctrl = ctrl;
+    index->data.hash.capacity = capacity;
+    index->data.hash.used = 0;
+    return true;
+}
+
+bool hash_index_init(Index *index) {
+    memclear(&index->data.hash, sizeof(index->data.hash));
+    index->data.hash.overflow_free = -1;
+    return hash_alloc_table(index, HASH_MIN_CAPACITY);
+}
+
+/* An index loaded from a snapshot borrows its arrays from the mapping; they are moved to
+   the heap before a rehash or overflow growth would free or reallocate them, and before the
+   first insert, whose key copy the index owns and hash_index_free only frees off the heap. */
+static bool hash_detach(Index *index) {
+    if (!index->data.hash.map)
+        return true;
+    uint32_t capacity = index->data.hash.capacity;
+    uint32_t overflow_cap = index->data.hash.overflow_cap;
+    HashSlot *slots = malloc(sizeof(HashSlot) * capacity);
+    uint8_t *ctrl = malloc(capacity);
+    HashOverflow *overflow = overflow_cap ? malloc(sizeof(HashOverflow) * overflow_cap) : NULL;
+    if (!slots || !ctrl || (overflow_cap && !overflow)) {
+        log_msg(LOG_ERROR, "hash_index: Failed to copy a mapped index");
+        free(slots);
+        free(ctrl);
+        free(overflow);
+        return false;
+    }
+    memcopy(slots, index->data.hash.slots, sizeof(HashSlot) * capacity);
+    memcopy(ctrl, index->data.hash.ctrl, capacity);
+    if (overflow)
+        memcopy(overflow, index->data.hash.overflow, sizeof(HashOverflow) * overflow_cap);
+    index->data.hash.slots = slots;
+    index->data.hash.ctrl = ctrl;
+    index->data.hash.overflow = overflow;
+    storage_map_release(index->data.hash.map);
+    index->data.hash.map = NULL;
+    return true;
+}
+
+/* True when every key can be copied bytewise, so the slot array can be written to a
+   snapshot and mapped back: no heap or interned strings and no blobs. */
+bool hash_index_relocatable(const Index *index) {
+    for (uint32_t i = 0; i < index->data.hash.capacity; i++) {
+        if (!(index->data.hash.ctrl[i] & HASH_CTRL_FULL))
+            continue;
+        const Value *key = &index->data.hash.slots[i].key;
+        if (key->type == TYPE_BLOB || (key->type == TYPE_STRING &&
+                                       key->str_format != VALUE_STR_INLINE))
+            return false;
+    }
+    return true;
+}
+
+void hash_index_free(Index *index) {
+    HashSlot *slots = index->data.hash.slots;
+    uint8_t *ctrl = index->data.hash.ctrl;
+    if (index->data.hash.map) {
+        storage_map_release(index->data.hash.map);
+        slots = NULL;
+        ctrl = NULL;
+        index->data.hash.overflow = NULL;
+    }
+    for (uint32_t i = 0; slots && i < index->data.hash.capacity; i++) {
+        if (ctrl[i] & HASH_CTRL_FULL)
+            free_value(&slots[i].key);
+    }
+    free(slots);
+    free(ctrl);
+    free(index->data.hash.overflow);
+    memclear(&index->data.hash, sizeof(index->data.hash));
+    index->data.hash.overflow_free = -1;
+    index->entry_count = 0;
+}
+
+/* Moves every live slot into a fresh table of new_capacity, dropping deleted markers. */
+static bool hash_rehash(Index *index, uint32_t new_capacity) {
+    if (!hash_detach(index))
+        return false;
+    HashSlot *old_slots = index->data.hash.slots;
+    uint8_t *old_ctrl = index->data.hash.ctrl;
+    uint32_t old_capacity = index->data.hash.capacity;
+
+    if (!hash_alloc_table(index, new_capacity)) {
+        index->data.hash.slots = old_slots;
+        index->data.hash.ctrl = old_ctrl;
+        index->data.hash.capacity = old_capacity;
+        return false;
+    }
+
+    uint32_t mask = new_capacity - 1;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (!(old_ctrl[i] & HASH_CTRL_FULL))
+            continue;
+        uint32_t pos = (uint32_t)old_slots[i].hash & mask;
+        while (index->data.hash.ctrl[pos] != HASH_CTRL_EMPTY)
+            pos = (pos + 1) & mask;
+        index->data.hash.ctrl[pos] = old_ctrl[i];
+        index->data.hash.slots[pos] = old_slots[i];
+    }
+    index->data.hash.used = index->data.hash.key_count;
+    free(old_slots);
+    free(old_ctrl);
+    return true;
+}
+
+static int hash_find_slot(const Index *index, const Value *key, uint64_t hash) {
+    const HashSlot *slots = index->data.hash.slots;
+    const uint8_t *ctrl = index->data.hash.ctrl;
+    uint32_t mask = index->data.hash.capacity - 1;
+    uint8_t tag = ctrl_tag(hash);
+
+    for (uint32_t pos = (uint32_t)hash & mask, probes = 0; probes <= mask;
+         pos = (pos + 1) & mask, probes++) {
+        if (ctrl[pos] == HASH_CTRL_EMPTY)
+            return -1;
+        if (ctrl[pos] == tag && slots[pos].hash == hash && slot_matches(index, &slots[pos], key))
+            return (int)pos;
+    }
+    return -1;
+}
+
+static void hash_remove_slot(Index *index, uint32_t pos) {
+    uint32_t mask = index->data.hash.capacity - 1;
+    free_value(&index->data.hash.slots[pos].key);
+    /* A slot followed by an empty one ends every probe chain through it, so it can go back
+       to empty instead of leaving a deleted marker. */
+    if (index->data.hash.ctrl[(pos + 1) & mask] == HASH_CTRL_EMPTY) {
+        index->data.hash.ctrl[pos] = HASH_CTRL_EMPTY;
+        index->data.hash.used--;
+    } else {
+        index->data.hash.ctrl[pos] = HASH_CTRL_DELETED;
+    }
+    index->data.hash.key_count--;
+}
+
+static int hash_alloc_overflow(Index *index) {
+    if (index->data.hash.overflow_free >= 0) {
+        int node = index->data.hash.overflow_free;
+        index->data.hash.overflow_free = index->data.hash.overflow[node].next;
+        return node;
+    }
+    if (index->data.hash.overflow_len == index->data.hash.overflow_cap) {
+        if (!hash_detach(index))
+            return -1;
+        uint32_t new_cap = index->data.hash.overflow_cap ? index->data.hash.overflow_cap * 2 : 16;
+        HashOverflow *grown = realloc(index->data.hash.overflow, sizeof(HashOverflow) * new_cap);
+        if (!grown) {
+            log_msg(LOG_ERROR, "hash_index: Failed to grow overflow rows");
+            return -1;
+        }
+        index->data.hash.overflow = grown;
+        index->data.hash.overflow_cap = new_cap;
+    }
+    return (int)index->data.hash.overflow_len++;
+}
+
+static void hash_release_overflow(Index *index, int node) {
+    index->data.hash.overflow[node].next = index->data.hash.overflow_free;
+    index->data.hash.overflow_free = node;
+}
+
+bool hash_index_insert(Index *index, const Value *key, int row_index) {
+    if (!index->data.hash.slots || is_null(key) || !hash_detach(index))
+        return false;
+
+    uint64_t hash = key_hash(index, key);
+    int found = hash_find_slot(index, key, hash);
+    if (found >= 0) {
+        int node = hash_alloc_overflow(index);
+        if (node < 0)
+            return false;
+        HashSlot *slot = &index->data.hash.slots[found];
+        index->data.hash.overflow[node].row_index = row_index;
+        index->data.hash.overflow[node].next = slot->overflow;
+        slot->overflow = node;
+        index->entry_count++;
+        return true;
+    }
+
+    uint32_t capacity = index->data.hash.capacity;
+    if ((uint64_t)(index->data.hash.used + 1) * 8 > (uint64_t)capacity * 7) {
+        /* Mostly deleted markers: rehash in place rather than doubling. */
+        uint32_t new_capacity =
+            index->data.hash.key_count * 2 < index->data.hash.used ? capacity : capacity * 2;
+        if (!hash_rehash(index, new_capacity))
+            return false;
+    }
+
+    uint32_t mask = index->data.hash.capacity - 1;
+    uint32_t pos = (uint32_t)hash & mask;
+    while (index->data.hash.ctrl[pos] & HASH_CTRL_FULL)
+        pos = (pos + 1) & mask;
+
+    if (index->data.hash.ctrl[pos] == HASH_CTRL_EMPTY)
+        index->data.hash.used++;
+    index->data.hash.ctrl[pos] = ctrl_tag(hash);
+    HashSlot *slot = &index->data.hash.slots[pos];
+    slot->hash = hash;
+    /* Only a composite key's first column is stored; slot_matches compares the others
+       against the row the slot points to. */
+    slot->key = copy_value(&key[0]);
+    slot->row_index = row_index;
+    slot->overflow = -1;
+    index->data.hash.key_count++;
+    index->entry_count++;
+    return true;
+}
+
+bool hash_index_delete(Index *index, const Value *key, int row_index) {
+    if (!index->data.hash.slots || is_null(key))
+        return false;
+
+    int found = hash_find_slot(index, key, key_hash(index, key));
+    if (found < 0)
+        return false;
+
+    HashSlot *slot = &index->data.hash.slots[found];
+    HashOverflow *overflow = index->data.hash.overflow;
+    if (slot->row_index == row_index) {
+        int head = slot->overflow;
+        if (head < 0) {
+            hash_remove_slot(index, (uint32_t)found);
+        } else {
+            slot->row_index = overflow[head].row_index;
+            slot->overflow = overflow[head].next;
+            hash_release_overflow(index, head);
+        }
+        index->entry_count--;
+        return true;
+    }
+
+    for (int *link = &slot->overflow; *link >= 0; link = &overflow[*link].next) {
+        int node = *link;
+        if (overflow[node].row_index == row_index) {
+            *link = overflow[node].next;
+            hash_release_overflow(index, node);
+            index->entry_count--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* new_rows[old] is the row's index after compaction, or -1 if it was deleted. */
+void hash_index_remap(Index *index, const int *new_rows) {
+    HashOverflow *overflow = index->data.hash.overflow;
+    for (uint32_t i = 0; i < index->data.hash.capacity; i++) {
+        if (!(index->data.hash.ctrl[i] & HASH_CTRL_FULL))
+            continue;
+        HashSlot *slot = &index->data.hash.slots[i];
+
+        for (int *link = &slot->overflow; *link >= 0;) {
+            int node = *link;
+            int mapped = new_rows[overflow[node].row_index];
+            if (mapped < 0) {
+                *link = overflow[node].next;
+                hash_release_overflow(index, node);
+                index->entry_count--;
+                continue;
+            }
+            overflow[node].row_index = mapped;
+            link = &overflow[node].next;
+        }
+
+        int mapped = new_rows[slot->row_index];
+        if (mapped >= 0) {
+            slot->row_index = mapped;
+            continue;
+        }
+        index->entry_count--;
+        int head = slot->overflow;
+        if (head < 0) {
+            hash_remove_slot(index, i);
+        } else {
+            slot->row_index = overflow[head].row_index;
+            slot->overflow = overflow[head].next;
+            hash_release_overflow(index, head);
+        }
+    }
+}
+
+/* True if key maps to any row other than exclude_row; used by the constraint checks. */
+bool hash_index_contains(const Index *index, const Value *key, int exclude_row) {
+    if (!index->data.hash.slots || is_null(key))
+        return false;
+
+    int found = hash_find_slot(index, key, key_hash(index, key));
+    if (found < 0)
+        return false;
+
+    const HashSlot *slot = &index->data.hash.slots[found];
+    if (slot->row_index != exclude_row)
+        return true;
+    for (int node = slot->overflow; node >= 0; node = index->data.hash.overflow[node].next)
+        if (index->data.hash.overflow[node].row_index != exclude_row)
+            return true;
+    return false;
+}
+
+void hash_index_lookup(const Index *index, const Value *key, ArrayList *out) {
+    if (!index->data.hash.slots || is_null(key))
+        return;
+
+    int found = hash_find_slot(index, key, key_hash(index, key));
+    if (found < 0)
+        return;
+
+    const HashSlot *slot = &index->data.hash.slots[found];
+    int *row_idx = (int *)alist_append(out);
+    if (row_idx)
+        *row_idx = slot->row_index;
+    for (int node = slot->overflow; node >= 0; node = index->data.hash.overflow[node].next) {
+        row_idx = (int *)alist_append(out);
+        if (row_idx)
+            *row_idx = index->data.hash.overflow[node].row_index;
+    }
+}
@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "db.h"
+#include "logger.h"
+#include "values.h"
+
+/* The string dictionary behind DICTIONARY columns: one shared copy of every distinct string,
+   carved from an arena that lives as long as the process. Interned values point at the copy,
+   so equality is a pointer compare and the hash is computed once. Slots are open addressed
+   with linear probing and kept at most half full. */
+typedef struct {
+    uint64_t hash;
+    uint32_t length;
+    char str[];
+} InternEntry;
+
+static Arena g_intern_arena;
+static InternEntry **g_slots;
+static uint32_t g_capacity;
+static int g_count;
+
+static InternEntry *entry_of(const Value *val) {
+    return (InternEntry *)(val->char_val - offsetof(InternEntry, str));
+}
+
+static uint64_t hash_string(const char *str) {
+    Value plain = {0};
+    plain.type = TYPE_STRING;
+    plain.char_val = (char *)str;
+    return value_hash(&plain);
+}
+
+static InternEntry **find_slot(InternEntry **slots, uint32_t capacity, const char *str,
+                               size_t len, uint64_t hash) {
+    uint32_t mask = capacity - 1;
+    for (uint32_t i = (uint32_t)hash & mask;; i = (i + 1) & mask) {
+        InternEntry *entry = slots[i];
+        if (!entry || (entry->hash == hash && entry->length == len &&
+                       memcmp(entry->str, str, len) == 0))
+            return &slots[i];
+    }
+}
+
+static bool grow_slots(void) {
+    uint32_t capacity = g_capacity ? g_capacity * 2 : 256;
+    InternEntry **slots = calloc(capacity, sizeof(InternEntry *));
+    if (!slots) {
+        log_msg(LOG_ERROR, "string_intern: Failed to allocate %u slots", capacity);
+        return false;
+    }
+    for (uint32_t i = 0; i < g_capacity; i++) {
+        InternEntry *entry = g_slots[i];
+        if (entry)
+            *find_slot(slots, capacity, entry->str, entry->length, entry->hash) = entry;
+    }
+    free(g_slots);
+    g_slots = slots;
+    g_capacity = capacity;
+    return true;
+}
+
+static Value interned_value(InternEntry *entry) {
+    Value val = {0};
+    val.type = TYPE_STRING;
+    val.str_format = VALUE_STR_INTERNED;
+    val.char_val = entry->str;
+    return val;
+}
+
+Value string_intern(const char *str) {
+    if ((uint32_t)(g_count + 1) * 2 > g_capacity && !grow_slots())
+        return make_string_value(str);
+
+    size_t len = strlen(str);
+    uint64_t hash = hash_string(str);
+    InternEntry **slot = find_slot(g_slots, g_capacity, str, len, hash);
+    if (!*slot) {
+        if (g_intern_arena.block_size == 0)
+            arena_init(&g_intern_arena, ARENA_BLOCK_SIZE);
+        InternEntry *entry = arena_alloc(&g_intern_arena, sizeof(InternEntry) + len + 1);
+        if (!entry)
+            return make_string_value(str);
+        entry->hash = hash;
+        entry->length = (uint32_t)len;
+        memcpy(entry->str, str, len + 1);
+        *slot = entry;
+        g_count++;
+    }
+    return interned_value(*slot);
+}
+
+/* Looks a string up without adding it; a miss means no interned value can equal it. */
+bool string_intern_find(const char *str, Value *out) {
+    if (g_capacity == 0)
+        return false;
+    size_t len = strlen(str);
+    InternEntry *entry = *find_slot(g_slots, g_capacity, str, len, hash_string(str));
+    if (entry && out)
+        *out = interned_value(entry);
+    return entry != NULL;
+}
+
+uint64_t string_intern_hash(const Value *val) {
+    return entry_of(val)->hash;
+}
+
+int string_intern_count(void) {
+    return g_count;
+}
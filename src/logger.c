@@ -9,7 +9,11 @@
 
 #include "utils.h"
 
-LogLevel g_log_level = LOG_INFO;
+LogLevel g_log_level = LOG_WARN;
+
+static _Thread_local unsigned g_error_count;
+static _Thread_local char g_last_error[256];
+static _Thread_local bool g_muted;
 
 #define COLOR_RESET "\x1b[0m"
 #define COLOR_RED "\x1b[31m"
@@ -122,7 +126,16 @@ LogLevel log_level_from_str(const char *level_str) {
         return LOG_INFO;
 }
 
-void log_msg(LogLevel level, const char *fmt, ...) {
+void log_write(LogLevel level, const char *fmt, ...) {
+    if (g_muted)
+        return;
+    if (level == LOG_ERROR) {
+        va_list ap;
+        va_start(ap, fmt);
+        string_format_v(g_last_error, sizeof(g_last_error), fmt, ap);
+        va_end(ap);
+        g_error_count++;
+    }
     if (level < g_log_level)
         return;
     time_t t = time(NULL);
@@ -142,6 +155,18 @@ void log_msg(LogLevel level, const char *fmt, ...) {
     fputs(line, stderr);
 }
 
+void log_mute(bool mute) {
+    g_muted = mute;
+}
+
+unsigned log_error_count(void) {
+    return g_error_count;
+}
+
+const char *log_last_error(void) {
+    return g_last_error;
+}
+
 void show_prominent_error(const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
@@ -1,11 +1,22 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 #include "arraylist.h"
 #include "db.h"
+#include "dbapi.h"
+#include "executor.h"
 #include "logger.h"
+#include "metrics.h"
+#include "server.h"
+#include "storage.h"
+#include "thread_pool.h"
+#include "txn.h"
 #include "utils.h"
 #include "table.h"
 
@@ -13,13 +24,61 @@ static void print_usage(void) {
     printf("Usage: db [OPTIONS]\n");
     printf("  Simple Database System\n\n");
     printf("Options:\n");
-    printf("  --show-logs    Show debug and info logs\n");
-    printf("  --help, -h     Show this help message\n");
+    printf("  --show-logs    Show info logs (and debug logs in a make debug build)\n");
+    printf("  --data-dir DIR Keep the database in DIR (snapshot plus write-ahead log)\n");
+    printf("  --threads N    Scan with N worker threads (default: one per CPU)\n");
+    printf("  --format F     Write results as table (default), csv, tsv, jsonl or binary\n");
+    printf("  --listen ADDR  Serve clients over TCP on [host:]port instead of reading stdin\n");
+    printf("  --workers N    Run requests on N server threads (default: %d)\n",
+           SERVER_DEFAULT_WORKERS);
+    printf("  --help, -h     Show this help message\n\n");
+    printf("Commands:\n");
+    printf("  .STATS [JSON | RESET];  Show (or reset) the engine's counters and histograms\n");
 }
 
-static bool read_input_line(char *input, size_t input_size) {
-    printf("db> ");
+/* Anything but OUTPUT_TABLE streams each result to stdout as its rows are produced, with
+   no banner or prompts, so the output can be piped straight into another program. */
+static OutputFormat g_format = OUTPUT_TABLE;
+
+static Server *g_server;
+
+static void stop_server(int sig) {
+    (void)sig;
+    server_stop(g_server);
+}
+
+/* Serves until SIGINT or SIGTERM, then rolls back what the sessions left open. */
+static int serve(const char *address, int workers) {
+    g_server = server_open(address, workers);
+    if (!g_server) {
+        printf("Cannot listen on '%s'\n", address);
+        return 1;
+    }
+    struct sigaction action = {0};
+    action.sa_handler = stop_server;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    printf("Listening on port %d\n", server_port(g_server));
     fflush(stdout);
+    server_run(g_server);
+    server_close(g_server);
+    txn_shutdown();
+    thread_pool_shutdown();
+    storage_close(true);
+    alist_destroy(&tables);
+    return 0;
+}
+
+static void prompt(const char *text) {
+    if (g_format != OUTPUT_TABLE)
+        return;
+    printf("%s", text);
+    fflush(stdout);
+}
+
+static bool read_input_line(char *input, size_t input_size) {
+    prompt("db> ");
 
     input[0] = '\0';
     char line[1024];
@@ -49,8 +108,7 @@ static bool read_input_line(char *input, size_t input_size) {
             break;
         }
 
-        printf("... ");
-        fflush(stdout);
+        prompt("... ");
     }
 
     if (!has_content) {
@@ -72,6 +130,11 @@ static bool handle_meta_command(const char *command) {
         return false;
     }
 
+    if (strcmp(command, ".CHECKPOINT;") == 0 || strcmp(command, ".checkpoint;") == 0) {
+        storage_checkpoint();
+        return false;
+    }
+
     if (strcmp(command, ".LIST") == 0 || strcmp(command, ".list") == 0) {
         extern ArrayList tables;
         int table_count = alist_length(&tables);
@@ -80,7 +143,7 @@ static bool handle_meta_command(const char *command) {
             Table *table = (Table *)alist_get(&tables, i);
             if (table) {
                 int col_count = alist_length(&table->schema.columns);
-                int row_count = alist_length(&table->rows);
+                int row_count = table_live_row_count(table);
                 log_msg(LOG_DEBUG, "Table '%s': %d columns, %d rows", table->name, col_count,
                         row_count);
             }
@@ -88,6 +151,24 @@ static bool handle_meta_command(const char *command) {
         return false;
     }
 
+    /* .STATS; prints the metrics, .STATS JSON; the same as one JSON line, .STATS RESET;
+       zeroes them. */
+    if (strncasecmp(command, ".STATS", 6) == 0) {
+        const char *arg = command + 6;
+        while (*arg == ' ')
+            arg++;
+        if (strcasecmp(arg, "JSON;") == 0)
+            metrics_dump(stdout, true);
+        else if (strcasecmp(arg, "RESET;") == 0)
+            metrics_reset();
+        else if (strcmp(arg, ";") == 0)
+            metrics_dump(stdout, false);
+        else
+            log_msg(LOG_ERROR, "Usage: .STATS [JSON | RESET];");
+        fflush(stdout);
+        return false;
+    }
+
     if (command[0] == '.') {
         log_msg(LOG_ERROR, "Unknown command: %s", command);
         return false;
@@ -96,6 +177,47 @@ static bool handle_meta_command(const char *command) {
     return false;
 }
 
+/* Writes a statement's rows in g_format: a streamed SELECT batch by batch, anything else
+   (EXECUTE, several statements) row by row from its finished result. */
+static void stream_statement(const char *sql) {
+    DbStatement *stmt = db_prepare(sql);
+    if (!stmt) {
+        db_exec(sql);
+        return;
+    }
+    const ResultBatch *batch = db_step_batch(stmt);
+    int cols = db_column_count(stmt);
+    if (cols == 0) {
+        db_finalize(stmt);
+        return;
+    }
+    const char **names = malloc(sizeof(char *) * (size_t)cols);
+    Value *row = malloc(sizeof(Value) * (size_t)cols);
+    if (!names || !row) {
+        log_msg(LOG_ERROR, "stream_statement: Out of memory");
+        free(names);
+        free(row);
+        db_finalize(stmt);
+        return;
+    }
+    for (int j = 0; j < cols; j++)
+        names[j] = db_column_name(stmt, j);
+
+    ResultWriter writer;
+    result_writer_begin(&writer, stdout, g_format, cols, names);
+    for (; batch; batch = db_step_batch(stmt))
+        result_writer_batch(&writer, batch);
+    while (db_step(stmt) == DB_ROW) {
+        for (int j = 0; j < cols; j++)
+            row[j] = *db_column_value(stmt, j);
+        result_writer_row(&writer, row, 1);
+    }
+    result_writer_end(&writer);
+    free(names);
+    free(row);
+    db_finalize(stmt);
+}
+
 static void process_statement(const char *trimmed_stmt) {
     if (strcmp(trimmed_stmt, ".LIST") == 0) {
         extern ArrayList tables;
@@ -105,7 +227,7 @@ static void process_statement(const char *trimmed_stmt) {
             Table *table = (Table *)alist_get(&tables, i);
             if (table) {
                 int col_count = alist_length(&table->schema.columns);
-                int row_count = alist_length(&table->rows);
+                int row_count = table_live_row_count(table);
                 log_msg(LOG_DEBUG, "Table '%s': %d columns, %d rows", table->name, col_count,
                         row_count);
             }
@@ -114,40 +236,17 @@ static void process_statement(const char *trimmed_stmt) {
     }
 
     log_msg(LOG_DEBUG, "Processing statement: '%s'", trimmed_stmt);
-    log_msg(LOG_DEBUG, "Tokenizing input");
-
-    Token *tokens = tokenize(trimmed_stmt);
-    if (!tokens) {
-        log_msg(LOG_ERROR, "Tokenization failed for input: '%s'", trimmed_stmt);
-        return;
-    }
-
-    log_msg(LOG_DEBUG, "Tokenization completed successfully");
-    log_msg(LOG_DEBUG, "Parsing tokens");
-
-    ASTNode *ast = parse_ex(trimmed_stmt, tokens);
-    if (!ast) {
-        log_msg(LOG_ERROR, "Parse failed for input: '%s'", trimmed_stmt);
-        ParseContext *ctx = parse_get_context();
-        if (ctx->error_occurred) {
-            parse_error_report(ctx);
-        }
-        free_tokens(tokens);
-        return;
-    }
-
-    log_msg(LOG_DEBUG, "Parsing completed successfully");
-    log_msg(LOG_DEBUG, "Executing AST");
-
-    exec_ast(ast);
-
-    log_msg(LOG_DEBUG, "AST execution completed");
-    free_ast(ast);
-    free_tokens(tokens);
+    if (g_format != OUTPUT_TABLE)
+        stream_statement(trimmed_stmt);
+    else
+        db_exec(trimmed_stmt);
 }
 
 int main(int argc, char *argv[]) {
     bool show_logs = false;
+    const char *command = NULL;
+    const char *listen_address = NULL;
+    int workers = SERVER_DEFAULT_WORKERS;
 
     init_tables();
     for (int i = 1; i < argc; i++) {
@@ -156,10 +255,47 @@ int main(int argc, char *argv[]) {
                 printf("<Usage> db -c <sql statment>\n");
                 return 1;
             }
+            command = argv[++i];
+
+        } else if (strncmp(argv[i], "--format", 8) == 0) {
+            const char *name = argv[i][8] == '=' ? argv[i] + 9 : NULL;
+            if (!name && argv[i][8] == '\0' && i + 1 < argc)
+                name = argv[++i];
+            if (!name || !output_format_parse(name, &g_format)) {
+                printf("<Usage> db --format <table|csv|tsv|jsonl|binary>\n");
+                return 1;
+            }
 
-            process_statement(argv[i + 1]);
-            alist_destroy(&tables);
-            return 0;
+        } else if (strcmp(argv[i], "--data-dir") == 0) {
+            if (i + 1 >= argc) {
+                printf("<Usage> db --data-dir <directory>\n");
+                return 1;
+            }
+            if (!storage_open(argv[++i])) {
+                printf("Cannot open data directory '%s'\n", argv[i]);
+                return 1;
+            }
+
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1) {
+                printf("<Usage> db --threads <count>\n");
+                return 1;
+            }
+            thread_pool_set_workers(atoi(argv[++i]));
+
+        } else if (strcmp(argv[i], "--listen") == 0) {
+            if (i + 1 >= argc) {
+                printf("<Usage> db --listen <[host:]port>\n");
+                return 1;
+            }
+            listen_address = argv[++i];
+
+        } else if (strcmp(argv[i], "--workers") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1) {
+                printf("<Usage> db --workers <count>\n");
+                return 1;
+            }
+            workers = atoi(argv[++i]);
 
         } else if (strcmp(argv[i], "--show-logs") == 0) {
             show_logs = true;
@@ -173,9 +309,28 @@ int main(int argc, char *argv[]) {
     } else {
         set_log_level(LOG_NONE);
     }
+    if (g_format != OUTPUT_TABLE) {
+        db_set_print_results(false);
+        setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+    }
+
+    /* -c runs its statement once all the options are read, whatever their order. */
+    if (command) {
+        process_statement(command);
+        fflush(stdout);
+        thread_pool_shutdown();
+        storage_close(true);
+        alist_destroy(&tables);
+        return 0;
+    }
 
-    printf("Simple Database System\n");
-    printf("Type '.help;' for usage, '.exit;' to quit\n\n");
+    if (listen_address)
+        return serve(listen_address, workers);
+
+    if (g_format == OUTPUT_TABLE) {
+        printf("Simple Database System\n");
+        printf("Type '.help;' for usage, '.exit;' to quit\n\n");
+    }
     log_msg(LOG_INFO, "Database system started");
 
     char input[8192];
@@ -206,7 +361,11 @@ int main(int argc, char *argv[]) {
         }
     }
     log_msg(LOG_INFO, "Database system shutting down");
+    txn_shutdown();
+    thread_pool_shutdown();
+    storage_close(true);
     alist_destroy(&tables);
-    printf("\nGoodbye!\n");
+    if (g_format == OUTPUT_TABLE)
+        printf("\nGoodbye!\n");
     return 0;
 }
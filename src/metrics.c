@@ -0,0 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+_Thread_local MetricsBlock *t_metrics;
+
+/* Blocks are never freed: a thread's counts outlive it, and readers walk the list unlocked
+   after loading its head. */
+static MetricsBlock *_Atomic g_blocks;
+static pthread_mutex_t g_blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *COUNTER_NAMES[METRIC_COUNTER_COUNT] = {
+    "statements",      "rows_scanned",    "index_probes", "index_rows", "join_build_rows",
+    "join_probe_rows", "arena_blocks",    "arena_bytes",  "spill_bytes"};
+
+static const char *HISTOGRAM_NAMES[METRIC_HISTOGRAM_COUNT] = {"statement_us", "join_build_size",
+                                                              "query_memory"};
+
+/* Registers the calling thread's block on its first record; NULL when out of memory, in
+   which case the thread's metrics are dropped. */
+MetricsBlock *metrics_thread_block(void) {
+    if (t_metrics)
+        return t_metrics;
+    MetricsBlock *block = calloc(1, sizeof(MetricsBlock));
+    if (!block)
+        return NULL;
+    pthread_mutex_lock(&g_blocks_lock);
+    block->next = atomic_load(&g_blocks);
+    atomic_store(&g_blocks, block);
+    pthread_mutex_unlock(&g_blocks_lock);
+    t_metrics = block;
+    return block;
+}
+
+static int bucket_of(uint64_t value) {
+    int bucket = 0;
+    while (value > 0 && bucket < METRIC_BUCKETS - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void metrics_record(MetricHistogram histogram, uint64_t value) {
+    MetricsBlock *block = t_metrics ? t_metrics : metrics_thread_block();
+    if (!block)
+        return;
+    metric_bump(&block->buckets[histogram][bucket_of(value)], 1);
+    metric_bump(&block->sums[histogram], value);
+    if (value > atomic_load_explicit(&block->maxima[histogram], memory_order_relaxed))
+        atomic_store_explicit(&block->maxima[histogram], value, memory_order_relaxed);
+}
+
+void metrics_snapshot(MetricsSnapshot *snapshot) {
+    *snapshot = (MetricsSnapshot){0};
+    for (MetricsBlock *block = atomic_load(&g_blocks); block; block = block->next) {
+        snapshot->threads++;
+        for (int c = 0; c < METRIC_COUNTER_COUNT; c++)
+            snapshot->counters[c] +=
+                atomic_load_explicit(&block->counters[c], memory_order_relaxed);
+        for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+            HistogramSnapshot *out = &snapshot->histograms[h];
+            for (int b = 0; b < METRIC_BUCKETS; b++) {
+                uint64_t n = atomic_load_explicit(&block->buckets[h][b], memory_order_relaxed);
+                out->buckets[b] += n;
+                out->count += n;
+            }
+            out->sum += atomic_load_explicit(&block->sums[h], memory_order_relaxed);
+            uint64_t max = atomic_load_explicit(&block->maxima[h], memory_order_relaxed);
+            if (max > out->max)
+                out->max = max;
+        }
+    }
+}
+
+/* The upper bound of the bucket holding the q-th value, capped at the largest value seen. */
+uint64_t metrics_percentile(const HistogramSnapshot *histogram, double q) {
+    if (histogram->count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(q * (double)histogram->count);
+    if (rank >= histogram->count)
+        rank = histogram->count - 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < METRIC_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen > rank) {
+            uint64_t bound = (1ull << b) - 1;
+            return bound < histogram->max ? bound : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/* Zeroes every thread's block. Meant for quiet moments: a count racing with the reset may
+   survive it. */
+void metrics_reset(void) {
+    for (MetricsBlock *block = atomic_load(&g_blocks); block; block = block->next) {
+        for (int c = 0; c < METRIC_COUNTER_COUNT; c++)
+            atomic_store_explicit(&block->counters[c], 0, memory_order_relaxed);
+        for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+            for (int b = 0; b < METRIC_BUCKETS; b++)
+                atomic_store_explicit(&block->buckets[h][b], 0, memory_order_relaxed);
+            atomic_store_explicit(&block->sums[h], 0, memory_order_relaxed);
+            atomic_store_explicit(&block->maxima[h], 0, memory_order_relaxed);
+        }
+    }
+}
+
+const char *metrics_counter_name(MetricCounter counter) {
+    return counter < METRIC_COUNTER_COUNT ? COUNTER_NAMES[counter] : "?";
+}
+
+const char *metrics_histogram_name(MetricHistogram histogram) {
+    return histogram < METRIC_HISTOGRAM_COUNT ? HISTOGRAM_NAMES[histogram] : "?";
+}
+
+/* One name/value line per counter and per histogram (count, mean, p50/p95/p99, max), or the
+   same as a single JSON object line for scripts. */
+void metrics_dump(FILE *file, bool json) {
+    MetricsSnapshot snapshot;
+    metrics_snapshot(&snapshot);
+    if (json)
+        fprintf(file, "{\"threads\":%d", snapshot.threads);
+    else
+        fprintf(file, "%-20s %d\n", "threads", snapshot.threads);
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        unsigned long long value = (unsigned long long)snapshot.counters[c];
+        if (json)
+            fprintf(file, ",\"%s\":%llu", COUNTER_NAMES[c], value);
+        else
+            fprintf(file, "%-20s %llu\n", COUNTER_NAMES[c], value);
+    }
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        const HistogramSnapshot *hist = &snapshot.histograms[h];
+        double mean = hist->count > 0 ? (double)hist->sum / (double)hist->count : 0;
+        unsigned long long p50 = (unsigned long long)metrics_percentile(hist, 0.50);
+        unsigned long long p95 = (unsigned long long)metrics_percentile(hist, 0.95);
+        unsigned long long p99 = (unsigned long long)metrics_percentile(hist, 0.99);
+        if (json)
+            fprintf(file,
+                    ",\"%s\":{\"count\":%llu,\"mean\":%.1f,\"p50\":%llu,\"p95\":%llu,"
+                    "\"p99\":%llu,\"max\":%llu}",
+                    HISTOGRAM_NAMES[h], (unsigned long long)hist->count, mean, p50, p95, p99,
+                    (unsigned long long)hist->max);
+        else
+            fprintf(file, "%-20s count=%llu mean=%.1f p50<=%llu p95<=%llu p99<=%llu max=%llu\n",
+                    HISTOGRAM_NAMES[h], (unsigned long long)hist->count, mean, p50, p95, p99,
+                    (unsigned long long)hist->max);
+    }
+    if (json)
+        fprintf(file, "}\n");
+}
+
+uint64_t metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
@@ -1,258 +1,1516 @@
 #include "db.h"
 #include "table.h"
 
+#include <limits.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "logger.h"
 #include "utils.h"
+#include "values.h"
 
-static TableStats g_stats[MAX_TABLES];
-static int g_stats_count = 0;
+#define MAX_INDEX_CONJUNCTS 16
 
-static double estimate_seq_scan_cost(uint8_t table_id) {
-    TableStats *stats = get_table_stats(table_id);
-    if (!stats) {
-        return 1000.0;
+/* Cost units are roughly "evaluate the WHERE clause on one row during a sequential scan".
+   An index path pays a fixed probe, a per-entry cost for walking the index, a sort of the
+   candidate row ids and a random fetch for every candidate. */
+#define SEQ_ROW_COST 1.0
+#define INDEX_PROBE_COST 4.0
+#define INDEX_ENTRY_COST 0.2
+#define SORT_ROW_COST 0.05
+#define ROW_FETCH_COST 1.5
+#define INTERSECT_ROW_COST 0.1
+#define HASH_BUILD_ROW_COST 1.5
+#define HASH_PROBE_ROW_COST 1.0
+#define PIPELINE_ROW_COST 0.1
+#define DEFAULT_JOIN_SELECTIVITY 0.1
+
+#define DEFAULT_EQ_SELECTIVITY 0.1
+#define DEFAULT_RANGE_SELECTIVITY 0.3
+
+typedef struct {
+    uint16_t column_id;
+    OperatorType op;
+    const Value *value;
+} IndexPredicate;
+
+static OperatorType flip_comparison(OperatorType op) {
+    switch (op) {
+    case OP_LESS:
+        return OP_GREATER;
+    case OP_LESS_EQUAL:
+        return OP_GREATER_EQUAL;
+    case OP_GREATER:
+        return OP_LESS;
+    case OP_GREATER_EQUAL:
+        return OP_LESS_EQUAL;
+    default:
+        return op;
     }
+}
 
-    double base_cost = stats->total_rows * 1.0;
-    double io_cost = stats->total_rows * 0.1;
+static bool is_index_predicate(const Expr *expr, IndexPredicate *pred) {
+    if (!expr || expr->type != EXPR_BINARY_OP)
+        return false;
 
-    return base_cost + io_cost;
+    OperatorType op = expr->binary.op;
+    if (op != OP_EQUALS && op != OP_LESS && op != OP_LESS_EQUAL && op != OP_GREATER &&
+        op != OP_GREATER_EQUAL)
+        return false;
+
+    Expr *left = expr->binary.left;
+    Expr *right = expr->binary.right;
+    if (left->type == EXPR_COLUMN && right->type == EXPR_VALUE) {
+        pred->column_id = left->column.column_id;
+        pred->op = op;
+        pred->value = &right->value;
+    } else if (left->type == EXPR_VALUE && right->type == EXPR_COLUMN) {
+        pred->column_id = right->column.column_id;
+        pred->op = flip_comparison(op);
+        pred->value = &left->value;
+    } else {
+        return false;
+    }
+    return !is_null(pred->value);
 }
 
-static double estimate_index_scan_cost(uint8_t table_id, Index *index, OperatorType op,
-                                       const Value *value) {
-    TableStats *stats = get_table_stats(table_id);
-    if (!stats) {
-        return 500.0;
+/* column LIKE 'abc%' is the range prefix <= column < prefix_end (the LIKE still filters
+   the candidates). */
+static int like_prefix_predicates(const Expr *expr, IndexPredicate *preds, int room) {
+    if (expr->type != EXPR_BINARY_OP || expr->binary.op != OP_LIKE || !expr->binary.like ||
+        expr->binary.like->kind != LIKE_PREFIX || expr->binary.left->type != EXPR_COLUMN ||
+        room < 2)
+        return 0;
+    const LikeMatcher *like = expr->binary.like;
+    preds[0].column_id = expr->binary.left->column.column_id;
+    preds[0].op = OP_GREATER_EQUAL;
+    preds[0].value = &like->prefix;
+    if (!like->prefix_end)
+        return 1;
+    preds[1].column_id = preds[0].column_id;
+    preds[1].op = OP_LESS;
+    preds[1].value = like->prefix_end;
+    return 2;
+}
+
+static void collect_conjuncts(const Expr *expr, IndexPredicate *preds, int *count) {
+    if (!expr || *count >= MAX_INDEX_CONJUNCTS)
+        return;
+    if (expr->type == EXPR_BINARY_OP && expr->binary.op == OP_AND) {
+        collect_conjuncts(expr->binary.left, preds, count);
+        collect_conjuncts(expr->binary.right, preds, count);
+        return;
     }
+    if (is_index_predicate(expr, &preds[*count]))
+        (*count)++;
+    else
+        *count += like_prefix_predicates(expr, &preds[*count], MAX_INDEX_CONJUNCTS - *count);
+}
 
-    double selectivity = 0.1;
-    if (alist_length(&index->columns) > 0) {
-        uint16_t *col_id_ptr = (uint16_t *)alist_get(&index->columns, 0);
-        if (col_id_ptr) {
-            selectivity = estimate_selectivity(stats, *col_id_ptr, op, value);
+/* Only probe an index with constants that order the same way as the stored keys. */
+static bool key_type_matches(const Table *table, uint16_t column_id, const Value *value) {
+    ColumnDef *col = (ColumnDef *)alist_get(&table->schema.columns, column_id);
+    if (!col)
+        return false;
+    if (col->type == value->type)
+        return true;
+    return (col->type == TYPE_INT || col->type == TYPE_FLOAT) &&
+           (value->type == TYPE_INT || value->type == TYPE_FLOAT);
+}
+
+typedef struct {
+    const Value *lo;
+    bool lo_inclusive;
+    const Value *hi;
+    bool hi_inclusive;
+} KeyRange;
+
+static void tighten_range(KeyRange *range, const IndexPredicate *pred) {
+    bool set_lo = pred->op == OP_EQUALS || pred->op == OP_GREATER || pred->op == OP_GREATER_EQUAL;
+    bool set_hi = pred->op == OP_EQUALS || pred->op == OP_LESS || pred->op == OP_LESS_EQUAL;
+    bool inclusive = pred->op == OP_EQUALS || pred->op == OP_GREATER_EQUAL ||
+                     pred->op == OP_LESS_EQUAL;
+
+    if (set_lo) {
+        int cmp = range->lo ? compare_values(pred->value, range->lo) : 1;
+        if (cmp > 0 || (cmp == 0 && !inclusive)) {
+            range->lo = pred->value;
+            range->lo_inclusive = inclusive;
         }
     }
+    if (set_hi) {
+        int cmp = range->hi ? compare_values(pred->value, range->hi) : -1;
+        if (cmp < 0 || (cmp == 0 && !inclusive)) {
+            range->hi = pred->value;
+            range->hi_inclusive = inclusive;
+        }
+    }
+}
+
+static const ColumnStats *column_stats_for(const TableStats *stats, int col_idx) {
+    if (!stats || !stats->has_stats || !stats->column_stats || col_idx < 0 ||
+        col_idx >= stats->column_count)
+        return NULL;
+    return &stats->column_stats[col_idx];
+}
+
+static bool value_as_double(const Value *value, double *out) {
+    switch (value->type) {
+    case TYPE_INT:
+        *out = (double)value->int_val;
+        return true;
+    case TYPE_FLOAT:
+        *out = value->float_val;
+        return true;
+    case TYPE_DATE:
+        *out = (double)value->date_val;
+        return true;
+    case TYPE_TIME:
+        *out = (double)value->time_val;
+        return true;
+    case TYPE_DECIMAL:
+        *out = (double)value->decimal_val.value / pow(10.0, value->decimal_val.scale);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Position of value inside [lo, hi] in 0..1; the bucket midpoint for non-numeric keys. */
+static double interpolate(const Value *lo, const Value *hi, const Value *value) {
+    double a, b, v;
+    if (!value_as_double(lo, &a) || !value_as_double(hi, &b) || !value_as_double(value, &v))
+        return 0.5;
+    if (b <= a)
+        return 1.0;
+    double t = (v - a) / (b - a);
+    return t < 0 ? 0 : (t > 1 ? 1 : t);
+}
 
-    double result_rows = stats->total_rows * selectivity;
-    double index_cost = result_rows * 0.5;
-    double table_access_cost = result_rows * 1.0;
+/* Share of the non-NULL rows whose key is below value. */
+static double histogram_fraction_below(const ColumnStats *cs, const Value *value) {
+    int n = cs->histogram_count;
+    if (n == 0)
+        return 0.5;
+    if (compare_values(value, &cs->histogram[0]) <= 0)
+        return 0.0;
+    if (compare_values(value, &cs->histogram[n - 1]) > 0 || n == 1)
+        return 1.0;
 
-    return index_cost + table_access_cost;
+    int lo = 0, hi = n - 1; /* histogram[lo] < value <= histogram[hi] */
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (compare_values(value, &cs->histogram[mid]) > 0)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    double within = interpolate(&cs->histogram[lo], &cs->histogram[hi], value);
+    return (lo + within) / (n - 1);
 }
 
-PlanNode *create_seq_scan_plan(uint8_t table_id, Expr *where_clause) {
+/* Share of the non-NULL rows equal to value: 1/NDV, raised for values that span several
+   histogram bounds so heavy hitters are not underestimated. */
+static double equality_fraction(const ColumnStats *cs, const Value *value) {
+    if (!cs->has_stats || compare_values(value, &cs->min_val) < 0 ||
+        compare_values(value, &cs->max_val) > 0)
+        return 0.0;
+
+    double fraction = cs->distinct_count > 0 ? 1.0 / cs->distinct_count : DEFAULT_EQ_SELECTIVITY;
+    int repeats = 0;
+    for (int i = 0; i < cs->histogram_count; i++) {
+        if (compare_values(value, &cs->histogram[i]) == 0)
+            repeats++;
+    }
+    if (repeats > 1 && cs->histogram_count > 1) {
+        double skew = (double)(repeats - 1) / (cs->histogram_count - 1);
+        if (skew > fraction)
+            fraction = skew;
+    }
+    return fraction;
+}
+
+static double non_null_fraction(const ColumnStats *cs) {
+    return cs->row_count > 0 ? (double)(cs->row_count - cs->null_count) / cs->row_count : 1.0;
+}
+
+double estimate_range_selectivity(const TableStats *stats, int col_idx, const Value *lo,
+                                  bool lo_inclusive, const Value *hi, bool hi_inclusive) {
+    const ColumnStats *cs = column_stats_for(stats, col_idx);
+    if (!cs)
+        return lo && hi ? DEFAULT_RANGE_SELECTIVITY * DEFAULT_RANGE_SELECTIVITY
+                        : DEFAULT_RANGE_SELECTIVITY;
+    if (!cs->has_stats || (lo && is_null(lo)) || (hi && is_null(hi)))
+        return 0.0;
+
+    double upper = 1.0;
+    if (hi)
+        upper = histogram_fraction_below(cs, hi) + (hi_inclusive ? equality_fraction(cs, hi) : 0);
+    double lower = 0.0;
+    if (lo)
+        lower = histogram_fraction_below(cs, lo) + (lo_inclusive ? 0 : equality_fraction(cs, lo));
+
+    double fraction = upper - lower;
+    fraction = fraction < 0 ? 0 : (fraction > 1 ? 1 : fraction);
+    return fraction * non_null_fraction(cs);
+}
+
+double estimate_selectivity(const TableStats *stats, int col_idx, OperatorType op,
+                            const Value *value) {
+    const ColumnStats *cs = column_stats_for(stats, col_idx);
+    if (!cs || !value) {
+        switch (op) {
+        case OP_EQUALS:
+            return DEFAULT_EQ_SELECTIVITY;
+        case OP_NOT_EQUALS:
+            return 1.0 - DEFAULT_EQ_SELECTIVITY;
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+            return DEFAULT_RANGE_SELECTIVITY;
+        default:
+            return DEFAULT_EQ_SELECTIVITY;
+        }
+    }
+    if (is_null(value))
+        return 0.0;
+
+    switch (op) {
+    case OP_EQUALS:
+        return equality_fraction(cs, value) * non_null_fraction(cs);
+    case OP_NOT_EQUALS:
+        return (1.0 - equality_fraction(cs, value)) * non_null_fraction(cs);
+    case OP_LESS:
+        return estimate_range_selectivity(stats, col_idx, NULL, false, value, false);
+    case OP_LESS_EQUAL:
+        return estimate_range_selectivity(stats, col_idx, NULL, false, value, true);
+    case OP_GREATER:
+        return estimate_range_selectivity(stats, col_idx, value, false, NULL, false);
+    case OP_GREATER_EQUAL:
+        return estimate_range_selectivity(stats, col_idx, value, true, NULL, false);
+    default:
+        return DEFAULT_EQ_SELECTIVITY;
+    }
+}
+
+static double table_rows(uint16_t table_id) {
+    Table *table = get_table_by_id(table_id);
+    return table ? (double)table_live_row_count(table) : 0.0;
+}
+
+static double estimate_seq_scan_cost(uint16_t table_id) {
+    return table_rows(table_id) * SEQ_ROW_COST;
+}
+
+/* Cost of producing the sorted candidate row ids, before they are fetched. */
+static double estimate_index_scan_cost(double candidate_rows) {
+    return INDEX_PROBE_COST + candidate_rows * INDEX_ENTRY_COST +
+           candidate_rows * log2(candidate_rows + 1) * SORT_ROW_COST;
+}
+
+static PlanNode *alloc_plan(PlanType type) {
     PlanNode *plan = malloc(sizeof(PlanNode));
-    if (!plan)
+    if (!plan) {
+        log_msg(LOG_ERROR, "optimize_select: Failed to allocate plan node");
         return NULL;
+    }
+    memclear(plan, sizeof(PlanNode));
+    plan->type = type;
+    return plan;
+}
 
-    plan->type = PLAN_SEQ_SCAN;
-    plan->left = NULL;
-    plan->right = NULL;
+PlanNode *create_seq_scan_plan(uint16_t table_id, const Expr *where_clause) {
+    PlanNode *plan = alloc_plan(PLAN_SEQ_SCAN);
+    if (!plan)
+        return NULL;
 
     plan->plan.seq_scan.where_clause = where_clause;
     plan->plan.seq_scan.table_id = table_id;
-
     plan->cost = estimate_seq_scan_cost(table_id);
-
-    TableStats *stats = get_table_stats(table_id);
-    plan->estimated_rows = stats ? stats->total_rows : 1000;
-
+    plan->estimated_rows = (uint32_t)table_rows(table_id);
     return plan;
 }
 
-static PlanNode *create_index_scan_plan(uint8_t table_id, Index *index, Expr *where_clause,
-                                        OperatorType op, const Value *value) {
-    PlanNode *plan = malloc(sizeof(PlanNode));
+/* TABLESAMPLE picks rows by their ids, so the FROM table is read sequentially whatever its
+   indexes. */
+static PlanNode *create_sample_scan_plan(const SelectNode *select, const Expr *where_clause) {
+    PlanNode *plan = create_seq_scan_plan(select->table_id, where_clause);
     if (!plan)
         return NULL;
+    SeqScanPlan *scan = &plan->plan.seq_scan;
+    scan->sampled = true;
+    scan->sample_percent = select->sample_percent;
+    scan->sample_seed = select->sample_seed;
+    plan->cost *= select->sample_percent / 100.0;
+    plan->estimated_rows = (uint32_t)(plan->estimated_rows * select->sample_percent / 100.0);
+    return plan;
+}
+
+static Value *copy_keys(const Value *const *values, int count) {
+    if (count == 0)
+        return NULL;
+    Value *keys = malloc(sizeof(Value) * (size_t)count);
+    if (keys)
+        for (int i = 0; i < count; i++)
+            keys[i] = copy_value(values[i]);
+    return keys;
+}
 
-    plan->type = PLAN_INDEX_SCAN;
-    plan->left = NULL;
-    plan->right = NULL;
+static void free_keys(Value *keys, int count) {
+    if (!keys)
+        return;
+    for (int i = 0; i < count; i++)
+        free_value(&keys[i]);
+    free(keys);
+}
+
+/* eq holds the values of the leading key columns matched by equality and range bounds the
+   next key column; a point range counts as one more equality. */
+static PlanNode *create_index_scan_plan(uint16_t table_id, Index *index, const Expr *where_clause,
+                                        const Value *const *eq, int eq_count,
+                                        const KeyRange *range, double selectivity) {
+    PlanNode *plan = alloc_plan(PLAN_INDEX_SCAN);
+    if (!plan)
+        return NULL;
 
-    plan->plan.index_scan.index = index;
-    plan->plan.index_scan.where_clause = where_clause;
-    plan->plan.index_scan.table_id = table_id;
-    plan->plan.index_scan.op = op;
+    IndexScanPlan *scan = &plan->plan.index_scan;
+    scan->index = index;
+    scan->where_clause = where_clause;
+    scan->table_id = table_id;
+    scan->selectivity = selectivity;
 
-    if (value) {
-        plan->plan.index_scan.search_key = malloc(sizeof(Value));
-        *plan->plan.index_scan.search_key = copy_value(value);
+    const Value *keys[MAX_INDEX_COLUMNS];
+    for (int i = 0; i < eq_count; i++)
+        keys[i] = eq[i];
+    bool point = range->lo && range->hi && range->lo_inclusive && range->hi_inclusive &&
+                 compare_values(range->lo, range->hi) == 0;
+    if (point)
+        keys[eq_count++] = range->lo;
+    scan->eq_count = eq_count;
+    if (point || (!range->lo && !range->hi)) {
+        scan->op = OP_EQUALS;
+        scan->search_key = copy_keys(keys, eq_count);
     } else {
-        plan->plan.index_scan.search_key = NULL;
+        scan->op = range->lo ? (range->lo_inclusive ? OP_GREATER_EQUAL : OP_GREATER)
+                             : (range->hi_inclusive ? OP_LESS_EQUAL : OP_LESS);
+        keys[eq_count] = range->lo;
+        scan->lo_width = eq_count + (range->lo ? 1 : 0);
+        scan->lo_key = copy_keys(keys, scan->lo_width);
+        scan->lo_inclusive = !range->lo || range->lo_inclusive;
+        keys[eq_count] = range->hi;
+        scan->hi_width = eq_count + (range->hi ? 1 : 0);
+        scan->hi_key = copy_keys(keys, scan->hi_width);
+        scan->hi_inclusive = !range->hi || range->hi_inclusive;
     }
 
-    plan->cost = estimate_index_scan_cost(table_id, index, op, value);
+    double candidates = table_rows(table_id) * selectivity;
+    plan->estimated_rows = (uint32_t)ceil(candidates);
+    plan->cost = estimate_index_scan_cost(candidates);
+    return plan;
+}
+
+/* Equality and merged range bounds on one column from the conjuncts. */
+static const Value *column_bounds(const Table *table, const IndexPredicate *preds,
+                                  int pred_count, uint16_t column_id, KeyRange *range) {
+    const Value *equals = NULL;
+    *range = (KeyRange){0};
+    for (int j = 0; j < pred_count; j++) {
+        if (preds[j].column_id != column_id ||
+            !key_type_matches(table, column_id, preds[j].value))
+            continue;
+        if (preds[j].op == OP_EQUALS && !equals)
+            equals = preds[j].value;
+        tighten_range(range, &preds[j]);
+    }
+    return equals;
+}
 
-    TableStats *stats = get_table_stats(table_id);
-    double base_rows = stats ? stats->total_rows : 1000;
-    double selectivity = 0.1;
+static double range_selectivity(const TableStats *stats, uint16_t column_id,
+                                const KeyRange *range) {
+    if (range->lo && range->hi && compare_values(range->lo, range->hi) > 0)
+        return 0.0;
+    return estimate_range_selectivity(stats, column_id, range->lo, range->lo_inclusive, range->hi,
+                                      range->hi_inclusive);
+}
 
-    if (alist_length(&index->columns) > 0 && stats) {
-        uint16_t *col_id_ptr = (uint16_t *)alist_get(&index->columns, 0);
-        if (col_id_ptr) {
-            selectivity = estimate_selectivity(stats, *col_id_ptr, op, value);
+/* Paths through indexes on several columns: equalities on the leading key columns, then a
+   range on the next one for a B-tree. A hash index needs every key column matched. The
+   columns a path uses get no single-column path of their own. */
+static int build_composite_paths(const Table *table, const Expr *where_clause,
+                                 const IndexPredicate *preds, int pred_count,
+                                 const TableStats *stats, PlanNode **paths, bool *used) {
+    int path_count = 0;
+    Index *index;
+    for (int i = 0; path_count < MAX_INDEX_CONJUNCTS &&
+                    (index = table_index(table->table_id, i)) != NULL;
+         i++) {
+        if (index->key_count < 2)
+            continue;
+        const Value *eq[MAX_INDEX_COLUMNS];
+        int eq_count = 0;
+        KeyRange range = {0};
+        double selectivity = 1.0;
+        for (int k = 0; k < index->key_count; k++) {
+            uint16_t column_id = *(uint16_t *)alist_get(&index->columns, k);
+            KeyRange bounds;
+            const Value *equals = column_bounds(table, preds, pred_count, column_id, &bounds);
+            if (equals) {
+                eq[eq_count++] = equals;
+                selectivity *= estimate_selectivity(stats, column_id, OP_EQUALS, equals);
+                continue;
+            }
+            if (index->type == INDEX_TYPE_BTREE && (bounds.lo || bounds.hi)) {
+                range = bounds;
+                selectivity *= range_selectivity(stats, column_id, &range);
+            }
+            break;
         }
+        int ranged = range.lo || range.hi ? 1 : 0;
+        if (index->type == INDEX_TYPE_HASH ? eq_count < index->key_count
+                                           : eq_count == 0 || eq_count + ranged < 2)
+            continue;
+
+        PlanNode *path = create_index_scan_plan(table->table_id, index, where_clause, eq, eq_count,
+                                                &range, selectivity);
+        if (!path)
+            continue;
+        paths[path_count++] = path;
+        for (int k = 0; k < eq_count + ranged; k++)
+            used[*(uint16_t *)alist_get(&index->columns, k)] = true;
     }
+    return path_count;
+}
 
-    plan->estimated_rows = base_rows * selectivity;
+/* Builds the composite index paths, then one index path per remaining column that has a
+   usable index: a hash or B-tree probe for an equality, or a B-tree range merged from every
+   bound on that column. */
+static int build_index_paths(const Table *table, const Expr *where_clause, PlanNode **paths) {
+    IndexPredicate preds[MAX_INDEX_CONJUNCTS];
+    int pred_count = 0;
+    collect_conjuncts(where_clause, preds, &pred_count);
+
+    /* A column that did not resolve keeps id UINT16_MAX; no index can serve it. */
+    int kept = 0;
+    for (int i = 0; i < pred_count; i++)
+        if (preds[i].column_id < MAX_COLUMNS &&
+            preds[i].column_id < alist_length(&table->schema.columns))
+            preds[kept++] = preds[i];
+    pred_count = kept;
+
+    TableStats *stats = get_table_stats(table->table_id);
+    bool used[MAX_COLUMNS] = {false};
+    int path_count =
+        build_composite_paths(table, where_clause, preds, pred_count, stats, paths, used);
+    for (int i = 0; i < pred_count && path_count < MAX_INDEX_CONJUNCTS; i++) {
+        uint16_t column_id = preds[i].column_id;
+        bool seen = used[column_id];
+        for (int j = 0; j < i; j++)
+            seen = seen || preds[j].column_id == column_id;
+        if (seen || !key_type_matches(table, column_id, preds[i].value))
+            continue;
+
+        KeyRange range;
+        const Value *equals = column_bounds(table, preds, pred_count, column_id, &range);
+
+        Index *index = NULL;
+        double selectivity;
+        if (equals) {
+            index = find_index_by_type(table->table_id, column_id, INDEX_TYPE_HASH);
+            if (!index)
+                index = find_index_by_type(table->table_id, column_id, INDEX_TYPE_BTREE);
+            range.lo = range.hi = equals;
+            range.lo_inclusive = range.hi_inclusive = true;
+            selectivity = estimate_selectivity(stats, column_id, OP_EQUALS, equals);
+        } else {
+            index = find_index_by_type(table->table_id, column_id, INDEX_TYPE_BTREE);
+            selectivity = range_selectivity(stats, column_id, &range);
+        }
+        if (!index)
+            continue;
+
+        PlanNode *path = create_index_scan_plan(table->table_id, index, where_clause, NULL, 0,
+                                                &range, selectivity);
+        if (path)
+            paths[path_count++] = path;
+    }
+    return path_count;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    const PlanNode *pa = *(PlanNode *const *)a;
+    const PlanNode *pb = *(PlanNode *const *)b;
+    double sa = pa->plan.index_scan.selectivity, sb = pb->plan.index_scan.selectivity;
+    return (sa > sb) - (sa < sb);
+}
+
+/* Seq scan, the cheapest single index path, or an intersection that adds index paths in
+   order of selectivity while each one still lowers the total cost. Predicates are assumed
+   independent when combining selectivities. */
+PlanNode *optimize_select(uint16_t table_id, const Expr *where_clause) {
+    collect_table_stats(table_id);
+
+    Table *table = get_table_by_id(table_id);
+    PlanNode *best_plan = create_seq_scan_plan(table_id, where_clause);
+    if (!table || !where_clause || !best_plan)
+        return best_plan;
+
+    PlanNode *paths[MAX_INDEX_CONJUNCTS];
+    int path_count = build_index_paths(table, where_clause, paths);
+    qsort(paths, (size_t)path_count, sizeof(PlanNode *), compare_paths);
+
+    double total_rows = table_rows(table_id);
+    PlanNode *access = NULL;
+    double access_cost = 0;      /* producing the candidate row ids */
+    double access_fraction = 1.0; /* share of rows left among the candidates */
+    for (int i = 0; i < path_count; i++) {
+        PlanNode *path = paths[i];
+        double fraction = access ? access_fraction * path->plan.index_scan.selectivity
+                                 : path->plan.index_scan.selectivity;
+        double cost = access ? access_cost + path->cost +
+                                   (access->estimated_rows + path->estimated_rows) *
+                                       INTERSECT_ROW_COST
+                             : path->cost;
+        double total = cost + total_rows * fraction * ROW_FETCH_COST;
+        double current = access ? access_cost + total_rows * access_fraction * ROW_FETCH_COST
+                                : best_plan->cost;
+        if (total >= current) {
+            free_plan(path);
+            continue;
+        }
+
+        if (access) {
+            PlanNode *both = alloc_plan(PLAN_INDEX_INTERSECT);
+            if (!both) {
+                free_plan(path);
+                continue;
+            }
+            both->left = access;
+            both->right = path;
+            path = both;
+        }
+        access = path;
+        access_cost = cost;
+        access_fraction = fraction;
+        access->estimated_rows = (uint32_t)ceil(total_rows * fraction);
+        access->cost = total;
+    }
 
+    if (access) {
+        free_plan(best_plan);
+        best_plan = access;
+    }
+
+    log_msg(LOG_DEBUG, "optimize_select: Best plan for '%s' type=%d cost=%.2f rows=%u",
+            table->name, best_plan->type, best_plan->cost, best_plan->estimated_rows);
+    return best_plan;
+}
+
+static bool select_has_aggregate(const SelectNode *select) {
+    int count = alist_length(&select->expressions);
+    for (int i = 0; i < count; i++) {
+        Expr **expr = (Expr **)alist_get(&select->expressions, i);
+        if (expr && *expr && (*expr)->type == EXPR_AGGREGATE_FUNC)
+            return true;
+    }
+    return false;
+}
+
+static bool select_has_distinct_aggregate(const SelectNode *select) {
+    int count = alist_length(&select->expressions);
+    for (int i = 0; i < count; i++) {
+        Expr **expr = (Expr **)alist_get(&select->expressions, i);
+        if (expr && *expr && (*expr)->type == EXPR_AGGREGATE_FUNC && (*expr)->aggregate.distinct)
+            return true;
+    }
+    return false;
+}
+
+/* Groups out of a GROUP BY: the product of the grouping columns' distinct counts from ANALYZE,
+   capped at the input rows; a tenth of the input per column without statistics. */
+static uint32_t estimate_groups(const Table *table, const SelectNode *select, uint32_t rows) {
+    const TableStats *stats = get_table_stats(table->table_id);
+    double groups = 1;
+    int count = alist_length(&select->group_by);
+    for (int i = 0; i < count; i++) {
+        const Expr *expr = *(Expr **)alist_get(&select->group_by, i);
+        const ColumnStats *cs =
+            expr->type == EXPR_COLUMN ? column_stats_for(stats, expr->column.column_id) : NULL;
+        groups *= cs && cs->has_stats ? cs->distinct_count : ceil(rows * DEFAULT_EQ_SELECTIVITY);
+    }
+    if (count == 0)
+        return 1;
+    return groups > rows ? rows : (uint32_t)groups;
+}
+
+static PlanNode *wrap_plan(PlanType type, PlanNode *input, double row_cost) {
+    if (!input)
+        return NULL;
+    PlanNode *plan = alloc_plan(type);
+    if (!plan) {
+        free_plan(input);
+        return NULL;
+    }
+    plan->left = input;
+    plan->estimated_rows = input->estimated_rows;
+    plan->cost = input->cost + input->estimated_rows * row_cost;
+    return plan;
+}
+
+static PlanNode *add_filter(PlanNode *input, const Expr *predicate) {
+    PlanNode *plan = wrap_plan(PLAN_FILTER, input, SEQ_ROW_COST);
+    if (plan)
+        plan->plan.filter.predicate = predicate;
+    return plan;
+}
+
+/* Rows left after a WHERE on the FROM table: its rows times the selectivity of every
+   column-constant conjunct, assumed independent, and never more than the access path gives.
+   A join builds its hash table on the side with fewer estimated rows. */
+static void estimate_filtered_rows(PlanNode *plan, const Table *table, const Expr *predicate) {
+    IndexPredicate preds[MAX_INDEX_CONJUNCTS];
+    int pred_count = 0;
+    collect_conjuncts(predicate, preds, &pred_count);
+    if (!plan || pred_count == 0)
+        return;
+    const TableStats *stats = get_table_stats(table->table_id);
+    double rows = table_rows(table->table_id);
+    for (int i = 0; i < pred_count; i++)
+        rows *= estimate_selectivity(stats, preds[i].column_id, preds[i].op, preds[i].value);
+    if (rows < plan->estimated_rows)
+        plan->estimated_rows = (uint32_t)ceil(rows);
+}
+
+/* A single-column ORDER BY on a B-tree indexed column is answered by walking the leaf
+   chain, so no sort is needed and LIMIT stops the walk early. */
+static PlanNode *create_index_order_plan(const Table *table, const SelectNode *select) {
+    if (alist_length(&select->order_by) != 1)
+        return NULL;
+    Expr **expr = (Expr **)alist_get(&select->order_by, 0);
+    if (!expr || !*expr || (*expr)->type != EXPR_COLUMN)
+        return NULL;
+    Index *index = find_index_by_type(table->table_id, (*expr)->column.column_id,
+                                      INDEX_TYPE_BTREE);
+    if (!index)
+        return NULL;
+
+    PlanNode *plan = alloc_plan(PLAN_INDEX_ORDER_SCAN);
+    if (!plan)
+        return NULL;
+    bool *desc = (bool *)alist_get(&select->order_by_desc, 0);
+    plan->plan.index_order_scan.table_id = table->table_id;
+    plan->plan.index_order_scan.index = index;
+    plan->plan.index_order_scan.desc = desc && *desc;
+    plan->estimated_rows = (uint32_t)table_rows(table->table_id);
+    plan->cost = plan->estimated_rows * ROW_FETCH_COST;
     return plan;
 }
 
-static bool is_simple_indexable_predicate(Expr *expr, uint8_t table_id, uint16_t *column_id,
-                                          OperatorType *op, Value **value) {
+/* N-way joins. WHERE and the ON conditions of inner joins are split into conjuncts, and
+   every conjunct is applied as low as the tables it reads allow: one over a single table is
+   copied onto that table's own column ids and pushed into its scan, where it can pick an
+   index; the others are applied by the first join that has all their tables. The join order
+   is chosen by dynamic programming over the subsets of tables. Plans are left-deep, every join
+   adding one table, and each step takes the cheapest of a hash join, an index nested loop
+   join and a nested loop join on the estimated rows of its inputs. A LEFT JOIN keeps the
+   query's order, as moving tables across it would change the result. */
+typedef struct {
+    const Expr *expr;
+    uint32_t tables; /* slots read */
+    bool applied;
+    bool picked; /* for and_predicates */
+    int8_t key_slots[2]; /* column = column of two slots with one declared type, else -1 */
+    uint16_t key_columns[2];
+} JoinConjunct;
+
+typedef struct {
+    double cost;
+    double rows;
+    int last; /* slot joined last; -1 while the subset is unreached */
+    PlanType type;
+    int key; /* conjunct keying a hash or index join, -1 */
+    bool build_left;
+    Index *index;
+} JoinChoice;
+
+typedef struct {
+    const SelectNode *select;
+    int count;
+    Table *tables[MAX_JOIN_TABLES];
+    int offsets[MAX_JOIN_TABLES + 1];
+    PlanNode *scans[MAX_JOIN_TABLES]; /* access path and pushed filter per slot */
+    JoinConjunct on[MAX_JOIN_TABLES]; /* ON of the LEFT JOIN that added a slot */
+    ArrayList conjuncts;              /* JoinConjunct */
+    bool has_left_join;
+} JoinQuery;
+
+static bool slot_is_nullable(const JoinQuery *q, int slot) {
+    return slot > 0 && q->select->joins[slot - 1].type == JOIN_LEFT;
+}
+
+static int slot_of_column(const JoinQuery *q, int column_id) {
+    int t = q->count - 1;
+    while (t > 0 && column_id < q->offsets[t])
+        t--;
+    return t;
+}
+
+/* Subqueries and anything else the copies below do not handle read "every table", so they
+   stay above the last join. */
+static uint32_t expr_tables(const JoinQuery *q, const Expr *expr) {
     if (!expr)
+        return 0;
+    switch (expr->type) {
+    case EXPR_COLUMN:
+        return 1u << slot_of_column(q, expr->column.column_id);
+    case EXPR_VALUE:
+    case EXPR_LIST:
+        return 0;
+    case EXPR_BINARY_OP:
+        return expr_tables(q, expr->binary.left) | expr_tables(q, expr->binary.right);
+    case EXPR_UNARY_OP:
+        return expr_tables(q, expr->unary.operand);
+    case EXPR_SCALAR_FUNC: {
+        uint32_t tables = 0;
+        for (int i = 0; i < expr->scalar.arg_count; i++)
+            tables |= expr_tables(q, expr->scalar.args[i]);
+        return tables;
+    }
+    default:
+        return (1u << q->count) - 1;
+    }
+}
+
+static void classify_conjunct(const JoinQuery *q, const Expr *expr, JoinConjunct *c) {
+    memclear(c, sizeof(JoinConjunct));
+    c->expr = expr;
+    c->tables = expr_tables(q, expr);
+    if (c->tables == 0)
+        c->tables = 1; /* constant: decided on the FROM table */
+    c->key_slots[0] = c->key_slots[1] = -1;
+    if (expr->type != EXPR_BINARY_OP || expr->binary.op != OP_EQUALS ||
+        expr->binary.left->type != EXPR_COLUMN || expr->binary.right->type != EXPR_COLUMN)
+        return;
+    const Expr *sides[2] = {expr->binary.left, expr->binary.right};
+    int slots[2];
+    const ColumnDef *defs[2];
+    for (int i = 0; i < 2; i++) {
+        int column_id = sides[i]->column.column_id;
+        slots[i] = slot_of_column(q, column_id);
+        c->key_columns[i] = (uint16_t)(column_id - q->offsets[slots[i]]);
+        defs[i] = alist_get(&q->tables[slots[i]]->schema.columns, c->key_columns[i]);
+    }
+    /* value_equals does not coerce, so only same-typed columns can be hashed or looked up. */
+    if (slots[0] != slots[1] && defs[0] && defs[1] && defs[0]->type == defs[1]->type) {
+        c->key_slots[0] = (int8_t)slots[0];
+        c->key_slots[1] = (int8_t)slots[1];
+    }
+}
+
+static bool add_conjuncts(JoinQuery *q, const Expr *expr) {
+    if (!expr)
+        return true;
+    if (expr->type == EXPR_BINARY_OP && expr->binary.op == OP_AND)
+        return add_conjuncts(q, expr->binary.left) && add_conjuncts(q, expr->binary.right);
+    JoinConjunct *c = alist_append(&q->conjuncts);
+    if (!c)
         return false;
+    classify_conjunct(q, expr, c);
+    return true;
+}
+
+static void free_predicate(Expr *expr) {
+    if (!expr)
+        return;
+    switch (expr->type) {
+    case EXPR_BINARY_OP:
+        free_predicate(expr->binary.left);
+        free_predicate(expr->binary.right);
+        break;
+    case EXPR_UNARY_OP:
+        free_predicate(expr->unary.operand);
+        break;
+    case EXPR_SCALAR_FUNC:
+        for (int i = 0; i < expr->scalar.arg_count; i++)
+            free_predicate(expr->scalar.args[i]);
+        break;
+    default:
+        break;
+    }
+    free(expr);
+}
 
-    if (expr->type == EXPR_BINARY_OP) {
-        if (expr->binary.left->type == EXPR_COLUMN &&
-            (expr->binary.right->type == EXPR_VALUE || expr->binary.right->type == EXPR_COLUMN)) {
-            if (expr->binary.left->column.table_id == table_id) {
-                *column_id = expr->binary.left->column.column_id;
-                *op = expr->binary.op;
-
-                if (expr->binary.right->type == EXPR_VALUE) {
-                    *value = &expr->binary.right->value;
-                    return true;
-                }
+/* A copy of expr reading column_id - offset. Only the nodes expr_tables looks into are
+   copied; anything below them is shared with the AST. */
+static Expr *copy_predicate(const Expr *expr, int offset) {
+    Expr *copy = malloc(sizeof(Expr));
+    if (!copy)
+        return NULL;
+    *copy = *expr;
+    bool ok = true;
+    switch (expr->type) {
+    case EXPR_COLUMN:
+        copy->column.column_id = (uint16_t)(expr->column.column_id - offset);
+        break;
+    case EXPR_BINARY_OP:
+        copy->binary.left = copy_predicate(expr->binary.left, offset);
+        copy->binary.right = copy->binary.left ? copy_predicate(expr->binary.right, offset) : NULL;
+        ok = copy->binary.left && copy->binary.right;
+        break;
+    case EXPR_UNARY_OP:
+        copy->unary.operand = copy_predicate(expr->unary.operand, offset);
+        ok = copy->unary.operand != NULL;
+        break;
+    case EXPR_SCALAR_FUNC:
+        for (int i = 0; i < expr->scalar.arg_count; i++) {
+            copy->scalar.args[i] = ok ? copy_predicate(expr->scalar.args[i], offset) : NULL;
+            ok = ok && copy->scalar.args[i];
+        }
+        break;
+    default:
+        break;
+    }
+    if (!ok) {
+        free_predicate(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+/* ANDs the picked conjuncts into one owned predicate over column_id - offset. */
+static bool and_predicates(const JoinQuery *q, int offset, Expr **out) {
+    *out = NULL;
+    for (int i = 0; i < alist_length(&q->conjuncts); i++) {
+        JoinConjunct *c = alist_get(&q->conjuncts, i);
+        if (!c->picked)
+            continue;
+        c->picked = false;
+        Expr *copy = copy_predicate(c->expr, offset);
+        Expr *and = *out && copy ? malloc(sizeof(Expr)) : NULL;
+        if (!copy || (*out && !and)) {
+            free_predicate(copy);
+            free_predicate(*out);
+            *out = NULL;
+            return false;
+        }
+        if (*out) {
+            memclear(and, sizeof(Expr));
+            and->type = EXPR_BINARY_OP;
+            and->binary.op = OP_AND;
+            and->binary.left = *out;
+            and->binary.right = copy;
+            copy = and;
+        }
+        *out = copy;
+    }
+    return true;
+}
+
+/* Each table's access path, with the conjuncts that only read it pushed down. Conjuncts over
+   the NULL side of a LEFT JOIN must see its NULL rows, so they wait above the join. */
+static bool plan_join_scans(JoinQuery *q) {
+    for (int t = 0; t < q->count; t++) {
+        bool any = false;
+        for (int i = 0; i < alist_length(&q->conjuncts); i++) {
+            JoinConjunct *c = alist_get(&q->conjuncts, i);
+            c->picked = c->tables == 1u << t && !slot_is_nullable(q, t);
+            c->applied |= c->picked;
+            any |= c->picked;
+        }
+        Expr *predicate = NULL;
+        if (any && !and_predicates(q, q->offsets[t], &predicate))
+            return false;
+        uint16_t table_id = q->tables[t]->table_id;
+        PlanNode *plan = t == 0 && q->select->sampled
+                             ? create_sample_scan_plan(q->select, predicate)
+                             : optimize_select(table_id, predicate);
+        if (predicate) {
+            plan = add_filter(plan, predicate);
+            if (plan) {
+                plan->owned = predicate;
+                estimate_filtered_rows(plan, q->tables[t], predicate);
+            } else {
+                free_predicate(predicate);
             }
         }
+        q->scans[t] = plan;
+        if (!plan)
+            return false;
+    }
+    return true;
+}
+
+/* Rows kept by a join conjunct: 1 / the larger distinct count of an equi-join's columns. */
+static double conjunct_selectivity(const JoinQuery *q, const JoinConjunct *c) {
+    if (c->key_slots[0] < 0)
+        return DEFAULT_JOIN_SELECTIVITY;
+    double distinct = 0;
+    for (int i = 0; i < 2; i++) {
+        const TableStats *stats = get_table_stats(q->tables[c->key_slots[i]]->table_id);
+        const ColumnStats *cs = column_stats_for(stats, c->key_columns[i]);
+        if (cs && cs->has_stats && cs->distinct_count > distinct)
+            distinct = cs->distinct_count;
     }
+    return distinct >= 1 ? 1.0 / distinct : DEFAULT_JOIN_SELECTIVITY;
+}
+
+/* Conjuncts the join of left and right applies first: unapplied, reading right and nothing
+   outside left and right. */
+static bool newly_covered(const JoinConjunct *c, uint32_t left, int right) {
+    uint32_t right_bit = 1u << right;
+    return !c->applied && (c->tables & right_bit) && (c->tables & ~(left | right_bit)) == 0;
+}
 
+/* Orients an equi-join conjunct: the column in left, then the one in right. */
+static bool conjunct_key(const JoinConjunct *c, uint32_t left, int right, int *key_slot,
+                         uint16_t *left_column, uint16_t *right_column) {
+    for (int i = 0; i < 2; i++) {
+        int a = c->key_slots[i], b = c->key_slots[1 - i];
+        if (a >= 0 && b == right && (left & (1u << a))) {
+            *key_slot = a;
+            *left_column = c->key_columns[i];
+            *right_column = c->key_columns[1 - i];
+            return true;
+        }
+    }
     return false;
 }
 
-PlanNode *optimize_select(uint8_t table_id, Expr *where_clause) {
-    collect_table_stats(table_id);
+/* Prices joining table right, alone, onto the best plan for the tables in left. */
+static void price_join_step(const JoinQuery *q, uint32_t left, const JoinChoice *from, int right,
+                            JoinChoice *out) {
+    const PlanNode *scan = q->scans[right];
+    double l = from->rows, r = scan->estimated_rows;
+    bool outer = slot_is_nullable(q, right);
+    bool single = (left & (left - 1)) == 0;
+
+    out->last = right;
+    out->type = PLAN_NESTED_LOOP_JOIN;
+    out->key = -1;
+    out->build_left = false;
+    out->index = NULL;
+    out->cost = from->cost + scan->cost + l * r * SEQ_ROW_COST;
+
+    double selectivity = 1;
+    const JoinConjunct *keys = outer ? &q->on[right] : (const JoinConjunct *)q->conjuncts.data;
+    int key_count = outer ? 1 : alist_length(&q->conjuncts);
+    if (outer)
+        selectivity = conjunct_selectivity(q, &q->on[right]);
+    for (int i = 0; i < alist_length(&q->conjuncts); i++) {
+        const JoinConjunct *c = alist_get(&q->conjuncts, i);
+        if (newly_covered(c, left, right))
+            selectivity *= conjunct_selectivity(q, c);
+    }
+    out->rows = l * r * selectivity;
+    if (outer && out->rows < l)
+        out->rows = l;
+
+    for (int i = 0; i < key_count; i++) {
+        const JoinConjunct *c = &keys[i];
+        int key_slot;
+        uint16_t left_column, right_column;
+        if ((!outer && !newly_covered(c, left, right)) ||
+            !conjunct_key(c, left, right, &key_slot, &left_column, &right_column))
+            continue;
 
-    PlanNode *best_plan = NULL;
-    double best_cost = 1e9;
-
-    PlanNode *seq_plan = create_seq_scan_plan(table_id, where_clause);
-    if (seq_plan && seq_plan->cost < best_cost) {
-        best_cost = seq_plan->cost;
-        best_plan = seq_plan;
-    }
-
-    if (where_clause) {
-        uint16_t col_id;
-        OperatorType op;
-        Value *value;
-
-        if (is_simple_indexable_predicate(where_clause, table_id, &col_id, &op,
-                                          &value)) {
-            Index *index = find_index_by_table_column(table_id, col_id);
-            if (index) {
-                PlanNode *idx_plan =
-                    create_index_scan_plan(table_id, index, where_clause, op, value);
-                if (idx_plan && idx_plan->cost < best_cost) {
-                    if (best_plan == seq_plan) {
-                        free(seq_plan);
-                        seq_plan = NULL;
-                    } else if (best_plan) {
-                        free(best_plan);
-                    }
-                    best_plan = idx_plan;
-                } else if (idx_plan) {
-                    free(idx_plan);
-                }
+        /* An inner join builds on the smaller side, but only a single table can be built. */
+        bool build_left = single && !outer && l < r;
+        double build = build_left ? l : r, probe = build_left ? r : l;
+        double cost = from->cost + scan->cost + build * HASH_BUILD_ROW_COST +
+                      probe * HASH_PROBE_ROW_COST;
+        if (cost < out->cost) {
+            out->cost = cost;
+            out->type = PLAN_HASH_JOIN;
+            out->key = i;
+            out->build_left = build_left;
+            out->index = NULL;
+        }
+
+        uint16_t table_id = q->tables[right]->table_id;
+        Index *index = find_index_by_table_column(table_id, right_column);
+        if (index) {
+            const ColumnStats *cs = column_stats_for(get_table_stats(table_id), right_column);
+            double matches = cs && cs->has_stats && cs->distinct_count > 0
+                                 ? table_rows(table_id) / cs->distinct_count
+                                 : table_rows(table_id) * DEFAULT_EQ_SELECTIVITY;
+            double fetch = ROW_FETCH_COST + (scan->type == PLAN_FILTER ? SEQ_ROW_COST : 0);
+            cost = from->cost + l * (INDEX_PROBE_COST + matches * fetch);
+            if (cost < out->cost) {
+                out->cost = cost;
+                out->type = PLAN_INDEX_NESTED_LOOP_JOIN;
+                out->key = i;
+                out->build_left = false;
+                out->index = index;
             }
         }
     }
+}
+
+static bool connected(const JoinQuery *q, uint32_t left, int right) {
+    for (int i = 0; i < alist_length(&q->conjuncts); i++) {
+        const JoinConjunct *c = alist_get(&q->conjuncts, i);
+        if (newly_covered(c, left, right) && (c->tables & left))
+            return true;
+    }
+    return slot_is_nullable(q, right);
+}
+
+/* best[set] for every subset of tables, smallest subsets first. Ties keep the earlier order,
+   so equal plans follow the query. Tables are only added without a join condition when no
+   remaining table has one. */
+static void enumerate_join_orders(const JoinQuery *q, JoinChoice *best) {
+    uint32_t all = (1u << q->count) - 1;
+    for (uint32_t set = 0; set <= all; set++)
+        best[set].last = -1;
+    for (int t = 0; t < q->count; t++) {
+        if (q->has_left_join && t > 0)
+            break;
+        best[1u << t].last = t;
+        best[1u << t].cost = q->scans[t]->cost;
+        best[1u << t].rows = q->scans[t]->estimated_rows;
+    }
+    for (uint32_t set = 1; set < all; set++) {
+        if (best[set].last < 0)
+            continue;
+        bool any_connected = false;
+        for (int t = 0; t < q->count && !any_connected; t++)
+            any_connected = !(set & (1u << t)) && connected(q, set, t);
+        for (int t = 0; t < q->count; t++) {
+            if ((set & (1u << t)) || (any_connected && !connected(q, set, t)))
+                continue;
+            /* Around a LEFT JOIN tables are added in query order. */
+            if (q->has_left_join && set != (1u << t) - 1)
+                continue;
+            JoinChoice step;
+            price_join_step(q, set, &best[set], t, &step);
+            JoinChoice *slot = &best[set | (1u << t)];
+            if (slot->last < 0 || step.cost < slot->cost)
+                *slot = step;
+        }
+    }
+}
 
-    if (best_plan) {
-        Table *table = get_table_by_id(table_id);
-        log_msg(LOG_INFO, "optimize_select: Best plan for '%s' cost=%.2f rows=%d",
-                table ? table->name : "unknown",
-                best_plan->cost, best_plan->estimated_rows);
-        if (seq_plan && seq_plan != best_plan) {
-            free(seq_plan);
+/* Adds table right onto plan as choice says, placing the conjuncts it covers. */
+static PlanNode *add_join_step(JoinQuery *q, PlanNode *plan, uint32_t left,
+                               const JoinChoice *choice) {
+    int right = choice->last;
+    PlanNode *node = alloc_plan(choice->type);
+    if (!node) {
+        free_plan(plan);
+        return NULL;
+    }
+    node->left = plan;
+    node->cost = choice->cost;
+    node->estimated_rows = choice->rows > UINT32_MAX ? UINT32_MAX : (uint32_t)ceil(choice->rows);
+    PlanNode *scan = q->scans[right];
+    q->scans[right] = NULL;
+    if (choice->type == PLAN_INDEX_NESTED_LOOP_JOIN) {
+        if (scan->type == PLAN_FILTER) {
+            node->owned = scan->owned;
+            scan->owned = NULL;
         }
-    } else if (seq_plan) {
-        free(seq_plan);
+        free_plan(scan);
+    } else {
+        node->right = scan;
     }
 
-    return best_plan;
+    bool outer = slot_is_nullable(q, right);
+    JoinPlan *join = &node->plan.join;
+    join->join_type = outer ? JOIN_LEFT : JOIN_INNER;
+    join->left_slot = -1;
+    for (int t = 0; (left & (left - 1)) == 0 && t < q->count; t++)
+        if (left == 1u << t)
+            join->left_slot = (int8_t)t;
+    join->right_slot = (uint8_t)right;
+    join->right_filter = node->owned;
+    join->build_left = choice->build_left;
+    join->index = choice->index;
+    const JoinConjunct *key = NULL;
+    if (choice->key >= 0) {
+        key = outer ? &q->on[right] : alist_get(&q->conjuncts, choice->key);
+        int key_slot = 0;
+        conjunct_key(key, left, right, &key_slot, &join->left_column, &join->right_column);
+        join->key_slot = (uint8_t)key_slot;
+    }
+    if (outer)
+        join->condition = q->on[right].expr;
+
+    bool any = false;
+    for (int i = 0; i < alist_length(&q->conjuncts); i++) {
+        JoinConjunct *c = alist_get(&q->conjuncts, i);
+        c->picked = newly_covered(c, left, right);
+        c->applied |= c->picked;
+        c->picked &= c != key;
+        any |= c->picked;
+    }
+    if (!any)
+        return node;
+    Expr *predicate;
+    if (!and_predicates(q, 0, &predicate)) {
+        free_plan(node);
+        return NULL;
+    }
+    if (choice->type == PLAN_NESTED_LOOP_JOIN && !outer) {
+        node->owned = predicate;
+        join->condition = predicate;
+        return node;
+    }
+    PlanNode *filter = add_filter(node, predicate);
+    if (filter)
+        filter->owned = predicate;
+    else
+        free_predicate(predicate);
+    return filter;
 }
 
-double estimate_selectivity(const TableStats *stats, int col_idx, OperatorType op,
-                            const Value *value __attribute__((unused))) {
-    if (!stats || !stats->has_stats || col_idx < 0 || col_idx >= MAX_COLUMNS) {
-        return 0.1;
+static PlanNode *plan_joins(JoinQuery *q) {
+    const SelectNode *select = q->select;
+    q->count = select->join_count + 1;
+    q->offsets[0] = 0;
+    for (int t = 0; t < q->count; t++) {
+        uint16_t table_id = t == 0 ? select->table_id : select->joins[t - 1].table_id;
+        q->tables[t] = get_table_by_id(table_id);
+        if (!q->tables[t]) {
+            log_msg(LOG_ERROR, "plan_select: Joined table with ID %d not found", table_id);
+            return NULL;
+        }
+        q->offsets[t + 1] = q->offsets[t] + alist_length(&q->tables[t]->schema.columns);
     }
 
-    double distinct = stats->distinct_values[col_idx];
-    double total_rows = stats->total_rows;
+    if (!add_conjuncts(q, select->where_clause))
+        return NULL;
+    for (int j = 0; j < select->join_count; j++) {
+        const JoinClause *clause = &select->joins[j];
+        if (clause->type == JOIN_LEFT) {
+            q->has_left_join = true;
+            classify_conjunct(q, clause->condition, &q->on[j + 1]);
+        } else if (!add_conjuncts(q, clause->condition)) {
+            return NULL;
+        }
+    }
+    if (!plan_join_scans(q))
+        return NULL;
 
-    if (total_rows == 0)
-        return 0.1;
+    JoinChoice best[1u << MAX_JOIN_TABLES];
+    enumerate_join_orders(q, best);
+    int order[MAX_JOIN_TABLES] = {0};
+    uint32_t set = (1u << q->count) - 1;
+    for (int i = q->count - 1; i >= 0; i--) {
+        order[i] = best[set].last;
+        set &= ~(1u << order[i]);
+    }
 
-    switch (op) {
-    case OP_EQUALS:
-        return distinct > 0 ? 1.0 / distinct : 0.1;
-    case OP_NOT_EQUALS:
-        return distinct > 1 ? (distinct - 1.0) / distinct : 0.1;
-    case OP_LESS:
-    case OP_LESS_EQUAL:
-    case OP_GREATER:
-    case OP_GREATER_EQUAL:
-        return 0.3; // Range queries typically select ~30%
-    case OP_LIKE:
-        return 0.1; // LIKE is less selective
-    default:
-        return 0.1;
+    PlanNode *plan = q->scans[order[0]];
+    q->scans[order[0]] = NULL;
+    set = 1u << order[0];
+    for (int i = 1; i < q->count && plan; i++) {
+        plan = add_join_step(q, plan, set, &best[set | (1u << order[i])]);
+        set |= 1u << order[i];
     }
+    return plan;
 }
 
-void free_plan(PlanNode *plan) {
-    if (!plan)
-        return;
+static bool select_star(const SelectNode *select) {
+    Expr **first = (Expr **)alist_get(&select->expressions, 0);
+    return first && *first && (*first)->type == EXPR_VALUE &&
+           (*first)->value.type == TYPE_STRING && value_str(&(*first)->value) &&
+           strcmp(value_str(&(*first)->value), "*") == 0;
+}
 
-    if (plan->left)
-        free_plan(plan->left);
-    if (plan->right)
-        free_plan(plan->right);
+static bool index_has_column(const Index *index, uint16_t column_id) {
+    for (int i = 0; i < alist_length(&index->columns); i++)
+        if (*(uint16_t *)alist_get(&index->columns, i) == column_id)
+            return true;
+    return false;
+}
 
-    if (plan->type == PLAN_INDEX_SCAN && plan->plan.index_scan.search_key) {
-        free_value(plan->plan.index_scan.search_key);
-        free(plan->plan.index_scan.search_key);
+/* Whether every conjunct of where is a bound the scan applies itself: an equality with the
+   value matched on one of its equality columns, or a comparison on its range column. */
+static bool scan_applies_exactly(const Table *table, const IndexScanPlan *scan,
+                                 const Expr *where) {
+    if (where->type == EXPR_BINARY_OP && where->binary.op == OP_AND)
+        return scan_applies_exactly(table, scan, where->binary.left) &&
+               scan_applies_exactly(table, scan, where->binary.right);
+    IndexPredicate pred;
+    if (!is_index_predicate(where, &pred) || !key_type_matches(table, pred.column_id, pred.value))
+        return false;
+    const Value *eq = scan->op == OP_EQUALS ? scan->search_key : scan->lo_key;
+    for (int k = 0; k < scan->index->key_count && k <= scan->eq_count; k++) {
+        if (*(uint16_t *)alist_get(&scan->index->columns, k) != pred.column_id)
+            continue;
+        if (k < scan->eq_count)
+            return pred.op == OP_EQUALS && compare_values(pred.value, &eq[k]) == 0;
+        return scan->op != OP_EQUALS && pred.op != OP_EQUALS;
     }
+    return false;
+}
 
-    free(plan);
+/* Turns a B-tree scan into an index-only scan when its entries hold every projected column
+   and its bounds are the whole WHERE, so no row is fetched and no Filter is needed. Only plain
+   column lists (or *) qualify; rows then go straight to Limit and Project. */
+static bool make_index_only(PlanNode *plan, const Table *table, const SelectNode *select,
+                            bool star) {
+    if (plan->type != PLAN_INDEX_SCAN || plan->plan.index_scan.index->type != INDEX_TYPE_BTREE)
+        return false;
+    IndexScanPlan *scan = &plan->plan.index_scan;
+    if (star) {
+        for (int c = 0; c < alist_length(&table->schema.columns); c++)
+            if (!index_has_column(scan->index, (uint16_t)c))
+                return false;
+    } else {
+        for (int i = 0; i < alist_length(&select->expressions); i++) {
+            const Expr *expr = *(Expr **)alist_get(&select->expressions, i);
+            if (expr->type != EXPR_COLUMN || !index_has_column(scan->index, expr->column.column_id))
+                return false;
+        }
+    }
+    if (select->where_clause && !scan_applies_exactly(table, scan, select->where_clause))
+        return false;
+
+    plan->type = PLAN_INDEX_ONLY_SCAN;
+    scan->outputs = star ? NULL : &select->expressions;
+    plan->cost = INDEX_PROBE_COST + plan->estimated_rows * INDEX_ENTRY_COST;
+    return true;
 }
 
-TableStats *get_table_stats(uint8_t table_id) {
-    for (int i = 0; i < g_stats_count; i++) {
-        if (g_stats[i].table_id == table_id) {
-            return &g_stats[i];
+/* Builds the operator tree for a SELECT: an access path for the FROM table (an ordered
+   index walk when it can answer ORDER BY, otherwise the cheapest plan from optimize_select),
+   then Filter, Join, Filter, Hash Aggregate, Aggregate or Sort, Limit and Project as the
+   query needs them; a join plans its tables with plan_joins. */
+PlanNode *plan_select(const SelectNode *select) {
+    Table *table = get_table_by_id(select->table_id);
+    if (!table) {
+        log_msg(LOG_ERROR, "plan_select: Table with ID %d not found", select->table_id);
+        return NULL;
+    }
+
+    bool has_agg = select_has_aggregate(select);
+    bool grouped = alist_length(&select->group_by) > 0 || select->having ||
+                   select_has_distinct_aggregate(select);
+    PlanNode *plan = NULL;
+    bool index_ordered = false;
+    if (select->join_count > 0) {
+        JoinQuery q = {.select = select};
+        alist_init(&q.conjuncts, sizeof(JoinConjunct), NULL);
+        plan = plan_joins(&q);
+        for (int t = 0; t < MAX_JOIN_TABLES; t++)
+            free_plan(q.scans[t]);
+        alist_destroy(&q.conjuncts);
+        if (!plan)
+            return NULL;
+    } else {
+        if (!has_agg && !grouped && select->order_by_count > 0 && !select->sampled) {
+            plan = create_index_order_plan(table, select);
+            index_ordered = plan != NULL;
+        }
+        if (!plan)
+            plan = select->sampled ? create_sample_scan_plan(select, select->where_clause)
+                                   : optimize_select(table->table_id, select->where_clause);
+        bool index_only = plan && !has_agg && !grouped && !index_ordered &&
+                          select->order_by_count == 0 &&
+                          make_index_only(plan, table, select, select_star(select));
+        if (select->where_clause && !index_only) {
+            plan = add_filter(plan, select->where_clause);
+            estimate_filtered_rows(plan, table, select->where_clause);
+        }
+    }
+
+    if (grouped) {
+        /* The groups are sorted for ORDER BY once HAVING has filtered them. */
+        uint32_t rows = plan ? plan->estimated_rows : 0;
+        plan = wrap_plan(PLAN_HASH_AGGREGATE, plan, HASH_BUILD_ROW_COST);
+        if (plan) {
+            HashAggregatePlan *agg = &plan->plan.hash_aggregate;
+            agg->expressions = &select->expressions;
+            agg->group_by = &select->group_by;
+            agg->having = select->having;
+            agg->order_by = &select->order_by;
+            agg->desc = &select->order_by_desc;
+            plan->estimated_rows = estimate_groups(table, select, rows);
+            double groups = plan->estimated_rows;
+            if (select->order_by_count > 0)
+                plan->cost += groups * log2(groups + 1) * SORT_ROW_COST;
+        }
+    } else if (has_agg) {
+        plan = wrap_plan(PLAN_AGGREGATE, plan, PIPELINE_ROW_COST);
+        if (plan) {
+            plan->plan.aggregate.expressions = &select->expressions;
+            plan->estimated_rows = 1;
+        }
+    } else if (select->order_by_count > 0 && !index_ordered) {
+        /* A LIMIT below the input keeps a heap of limit rows: log2(limit) per input row. A
+           larger one sorts everything, which can spill, and leaves the cut to the LIMIT. */
+        double rows = plan ? plan->estimated_rows : 0;
+        bool top_k = select->limit > 0 && select->limit <= INT_MAX && select->limit < rows;
+        double kept = top_k ? select->limit : rows;
+        plan = wrap_plan(PLAN_SORT, plan, log2(kept + 1) * SORT_ROW_COST);
+        if (plan) {
+            plan->plan.sort.keys = &select->order_by;
+            plan->plan.sort.desc = &select->order_by_desc;
+            plan->plan.sort.limit = top_k ? select->limit : 0;
+        }
+    }
+
+    if (select->limit > 0) {
+        plan = wrap_plan(PLAN_LIMIT, plan, 0);
+        if (plan) {
+            plan->plan.limit.count = select->limit;
+            if (plan->estimated_rows > select->limit)
+                plan->estimated_rows = select->limit;
         }
     }
+
+    plan = wrap_plan(PLAN_PROJECT, plan, PIPELINE_ROW_COST);
+    if (plan) {
+        plan->plan.project.expressions = &select->expressions;
+        plan->plan.project.select_star = select_star(select);
+    }
+    return plan;
+}
+
+/* The outer reference whose value expr is, if any. */
+static const OuterRef *outer_ref_of(const Expr *expr, const SubqueryState *state) {
+    if (!expr || expr->type != EXPR_VALUE)
+        return NULL;
+    for (int i = 0; i < state->outer_count; i++)
+        if (state->outer[i].slot == &expr->value)
+            return &state->outer[i];
     return NULL;
 }
 
-void collect_table_stats(uint8_t table_id) {
-    for (int i = 0; i < g_stats_count; i++) {
-        if (g_stats[i].table_id == table_id) {
-            return;
-        }
+/* Whether expr reads an outer value of the subquery (nested subqueries bind their own). */
+static bool reads_outer(const Expr *expr, const SubqueryState *state) {
+    if (!expr)
+        return false;
+    switch (expr->type) {
+    case EXPR_VALUE:
+        return outer_ref_of(expr, state) != NULL;
+    case EXPR_BINARY_OP:
+        return reads_outer(expr->binary.left, state) || reads_outer(expr->binary.right, state);
+    case EXPR_UNARY_OP:
+        return reads_outer(expr->unary.operand, state);
+    case EXPR_AGGREGATE_FUNC:
+        return reads_outer(expr->aggregate.operand, state);
+    case EXPR_SCALAR_FUNC:
+        for (int i = 0; i < expr->scalar.arg_count; i++)
+            if (reads_outer(expr->scalar.args[i], state))
+                return true;
+        return false;
+    case EXPR_SUBQUERY:
+        return reads_outer(expr->subquery.operand, state);
+    default:
+        return false;
     }
+}
 
-    if (g_stats_count < MAX_TABLES) {
-        g_stats[g_stats_count].table_id = table_id;
-        g_stats[g_stats_count].total_rows = 1000; // Default estimate
-        g_stats[g_stats_count].has_stats = false;
+static bool has_aggregate(const Expr *expr) {
+    if (!expr)
+        return false;
+    switch (expr->type) {
+    case EXPR_AGGREGATE_FUNC:
+        return true;
+    case EXPR_BINARY_OP:
+        return has_aggregate(expr->binary.left) || has_aggregate(expr->binary.right);
+    case EXPR_UNARY_OP:
+        return has_aggregate(expr->unary.operand);
+    case EXPR_SCALAR_FUNC:
+        for (int i = 0; i < expr->scalar.arg_count; i++)
+            if (has_aggregate(expr->scalar.args[i]))
+                return true;
+        return false;
+    default:
+        return false;
+    }
+}
 
-        for (int i = 0; i < MAX_COLUMNS; i++) {
-            g_stats[g_stats_count].distinct_values[i] = 100;
+/* Sorts the conjuncts of a correlated WHERE into the semi join's keys (inner = outer column)
+   and the residual filter of its build side; false when an outer value is used otherwise. */
+static bool split_correlation(Arena *arena, const Expr *expr, const SubqueryState *state,
+                              SemiJoinPlan *plan) {
+    if (!expr)
+        return true;
+    if (expr->type == EXPR_BINARY_OP && expr->binary.op == OP_AND)
+        return split_correlation(arena, expr->binary.left, state, plan) &&
+               split_correlation(arena, expr->binary.right, state, plan);
+    if (!reads_outer(expr, state)) {
+        if (!plan->residual) {
+            plan->residual = expr;
+            return true;
         }
+        Expr *and = arena_calloc(arena, 1, sizeof(Expr));
+        if (!and)
+            return false;
+        and->type = EXPR_BINARY_OP;
+        and->binary.op = OP_AND;
+        and->binary.left = (Expr *)plan->residual;
+        and->binary.right = (Expr *)expr;
+        plan->residual = and;
+        return true;
+    }
+    if (expr->type != EXPR_BINARY_OP || expr->binary.op != OP_EQUALS ||
+        plan->key_count == SEMI_JOIN_MAX_KEYS)
+        return false;
+    Expr *inner = expr->binary.right;
+    const OuterRef *ref = outer_ref_of(expr->binary.left, state);
+    if (!ref) {
+        inner = expr->binary.left;
+        ref = outer_ref_of(expr->binary.right, state);
+    }
+    if (!ref || reads_outer(inner, state) || has_aggregate(inner))
+        return false;
+    plan->inner_keys[plan->key_count] = inner;
+    plan->outer_columns[plan->key_count] = ref->column_id;
+    plan->key_count++;
+    return true;
+}
 
-        g_stats_count++;
-        log_msg(LOG_INFO, "Collected stats for table_id=%d", table_id);
+/* Decorrelates a correlated [NOT] EXISTS or [NOT] IN subquery into a semi join (see
+   SemiJoinPlan). It must read one whole table without grouping or aggregates, an IN subquery's
+   column must not read the outer row, and in its WHERE an outer value may only be one side
+   of an equality. NULL when the subquery has to run for each outer row instead. */
+const SemiJoinPlan *plan_semi_join(Arena *arena, const Expr *subquery) {
+    const SubqueryState *state = subquery->subquery.state;
+    const ASTNode *ast = subquery->subquery.subquery;
+    const SelectNode *select = &ast->select;
+    bool exists = subquery->subquery.kind == SUBQUERY_EXISTS;
+    if (ast->next || select->join_count > 0 || alist_length(&select->group_by) > 0 ||
+        select->having || select->sampled || (!exists && select->limit > 0))
+        return NULL;
+    for (int i = 0; i < alist_length(&select->expressions); i++) {
+        const Expr *expr = *(Expr **)alist_get(&select->expressions, i);
+        if (has_aggregate(expr) || (!exists && reads_outer(expr, state)))
+            return NULL;
+    }
+
+    SemiJoinPlan *plan = arena_calloc(arena, 1, sizeof(SemiJoinPlan));
+    if (!plan)
+        return NULL;
+    plan->table_id = select->table_id;
+    if (!split_correlation(arena, select->where_clause, state, plan) || plan->key_count == 0)
+        return NULL;
+    log_msg(LOG_DEBUG, "plan_semi_join: %d key(s) over table %d", plan->key_count,
+            plan->table_id);
+    return plan;
+}
+
+void free_plan(PlanNode *plan) {
+    if (!plan)
+        return;
+
+    if (plan->left)
+        free_plan(plan->left);
+    if (plan->right)
+        free_plan(plan->right);
+
+    free_predicate(plan->owned);
+    if (plan->type == PLAN_INDEX_SCAN || plan->type == PLAN_INDEX_ONLY_SCAN) {
+        IndexScanPlan *scan = &plan->plan.index_scan;
+        free_keys(scan->search_key, scan->eq_count);
+        free_keys(scan->lo_key, scan->lo_width);
+        free_keys(scan->hi_key, scan->hi_width);
     }
+
+    free(plan);
 }
@@ -1,21 +1,17 @@
 #include <ctype.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 
 #include "db.h"
 #include "logger.h"
 #include "utils.h"
 #include "table.h"
-
-static unsigned int make_time(int hour, int minute, int second) {
-    return ((hour & 0xFF) << 12) | ((minute & 0x3F) << 6) | (second & 0x3F);
-}
-static unsigned int make_date(int year, int month, int day) {
-    return ((year & 0x3FFFFF) << 9) | ((month & 0xF) << 5) | (day & 0x1F);
-}
+#include "values.h"
 
 #define COLOR_RESET "\x1b[0m"
 #define COLOR_RED "\x1b[31m"
@@ -93,8 +89,9 @@ static ParseContext g_parse_context;
 
 static void advance(void);
 static Expr *parse_primary(ParseContext *ctx);
-static Expr *parse_subquery(ParseContext *ctx);
+static Expr *parse_subquery(ParseContext *ctx, SubqueryKind kind, Expr *operand);
 static Expr *parse_unary_expr(ParseContext *ctx);
+static Expr *parse_additive_expr(ParseContext *ctx);
 static Expr *parse_comparison_expr(ParseContext *ctx);
 static Expr *parse_and_expr(ParseContext *ctx);
 static Expr *parse_or_expr(ParseContext *ctx);
@@ -113,60 +110,43 @@ static ASTNode *parse_delete(ParseContext *ctx);
 static ASTNode *parse_select(ParseContext *ctx);
 static ASTNode *parse_create_index(ParseContext *ctx);
 static ASTNode *parse_drop_index(ParseContext *ctx);
+static ASTNode *parse_analyze(ParseContext *ctx);
+static ASTNode *parse_set(ParseContext *ctx);
+static ASTNode *parse_copy(ParseContext *ctx);
+static ASTNode *parse_create_view(ParseContext *ctx);
+static ASTNode *parse_prepare(ParseContext *ctx);
+static ASTNode *parse_execute(ParseContext *ctx);
+static ASTNode *parse_deallocate(ParseContext *ctx);
 static void print_error_line(FILE *stream, const char *fmt, ...);
-static bool parse_date_literal(const char *value, int *year, int *month, int *day);
-static bool parse_time_literal(const char *value, int *hour, int *minute, int *second);
 static bool parse_hex_byte(const char *value, unsigned char *out);
 
-static void free_column_value(void *ptr) {
-    ColumnValue *cv = (ColumnValue *)ptr;
-    if (!cv)
-        return;
-    if (cv->value.type == TYPE_STRING && cv->value.char_val) {
-        free(cv->value.char_val);
-        cv->value.char_val = NULL;
-    }
-    cv->value.type = TYPE_NULL;
-}
-
+/* Expressions live in the statement's arena; only subqueries own heap memory (their
+   ArrayLists), so freeing an expression just walks down to them. */
 static void free_expr(Expr *expr) {
     if (!expr)
         return;
     switch (expr->type) {
-    case EXPR_VALUE:
-        if (expr->value.type == TYPE_STRING && expr->value.char_val) {
-            free(expr->value.char_val);
-            expr->value.char_val = NULL;
-        }
-        break;
     case EXPR_BINARY_OP:
-        if (expr->binary.left)
-            free_expr(expr->binary.left);
-        if (expr->binary.right)
-            free_expr(expr->binary.right);
+        free_expr(expr->binary.left);
+        free_expr(expr->binary.right);
         break;
     case EXPR_UNARY_OP:
-        if (expr->unary.operand)
-            free_expr(expr->unary.operand);
+        free_expr(expr->unary.operand);
         break;
     case EXPR_AGGREGATE_FUNC:
-        if (expr->aggregate.operand)
-            free_expr(expr->aggregate.operand);
+        free_expr(expr->aggregate.operand);
         break;
     case EXPR_SCALAR_FUNC:
-        for (int i = 0; i < expr->scalar.arg_count; i++) {
-            if (expr->scalar.args[i])
-                free_expr(expr->scalar.args[i]);
-        }
+        for (int i = 0; i < expr->scalar.arg_count; i++)
+            free_expr(expr->scalar.args[i]);
         break;
     case EXPR_SUBQUERY:
-        if (expr->subquery.subquery)
-            free_ast(expr->subquery.subquery);
+        free_expr(expr->subquery.operand);
+        free_ast(expr->subquery.subquery);
         break;
     default:
         break;
     }
-    free(expr);
 }
 
 static const char *token_type_name(TokenType type) {
@@ -249,6 +229,10 @@ static const char *token_type_name(TokenType type) {
         return "INNER";
     case TOKEN_LEFT:
         return "LEFT";
+    case TOKEN_DOT:
+        return "DOT";
+    case TOKEN_PARAM:
+        return "PARAM";
     default:
         return "UNKNOWN";
     }
@@ -419,14 +403,8 @@ static void parse_error_set(ParseContext *ctx, ParseErrorCode code, const char *
 
     ctx->error.token_index = token_index;
 
-    int pos = 0;
-    for (int i = 0; i < token_index && i < ctx->token_count; i++) {
-        pos += strlen(ctx->tokens[i].value);
-        if (i < token_index - 1 && i + 1 < ctx->token_count) {
-            pos++;
-        }
-    }
-    ctx->error.column = pos + 1;
+    if (token_index >= 0 && token_index < ctx->token_count)
+        ctx->error.column = ctx->tokens[token_index].offset + 1;
 }
 
 static int calculate_line_number(const char *input, int target_pos) {
@@ -477,28 +455,10 @@ static void print_token_context(ParseContext *ctx) {
 }
 
 static int find_token_position(ParseContext *ctx) {
-    Token *err_tok = &ctx->tokens[ctx->error.token_index];
-    const char *token_val = err_tok->value;
-    int token_pos = -1;
-    const char *found = ctx->input;
-    while (*found) {
-        if (strncmp(found, token_val, strlen(token_val)) == 0) {
-            token_pos = found - ctx->input;
-            break;
-        }
-        found++;
-    }
-    if (token_pos < 0) {
-        int pos = 0;
-        for (int i = 0; i <= ctx->error.token_index && i < ctx->token_count; i++) {
-            if (i == ctx->error.token_index) {
-                break;
-            }
-            pos += strlen(ctx->tokens[i].value) + 1;
-        }
-        token_pos = pos;
-    }
-    return token_pos;
+    /* The input kept for reports is capped, so a token past its end is marked at the end. */
+    int token_pos = ctx->tokens[ctx->error.token_index].offset;
+    int input_len = strlen(ctx->input);
+    return token_pos < input_len ? token_pos : input_len;
 }
 
 static void print_input_context_with_marker(ParseContext *ctx, int token_pos) {
@@ -995,6 +955,17 @@ static bool parse_column_def(ParseContext *ctx, ColumnDef *col) {
             if (!parse_column_references(ctx, col)) {
                 return false;
             }
+        } else if (current_token->type == TOKEN_KEYWORD &&
+                   strcasecmp(current_token->value, "DICTIONARY") == 0) {
+            if (col->type != TYPE_STRING) {
+                parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX,
+                                "DICTIONARY applies to STRING columns only", "STRING column",
+                                col->name, "Remove DICTIONARY or declare the column as STRING");
+                return false;
+            }
+            col->flags |= COL_FLAG_DICTIONARY;
+            log_msg(LOG_DEBUG, "parse_column_def: Column '%s' DICTIONARY", col->name);
+            advance();
         } else if (current_token->type == TOKEN_KEYWORD) {
             log_msg(LOG_WARN, "parse_column_def: Unknown keyword '%s', skipping",
                     current_token->value);
@@ -1065,9 +1036,9 @@ static ASTNode *parse_create_table(ParseContext *ctx) {
         return false;
     }
 
-    ASTNode *node = malloc(sizeof(ASTNode));
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
     if (!node) {
-        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for CREATE TABLE node",
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for CREATE TABLE node",
                         "memory", "NULL", "Try again or reduce query complexity");
         return false;
     }
@@ -1093,7 +1064,7 @@ static ASTNode *parse_create_table(ParseContext *ctx) {
     Table tmp;
     memclear(&tmp, sizeof(Table));
     strcopy(tmp.name, sizeof(tmp.name), node->create_table.table_name);
-    tmp.table_id = alist_length(&tables) + 1;
+    tmp.table_id = next_table_id();
     tmp.schema.columns = node->create_table.columns;
     ctx->current_table = &tmp;
 
@@ -1108,7 +1079,7 @@ static ASTNode *parse_create_table(ParseContext *ctx) {
         } else {
             ColumnDef *col = (ColumnDef *)alist_append(&node->create_table.columns);
             if (!col) {
-                parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for columns",
+                parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for columns",
                                 "memory", "NULL", NULL);
                 ctx->current_table = NULL;
                 free_ast(node);
@@ -1137,24 +1108,51 @@ static ASTNode *parse_create_table(ParseContext *ctx) {
         return false;
     }
 
-    if (match(TOKEN_STRICT)) {
-        node->create_table.strict = true;
-        advance();
+    while (true) {
+        if (match(TOKEN_STRICT)) {
+            node->create_table.strict = true;
+            advance();
+        } else if (match(TOKEN_KEYWORD) && strcasecmp(current_token->value, "STORAGE") == 0) {
+            advance();
+            if (strcasecmp(current_token->value, "COLUMNAR") == 0) {
+                node->create_table.storage = STORAGE_COLUMNAR;
+            } else if (strcasecmp(current_token->value, "ROW") == 0) {
+                node->create_table.storage = STORAGE_ROW;
+            } else {
+                parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "Unknown storage type",
+                                "COLUMNAR or ROW", current_token->value, NULL);
+                free_ast(node);
+                return NULL;
+            }
+            advance();
+        } else {
+            break;
+        }
     }
 
     return node;
 }
 
+/* A '?' parses to a NULL carrying its 1-based parameter number in int_val until a value
+   is bound over it; see ast_collect_params. */
+static Value parse_param(ParseContext *ctx) {
+    Value val = {0};
+    val.type = TYPE_NULL;
+    val.int_val = ++ctx->param_count;
+    advance();
+    return val;
+}
+
 static Value parse_value(ParseContext *ctx) {
-    (void)ctx;
-    Value val;
+    Value val = {0};
     val.type = TYPE_ERROR;
 
-    if (match(TOKEN_STRING)) {
+    if (match(TOKEN_PARAM)) {
+        return parse_param(ctx);
+    } else if (match(TOKEN_STRING)) {
         log_msg(LOG_DEBUG, "parse_value: Parsing string value '%s'", current_token->value);
         val.type = TYPE_STRING;
-        val.char_val = malloc(strlen(current_token->value) + 1);
-        strcopy(val.char_val, strlen(current_token->value) + 1, current_token->value);
+        val.char_val = arena_strdup(ctx->arena, current_token->value);
         advance();
         return val;
     } else if (match(TOKEN_NUMBER)) {
@@ -1221,7 +1219,7 @@ static Value parse_value(ParseContext *ctx) {
             hex_len--;
         }
         val.blob_val.length = hex_len / 2;
-        val.blob_val.data = malloc(val.blob_val.length);
+        val.blob_val.data = arena_alloc(ctx->arena, val.blob_val.length);
         if (val.blob_val.data) {
             for (size_t i = 0; i < val.blob_val.length; i++) {
                 unsigned char byte = 0;
@@ -1238,17 +1236,16 @@ static Value parse_value(ParseContext *ctx) {
 
     log_msg(LOG_WARN, "parse_value: Unknown value type, defaulting to empty string");
     val.type = TYPE_STRING;
-    val.char_val = malloc(1);
-    strcopy(val.char_val, 1, "");
+    val.char_val = arena_strdup(ctx->arena, "");
     return val;
 }
 
 static Expr *parse_aggregate_func(ParseContext *ctx) {
     log_msg(LOG_DEBUG, "parse_aggregate_func: Parsing '%s'", current_token->value);
 
-    Expr *expr = malloc(sizeof(Expr));
+    Expr *expr = arena_alloc(ctx->arena, sizeof(Expr));
     if (!expr) {
-        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for aggregate function",
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for aggregate function",
                         "expression", "NULL", "Try again or simplify your query");
         return NULL;
     }
@@ -1256,6 +1253,7 @@ static Expr *parse_aggregate_func(ParseContext *ctx) {
     memclear(expr, sizeof(Expr));
     expr->type = EXPR_AGGREGATE_FUNC;
 
+    bool percentile = false;
     if (strcasecmp(current_token->value, "COUNT") == 0) {
         expr->aggregate.func_type = FUNC_COUNT;
     } else if (strcasecmp(current_token->value, "SUM") == 0) {
@@ -1266,6 +1264,18 @@ static Expr *parse_aggregate_func(ParseContext *ctx) {
         expr->aggregate.func_type = FUNC_MIN;
     } else if (strcasecmp(current_token->value, "MAX") == 0) {
         expr->aggregate.func_type = FUNC_MAX;
+    } else if (strcasecmp(current_token->value, "STDDEV") == 0) {
+        expr->aggregate.func_type = FUNC_STDDEV;
+    } else if (strcasecmp(current_token->value, "VARIANCE") == 0) {
+        expr->aggregate.func_type = FUNC_VARIANCE;
+    } else if (strcasecmp(current_token->value, "APPROX_COUNT_DISTINCT") == 0) {
+        expr->aggregate.func_type = FUNC_APPROX_COUNT_DISTINCT;
+    } else if (strcasecmp(current_token->value, "APPROX_PERCENTILE") == 0) {
+        expr->aggregate.func_type = FUNC_APPROX_PERCENTILE;
+        percentile = true;
+    } else if (strcasecmp(current_token->value, "APPROX_MEDIAN") == 0) {
+        expr->aggregate.func_type = FUNC_APPROX_PERCENTILE;
+        expr->aggregate.fraction = 0.5;
     } else {
         expr->aggregate.func_type = FUNC_COUNT;
     }
@@ -1307,6 +1317,31 @@ static Expr *parse_aggregate_func(ParseContext *ctx) {
         expr->aggregate.count_all = false;
     }
 
+    /* APPROX_PERCENTILE(x, p) takes the fraction p as a literal in [0, 1]. */
+    if (percentile) {
+        double fraction = 0;
+        bool ok = match(TOKEN_COMMA);
+        if (ok) {
+            advance();
+            ok = match(TOKEN_NUMBER);
+            fraction = ok ? atof(current_token->value) : 0;
+            ok = ok && fraction >= 0 && fraction <= 1;
+        }
+        if (!ok) {
+            parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX,
+                            "APPROX_PERCENTILE takes a fraction between 0 and 1",
+                            "a number from 0 to 1",
+                            current_token->type == TOKEN_EOF ? "end of input"
+                                                             : current_token->value,
+                            "Use: APPROX_PERCENTILE(column, 0.95)");
+            free_expr(expr->aggregate.operand);
+            free_expr(expr);
+            return NULL;
+        }
+        expr->aggregate.fraction = fraction;
+        advance();
+    }
+
     if (!expect(ctx, TOKEN_RPAREN, "aggregate function")) {
         if (expr->aggregate.operand) {
             free_expr(expr->aggregate.operand);
@@ -1320,9 +1355,9 @@ static Expr *parse_aggregate_func(ParseContext *ctx) {
 }
 
 static Expr *parse_scalar_func(ParseContext *ctx) {
-    Expr *expr = malloc(sizeof(Expr));
+    Expr *expr = arena_alloc(ctx->arena, sizeof(Expr));
     if (!expr) {
-        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for scalar function",
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for scalar function",
                         "expression", "NULL", "Try again or simplify your query");
         return NULL;
     }
@@ -1404,7 +1439,7 @@ static Expr *parse_scalar_func(ParseContext *ctx) {
     return expr;
 }
 
-static void parse_literal_value(Expr *expr) {
+static void parse_literal_value(ParseContext *ctx, Expr *expr) {
     log_msg(LOG_DEBUG, "parse_primary: Parsing literal value '%s'", current_token->value);
     expr->type = EXPR_VALUE;
     if (match(TOKEN_DATE)) {
@@ -1425,8 +1460,7 @@ static void parse_literal_value(Expr *expr) {
         }
     } else if (match(TOKEN_STRING)) {
         expr->value.type = TYPE_STRING;
-        expr->value.char_val = malloc(strlen(current_token->value) + 1);
-        strcopy(expr->value.char_val, strlen(current_token->value) + 1, current_token->value);
+        expr->value.char_val = arena_strdup(ctx->arena, current_token->value);
     } else {
         if (strchr(current_token->value, '.')) {
             expr->value.type = TYPE_FLOAT;
@@ -1439,9 +1473,21 @@ static void parse_literal_value(Expr *expr) {
     advance();
 }
 
+static bool match_select_keyword(void) {
+    return match(TOKEN_KEYWORD) && strcasecmp(current_token->value, "SELECT") == 0;
+}
+
 static Expr *parse_parenthesized_expr(ParseContext *ctx) {
     log_msg(LOG_DEBUG, "parse_primary: Parsing parenthesized expression");
     advance();
+    if (match_select_keyword()) {
+        Expr *subquery = parse_subquery(ctx, SUBQUERY_SCALAR, NULL);
+        if (!subquery || !expect(ctx, TOKEN_RPAREN, "subquery")) {
+            free_expr(subquery);
+            return NULL;
+        }
+        return subquery;
+    }
     Expr *inner = parse_or_expr(ctx);
     if (!inner) {
         parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX,
@@ -1458,43 +1504,145 @@ static Expr *parse_parenthesized_expr(ParseContext *ctx) {
     return inner;
 }
 
+static int find_column_in_table(const Table *table, const char *name) {
+    for (int i = 0; i < alist_length(&table->schema.columns); i++) {
+        ColumnDef *col = (ColumnDef *)alist_get(&table->schema.columns, i);
+        if (col && strcasecmp(col->name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* An aliased table is only reachable through its alias, so a self-join can tell its two
+   sides apart. */
+static bool table_matches_qualifier(const Table *table, const char *alias, const char *qualifier) {
+    if (alias[0])
+        return strcasecmp(alias, qualifier) == 0;
+    return strcasecmp(table->name, qualifier) == 0;
+}
+
+/* The FROM and JOIN tables of a query a subquery is nested in, saved while the subquery's own
+   tables are in the ParseContext, and the columns of them the subquery reads. */
+typedef struct ParseScope {
+    Table *table;
+    Table *join_tables[MAX_JOIN_TABLES - 1];
+    int join_table_count;
+    char table_alias[MAX_TABLE_NAME_LEN];
+    char join_aliases[MAX_JOIN_TABLES - 1][MAX_TABLE_NAME_LEN];
+    ArrayList refs; /* OuterRef */
+    struct ParseScope *outer;
+} ParseScope;
+
+static void scope_save(const ParseContext *ctx, ParseScope *scope) {
+    scope->table = ctx->current_table;
+    scope->join_table_count = ctx->join_table_count;
+    memcopy(scope->join_tables, ctx->join_tables, sizeof(scope->join_tables));
+    memcopy(scope->table_alias, ctx->table_alias, sizeof(scope->table_alias));
+    memcopy(scope->join_aliases, ctx->join_aliases, sizeof(scope->join_aliases));
+    scope->outer = ctx->outer;
+}
+
+static void scope_restore(ParseContext *ctx, const ParseScope *scope) {
+    ctx->current_table = scope->table;
+    ctx->join_table_count = scope->join_table_count;
+    memcopy(ctx->join_tables, scope->join_tables, sizeof(scope->join_tables));
+    memcopy(ctx->table_alias, scope->table_alias, sizeof(scope->table_alias));
+    memcopy(ctx->join_aliases, scope->join_aliases, sizeof(scope->join_aliases));
+    ctx->outer = scope->outer;
+}
+
+/* Finds [qualifier.]name among left and its joins. In a join each joined table's columns
+   follow those of the tables before it, so the result indexes the combined row and an
+   unqualified name binds to the first table, in query order, that has the column. */
+static int bind_column(Table *left, const char *alias, Table *const *joins,
+                       const char (*join_aliases)[MAX_TABLE_NAME_LEN], int join_count,
+                       const char *qualifier, const char *name, uint16_t *table_id) {
+    int column_id = -1;
+    if (left && (!qualifier || table_matches_qualifier(left, alias, qualifier))) {
+        *table_id = left->table_id;
+        column_id = find_column_in_table(left, name);
+    }
+    int offset = left ? alist_length(&left->schema.columns) : 0;
+    for (int t = 0; column_id < 0 && left && t < join_count; t++) {
+        Table *right = joins[t];
+        if (!right)
+            break;
+        if (!qualifier || table_matches_qualifier(right, join_aliases[t], qualifier)) {
+            column_id = find_column_in_table(right, name);
+            if (column_id >= 0) {
+                *table_id = right->table_id;
+                column_id += offset;
+            }
+        }
+        offset += alist_length(&right->schema.columns);
+    }
+    return column_id;
+}
+
+/* Binds [qualifier.]column, to a column of the current query or else, inside a subquery, of
+   the query around it. An outer column becomes a value the subquery is run with. */
+static void parse_column_ref(ParseContext *ctx, Expr *expr) {
+    const char *qualifier = NULL;
+    if (current_token[1].type == TOKEN_DOT && current_token[2].type == TOKEN_IDENTIFIER) {
+        qualifier = current_token->value;
+        advance();
+        advance();
+    }
+    const char *name = current_token->value;
+
+    expr->type = EXPR_COLUMN;
+    expr->column.column_id = -1;
+    expr->column.table_id = 0;
+
+    int column_id = bind_column(ctx->current_table, ctx->table_alias, ctx->join_tables,
+                                (const char(*)[MAX_TABLE_NAME_LEN])ctx->join_aliases,
+                                ctx->join_table_count, qualifier, name, &expr->column.table_id);
+    ParseScope *outer = ctx->outer;
+    if (column_id < 0 && outer) {
+        uint16_t table_id = 0;
+        int outer_id = bind_column(outer->table, outer->table_alias, outer->join_tables,
+                                   (const char(*)[MAX_TABLE_NAME_LEN])outer->join_aliases,
+                                   outer->join_table_count, qualifier, name, &table_id);
+        OuterRef *ref = outer_id >= 0 ? alist_append(&outer->refs) : NULL;
+        if (ref) {
+            expr->type = EXPR_VALUE;
+            memclear(&expr->value, sizeof(Value));
+            expr->value.type = TYPE_NULL;
+            ref->column_id = (uint16_t)outer_id;
+            ref->slot = &expr->value;
+        }
+    }
+    if (column_id >= 0)
+        expr->column.column_id = (uint16_t)column_id;
+    advance();
+}
+
 static Expr *parse_primary(ParseContext *ctx) {
-    Expr *expr = malloc(sizeof(Expr));
+    Expr *expr = arena_alloc(ctx->arena, sizeof(Expr));
     if (!expr) {
-        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for primary expression",
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for primary expression",
                         "expression", "NULL", "Try again or simplify your query");
         return NULL;
     }
-
-    expr->alias[0] = '\0';
+    /* Cleared so the branches that hand off to another parser can free it safely. */
+    memclear(expr, sizeof(Expr));
 
     if (match(TOKEN_IDENTIFIER)) {
         log_msg(LOG_DEBUG, "parse_primary: Parsing identifier '%s'", current_token->value);
-        expr->type = EXPR_COLUMN;
-        expr->column.column_id = -1;
-        expr->column.table_id = 0;
-
-        if (ctx->current_table) {
-            expr->column.table_id = ctx->current_table->table_id;
-            for (int i = 0; i < alist_length(&ctx->current_table->schema.columns); i++) {
-                ColumnDef *col = (ColumnDef *)alist_get(&ctx->current_table->schema.columns, i);
-                if (col && strcasecmp(col->name, current_token->value) == 0) {
-                    expr->column.column_id = i;
-                    break;
-                }
-            }
-        } else {
-        }
-        advance();
+        parse_column_ref(ctx, expr);
     } else if (match(TOKEN_STRING) || match(TOKEN_NUMBER) || match(TOKEN_DATE) ||
                match(TOKEN_TIME)) {
-        parse_literal_value(expr);
-    } else if (match(TOKEN_KEYWORD) && strcasecmp(current_token->value, "NULL") == 0) {
-        log_msg(LOG_DEBUG, "parse_primary: Parsing NULL keyword");
+        parse_literal_value(ctx, expr);
+    } else if (match(TOKEN_PARAM)) {
         expr->type = EXPR_VALUE;
-        expr->value.char_val = malloc(5);
-        strcopy(expr->value.char_val, strlen("NULL") + 1, "NULL");
-        advance();
+        expr->value = parse_param(ctx);
+    } else if (match(TOKEN_NULL) ||
+               (match(TOKEN_KEYWORD) && (strcasecmp(current_token->value, "NULL") == 0 ||
+                                         strcasecmp(current_token->value, "TRUE") == 0 ||
+                                         strcasecmp(current_token->value, "FALSE") == 0))) {
+        log_msg(LOG_DEBUG, "parse_primary: Parsing %s keyword", current_token->value);
+        expr->type = EXPR_VALUE;
+        expr->value = parse_value(ctx);
     } else if (match(TOKEN_AGGREGATE_FUNC)) {
         free_expr(expr);
         return parse_aggregate_func(ctx);
@@ -1525,9 +1673,9 @@ static Expr *parse_primary(ParseContext *ctx) {
 static Expr *parse_unary_expr(ParseContext *ctx) {
     if (match(TOKEN_NOT)) {
         log_msg(LOG_DEBUG, "parse_unary_expr: Parsing NOT expression");
-        Expr *expr = malloc(sizeof(Expr));
+        Expr *expr = arena_alloc(ctx->arena, sizeof(Expr));
         if (!expr) {
-            log_msg(LOG_ERROR, "parse_unary_expr: malloc() failed");
+            log_msg(LOG_ERROR, "parse_unary_expr: allocation failed");
             return NULL;
         }
         memclear(expr, sizeof(Expr));
@@ -1544,37 +1692,22 @@ static Expr *parse_unary_expr(ParseContext *ctx) {
     }
     if (match(TOKEN_EXISTS)) {
         log_msg(LOG_DEBUG, "parse_unary_expr: Parsing EXISTS expression");
-        Expr *expr = malloc(sizeof(Expr));
-        if (!expr) {
-            log_msg(LOG_ERROR, "parse_unary_expr: malloc() failed");
-            return NULL;
-        }
-        memclear(expr, sizeof(Expr));
-        expr->type = EXPR_SUBQUERY;
         advance();
-        if (!expect(ctx, TOKEN_LPAREN, "EXISTS")) {
-            free_expr(expr);
+        if (!expect(ctx, TOKEN_LPAREN, "EXISTS"))
             return NULL;
-        }
-        Expr *subquery_expr = parse_subquery(ctx);
+        Expr *subquery_expr = parse_subquery(ctx, SUBQUERY_EXISTS, NULL);
         if (!subquery_expr) {
             log_msg(LOG_ERROR, "parse_unary_expr: Failed to parse EXISTS subquery");
             parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX,
                             "Failed to parse subquery in EXISTS expression",
                             "valid SELECT statement", "NULL", NULL);
-            free_expr(expr);
             return NULL;
         }
-        expr->subquery.subquery = subquery_expr->subquery.subquery;
-        free_expr(subquery_expr);
         if (!expect(ctx, TOKEN_RPAREN, "EXISTS")) {
-            if (expr->subquery.subquery) {
-                free_ast(expr->subquery.subquery);
-            }
-            free_expr(expr);
+            free_expr(subquery_expr);
             return NULL;
         }
-        return expr;
+        return subquery_expr;
     }
     Expr *primary = parse_primary(ctx);
     if (!primary) {
@@ -1583,10 +1716,17 @@ static Expr *parse_unary_expr(ParseContext *ctx) {
     return primary;
 }
 
-static Expr *parse_subquery(ParseContext *ctx) {
+static bool is_star_expr(const Expr *expr) {
+    return expr->type == EXPR_VALUE && expr->value.type == TYPE_STRING &&
+           strcmp(value_str(&expr->value), "*") == 0;
+}
+
+/* Parses the SELECT of a subquery with the current query's tables saved as its outer scope,
+   then plans correlated EXISTS and IN as semi joins where their correlation allows it. */
+static Expr *parse_subquery(ParseContext *ctx, SubqueryKind kind, Expr *operand) {
     log_msg(LOG_DEBUG, "parse_subquery: Starting subquery parsing");
 
-    if (!match(TOKEN_KEYWORD) || strcasecmp(current_token->value, "SELECT") != 0) {
+    if (!match_select_keyword()) {
         log_msg(LOG_WARN, "parse_subquery: Expected SELECT keyword");
         parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected SELECT in subquery", "SELECT",
                         current_token->value, "subquery");
@@ -1594,46 +1734,173 @@ static Expr *parse_subquery(ParseContext *ctx) {
     }
 
     advance();
+    ParseScope scope;
+    scope_save(ctx, &scope);
+    alist_init(&scope.refs, sizeof(OuterRef), NULL);
+    ctx->outer = &scope;
     ASTNode *subquery_ast = parse_select(ctx);
-    if (!subquery_ast) {
+    scope_restore(ctx, &scope);
+
+    int ref_count = alist_length(&scope.refs);
+    Expr *expr = subquery_ast ? arena_calloc(ctx->arena, 1, sizeof(Expr)) : NULL;
+    SubqueryState *state = expr ? arena_calloc(ctx->arena, 1, sizeof(SubqueryState)) : NULL;
+    OuterRef *refs = state && ref_count > 0
+                         ? arena_memdup(ctx->arena, scope.refs.data,
+                                        sizeof(OuterRef) * (size_t)ref_count)
+                         : NULL;
+    alist_destroy(&scope.refs);
+    if (!state || (ref_count > 0 && !refs)) {
         log_msg(LOG_WARN, "parse_subquery: Failed to parse subquery AST");
-        return NULL;
-    }
-
-    if (subquery_ast->type != AST_SELECT) {
-        log_msg(LOG_WARN, "parse_subquery: Subquery must be a SELECT statement");
         free_ast(subquery_ast);
         return NULL;
     }
 
-    Expr *expr = malloc(sizeof(Expr));
-    if (!expr) {
-        log_msg(LOG_ERROR, "parse_subquery: malloc() failed");
+    SelectNode *select = &subquery_ast->select;
+    if ((kind == SUBQUERY_IN || kind == SUBQUERY_NOT_IN) &&
+        (alist_length(&select->expressions) != 1 ||
+         is_star_expr(*(Expr **)alist_get(&select->expressions, 0)))) {
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "Subquery after IN must return one column",
+                        "SELECT column", current_token->value,
+                        "e.g. id IN (SELECT user_id FROM orders)");
         free_ast(subquery_ast);
         return NULL;
     }
+    if (kind == SUBQUERY_EXISTS)
+        select->limit = 1; /* the first row decides */
 
-    expr->alias[0] = '\0';
     expr->type = EXPR_SUBQUERY;
     expr->subquery.subquery = subquery_ast;
+    expr->subquery.operand = operand;
+    expr->subquery.kind = kind;
+    expr->subquery.state = state;
+    state->outer = refs;
+    state->outer_count = ref_count;
+    if (ref_count > 0 && kind != SUBQUERY_SCALAR)
+        state->semi_join = plan_semi_join(ctx->arena, expr);
+
+    log_msg(LOG_DEBUG, "parse_subquery: Subquery parsed successfully (%d outer columns)",
+            ref_count);
+    return expr;
+}
 
-    log_msg(LOG_DEBUG, "parse_subquery: Subquery parsed successfully");
+static bool match_operator(const char *op) {
+    return match(TOKEN_OPERATOR) && strcmp(current_token->value, op) == 0;
+}
+
+static Expr *new_binary_expr(ParseContext *ctx, OperatorType op, Expr *left) {
+    Expr *expr = arena_alloc(ctx->arena, sizeof(Expr));
+    if (!expr) {
+        log_msg(LOG_ERROR, "parse: allocation failed for binary expression");
+        return NULL;
+    }
+    memclear(expr, sizeof(Expr));
+    expr->type = EXPR_BINARY_OP;
+    expr->binary.op = op;
+    expr->binary.left = left;
     return expr;
 }
 
+static Expr *parse_multiplicative_expr(ParseContext *ctx) {
+    Expr *left = parse_unary_expr(ctx);
+    while (left && (match_operator("*") || match_operator("/") || match_operator("%"))) {
+        OperatorType op = current_token->value[0] == '*'   ? OP_MULTIPLY
+                          : current_token->value[0] == '/' ? OP_DIVIDE
+                                                           : OP_MODULUS;
+        advance();
+        Expr *expr = new_binary_expr(ctx, op, left);
+        if (!expr)
+            return NULL;
+        expr->binary.right = parse_unary_expr(ctx);
+        if (!expr->binary.right)
+            return NULL;
+        left = expr;
+    }
+    return left;
+}
+
+/* The tokenizer reads "a -1" as a and the number -1, which after an operand is a
+   subtraction of 1. */
+static Expr *parse_additive_expr(ParseContext *ctx) {
+    Expr *left = parse_multiplicative_expr(ctx);
+    while (left && (match_operator("+") || match_operator("-") ||
+                    (match(TOKEN_NUMBER) && current_token->value[0] == '-'))) {
+        Expr *expr = new_binary_expr(ctx, current_token->value[0] == '+' ? OP_ADD : OP_SUBTRACT,
+                                     left);
+        if (!expr)
+            return NULL;
+        if (match(TOKEN_NUMBER)) {
+            current_token->value++;
+            current_token->offset++;
+            current_token->length--;
+        } else {
+            advance();
+        }
+        expr->binary.right = parse_multiplicative_expr(ctx);
+        if (!expr->binary.right)
+            return NULL;
+        left = expr;
+    }
+    return left;
+}
+
+/* The ( value, ... ) of IN. Lists of literals of one type are hashed; a list with a
+   parameter is compared value by value, since binding rewrites it in place. */
+static Expr *parse_in_list(ParseContext *ctx) {
+    if (!consume(ctx, TOKEN_LPAREN)) {
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "Expected a list of values after IN",
+                        "(value, ...)", current_token->value,
+                        "IN takes a list of constants or a subquery, e.g. id IN (1, 2, 3)");
+        return NULL;
+    }
+    ArrayList values;
+    alist_init(&values, sizeof(Value), NULL);
+    bool has_param = false;
+    bool ok = true;
+    do {
+        has_param = has_param || match(TOKEN_PARAM);
+        Value val = parse_value(ctx);
+        Value *slot = val.type == TYPE_ERROR ? NULL : (Value *)alist_append(&values);
+        if (!slot) {
+            ok = false;
+            break;
+        }
+        *slot = val;
+    } while (consume(ctx, TOKEN_COMMA));
+    ok = ok && consume(ctx, TOKEN_RPAREN);
+
+    Expr *list = ok ? arena_calloc(ctx->arena, 1, sizeof(Expr)) : NULL;
+    if (list) {
+        list->type = EXPR_LIST;
+        list->list.count = alist_length(&values);
+        list->list.values = arena_memdup(ctx->arena, values.data,
+                                         sizeof(Value) * (size_t)list->list.count);
+        if (!list->list.values)
+            list = NULL;
+        else if (!has_param)
+            list->list.set = value_set_build(ctx->arena, list->list.values, list->list.count);
+    }
+    alist_destroy(&values);
+    if (!list)
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "Invalid IN list", "(value, ...)",
+                        current_token->value, "IN lists hold constants separated by commas");
+    return list;
+}
+
 static Expr *parse_comparison_expr(ParseContext *ctx) {
     log_msg(LOG_DEBUG, "parse_comparison_expr: Starting comparison expression parsing");
 
-    Expr *left = parse_unary_expr(ctx);
+    Expr *left = parse_additive_expr(ctx);
     if (!left)
         return NULL;
 
     while (match(TOKEN_EQUALS) || match(TOKEN_NOT_EQUALS) || match(TOKEN_LESS) ||
            match(TOKEN_LESS_EQUAL) || match(TOKEN_GREATER) || match(TOKEN_GREATER_EQUAL) ||
-           match(TOKEN_LIKE)) {
-        Expr *expr = malloc(sizeof(Expr));
+           match(TOKEN_LIKE) || match(TOKEN_IN) ||
+           (match(TOKEN_NOT) && (current_token[1].type == TOKEN_LIKE ||
+                                 current_token[1].type == TOKEN_IN))) {
+        Expr *expr = arena_alloc(ctx->arena, sizeof(Expr));
         if (!expr) {
-            log_msg(LOG_ERROR, "parse_comparison_expr: malloc() failed");
+            log_msg(LOG_ERROR, "parse_comparison_expr: allocation failed");
             free_expr(left);
             return NULL;
         }
@@ -1665,19 +1932,46 @@ static Expr *parse_comparison_expr(ParseContext *ctx) {
             op = OP_GREATER_EQUAL;
             log_msg(LOG_DEBUG, "parse_comparison_expr: Found >= operator");
             advance();
+        } else if (match(TOKEN_NOT)) {
+            advance();
+            op = match(TOKEN_IN) ? OP_NOT_IN : OP_NOT_LIKE;
+            advance();
+        } else if (match(TOKEN_IN)) {
+            op = OP_IN;
+            advance();
         } else {
             op = OP_LIKE;
             log_msg(LOG_DEBUG, "parse_comparison_expr: Found LIKE operator");
             advance();
         }
 
+        if ((op == OP_IN || op == OP_NOT_IN) && match(TOKEN_LPAREN) &&
+            current_token[1].type == TOKEN_KEYWORD &&
+            strcasecmp(current_token[1].value, "SELECT") == 0) {
+            advance();
+            Expr *subquery =
+                parse_subquery(ctx, op == OP_IN ? SUBQUERY_IN : SUBQUERY_NOT_IN, left);
+            if (!subquery || !expect(ctx, TOKEN_RPAREN, "IN subquery")) {
+                free_expr(subquery ? subquery : left);
+                return NULL;
+            }
+            left = subquery;
+            continue;
+        }
         expr->binary.op = op;
         expr->binary.left = left;
-        expr->binary.right = parse_unary_expr(ctx);
+        expr->binary.like = NULL;
+        expr->binary.right = op == OP_IN || op == OP_NOT_IN ? parse_in_list(ctx)
+                                                            : parse_additive_expr(ctx);
         if (!expr->binary.right) {
             free_expr(expr);
             return NULL;
         }
+        /* A literal pattern is compiled here, once for every execution of the statement. */
+        const Expr *right = expr->binary.right;
+        if ((op == OP_LIKE || op == OP_NOT_LIKE) && right->type == EXPR_VALUE &&
+            right->value.type == TYPE_STRING)
+            expr->binary.like = like_compile(ctx->arena, value_str(&right->value));
         left = expr;
     }
 
@@ -1693,9 +1987,9 @@ static Expr *parse_and_expr(ParseContext *ctx) {
 
     while (match(TOKEN_AND)) {
         log_msg(LOG_DEBUG, "parse_and_expr: Found AND operator");
-        Expr *expr = malloc(sizeof(Expr));
+        Expr *expr = arena_alloc(ctx->arena, sizeof(Expr));
         if (!expr) {
-            log_msg(LOG_ERROR, "parse_and_expr: malloc() failed");
+            log_msg(LOG_ERROR, "parse_and_expr: allocation failed");
             free_expr(left);
             return NULL;
         }
@@ -1724,9 +2018,9 @@ static Expr *parse_or_expr(ParseContext *ctx) {
 
     while (match(TOKEN_OR)) {
         log_msg(LOG_DEBUG, "parse_or_expr: Found OR operator");
-        Expr *expr = malloc(sizeof(Expr));
+        Expr *expr = arena_alloc(ctx->arena, sizeof(Expr));
         if (!expr) {
-            log_msg(LOG_ERROR, "parse_or_expr: malloc() failed");
+            log_msg(LOG_ERROR, "parse_or_expr: allocation failed");
             free_expr(left);
             return NULL;
         }
@@ -1849,6 +2143,7 @@ static Table *parse_insert_table_and_columns(ParseContext *ctx, ASTNode *node,
                 ColumnValue *cv = (ColumnValue *)alist_append(column_indices);
                 if (cv) {
                     cv->value = parse_value(ctx);
+                    cv->expr = NULL;
                     cv->column_name[0] = '\0';
                 }
                 if (!consume(ctx, TOKEN_COMMA)) {
@@ -1908,20 +2203,21 @@ static bool parse_insert_value_rows(ParseContext *ctx, ASTNode *node, bool has_c
 
         ArrayList *value_row = (ArrayList *)alist_append(&node->insert.value_rows);
         if (!value_row) {
-            parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for value row",
+            parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for value row",
                             "memory", "NULL", NULL);
             return false;
         }
-        alist_init(value_row, sizeof(ColumnValue), free_column_value);
+        alist_init(value_row, sizeof(ColumnValue), NULL);
 
         int value_idx = 0;
         while (current_token->type != TOKEN_RPAREN) {
             ColumnValue *cv = (ColumnValue *)alist_append(value_row);
             if (!cv) {
-                parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for values",
+                parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for values",
                                 "memory", "NULL", NULL);
                 return false;
             }
+            cv->expr = NULL;
 
             if (has_columns && value_idx < col_count) {
                 int *col_idx = (int *)alist_get(&node->insert.columns, value_idx);
@@ -1966,10 +2262,10 @@ static bool parse_insert_value_rows(ParseContext *ctx, ASTNode *node, bool has_c
 static ASTNode *parse_insert(ParseContext *ctx) {
     log_msg(LOG_DEBUG, "parse_insert: Starting INSERT parsing");
 
-    ASTNode *node = malloc(sizeof(ASTNode));
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
     if (!node) {
-        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for INSERT node", "node",
-                        "NULL", "Try again");
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for INSERT node",
+                        "node", "NULL", "Try again");
         return NULL;
     }
 
@@ -2017,13 +2313,12 @@ static bool parse_select_columns(ParseContext *ctx, ASTNode *node) {
 
     if (match(TOKEN_OPERATOR) && strcmp(current_token->value, "*") == 0) {
         log_msg(LOG_DEBUG, "parse_select: Found * (all columns)");
-        Expr *star_expr = malloc(sizeof(Expr));
+        Expr *star_expr = arena_calloc(ctx->arena, 1, sizeof(Expr));
         if (star_expr) {
             star_expr->type = EXPR_VALUE;
             star_expr->value.type = TYPE_STRING;
             star_expr->alias[0] = '\0';
-            star_expr->value.char_val = malloc(2);
-            strcopy(star_expr->value.char_val, strlen("*") + 1, "*");
+            star_expr->value.char_val = arena_strdup(ctx->arena, "*");
         }
         if (match(TOKEN_AS)) {
             advance();
@@ -2046,7 +2341,9 @@ static bool parse_select_columns(ParseContext *ctx, ASTNode *node) {
         while (true) {
             if (match(TOKEN_IDENTIFIER) ||
                 (match(TOKEN_KEYWORD) && strcasecmp(current_token->value, "FROM") != 0) ||
-                match(TOKEN_AGGREGATE_FUNC) || match(TOKEN_SCALAR_FUNC) || match(TOKEN_LEFT)) {
+                match(TOKEN_AGGREGATE_FUNC) || match(TOKEN_SCALAR_FUNC) || match(TOKEN_LEFT) ||
+                match(TOKEN_NUMBER) || match(TOKEN_STRING) || match(TOKEN_LPAREN) ||
+                match(TOKEN_NOT) || match(TOKEN_PARAM)) {
                 Expr *expr = parse_or_expr(ctx);
                 if (!expr) {
                     log_msg(LOG_ERROR, "parse_select: Failed to parse expression");
@@ -2093,6 +2390,66 @@ static bool parse_select_columns(ParseContext *ctx, ASTNode *node) {
     return true;
 }
 
+/* Aliases are bound by peek_select_tables before the select list is parsed. */
+static void skip_table_alias(void) {
+    if (match(TOKEN_AS))
+        advance();
+    if (match(TOKEN_IDENTIFIER))
+        advance();
+}
+
+static bool sample_syntax_error(ParseContext *ctx) {
+    parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "Invalid TABLESAMPLE clause",
+                    "TABLESAMPLE (percent) with a percent from 0 to 100",
+                    current_token->type == TOKEN_EOF ? "end of input" : current_token->value,
+                    "Use: SELECT ... FROM table TABLESAMPLE SYSTEM (10 PERCENT) "
+                    "[REPEATABLE (seed)]");
+    return false;
+}
+
+/* TABLESAMPLE [SYSTEM] (percent [PERCENT]) [REPEATABLE (seed)] after the FROM table; without
+   REPEATABLE every statement draws a seed of its own. */
+static bool parse_table_sample(ParseContext *ctx, ASTNode *node) {
+    static atomic_uint statements;
+    if (!match(TOKEN_KEYWORD) || strcasecmp(current_token->value, "TABLESAMPLE") != 0)
+        return true;
+    advance();
+    if (match(TOKEN_IDENTIFIER) && strcasecmp(current_token->value, "SYSTEM") == 0)
+        advance();
+    if (!match(TOKEN_LPAREN))
+        return sample_syntax_error(ctx);
+    advance();
+    if (!match(TOKEN_NUMBER))
+        return sample_syntax_error(ctx);
+    double percent = atof(current_token->value);
+    advance();
+    if (match(TOKEN_IDENTIFIER) && strcasecmp(current_token->value, "PERCENT") == 0)
+        advance();
+    if (percent < 0 || percent > 100 || !match(TOKEN_RPAREN))
+        return sample_syntax_error(ctx);
+    advance();
+
+    node->select.sampled = true;
+    node->select.sample_percent = percent;
+    if (match(TOKEN_IDENTIFIER) && strcasecmp(current_token->value, "REPEATABLE") == 0) {
+        advance();
+        if (!match(TOKEN_LPAREN))
+            return sample_syntax_error(ctx);
+        advance();
+        if (!match(TOKEN_NUMBER))
+            return sample_syntax_error(ctx);
+        node->select.sample_seed = (uint32_t)strtoul(current_token->value, NULL, 10);
+        advance();
+        if (!match(TOKEN_RPAREN))
+            return sample_syntax_error(ctx);
+        advance();
+    } else {
+        node->select.sample_seed =
+            (uint32_t)time(NULL) * 2654435761u + atomic_fetch_add(&statements, 1);
+    }
+    return true;
+}
+
 static bool parse_select_from_table(ParseContext *ctx, ASTNode *node) {
     if (!expect(ctx, TOKEN_KEYWORD, "SELECT") || strcasecmp(current_token[-1].value, "FROM") != 0) {
         if (current_token->type == TOKEN_EOF) {
@@ -2148,27 +2505,45 @@ static bool parse_select_from_table(ParseContext *ctx, ASTNode *node) {
         return false;
     }
     node->select.table_id = table->table_id;
-    node->select.join_type = JOIN_NONE;
-    node->select.join_table_id = -1;
-    node->select.join_condition = NULL;
+    node->select.join_count = 0;
+    skip_table_alias();
+    if (!parse_table_sample(ctx, node))
+        return false;
 
     log_msg(LOG_DEBUG, "parse_select: Table name = '%s', table_id = %d", table_name,
             node->select.table_id);
     return true;
 }
 
+/* Any number of [INNER | LEFT] JOIN table [alias] ON condition clauses, up to
+   MAX_JOIN_TABLES tables in all. */
 static bool parse_select_join_clause(ParseContext *ctx, ASTNode *node) {
-    if (match(TOKEN_JOIN)) {
+    while (match(TOKEN_JOIN) || match(TOKEN_LEFT) || match(TOKEN_INNER)) {
+        JoinType join_type = JOIN_INNER;
+        if (!match(TOKEN_JOIN)) {
+            if (match(TOKEN_LEFT))
+                join_type = JOIN_LEFT;
+            advance();
+            if (!match(TOKEN_JOIN)) {
+                parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected JOIN", "JOIN keyword",
+                                current_token->type == TOKEN_EOF
+                                    ? "end of input"
+                                    : token_type_name(current_token->type),
+                                "Use: SELECT ... FROM table1 LEFT JOIN table2 ON condition");
+                return false;
+            }
+        }
         log_msg(LOG_DEBUG, "parse_select: Found JOIN keyword");
         advance();
 
-        node->select.join_type = JOIN_INNER;
-        if (match(TOKEN_LEFT)) {
-            node->select.join_type = JOIN_LEFT;
-            advance();
-        } else if (match(TOKEN_INNER)) {
-            advance();
+        if (node->select.join_count >= MAX_JOIN_TABLES - 1) {
+            parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "Too many tables in JOIN",
+                            "WHERE, ORDER BY or LIMIT", current_token->value,
+                            "A SELECT can join at most 8 tables");
+            return false;
         }
+        JoinClause *join = &node->select.joins[node->select.join_count];
+        join->type = join_type;
 
         if (!match(TOKEN_IDENTIFIER)) {
             parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected table name after JOIN",
@@ -2191,8 +2566,9 @@ static bool parse_select_join_clause(ParseContext *ctx, ASTNode *node) {
                                                      : "No tables found with that name");
             return false;
         }
-        node->select.join_table_id = join_table->table_id;
+        join->table_id = join_table->table_id;
         advance();
+        skip_table_alias();
 
         if (!match(TOKEN_KEYWORD) || strcasecmp(current_token->value, "ON") != 0) {
             parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN,
@@ -2204,16 +2580,66 @@ static bool parse_select_join_clause(ParseContext *ctx, ASTNode *node) {
         }
         advance();
 
-        node->select.join_condition = parse_or_expr(ctx);
-        if (!node->select.join_condition) {
+        join->condition = parse_or_expr(ctx);
+        if (!join->condition) {
             log_msg(LOG_ERROR, "parse_select: Failed to parse JOIN condition");
             return false;
         }
+        node->select.join_count++;
     }
 
     return true;
 }
 
+/* GROUP BY takes column names; HAVING is any condition over them and aggregates. */
+static bool parse_select_group_by(ParseContext *ctx, ASTNode *node) {
+    if (match(TOKEN_KEYWORD) && strcasecmp(current_token->value, "GROUP") == 0) {
+        advance();
+        if (current_token->type != TOKEN_BY) {
+            parse_error_set(
+                ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected 'BY' after 'GROUP'", "BY keyword",
+                current_token->type == TOKEN_EOF ? "end of input" : current_token->value,
+                "Use GROUP BY column_name[, column_name]");
+            return false;
+        }
+        advance();
+
+        do {
+            if (!match(TOKEN_IDENTIFIER)) {
+                parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN,
+                                "Expected column name in GROUP BY", "column name",
+                                current_token->type == TOKEN_EOF ? "end of input"
+                                                                 : current_token->value,
+                                "Use GROUP BY column_name[, column_name]");
+                return false;
+            }
+            Expr *group_expr = parse_primary(ctx);
+            if (!group_expr)
+                return false;
+            Expr **expr_ptr = (Expr **)alist_append(&node->select.group_by);
+            if (!expr_ptr) {
+                free_expr(group_expr);
+                return false;
+            }
+            *expr_ptr = group_expr;
+        } while (consume(ctx, TOKEN_COMMA));
+    }
+
+    if (match(TOKEN_KEYWORD) && strcasecmp(current_token->value, "HAVING") == 0) {
+        advance();
+        node->select.having = parse_or_expr(ctx);
+        if (!node->select.having) {
+            parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "Expected condition after HAVING",
+                            "condition",
+                            current_token->type == TOKEN_EOF ? "end of input"
+                                                             : current_token->value,
+                            "Use HAVING COUNT(*) > 1");
+            return false;
+        }
+    }
+    return true;
+}
+
 static bool parse_select_order_by(ParseContext *ctx, ASTNode *node) {
     node->select.order_by_count = 0;
     node->select.limit = 0;
@@ -2278,32 +2704,44 @@ static bool parse_select_limit(ParseContext *ctx, ASTNode *node) {
                             "Use LIMIT n where n is a positive integer");
             return false;
         }
-        node->select.limit = atol(current_token->value);
+        const char *digits = current_token->value;
+        bool valid = digits[0] != '\0' && strlen(digits) <= 10;
+        for (const char *c = digits; valid && *c; c++)
+            valid = isdigit((unsigned char)*c);
+        unsigned long long limit = valid ? strtoull(digits, NULL, 10) : 0;
+        if (!valid || limit > UINT32_MAX) {
+            parse_error_set(ctx, PARSE_ERROR_INVALID_NUMBER, "Invalid LIMIT", "integer",
+                            digits, "Use LIMIT n where n is an integer from 0 to 4294967295");
+            return false;
+        }
+        node->select.limit = (uint32_t)limit;
         advance();
     }
 
     return true;
 }
 
-static ASTNode *parse_select(ParseContext *ctx) {
-    ASTNode *node = malloc(sizeof(ASTNode));
-    if (!node) {
-        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for SELECT node", "node",
-                        "NULL", "Try again");
-        return NULL;
+/* Reads "[AS] alias" at token i into alias; returns the index after it. */
+static int peek_table_alias(ParseContext *ctx, int i, char *alias) {
+    alias[0] = '\0';
+    if (i < ctx->token_count && ctx->tokens[i].type == TOKEN_AS)
+        i++;
+    if (i < ctx->token_count && ctx->tokens[i].type == TOKEN_IDENTIFIER) {
+        strcopy(alias, MAX_TABLE_NAME_LEN, ctx->tokens[i].value);
+        i++;
     }
+    return i;
+}
 
-    memclear(node, sizeof(ASTNode));
-    node->type = AST_SELECT;
-    node->next = NULL;
-
-    alist_init(&node->select.expressions, sizeof(Expr *), NULL);
+/* The select list comes before FROM, so the FROM and JOIN tables and their aliases are looked
+   up ahead to resolve column IDs. */
+static void peek_select_tables(ParseContext *ctx) {
+    ctx->join_table_count = 0;
+    ctx->table_alias[0] = '\0';
 
-    // Peek ahead for FROM to resolve column IDs
-    int original_idx = ctx->current_token_index;
     int from_idx = -1;
     int depth = 0;
-    for (int i = ctx->current_token_index; i < ctx->token_count; i++) {
+    for (int i = (int)(current_token - ctx->tokens); i < ctx->token_count; i++) {
         if (ctx->tokens[i].type == TOKEN_LPAREN)
             depth++;
         if (ctx->tokens[i].type == TOKEN_RPAREN)
@@ -2315,13 +2753,75 @@ static ASTNode *parse_select(ParseContext *ctx) {
         }
     }
 
-    if (from_idx != -1) {
-        ctx->current_token_index = from_idx + 1;
-        if (match(TOKEN_IDENTIFIER)) {
-            ctx->current_table = find_table(current_token->value);
+    if (from_idx == -1 || from_idx + 1 >= ctx->token_count ||
+        ctx->tokens[from_idx + 1].type != TOKEN_IDENTIFIER)
+        return;
+    ctx->current_table = find_table(ctx->tokens[from_idx + 1].value);
+
+    /* Every JOIN of this SELECT: outside parentheses and before the clauses after them. */
+    depth = 0;
+    for (int i = peek_table_alias(ctx, from_idx + 2, ctx->table_alias); i < ctx->token_count;
+         i++) {
+        const Token *token = &ctx->tokens[i];
+        if (token->type == TOKEN_LPAREN)
+            depth++;
+        if (token->type == TOKEN_RPAREN && --depth < 0)
+            break;
+        if (depth > 0)
+            continue;
+        if (token->type == TOKEN_SEMICOLON || token->type == TOKEN_EOF ||
+            ctx->join_table_count == MAX_JOIN_TABLES - 1)
+            break;
+        if (token->type == TOKEN_KEYWORD &&
+            (strcasecmp(token->value, "WHERE") == 0 || strcasecmp(token->value, "GROUP") == 0 ||
+             strcasecmp(token->value, "ORDER") == 0 || strcasecmp(token->value, "LIMIT") == 0))
+            break;
+        if (token->type == TOKEN_JOIN && i + 1 < ctx->token_count &&
+            ctx->tokens[i + 1].type == TOKEN_IDENTIFIER) {
+            int t = ctx->join_table_count++;
+            ctx->join_tables[t] = find_table(ctx->tokens[i + 1].value);
+            peek_table_alias(ctx, i + 2, ctx->join_aliases[t]);
         }
-        ctx->current_token_index = original_idx;
     }
+}
+
+/* EXPLAIN [ANALYZE] SELECT ...: the SELECT, flagged to describe its plan instead. */
+static ASTNode *parse_explain(ParseContext *ctx) {
+    ExplainMode mode = EXPLAIN_PLAN;
+    if (match(TOKEN_KEYWORD) && strcasecmp(current_token->value, "ANALYZE") == 0) {
+        mode = EXPLAIN_ANALYZE;
+        advance();
+    }
+    if (!match_select_keyword()) {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected SELECT after EXPLAIN",
+                        "SELECT", current_token->type == TOKEN_EOF ? "end of input"
+                                                                   : current_token->value,
+                        "Did you mean: EXPLAIN [ANALYZE] SELECT ... ?");
+        return NULL;
+    }
+    advance();
+    ASTNode *node = parse_select(ctx);
+    if (node)
+        node->select.explain = (uint8_t)mode;
+    return node;
+}
+
+static ASTNode *parse_select(ParseContext *ctx) {
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
+    if (!node) {
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for SELECT node",
+                        "node", "NULL", "Try again");
+        return NULL;
+    }
+
+    memclear(node, sizeof(ASTNode));
+    node->type = AST_SELECT;
+    node->next = NULL;
+
+    alist_init(&node->select.expressions, sizeof(Expr *), NULL);
+    alist_init(&node->select.group_by, sizeof(Expr *), NULL);
+
+    peek_select_tables(ctx);
 
     if (!parse_select_columns(ctx, node))
         goto error;
@@ -2330,13 +2830,19 @@ static ASTNode *parse_select(ParseContext *ctx) {
     if (!parse_select_join_clause(ctx, node))
         goto error;
 
+    /* A WHERE that does not parse must fail the statement, not drop the filter. */
+    bool has_where = match(TOKEN_KEYWORD) && strcasecmp(current_token->value, "WHERE") == 0;
     node->select.where_clause = parse_where_clause(ctx);
+    if (has_where && !node->select.where_clause)
+        goto error;
     node->select.order_by_count = 0;
     node->select.limit = 0;
 
     alist_init(&node->select.order_by, sizeof(Expr *), NULL);
     alist_init(&node->select.order_by_desc, sizeof(bool), NULL);
 
+    if (!parse_select_group_by(ctx, node))
+        goto error;
     if (!parse_select_order_by(ctx, node))
         goto error;
     if (!parse_select_limit(ctx, node))
@@ -2347,10 +2853,12 @@ static ASTNode *parse_select(ParseContext *ctx) {
     log_msg(LOG_DEBUG, "parse_select: Successfully parsed SELECT with %d expressions",
             alist_length(&node->select.expressions));
     ctx->current_table = NULL;
+    ctx->join_table_count = 0;
     return node;
 
 error:
     ctx->current_table = NULL;
+    ctx->join_table_count = 0;
     free_ast(node);
     return NULL;
 }
@@ -2368,9 +2876,9 @@ static ASTNode *parse_drop_table(ParseContext *ctx) {
         return NULL;
     }
 
-    ASTNode *node = malloc(sizeof(ASTNode));
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
     if (!node) {
-        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for DROP TABLE node",
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for DROP TABLE node",
                         "node", "NULL", "Try again");
         return NULL;
     }
@@ -2415,8 +2923,28 @@ static Table *parse_update_table_and_set(ParseContext *ctx, ASTNode *node) {
     return table;
 }
 
+/* Whether a SET value is a lone constant or '?', stored as it is. Anything else, such as
+   "balance + ?", is an expression evaluated against each row the UPDATE changes. */
+static bool update_value_is_constant(void) {
+    const Token *token = current_token;
+    bool value = token->type == TOKEN_PARAM || token->type == TOKEN_STRING ||
+                 token->type == TOKEN_NUMBER || token->type == TOKEN_NULL ||
+                 token->type == TOKEN_DATE || token->type == TOKEN_TIME ||
+                 (token->type == TOKEN_KEYWORD &&
+                  (strcasecmp(token->value, "NULL") == 0 ||
+                   strcasecmp(token->value, "TRUE") == 0 ||
+                   strcasecmp(token->value, "FALSE") == 0 ||
+                   strncasecmp(token->value, "X'", 2) == 0));
+    if (!value)
+        return false;
+    const Token *next = token + 1;
+    return next->type == TOKEN_COMMA || next->type == TOKEN_SEMICOLON ||
+           next->type == TOKEN_EOF ||
+           (next->type == TOKEN_KEYWORD && strcasecmp(next->value, "WHERE") == 0);
+}
+
 static bool parse_update_assignments(ParseContext *ctx, ASTNode *node, Table *table) {
-    alist_init(&node->update.values, sizeof(ColumnValue), free_column_value);
+    alist_init(&node->update.values, sizeof(ColumnValue), NULL);
 
     while (true) {
         if (match(TOKEN_KEYWORD) && strcasecmp(current_token->value, "WHERE") == 0) {
@@ -2435,12 +2963,13 @@ static bool parse_update_assignments(ParseContext *ctx, ASTNode *node, Table *ta
 
         ColumnValue *cv = (ColumnValue *)alist_append(&node->update.values);
         if (!cv) {
-            parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for values", "memory",
-                            "NULL", NULL);
+            parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for values",
+                            "memory", "NULL", NULL);
             return false;
         }
 
         strcopy(cv->column_name, sizeof(cv->column_name), current_token->value);
+        cv->expr = NULL;
 
         cv->column_id = -1;
         if (table) {
@@ -2462,7 +2991,14 @@ static bool parse_update_assignments(ParseContext *ctx, ASTNode *node, Table *ta
             return false;
         }
 
-        cv->value = parse_value(ctx);
+        if (update_value_is_constant()) {
+            cv->value = parse_value(ctx);
+        } else {
+            cv->value.type = TYPE_NULL;
+            cv->expr = parse_or_expr(ctx);
+            if (!cv->expr)
+                return false;
+        }
 
         if (!consume(ctx, TOKEN_COMMA)) {
             log_msg(LOG_DEBUG, "parse_update: No more commas");
@@ -2476,10 +3012,10 @@ static bool parse_update_assignments(ParseContext *ctx, ASTNode *node, Table *ta
 static ASTNode *parse_update(ParseContext *ctx) {
     log_msg(LOG_DEBUG, "parse_update: Starting UPDATE parsing");
 
-    ASTNode *node = malloc(sizeof(ASTNode));
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
     if (!node) {
-        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for UPDATE node", "node",
-                        "NULL", "Try again");
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for UPDATE node",
+                        "node", "NULL", "Try again");
         return NULL;
     }
 
@@ -2500,11 +3036,19 @@ static ASTNode *parse_update(ParseContext *ctx) {
         node->update.where_clause = parse_or_expr(ctx);
         if (!node->update.where_clause) {
             log_msg(LOG_WARN, "parse_update: Failed to parse WHERE clause");
-            node->update.where_clause = NULL;
+            ctx->current_table = NULL;
+            free_ast(node);
+            return NULL;
         }
     } else {
         node->update.where_clause = NULL;
     }
+    if (current_token->type != TOKEN_SEMICOLON && current_token->type != TOKEN_EOF) {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Unexpected token in UPDATE",
+                        "WHERE or end of statement", current_token->value,
+                        get_context_suggestion("UPDATE", TOKEN_ERROR));
+        goto error;
+    }
 
     log_msg(LOG_DEBUG, "parse_update: Successfully parsed UPDATE with %d assignments",
             alist_length(&node->update.values));
@@ -2532,10 +3076,10 @@ static ASTNode *parse_delete(ParseContext *ctx) {
         return NULL;
     }
 
-    ASTNode *node = malloc(sizeof(ASTNode));
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
     if (!node) {
-        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for DELETE node", "node",
-                        "NULL", "Try again");
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for DELETE node",
+                        "node", "NULL", "Try again");
         return NULL;
     }
 
@@ -2557,7 +3101,9 @@ static ASTNode *parse_delete(ParseContext *ctx) {
         node->delete.where_clause = parse_or_expr(ctx);
         if (!node->delete.where_clause) {
             log_msg(LOG_WARN, "parse_delete: Failed to parse WHERE clause");
-            node->delete.where_clause = NULL;
+            ctx->current_table = NULL;
+            free_ast(node);
+            return NULL;
         }
     } else {
         node->delete.where_clause = NULL;
@@ -2576,9 +3122,9 @@ static ASTNode *parse_index_name_and_allocate(ParseContext *ctx) {
         return NULL;
     }
 
-    ASTNode *node = malloc(sizeof(ASTNode));
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
     if (!node) {
-        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for CREATE INDEX node",
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for CREATE INDEX node",
                         "memory", "NULL", "Try again or reduce query complexity");
         return NULL;
     }
@@ -2622,9 +3168,13 @@ static Table *parse_table_for_index(ParseContext *ctx, ASTNode *node) {
     return table;
 }
 
-static bool parse_column_for_index(ParseContext *ctx, ASTNode *node, Table *table) {
+/* Appends a parenthesized column list to the index's columns: its keys, or the INCLUDE
+   columns that follow them. */
+static bool parse_column_for_index(ParseContext *ctx, ASTNode *node, Table *table,
+                                   bool include) {
     if (!match(TOKEN_LPAREN)) {
-        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected '(' after table name",
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN,
+                        include ? "Expected '(' after INCLUDE" : "Expected '(' after table name",
                         "LPAREN", token_type_name(current_token->type),
                         "Syntax: CREATE INDEX index_name ON table_name (column_name, ...)");
         return false;
@@ -2662,6 +3212,19 @@ static bool parse_column_for_index(ParseContext *ctx, ASTNode *node, Table *tabl
                             column_name, "existing column", NULL);
             return false;
         }
+        ArrayList *columns = &node->create_index.column_ids;
+        for (int i = 0; i < alist_length(columns); i++) {
+            if (*(uint16_t *)alist_get(columns, i) == (uint16_t)col_idx) {
+                parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "Column appears twice in index",
+                                column_name, "distinct columns", NULL);
+                return false;
+            }
+        }
+        if (alist_length(columns) >= MAX_INDEX_COLUMNS) {
+            parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "Too many columns in index",
+                            column_name, "at most 16 columns", NULL);
+            return false;
+        }
 
         uint16_t *col_id_ptr = (uint16_t *)alist_append(&node->create_index.column_ids);
         if (col_id_ptr) {
@@ -2686,6 +3249,45 @@ static bool parse_column_for_index(ParseContext *ctx, ASTNode *node, Table *tabl
     return true;
 }
 
+/* Accepts USING BTREE / USING HASH either before or after the column list. */
+static bool parse_index_using(ParseContext *ctx, ASTNode *node) {
+    if (!match(TOKEN_KEYWORD) || strcasecmp(current_token->value, "USING") != 0)
+        return true;
+    advance();
+
+    if ((match(TOKEN_KEYWORD) || match(TOKEN_IDENTIFIER)) &&
+        strcasecmp(current_token->value, "BTREE") == 0) {
+        node->create_index.index_type = INDEX_TYPE_BTREE;
+    } else if ((match(TOKEN_KEYWORD) || match(TOKEN_IDENTIFIER)) &&
+               strcasecmp(current_token->value, "HASH") == 0) {
+        node->create_index.index_type = INDEX_TYPE_HASH;
+    } else {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Unknown index method after 'USING'",
+                        "BTREE or HASH", current_token->value,
+                        "Syntax: CREATE INDEX index_name ON table_name USING BTREE (column_name)");
+        return false;
+    }
+    advance();
+    return true;
+}
+
+/* INCLUDE (column, ...) stores more columns in a B-tree's leaves, so queries reading only
+   the index's columns need not visit the table. */
+static bool parse_index_include(ParseContext *ctx, ASTNode *node, Table *table) {
+    if (!(match(TOKEN_KEYWORD) || match(TOKEN_IDENTIFIER)) ||
+        strcasecmp(current_token->value, "INCLUDE") != 0)
+        return true;
+    if (node->create_index.index_type != INDEX_TYPE_BTREE) {
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "INCLUDE columns need a B-tree index",
+                        "USING BTREE", current_token->value,
+                        "Syntax: CREATE INDEX index_name ON table_name USING BTREE "
+                        "(column_name, ...) INCLUDE (column_name, ...)");
+        return false;
+    }
+    advance();
+    return parse_column_for_index(ctx, node, table, true);
+}
+
 static ASTNode *parse_create_index(ParseContext *ctx) {
     log_msg(LOG_DEBUG, "parse_create_index: Starting CREATE INDEX parsing");
 
@@ -2697,7 +3299,17 @@ static ASTNode *parse_create_index(ParseContext *ctx) {
     if (!table)
         goto error;
 
-    if (!parse_column_for_index(ctx, node, table))
+    if (!parse_index_using(ctx, node))
+        goto error;
+
+    if (!parse_column_for_index(ctx, node, table, false))
+        goto error;
+    node->create_index.key_count = alist_length(&node->create_index.column_ids);
+
+    if (!parse_index_using(ctx, node))
+        goto error;
+
+    if (!parse_index_include(ctx, node, table))
         goto error;
 
     log_msg(LOG_DEBUG, "parse_create_index: Successfully parsed CREATE INDEX");
@@ -2718,9 +3330,9 @@ static ASTNode *parse_drop_index(ParseContext *ctx) {
         return NULL;
     }
 
-    ASTNode *node = malloc(sizeof(ASTNode));
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
     if (!node) {
-        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "malloc() failed for DROP INDEX node",
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for DROP INDEX node",
                         "memory", "NULL", "Try again or reduce query complexity");
         return NULL;
     }
@@ -2738,7 +3350,409 @@ static ASTNode *parse_drop_index(ParseContext *ctx) {
     return node;
 }
 
-ASTNode *parse_with_context(ParseContext *ctx, Token *tokens) {
+static ASTNode *parse_analyze(ParseContext *ctx) {
+    log_msg(LOG_DEBUG, "parse_analyze: Starting ANALYZE parsing");
+
+    uint16_t table_id = 0;
+    if (match(TOKEN_IDENTIFIER)) {
+        Table *table = find_table(current_token->value);
+        if (!table) {
+            parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Unknown table in ANALYZE",
+                            "existing table name", current_token->value,
+                            "Syntax: ANALYZE [table_name]");
+            return NULL;
+        }
+        table_id = table->table_id;
+        advance();
+    }
+
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
+    if (!node) {
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for ANALYZE node",
+                        "memory", "NULL", "Try again or reduce query complexity");
+        return NULL;
+    }
+
+    memclear(node, sizeof(ASTNode));
+    node->type = AST_ANALYZE;
+    node->next = NULL;
+    node->analyze.table_id = table_id;
+
+    log_msg(LOG_DEBUG, "parse_analyze: table_id = %d", table_id);
+    return node;
+}
+
+static ASTNode *parse_set(ParseContext *ctx) {
+    if (!match(TOKEN_IDENTIFIER)) {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected a setting name after SET",
+                        "setting name",
+                        current_token->type == TOKEN_EOF ? "end of input"
+                                                         : token_type_name(current_token->type),
+                        "Syntax: SET max_parallel_workers = n");
+        return NULL;
+    }
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
+    if (!node) {
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for SET node",
+                        "memory", "NULL", "Try again or reduce query complexity");
+        return NULL;
+    }
+    memclear(node, sizeof(ASTNode));
+    node->type = AST_SET;
+    strcopy(node->set.name, sizeof(node->set.name), current_token->value);
+    advance();
+
+    if (!consume(ctx, TOKEN_EQUALS) || !match(TOKEN_NUMBER)) {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected '= number' in SET",
+                        "= number",
+                        current_token->type == TOKEN_EOF ? "end of input" : current_token->value,
+                        "Syntax: SET max_parallel_workers = n");
+        return NULL;
+    }
+    node->set.value = atoll(current_token->value);
+    advance();
+
+    log_msg(LOG_DEBUG, "parse_set: %s = %lld", node->set.name, node->set.value);
+    return node;
+}
+
+/* The parenthesized option list of COPY: FORMAT CSV | BINARY, HEADER [TRUE | FALSE] and
+   DELIMITER 'c', separated by commas. */
+static bool parse_copy_options(ParseContext *ctx, CopyNode *copy) {
+    if (!consume(ctx, TOKEN_LPAREN))
+        return true;
+    while (!match(TOKEN_RPAREN)) {
+        if (!match(TOKEN_IDENTIFIER) && !match(TOKEN_KEYWORD)) {
+            parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected a COPY option",
+                            "FORMAT, HEADER or DELIMITER",
+                            current_token->type == TOKEN_EOF ? "end of input"
+                                                             : current_token->value,
+                            "Example: COPY t FROM 'data.csv' (FORMAT CSV, HEADER)");
+            return false;
+        }
+        const char *option = current_token->value;
+        advance();
+        if (strcasecmp(option, "FORMAT") == 0) {
+            if (strcasecmp(current_token->value, "CSV") == 0) {
+                copy->format = COPY_FORMAT_CSV;
+            } else if (strcasecmp(current_token->value, "BINARY") == 0) {
+                copy->format = COPY_FORMAT_BINARY;
+            } else {
+                parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Unknown COPY format",
+                                "CSV or BINARY", current_token->value,
+                                "Example: COPY t FROM 'data.bin' (FORMAT BINARY)");
+                return false;
+            }
+            advance();
+        } else if (strcasecmp(option, "HEADER") == 0) {
+            copy->header = true;
+            if (match(TOKEN_KEYWORD) && (strcasecmp(current_token->value, "TRUE") == 0 ||
+                                         strcasecmp(current_token->value, "FALSE") == 0)) {
+                copy->header = strcasecmp(current_token->value, "TRUE") == 0;
+                advance();
+            }
+        } else if (strcasecmp(option, "DELIMITER") == 0) {
+            const char *delim = current_token->value;
+            bool tab = strcmp(delim, "\\t") == 0;
+            if (!match(TOKEN_STRING) || (strlen(delim) != 1 && !tab) || delim[0] == '"' ||
+                delim[0] == '\n' || delim[0] == '\r') {
+                parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN,
+                                "COPY DELIMITER must be a single character", "'c'",
+                                current_token->value, "Example: (DELIMITER '|')");
+                return false;
+            }
+            copy->delimiter = tab ? '\t' : delim[0];
+            advance();
+        } else {
+            parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Unknown COPY option",
+                            "FORMAT, HEADER or DELIMITER", option,
+                            "Example: COPY t FROM 'data.csv' (FORMAT CSV, HEADER)");
+            return false;
+        }
+        if (!consume(ctx, TOKEN_COMMA))
+            break;
+    }
+    return expect(ctx, TOKEN_RPAREN, "COPY options");
+}
+
+static ASTNode *parse_copy(ParseContext *ctx) {
+    if (!match(TOKEN_IDENTIFIER)) {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected a table name after COPY",
+                        "table name",
+                        current_token->type == TOKEN_EOF ? "end of input" : current_token->value,
+                        "Syntax: COPY table FROM 'file' [(FORMAT CSV | BINARY)]");
+        return NULL;
+    }
+    Table *table = find_table(current_token->value);
+    if (!table) {
+        parse_error_set(ctx, PARSE_ERROR_TABLE_NOT_FOUND, "Unknown table in COPY",
+                        "existing table name", current_token->value,
+                        "Syntax: COPY table FROM 'file' [(FORMAT CSV | BINARY)]");
+        return NULL;
+    }
+    advance();
+
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
+    if (!node) {
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for COPY node",
+                        "memory", "NULL", "Try again or reduce query complexity");
+        return NULL;
+    }
+    memclear(node, sizeof(ASTNode));
+    node->type = AST_COPY;
+    node->copy.table_id = table->table_id;
+    node->copy.format = COPY_FORMAT_CSV;
+    node->copy.delimiter = ',';
+    alist_init(&node->copy.columns, sizeof(int), NULL);
+
+    if (consume(ctx, TOKEN_LPAREN)) {
+        while (match(TOKEN_IDENTIFIER)) {
+            int col_idx = -1;
+            for (int k = 0; k < alist_length(&table->schema.columns); k++) {
+                ColumnDef *col = (ColumnDef *)alist_get(&table->schema.columns, k);
+                if (strcasecmp(col->name, current_token->value) == 0) {
+                    col_idx = k;
+                    break;
+                }
+            }
+            if (col_idx < 0) {
+                parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Unknown column in COPY",
+                                "column of the table", current_token->value,
+                                "Syntax: COPY table (col1, col2) FROM 'file'");
+                goto fail;
+            }
+            int *slot = (int *)alist_append(&node->copy.columns);
+            *slot = col_idx;
+            advance();
+            if (!consume(ctx, TOKEN_COMMA))
+                break;
+        }
+        if (!expect(ctx, TOKEN_RPAREN, "COPY column list"))
+            goto fail;
+    }
+
+    if (match(TOKEN_KEYWORD) && strcasecmp(current_token->value, "FROM") == 0) {
+        node->copy.to_file = false;
+    } else if (match(TOKEN_IDENTIFIER) && strcasecmp(current_token->value, "TO") == 0) {
+        node->copy.to_file = true;
+    } else {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected FROM or TO in COPY",
+                        "FROM or TO",
+                        current_token->type == TOKEN_EOF ? "end of input" : current_token->value,
+                        "Syntax: COPY table FROM 'file' or COPY table TO 'file'");
+        goto fail;
+    }
+    advance();
+
+    if (!match(TOKEN_STRING)) {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected a quoted file name in COPY",
+                        "'file'",
+                        current_token->type == TOKEN_EOF ? "end of input" : current_token->value,
+                        "Syntax: COPY table FROM 'file'");
+        goto fail;
+    }
+    strcopy(node->copy.path, sizeof(node->copy.path), current_token->value);
+    advance();
+
+    if (match(TOKEN_IDENTIFIER) && strcasecmp(current_token->value, "WITH") == 0)
+        advance();
+    if (!parse_copy_options(ctx, &node->copy))
+        goto fail;
+
+    log_msg(LOG_DEBUG, "parse_copy: %s '%s' %s table_id = %d", node->copy.to_file ? "TO" : "FROM",
+            node->copy.path, node->copy.format == COPY_FORMAT_BINARY ? "BINARY" : "CSV",
+            node->copy.table_id);
+    return node;
+
+fail:
+    alist_destroy(&node->copy.columns);
+    return NULL;
+}
+
+static ASTNode *new_statement_node(ParseContext *ctx, ASTType type, const char *what) {
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
+    if (!node) {
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for statement node",
+                        "memory", what, "Try again or reduce query complexity");
+        return NULL;
+    }
+    memclear(node, sizeof(ASTNode));
+    node->type = type;
+    return node;
+}
+
+static bool parse_statement_name(ParseContext *ctx, char *name, size_t size, const char *syntax) {
+    if (!match(TOKEN_IDENTIFIER)) {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected a prepared statement name",
+                        "statement name",
+                        current_token->type == TOKEN_EOF ? "end of input" : current_token->value,
+                        syntax);
+        return false;
+    }
+    strcopy(name, size, current_token->value);
+    advance();
+    return true;
+}
+
+/* Appends the text of a token so that tokenizing it again gives back the same token. */
+static void append_token_text(char *out, size_t size, const Token *token) {
+    const char *value = token->value;
+    bool quoted = token->type == TOKEN_STRING ||
+                  ((token->type == TOKEN_DATE || token->type == TOKEN_TIME) &&
+                   isdigit((unsigned char)value[0]));
+    if (quoted) {
+        const char *quote = strchr(value, '\'') ? "\"" : "'";
+        str_append(out, size, quote);
+        str_append(out, size, value);
+        str_append(out, size, quote);
+        return;
+    }
+    str_append(out, size, value);
+}
+
+/* The text of the statement that follows, up to the semicolon, rebuilt from its tokens. */
+static char *parse_statement_text(ParseContext *ctx, const char *what, const char *syntax) {
+    size_t size = 1;
+    int count = 0;
+    while (current_token[count].type != TOKEN_EOF && current_token[count].type != TOKEN_SEMICOLON)
+        size += strlen(current_token[count++].value) + 3;
+    if (count == 0) {
+        char message[64];
+        snprintf(message, sizeof(message), "%s needs a statement", what);
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_END, message, "statement", "end of input",
+                        syntax);
+        return NULL;
+    }
+    char *sql = arena_alloc(ctx->arena, size);
+    if (!sql)
+        return NULL;
+    sql[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        bool glued = i > 0 && (current_token[i].type == TOKEN_DOT ||
+                               current_token[i - 1].type == TOKEN_DOT);
+        if (i > 0 && !glued)
+            str_append(sql, size, " ");
+        append_token_text(sql, size, &current_token[i]);
+    }
+    for (int i = 0; i < count; i++)
+        advance();
+    return sql;
+}
+
+/* CREATE MATERIALIZED VIEW name AS SELECT ... The SELECT is kept as text, as PREPARE keeps
+   its statement, and checked when the view is created. */
+static ASTNode *parse_create_view(ParseContext *ctx) {
+    static const char *syntax = "Syntax: CREATE MATERIALIZED VIEW name AS SELECT ...";
+    if (!match(TOKEN_IDENTIFIER) || strcasecmp(current_token->value, "VIEW") != 0) {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected VIEW after MATERIALIZED",
+                        "VIEW", current_token->type == TOKEN_EOF ? "end of input"
+                                                                 : current_token->value,
+                        syntax);
+        return NULL;
+    }
+    advance();
+    ASTNode *node = new_statement_node(ctx, AST_CREATE_VIEW, "CREATE MATERIALIZED VIEW");
+    if (!node || !parse_statement_name(ctx, node->create_view.name,
+                                       sizeof(node->create_view.name), syntax))
+        return NULL;
+    if (!consume(ctx, TOKEN_AS)) {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected AS after the view name",
+                        "AS", current_token->type == TOKEN_EOF ? "end of input"
+                                                               : current_token->value,
+                        syntax);
+        return NULL;
+    }
+    node->create_view.sql = parse_statement_text(ctx, "CREATE MATERIALIZED VIEW", syntax);
+    if (!node->create_view.sql)
+        return NULL;
+    log_msg(LOG_DEBUG, "parse_create_view: %s AS %s", node->create_view.name,
+            node->create_view.sql);
+    return node;
+}
+
+/* PREPARE name AS statement. The statement runs to the next ';' and is kept as text
+   rebuilt from its tokens, so it can be parsed again once the tables it names change. */
+static ASTNode *parse_prepare(ParseContext *ctx) {
+    static const char *syntax = "Syntax: PREPARE name AS SELECT ... WHERE id = ?";
+    ASTNode *node = new_statement_node(ctx, AST_PREPARE, "PREPARE");
+    if (!node || !parse_statement_name(ctx, node->prepare.name, sizeof(node->prepare.name),
+                                       syntax))
+        return NULL;
+    if (!consume(ctx, TOKEN_AS)) {
+        parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN, "Expected AS after the statement name",
+                        "AS", current_token->type == TOKEN_EOF ? "end of input"
+                                                               : current_token->value,
+                        syntax);
+        return NULL;
+    }
+
+    node->prepare.sql = parse_statement_text(ctx, "PREPARE", syntax);
+    if (!node->prepare.sql)
+        return NULL;
+    log_msg(LOG_DEBUG, "parse_prepare: %s AS %s", node->prepare.name, node->prepare.sql);
+    return node;
+}
+
+/* EXECUTE name [(value, ...)] */
+static ASTNode *parse_execute(ParseContext *ctx) {
+    ASTNode *node = new_statement_node(ctx, AST_EXECUTE, "EXECUTE");
+    if (!node || !parse_statement_name(ctx, node->execute.name, sizeof(node->execute.name),
+                                       "Syntax: EXECUTE name (value, ...)"))
+        return NULL;
+    alist_init(&node->execute.values, sizeof(Value), NULL);
+    if (!consume(ctx, TOKEN_LPAREN))
+        return node;
+    while (!match(TOKEN_RPAREN)) {
+        Value val = parse_value(ctx);
+        if (val.type == TYPE_ERROR) {
+            alist_destroy(&node->execute.values);
+            return NULL;
+        }
+        *(Value *)alist_append(&node->execute.values) = val;
+        if (!consume(ctx, TOKEN_COMMA))
+            break;
+    }
+    if (!expect(ctx, TOKEN_RPAREN, "EXECUTE parameters")) {
+        alist_destroy(&node->execute.values);
+        return NULL;
+    }
+    return node;
+}
+
+/* DEALLOCATE [PREPARE] name | ALL */
+static ASTNode *parse_deallocate(ParseContext *ctx) {
+    ASTNode *node = new_statement_node(ctx, AST_DEALLOCATE, "DEALLOCATE");
+    if (!node)
+        return NULL;
+    if (match(TOKEN_KEYWORD) && strcasecmp(current_token->value, "PREPARE") == 0)
+        advance();
+    if (match(TOKEN_IDENTIFIER) && strcasecmp(current_token->value, "ALL") == 0) {
+        advance();
+        return node;
+    }
+    if (!parse_statement_name(ctx, node->prepare.name, sizeof(node->prepare.name),
+                              "Syntax: DEALLOCATE name"))
+        return NULL;
+    return node;
+}
+
+/* BEGIN, COMMIT and ROLLBACK, each optionally followed by TRANSACTION or WORK. */
+static ASTNode *parse_transaction(ParseContext *ctx, ASTType type) {
+    if (match(TOKEN_IDENTIFIER) && (strcasecmp(current_token->value, "TRANSACTION") == 0 ||
+                                    strcasecmp(current_token->value, "WORK") == 0))
+        advance();
+    ASTNode *node = arena_alloc(ctx->arena, sizeof(ASTNode));
+    if (!node) {
+        parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "allocation failed for transaction node",
+                        "memory", "NULL", "Try again or reduce query complexity");
+        return NULL;
+    }
+    memclear(node, sizeof(ASTNode));
+    node->type = type;
+    return node;
+}
+
+static ASTNode *parse_statement(ParseContext *ctx, Token *tokens) {
     if (!tokens) {
         parse_error_set(ctx, PARSE_ERROR_INVALID_SYNTAX, "Parse called with NULL tokens",
                         "valid token stream", "NULL",
@@ -2765,10 +3779,14 @@ ASTNode *parse_with_context(ParseContext *ctx, Token *tokens) {
                 advance();
                 log_msg(LOG_DEBUG, "parse: Parsing CREATE INDEX statement");
                 return parse_create_index(ctx);
+            } else if (match(TOKEN_IDENTIFIER) &&
+                       strcasecmp(current_token->value, "MATERIALIZED") == 0) {
+                advance();
+                return parse_create_view(ctx);
             } else {
                 parse_error_set(ctx, PARSE_ERROR_UNEXPECTED_TOKEN,
-                                "Expected 'TABLE' or 'INDEX' keyword after 'CREATE'",
-                                "TABLE or INDEX keyword", current_token->value,
+                                "Expected 'TABLE', 'INDEX' or 'MATERIALIZED VIEW' after 'CREATE'",
+                                "TABLE, INDEX or MATERIALIZED VIEW", current_token->value,
                                 "Did you mean: CREATE TABLE table_name (...) ?");
                 return NULL;
             }
@@ -2780,6 +3798,10 @@ ASTNode *parse_with_context(ParseContext *ctx, Token *tokens) {
             log_msg(LOG_DEBUG, "parse: Parsing SELECT statement");
             advance();
             return parse_select(ctx);
+        } else if (strcasecmp(current_token->value, "EXPLAIN") == 0) {
+            log_msg(LOG_DEBUG, "parse: Parsing EXPLAIN statement");
+            advance();
+            return parse_explain(ctx);
         } else if (strcasecmp(current_token->value, "UPDATE") == 0) {
             log_msg(LOG_DEBUG, "parse: Parsing UPDATE statement");
             advance();
@@ -2788,6 +3810,36 @@ ASTNode *parse_with_context(ParseContext *ctx, Token *tokens) {
             log_msg(LOG_DEBUG, "parse: Parsing DELETE statement");
             advance();
             return parse_delete(ctx);
+        } else if (strcasecmp(current_token->value, "ANALYZE") == 0) {
+            log_msg(LOG_DEBUG, "parse: Parsing ANALYZE statement");
+            advance();
+            return parse_analyze(ctx);
+        } else if (strcasecmp(current_token->value, "SET") == 0) {
+            log_msg(LOG_DEBUG, "parse: Parsing SET statement");
+            advance();
+            return parse_set(ctx);
+        } else if (strcasecmp(current_token->value, "PREPARE") == 0) {
+            advance();
+            return parse_prepare(ctx);
+        } else if (strcasecmp(current_token->value, "EXECUTE") == 0) {
+            advance();
+            return parse_execute(ctx);
+        } else if (strcasecmp(current_token->value, "DEALLOCATE") == 0) {
+            advance();
+            return parse_deallocate(ctx);
+        } else if (strcasecmp(current_token->value, "COPY") == 0) {
+            log_msg(LOG_DEBUG, "parse: Parsing COPY statement");
+            advance();
+            return parse_copy(ctx);
+        } else if (strcasecmp(current_token->value, "BEGIN") == 0) {
+            advance();
+            return parse_transaction(ctx, AST_BEGIN);
+        } else if (strcasecmp(current_token->value, "COMMIT") == 0) {
+            advance();
+            return parse_transaction(ctx, AST_COMMIT);
+        } else if (strcasecmp(current_token->value, "ROLLBACK") == 0) {
+            advance();
+            return parse_transaction(ctx, AST_ROLLBACK);
         } else if (strcasecmp(current_token->value, "DROP") == 0) {
             log_msg(LOG_DEBUG, "parse: Detected DROP statement");
             advance();
@@ -2799,6 +3851,16 @@ ASTNode *parse_with_context(ParseContext *ctx, Token *tokens) {
                 advance();
                 log_msg(LOG_DEBUG, "parse: Parsing DROP INDEX statement");
                 return parse_drop_index(ctx);
+            } else if (match(TOKEN_IDENTIFIER) &&
+                       strcasecmp(current_token->value, "MATERIALIZED") == 0 &&
+                       current_token[1].type == TOKEN_IDENTIFIER &&
+                       strcasecmp(current_token[1].value, "VIEW") == 0) {
+                advance();
+                advance();
+                ASTNode *node = parse_drop_table(ctx);
+                if (node)
+                    node->drop_table.view = true;
+                return node;
             } else {
                 parse_error_set(
                     ctx, PARSE_ERROR_UNEXPECTED_TOKEN,
@@ -2835,13 +3897,33 @@ ASTNode *parse_with_context(ParseContext *ctx, Token *tokens) {
     return NULL;
 }
 
+/* Every node, expression and literal of a statement is carved from one arena owned by the
+   root node, so free_ast releases the whole tree at once. */
+ASTNode *parse_with_context(ParseContext *ctx, Token *tokens) {
+    ctx->arena = arena_create(4096);
+    if (!ctx->arena) {
+        log_msg(LOG_ERROR, "parse: Failed to create the statement arena");
+        return NULL;
+    }
+    ctx->param_count = 0;
+    ctx->outer = NULL;
+    ASTNode *result = parse_statement(ctx, tokens);
+    if (result) {
+        result->arena = ctx->arena;
+        result->param_count = ctx->param_count;
+    } else
+        arena_destroy(ctx->arena);
+    ctx->arena = NULL;
+    return result;
+}
+
 ASTNode *parse_ex(const char *input, Token *tokens) {
     parse_error_init(&g_parse_context, input, tokens, 0);
 
     Token *count_tokens = tokens;
     int count = 0;
     if (tokens) {
-        while (count < 10000 && count_tokens[count].type != TOKEN_EOF) {
+        while (count_tokens[count].type != TOKEN_EOF) {
             count++;
         }
         count++;
@@ -2861,6 +3943,97 @@ ASTNode *parse(Token *tokens) {
     return parse_ex(NULL, tokens);
 }
 
+static void collect_expr_params(Expr *expr, Value **slots, int count);
+
+static void collect_list_params(ArrayList *exprs, Value **slots, int count) {
+    for (int i = 0; i < alist_length(exprs); i++)
+        collect_expr_params(*(Expr **)alist_get(exprs, i), slots, count);
+}
+
+static void collect_value_param(Value *val, Value **slots, int count) {
+    if (val->type == TYPE_NULL && val->int_val > 0 && val->int_val <= count)
+        slots[val->int_val - 1] = val;
+}
+
+static void collect_expr_params(Expr *expr, Value **slots, int count) {
+    if (!expr)
+        return;
+    switch (expr->type) {
+    case EXPR_VALUE:
+        collect_value_param(&expr->value, slots, count);
+        break;
+    case EXPR_LIST:
+        for (int i = 0; i < expr->list.count; i++)
+            collect_value_param(&expr->list.values[i], slots, count);
+        break;
+    case EXPR_BINARY_OP:
+        collect_expr_params(expr->binary.left, slots, count);
+        collect_expr_params(expr->binary.right, slots, count);
+        break;
+    case EXPR_UNARY_OP:
+        collect_expr_params(expr->unary.operand, slots, count);
+        break;
+    case EXPR_AGGREGATE_FUNC:
+        collect_expr_params(expr->aggregate.operand, slots, count);
+        break;
+    case EXPR_SCALAR_FUNC:
+        for (int i = 0; i < expr->scalar.arg_count; i++)
+            collect_expr_params(expr->scalar.args[i], slots, count);
+        break;
+    case EXPR_SUBQUERY:
+        collect_expr_params(expr->subquery.operand, slots, count);
+        for (ASTNode *sub = expr->subquery.subquery; sub; sub = sub->next) {
+            collect_list_params(&sub->select.expressions, slots, count);
+            collect_expr_params(sub->select.where_clause, slots, count);
+            collect_expr_params(sub->select.having, slots, count);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void collect_column_values(ArrayList *values, Value **slots, int count) {
+    for (int i = 0; i < alist_length(values); i++) {
+        ColumnValue *cv = (ColumnValue *)alist_get(values, i);
+        collect_value_param(&cv->value, slots, count);
+        collect_expr_params(cv->expr, slots, count);
+    }
+}
+
+/* Points slots[n - 1] at the value of the n-th '?' of the statement, for n up to
+   ast->param_count, so a prepared statement can bind new values in place. */
+void ast_collect_params(ASTNode *ast, Value **slots) {
+    int count = ast->param_count;
+    for (ASTNode *node = ast; node; node = node->next) {
+        switch (node->type) {
+        case AST_SELECT:
+            collect_list_params(&node->select.expressions, slots, count);
+            collect_expr_params(node->select.where_clause, slots, count);
+            collect_list_params(&node->select.group_by, slots, count);
+            collect_expr_params(node->select.having, slots, count);
+            collect_list_params(&node->select.order_by, slots, count);
+            for (int j = 0; j < node->select.join_count; j++)
+                collect_expr_params(node->select.joins[j].condition, slots, count);
+            break;
+        case AST_INSERT_ROW:
+            for (int r = 0; r < alist_length(&node->insert.value_rows); r++)
+                collect_column_values((ArrayList *)alist_get(&node->insert.value_rows, r), slots,
+                                      count);
+            break;
+        case AST_UPDATE_ROW:
+            collect_column_values(&node->update.values, slots, count);
+            collect_expr_params(node->update.where_clause, slots, count);
+            break;
+        case AST_DELETE_ROW:
+            collect_expr_params(node->delete.where_clause, slots, count);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
 void free_ast(ASTNode *ast) {
     if (!ast)
         return;
@@ -2882,6 +4055,8 @@ void free_ast(ASTNode *ast) {
         alist_destroy(&ast->create_table.columns);
         break;
     case AST_UPDATE_ROW:
+        for (int i = 0; i < alist_length(&ast->update.values); i++)
+            free_expr(((ColumnValue *)alist_get(&ast->update.values, i))->expr);
         alist_destroy(&ast->update.values);
         if (ast->update.where_clause) {
             free_expr(ast->update.where_clause);
@@ -2895,6 +4070,12 @@ void free_ast(ASTNode *ast) {
     case AST_CREATE_INDEX:
         alist_destroy(&ast->create_index.column_ids);
         break;
+    case AST_COPY:
+        alist_destroy(&ast->copy.columns);
+        break;
+    case AST_EXECUTE:
+        alist_destroy(&ast->execute.values);
+        break;
     case AST_SELECT: {
         int expr_count = alist_length(&ast->select.expressions);
         for (int i = 0; i < expr_count; i++) {
@@ -2913,19 +4094,30 @@ void free_ast(ASTNode *ast) {
         }
         alist_destroy(&ast->select.order_by);
         alist_destroy(&ast->select.order_by_desc);
+        int group_by_count = alist_length(&ast->select.group_by);
+        for (int i = 0; i < group_by_count; i++) {
+            Expr **expr_ptr = (Expr **)alist_get(&ast->select.group_by, i);
+            if (expr_ptr && *expr_ptr) {
+                free_expr(*expr_ptr);
+            }
+        }
+        alist_destroy(&ast->select.group_by);
+        if (ast->select.having) {
+            free_expr(ast->select.having);
+        }
         if (ast->select.where_clause) {
             free_expr(ast->select.where_clause);
         }
-        if (ast->select.join_condition) {
-            free_expr(ast->select.join_condition);
-        }
+        for (int j = 0; j < ast->select.join_count; j++)
+            free_expr(ast->select.joins[j].condition);
         break;
     }
     default:
         break;
     }
 
-    free(ast);
+    if (ast->arena)
+        arena_destroy(ast->arena);
 }
 
 static void print_error_line(FILE *stream, const char *fmt, ...) {
@@ -2937,53 +4129,6 @@ static void print_error_line(FILE *stream, const char *fmt, ...) {
     fputs(buffer, stream);
 }
 
-static bool parse_date_literal(const char *value, int *year, int *month, int *day) {
-    if (!value || !year || !month || !day) {
-        return false;
-    }
-    if (strlen(value) != 10 || value[4] != '-' || value[7] != '-') {
-        return false;
-    }
-    for (int i = 0; i < 10; i++) {
-        if (i == 4 || i == 7)
-            continue;
-        if (!isdigit((unsigned char)value[i])) {
-            return false;
-        }
-    }
-    *year =
-        (value[0] - '0') * 1000 + (value[1] - '0') * 100 + (value[2] - '0') * 10 + (value[3] - '0');
-    *month = (value[5] - '0') * 10 + (value[6] - '0');
-    *day = (value[8] - '0') * 10 + (value[9] - '0');
-    if (*month < 1 || *month > 12 || *day < 1 || *day > 31) {
-        return false;
-    }
-    return true;
-}
-
-static bool parse_time_literal(const char *value, int *hour, int *minute, int *second) {
-    if (!value || !hour || !minute || !second) {
-        return false;
-    }
-    if (strlen(value) != 8 || value[2] != ':' || value[5] != ':') {
-        return false;
-    }
-    for (int i = 0; i < 8; i++) {
-        if (i == 2 || i == 5)
-            continue;
-        if (!isdigit((unsigned char)value[i])) {
-            return false;
-        }
-    }
-    *hour = (value[0] - '0') * 10 + (value[1] - '0');
-    *minute = (value[3] - '0') * 10 + (value[4] - '0');
-    *second = (value[6] - '0') * 10 + (value[7] - '0');
-    if (*hour < 0 || *hour > 23 || *minute < 0 || *minute > 59 || *second < 0 || *second > 59) {
-        return false;
-    }
-    return true;
-}
-
 static bool parse_hex_byte(const char *value, unsigned char *out) {
     if (!value || !out) {
         return false;
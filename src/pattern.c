@@ -0,0 +1,352 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "db.h"
+#include "logger.h"
+#include "utils.h"
+#include "values.h"
+
+/* LIKE matching and IN-list sets. Both are built once per statement, in its arena, from the
+   literal pattern or list, and are read-only afterwards so parallel scans can share them. */
+
+#define LIKE_STACK_CODES 256
+
+/* Decodes pattern into one code per position (see LIKE_ANY_CHAR / LIKE_ANY_RUN), collapsing
+   runs of %. codes must hold strlen(pattern) entries. */
+static int like_decode(const char *pattern, uint16_t *codes) {
+    int n = 0;
+    for (const unsigned char *p = (const unsigned char *)pattern; *p; p++) {
+        uint16_t code;
+        if (*p == '%' || *p == '*')
+            code = LIKE_ANY_RUN;
+        else if (*p == '_' || *p == '?')
+            code = LIKE_ANY_CHAR;
+        else if (*p == '\\' && p[1])
+            code = *++p;
+        else
+            code = *p;
+        if (code == LIKE_ANY_RUN && n > 0 && codes[n - 1] == LIKE_ANY_RUN)
+            continue;
+        codes[n++] = code;
+    }
+    return n;
+}
+
+/* Wildcard matching with one restart point: on a mismatch the last % absorbs one more
+   character and matching resumes after it. Earlier %s never need to be revisited. */
+static bool match_codes(const uint16_t *codes, int n, const char *text, size_t len) {
+    const unsigned char *t = (const unsigned char *)text;
+    size_t ti = 0;
+    int pi = 0;
+    int star = -1;
+    size_t star_ti = 0;
+    while (ti < len) {
+        if (pi < n && (codes[pi] == LIKE_ANY_CHAR || codes[pi] == t[ti])) {
+            pi++;
+            ti++;
+        } else if (pi < n && codes[pi] == LIKE_ANY_RUN) {
+            star = pi++;
+            star_ti = ti;
+        } else if (star >= 0) {
+            pi = star + 1;
+            ti = ++star_ti;
+        } else {
+            return false;
+        }
+    }
+    while (pi < n && codes[pi] == LIKE_ANY_RUN)
+        pi++;
+    return pi == n;
+}
+
+/* memchr for the first byte then memcmp; libc vectorizes the memchr. */
+static const char *find_run(const char *text, size_t len, const char *run, size_t run_len) {
+    if (run_len == 0)
+        return text;
+    const char *end = text + len;
+    while ((size_t)(end - text) >= run_len) {
+        const char *hit = memchr(text, run[0], (size_t)(end - text) - run_len + 1);
+        if (!hit)
+            return NULL;
+        if (memcmp(hit + 1, run + 1, run_len - 1) == 0)
+            return hit;
+        text = hit + 1;
+    }
+    return NULL;
+}
+
+static bool match_runs(const LikeMatcher *m, const char *text, size_t len) {
+    size_t pos = 0;
+    size_t end = len;
+    int first = 0;
+    int last = m->run_count;
+    if (m->anchored_start && first < last) {
+        if (len < m->run_lens[0] || memcmp(text, m->runs[0], m->run_lens[0]) != 0)
+            return false;
+        pos = m->run_lens[0];
+        first++;
+    }
+    if (m->anchored_end && first < last) {
+        uint32_t tail = m->run_lens[last - 1];
+        if (len - pos < tail || memcmp(text + len - tail, m->runs[last - 1], tail) != 0)
+            return false;
+        end = len - tail;
+        last--;
+    }
+    for (int i = first; i < last; i++) {
+        const char *hit = find_run(text + pos, end - pos, m->runs[i], m->run_lens[i]);
+        if (!hit)
+            return false;
+        pos = (size_t)(hit - text) + m->run_lens[i];
+    }
+    return true;
+}
+
+static bool set_prefix_bounds(Arena *arena, LikeMatcher *m) {
+    const char *prefix = m->runs[0];
+    uint32_t len = m->run_lens[0];
+    m->prefix.type = TYPE_STRING;
+    m->prefix.str_format = VALUE_STR_PTR;
+    m->prefix.char_val = (char *)prefix;
+
+    char *end = arena_memdup(arena, prefix, len + 1);
+    if (!end)
+        return false;
+    while (len > 0 && (unsigned char)end[len - 1] == 0xFF)
+        end[--len] = '\0';
+    if (len == 0)
+        return true;
+    end[len - 1] = (char)((unsigned char)end[len - 1] + 1);
+    m->prefix_end = arena_calloc(arena, 1, sizeof(Value));
+    if (!m->prefix_end)
+        return false;
+    m->prefix_end->type = TYPE_STRING;
+    m->prefix_end->str_format = VALUE_STR_PTR;
+    m->prefix_end->char_val = end;
+    return true;
+}
+
+LikeMatcher *like_compile(Arena *arena, const char *pattern) {
+    size_t len = strlen(pattern);
+    LikeMatcher *m = arena_calloc(arena, 1, sizeof(LikeMatcher));
+    uint16_t *codes = arena_alloc(arena, sizeof(uint16_t) * (len + 1));
+    if (!m || !codes) {
+        log_msg(LOG_ERROR, "like_compile: allocation failed for '%s'", pattern);
+        return NULL;
+    }
+    int n = like_decode(pattern, codes);
+    m->program = codes;
+    m->program_len = n;
+
+    int wildcards = 0;
+    int any_runs = 0;
+    for (int i = 0; i < n; i++) {
+        wildcards += codes[i] == LIKE_ANY_CHAR;
+        any_runs += codes[i] == LIKE_ANY_RUN;
+    }
+    if (wildcards > 0) {
+        m->kind = LIKE_WILDCARD;
+        return m;
+    }
+
+    /* Literal runs: at most one more than the %s. */
+    m->runs = arena_alloc(arena, sizeof(char *) * (size_t)(any_runs + 1));
+    m->run_lens = arena_alloc(arena, sizeof(uint32_t) * (size_t)(any_runs + 1));
+    char *chars = arena_alloc(arena, len + (size_t)any_runs + 2);
+    if (!m->runs || !m->run_lens || !chars)
+        return NULL;
+    m->anchored_start = n == 0 || codes[0] != LIKE_ANY_RUN;
+    m->anchored_end = n == 0 || codes[n - 1] != LIKE_ANY_RUN;
+    int i = 0;
+    while (i < n) {
+        if (codes[i] == LIKE_ANY_RUN) {
+            i++;
+            continue;
+        }
+        m->runs[m->run_count] = chars;
+        uint32_t run_len = 0;
+        while (i < n && codes[i] != LIKE_ANY_RUN)
+            chars[run_len++] = (char)codes[i++];
+        chars[run_len] = '\0';
+        m->run_lens[m->run_count++] = run_len;
+        chars += run_len + 1;
+    }
+    if (any_runs == 0) {
+        m->kind = LIKE_EXACT;
+        if (m->run_count == 0) {
+            m->runs[0] = "";
+            m->run_lens[0] = 0;
+            m->run_count = 1;
+        }
+    } else if (m->run_count == 1 && m->anchored_start) {
+        m->kind = LIKE_PREFIX;
+        if (!set_prefix_bounds(arena, m))
+            return NULL;
+    } else if (m->run_count == 1 && m->anchored_end) {
+        m->kind = LIKE_SUFFIX;
+    } else if (m->run_count == 1) {
+        m->kind = LIKE_CONTAINS;
+    } else {
+        m->kind = LIKE_RUNS;
+    }
+    return m;
+}
+
+bool like_match(const LikeMatcher *m, const char *text, size_t len) {
+    switch (m->kind) {
+    case LIKE_EXACT:
+        return len == m->run_lens[0] && memcmp(text, m->runs[0], len) == 0;
+    case LIKE_PREFIX:
+        return len >= m->run_lens[0] && memcmp(text, m->runs[0], m->run_lens[0]) == 0;
+    case LIKE_SUFFIX:
+        return len >= m->run_lens[0] &&
+               memcmp(text + len - m->run_lens[0], m->runs[0], m->run_lens[0]) == 0;
+    case LIKE_CONTAINS:
+        return find_run(text, len, m->runs[0], m->run_lens[0]) != NULL;
+    case LIKE_RUNS:
+        return match_runs(m, text, len);
+    case LIKE_WILDCARD:
+        return match_codes(m->program, m->program_len, text, len);
+    }
+    return false;
+}
+
+/* Non-string operands are matched against their printed form, as repr shows them. */
+bool like_match_value(const LikeMatcher *m, const Value *val) {
+    if (is_null(val))
+        return false;
+    if (val->type == TYPE_STRING) {
+        const char *text = value_str(val);
+        return like_match(m, text, strlen(text));
+    }
+    char buffer[MAX_STRING_LEN];
+    const char *text = repr_into(val, buffer, sizeof(buffer));
+    return like_match(m, text, strlen(text));
+}
+
+/* LIKE with a pattern only known at run time, such as a bound parameter. */
+bool like_match_pattern(const Value *val, const char *pattern) {
+    if (is_null(val))
+        return false;
+    char buffer[MAX_STRING_LEN];
+    const char *text = val->type == TYPE_STRING ? value_str(val)
+                                                : repr_into(val, buffer, sizeof(buffer));
+    size_t len = strlen(pattern);
+    uint16_t stack_codes[LIKE_STACK_CODES];
+    uint16_t *codes = len <= LIKE_STACK_CODES ? stack_codes : malloc(sizeof(uint16_t) * len);
+    if (!codes)
+        return false;
+    int n = like_decode(pattern, codes);
+    bool match = match_codes(codes, n, text, strlen(text));
+    if (codes != stack_codes)
+        free(codes);
+    return match;
+}
+
+const ValueSet *value_set_build(Arena *arena, const Value *values, int count) {
+    if (count < IN_LIST_HASH_MIN)
+        return NULL;
+    DataType type = TYPE_NULL;
+    bool has_null = false;
+    for (int i = 0; i < count; i++) {
+        if (values[i].type == TYPE_NULL) {
+            has_null = true;
+            continue;
+        }
+        if (type != TYPE_NULL && values[i].type != type)
+            return NULL; /* mixed types compare with coercion: keep the linear scan */
+        type = values[i].type;
+    }
+    if (type == TYPE_NULL || type == TYPE_ERROR)
+        return NULL;
+
+    uint32_t capacity = 16;
+    while (capacity < (uint32_t)count * 2)
+        capacity *= 2;
+    ValueSet *set = arena_alloc(arena, sizeof(ValueSet));
+    uint32_t *slots = arena_calloc(arena, capacity, sizeof(uint32_t));
+    if (!set || !slots)
+        return NULL;
+    set->type = type;
+    set->has_null = has_null;
+    set->mask = capacity - 1;
+    set->slots = slots;
+    for (int i = 0; i < count; i++) {
+        if (values[i].type == TYPE_NULL)
+            continue;
+        uint32_t slot = (uint32_t)value_hash(&values[i]) & set->mask;
+        while (slots[slot] && !value_equals(&values[slots[slot] - 1], &values[i]))
+            slot = (slot + 1) & set->mask;
+        slots[slot] = (uint32_t)i + 1;
+    }
+    return set;
+}
+
+/* Brings a probe to the set's type the way compare_values would compare them; false when
+   no value of that type can be equal to it. */
+static bool coerce_probe(const ValueSet *set, const Value *val, Value *out) {
+    *out = *val;
+    if (val->type == set->type)
+        return true;
+    if (set->type == TYPE_INT && val->type == TYPE_FLOAT) {
+        double d = val->float_val;
+        if (d != d || d < -9.2e18 || d > 9.2e18 || (double)(long long)d != d)
+            return false;
+        out->type = TYPE_INT;
+        out->int_val = (long long)d;
+        return true;
+    }
+    if (set->type == TYPE_FLOAT && val->type == TYPE_INT) {
+        out->type = TYPE_FLOAT;
+        out->float_val = (double)val->int_val;
+        return true;
+    }
+    return false;
+}
+
+/* IN over the list's values: a hash probe when the list has a set (an operand that cannot be
+   coerced to the set's type matches nothing), otherwise a comparison with each value. NULL
+   operands and NULL values never match. */
+bool in_list_contains(const Expr *list, const Value *val) {
+    if (is_null(val))
+        return false;
+    const ValueSet *set = list->list.set;
+    Value probe;
+    if (set) {
+        if (!coerce_probe(set, val, &probe))
+            return false;
+        uint32_t slot = (uint32_t)value_hash(&probe) & set->mask;
+        while (set->slots[slot]) {
+            if (value_equals(&list->list.values[set->slots[slot] - 1], &probe))
+                return true;
+            slot = (slot + 1) & set->mask;
+        }
+        return false;
+    }
+    for (int i = 0; i < list->list.count; i++)
+        if (eval_comparison(*val, list->list.values[i], OP_EQUALS))
+            return true;
+    return false;
+}
+
+/* x NOT IN (...) is false when x is NULL or the list holds a NULL, as SQL's unknown; only
+   an empty list, which a subquery can return, makes it true for every x. */
+bool eval_in_list(const Expr *list, const Value *val, bool negated) {
+    if (list->list.count == 0)
+        return negated;
+    if (is_null(val))
+        return false;
+    bool found = in_list_contains(list, val);
+    if (!negated)
+        return found;
+    if (found)
+        return false;
+    if (list->list.set)
+        return !list->list.set->has_null;
+    for (int i = 0; i < list->list.count; i++)
+        if (is_null(&list->list.values[i]))
+            return false;
+    return true;
+}
@@ -0,0 +1,727 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "dbapi.h"
+#include "executor.h"
+#include "logger.h"
+#include "txn.h"
+#include "utils.h"
+
+#define SERVER_READ_CHUNK 65536
+#define SERVER_EVENTS 64
+/* Reading stops while this much input waits, which always holds a whole frame, and resumes
+   once a worker has taken it. */
+#define SERVER_MAX_BUFFERED (SERVER_MAX_FRAME + 4)
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    bool failed; /* an allocation failed and the contents are incomplete */
+} ByteBuf;
+
+/* A client session. The loop thread reads into in and owns the socket's registration; a
+   worker holds the connection while queued, taking whole frames from in and appending their
+   responses to out. Either side writes out, and only the loop thread frees a connection,
+   once it is retired: closing, not queued and with nothing left to write. */
+typedef struct Connection {
+    int fd;
+    pthread_mutex_t lock;
+    ByteBuf in;
+    ByteBuf out;
+    uint32_t events; /* registered with epoll, 0 when not registered */
+    bool queued;
+    bool closing; /* no more requests are read: the peer is gone or broke the protocol */
+    bool retired;
+    Transaction *txn; /* the session's open transaction between statements */
+    struct Connection *next_ready;  /* run queue or closed list */
+    struct Connection *prev, *next; /* every open connection */
+} Connection;
+
+struct Server {
+    int listen_fd;
+    int epoll_fd;
+    int wake[2]; /* server_stop and workers retiring a connection wake the loop */
+    int port;
+    _Atomic int stop_requested; /* lock-free, so server_stop may set it from a signal handler */
+    int worker_count;
+    pthread_t *workers;
+    pthread_mutex_t queue_lock; /* guards the run queue, the closed list and stopping */
+    pthread_cond_t queue_ready;
+    Connection *ready_head;
+    Connection *ready_tail;
+    Connection *closed;
+    bool stopping;
+    Connection *connections;
+    _Atomic uint64_t stats[5]; /* the ServerStats counters, in order */
+    _Atomic int open;
+};
+
+enum { STAT_CONNECTIONS, STAT_REQUESTS, STAT_BATCHES, STAT_BYTES_IN, STAT_BYTES_OUT };
+
+/* The engine runs one statement at a time; workers take turns holding it. */
+static pthread_mutex_t g_engine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void count(Server *server, int stat, uint64_t n) {
+    atomic_fetch_add_explicit(&server->stats[stat], n, memory_order_relaxed);
+}
+
+static uint8_t *buf_extend(ByteBuf *buf, size_t n) {
+    if (buf->failed)
+        return NULL;
+    if (buf->len + n > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 256;
+        while (cap < buf->len + n)
+            cap *= 2;
+        uint8_t *data = realloc(buf->data, cap);
+        if (!data) {
+            log_msg(LOG_ERROR, "server: Failed to grow a %zu byte buffer", cap);
+            buf->failed = true;
+            return NULL;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+    uint8_t *p = buf->data + buf->len;
+    buf->len += n;
+    return p;
+}
+
+static void put_bytes(ByteBuf *buf, const void *src, size_t n) {
+    uint8_t *p = buf_extend(buf, n);
+    if (p && n > 0)
+        memcpy(p, src, n);
+}
+
+static void store_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t load_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u16(ByteBuf *buf, uint16_t v) {
+    uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    put_bytes(buf, b, 2);
+}
+
+static void put_u32(ByteBuf *buf, uint32_t v) {
+    uint8_t *p = buf_extend(buf, 4);
+    if (p)
+        store_u32(p, v);
+}
+
+static size_t begin_frame(ByteBuf *buf, uint8_t type) {
+    size_t start = buf->len;
+    put_u32(buf, 0);
+    put_bytes(buf, &type, 1);
+    return start;
+}
+
+static void end_frame(ByteBuf *buf, size_t start) {
+    if (!buf->failed)
+        store_u32(buf->data + start, (uint32_t)(buf->len - start - 4));
+}
+
+static void put_error(ByteBuf *buf, const char *message) {
+    size_t start = begin_frame(buf, SERVER_MSG_ERROR);
+    put_bytes(buf, message, strlen(message));
+    end_frame(buf, start);
+}
+
+static void buf_free(ByteBuf *buf) {
+    free(buf->data);
+    memclear(buf, sizeof(ByteBuf));
+}
+
+/* Bytes at the front of buf that make whole frames. *bad is set when the next frame is
+   empty or larger than SERVER_MAX_FRAME. */
+static size_t whole_frames(const ByteBuf *buf, bool *bad) {
+    size_t pos = 0;
+    *bad = false;
+    while (buf->len - pos >= 4) {
+        uint32_t len = load_u32(buf->data + pos);
+        if (len == 0 || len > SERVER_MAX_FRAME) {
+            *bad = true;
+            break;
+        }
+        if (buf->len - pos - 4 < len)
+            break;
+        pos += 4 + (size_t)len;
+    }
+    return pos;
+}
+
+/* Appends a statement's result set as it goes in a RESULT frame. False when the statement
+   fails, with out unchanged. */
+static bool put_result_set(ByteBuf *out, DbStatement *stmt) {
+    char *values = NULL;
+    size_t values_len = 0;
+    FILE *file = open_memstream(&values, &values_len);
+    if (!file) {
+        out->failed = true;
+        return false;
+    }
+    uint32_t rows = 0;
+    const ResultBatch *batch = db_step_batch(stmt);
+    int cols = db_column_count(stmt);
+    for (; batch; batch = db_step_batch(stmt)) {
+        for (int i = 0; i < batch->row_count; i++)
+            for (int j = 0; j < cols; j++)
+                copy_write_binary_value(file, &db_batch_column(batch, j)[i]);
+        rows += (uint32_t)batch->row_count;
+    }
+    DbStep step;
+    while ((step = db_step(stmt)) == DB_ROW) {
+        for (int j = 0; j < cols; j++)
+            copy_write_binary_value(file, db_column_value(stmt, j));
+        rows++;
+    }
+    fclose(file);
+    if (step == DB_ERROR) {
+        free(values);
+        return false;
+    }
+
+    put_u16(out, (uint16_t)cols);
+    for (int j = 0; j < cols; j++) {
+        const char *name = db_column_name(stmt, j);
+        size_t name_len = name ? strlen(name) : 0;
+        put_u16(out, (uint16_t)name_len);
+        put_bytes(out, name, name_len);
+    }
+    put_u32(out, rows);
+    put_bytes(out, values, values_len);
+    free(values);
+    return true;
+}
+
+/* Runs the statements of the SQL one at a time, cut at the tokenizer's semicolons, and
+   appends a RESULT frame with their result sets in order; the first statement that does not
+   parse or fails gets an ERROR frame instead, and the ones after it do not run. */
+static void run_query(ByteBuf *out, const uint8_t *text, size_t len) {
+    char *sql = malloc(len + 1);
+    if (!sql) {
+        put_error(out, "Out of memory");
+        return;
+    }
+    memcpy(sql, text, len);
+    sql[len] = '\0';
+    Token *tokens = tokenize(sql);
+    if (!tokens) {
+        free(sql);
+        put_error(out, "Statement does not parse");
+        return;
+    }
+
+    ByteBuf sets = {0};
+    char error[320] = "";
+    int statements = 0;
+    int from = 0;
+    bool pending = false; /* tokens since the last cut */
+    for (const Token *token = tokens; !error[0]; token++) {
+        if (token->type != TOKEN_SEMICOLON && token->type != TOKEN_EOF) {
+            pending = true;
+            continue;
+        }
+        int to = token->type == TOKEN_EOF ? (int)len : token->offset + 1;
+        if (pending) {
+            char saved = sql[to];
+            sql[to] = '\0';
+            DbStatement *stmt = db_prepare(sql + from);
+            sql[to] = saved;
+            statements++;
+            if (!stmt)
+                string_format(error, sizeof(error), "Statement %d does not parse", statements);
+            else if (!put_result_set(&sets, stmt))
+                string_format(error, sizeof(error), "Statement %d failed: %s", statements,
+                              db_error_message(stmt) ? db_error_message(stmt) : "out of memory");
+            db_finalize(stmt);
+        }
+        from = to;
+        pending = false;
+        if (token->type == TOKEN_EOF)
+            break;
+    }
+    free_tokens(tokens);
+    free(sql);
+
+    if (statements == 0 && !error[0])
+        string_format(error, sizeof(error), "Statement does not parse");
+    if (error[0]) {
+        put_error(out, error);
+    } else {
+        size_t start = begin_frame(out, SERVER_MSG_RESULT);
+        put_bytes(out, sets.data, sets.len);
+        out->failed = out->failed || sets.failed;
+        end_frame(out, start);
+    }
+    buf_free(&sets);
+}
+
+/* Answers every frame in requests inside the session's transaction. */
+static int run_requests(Connection *conn, const uint8_t *requests, size_t len, ByteBuf *out) {
+    int answered = 0;
+    pthread_mutex_lock(&g_engine_lock);
+    txn_attach(conn->txn);
+    for (size_t pos = 0; pos < len; answered++) {
+        uint32_t frame = load_u32(requests + pos);
+        const uint8_t *payload = requests + pos + SERVER_FRAME_HEADER;
+        if (requests[pos + 4] == SERVER_MSG_QUERY)
+            run_query(out, payload, frame - 1);
+        else
+            put_error(out, "Unknown request type");
+        pos += 4 + (size_t)frame;
+    }
+    conn->txn = txn_detach();
+    pthread_mutex_unlock(&g_engine_lock);
+    return answered;
+}
+
+/* Writes as much of out as the socket takes now. */
+static void flush_output(Server *server, Connection *conn) {
+    size_t sent = 0;
+    while (sent < conn->out.len) {
+        ssize_t n = send(conn->fd, conn->out.data + sent, conn->out.len - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            conn->closing = true;
+            conn->in.len = 0;
+            sent = conn->out.len;
+        }
+    }
+    count(server, STAT_BYTES_OUT, sent);
+    memmove(conn->out.data, conn->out.data + sent, conn->out.len - sent);
+    conn->out.len -= sent;
+}
+
+/* Registers the events the connection waits for: readable unless closing or its input is
+   full, writable while output is pending. With neither it leaves epoll, so a hung-up socket
+   cannot spin the loop while a worker still holds it. */
+static void watch_connection(Server *server, Connection *conn) {
+    bool readable = !conn->closing && conn->in.len < SERVER_MAX_BUFFERED;
+    uint32_t events = (readable ? EPOLLIN : 0) | (conn->out.len > 0 ? EPOLLOUT : 0);
+    if (events == conn->events)
+        return;
+    struct epoll_event ev = {.events = events, .data.ptr = conn};
+    int op = events == 0 ? EPOLL_CTL_DEL : conn->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(server->epoll_fd, op, conn->fd, &ev) != 0)
+        log_msg(LOG_ERROR, "server: epoll_ctl failed: %s", strerror(errno));
+    conn->events = events;
+}
+
+static bool retire(Connection *conn) {
+    if (conn->retired || !conn->closing || conn->queued || conn->out.len > 0)
+        return false;
+    conn->retired = true;
+    return true;
+}
+
+static void enqueue(Server *server, Connection *conn) {
+    conn->queued = true;
+    conn->next_ready = NULL;
+    pthread_mutex_lock(&server->queue_lock);
+    if (server->ready_tail)
+        server->ready_tail->next_ready = conn;
+    else
+        server->ready_head = conn;
+    server->ready_tail = conn;
+    pthread_cond_signal(&server->queue_ready);
+    pthread_mutex_unlock(&server->queue_lock);
+}
+
+static void wake_loop(Server *server) {
+    char byte = 0;
+    ssize_t n = write(server->wake[1], &byte, 1);
+    (void)n; /* a full pipe already holds a wake-up */
+}
+
+/* Rolls back the session's open transaction, as if the client had. */
+static void end_session(Connection *conn) {
+    if (!conn->txn)
+        return;
+    pthread_mutex_lock(&g_engine_lock);
+    txn_attach(conn->txn);
+    txn_rollback();
+    conn->txn = txn_detach();
+    pthread_mutex_unlock(&g_engine_lock);
+}
+
+/* Loop thread only. A closing session with a transaction is handed to a worker to end it
+   first, so the loop never waits for the engine; only server_close, with the workers gone,
+   ends one here. */
+static void destroy_connection(Server *server, Connection *conn) {
+    if (conn->events != 0)
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    end_session(conn);
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        server->connections = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    buf_free(&conn->in);
+    buf_free(&conn->out);
+    pthread_mutex_destroy(&conn->lock);
+    free(conn);
+    atomic_fetch_sub(&server->open, 1);
+}
+
+/* A worker's turn with a connection: answers the whole frames waiting, as one batch of
+   responses, until no more have arrived. */
+static void serve_connection(Server *server, Connection *conn) {
+    pthread_mutex_lock(&conn->lock);
+    for (;;) {
+        bool bad;
+        size_t used = whole_frames(&conn->in, &bad);
+        if (used == 0 && !bad)
+            break;
+        uint8_t *requests = used > 0 ? malloc(used) : NULL;
+        if (used > 0 && !requests) {
+            log_msg(LOG_ERROR, "server: Failed to take %zu bytes of requests", used);
+            conn->closing = true;
+            break;
+        }
+        memcopy(requests, conn->in.data, used);
+        memmove(conn->in.data, conn->in.data + used, conn->in.len - used);
+        conn->in.len -= used;
+        pthread_mutex_unlock(&conn->lock);
+
+        ByteBuf replies = {0};
+        int answered = requests ? run_requests(conn, requests, used, &replies) : 0;
+        free(requests);
+        if (bad)
+            put_error(&replies, "Malformed or oversized frame");
+        count(server, STAT_REQUESTS, (uint64_t)answered);
+        count(server, STAT_BATCHES, 1);
+
+        pthread_mutex_lock(&conn->lock);
+        if (bad || replies.failed) {
+            conn->closing = true;
+            conn->in.len = 0;
+        }
+        if (!replies.failed)
+            put_bytes(&conn->out, replies.data, replies.len);
+        buf_free(&replies);
+        flush_output(server, conn);
+        if (conn->closing)
+            break;
+    }
+    if (conn->closing && conn->txn) {
+        pthread_mutex_unlock(&conn->lock);
+        end_session(conn);
+        pthread_mutex_lock(&conn->lock);
+    }
+    conn->queued = false;
+    bool retired = retire(conn);
+    if (!retired)
+        watch_connection(server, conn);
+    pthread_mutex_unlock(&conn->lock);
+
+    if (retired) {
+        pthread_mutex_lock(&server->queue_lock);
+        conn->next_ready = server->closed;
+        server->closed = conn;
+        pthread_mutex_unlock(&server->queue_lock);
+        wake_loop(server);
+    }
+}
+
+static void *worker_main(void *arg) {
+    Server *server = arg;
+    for (;;) {
+        pthread_mutex_lock(&server->queue_lock);
+        while (!server->ready_head && !server->stopping)
+            pthread_cond_wait(&server->queue_ready, &server->queue_lock);
+        Connection *conn = server->ready_head;
+        if (conn) {
+            server->ready_head = conn->next_ready;
+            if (!server->ready_head)
+                server->ready_tail = NULL;
+        }
+        pthread_mutex_unlock(&server->queue_lock);
+        if (!conn)
+            return NULL;
+        serve_connection(server, conn);
+    }
+}
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void accept_connections(Server *server) {
+    for (;;) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                log_msg(LOG_ERROR, "server: accept failed: %s", strerror(errno));
+            return;
+        }
+        Connection *conn = calloc(1, sizeof(Connection));
+        if (!conn || !set_nonblocking(fd)) {
+            log_msg(LOG_ERROR, "server: Cannot take a new connection");
+            free(conn);
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn->fd = fd;
+        pthread_mutex_init(&conn->lock, NULL);
+        conn->next = server->connections;
+        if (conn->next)
+            conn->next->prev = conn;
+        server->connections = conn;
+        watch_connection(server, conn);
+        count(server, STAT_CONNECTIONS, 1);
+        atomic_fetch_add(&server->open, 1);
+    }
+}
+
+/* Reads what arrived, writes what is pending and hands whole frames to a worker. */
+static void connection_event(Server *server, Connection *conn, uint32_t events) {
+    pthread_mutex_lock(&conn->lock);
+    if (conn->retired) {
+        pthread_mutex_unlock(&conn->lock);
+        return;
+    }
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn->closing) {
+        uint8_t chunk[SERVER_READ_CHUNK];
+        while (conn->in.len < SERVER_MAX_BUFFERED) {
+            ssize_t n = recv(conn->fd, chunk, sizeof(chunk), 0);
+            if (n > 0) {
+                put_bytes(&conn->in, chunk, (size_t)n);
+                count(server, STAT_BYTES_IN, (uint64_t)n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    conn->closing = true;
+                break;
+            }
+        }
+        if (conn->in.failed) {
+            conn->closing = true;
+            conn->in.len = 0;
+        }
+    }
+    if (conn->out.len > 0)
+        flush_output(server, conn);
+    bool bad;
+    if (!conn->queued &&
+        (whole_frames(&conn->in, &bad) > 0 || bad || (conn->closing && conn->txn)))
+        enqueue(server, conn);
+    bool retired = retire(conn);
+    if (!retired)
+        watch_connection(server, conn);
+    pthread_mutex_unlock(&conn->lock);
+    if (retired)
+        destroy_connection(server, conn);
+}
+
+static void destroy_closed(Server *server) {
+    pthread_mutex_lock(&server->queue_lock);
+    Connection *closed = server->closed;
+    server->closed = NULL;
+    pthread_mutex_unlock(&server->queue_lock);
+    while (closed) {
+        Connection *next = closed->next_ready;
+        destroy_connection(server, closed);
+        closed = next;
+    }
+}
+
+/* Binds "host:port", ":port" or "port" (port 0 picks a free one). */
+static int listen_on(const char *address, int *port) {
+    char host[256] = "";
+    const char *colon = strrchr(address, ':');
+    const char *service = colon ? colon + 1 : address;
+    if (colon && (size_t)(colon - address) < sizeof(host)) {
+        memcopy(host, address, (size_t)(colon - address));
+        host[colon - address] = '\0';
+    }
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *found = NULL;
+    int err = getaddrinfo(host[0] ? host : NULL, service, &hints, &found);
+    if (err != 0) {
+        log_msg(LOG_ERROR, "server: Cannot resolve '%s': %s", address, gai_strerror(err));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = found; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0 ||
+            !set_nonblocking(fd)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "server: Cannot listen on '%s': %s", address, strerror(errno));
+        return -1;
+    }
+    struct sockaddr_storage bound;
+    socklen_t len = sizeof(bound);
+    *port = 0;
+    if (getsockname(fd, (struct sockaddr *)&bound, &len) == 0)
+        *port = bound.ss_family == AF_INET6 ? ntohs(((struct sockaddr_in6 *)&bound)->sin6_port)
+                                            : ntohs(((struct sockaddr_in *)&bound)->sin_port);
+    return fd;
+}
+
+/* Listens on address and starts the workers; NULL when the address cannot be bound. Results
+   go to the clients, so the engine stops printing them. */
+Server *server_open(const char *address, int workers) {
+    Server *server = calloc(1, sizeof(Server));
+    if (!server) {
+        log_msg(LOG_ERROR, "server_open: Out of memory");
+        return NULL;
+    }
+    server->wake[0] = server->wake[1] = -1;
+    server->epoll_fd = -1;
+    server->listen_fd = listen_on(address, &server->port);
+    if (server->listen_fd < 0) {
+        free(server);
+        return NULL;
+    }
+    server->epoll_fd = epoll_create1(0);
+    if (server->epoll_fd < 0 || pipe(server->wake) != 0 || !set_nonblocking(server->wake[0]) ||
+        !set_nonblocking(server->wake[1])) {
+        log_msg(LOG_ERROR, "server_open: Cannot set up the event loop: %s", strerror(errno));
+        server_close(server);
+        return NULL;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &server->listen_fd};
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &ev);
+    ev.data.ptr = server->wake;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->wake[0], &ev);
+
+    pthread_mutex_init(&server->queue_lock, NULL);
+    pthread_cond_init(&server->queue_ready, NULL);
+    int wanted = workers > 0 ? workers : SERVER_DEFAULT_WORKERS;
+    server->workers = calloc((size_t)wanted, sizeof(pthread_t));
+    for (int i = 0; server->workers && i < wanted; i++) {
+        if (pthread_create(&server->workers[i], NULL, worker_main, server) != 0)
+            break;
+        server->worker_count++;
+    }
+    if (server->worker_count == 0) {
+        log_msg(LOG_ERROR, "server_open: Cannot start worker threads");
+        server_close(server);
+        return NULL;
+    }
+    db_set_print_results(false);
+    log_msg(LOG_INFO, "server: Listening on port %d with %d workers", server->port,
+            server->worker_count);
+    return server;
+}
+
+int server_port(const Server *server) {
+    return server->port;
+}
+
+/* The event loop; returns after server_stop. */
+void server_run(Server *server) {
+    struct epoll_event events[SERVER_EVENTS];
+    while (!server->stop_requested) {
+        int n = epoll_wait(server->epoll_fd, events, SERVER_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            log_msg(LOG_ERROR, "server: epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &server->listen_fd) {
+                accept_connections(server);
+            } else if (ptr == server->wake) {
+                char drain[64];
+                while (read(server->wake[0], drain, sizeof(drain)) > 0) {
+                }
+            } else {
+                connection_event(server, ptr, events[i].events);
+            }
+        }
+        /* After the batch: a retired connection may still have had an event in it. */
+        destroy_closed(server);
+    }
+}
+
+/* Safe from a signal handler. */
+void server_stop(Server *server) {
+    server->stop_requested = 1;
+    wake_loop(server);
+}
+
+/* Lets the workers finish the requests they hold, then closes every connection. */
+void server_close(Server *server) {
+    if (!server)
+        return;
+    if (server->worker_count > 0) {
+        pthread_mutex_lock(&server->queue_lock);
+        server->stopping = true;
+        pthread_cond_broadcast(&server->queue_ready);
+        pthread_mutex_unlock(&server->queue_lock);
+        for (int i = 0; i < server->worker_count; i++)
+            pthread_join(server->workers[i], NULL);
+        destroy_closed(server);
+        while (server->connections)
+            destroy_connection(server, server->connections);
+        pthread_cond_destroy(&server->queue_ready);
+        pthread_mutex_destroy(&server->queue_lock);
+    }
+    free(server->workers);
+    for (int i = 0; i < 2; i++)
+        if (server->wake[i] >= 0)
+            close(server->wake[i]);
+    if (server->epoll_fd >= 0)
+        close(server->epoll_fd);
+    close(server->listen_fd);
+    free(server);
+}
+
+void server_get_stats(Server *server, ServerStats *stats) {
+    stats->connections = atomic_load(&server->stats[STAT_CONNECTIONS]);
+    stats->requests = atomic_load(&server->stats[STAT_REQUESTS]);
+    stats->batches = atomic_load(&server->stats[STAT_BATCHES]);
+    stats->bytes_in = atomic_load(&server->stats[STAT_BYTES_IN]);
+    stats->bytes_out = atomic_load(&server->stats[STAT_BYTES_OUT]);
+    stats->open = atomic_load(&server->open);
+}
@@ -0,0 +1,330 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "db.h"
+#include "logger.h"
+#include "sketch.h"
+
+#define KLL_MIN_CAPACITY 8
+#define KLL_MAX_LEVELS 40
+
+typedef struct {
+    double *items;
+    int count;
+    int cap;
+} KllLevel;
+
+struct Sketch {
+    AggFuncType func;
+    long long count; /* values added */
+    union {
+        struct {
+            uint64_t hashes[HLL_SPARSE_HASHES];
+            int hash_count;
+            uint8_t *registers; /* NULL while the hashes are kept */
+        } hll;
+        struct {
+            KllLevel levels[KLL_MAX_LEVELS];
+            int level_count;
+            int limit;     /* level 0's capacity */
+            uint64_t coin; /* picks the half of a compacted level that moves up */
+            double min;    /* kept exactly, compaction may drop them */
+            double max;
+        } kll;
+    };
+};
+
+/* HyperLogLog. */
+
+/* value_hash is built for hash tables; the registers need every bit of it well mixed. */
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+void hll_add(uint8_t *registers, uint64_t hash) {
+    uint32_t slot = (uint32_t)(hash >> (64 - HLL_PRECISION));
+    uint64_t rest = (hash << HLL_PRECISION) | (1ull << (HLL_PRECISION - 1));
+    uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+    if (rank > registers[slot])
+        registers[slot] = rank;
+}
+
+uint64_t hll_estimate(const uint8_t *registers) {
+    const double m = HLL_REGISTERS;
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        sum += ldexp(1.0, -registers[i]);
+        if (registers[i] == 0)
+            zeros++;
+    }
+    double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0)
+        estimate = m * log(m / zeros); /* linear counting for small cardinalities */
+    return (uint64_t)(estimate + 0.5);
+}
+
+static bool hll_densify(Sketch *sketch) {
+    sketch->hll.registers = calloc(HLL_REGISTERS, 1);
+    if (!sketch->hll.registers)
+        return false;
+    for (int i = 0; i < sketch->hll.hash_count; i++)
+        hll_add(sketch->hll.registers, sketch->hll.hashes[i]);
+    sketch->hll.hash_count = 0;
+    return true;
+}
+
+static bool hll_insert(Sketch *sketch, uint64_t hash) {
+    if (sketch->hll.registers) {
+        hll_add(sketch->hll.registers, hash);
+        return true;
+    }
+    for (int i = 0; i < sketch->hll.hash_count; i++)
+        if (sketch->hll.hashes[i] == hash)
+            return true;
+    if (sketch->hll.hash_count < HLL_SPARSE_HASHES) {
+        sketch->hll.hashes[sketch->hll.hash_count++] = hash;
+        return true;
+    }
+    if (!hll_densify(sketch))
+        return false;
+    hll_add(sketch->hll.registers, hash);
+    return true;
+}
+
+static bool hll_merge(Sketch *dst, const Sketch *src) {
+    if (!src->hll.registers) {
+        for (int i = 0; i < src->hll.hash_count; i++)
+            if (!hll_insert(dst, src->hll.hashes[i]))
+                return false;
+        return true;
+    }
+    if (!dst->hll.registers && !hll_densify(dst))
+        return false;
+    for (int i = 0; i < HLL_REGISTERS; i++)
+        if (src->hll.registers[i] > dst->hll.registers[i])
+            dst->hll.registers[i] = src->hll.registers[i];
+    return true;
+}
+
+static long long hll_count(const Sketch *sketch) {
+    return sketch->hll.registers ? (long long)hll_estimate(sketch->hll.registers)
+                                 : sketch->hll.hash_count;
+}
+
+/* KLL. The capacity of level h is KLL_K (2/3)^(top - h), at least KLL_MIN_CAPACITY: the
+   highest level holds the most items and each one below two thirds of the one above it. */
+
+static int kll_capacity(const Sketch *sketch, int level) {
+    double cap = ceil(KLL_K * pow(2.0 / 3.0, sketch->kll.level_count - 1 - level));
+    return cap > KLL_MIN_CAPACITY ? (int)cap : KLL_MIN_CAPACITY;
+}
+
+static bool kll_append(KllLevel *level, double x) {
+    if (level->count == level->cap) {
+        int cap = level->cap > 0 ? level->cap * 2 : KLL_MIN_CAPACITY;
+        double *items = realloc(level->items, sizeof(double) * (size_t)cap);
+        if (!items)
+            return false;
+        level->items = items;
+        level->cap = cap;
+    }
+    level->items[level->count++] = x;
+    return true;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Sorts a full level and moves every other item, from the first or the second by a coin
+   flip, one level up at twice the weight; an odd item out stays. */
+static bool kll_compact(Sketch *sketch, int h) {
+    KllLevel *level = &sketch->kll.levels[h];
+    if (h + 1 == sketch->kll.level_count)
+        sketch->kll.level_count++;
+    qsort(level->items, (size_t)level->count, sizeof(double), compare_doubles);
+    uint64_t coin = sketch->kll.coin;
+    coin ^= coin << 13;
+    coin ^= coin >> 7;
+    coin ^= coin << 17;
+    sketch->kll.coin = coin;
+    int offset = (int)(coin & 1);
+    int pairs = level->count / 2;
+    for (int i = 0; i < pairs; i++)
+        if (!kll_append(&sketch->kll.levels[h + 1], level->items[2 * i + offset]))
+            return false;
+    if (level->count % 2)
+        level->items[0] = level->items[level->count - 1];
+    level->count %= 2;
+    return true;
+}
+
+/* Compacts levels over their capacity, bottom up, until none is. */
+static bool kll_compress(Sketch *sketch) {
+    bool compacted = true;
+    while (compacted) {
+        compacted = false;
+        for (int h = 0; h < sketch->kll.level_count && h + 1 < KLL_MAX_LEVELS; h++) {
+            if (sketch->kll.levels[h].count < kll_capacity(sketch, h))
+                continue;
+            if (!kll_compact(sketch, h))
+                return false;
+            compacted = true;
+        }
+    }
+    sketch->kll.limit = kll_capacity(sketch, 0);
+    return true;
+}
+
+static bool kll_insert(Sketch *sketch, double x) {
+    if (!kll_append(&sketch->kll.levels[0], x))
+        return false;
+    if (sketch->count == 0 || x < sketch->kll.min)
+        sketch->kll.min = x;
+    if (sketch->count == 0 || x > sketch->kll.max)
+        sketch->kll.max = x;
+    return sketch->kll.levels[0].count < sketch->kll.limit || kll_compress(sketch);
+}
+
+static bool kll_merge(Sketch *dst, const Sketch *src) {
+    if (dst->count == 0 || src->kll.min < dst->kll.min)
+        dst->kll.min = src->kll.min;
+    if (dst->count == 0 || src->kll.max > dst->kll.max)
+        dst->kll.max = src->kll.max;
+    if (dst->kll.level_count < src->kll.level_count)
+        dst->kll.level_count = src->kll.level_count;
+    for (int h = 0; h < src->kll.level_count; h++)
+        for (int i = 0; i < src->kll.levels[h].count; i++)
+            if (!kll_append(&dst->kll.levels[h], src->kll.levels[h].items[i]))
+                return false;
+    return kll_compress(dst);
+}
+
+typedef struct {
+    double value;
+    uint64_t weight;
+} WeightedItem;
+
+static int compare_weighted(const void *a, const void *b) {
+    return compare_doubles(&((const WeightedItem *)a)->value, &((const WeightedItem *)b)->value);
+}
+
+/* The nearest-rank quantile: the smallest item whose cumulative weight reaches
+   fraction of the total; 0 and 1 are the exact minimum and maximum. */
+static bool kll_quantile(const Sketch *sketch, double fraction, double *out) {
+    if (fraction <= 0 || fraction >= 1) {
+        *out = fraction <= 0 ? sketch->kll.min : sketch->kll.max;
+        return true;
+    }
+    int n = 0;
+    for (int h = 0; h < sketch->kll.level_count; h++)
+        n += sketch->kll.levels[h].count;
+    WeightedItem *items = malloc(sizeof(WeightedItem) * (size_t)(n > 0 ? n : 1));
+    if (!items)
+        return false;
+    uint64_t total = 0;
+    n = 0;
+    for (int h = 0; h < sketch->kll.level_count; h++) {
+        for (int i = 0; i < sketch->kll.levels[h].count; i++) {
+            items[n].value = sketch->kll.levels[h].items[i];
+            items[n++].weight = 1ull << h;
+            total += 1ull << h;
+        }
+    }
+    qsort(items, (size_t)n, sizeof(WeightedItem), compare_weighted);
+    double rank = ceil(fraction * (double)total);
+    uint64_t seen = 0;
+    int i = 0;
+    while (i < n - 1 && (double)(seen + items[i].weight) < rank)
+        seen += items[i++].weight;
+    *out = items[i].value;
+    free(items);
+    return true;
+}
+
+/* Sketches. */
+
+bool sketch_function(AggFuncType func) {
+    return func == FUNC_APPROX_COUNT_DISTINCT || func == FUNC_APPROX_PERCENTILE;
+}
+
+Sketch *sketch_create(AggFuncType func) {
+    Sketch *sketch = calloc(1, sizeof(Sketch));
+    if (!sketch) {
+        log_msg(LOG_ERROR, "sketch_create: Out of memory");
+        return NULL;
+    }
+    sketch->func = func;
+    if (func == FUNC_APPROX_PERCENTILE) {
+        sketch->kll.level_count = 1;
+        sketch->kll.limit = KLL_K;
+        sketch->kll.coin = 0x9E3779B97F4A7C15ull;
+    }
+    return sketch;
+}
+
+/* Adds a non-NULL value; percentiles take numbers and ignore the rest. False when out of
+   memory. */
+bool sketch_add(Sketch *sketch, const Value *value) {
+    bool ok = true;
+    if (sketch->func == FUNC_APPROX_COUNT_DISTINCT) {
+        ok = hll_insert(sketch, mix64(value_hash(value)));
+    } else if (value->type == TYPE_INT) {
+        ok = kll_insert(sketch, (double)value->int_val);
+    } else if (value->type == TYPE_FLOAT && !isnan(value->float_val)) {
+        ok = kll_insert(sketch, value->float_val);
+    } else {
+        return true;
+    }
+    if (ok)
+        sketch->count++;
+    return ok;
+}
+
+/* Folds src into dst; both summarize the same function. */
+bool sketch_merge(Sketch *dst, const Sketch *src) {
+    if (!src || src->count == 0)
+        return true;
+    bool ok = dst->func == FUNC_APPROX_COUNT_DISTINCT ? hll_merge(dst, src) : kll_merge(dst, src);
+    if (ok)
+        dst->count += src->count;
+    return ok;
+}
+
+/* APPROX_COUNT_DISTINCT is 0 over no values, APPROX_PERCENTILE NULL; sketch may be NULL
+   when none were added. */
+Value sketch_result(const Sketch *sketch, AggFuncType func, double fraction) {
+    Value result = {0};
+    if (func == FUNC_APPROX_COUNT_DISTINCT) {
+        result.type = TYPE_INT;
+        result.int_val = sketch ? hll_count(sketch) : 0;
+        return result;
+    }
+    result.type = TYPE_NULL;
+    if (!sketch || sketch->count == 0)
+        return result;
+    if (!kll_quantile(sketch, fraction, &result.float_val)) {
+        log_msg(LOG_ERROR, "sketch_result: Out of memory");
+        return result;
+    }
+    result.type = TYPE_FLOAT;
+    return result;
+}
+
+void sketch_free(Sketch *sketch) {
+    if (!sketch)
+        return;
+    if (sketch->func == FUNC_APPROX_COUNT_DISTINCT)
+        free(sketch->hll.registers);
+    else
+        for (int h = 0; h < sketch->kll.level_count; h++)
+            free(sketch->kll.levels[h].items);
+    free(sketch);
+}
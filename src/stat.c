@@ -2,16 +2,77 @@
 #include "values.h"
 #include "table.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "logger.h"
+#include "sketch.h"
+#include "utils.h"
 
-ArrayList table_stats;
+/* Distinct counts come from a HyperLogLog sketch over every row; histograms from an
+   equi-depth split of a fixed-size reservoir sample, so ANALYZE stays linear in the table
+   size. */
+#define STATS_SAMPLE_ROWS 30000
+
+static TableStats **g_stats; /* by table id, NULL until the table is analyzed */
+static int g_stats_capacity;
+
+static void free_column_stats(ColumnStats *col_stats) {
+    free_value(&col_stats->min_val);
+    free_value(&col_stats->max_val);
+    for (int i = 0; i < col_stats->histogram_count; i++)
+        free_value(&col_stats->histogram[i]);
+    col_stats->histogram_count = 0;
+}
+
+static void free_table_stats(TableStats *stats) {
+    for (int i = 0; i < stats->column_count; i++)
+        free_column_stats(&stats->column_stats[i]);
+    free(stats->column_stats);
+    stats->column_stats = NULL;
+    stats->column_count = 0;
+    stats->has_stats = false;
+}
 
 void init_stat(void) {
-    alist_init(&table_stats, sizeof(TableStats), NULL);
+    for (int i = 0; i < g_stats_capacity; i++)
+        drop_table_stats((uint16_t)i);
+}
+
+TableStats *get_table_stats(uint16_t table_id) {
+    return table_id < g_stats_capacity ? g_stats[table_id] : NULL;
+}
+
+void drop_table_stats(uint16_t table_id) {
+    TableStats *stats = get_table_stats(table_id);
+    if (!stats)
+        return;
+    free_table_stats(stats);
+    free(stats);
+    g_stats[table_id] = NULL;
+}
+
+static TableStats *create_table_stats(uint16_t table_id) {
+    if (table_id >= g_stats_capacity) {
+        int capacity = g_stats_capacity > 0 ? g_stats_capacity : 32;
+        while (capacity <= table_id)
+            capacity *= 2;
+        TableStats **grown = realloc(g_stats, sizeof(TableStats *) * (size_t)capacity);
+        if (!grown)
+            return NULL;
+        memclear(grown + g_stats_capacity,
+                 sizeof(TableStats *) * (size_t)(capacity - g_stats_capacity));
+        g_stats = grown;
+        g_stats_capacity = capacity;
+    }
+    TableStats *stats = calloc(1, sizeof(TableStats));
+    if (stats) {
+        stats->table_id = table_id;
+        g_stats[table_id] = stats;
+    }
+    return stats;
 }
 
 void update_column_stats(TableStats *stats, int col_idx, const Value *value) {
@@ -23,21 +84,199 @@ void update_column_stats(TableStats *stats, int col_idx, const Value *value) {
 
     if (!is_null(value)) {
         if (!col_stats->has_stats || compare_values(value, &col_stats->min_val) < 0) {
+            if (col_stats->has_stats)
+                free_value(&col_stats->min_val);
             col_stats->min_val = copy_value(value);
         }
 
         if (!col_stats->has_stats || compare_values(value, &col_stats->max_val) > 0) {
+            if (col_stats->has_stats)
+                free_value(&col_stats->max_val);
             col_stats->max_val = copy_value(value);
         }
+        col_stats->has_stats = true;
 
         size_t value_size = 0;
         if (value->type == TYPE_STRING) {
-            value_size = strlen(value->char_val);
+            value_size = strlen(value_str(value));
         } else {
             value_size = sizeof(Value);
         }
 
         col_stats->avg_width =
             (col_stats->avg_width * (col_stats->row_count - 1) + value_size) / col_stats->row_count;
+    } else {
+        col_stats->null_count++;
+    }
+}
+
+static int compare_sample_values(const void *a, const void *b) {
+    return compare_values((const Value *)a, (const Value *)b);
+}
+
+static uint64_t sample_next(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* Reservoir-samples row ids so every row has the same chance of shaping the histograms. */
+static int sample_rows(int row_count, int *rows) {
+    if (row_count <= STATS_SAMPLE_ROWS) {
+        for (int i = 0; i < row_count; i++)
+            rows[i] = i;
+        return row_count;
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (int i = 0; i < STATS_SAMPLE_ROWS; i++)
+        rows[i] = i;
+    for (int i = STATS_SAMPLE_ROWS; i < row_count; i++) {
+        uint64_t j = sample_next(&state) % (uint64_t)(i + 1);
+        if (j < STATS_SAMPLE_ROWS)
+            rows[j] = i;
+    }
+    return STATS_SAMPLE_ROWS;
+}
+
+static void build_histogram(ColumnStats *col_stats, Value *values, int count) {
+    col_stats->histogram_count = 0;
+    if (count == 0)
+        return;
+    qsort(values, (size_t)count, sizeof(Value), compare_sample_values);
+
+    int buckets = count - 1 < STATS_HISTOGRAM_BUCKETS ? count - 1 : STATS_HISTOGRAM_BUCKETS;
+    if (buckets < 1)
+        buckets = 1;
+    for (int b = 0; b <= buckets; b++) {
+        long long pos = (long long)b * (count - 1) / buckets;
+        col_stats->histogram[b] = copy_value(&values[pos]);
+    }
+    col_stats->histogram_count = buckets + 1;
+}
+
+static void analyze_column(const Table *table, uint16_t column_id, const int *sample,
+                           int sample_count, uint8_t *registers, Value *scratch,
+                           ColumnStats *col_stats) {
+    int row_count = table_row_count(table);
+    memclear(registers, HLL_REGISTERS);
+    memclear(col_stats, sizeof(ColumnStats));
+    col_stats->row_count = (uint32_t)table_live_row_count(table);
+
+    double width = 0;
+    for (int r = 0; r < row_count; r++) {
+        if (table_row_deleted(table, r))
+            continue;
+        Value val = table_get_value(table, r, column_id);
+        if (is_null(&val)) {
+            col_stats->null_count++;
+            continue;
+        }
+        hll_add(registers, value_hash(&val));
+        width +=
+            val.type == TYPE_STRING ? (double)strlen(value_str(&val)) : (double)sizeof(Value);
+        if (!col_stats->has_stats || compare_values(&val, &col_stats->min_val) < 0) {
+            free_value(&col_stats->min_val);
+            col_stats->min_val = copy_value(&val);
+        }
+        if (!col_stats->has_stats || compare_values(&val, &col_stats->max_val) > 0) {
+            free_value(&col_stats->max_val);
+            col_stats->max_val = copy_value(&val);
+        }
+        col_stats->has_stats = true;
+    }
+
+    uint32_t non_null = col_stats->row_count - col_stats->null_count;
+    if (non_null == 0)
+        return;
+    col_stats->avg_width = width / non_null;
+    col_stats->distinct_count = (uint32_t)hll_estimate(registers);
+    if (col_stats->distinct_count > non_null)
+        col_stats->distinct_count = non_null;
+    if (col_stats->distinct_count == 0)
+        col_stats->distinct_count = 1;
+
+    int count = 0;
+    for (int i = 0; i < sample_count; i++) {
+        Value val = table_get_value(table, sample[i], column_id);
+        if (!is_null(&val))
+            scratch[count++] = val;
+    }
+    build_histogram(col_stats, scratch, count);
+}
+
+bool analyze_table(uint16_t table_id) {
+    Table *table = get_table_by_id(table_id);
+    if (!table) {
+        log_msg(LOG_ERROR, "analyze_table: Table with ID %d not found", table_id);
+        return false;
+    }
+
+    TableStats *stats = get_table_stats(table_id);
+    if (!stats && !(stats = create_table_stats(table_id))) {
+        log_msg(LOG_ERROR, "analyze_table: Failed to allocate statistics");
+        return false;
+    }
+    free_table_stats(stats);
+
+    int column_count = alist_length(&table->schema.columns);
+    int row_count = table_row_count(table);
+    int sample_cap = row_count < STATS_SAMPLE_ROWS ? row_count : STATS_SAMPLE_ROWS;
+    stats->column_stats = calloc((size_t)(column_count > 0 ? column_count : 1),
+                                 sizeof(ColumnStats));
+    uint8_t *registers = malloc(HLL_REGISTERS);
+    int *sample = malloc(sizeof(int) * (size_t)(sample_cap > 0 ? sample_cap : 1));
+    Value *scratch = malloc(sizeof(Value) * (size_t)(sample_cap > 0 ? sample_cap : 1));
+    if (!stats->column_stats || !registers || !sample || !scratch) {
+        log_msg(LOG_ERROR, "analyze_table: Failed to allocate statistics buffers");
+        free(registers);
+        free(sample);
+        free(scratch);
+        free(stats->column_stats);
+        stats->column_stats = NULL;
+        return false;
     }
-}
\ No newline at end of file
+
+    int sampled = sample_rows(row_count, sample);
+    int sample_count = 0;
+    for (int k = 0; k < sampled; k++)
+        if (!table_row_deleted(table, sample[k]))
+            sample[sample_count++] = sample[k];
+    stats->column_count = column_count;
+    stats->total_rows = (uint32_t)table_live_row_count(table);
+    for (int c = 0; c < column_count && c < MAX_COLUMNS; c++) {
+        analyze_column(table, (uint16_t)c, sample, sample_count, registers, scratch,
+                       &stats->column_stats[c]);
+        stats->distinct_values[c] = stats->column_stats[c].distinct_count;
+    }
+    stats->has_stats = true;
+
+    free(registers);
+    free(sample);
+    free(scratch);
+    log_msg(LOG_INFO, "analyze_table: Analyzed '%s': %d rows, %d columns", table->name,
+            row_count, column_count);
+    return true;
+}
+
+/* Statistics are refreshed automatically once the row count drifts by more than a fifth
+   since the last ANALYZE, or when the schema no longer matches. */
+static bool stats_are_stale(const TableStats *stats, const Table *table) {
+    if (!stats->has_stats || stats->column_count != alist_length(&table->schema.columns))
+        return true;
+    long long drift = (long long)table_live_row_count(table) - (long long)stats->total_rows;
+    if (drift < 0)
+        drift = -drift;
+    return drift > (long long)stats->total_rows / 5 + 100;
+}
+
+void collect_table_stats(uint16_t table_id) {
+    Table *table = get_table_by_id(table_id);
+    if (!table)
+        return;
+
+    TableStats *stats = get_table_stats(table_id);
+    if (stats && !stats_are_stale(stats, table))
+        return;
+    analyze_table(table_id);
+}
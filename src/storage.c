@@ -0,0 +1,1520 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "storage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "utils.h"
+#include "values.h"
+
+extern ArrayList indexes;
+
+/* Snapshot file: page 0 is the file header, then catalog pages (table definitions), the
+   table data and the indexes. A page starts with a PAGE_HEADER_SIZE header whose CRC covers
+   its records; a record never straddles pages, so a large one gets a page spanning several.
+   Row tables are row pages of encoded values. Columnar tables are one segment per column
+   and hash indexes one segment each: the raw arrays, laid out so a mapping of the file can
+   be used in place (see StorageMap). Other indexes are definitions, rebuilt on load.
+
+   Log file: a WAL_HEADER_SIZE header, then frames of [payload length, CRC, LSN, records].
+   Each frame is one statement's changes. Recovery applies the frames whose LSN is newer than
+   the snapshot and stops at the first torn or corrupt frame, truncating the log there.
+
+   Version 3 widened table ids from one byte to two, in records and in the page header (bytes
+   5 and 6); the log header carries the version after its magic, 0 in older logs. Version 4
+   appends the key column count to index definitions; before it every column was a key.
+   Version 5 adds materialized views: a view page after the indexes holds each view's table
+   id and SELECT, its table a catalog entry whose rows are recomputed rather than stored. */
+#define SNAPSHOT_MAGIC "SDBSNAP1"
+#define WAL_MAGIC "SDBWAL01"
+#define STORAGE_VERSION 5
+#define PAGE_HEADER_SIZE 24
+#define WAL_HEADER_SIZE 16
+#define FRAME_HEADER_SIZE 16
+#define STORAGE_PATH_LEN 512
+#define SEGMENT_ALIGN 64
+
+typedef enum {
+    PAGE_CATALOG = 1,
+    PAGE_ROWS,
+    PAGE_INDEXES,
+    PAGE_COLUMN_SEGMENT,
+    PAGE_HASH_SEGMENT,
+    PAGE_VIEWS
+} PageType;
+
+typedef enum {
+    WAL_CREATE_TABLE = 1,
+    WAL_DROP_TABLE,
+    WAL_CREATE_INDEX,
+    WAL_DROP_INDEX,
+    WAL_INSERT,
+    WAL_UPDATE,
+    WAL_DELETE,
+    WAL_DELETE_IN_PLACE,
+    WAL_CREATE_VIEW
+} WalRecordType;
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    bool failed; /* an allocation failed and the contents are incomplete */
+} ByteBuf;
+
+typedef struct {
+    const uint8_t *pos;
+    const uint8_t *end;
+    bool ok;
+    uint32_t version; /* of the file: table ids take two bytes from version 3 on */
+} Reader;
+
+static struct {
+    int wal_fd;
+    char dir[STORAGE_PATH_LEN];
+    ByteBuf pending; /* the current statement's frame */
+    uint64_t last_lsn;
+    uint64_t checkpoint_lsn;
+    int unsynced;              /* frames written since the last fsync */
+    struct timespec last_sync; /* CLOCK_MONOTONIC */
+    int group_max;
+    int group_usec;
+    pthread_mutex_t sync_lock; /* guards unsynced, syncing, last_sync, group_usec, stats.syncs */
+    pthread_cond_t sync_done;  /* an fsync under way has finished */
+    bool syncing;
+    pthread_cond_t flusher_wake;
+    pthread_t flusher;
+    bool flusher_running;
+    bool flusher_stop;
+    bool replaying;
+    uint32_t log_version; /* of the log replayed; an older one is folded into a snapshot */
+    StorageStats stats;
+} g_storage = {.wal_fd = -1, .group_max = WAL_GROUP_COMMIT_MAX,
+               .group_usec = WAL_GROUP_COMMIT_USEC, .sync_lock = PTHREAD_MUTEX_INITIALIZER,
+               .sync_done = PTHREAD_COND_INITIALIZER};
+
+static uint32_t crc32_update(const uint8_t *data, size_t len) {
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static void store_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void store_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t load_u32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+        v |= (uint32_t)p[i] << (8 * i);
+    return v;
+}
+
+static uint64_t load_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+        v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+static uint8_t *buf_extend(ByteBuf *buf, size_t n) {
+    if (buf->len + n > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 256;
+        while (cap < buf->len + n)
+            cap *= 2;
+        uint8_t *data = realloc(buf->data, cap);
+        if (!data) {
+            log_msg(LOG_ERROR, "storage: Failed to grow a %zu byte buffer", cap);
+            buf->failed = true;
+            return NULL;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+    uint8_t *p = buf->data + buf->len;
+    buf->len += n;
+    return p;
+}
+
+static void put_bytes(ByteBuf *buf, const void *src, size_t n) {
+    uint8_t *p = buf_extend(buf, n);
+    if (p && n > 0)
+        memcpy(p, src, n);
+}
+
+static void put_zeros(ByteBuf *buf, size_t n) {
+    uint8_t *p = buf_extend(buf, n);
+    if (p)
+        memset(p, 0, n);
+}
+
+static void put_u8(ByteBuf *buf, uint8_t v) {
+    put_bytes(buf, &v, 1);
+}
+
+static void put_u16(ByteBuf *buf, uint16_t v) {
+    uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    put_bytes(buf, b, 2);
+}
+
+static void put_u32(ByteBuf *buf, uint32_t v) {
+    uint8_t *p = buf_extend(buf, 4);
+    if (p)
+        store_u32(p, v);
+}
+
+static void put_u64(ByteBuf *buf, uint64_t v) {
+    uint8_t *p = buf_extend(buf, 8);
+    if (p)
+        store_u64(p, v);
+}
+
+/* Length-prefixed and NUL terminated, so readers can use the bytes in place. */
+static void put_str(ByteBuf *buf, const char *str) {
+    size_t len = strlen(str);
+    put_u32(buf, (uint32_t)len);
+    put_bytes(buf, str, len + 1);
+}
+
+static void put_value(ByteBuf *buf, const Value *val) {
+    put_u8(buf, (uint8_t)val->type);
+    switch (val->type) {
+    case TYPE_INT:
+        put_u64(buf, (uint64_t)val->int_val);
+        break;
+    case TYPE_FLOAT: {
+        uint64_t bits;
+        memcpy(&bits, &val->float_val, sizeof(bits));
+        put_u64(buf, bits);
+        break;
+    }
+    case TYPE_BOOLEAN:
+        put_u8(buf, val->bool_val ? 1 : 0);
+        break;
+    case TYPE_DECIMAL:
+        put_u32(buf, (uint32_t)val->decimal_val.precision);
+        put_u32(buf, (uint32_t)val->decimal_val.scale);
+        put_u64(buf, (uint64_t)val->decimal_val.value);
+        break;
+    case TYPE_TIME:
+        put_u32(buf, val->time_val);
+        break;
+    case TYPE_DATE:
+        put_u32(buf, val->date_val);
+        break;
+    case TYPE_STRING:
+        put_str(buf, value_str(val) ? value_str(val) : "");
+        break;
+    case TYPE_BLOB:
+        put_u32(buf, (uint32_t)val->blob_val.length);
+        put_bytes(buf, val->blob_val.data, val->blob_val.length);
+        break;
+    default:
+        break;
+    }
+}
+
+static void put_table_def(ByteBuf *buf, const Table *table) {
+    put_u16(buf, table->table_id);
+    put_str(buf, table->name);
+    put_u8(buf, table->schema.strict ? 1 : 0);
+    put_u8(buf, (uint8_t)table->storage);
+    int col_count = alist_length(&table->schema.columns);
+    put_u16(buf, (uint16_t)col_count);
+    for (int i = 0; i < col_count; i++) {
+        const ColumnDef *col = (const ColumnDef *)alist_get(&table->schema.columns, i);
+        put_str(buf, col->name);
+        put_u8(buf, (uint8_t)col->type);
+        put_u32(buf, col->flags);
+        put_u16(buf, col->reference.table_id);
+        put_u16(buf, col->reference.column_id);
+    }
+}
+
+static void put_index_def(ByteBuf *buf, const Index *index) {
+    put_u16(buf, index->table_id);
+    put_str(buf, index->index_name);
+    put_u8(buf, (uint8_t)index->type);
+    int col_count = alist_length(&index->columns);
+    put_u16(buf, (uint16_t)col_count);
+    for (int i = 0; i < col_count; i++)
+        put_u16(buf, *(const uint16_t *)alist_get(&index->columns, i));
+    put_u16(buf, index->key_count);
+}
+
+static void put_row(ByteBuf *buf, const Table *table, int row_idx) {
+    for (int c = 0; c < alist_length(&table->schema.columns); c++) {
+        Value val = table_get_value(table, row_idx, (uint16_t)c);
+        put_value(buf, &val);
+    }
+}
+
+static const uint8_t *take(Reader *r, size_t n) {
+    if (!r->ok || (size_t)(r->end - r->pos) < n) {
+        r->ok = false;
+        return NULL;
+    }
+    const uint8_t *p = r->pos;
+    r->pos += n;
+    return p;
+}
+
+static uint8_t get_u8(Reader *r) {
+    const uint8_t *p = take(r, 1);
+    return p ? p[0] : 0;
+}
+
+static uint16_t get_u16(Reader *r) {
+    const uint8_t *p = take(r, 2);
+    return p ? (uint16_t)(p[0] | p[1] << 8) : 0;
+}
+
+static uint16_t get_table_id(Reader *r) {
+    return r->version >= 3 ? get_u16(r) : get_u8(r);
+}
+
+static uint32_t get_u32(Reader *r) {
+    const uint8_t *p = take(r, 4);
+    return p ? load_u32(p) : 0;
+}
+
+static uint64_t get_u64(Reader *r) {
+    const uint8_t *p = take(r, 8);
+    return p ? load_u64(p) : 0;
+}
+
+static const char *get_str(Reader *r) {
+    uint32_t len = get_u32(r);
+    const uint8_t *p = take(r, (size_t)len + 1);
+    if (!p || p[len] != '\0') {
+        r->ok = false;
+        return NULL;
+    }
+    return (const char *)p;
+}
+
+static void get_name(Reader *r, char *dst, size_t size) {
+    const char *str = get_str(r);
+    if (str && strlen(str) >= size)
+        r->ok = false;
+    strcopy(dst, size, str && r->ok ? str : "");
+}
+
+static Value get_value(Reader *r) {
+    Value val = {0};
+    val.type = (DataType)get_u8(r);
+    switch (val.type) {
+    case TYPE_INT:
+        val.int_val = (long long)get_u64(r);
+        break;
+    case TYPE_FLOAT: {
+        uint64_t bits = get_u64(r);
+        memcpy(&val.float_val, &bits, sizeof(bits));
+        break;
+    }
+    case TYPE_BOOLEAN:
+        val.bool_val = get_u8(r) != 0;
+        break;
+    case TYPE_DECIMAL:
+        val.decimal_val.precision = (int)get_u32(r);
+        val.decimal_val.scale = (int)get_u32(r);
+        val.decimal_val.value = (long long)get_u64(r);
+        break;
+    case TYPE_TIME:
+        val.time_val = get_u32(r);
+        break;
+    case TYPE_DATE:
+        val.date_val = get_u32(r);
+        break;
+    case TYPE_STRING: {
+        const char *str = get_str(r);
+        if (str)
+            val = make_string_value(str);
+        break;
+    }
+    case TYPE_BLOB: {
+        uint32_t len = get_u32(r);
+        const uint8_t *p = take(r, len);
+        if (p && len > 0) {
+            val.blob_val.data = malloc(len);
+            if (val.blob_val.data) {
+                memcpy(val.blob_val.data, p, len);
+                val.blob_val.length = len;
+            }
+        }
+        break;
+    }
+    case TYPE_NULL:
+        break;
+    default:
+        r->ok = false;
+        break;
+    }
+    if (!r->ok) {
+        free_value(&val);
+        val.type = TYPE_NULL;
+    }
+    return val;
+}
+
+/* Reads one value per schema column and appends the row; constraints were checked when the
+   row was first stored. */
+static bool get_row(Reader *r, Table *table) {
+    Row row;
+    if (!table_row_init(table, &row))
+        return false;
+    for (int c = 0; c < alist_length(&table->schema.columns); c++)
+        *(Value *)alist_append(&row) = get_value(r);
+    if (!r->ok) {
+        table_row_free(table, &row);
+        return false;
+    }
+    return table_append_row(table, &row);
+}
+
+/* def->columns must be initialized to hold ColumnDef. */
+static bool get_table_def(Reader *r, uint16_t *table_id, CreateTableNode *def) {
+    *table_id = get_table_id(r);
+    get_name(r, def->table_name, sizeof(def->table_name));
+    def->strict = get_u8(r) != 0;
+    def->storage = (StorageType)get_u8(r);
+    uint16_t col_count = get_u16(r);
+    for (uint16_t i = 0; i < col_count && r->ok; i++) {
+        ColumnDef *col = (ColumnDef *)alist_append(&def->columns);
+        memclear(col, sizeof(ColumnDef));
+        get_name(r, col->name, sizeof(col->name));
+        col->type = (DataType)get_u8(r);
+        col->flags = get_u32(r);
+        col->reference.table_id = get_table_id(r);
+        col->reference.column_id = get_u16(r);
+    }
+    return r->ok;
+}
+
+/* column_ids must be initialized to hold uint16_t. */
+static void get_index_def(Reader *r, uint16_t *table_id, char *name, size_t name_size,
+                          IndexType *type, ArrayList *column_ids, int *key_count) {
+    *table_id = get_table_id(r);
+    get_name(r, name, name_size);
+    *type = (IndexType)get_u8(r);
+    uint16_t col_count = get_u16(r);
+    for (uint16_t i = 0; i < col_count && r->ok; i++)
+        *(uint16_t *)alist_append(column_ids) = get_u16(r);
+    *key_count = r->version >= 4 ? get_u16(r) : col_count;
+}
+
+static bool apply_index_def(Reader *r) {
+    uint16_t table_id;
+    char name[MAX_TABLE_NAME_LEN];
+    IndexType type;
+    ArrayList column_ids;
+    int key_count;
+    alist_init(&column_ids, sizeof(uint16_t), NULL);
+    get_index_def(r, &table_id, name, sizeof(name), &type, &column_ids, &key_count);
+    bool ok = r->ok && get_table_by_id(table_id) != NULL;
+    if (ok)
+        index_table(table_id, &column_ids, key_count, name, type);
+    alist_destroy(&column_ids);
+    return ok;
+}
+
+static void storage_path(char *dst, size_t size, const char *file) {
+    string_format(dst, size, "%s/%s", g_storage.dir, file);
+}
+
+static uint8_t *read_file(const char *path, size_t *size, bool *missing) {
+    *size = 0;
+    *missing = false;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        *missing = errno == ENOENT;
+        if (!*missing)
+            log_msg(LOG_ERROR, "storage: Cannot open '%s': %s", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    uint8_t *data = NULL;
+    if (fstat(fd, &st) == 0 && (data = malloc((size_t)st.st_size + 1)) != NULL) {
+        size_t done = 0;
+        while (done < (size_t)st.st_size) {
+            ssize_t n = read(fd, data + done, (size_t)st.st_size - done);
+            if (n <= 0)
+                break;
+            done += (size_t)n;
+        }
+        *size = done;
+    }
+    close(fd);
+    if (!data)
+        log_msg(LOG_ERROR, "storage: Cannot read '%s'", path);
+    return data;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            log_msg(LOG_ERROR, "storage: write failed: %s", strerror(errno));
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool sync_dir(void) {
+    int fd = open(g_storage.dir, O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+/* Snapshot writing. */
+
+typedef struct {
+    ByteBuf *out;
+    size_t start;
+    uint8_t type;
+    uint16_t table_id;
+    uint32_t records;
+} PageWriter;
+
+static void page_begin(PageWriter *pw, uint8_t type, uint16_t table_id) {
+    pw->start = pw->out->len;
+    pw->type = type;
+    pw->table_id = table_id;
+    pw->records = 0;
+    put_zeros(pw->out, PAGE_HEADER_SIZE);
+}
+
+/* Pads the page out to whole pages and fills in its header. The CRC covers the header and
+   the used record bytes; segment arrays placed after them are not checksummed, so opening a
+   snapshot never has to read them. */
+static void page_seal(PageWriter *pw, size_t used) {
+    size_t span = (pw->out->len - pw->start + STORAGE_PAGE_SIZE - 1) / STORAGE_PAGE_SIZE;
+    put_zeros(pw->out, span * STORAGE_PAGE_SIZE - (pw->out->len - pw->start));
+    if (pw->out->failed)
+        return;
+    uint8_t *page = pw->out->data + pw->start;
+    page[4] = pw->type;
+    page[5] = (uint8_t)pw->table_id;
+    page[6] = (uint8_t)(pw->table_id >> 8);
+    store_u32(page + 8, pw->records);
+    store_u32(page + 12, (uint32_t)used);
+    store_u32(page + 16, (uint32_t)span);
+    store_u32(page, crc32_update(page + 4, PAGE_HEADER_SIZE - 4 + used));
+}
+
+static void page_finish(PageWriter *pw) {
+    page_seal(pw, pw->out->len - pw->start - PAGE_HEADER_SIZE);
+}
+
+static void page_add(PageWriter *pw, const ByteBuf *record) {
+    size_t used = pw->out->len - pw->start - PAGE_HEADER_SIZE;
+    if (pw->records > 0 && PAGE_HEADER_SIZE + used + record->len > STORAGE_PAGE_SIZE) {
+        page_finish(pw);
+        page_begin(pw, pw->type, pw->table_id);
+    }
+    put_bytes(pw->out, record->data, record->len);
+    pw->records++;
+}
+
+/* Appends an array to the open segment, SEGMENT_ALIGN aligned, and returns its offset from
+   the start of the page. Pages start on page boundaries, so the mapped array is aligned. */
+static uint64_t put_segment_array(PageWriter *pw, const void *data, size_t bytes) {
+    size_t pad = (SEGMENT_ALIGN - (pw->out->len - pw->start) % SEGMENT_ALIGN) % SEGMENT_ALIGN;
+    put_zeros(pw->out, pad);
+    uint64_t offset = pw->out->len - pw->start;
+    put_bytes(pw->out, data, bytes);
+    return offset;
+}
+
+static void patch_offsets(ByteBuf *out, size_t pos, const uint64_t *offsets, int count) {
+    if (out->failed)
+        return;
+    for (int i = 0; i < count; i++)
+        store_u64(out->data + pos + 8 * (size_t)i, offsets[i]);
+}
+
+/* Columnar tables whose vectors hold no pointers are written as one segment per column. */
+static bool table_mappable(const Table *table) {
+    if (table->storage != STORAGE_COLUMNAR || table->row_count == 0)
+        return false;
+    for (int c = 0; c < alist_length(&table->schema.columns); c++) {
+        DataType type = table->vectors[c].type;
+        if (type == TYPE_DECIMAL || type == TYPE_BLOB)
+            return false;
+    }
+    return true;
+}
+
+/* Sealed segments are written unpacked, so that the snapshot maps as one array per column. */
+static void put_column_segment(PageWriter *pw, const Table *table, uint16_t column_id) {
+    const ColumnVector *vec = &table->vectors[column_id];
+    ColumnVector plain;
+    if (vec->sealed > 0) {
+        if (!column_store_unpack(vec, &plain)) {
+            pw->out->failed = true;
+            return;
+        }
+        vec = &plain;
+    }
+    page_begin(pw, PAGE_COLUMN_SEGMENT, table->table_id);
+    put_u16(pw->out, column_id);
+    put_u8(pw->out, (uint8_t)vec->type);
+    put_u32(pw->out, (uint32_t)vec->length);
+    size_t pos = pw->out->len;
+    put_zeros(pw->out, 4 * 8);
+    size_t used = pw->out->len - pw->start - PAGE_HEADER_SIZE;
+
+    uint64_t offsets[4] = {0};
+    offsets[0] = put_segment_array(pw, vec->nulls, ((size_t)vec->length + 7) / 8);
+    offsets[1] = put_segment_array(pw, column_store_vector_data(vec),
+                                   (size_t)vec->length * column_store_element_size(vec->type));
+    if (vec->type == TYPE_STRING) {
+        offsets[2] = put_segment_array(pw, vec->strings.heap, vec->strings.heap_len);
+        offsets[3] = vec->strings.heap_len;
+    }
+    patch_offsets(pw->out, pos, offsets, 4);
+    pw->records = 1;
+    page_seal(pw, used);
+    if (vec == &plain)
+        column_store_free_vector(&plain);
+}
+
+/* Hash indexes with bytewise-copyable keys are written as their slot, control and overflow
+   arrays, along with the struct sizes they were laid out with. */
+static void put_hash_segment(PageWriter *pw, const Index *index) {
+    page_begin(pw, PAGE_HASH_SEGMENT, index->table_id);
+    put_index_def(pw->out, index);
+    put_u32(pw->out, (uint32_t)sizeof(HashSlot));
+    put_u32(pw->out, (uint32_t)sizeof(HashOverflow));
+    put_u32(pw->out, index->data.hash.capacity);
+    put_u32(pw->out, index->data.hash.used);
+    put_u32(pw->out, index->data.hash.key_count);
+    put_u32(pw->out, index->entry_count);
+    put_u32(pw->out, index->data.hash.overflow_len);
+    put_u32(pw->out, (uint32_t)index->data.hash.overflow_free);
+    size_t pos = pw->out->len;
+    put_zeros(pw->out, 3 * 8);
+    size_t used = pw->out->len - pw->start - PAGE_HEADER_SIZE;
+
+    uint64_t offsets[3] = {0};
+    offsets[0] = put_segment_array(pw, index->data.hash.slots,
+                                   sizeof(HashSlot) * index->data.hash.capacity);
+    offsets[1] = put_segment_array(pw, index->data.hash.ctrl, index->data.hash.capacity);
+    if (index->data.hash.overflow_len > 0)
+        offsets[2] = put_segment_array(pw, index->data.hash.overflow,
+                                       sizeof(HashOverflow) * index->data.hash.overflow_len);
+    patch_offsets(pw->out, pos, offsets, 3);
+    pw->records = 1;
+    page_seal(pw, used);
+}
+
+static void serialize_snapshot(ByteBuf *out, uint64_t checkpoint_lsn) {
+    put_zeros(out, STORAGE_PAGE_SIZE);
+
+    ByteBuf record = {0};
+    PageWriter pw = {.out = out};
+    page_begin(&pw, PAGE_CATALOG, 0);
+    for (int i = 0; i < alist_length(&tables); i++) {
+        record.len = 0;
+        put_table_def(&record, (const Table *)alist_get(&tables, i));
+        page_add(&pw, &record);
+    }
+    page_finish(&pw);
+
+    for (int i = 0; i < alist_length(&tables); i++) {
+        const Table *table = (const Table *)alist_get(&tables, i);
+        int row_count = table_row_count(table);
+        if (row_count == 0 || table->view)
+            continue;
+        if (table_mappable(table)) {
+            for (int c = 0; c < alist_length(&table->schema.columns); c++)
+                put_column_segment(&pw, table, (uint16_t)c);
+            continue;
+        }
+        page_begin(&pw, PAGE_ROWS, table->table_id);
+        for (int r = 0; r < row_count; r++) {
+            record.len = 0;
+            put_row(&record, table, r);
+            page_add(&pw, &record);
+        }
+        page_finish(&pw);
+    }
+
+    /* Indexes keep their catalog order: definitions to rebuild share index pages, mappable
+       hash indexes get a segment each. */
+    page_begin(&pw, PAGE_INDEXES, 0);
+    for (int i = 0; i < alist_length(&indexes); i++) {
+        const Index *index = (const Index *)alist_get(&indexes, i);
+        if (index->type == INDEX_TYPE_HASH && hash_index_relocatable(index)) {
+            page_finish(&pw);
+            put_hash_segment(&pw, index);
+            page_begin(&pw, PAGE_INDEXES, 0);
+            continue;
+        }
+        record.len = 0;
+        put_index_def(&record, index);
+        page_add(&pw, &record);
+    }
+    page_finish(&pw);
+
+    bool views = false;
+    for (int i = 0; i < alist_length(&tables); i++) {
+        const Table *table = (const Table *)alist_get(&tables, i);
+        if (!table->view)
+            continue;
+        if (!views)
+            page_begin(&pw, PAGE_VIEWS, 0);
+        views = true;
+        record.len = 0;
+        put_u16(&record, table->table_id);
+        put_str(&record, matview_sql(table->view));
+        page_add(&pw, &record);
+    }
+    if (views)
+        page_finish(&pw);
+    free(record.data);
+    out->failed |= record.failed;
+
+    if (out->failed)
+        return;
+    uint8_t *header = out->data;
+    memcpy(header, SNAPSHOT_MAGIC, 8);
+    store_u32(header + 8, STORAGE_VERSION);
+    store_u32(header + 12, STORAGE_PAGE_SIZE);
+    store_u64(header + 16, checkpoint_lsn);
+    store_u32(header + 24, (uint32_t)(out->len / STORAGE_PAGE_SIZE));
+    store_u32(header + 28, crc32_update(header, 28));
+}
+
+/* Writes the snapshot beside the old one and renames it into place, so a crash leaves
+   either the old or the new snapshot, never a mix. A mapping of the old file stays valid. */
+static bool write_snapshot(uint64_t checkpoint_lsn) {
+    ByteBuf out = {0};
+    serialize_snapshot(&out, checkpoint_lsn);
+    if (out.failed) {
+        log_msg(LOG_ERROR, "storage_checkpoint: Failed to build the snapshot");
+        free(out.data);
+        return false;
+    }
+
+    char tmp_path[STORAGE_PATH_LEN], path[STORAGE_PATH_LEN];
+    storage_path(tmp_path, sizeof(tmp_path), STORAGE_SNAPSHOT_FILE ".tmp");
+    storage_path(path, sizeof(path), STORAGE_SNAPSHOT_FILE);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_all(fd, out.data, out.len) && fsync(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+    free(out.data);
+    if (!ok || rename(tmp_path, path) != 0) {
+        log_msg(LOG_ERROR, "storage_checkpoint: Failed to write '%s': %s", path,
+                strerror(errno));
+        unlink(tmp_path);
+        return false;
+    }
+    sync_dir();
+    return true;
+}
+
+/* Snapshot loading. */
+
+static Table *restore_table(uint16_t table_id, const CreateTableNode *def) {
+    Table *table = (Table *)alist_append(&tables);
+    if (!table)
+        return NULL;
+    memclear(table, sizeof(Table));
+    strcopy(table->name, sizeof(table->name), def->table_name);
+    table->table_id = table_id;
+    alist_init(&table->rows, sizeof(Row), NULL);
+    alist_init(&table->schema.columns, sizeof(ColumnDef), NULL);
+    table->schema.strict = def->strict;
+    for (int i = 0; i < alist_length(&def->columns); i++)
+        *(ColumnDef *)alist_append(&table->schema.columns) =
+            *(const ColumnDef *)alist_get(&def->columns, i);
+    table->storage = def->storage;
+    if (table->storage == STORAGE_COLUMNAR && !column_store_init(table)) {
+        alist_remove(&tables, alist_length(&tables) - 1);
+        return NULL;
+    }
+    catalog_changed();
+    return table;
+}
+
+static bool segment_holds(size_t bytes, uint64_t offset, uint64_t length) {
+    return offset <= bytes && length <= bytes - offset;
+}
+
+static bool map_column_segment(StorageMap *map, uint8_t *page, size_t bytes, Table *table,
+                               Reader *r) {
+    uint16_t column_id = get_u16(r);
+    DataType type = (DataType)get_u8(r);
+    uint32_t length = get_u32(r);
+    uint64_t nulls_off = get_u64(r), data_off = get_u64(r);
+    uint64_t heap_off = get_u64(r), heap_len = get_u64(r);
+    if (!r->ok || !table || table->storage != STORAGE_COLUMNAR ||
+        column_id >= alist_length(&table->schema.columns) || length > INT32_MAX)
+        return false;
+
+    ColumnVector *vec = &table->vectors[column_id];
+    if (vec->type != type || vec->length != 0 ||
+        (table->row_count != 0 && table->row_count != (int)length) ||
+        !segment_holds(bytes, nulls_off, ((uint64_t)length + 7) / 8) ||
+        !segment_holds(bytes, data_off, (uint64_t)length * column_store_element_size(type)) ||
+        (type == TYPE_STRING && (!segment_holds(bytes, heap_off, heap_len) ||
+                                 (heap_len > 0 && page[heap_off + heap_len - 1] != '\0'))))
+        return false;
+
+    map->refs++;
+    column_store_map_vector(vec, (int)length, page + data_off, page + nulls_off,
+                            heap_len ? (char *)page + heap_off : NULL, (size_t)heap_len, map);
+    table->row_count = (int)length;
+    g_storage.stats.mapped++;
+    return true;
+}
+
+static bool map_hash_segment(StorageMap *map, uint8_t *page, size_t bytes, Reader *r) {
+    uint16_t table_id;
+    char name[MAX_TABLE_NAME_LEN];
+    IndexType type;
+    ArrayList column_ids;
+    int key_columns;
+    alist_init(&column_ids, sizeof(uint16_t), NULL);
+    get_index_def(r, &table_id, name, sizeof(name), &type, &column_ids, &key_columns);
+    uint32_t slot_size = get_u32(r), overflow_size = get_u32(r);
+    uint32_t capacity = get_u32(r), used = get_u32(r), key_count = get_u32(r);
+    uint32_t entry_count = get_u32(r), overflow_len = get_u32(r);
+    int overflow_free = (int)get_u32(r);
+    uint64_t slots_off = get_u64(r), ctrl_off = get_u64(r), overflow_off = get_u64(r);
+
+    bool ok = r->ok && get_table_by_id(table_id) != NULL && type == INDEX_TYPE_HASH &&
+              key_columns > 0 && key_columns == alist_length(&column_ids);
+    /* Built with a different Value layout, or hashed on the first column alone before
+       version 4: fall back to rebuilding from the table. */
+    if (ok && (slot_size != sizeof(HashSlot) || overflow_size != sizeof(HashOverflow) ||
+               (r->version < 4 && key_columns > 1))) {
+        index_table(table_id, &column_ids, key_columns, name, type);
+        alist_destroy(&column_ids);
+        return true;
+    }
+    ok = ok && capacity > 0 && (capacity & (capacity - 1)) == 0 &&
+         segment_holds(bytes, slots_off, (uint64_t)sizeof(HashSlot) * capacity) &&
+         segment_holds(bytes, ctrl_off, capacity) &&
+         (overflow_len == 0 ||
+          segment_holds(bytes, overflow_off, (uint64_t)sizeof(HashOverflow) * overflow_len));
+    Index *index = ok ? (Index *)alist_append(&indexes) : NULL;
+    if (!index) {
+        alist_destroy(&column_ids);
+        return false;
+    }
+
+    memclear(index, sizeof(Index));
+    strcopy(index->index_name, sizeof(index->index_name), name);
+    index->table_id = table_id;
+    index->type = INDEX_TYPE_HASH;
+    index->columns = column_ids;
+    index->key_count = (uint16_t)key_columns;
+    index->entry_count = entry_count;
+    index->data.hash.slots = (HashSlot *)(page + slots_off);
+    index->data.hash.ctrl = page + ctrl_off;
+    index->data.hash.capacity = capacity;
+    index->data.hash.used = used;
+    index->data.hash.key_count = key_count;
+    index->data.hash.overflow = overflow_len ? (HashOverflow *)(page + overflow_off) : NULL;
+    index->data.hash.overflow_len = overflow_len;
+    index->data.hash.overflow_cap = overflow_len;
+    index->data.hash.overflow_free = overflow_free;
+    index->data.hash.map = map;
+    catalog_indexes_changed();
+    map->refs++;
+    g_storage.stats.mapped++;
+    return true;
+}
+
+static bool load_page(StorageMap *map, uint8_t *page, size_t bytes, Reader *r) {
+    uint8_t type = page[4];
+    Table *table = get_table_by_id((uint16_t)(page[5] | page[6] << 8));
+    uint32_t records = load_u32(page + 8);
+    for (uint32_t i = 0; i < records && r->ok; i++) {
+        bool ok;
+        if (type == PAGE_CATALOG) {
+            CreateTableNode def;
+            memclear(&def, sizeof(def));
+            alist_init(&def.columns, sizeof(ColumnDef), NULL);
+            uint16_t id;
+            ok = get_table_def(r, &id, &def) && restore_table(id, &def) != NULL;
+            alist_destroy(&def.columns);
+        } else if (type == PAGE_ROWS) {
+            ok = table && get_row(r, table);
+        } else if (type == PAGE_INDEXES) {
+            ok = apply_index_def(r);
+        } else if (type == PAGE_COLUMN_SEGMENT) {
+            ok = map_column_segment(map, page, bytes, table, r);
+        } else if (type == PAGE_HASH_SEGMENT) {
+            ok = map_hash_segment(map, page, bytes, r);
+        } else if (type == PAGE_VIEWS) {
+            uint16_t table_id = get_table_id(r);
+            const char *sql = get_str(r);
+            ok = sql && matview_attach(table_id, sql);
+        } else {
+            ok = false;
+        }
+        if (!ok)
+            return false;
+    }
+    return r->ok;
+}
+
+void storage_map_release(StorageMap *map) {
+    if (!map || --map->refs > 0)
+        return;
+    munmap(map->base, map->length);
+    free(map);
+}
+
+/* Maps the snapshot instead of reading it: row pages are decoded in place and segments are
+   used where they lie, so opening costs a page walk rather than a pass over the data. */
+static bool load_snapshot(void) {
+    char path[STORAGE_PATH_LEN];
+    storage_path(path, sizeof(path), STORAGE_SNAPSHOT_FILE);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return true;
+        log_msg(LOG_ERROR, "storage_open: Cannot open '%s': %s", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    size_t size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    void *base = size >= STORAGE_PAGE_SIZE
+                     ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+                     : MAP_FAILED;
+    close(fd);
+    StorageMap *map = base != MAP_FAILED ? malloc(sizeof(StorageMap)) : NULL;
+    if (!map) {
+        log_msg(LOG_ERROR, "storage_open: Cannot map snapshot '%s'", path);
+        if (base != MAP_FAILED)
+            munmap(base, size);
+        return false;
+    }
+    map->base = base;
+    map->length = size;
+    map->refs = 1;
+
+    uint8_t *data = base;
+    uint32_t version = load_u32(data + 8);
+    bool ok = size % STORAGE_PAGE_SIZE == 0 && memcmp(data, SNAPSHOT_MAGIC, 8) == 0 &&
+              version >= 1 && version <= STORAGE_VERSION &&
+              load_u32(data + 12) == STORAGE_PAGE_SIZE &&
+              load_u32(data + 28) == crc32_update(data, 28);
+    if (ok)
+        g_storage.checkpoint_lsn = load_u64(data + 16);
+
+    size_t off = STORAGE_PAGE_SIZE;
+    while (ok && off < size) {
+        uint8_t *page = data + off;
+        uint32_t used = load_u32(page + 12);
+        size_t span = load_u32(page + 16);
+        size_t bytes = span * STORAGE_PAGE_SIZE;
+        ok = span > 0 && bytes <= size - off && used <= bytes - PAGE_HEADER_SIZE;
+        /* Version 1 checksummed whole pages. */
+        size_t crc_len = version == 1 ? bytes - 4 : PAGE_HEADER_SIZE - 4 + (size_t)used;
+        ok = ok && load_u32(page) == crc32_update(page + 4, crc_len);
+        if (ok) {
+            Reader r = {page + PAGE_HEADER_SIZE, page + PAGE_HEADER_SIZE + used, true,
+                        version};
+            ok = load_page(map, page, bytes, &r);
+        }
+        off += bytes;
+    }
+    storage_map_release(map);
+    if (!ok)
+        log_msg(LOG_ERROR, "storage_open: Snapshot '%s' is corrupt", path);
+    return ok;
+}
+
+/* Log replay. */
+
+/* The keep mask of a delete record, NULL when it does not fit table. */
+static bool *get_deleted_rows(Reader *r, const Table *table) {
+    uint32_t row_count = get_u32(r);
+    uint32_t deleted = get_u32(r);
+    if (!r->ok || row_count != (uint32_t)table_row_count(table))
+        return NULL;
+    bool *keep = malloc(sizeof(bool) * (row_count > 0 ? row_count : 1));
+    if (!keep)
+        return NULL;
+    for (uint32_t i = 0; i < row_count; i++)
+        keep[i] = true;
+    for (uint32_t i = 0; i < deleted && r->ok; i++) {
+        uint32_t row_idx = get_u32(r);
+        if (row_idx < row_count)
+            keep[row_idx] = false;
+        else
+            r->ok = false;
+    }
+    if (!r->ok) {
+        free(keep);
+        return NULL;
+    }
+    return keep;
+}
+
+static bool apply_record(Reader *r) {
+    WalRecordType type = (WalRecordType)get_u8(r);
+    switch (type) {
+    case WAL_CREATE_TABLE: {
+        ASTNode node;
+        memclear(&node, sizeof(node));
+        node.type = AST_CREATE_TABLE;
+        alist_init(&node.create_table.columns, sizeof(ColumnDef), NULL);
+        uint16_t table_id;
+        bool ok = get_table_def(r, &table_id, &node.create_table);
+        if (ok)
+            exec_create_table_ast(&node);
+        alist_destroy(&node.create_table.columns);
+        return ok;
+    }
+    case WAL_DROP_TABLE: {
+        ASTNode node;
+        memclear(&node, sizeof(node));
+        node.type = AST_DROP_TABLE;
+        node.drop_table.table_id = get_table_id(r);
+        Table *table = get_table_by_id(node.drop_table.table_id);
+        node.drop_table.view = table && table->view;
+        if (r->ok)
+            exec_drop_table_ast(&node);
+        return r->ok;
+    }
+    case WAL_CREATE_INDEX:
+        return apply_index_def(r);
+    case WAL_DROP_INDEX: {
+        char name[MAX_TABLE_NAME_LEN];
+        get_name(r, name, sizeof(name));
+        if (r->ok)
+            drop_index_by_name(name);
+        return r->ok;
+    }
+    case WAL_INSERT: {
+        Table *table = get_table_by_id(get_table_id(r));
+        return table && get_row(r, table);
+    }
+    case WAL_UPDATE: {
+        Table *table = get_table_by_id(get_table_id(r));
+        int row_idx = (int)get_u32(r);
+        uint16_t column_id = get_u16(r);
+        Value val = get_value(r);
+        if (!table || !r->ok || column_id >= alist_length(&table->schema.columns)) {
+            free_value(&val);
+            return false;
+        }
+        return table_set_value(table, row_idx, column_id, &val);
+    }
+    case WAL_DELETE:
+    case WAL_DELETE_IN_PLACE: {
+        Table *table = get_table_by_id(get_table_id(r));
+        bool *keep = table ? get_deleted_rows(r, table) : NULL;
+        if (!keep)
+            return false;
+        if (type == WAL_DELETE)
+            table_compact_rows(table, keep);
+        else
+            table_delete_rows(table, keep);
+        free(keep);
+        return true;
+    }
+    case WAL_CREATE_VIEW: {
+        ASTNode node;
+        memclear(&node, sizeof(node));
+        node.type = AST_CREATE_VIEW;
+        get_name(r, node.create_view.name, sizeof(node.create_view.name));
+        node.create_view.sql = (char *)get_str(r);
+        if (r->ok)
+            exec_create_view_ast(&node);
+        return r->ok;
+    }
+    }
+    return false;
+}
+
+/* Returns the offset just past the last intact frame. */
+static size_t replay_wal(const uint8_t *data, size_t size) {
+    size_t off = WAL_HEADER_SIZE;
+    while (size - off >= FRAME_HEADER_SIZE) {
+        const uint8_t *frame = data + off;
+        uint32_t len = load_u32(frame);
+        if (len > size - off - FRAME_HEADER_SIZE ||
+            load_u32(frame + 4) != crc32_update(frame + FRAME_HEADER_SIZE, len))
+            break;
+        uint64_t lsn = load_u64(frame + 8);
+        if (lsn > g_storage.checkpoint_lsn) {
+            Reader r = {frame + FRAME_HEADER_SIZE, frame + FRAME_HEADER_SIZE + len, true,
+                        g_storage.log_version};
+            while (r.ok && r.pos < r.end) {
+                if (!apply_record(&r)) {
+                    log_msg(LOG_ERROR, "storage_open: Log record at LSN %llu does not apply",
+                            (unsigned long long)lsn);
+                    break;
+                }
+            }
+            g_storage.stats.replayed++;
+        }
+        if (lsn > g_storage.last_lsn)
+            g_storage.last_lsn = lsn;
+        off += FRAME_HEADER_SIZE + len;
+    }
+    return off;
+}
+
+static bool write_wal_header(void) {
+    uint8_t header[WAL_HEADER_SIZE] = {0};
+    memcpy(header, WAL_MAGIC, 8);
+    store_u32(header + 8, STORAGE_VERSION);
+    g_storage.log_version = STORAGE_VERSION;
+    return ftruncate(g_storage.wal_fd, 0) == 0 &&
+           write_all(g_storage.wal_fd, header, sizeof(header));
+}
+
+static bool open_wal(void) {
+    char path[STORAGE_PATH_LEN];
+    storage_path(path, sizeof(path), STORAGE_WAL_FILE);
+    size_t size;
+    bool missing;
+    uint8_t *data = read_file(path, &size, &missing);
+    if (!data && !missing)
+        return false;
+
+    size_t end = 0;
+    g_storage.log_version = STORAGE_VERSION;
+    if (data && size >= WAL_HEADER_SIZE && memcmp(data, WAL_MAGIC, 8) == 0) {
+        g_storage.log_version = load_u32(data + 8);
+        g_storage.replaying = true;
+        end = replay_wal(data, size);
+        g_storage.replaying = false;
+        if (end < size)
+            log_msg(LOG_WARN, "storage_open: Discarding %zu bytes of torn log tail", size - end);
+    } else if (data && size > 0) {
+        log_msg(LOG_ERROR, "storage_open: '%s' is not a log file", path);
+        free(data);
+        return false;
+    }
+    free(data);
+
+    g_storage.wal_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (g_storage.wal_fd < 0) {
+        log_msg(LOG_ERROR, "storage_open: Cannot open '%s': %s", path, strerror(errno));
+        return false;
+    }
+    if (end == 0 || (g_storage.log_version < STORAGE_VERSION && end == WAL_HEADER_SIZE)) {
+        if (!write_wal_header())
+            return false;
+        end = WAL_HEADER_SIZE;
+    } else if (end < size && ftruncate(g_storage.wal_fd, (off_t)end) != 0) {
+        return false;
+    }
+    g_storage.stats.wal_bytes = end;
+    return fsync(g_storage.wal_fd) == 0;
+}
+
+static long long usec_since(const struct timespec *then) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - then->tv_sec) * 1000000LL + (now.tv_nsec - then->tv_nsec) / 1000;
+}
+
+/* Syncs the frames written since the last fsync once group_usec has passed since it, so a
+   commit is on disk within about group_usec even when no later commit comes; a full group
+   is synced by storage_commit itself. */
+static void *flusher_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_storage.sync_lock);
+    while (!g_storage.flusher_stop) {
+        long long wait =
+            g_storage.group_usec > 0 ? g_storage.group_usec : WAL_GROUP_COMMIT_USEC;
+        if (g_storage.unsynced > 0)
+            wait -= usec_since(&g_storage.last_sync);
+        if (g_storage.unsynced == 0 || wait > 0) {
+            struct timespec until;
+            clock_gettime(CLOCK_MONOTONIC, &until);
+            long long nsec = until.tv_nsec + wait * 1000;
+            until.tv_sec += (time_t)(nsec / 1000000000LL);
+            until.tv_nsec = (long)(nsec % 1000000000LL);
+            pthread_cond_timedwait(&g_storage.flusher_wake, &g_storage.sync_lock, &until);
+            continue;
+        }
+        pthread_mutex_unlock(&g_storage.sync_lock);
+        storage_sync();
+        pthread_mutex_lock(&g_storage.sync_lock);
+    }
+    pthread_mutex_unlock(&g_storage.sync_lock);
+    return NULL;
+}
+
+static bool start_flusher(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_storage.flusher_wake, &attr);
+    pthread_condattr_destroy(&attr);
+    g_storage.flusher_stop = false;
+    if (pthread_create(&g_storage.flusher, NULL, flusher_main, NULL) != 0) {
+        log_msg(LOG_ERROR, "storage_open: Cannot start the log flusher");
+        pthread_cond_destroy(&g_storage.flusher_wake);
+        return false;
+    }
+    g_storage.flusher_running = true;
+    return true;
+}
+
+static void stop_flusher(void) {
+    if (!g_storage.flusher_running)
+        return;
+    pthread_mutex_lock(&g_storage.sync_lock);
+    g_storage.flusher_stop = true;
+    pthread_cond_signal(&g_storage.flusher_wake);
+    pthread_mutex_unlock(&g_storage.sync_lock);
+    pthread_join(g_storage.flusher, NULL);
+    pthread_cond_destroy(&g_storage.flusher_wake);
+    g_storage.flusher_running = false;
+}
+
+/* Public interface. */
+
+bool storage_open(const char *dir) {
+    if (storage_is_open()) {
+        log_msg(LOG_ERROR, "storage_open: Storage is already open in '%s'", g_storage.dir);
+        return false;
+    }
+    if (alist_length(&tables) > 0) {
+        log_msg(LOG_ERROR, "storage_open: The database must be empty before loading '%s'", dir);
+        return false;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        log_msg(LOG_ERROR, "storage_open: Cannot create '%s': %s", dir, strerror(errno));
+        return false;
+    }
+
+    strcopy(g_storage.dir, sizeof(g_storage.dir), dir);
+    g_storage.pending.len = 0;
+    g_storage.last_lsn = 0;
+    g_storage.checkpoint_lsn = 0;
+    g_storage.unsynced = 0;
+    memclear(&g_storage.stats, sizeof(g_storage.stats));
+    clock_gettime(CLOCK_MONOTONIC, &g_storage.last_sync);
+
+    if (!load_snapshot() || !open_wal()) {
+        if (g_storage.wal_fd >= 0)
+            close(g_storage.wal_fd);
+        g_storage.wal_fd = -1;
+        return false;
+    }
+    if (g_storage.last_lsn < g_storage.checkpoint_lsn)
+        g_storage.last_lsn = g_storage.checkpoint_lsn;
+    g_storage.stats.lsn = g_storage.last_lsn;
+    /* New records cannot go on a log of an older version: fold it into a snapshot first. */
+    if (g_storage.log_version < STORAGE_VERSION &&
+        (!storage_checkpoint() || !write_wal_header() || fsync(g_storage.wal_fd) != 0)) {
+        log_msg(LOG_ERROR, "storage_open: Cannot upgrade the log in '%s'", dir);
+        storage_close(false);
+        return false;
+    }
+
+    if (!start_flusher()) {
+        storage_close(false);
+        return false;
+    }
+    log_msg(LOG_INFO, "Opened storage in '%s': %d tables, %llu log frames replayed", dir,
+            alist_length(&tables), (unsigned long long)g_storage.stats.replayed);
+    return true;
+}
+
+void storage_close(bool checkpoint) {
+    if (!storage_is_open())
+        return;
+    stop_flusher();
+    storage_commit();
+    if (checkpoint)
+        storage_checkpoint();
+    storage_sync();
+    close(g_storage.wal_fd);
+    g_storage.wal_fd = -1;
+    free(g_storage.pending.data);
+    g_storage.pending = (ByteBuf){0};
+}
+
+bool storage_is_open(void) {
+    return g_storage.wal_fd >= 0;
+}
+
+/* Makes every frame written so far durable. The lock is not held across the fsync, so the
+   statement thread keeps appending while the flusher waits on the disk. One fsync runs at a
+   time: a second caller waits for it, then syncs only what it did not cover. */
+bool storage_sync(void) {
+    if (!storage_is_open())
+        return true;
+    pthread_mutex_lock(&g_storage.sync_lock);
+    while (g_storage.syncing)
+        pthread_cond_wait(&g_storage.sync_done, &g_storage.sync_lock);
+    int pending = g_storage.unsynced;
+    if (pending == 0) {
+        pthread_mutex_unlock(&g_storage.sync_lock);
+        return true;
+    }
+    g_storage.syncing = true;
+    pthread_mutex_unlock(&g_storage.sync_lock);
+
+    bool ok = fsync(g_storage.wal_fd) == 0;
+    if (!ok)
+        log_msg(LOG_ERROR, "storage_sync: fsync failed: %s", strerror(errno));
+
+    pthread_mutex_lock(&g_storage.sync_lock);
+    if (ok) {
+        g_storage.unsynced -= pending;
+        g_storage.stats.syncs++;
+        clock_gettime(CLOCK_MONOTONIC, &g_storage.last_sync);
+    }
+    g_storage.syncing = false;
+    pthread_cond_broadcast(&g_storage.sync_done);
+    pthread_mutex_unlock(&g_storage.sync_lock);
+    return ok;
+}
+
+/* The snapshot holds the committed rows only, which are not told apart from other row
+   versions in the page format, so checkpoints wait until no table is versioned. */
+static bool tables_versioned(void) {
+    for (int i = 0; i < alist_length(&tables); i++)
+        if (((const Table *)alist_get(&tables, i))->versions)
+            return true;
+    return false;
+}
+
+/* Ends the current statement: its records go to the log as one frame. The fsync is shared
+   with the statements around it, see WAL_GROUP_COMMIT_MAX; the flusher thread syncs a group
+   that does not fill up in time. */
+void storage_commit(void) {
+    ByteBuf *frame = &g_storage.pending;
+    if (!storage_is_open() || frame->len == 0)
+        return;
+    if (frame->failed) {
+        log_msg(LOG_ERROR, "storage_commit: Statement changes were not logged");
+        frame->len = 0;
+        frame->failed = false;
+        return;
+    }
+
+    uint32_t len = (uint32_t)(frame->len - FRAME_HEADER_SIZE);
+    store_u32(frame->data, len);
+    store_u32(frame->data + 4, crc32_update(frame->data + FRAME_HEADER_SIZE, len));
+    store_u64(frame->data + 8, g_storage.last_lsn + 1);
+    bool ok = write_all(g_storage.wal_fd, frame->data, frame->len);
+    if (ok) {
+        g_storage.last_lsn++;
+        g_storage.stats.lsn = g_storage.last_lsn;
+        g_storage.stats.commits++;
+        g_storage.stats.wal_bytes += frame->len;
+    }
+    frame->len = 0;
+    if (!ok)
+        return;
+
+    pthread_mutex_lock(&g_storage.sync_lock);
+    if (g_storage.unsynced++ == 0)
+        pthread_cond_signal(&g_storage.flusher_wake);
+    bool due = g_storage.unsynced >= g_storage.group_max ||
+               usec_since(&g_storage.last_sync) >= g_storage.group_usec;
+    pthread_mutex_unlock(&g_storage.sync_lock);
+    if (due)
+        storage_sync();
+
+    if (g_storage.stats.wal_bytes >= WAL_CHECKPOINT_BYTES && !tables_versioned())
+        storage_checkpoint();
+}
+
+/* The snapshot has no room for deleted rows, so they are compacted away first, and the
+   compaction logged in case the snapshot is never written. */
+static void purge_deleted_rows(void) {
+    for (int t = 0; t < alist_length(&tables); t++) {
+        Table *table = (Table *)alist_get(&tables, t);
+        if (!table->tombstones)
+            continue;
+        int row_count = table_row_count(table);
+        bool *keep = malloc(sizeof(bool) * (size_t)row_count);
+        if (!keep) {
+            log_msg(LOG_ERROR, "purge_deleted_rows: Failed to allocate row mask");
+            continue;
+        }
+        for (int i = 0; i < row_count; i++)
+            keep[i] = !table_row_deleted(table, i);
+        wal_log_delete(table, keep, row_count);
+        table_compact_rows(table, keep);
+        free(keep);
+    }
+}
+
+/* Snapshots the catalog and truncates the log. The snapshot records the LSN it covers, so
+   a crash before the truncate only makes recovery skip frames it already contains. */
+bool storage_checkpoint(void) {
+    if (!storage_is_open()) {
+        log_msg(LOG_ERROR, "storage_checkpoint: No storage directory is open");
+        return false;
+    }
+    if (tables_versioned()) {
+        log_msg(LOG_WARN, "storage_checkpoint: Deferred while transactions are open");
+        return false;
+    }
+    purge_deleted_rows();
+    storage_commit();
+    if (!storage_sync() || !write_snapshot(g_storage.last_lsn))
+        return false;
+    g_storage.checkpoint_lsn = g_storage.last_lsn;
+    if (ftruncate(g_storage.wal_fd, WAL_HEADER_SIZE) != 0 || fsync(g_storage.wal_fd) != 0) {
+        log_msg(LOG_ERROR, "storage_checkpoint: Failed to truncate the log: %s",
+                strerror(errno));
+        return false;
+    }
+    g_storage.stats.wal_bytes = WAL_HEADER_SIZE;
+    g_storage.stats.checkpoints++;
+    log_msg(LOG_INFO, "Checkpoint at LSN %llu", (unsigned long long)g_storage.last_lsn);
+    return true;
+}
+
+void storage_set_group_commit(int max_commits, int interval_usec) {
+    pthread_mutex_lock(&g_storage.sync_lock);
+    g_storage.group_max = max_commits > 0 ? max_commits : 1;
+    g_storage.group_usec = interval_usec >= 0 ? interval_usec : 0;
+    if (g_storage.flusher_running)
+        pthread_cond_signal(&g_storage.flusher_wake);
+    pthread_mutex_unlock(&g_storage.sync_lock);
+}
+
+void storage_get_stats(StorageStats *stats) {
+    pthread_mutex_lock(&g_storage.sync_lock);
+    *stats = g_storage.stats;
+    stats->unsynced = (uint64_t)g_storage.unsynced;
+    pthread_mutex_unlock(&g_storage.sync_lock);
+}
+
+/* Logging hooks called by the executor after each change has been applied. */
+
+static ByteBuf *begin_record(WalRecordType type) {
+    if (!storage_is_open() || g_storage.replaying)
+        return NULL;
+    ByteBuf *frame = &g_storage.pending;
+    if (frame->len == 0)
+        put_zeros(frame, FRAME_HEADER_SIZE);
+    put_u8(frame, (uint8_t)type);
+    return frame;
+}
+
+void wal_log_create_table(const Table *table) {
+    ByteBuf *buf = begin_record(WAL_CREATE_TABLE);
+    if (buf)
+        put_table_def(buf, table);
+}
+
+void wal_log_drop_table(uint16_t table_id) {
+    ByteBuf *buf = begin_record(WAL_DROP_TABLE);
+    if (buf)
+        put_u16(buf, table_id);
+}
+
+void wal_log_create_index(const Index *index) {
+    ByteBuf *buf = begin_record(WAL_CREATE_INDEX);
+    if (buf)
+        put_index_def(buf, index);
+}
+
+void wal_log_drop_index(const char *index_name) {
+    ByteBuf *buf = begin_record(WAL_DROP_INDEX);
+    if (buf)
+        put_str(buf, index_name);
+}
+
+void wal_log_create_view(const char *name, const char *sql) {
+    ByteBuf *buf = begin_record(WAL_CREATE_VIEW);
+    if (!buf)
+        return;
+    put_str(buf, name);
+    put_str(buf, sql);
+}
+
+void wal_log_insert(const Table *table, int row_idx) {
+    ByteBuf *buf = begin_record(WAL_INSERT);
+    if (!buf)
+        return;
+    put_u16(buf, table->table_id);
+    put_row(buf, table, row_idx);
+}
+
+void wal_log_update(const Table *table, int row_idx, uint16_t column_id) {
+    ByteBuf *buf = begin_record(WAL_UPDATE);
+    if (!buf)
+        return;
+    Value val = table_get_value(table, row_idx, column_id);
+    put_u16(buf, table->table_id);
+    put_u32(buf, (uint32_t)row_idx);
+    put_u16(buf, column_id);
+    put_value(buf, &val);
+}
+
+static void put_deleted_rows(WalRecordType type, const Table *table, const bool *keep,
+                             int row_count) {
+    ByteBuf *buf = begin_record(type);
+    if (!buf)
+        return;
+    uint32_t deleted = 0;
+    for (int i = 0; i < row_count; i++)
+        deleted += keep[i] ? 0 : 1;
+    put_u16(buf, table->table_id);
+    put_u32(buf, (uint32_t)row_count);
+    put_u32(buf, deleted);
+    for (int i = 0; i < row_count; i++)
+        if (!keep[i])
+            put_u32(buf, (uint32_t)i);
+}
+
+/* keep is the mask handed to table_compact_rows, over the row_count rows before the delete. */
+void wal_log_delete(const Table *table, const bool *keep, int row_count) {
+    put_deleted_rows(WAL_DELETE, table, keep, row_count);
+}
+
+/* As wal_log_delete, for the mask handed to table_delete_rows. */
+void wal_log_delete_in_place(const Table *table, const bool *keep, int row_count) {
+    put_deleted_rows(WAL_DELETE_IN_PLACE, table, keep, row_count);
+}
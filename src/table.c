@@ -6,13 +6,21 @@
 
 #include "arraylist.h"
 #include "db.h"
+#include "executor.h"
 #include "logger.h"
+#include "metrics.h"
+#include "txn.h"
 #include "utils.h"
 #include "values.h"
 
 ArrayList tables;
 ArrayList indexes;
 static void free_index(void *ptr);
+static void index_insert_row(Table *table, int row_idx);
+static void index_remove_value(Table *table, int row_idx, uint16_t column_id);
+static void index_remove_row(Table *table, int row_idx);
+static void index_add_value(Table *table, int row_idx, uint16_t column_id);
+static void index_remap_rows(Table *table, const bool *keep, int old_count);
 
 void copy_row(Row *dst, const Row *src, int column_count) {
     if (!dst || !src)
@@ -30,13 +38,58 @@ void copy_row(Row *dst, const Row *src, int column_count) {
     }
 }
 
+/* Row values live in fixed-size slots of the table's pool rather than one malloc per row;
+   a row's ArrayList never grows past the column count, so its slot is never reallocated. */
+bool table_row_init(Table *table, Row *row) {
+    int cols = alist_length(&table->schema.columns);
+    if (table->row_pool.element_size == 0)
+        pool_init(&table->row_pool, sizeof(Value) * (size_t)(cols > 0 ? cols : 1));
+    row->data = pool_alloc(&table->row_pool);
+    row->element_size = sizeof(Value);
+    row->length = 0;
+    row->capacity = cols;
+    row->free_func = NULL;
+    return row->data != NULL;
+}
+
+void table_row_free(Table *table, Row *row) {
+    for (int i = 0; i < alist_length(row); i++)
+        free_value(alist_get(row, i));
+    pool_free(&table->row_pool, row->data);
+    row->data = NULL;
+    row->length = 0;
+}
+
+static void free_row_storage(Table *table) {
+    if (table->rows.data != NULL) {
+        for (int i = 0; i < alist_length(&table->rows); i++)
+            table_row_free(table, (Row *)alist_get(&table->rows, i));
+        alist_destroy(&table->rows);
+    }
+    pool_destroy(&table->row_pool);
+}
+
+static void tombstones_free(Table *table) {
+    if (!table->tombstones)
+        return;
+    free(table->tombstones->bits);
+    free(table->tombstones);
+    table->tombstones = NULL;
+}
+
 void free_table_internal(void *ptr) {
     Table *table = (Table *)ptr;
     if (!table)
         return;
 
-    if (table->rows.data != NULL) {
-        alist_destroy(&table->rows);
+    if (table->view)
+        matview_free(table->view);
+    free_row_storage(table);
+    row_versions_free(table);
+    tombstones_free(table);
+    zone_map_free(table);
+    if (table->storage == STORAGE_COLUMNAR) {
+        column_store_free(table);
     }
     if (table->schema.columns.data != NULL) {
         alist_destroy(&table->schema.columns);
@@ -46,21 +99,258 @@ void free_table_internal(void *ptr) {
 void free_table(Table *table) {
     if (!table)
         return;
-    if (table->rows.data != NULL) {
-        alist_destroy(&table->rows);
+    free_row_storage(table);
+    row_versions_free(table);
+    tombstones_free(table);
+    zone_map_free(table);
+    if (table->storage == STORAGE_COLUMNAR) {
+        column_store_free(table);
     }
     if (table->schema.columns.data != NULL) {
         alist_destroy(&table->schema.columns);
     }
 }
 
+int table_row_count(const Table *table) {
+    if (table->storage == STORAGE_COLUMNAR)
+        return table->row_count;
+    return alist_length(&table->rows);
+}
+
+Value table_get_value(const Table *table, int row_idx, uint16_t column_id) {
+    if (table->storage == STORAGE_COLUMNAR)
+        return column_store_get_value(table, row_idx, column_id);
+
+    Value val = {0};
+    val.type = TYPE_NULL;
+    Row *row = (Row *)alist_get(&table->rows, row_idx);
+    if (row && column_id < alist_length(row))
+        val = *(Value *)alist_get(row, column_id);
+    return val;
+}
+
+const Row *table_fetch_row(const Table *table, int row_idx, Row *scratch) {
+    if (table->storage == STORAGE_COLUMNAR) {
+        if (row_idx < 0 || row_idx >= table->row_count)
+            return NULL;
+        column_store_fetch_row(table, row_idx, scratch);
+        return scratch;
+    }
+    return (const Row *)alist_get(&table->rows, row_idx);
+}
+
+/* Swaps an owned string stored into a DICTIONARY column for its interned copy. Columnar
+   tables keep all strings in their vector's heap instead. */
+static void intern_column_value(const Table *table, uint16_t column_id, Value *val) {
+    if (table->storage != STORAGE_ROW || val->type != TYPE_STRING ||
+        val->str_format == VALUE_STR_INTERNED)
+        return;
+    const ColumnDef *col = (const ColumnDef *)alist_get(&table->schema.columns, column_id);
+    if (!col || !(col->flags & COL_FLAG_DICTIONARY))
+        return;
+    Value interned = string_intern(value_str(val));
+    free_value(val);
+    *val = interned;
+}
+
+static bool append_row(Table *table, Row *row, bool indexed) {
+    if (table->storage == STORAGE_COLUMNAR) {
+        bool ok = column_store_append_row(table, row);
+        table_row_free(table, row);
+        if (ok) {
+            row_versions_append(table);
+            zone_map_append(table);
+            if (indexed)
+                index_insert_row(table, table->row_count - 1);
+        }
+        return ok;
+    }
+    Row *slot = (Row *)alist_append(&table->rows);
+    if (!slot) {
+        table_row_free(table, row);
+        return false;
+    }
+    for (int c = 0; c < alist_length(row); c++)
+        intern_column_value(table, (uint16_t)c, (Value *)alist_get(row, c));
+    *slot = *row;
+    row_versions_append(table);
+    zone_map_append(table);
+    if (indexed)
+        index_insert_row(table, alist_length(&table->rows) - 1);
+    return true;
+}
+
+bool table_append_row(Table *table, Row *row) {
+    return append_row(table, row, true);
+}
+
+/* Appends without touching the table's indexes; a bulk load calls
+   table_index_appended_rows once it has appended all of its rows. */
+bool table_append_row_unindexed(Table *table, Row *row) {
+    return append_row(table, row, false);
+}
+
+bool table_set_value(Table *table, int row_idx, uint16_t column_id, Value *val) {
+    if (row_idx < 0 || row_idx >= table_row_count(table)) {
+        free_value(val);
+        return false;
+    }
+
+    Value old = table_get_value(table, row_idx, column_id);
+    bool was_null = is_null(&old);
+    index_remove_value(table, row_idx, column_id);
+    bool ok;
+    if (table->storage == STORAGE_COLUMNAR) {
+        ok = column_store_set_value(table, row_idx, column_id, val);
+        free_value(val);
+    } else {
+        Row *row = (Row *)alist_get(&table->rows, row_idx);
+        Value *row_val = row ? (Value *)alist_get(row, column_id) : NULL;
+        ok = row_val != NULL;
+        if (row_val) {
+            free_value(row_val);
+            intern_column_value(table, column_id, val);
+            *row_val = *val;
+        } else {
+            free_value(val);
+        }
+    }
+    index_add_value(table, row_idx, column_id);
+    zone_map_update(table, row_idx, column_id, was_null);
+    return ok;
+}
+
+/* Moves the deleted marks along with the rows table_compact_rows keeps. */
+static void tombstones_compact(Table *table, const bool *keep, int old_count) {
+    Tombstones *dead = table->tombstones;
+    if (!dead)
+        return;
+    int dst = 0;
+    dead->count = 0;
+    for (int i = 0; i < old_count; i++) {
+        if (!keep[i])
+            continue;
+        if (dst < dead->capacity) {
+            bool bit = table_row_deleted(table, i);
+            dead->bits[dst / 8] = (uint8_t)((dead->bits[dst / 8] & ~(1u << (dst % 8))) |
+                                            ((unsigned)bit << (dst % 8)));
+            dead->count += bit;
+        }
+        dst++;
+    }
+    if (dead->count == 0) {
+        tombstones_free(table);
+        return;
+    }
+    for (int i = dst; i < dead->capacity; i++)
+        dead->bits[i / 8] &= (uint8_t)~(1u << (i % 8));
+}
+
+void table_compact_rows(Table *table, const bool *keep) {
+    int old_count = table_row_count(table);
+    row_versions_compact(table, keep);
+    tombstones_compact(table, keep, old_count);
+    zone_map_free(table);
+    if (table->storage == STORAGE_COLUMNAR) {
+        column_store_compact(table, keep);
+        index_remap_rows(table, keep, old_count);
+        return;
+    }
+
+    int row_count = alist_length(&table->rows);
+    int dst = 0;
+    for (int i = 0; i < row_count; i++) {
+        Row *row = (Row *)alist_get(&table->rows, i);
+        if (!keep[i]) {
+            table_row_free(table, row);
+            continue;
+        }
+        if (dst != i)
+            alist_set(&table->rows, dst, row);
+        dst++;
+    }
+    table->rows.length = dst;
+    index_remap_rows(table, keep, old_count);
+}
+
+static bool tombstones_reserve(Table *table, int rows) {
+    Tombstones *dead = table->tombstones;
+    if (!dead) {
+        dead = calloc(1, sizeof(Tombstones));
+        if (!dead)
+            return false;
+        table->tombstones = dead;
+    }
+    if (rows <= dead->capacity)
+        return true;
+    int capacity = dead->capacity > 0 ? dead->capacity : 64;
+    while (capacity < rows)
+        capacity *= 2;
+    uint8_t *bits = realloc(dead->bits, (size_t)(capacity + 7) / 8);
+    if (!bits)
+        return false;
+    memclear(bits + (dead->capacity + 7) / 8,
+             (size_t)((capacity + 7) / 8 - (dead->capacity + 7) / 8));
+    dead->bits = bits;
+    dead->capacity = capacity;
+    return true;
+}
+
+/* Deletes the rows keep clears by marking them, so the other rows keep their numbers and
+   a DELETE of a few rows touches only those and their index entries. The table is compacted
+   once a TOMBSTONE_COMPACT_FRACTION of its rows are deleted. The log and its replay both go
+   through here, so they compact at the same points and number rows alike. */
+void table_delete_rows(Table *table, const bool *keep) {
+    int row_count = table_row_count(table);
+    if (!tombstones_reserve(table, row_count)) {
+        log_msg(LOG_WARN, "table_delete_rows: Out of memory marking rows, compacting '%s'",
+                table->name);
+        table_compact_rows(table, keep);
+        return;
+    }
+    Tombstones *dead = table->tombstones;
+    for (int i = 0; i < row_count; i++) {
+        if (keep[i] || table_row_deleted(table, i))
+            continue;
+        index_remove_row(table, i);
+        dead->bits[i / 8] |= (uint8_t)(1u << (i % 8));
+        dead->count++;
+    }
+    if (dead->count == 0)
+        tombstones_free(table);
+    else if ((long long)dead->count * TOMBSTONE_COMPACT_FRACTION >= row_count)
+        table_purge_deleted(table);
+}
+
+/* Compacts away every deleted row. Row numbers move, so callers that log changes must log
+   this too, see storage_checkpoint. */
+void table_purge_deleted(Table *table) {
+    if (!table->tombstones)
+        return;
+    int row_count = table_row_count(table);
+    bool *keep = malloc(sizeof(bool) * (size_t)(row_count > 0 ? row_count : 1));
+    if (!keep) {
+        log_msg(LOG_ERROR, "table_purge_deleted: Failed to allocate row mask");
+        return;
+    }
+    for (int i = 0; i < row_count; i++)
+        keep[i] = !table_row_deleted(table, i);
+    log_msg(LOG_DEBUG, "table_purge_deleted: Compacting %d deleted rows of '%s'",
+            table->tombstones->count, table->name);
+    table_compact_rows(table, keep);
+    free(keep);
+}
+
+int table_live_row_count(const Table *table) {
+    return table_row_count(table) - (table->tombstones ? table->tombstones->count : 0);
+}
+
+/* Interned strings are shared, so copying one copies the pointer. */
 Value copy_value(const Value *src) {
     Value dst = *src;
-    if (src->type == TYPE_STRING && src->char_val != NULL) {
-        dst.char_val = malloc(strlen(src->char_val) + 1);
-        if (dst.char_val) {
-            strcopy(dst.char_val, strlen(src->char_val) + 1, src->char_val);
-        }
+    if (src->type == TYPE_STRING && src->str_format != VALUE_STR_INTERNED &&
+        value_str(src) != NULL) {
+        dst = make_string_value(value_str(src));
     } else if (src->type == TYPE_BLOB && src->blob_val.data != NULL && src->blob_val.length > 0) {
         dst.blob_val.data = malloc(src->blob_val.length);
         if (dst.blob_val.data) {
@@ -70,12 +360,27 @@ Value copy_value(const Value *src) {
     return dst;
 }
 
+/* Like copy_value, but the copy lives (and dies) with arena. Strings always come back with
+   a usable char_val: interned ones are shared, the rest are copied into the arena. */
+Value copy_value_to_arena(Arena *arena, const Value *src) {
+    Value dst = *src;
+    if (src->type == TYPE_STRING && src->str_format != VALUE_STR_INTERNED &&
+        value_str(src) != NULL) {
+        dst.str_format = VALUE_STR_PTR;
+        dst.char_val = arena_strdup(arena, value_str(src));
+    } else if (src->type == TYPE_BLOB && src->blob_val.data != NULL && src->blob_val.length > 0)
+        dst.blob_val.data = arena_memdup(arena, src->blob_val.data, src->blob_val.length);
+    return dst;
+}
+
 void free_value(void *ptr) {
     Value *val = (Value *)ptr;
     if (!val)
         return;
-    if (val->type == TYPE_STRING && val->char_val) {
-        free(val->char_val);
+    if (val->type == TYPE_STRING) {
+        if (val->str_format == VALUE_STR_PTR)
+            free(val->char_val);
+        val->str_format = VALUE_STR_PTR;
         val->char_val = NULL;
     } else if (val->type == TYPE_BLOB && val->blob_val.data) {
         free(val->blob_val.data);
@@ -85,49 +390,174 @@ void free_value(void *ptr) {
     val->type = TYPE_NULL;
 }
 
-Table *find_table(const char *name) {
-    ParseContext *ctx = parse_get_context();
-    if (ctx && ctx->current_table && strcmp(ctx->current_table->name, name) == 0) {
-        return ctx->current_table;
+/* The catalog maps. Tables and indexes live by value in their lists, which move them as
+   they grow and shrink, so the maps hold list positions; they are rebuilt whenever either
+   list changes, which DDL does rarely enough that a rebuild costs nothing next to the
+   lookups it saves. A position is checked against its entry before it is trusted. */
+typedef struct {
+    int *table_pos; /* by table id, -1 when the id is free */
+    int id_capacity;
+    int *table_names; /* open addressing by name: position + 1, 0 when empty */
+    int *index_names;
+    int table_slots;
+    int index_slots;
+    /* A table's indexes, in list order, are index_order[index_start[id] .. index_start[id + 1]) */
+    int *index_start;
+    int *index_order;
+} Catalog;
+
+static Catalog g_catalog;
+
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    for (const char *c = name; *c; c++)
+        h = (h ^ (uint8_t)*c) * 16777619u;
+    return h;
+}
+
+static int name_slots_for(int count) {
+    int slots = 16;
+    while (slots < count * 2)
+        slots *= 2;
+    return slots;
+}
+
+static void name_map_add(int *map, int slots, const char *name, int pos) {
+    uint32_t slot = name_hash(name) & (uint32_t)(slots - 1);
+    while (map[slot])
+        slot = (slot + 1) & (uint32_t)(slots - 1);
+    map[slot] = pos + 1;
+}
+
+static Table *table_at(int pos) {
+    return pos >= 0 && pos < alist_length(&tables) ? (Table *)alist_get(&tables, pos) : NULL;
+}
+
+static Index *index_at(int pos) {
+    return pos >= 0 && pos < alist_length(&indexes) ? (Index *)alist_get(&indexes, pos) : NULL;
+}
+
+static bool catalog_reserve(int **array, int count) {
+    int *grown = realloc(*array, sizeof(int) * (size_t)(count > 0 ? count : 1));
+    if (!grown)
+        return false;
+    *array = grown;
+    return true;
+}
+
+/* On allocation failure the maps are left empty and every lookup misses, which DDL reports
+   as a missing table rather than corrupting anything. */
+static void catalog_rebuild(void) {
+    Catalog *cat = &g_catalog;
+    int table_count = alist_length(&tables);
+    int index_count = alist_length(&indexes);
+    int max_id = 0;
+    for (int i = 0; i < table_count; i++)
+        if (table_at(i)->table_id > max_id)
+            max_id = table_at(i)->table_id;
+
+    int id_capacity = max_id + 2;
+    int table_slots = name_slots_for(table_count);
+    int index_slots = name_slots_for(index_count);
+    if (!catalog_reserve(&cat->table_pos, id_capacity) ||
+        !catalog_reserve(&cat->index_start, id_capacity + 1) ||
+        !catalog_reserve(&cat->table_names, table_slots) ||
+        !catalog_reserve(&cat->index_names, index_slots) ||
+        !catalog_reserve(&cat->index_order, index_count)) {
+        log_msg(LOG_ERROR, "catalog_rebuild: Failed to allocate the catalog maps");
+        cat->id_capacity = cat->table_slots = cat->index_slots = 0;
+        return;
+    }
+    cat->id_capacity = id_capacity;
+    cat->table_slots = table_slots;
+    cat->index_slots = index_slots;
+
+    for (int id = 0; id < id_capacity; id++)
+        cat->table_pos[id] = -1;
+    memclear(cat->table_names, sizeof(int) * (size_t)table_slots);
+    for (int i = 0; i < table_count; i++) {
+        Table *table = table_at(i);
+        cat->table_pos[table->table_id] = i;
+        name_map_add(cat->table_names, table_slots, table->name, i);
     }
 
-    for (int i = 0; i < alist_length(&tables); i++) {
-        Table *table = (Table *)alist_get(&tables, i);
-        if (table && strcmp(table->name, name) == 0) {
-            return table;
-        }
+    /* Counting sort of the indexes by table id, keeping list order within a table. */
+    memclear(cat->index_start, sizeof(int) * (size_t)(id_capacity + 1));
+    memclear(cat->index_names, sizeof(int) * (size_t)index_slots);
+    for (int i = 0; i < index_count; i++) {
+        Index *index = index_at(i);
+        name_map_add(cat->index_names, index_slots, index->index_name, i);
+        if (index->table_id < id_capacity)
+            cat->index_start[index->table_id + 1]++;
     }
-    return NULL;
+    for (int id = 0; id < id_capacity; id++)
+        cat->index_start[id + 1] += cat->index_start[id];
+    for (int i = 0; i < index_count; i++) {
+        uint16_t id = index_at(i)->table_id;
+        if (id < id_capacity)
+            cat->index_order[cat->index_start[id]++] = i;
+    }
+    /* Filling moved each start to where the next table's begins. */
+    for (int id = id_capacity; id > 0; id--)
+        cat->index_start[id] = cat->index_start[id - 1];
+    cat->index_start[0] = 0;
+}
+
+/* Positions of the indexes of table_id; returns how many there are. */
+static int table_index_positions(uint16_t table_id, const int **positions) {
+    const Catalog *cat = &g_catalog;
+    if (table_id >= cat->id_capacity) {
+        *positions = NULL;
+        return 0;
+    }
+    *positions = cat->index_order + cat->index_start[table_id];
+    return cat->index_start[table_id + 1] - cat->index_start[table_id];
 }
 
-uint8_t find_table_id_by_name(const char *name) {
+static int find_table_pos(const char *name) {
+    const Catalog *cat = &g_catalog;
+    if (cat->table_slots == 0)
+        return -1;
+    uint32_t mask = (uint32_t)(cat->table_slots - 1);
+    for (uint32_t slot = name_hash(name) & mask; cat->table_names[slot];
+         slot = (slot + 1) & mask) {
+        Table *table = table_at(cat->table_names[slot] - 1);
+        if (table && strcmp(table->name, name) == 0)
+            return cat->table_names[slot] - 1;
+    }
+    return -1;
+}
+
+Table *find_table(const char *name) {
     ParseContext *ctx = parse_get_context();
     if (ctx && ctx->current_table && strcmp(ctx->current_table->name, name) == 0) {
-        return ctx->current_table->table_id;
+        return ctx->current_table;
     }
+    return table_at(find_table_pos(name));
+}
 
-    for (int i = 0; i < alist_length(&tables); i++) {
-        Table *table = (Table *)alist_get(&tables, i);
-        if (table && strcmp(table->name, name) == 0) {
-            return table->table_id;
-        }
-    }
-    return 0;
+uint16_t find_table_id_by_name(const char *name) {
+    Table *table = find_table(name);
+    return table ? table->table_id : 0;
 }
 
 Table *get_table(const char *name) {
     return find_table(name);
 }
 
-Table *get_table_by_id(uint8_t table_id) {
-    int count = alist_length(&tables);
-    for (int i = 0; i < count; i++) {
-        Table *table = (Table *)alist_get(&tables, i);
-        if (table && table->table_id == table_id) {
-            return table;
-        }
-    }
-    return NULL;
+Table *get_table_by_id(uint16_t table_id) {
+    if (table_id >= g_catalog.id_capacity)
+        return NULL;
+    Table *table = table_at(g_catalog.table_pos[table_id]);
+    return table && table->table_id == table_id ? table : NULL;
+}
+
+/* The lowest id no table holds, 0 once all MAX_TABLES are taken. */
+uint16_t next_table_id(void) {
+    for (int id = 1; id <= MAX_TABLES; id++)
+        if (!get_table_by_id((uint16_t)id))
+            return (uint16_t)id;
+    return 0;
 }
 
 bool value_equals(const Value *a, const Value *b) {
@@ -153,7 +583,13 @@ bool value_equals(const Value *a, const Value *b) {
         return a->blob_val.length == b->blob_val.length &&
                memcmp(a->blob_val.data, b->blob_val.data, a->blob_val.length) == 0;
     case TYPE_STRING:
-        return strcmp(a->char_val, b->char_val) == 0;
+        if (a->str_format == VALUE_STR_INTERNED && b->str_format == VALUE_STR_INTERNED)
+            return a->char_val == b->char_val;
+        return strcmp(value_str(a), value_str(b)) == 0;
+    case TYPE_TIME:
+        return a->time_val == b->time_val;
+    case TYPE_DATE:
+        return a->date_val == b->date_val;
     default:
         return false;
     }
@@ -170,25 +606,53 @@ bool check_not_null_constraint(Table *table, int col_idx, Value *val) {
     return true;
 }
 
-bool check_unique_constraint(Table *table, int col_idx, Value *val, int exclude_row_idx) {
-    if (is_null(val))
-        return true;
+/* True if a live row (see table_row_live) other than exclude_row_idx holds key in
+   column_id. Probes an index on the column when there is one (UNIQUE and PRIMARY KEY
+   columns always have a hash index) and scans the table otherwise. */
+static bool column_contains_value(const Table *table, uint16_t column_id, const Value *key,
+                                  int exclude_row_idx) {
+    const Index *index = find_index_by_type(table->table_id, column_id, INDEX_TYPE_HASH);
+    if (index && !table->versions)
+        return hash_index_contains(index, key, exclude_row_idx);
 
-    int row_count = alist_length(&table->rows);
+    if (!index)
+        index = find_index_by_type(table->table_id, column_id, INDEX_TYPE_BTREE);
+    if (index) {
+        ArrayList rows;
+        alist_init(&rows, sizeof(int), NULL);
+        if (index->type == INDEX_TYPE_HASH)
+            hash_index_lookup(index, key, &rows);
+        else
+            btree_scan_range(index, key, true, key, true, &rows);
+        bool found = false;
+        for (int i = 0; i < alist_length(&rows) && !found; i++) {
+            int row = *(int *)alist_get(&rows, i);
+            found = row != exclude_row_idx && table_row_live(table, row);
+        }
+        alist_destroy(&rows);
+        return found;
+    }
+
+    int row_count = table_row_count(table);
     for (int i = 0; i < row_count; i++) {
-        if (i == exclude_row_idx)
+        if (i == exclude_row_idx || !table_row_live(table, i))
             continue;
-        Row *row = (Row *)alist_get(&table->rows, i);
-        ColumnDef *col = (ColumnDef *)alist_get(&table->schema.columns, col_idx);
-        if (row && col) {
-            Value *row_val = (Value *)alist_get(row, col_idx);
-            if (row_val && value_equals(row_val, val)) {
-                log_msg(LOG_ERROR,
-                        "Constraint violation: UNIQUE on column '%s' (duplicate value '%s')",
-                        col->name, repr(val));
-                return false;
-            }
-        }
+        Value row_val = table_get_value(table, i, column_id);
+        if (value_equals(&row_val, key))
+            return true;
+    }
+    return false;
+}
+
+bool check_unique_constraint(Table *table, int col_idx, Value *val, int exclude_row_idx) {
+    ColumnDef *col = (ColumnDef *)alist_get(&table->schema.columns, col_idx);
+    if (!col || !(col->flags & COL_FLAG_UNIQUE) || is_null(val))
+        return true;
+
+    if (column_contains_value(table, (uint16_t)col_idx, val, exclude_row_idx)) {
+        log_msg(LOG_ERROR, "Constraint violation: UNIQUE on column '%s' (duplicate value '%s')",
+                col->name, repr(val));
+        return false;
     }
     return true;
 }
@@ -210,17 +674,8 @@ bool check_foreign_key_constraint(Table *table, int col_idx, Value *val) {
     }
 
     uint16_t ref_col_id = col->reference.column_id;
-
-    int ref_row_count = alist_length(&ref_table->rows);
-    for (int i = 0; i < ref_row_count; i++) {
-        Row *ref_row = (Row *)alist_get(&ref_table->rows, i);
-        if (ref_row) {
-            Value *ref_val = (Value *)alist_get(ref_row, ref_col_id);
-            if (ref_val && value_equals(ref_val, val)) {
-                return true;
-            }
-        }
-    }
+    if (column_contains_value(ref_table, ref_col_id, val, -1))
+        return true;
 
     ColumnDef *ref_col = (ColumnDef *)alist_get(&ref_table->schema.columns, ref_col_id);
     log_msg(LOG_ERROR,
@@ -229,6 +684,24 @@ bool check_foreign_key_constraint(Table *table, int col_idx, Value *val) {
     return false;
 }
 
+/* Bumped whenever a table is created or dropped. Parsed statements hold table and column
+   ids, so a cached AST is only reused while the version it was parsed under is current. */
+static uint64_t g_catalog_version = 1;
+
+uint64_t catalog_version(void) {
+    return g_catalog_version;
+}
+
+void catalog_changed(void) {
+    g_catalog_version++;
+    catalog_rebuild();
+}
+
+/* Index changes leave parsed statements valid; only the maps need rebuilding. */
+void catalog_indexes_changed(void) {
+    catalog_rebuild();
+}
+
 void init_tables(void) {
     if (tables.data == NULL) {
         alist_init(&tables, sizeof(Table), free_table_internal);
@@ -236,56 +709,14 @@ void init_tables(void) {
     if (indexes.data == NULL) {
         alist_init(&indexes, sizeof(Index), free_index);
     }
+    catalog_rebuild();
 }
 
-/* Hash function for Values - used by index implementation.
- * Converts a Value to a hash code for bucket indexing.
- * Returns a value between 0 and bucket_count-1. */
+/* Maps a Value to a bucket in [0, bucket_count) for the hash join. */
 int hash_value(const Value *value, int bucket_count) {
     if (!value || bucket_count <= 0)
         return 0;
-
-    unsigned long hash = 0;
-    switch (value->type) {
-    case TYPE_INT:
-        hash = (unsigned long)(value->int_val);
-        break;
-    case TYPE_FLOAT:
-        hash = (unsigned long)(value->float_val * 1000.0);
-        break;
-    case TYPE_BOOLEAN:
-        hash = (unsigned long)(value->bool_val);
-        break;
-    case TYPE_STRING:
-        if (value->char_val) {
-            const char *p = value->char_val;
-            while (*p) {
-                hash = hash * 31 + *p++;
-            }
-        }
-        break;
-    case TYPE_TIME:
-        hash = value->time_val;
-        break;
-    case TYPE_DATE:
-        hash = value->date_val;
-        break;
-    default:
-        hash = 0;
-    }
-
-    return (int)(hash % (unsigned long)bucket_count);
-}
-
-static void free_index_entry(IndexEntry *entry) {
-    if (!entry)
-        return;
-
-    if (entry->key.type == TYPE_STRING && entry->key.char_val) {
-        free(entry->key.char_val);
-    }
-    free_index_entry(entry->next);
-    free(entry);
+    return (int)(value_hash(value) % (uint64_t)bucket_count);
 }
 
 static void free_index(void *ptr) {
@@ -295,44 +726,43 @@ static void free_index(void *ptr) {
 
     alist_destroy(&index->columns);
 
-    if (index->buckets) {
-        for (int i = 0; i < (int)index->bucket_count; i++) {
-            if (index->buckets[i]) {
-                free_index_entry(index->buckets[i]);
-            }
-        }
-        free(index->buckets);
-    }
+    if (index->type == INDEX_TYPE_BTREE)
+        btree_index_free(index);
+    else
+        hash_index_free(index);
     log_msg(LOG_DEBUG, "free_index: Index '%s' freed", index->index_name);
 }
 
+static int find_index_pos(const char *index_name) {
+    const Catalog *cat = &g_catalog;
+    if (cat->index_slots == 0)
+        return -1;
+    uint32_t mask = (uint32_t)(cat->index_slots - 1);
+    for (uint32_t slot = name_hash(index_name) & mask; cat->index_names[slot];
+         slot = (slot + 1) & mask) {
+        Index *index = index_at(cat->index_names[slot] - 1);
+        if (index && strcmp(index->index_name, index_name) == 0)
+            return cat->index_names[slot] - 1;
+    }
+    return -1;
+}
+
 Index *find_index(const char *index_name) {
     if (!index_name)
         return NULL;
-
-    int index_count = alist_length(&indexes);
-    for (int i = 0; i < index_count; i++) {
-        Index *idx = (Index *)alist_get(&indexes, i);
-        if (idx && strcmp(idx->index_name, index_name) == 0) {
-            return idx;
-        }
-    }
-    return NULL;
+    return index_at(find_index_pos(index_name));
 }
 
 static void remove_existing_index(const char *idx_name) {
-    int index_count = alist_length(&indexes);
-    for (int i = 0; i < index_count; i++) {
-        Index *idx = (Index *)alist_get(&indexes, i);
-        if (idx && strcmp(idx->index_name, idx_name) == 0) {
-            alist_remove(&indexes, i);
-            break;
-        }
+    int pos = find_index_pos(idx_name);
+    if (pos >= 0) {
+        alist_remove(&indexes, pos);
+        catalog_indexes_changed();
     }
 }
 
-static Index *create_and_init_index(const char *idx_name, uint8_t table_id,
-                                    ArrayList *column_ids) {
+static Index *create_and_init_index(const char *idx_name, uint16_t table_id,
+                                    ArrayList *column_ids, int key_count, IndexType type) {
     Index *index = (Index *)malloc(sizeof(Index));
     if (!index) {
         log_msg(LOG_ERROR, "index_table_column: Failed to allocate index");
@@ -342,6 +772,7 @@ static Index *create_and_init_index(const char *idx_name, uint8_t table_id,
     memclear(index, sizeof(Index));
     strcopy(index->index_name, sizeof(index->index_name), idx_name);
     index->table_id = table_id;
+    index->type = type;
     alist_init(&index->columns, sizeof(uint16_t), NULL);
 
     int col_count = alist_length(column_ids);
@@ -352,13 +783,14 @@ static Index *create_and_init_index(const char *idx_name, uint8_t table_id,
             *dst_id = *src_id;
         }
     }
+    index->key_count = (uint16_t)key_count;
 
-    index->bucket_count = 64;
-    index->buckets = calloc(index->bucket_count, sizeof(IndexEntry *));
     index->entry_count = 0;
+    if (type == INDEX_TYPE_BTREE)
+        return index;
 
-    if (!index->buckets) {
-        log_msg(LOG_ERROR, "index_table_column: Failed to allocate index buckets");
+    if (!hash_index_init(index)) {
+        log_msg(LOG_ERROR, "index_table_column: Failed to allocate hash index");
         alist_destroy(&index->columns);
         free(index);
         return NULL;
@@ -367,40 +799,158 @@ static Index *create_and_init_index(const char *idx_name, uint8_t table_id,
     return index;
 }
 
+static uint16_t index_column(const Index *index, int i) {
+    return *(uint16_t *)alist_get(&index->columns, i);
+}
+
+/* Reads the index entry of a row: the values of the index's columns in order (just the key
+   columns for a hash index). The values stay owned by the table. */
+void index_entry_values(const Index *index, const Table *table, int row_idx, Value *out) {
+    int width = index->type == INDEX_TYPE_BTREE ? alist_length(&index->columns) : index->key_count;
+    for (int i = 0; i < width; i++)
+        out[i] = table_get_value(table, row_idx, index_column(index, i));
+}
+
+static bool index_covers_column(const Index *index, uint16_t column_id) {
+    int width = index->type == INDEX_TYPE_BTREE ? alist_length(&index->columns) : index->key_count;
+    for (int i = 0; i < width; i++)
+        if (index_column(index, i) == column_id)
+            return true;
+    return false;
+}
+
+static void index_insert_key(Index *index, const Table *table, int row_idx) {
+    Value entry[MAX_INDEX_COLUMNS];
+    index_entry_values(index, table, row_idx, entry);
+    if (index->type == INDEX_TYPE_BTREE) {
+        if (!is_null(&entry[0]))
+            btree_insert(index, entry, row_idx);
+    } else {
+        hash_index_insert(index, entry, row_idx);
+    }
+}
+
+static void index_delete_key(Index *index, const Table *table, int row_idx) {
+    Value entry[MAX_INDEX_COLUMNS];
+    index_entry_values(index, table, row_idx, entry);
+    if (index->type == INDEX_TYPE_BTREE)
+        btree_delete(index, entry, row_idx);
+    else
+        hash_index_delete(index, entry, row_idx);
+}
+
 static void populate_index_entries(Index *index, Table *table) {
     if (alist_length(&index->columns) == 0)
         return;
 
-    uint16_t *col = (uint16_t *)alist_get(&index->columns, 0);
-    if (!col)
+    if (index->type == INDEX_TYPE_BTREE) {
+        btree_bulk_load(index, table);
         return;
-    uint16_t col_id = *col;
+    }
 
-    int row_count = alist_length(&table->rows);
+    int row_count = table_row_count(table);
     for (int i = 0; i < row_count; i++) {
-        Row *row = (Row *)alist_get(&table->rows, i);
-        if (!row || alist_length(row) <= col_id)
-            continue;
+        if (!table_row_deleted(table, i))
+            index_insert_key(index, table, i);
+    }
+}
+
+static void index_insert_row(Table *table, int row_idx) {
+    const int *positions;
+    int count = table_index_positions(table->table_id, &positions);
+    for (int i = 0; i < count; i++) {
+        Index *index = index_at(positions[i]);
+        if (alist_length(&index->columns) > 0)
+            index_insert_key(index, table, row_idx);
+    }
+}
 
-        IndexEntry *entry = malloc(sizeof(IndexEntry));
-        if (!entry)
+static void index_remove_row(Table *table, int row_idx) {
+    const int *positions;
+    int count = table_index_positions(table->table_id, &positions);
+    for (int i = 0; i < count; i++) {
+        Index *index = index_at(positions[i]);
+        if (alist_length(&index->columns) > 0)
+            index_delete_key(index, table, row_idx);
+    }
+}
+
+/* Removes row_idx from every index of table whose entries hold column_id. */
+static void index_remove_value(Table *table, int row_idx, uint16_t column_id) {
+    const int *positions;
+    int count = table_index_positions(table->table_id, &positions);
+    for (int i = 0; i < count; i++) {
+        Index *index = index_at(positions[i]);
+        if (index_covers_column(index, column_id))
+            index_delete_key(index, table, row_idx);
+    }
+}
+
+/* Adds row_idx to every index of table whose entries hold column_id. */
+static void index_add_value(Table *table, int row_idx, uint16_t column_id) {
+    const int *positions;
+    int count = table_index_positions(table->table_id, &positions);
+    for (int i = 0; i < count; i++) {
+        Index *index = index_at(positions[i]);
+        if (index_covers_column(index, column_id))
+            index_insert_key(index, table, row_idx);
+    }
+}
+
+static void index_remap_rows(Table *table, const bool *keep, int old_count) {
+    int *new_rows = NULL;
+    const int *positions;
+    int count = table_index_positions(table->table_id, &positions);
+    for (int i = 0; i < count; i++) {
+        Index *index = index_at(positions[i]);
+        if (alist_length(&index->columns) == 0)
             continue;
 
-        Value *row_val = (Value *)alist_get(row, col_id);
-        entry->key = copy_value(row_val);
-        entry->row_index = i;
-        entry->next = NULL;
+        if (!new_rows) {
+            new_rows = malloc(sizeof(int) * (size_t)(old_count > 0 ? old_count : 1));
+            if (!new_rows) {
+                log_msg(LOG_ERROR, "index_remap_rows: Failed to allocate row map");
+                return;
+            }
+            int next = 0;
+            for (int r = 0; r < old_count; r++)
+                new_rows[r] = keep[r] ? next++ : -1;
+        }
+
+        if (index->type == INDEX_TYPE_BTREE) {
+            if (!btree_remap_rows(index, new_rows))
+                btree_bulk_load(index, table);
+        } else {
+            hash_index_remap(index, new_rows);
+        }
+    }
+    free(new_rows);
+}
 
-        int bucket = hash_value(&entry->key, index->bucket_count);
-        entry->next = index->buckets[bucket];
-        index->buckets[bucket] = entry;
-        index->entry_count++;
+void drop_table_indexes(uint16_t table_id) {
+    for (int i = alist_length(&indexes) - 1; i >= 0; i--) {
+        Index *index = (Index *)alist_get(&indexes, i);
+        if (index && index->table_id == table_id) {
+            log_msg(LOG_INFO, "drop_table_indexes: Dropping index '%s'", index->index_name);
+            alist_remove(&indexes, i);
+        }
     }
+    catalog_indexes_changed();
 }
 
-void index_table(uint8_t table_id, ArrayList *column_ids, const char *index_name) {
+/* column_ids are the key columns, key_count of them, then the INCLUDE columns, which only a
+   B-tree stores. */
+void index_table(uint16_t table_id, ArrayList *column_ids, int key_count, const char *index_name,
+                 IndexType type) {
     if (!column_ids || alist_length(column_ids) == 0)
         return;
+    int col_count = alist_length(column_ids);
+    if (key_count <= 0 || key_count > col_count || col_count > MAX_INDEX_COLUMNS ||
+        (type == INDEX_TYPE_HASH && key_count < col_count)) {
+        log_msg(LOG_ERROR, "index_table: Invalid index of %d columns with %d key columns",
+                col_count, key_count);
+        return;
+    }
 
     Table *table = get_table_by_id(table_id);
     if (!table) {
@@ -424,79 +974,119 @@ void index_table(uint8_t table_id, ArrayList *column_ids, const char *index_name
         remove_existing_index(idx_name);
     }
 
-    Index *index = create_and_init_index(idx_name, table_id, column_ids);
+    Index *index = create_and_init_index(idx_name, table_id, column_ids, key_count, type);
     if (!index)
         return;
 
     populate_index_entries(index, table);
 
     Index *stored = (Index *)alist_append(&indexes);
-    stored->bucket_count = index->bucket_count;
-    stored->buckets = index->buckets;
-    stored->entry_count = index->entry_count;
-    strcopy(stored->index_name, sizeof(stored->index_name), index->index_name);
-    stored->table_id = index->table_id;
-    alist_init(&stored->columns, sizeof(uint16_t), NULL);
-    for (int i = 0; i < alist_length(&index->columns); i++) {
-        uint16_t *src = (uint16_t *)alist_get(&index->columns, i);
-        uint16_t *dst = (uint16_t *)alist_append(&stored->columns);
-        if (src && dst)
-            *dst = *src;
-    }
-
-    log_msg(LOG_INFO, "index_table: Created index '%s' on table_id=%d with %d entries", idx_name,
-            table_id, index->entry_count);
+    if (!stored) {
+        free_index(index);
+        free(index);
+        return;
+    }
+    *stored = *index;
+    catalog_indexes_changed();
+
+    log_msg(LOG_INFO, "index_table: Created %s index '%s' on table_id=%d with %d entries",
+            type == INDEX_TYPE_BTREE ? "BTREE" : "HASH", idx_name, table_id, index->entry_count);
 
     free(index);
 }
 
+/* Brings every index of table up to date with the rows appended unindexed from first_row
+   on. A B+tree that at least doubles is rebuilt with a bulk load rather than one insert per
+   key; hash indexes take the new keys one at a time. */
+void table_index_appended_rows(Table *table, int first_row) {
+    int row_count = table_row_count(table);
+    if (first_row >= row_count)
+        return;
+    const int *positions;
+    int count = table_index_positions(table->table_id, &positions);
+    for (int i = 0; i < count; i++) {
+        Index *index = index_at(positions[i]);
+        if (alist_length(&index->columns) == 0)
+            continue;
+        if (index->type == INDEX_TYPE_BTREE && row_count - first_row >= first_row) {
+            btree_bulk_load(index, table);
+            continue;
+        }
+        for (int r = first_row; r < row_count; r++)
+            index_insert_key(index, table, r);
+    }
+}
+
 /* Drop an index by name */
 void drop_index_by_name(const char *index_name) {
     if (!index_name)
         return;
 
-    int index_count = alist_length(&indexes);
-    for (int i = 0; i < index_count; i++) {
-        Index *idx = (Index *)alist_get(&indexes, i);
-        if (idx && strcmp(idx->index_name, index_name) == 0) {
-            alist_remove(&indexes, i);
-            log_msg(LOG_INFO, "drop_index_by_name: Index '%s' dropped", index_name);
-            return;
-        }
+    int pos = find_index_pos(index_name);
+    if (pos >= 0) {
+        alist_remove(&indexes, pos);
+        catalog_indexes_changed();
+        log_msg(LOG_INFO, "drop_index_by_name: Index '%s' dropped", index_name);
+        return;
     }
 
     log_msg(LOG_ERROR, "drop_index_by_name: Index '%s' not found", index_name);
 }
 
-Index *find_index_by_table_column(uint8_t table_id, uint16_t column_id) {
-    int index_count = alist_length(&indexes);
-    for (int i = 0; i < index_count; i++) {
-        Index *idx = (Index *)alist_get(&indexes, i);
-        if (idx && idx->table_id == table_id) {
-            if (alist_length(&idx->columns) > 0) {
-                uint16_t *first_col = (uint16_t *)alist_get(&idx->columns, 0);
-                if (first_col && *first_col == column_id) {
-                    return idx;
-                }
-            }
-        }
+/* Whether the index can be probed with one value of column_id: a B-tree leading with it,
+   or a hash index on it alone. */
+static bool index_probes_column(const Index *index, uint16_t column_id) {
+    return index && alist_length(&index->columns) > 0 && index_column(index, 0) == column_id &&
+           (index->type == INDEX_TYPE_BTREE || index->key_count == 1);
+}
+
+Index *find_index_by_table_column(uint16_t table_id, uint16_t column_id) {
+    const int *positions;
+    int count = table_index_positions(table_id, &positions);
+    for (int i = 0; i < count; i++) {
+        Index *idx = index_at(positions[i]);
+        if (index_probes_column(idx, column_id))
+            return idx;
+    }
+    return NULL;
+}
+
+Index *find_index_by_type(uint16_t table_id, uint16_t column_id, IndexType type) {
+    const int *positions;
+    int count = table_index_positions(table_id, &positions);
+    for (int i = 0; i < count; i++) {
+        Index *idx = index_at(positions[i]);
+        if (idx && idx->type == type && index_probes_column(idx, column_id))
+            return idx;
     }
     return NULL;
 }
 
+/* The i-th index of table_id, NULL past the last. */
+Index *table_index(uint16_t table_id, int i) {
+    const int *positions;
+    int count = table_index_positions(table_id, &positions);
+    return i >= 0 && i < count ? index_at(positions[i]) : NULL;
+}
+
 void lookup_index_values(const Index *index, const Value *key, ArrayList *result) {
+    lookup_index_prefix(index, key, 1, result);
+}
+
+/* Rows whose first width key columns equal key. A hash index only answers all of them. */
+void lookup_index_prefix(const Index *index, const Value *key, int width, ArrayList *result) {
     if (!index || !key || !result)
         return;
 
-    int bucket = hash_value(key, index->bucket_count);
-    bucket = (bucket < 0) ? -bucket : bucket;
-    bucket = bucket % index->bucket_count;
-
-    for (IndexEntry *entry = index->buckets[bucket]; entry != NULL; entry = entry->next) {
-        if (value_equals(&entry->key, key)) {
-            int *row_idx = (int *)alist_append(result);
-            if (row_idx)
-                *row_idx = entry->row_index;
-        }
+    if (index->type == INDEX_TYPE_BTREE) {
+        BTreeRange range = {key, width, true, key, width, true, -1};
+        if (!is_null(key))
+            btree_scan(index, &range, result);
+        return;
     }
+
+    int before = alist_length(result);
+    hash_index_lookup(index, key, result);
+    metrics_add(METRIC_INDEX_PROBES, 1);
+    metrics_add(METRIC_INDEX_ROWS, (uint64_t)(alist_length(result) - before));
 }
@@ -0,0 +1,210 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "test_util.h"
+#include "utils.h"
+
+#define AGG_TEST_ROWS 3000
+
+static Value *agg_value(QueryResult *result, int col) {
+    return (Value *)alist_get(&result->values, col);
+}
+
+/* SUM, MIN and MAX of an INT column are INTs. */
+static double agg_number(QueryResult *result, int col, bool use_float) {
+    const Value *value = agg_value(result, col);
+    assert_true(value->type == (use_float ? TYPE_FLOAT : TYPE_INT), "Type of column %d", col);
+    return use_float ? value->float_val : (double)value->int_val;
+}
+
+/* id 0..2999, val = id % 100 with every 7th value NULL, f = val / 4. */
+static void fill_agg_table(const char *storage) {
+    char sql[8192];
+    string_format(sql, sizeof(sql), "CREATE TABLE samples (id INT, val INT, f FLOAT)%s;",
+                  storage);
+    exec(sql);
+
+    for (int start = 0; start < AGG_TEST_ROWS; start += 100) {
+        string_format(sql, sizeof(sql), "INSERT INTO samples VALUES ");
+        for (int i = start; i < start + 100; i++) {
+            char row[96];
+            if (i % 7 == 0)
+                string_format(row, sizeof(row), "%s(%d, NULL, NULL)", i == start ? "" : ", ",
+                              i);
+            else
+                string_format(row, sizeof(row), "%s(%d, %d, %.2f)", i == start ? "" : ", ", i,
+                              i % 100, (i % 100) / 4.0);
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+}
+
+static void expected_stats(int lo, int hi, bool use_float, NumericAgg *out) {
+    numeric_agg_init(out);
+    for (int i = lo; i < hi; i++) {
+        if (i % 7 == 0)
+            continue;
+        double x = use_float ? (i % 100) / 4.0 : (double)(i % 100);
+        numeric_agg_add(out, x);
+    }
+}
+
+static void check_aggregates(const char *column, const char *where, int lo, int hi,
+                             bool use_float) {
+    char sql[256];
+    string_format(sql, sizeof(sql),
+                  "SELECT SUM(%s), AVG(%s), MIN(%s), MAX(%s), VARIANCE(%s), STDDEV(%s) FROM "
+                  "samples%s;",
+                  column, column, column, column, column, column, where);
+    QueryResult *result = exec_query(sql);
+    assert_int_eq(1, alist_length(&result->rows), "Aggregate should return 1 row");
+
+    NumericAgg expected;
+    expected_stats(lo, hi, use_float, &expected);
+    double variance = expected.m2 / (double)(expected.count - 1);
+
+    assert_float_eq(expected.sum, agg_number(result, 0, use_float), 0.0001, "SUM");
+    assert_float_eq(expected.sum / expected.count, agg_value(result, 1)->float_val, 0.0001,
+                    "AVG");
+    assert_float_eq(expected.min, agg_number(result, 2, use_float), 0.0001, "MIN");
+    assert_float_eq(expected.max, agg_number(result, 3, use_float), 0.0001, "MAX");
+    assert_float_eq(variance, agg_value(result, 4)->float_val, 0.0001, "VARIANCE");
+    assert_float_eq(sqrt(variance), agg_value(result, 5)->float_val, 0.0001, "STDDEV");
+}
+
+static void check_all_aggregates(void) {
+    check_aggregates("val", "", 0, AGG_TEST_ROWS, false);
+    check_aggregates("f", "", 0, AGG_TEST_ROWS, true);
+    check_aggregates("val", " WHERE id >= 1013 AND id < 2290", 1013, 2290, false);
+    check_aggregates("f", " WHERE id >= 5 AND id < 1030", 5, 1030, true);
+}
+
+void test_agg_kernels_row_storage(void) {
+    log_msg(LOG_INFO, "Testing numeric aggregates on row storage...");
+
+    reset_database();
+    fill_agg_table("");
+    check_all_aggregates();
+
+    log_msg(LOG_INFO, "Numeric aggregates on row storage tests passed");
+}
+
+void test_agg_kernels_columnar_storage(void) {
+    log_msg(LOG_INFO, "Testing %s aggregate kernels on columnar storage...", agg_kernel_name());
+
+    reset_database();
+    fill_agg_table(" STORAGE COLUMNAR");
+    check_all_aggregates();
+
+    agg_force_scalar_kernels(true);
+    check_all_aggregates();
+    agg_force_scalar_kernels(false);
+
+    log_msg(LOG_INFO, "Aggregate kernels on columnar storage tests passed");
+}
+
+void test_agg_kernels_merge(void) {
+    log_msg(LOG_INFO, "Testing aggregate partial merge...");
+
+    long long ints[37];
+    uint8_t valid[5] = {0xFF, 0xF0, 0xFF, 0xFF, 0x1F};
+    NumericAgg expected;
+    numeric_agg_init(&expected);
+    for (int i = 0; i < 37; i++) {
+        ints[i] = (i * 37) % 101 - 50;
+        if (valid[i / 8] & (1u << (i % 8)))
+            numeric_agg_add_int(&expected, ints[i]);
+    }
+
+    NumericAgg left, right;
+    numeric_agg_init(&left);
+    numeric_agg_init(&right);
+    aggregate_int_vector(ints, valid, 16, true, &left);
+    aggregate_int_vector(ints + 16, valid + 2, 21, true, &right);
+    numeric_agg_merge(&left, &right);
+
+    assert_int_eq((int)expected.count, (int)left.count, "Merged count");
+    assert_float_eq(expected.sum, left.sum, 0.0001, "Merged sum");
+    assert_float_eq(expected.min, left.min, 0.0001, "Merged min");
+    assert_float_eq(expected.max, left.max, 0.0001, "Merged max");
+    assert_float_eq(expected.m2, left.m2, 0.0001, "Merged M2");
+    assert_true(left.int_sum == expected.int_sum && left.int_min == expected.int_min &&
+                    left.int_max == expected.int_max && !left.has_float,
+                "Merged exact INT sum, min and max");
+
+    /* Past 2^53 a double sum loses the low bits; past LLONG_MAX the SUM becomes a FLOAT. */
+    long long big[8];
+    for (int i = 0; i < 8; i++)
+        big[i] = (1LL << 60) + i;
+    NumericAgg exact;
+    numeric_agg_init(&exact);
+    aggregate_int_vector(big, NULL, 7, false, &exact);
+    Value sum = numeric_agg_result(FUNC_SUM, &exact, TYPE_INT);
+    assert_true(sum.type == TYPE_INT && sum.int_val == 7 * (1LL << 60) + 21,
+                "An INT SUM past 2^53 is exact");
+    aggregate_int_vector(big, NULL, 8, false, &exact);
+    assert_true(numeric_agg_result(FUNC_SUM, &exact, TYPE_INT).type == TYPE_FLOAT,
+                "An INT SUM past LLONG_MAX is a FLOAT");
+    assert_true(numeric_agg_result(FUNC_MAX, &exact, TYPE_INT).int_val == (1LL << 60) + 7,
+                "MAX stays exact");
+    assert_true(numeric_agg_result(FUNC_MAX, &exact, TYPE_FLOAT).type == TYPE_FLOAT,
+                "Whole numbers of a FLOAT operand stay FLOATs");
+    numeric_agg_init(&exact);
+    assert_true(numeric_agg_result(FUNC_SUM, &exact, TYPE_INT).type == TYPE_NULL, "SUM of nothing");
+
+    reset_database();
+    exec("CREATE TABLE one (v INT) STORAGE COLUMNAR;");
+    exec("INSERT INTO one VALUES (5);");
+    QueryResult *result = exec_query("SELECT STDDEV(v) FROM one;");
+    assert_true(agg_value(result, 0)->type == TYPE_NULL, "STDDEV of one row should be NULL");
+
+    log_msg(LOG_INFO, "Aggregate partial merge tests passed");
+}
+
+/* M2 of INT runs through the vector kernel under 2^51 and the scalar one past it, and only
+   when VARIANCE or STDDEV asks for it. */
+void test_agg_kernels_int_moments(void) {
+    log_msg(LOG_INFO, "Testing INT variance kernels...");
+
+    long long small[67], big[67];
+    for (int i = 0; i < 67; i++) {
+        small[i] = (long long)i * 1000003 - 30000000;
+        big[i] = (1LL << 52) + (long long)i * 977;
+    }
+    /* Evenly spaced by step, so M2 = step^2 * sum of (i - 33)^2 = step^2 * 25058. */
+    const long long *inputs[] = {small, big};
+    const double steps[] = {1000003.0, 977.0};
+    for (int force = 0; force < 2; force++) {
+        agg_force_scalar_kernels(force == 1);
+        for (int t = 0; t < 2; t++) {
+            NumericAgg expected, agg, plain;
+            numeric_agg_init(&expected);
+            for (int i = 0; i < 67; i++)
+                numeric_agg_add_int(&expected, inputs[t][i]);
+            double m2 = steps[t] * steps[t] * 25058.0;
+            numeric_agg_init(&agg);
+            aggregate_int_vector(inputs[t], NULL, 67, true, &agg);
+            assert_float_eq(m2, agg.m2, m2 * 1e-6, "%s M2 of input %d", agg_kernel_name(), t);
+            numeric_agg_init(&plain);
+            aggregate_int_vector(inputs[t], NULL, 67, false, &plain);
+            assert_true(plain.m2 == 0.0 && plain.int_sum == expected.int_sum,
+                        "Without moments only the sums are folded");
+        }
+    }
+    agg_force_scalar_kernels(false);
+
+    NumericAgg none;
+    numeric_agg_init(&none);
+    aggregate_int_vector(small, NULL, 0, true, &none);
+    assert_int_eq(0, (int)none.count, "An empty vector folds nothing");
+
+    log_msg(LOG_INFO, "INT variance kernel tests passed");
+}
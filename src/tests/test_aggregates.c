@@ -88,6 +88,12 @@ void test_multiple_aggregates(void) {
         "SELECT COUNT(value), SUM(value), AVG(value), MIN(value), MAX(value) FROM test_multi;");
     assert_ptr_not_null(result, "Multiple aggregates query should return result");
 
+    result = exec_query("SELECT SUM(value * id), MAX(value - id) FROM test_multi;");
+    assert_int_eq(140, (int)((Value *)alist_get(&result->values, 0))->int_val,
+                  "SUM over an expression");
+    assert_int_eq(27, (int)((Value *)alist_get(&result->values, 1))->int_val,
+                  "MAX over an expression");
+
     log_msg(LOG_INFO, "Multiple aggregates test passed");
 }
 
@@ -0,0 +1,274 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "sketch.h"
+#include "test_util.h"
+#include "utils.h"
+#include "values.h"
+
+#define APPROX_TEST_ROWS 20000
+#define SAMPLE_TEST_BLOCKS 16
+
+static Value result_value(QueryResult *result, int row, int col) {
+    return *(Value *)alist_get(&result->values, row * result->col_count + col);
+}
+
+static double query_number(const char *sql) {
+    QueryResult *result = exec_query(sql);
+    assert_ptr_not_null(result, "Query runs: %s", sql);
+    assert_int_eq(1, alist_length(&result->rows), "One row from: %s", sql);
+    Value val = result_value(result, 0, 0);
+    assert_true(val.type == TYPE_INT || val.type == TYPE_FLOAT, "A number from: %s", sql);
+    return val.type == TYPE_INT ? (double)val.int_val : val.float_val;
+}
+
+static bool parses(const char *sql) {
+    Token *tokens = tokenize(sql);
+    assert_ptr_not_null(tokens, "Tokenization failed for: %s", sql);
+    ASTNode *ast = parse(tokens);
+    free_tokens(tokens);
+    if (!ast)
+        return false;
+    free_ast(ast);
+    return true;
+}
+
+/* rows rows of (id, grp, name): grp = id % 10 and 500 distinct names. */
+static void fill_measures(const char *table, int rows) {
+    char sql[8192];
+    string_format(sql, sizeof(sql), "CREATE TABLE %s (id INT, grp INT, name STRING);", table);
+    exec(sql);
+    for (int start = 0; start < rows; start += 256) {
+        string_format(sql, sizeof(sql), "INSERT INTO %s VALUES ", table);
+        for (int i = start; i < start + 256 && i < rows; i++) {
+            char row[64];
+            string_format(row, sizeof(row), "%s(%d, %d, 'n%d')", i == start ? "" : ", ", i,
+                          i % 10, i % 500);
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+}
+
+void test_sketch_merge(void) {
+    log_msg(LOG_INFO, "Testing distinct and quantile sketches and their merges...");
+
+    Sketch *whole = sketch_create(FUNC_APPROX_PERCENTILE);
+    Sketch *halves[2] = {sketch_create(FUNC_APPROX_PERCENTILE),
+                         sketch_create(FUNC_APPROX_PERCENTILE)};
+    Sketch *distinct = sketch_create(FUNC_APPROX_COUNT_DISTINCT);
+    Sketch *parts[2] = {sketch_create(FUNC_APPROX_COUNT_DISTINCT),
+                        sketch_create(FUNC_APPROX_COUNT_DISTINCT)};
+    for (int i = 0; i < 100000; i++) {
+        Value val = {0};
+        val.type = TYPE_INT;
+        val.int_val = (i * 7919) % 100000; /* every number once, shuffled */
+        assert_true(sketch_add(whole, &val) && sketch_add(halves[i % 2], &val) &&
+                        sketch_add(distinct, &val) && sketch_add(parts[i < 50000], &val),
+                    "Values added");
+    }
+    assert_true(sketch_merge(halves[0], halves[1]), "Quantile sketches merge");
+    assert_true(sketch_merge(parts[0], parts[1]), "Distinct sketches merge");
+    for (int q = 1; q < 10; q++) {
+        double fraction = q / 10.0;
+        Value a = sketch_result(whole, FUNC_APPROX_PERCENTILE, fraction);
+        Value b = sketch_result(halves[0], FUNC_APPROX_PERCENTILE, fraction);
+        assert_float_eq(fraction * 100000, a.float_val, 2000, "Quantile %.1f", fraction);
+        assert_float_eq(fraction * 100000, b.float_val, 2000, "Merged quantile %.1f", fraction);
+    }
+    Value a = sketch_result(distinct, FUNC_APPROX_COUNT_DISTINCT, 0);
+    Value b = sketch_result(parts[0], FUNC_APPROX_COUNT_DISTINCT, 0);
+    assert_true(a.int_val == b.int_val, "A merged HyperLogLog equals one over all values");
+    assert_float_eq(100000, (double)a.int_val, 5000, "Distinct estimate");
+
+    /* Few values are kept exactly. */
+    Sketch *small = sketch_create(FUNC_APPROX_COUNT_DISTINCT);
+    for (int i = 0; i < 200; i++) {
+        Value val = {0};
+        val.type = TYPE_INT;
+        val.int_val = i % HLL_SPARSE_HASHES;
+        sketch_add(small, &val);
+    }
+    assert_int_eq(HLL_SPARSE_HASHES,
+                  (int)sketch_result(small, FUNC_APPROX_COUNT_DISTINCT, 0).int_val,
+                  "Sparse distinct count is exact");
+    Value empty = sketch_result(NULL, FUNC_APPROX_PERCENTILE, 0.5);
+    assert_true(is_null(&empty), "No values, no percentile");
+
+    sketch_free(whole);
+    sketch_free(halves[0]);
+    sketch_free(halves[1]);
+    sketch_free(distinct);
+    sketch_free(parts[0]);
+    sketch_free(parts[1]);
+    sketch_free(small);
+
+    log_msg(LOG_INFO, "Sketch merge tests passed");
+}
+
+void test_approx_aggregates(void) {
+    log_msg(LOG_INFO, "Testing APPROX_COUNT_DISTINCT and APPROX_PERCENTILE...");
+
+    reset_database();
+    fill_measures("measures", APPROX_TEST_ROWS);
+
+    assert_float_eq(APPROX_TEST_ROWS,
+                    query_number("SELECT APPROX_COUNT_DISTINCT(id) FROM measures;"),
+                    APPROX_TEST_ROWS * 0.05, "Distinct ids");
+    assert_float_eq(500, query_number("SELECT APPROX_COUNT_DISTINCT(name) FROM measures;"), 25,
+                    "Distinct names");
+    assert_float_eq(10, query_number("SELECT APPROX_COUNT_DISTINCT(grp) FROM measures;"), 0,
+                    "Few distinct values are exact");
+    assert_float_eq(APPROX_TEST_ROWS / 2,
+                    query_number("SELECT APPROX_MEDIAN(id) FROM measures;"),
+                    APPROX_TEST_ROWS * 0.02, "Median");
+    assert_float_eq(APPROX_TEST_ROWS * 0.9,
+                    query_number("SELECT APPROX_PERCENTILE(id, 0.9) FROM measures;"),
+                    APPROX_TEST_ROWS * 0.02, "90th percentile");
+    assert_float_eq(0, query_number("SELECT APPROX_PERCENTILE(id, 0) FROM measures;"), 0,
+                    "The 0th percentile is the minimum");
+    assert_float_eq(APPROX_TEST_ROWS - 1,
+                    query_number("SELECT APPROX_PERCENTILE(id, 1) FROM measures;"), 0,
+                    "The 100th percentile is the maximum");
+    assert_float_eq(99, query_number("SELECT APPROX_MEDIAN(id) FROM measures WHERE id < 199;"),
+                    0, "Below KLL_K values the percentile is exact");
+    assert_float_eq(0,
+                    query_number("SELECT APPROX_COUNT_DISTINCT(id) FROM measures WHERE id < 0;"),
+                    0, "No rows, no distinct values");
+    QueryResult *result = exec_query("SELECT APPROX_MEDIAN(id) FROM measures WHERE id < 0;");
+    Value none = result_value(result, 0, 0);
+    assert_true(is_null(&none), "No rows, NULL median");
+
+    /* Grouped, the sketches live in the groups and merge across partials. */
+    for (int workers = 1; workers <= 4; workers += 3) {
+        char sql[64];
+        string_format(sql, sizeof(sql), "SET max_parallel_workers = %d;", workers);
+        exec(sql);
+        result = exec_query("SELECT grp, APPROX_COUNT_DISTINCT(id), APPROX_MEDIAN(id), "
+                            "APPROX_COUNT_DISTINCT(DISTINCT name) FROM measures GROUP BY grp "
+                            "ORDER BY grp;");
+        assert_int_eq(10, alist_length(&result->rows), "Ten groups");
+        for (int g = 0; g < 10; g++) {
+            assert_float_eq(APPROX_TEST_ROWS / 10, (double)result_value(result, g, 1).int_val,
+                            APPROX_TEST_ROWS / 10 * 0.05, "Distinct ids of group %d", g);
+            assert_float_eq(APPROX_TEST_ROWS / 2, result_value(result, g, 2).float_val,
+                            APPROX_TEST_ROWS * 0.03, "Median of group %d", g);
+            assert_int_eq(50, (int)result_value(result, g, 3).int_val, "Names of group %d", g);
+        }
+        assert_float_eq(APPROX_TEST_ROWS, query_number("SELECT APPROX_COUNT_DISTINCT(id) FROM "
+                                                       "measures;"),
+                        APPROX_TEST_ROWS * 0.05, "Distinct ids on %d workers", workers);
+        assert_float_eq(APPROX_TEST_ROWS / 4,
+                        query_number("SELECT APPROX_PERCENTILE(id * 2, 0.125) FROM measures;"),
+                        APPROX_TEST_ROWS * 0.04, "Percentile of an expression on %d workers",
+                        workers);
+    }
+    exec("SET max_parallel_workers = 1;");
+
+    assert_false(parses("SELECT APPROX_PERCENTILE(id, 1.5) FROM measures;"),
+                 "A fraction above 1 is rejected");
+    assert_false(parses("SELECT APPROX_PERCENTILE(id) FROM measures;"),
+                 "APPROX_PERCENTILE needs its fraction");
+
+    log_msg(LOG_INFO, "Approximate aggregate tests passed");
+}
+
+static int sampled_rows(double percent, uint32_t seed, int first, int rows) {
+    SeqScanPlan scan = {0};
+    scan.sampled = true;
+    scan.sample_percent = percent;
+    scan.sample_seed = seed;
+    int kept = 0;
+    for (int r = first; r < first + rows; r++)
+        kept += sample_row_kept(&scan, r);
+    return kept;
+}
+
+void test_table_sample(void) {
+    log_msg(LOG_INFO, "Testing TABLESAMPLE row sampling...");
+
+    reset_database();
+    int rows = SAMPLE_TEST_BLOCKS * ZONE_MAP_ROWS;
+    fill_measures("events", rows);
+    exec("CREATE INDEX idx_events_id ON events (id);");
+
+    assert_float_eq(rows, query_number("SELECT COUNT(*) FROM events TABLESAMPLE (100 PERCENT);"),
+                    0, "A full sample reads every row");
+    assert_float_eq(0, query_number("SELECT COUNT(*) FROM events TABLESAMPLE SYSTEM (0);"), 0,
+                    "An empty sample reads none");
+
+    int kept = sampled_rows(50, 7, 0, rows);
+    assert_true(kept > 0 && kept < rows, "Half the rows are picked");
+    const char *sample = "SELECT COUNT(*) FROM events e TABLESAMPLE SYSTEM (50 PERCENT) "
+                         "REPEATABLE (7);";
+    for (int workers = 1; workers <= 4; workers += 3) {
+        char sql[64];
+        string_format(sql, sizeof(sql), "SET max_parallel_workers = %d;", workers);
+        exec(sql);
+        assert_float_eq(kept, query_number(sample), 0, "The same rows are read on %d workers",
+                        workers);
+    }
+    exec("SET max_parallel_workers = 1;");
+    assert_float_eq(kept, query_number(sample), 0, "REPEATABLE picks the same rows again");
+
+    /* The sample is of the table, not of what an index finds. */
+    char sql[256];
+    string_format(sql, sizeof(sql),
+                  "SELECT COUNT(*) FROM events TABLESAMPLE (50) REPEATABLE (7) WHERE id < %d;",
+                  2 * ZONE_MAP_ROWS);
+    assert_float_eq(sampled_rows(50, 7, 0, 2 * ZONE_MAP_ROWS), query_number(sql), 0,
+                    "WHERE filters the sampled rows");
+    string_format(sql, sizeof(sql),
+                  "SELECT APPROX_COUNT_DISTINCT(id) FROM events TABLESAMPLE (50) REPEATABLE (7);");
+    assert_float_eq(kept, query_number(sql), kept * 0.05, "Sketches over a sample");
+
+    assert_false(parses("SELECT COUNT(*) FROM events TABLESAMPLE (150);"),
+                 "More than 100 percent is rejected");
+    assert_false(parses("SELECT COUNT(*) FROM events TABLESAMPLE 10;"),
+                 "The percent takes parentheses");
+
+    /* A table of a few blocks still gets about its percent, whatever the seed. */
+    reset_database();
+    fill_measures("small", 20000);
+    for (int seed = 1; seed <= 5; seed++) {
+        string_format(sql, sizeof(sql),
+                      "SELECT COUNT(*) FROM small TABLESAMPLE (10) REPEATABLE (%d);", seed);
+        assert_float_eq(2000, query_number(sql), 200, "10%% of 20000 rows with seed %d", seed);
+    }
+
+    log_msg(LOG_INFO, "TABLESAMPLE tests passed");
+}
+
+void test_approx_views(void) {
+    log_msg(LOG_INFO, "Testing approximate aggregates in materialized views...");
+
+    reset_database();
+    fill_measures("readings", 1000);
+    exec("CREATE MATERIALIZED VIEW reading_stats AS SELECT grp, APPROX_COUNT_DISTINCT(name) AS "
+         "names, APPROX_MEDIAN(id) AS median FROM readings GROUP BY grp;");
+    assert_float_eq(50, query_number("SELECT names FROM reading_stats WHERE grp = 3;"), 0,
+                    "View's distinct names");
+    assert_float_eq(493, query_number("SELECT median FROM reading_stats WHERE grp = 3;"), 0,
+                    "View's median");
+
+    MatViewStats before, after;
+    matview_get_stats(&before);
+    exec("INSERT INTO readings VALUES (2003, 3, 'fresh'), (2013, 3, 'fresh');");
+    assert_float_eq(51, query_number("SELECT names FROM reading_stats WHERE grp = 3;"), 0,
+                    "Inserts fold into the sketches");
+    matview_get_stats(&after);
+    assert_int_eq(0, (int)(after.refreshes - before.refreshes), "No refresh for inserts");
+
+    exec("DELETE FROM readings WHERE id >= 2000;");
+    assert_float_eq(50, query_number("SELECT names FROM reading_stats WHERE grp = 3;"), 0,
+                    "Deletes refresh the sketches");
+    matview_get_stats(&after);
+    assert_int_eq(1, (int)(after.refreshes - before.refreshes), "One refresh for the delete");
+
+    log_msg(LOG_INFO, "Approximate view tests passed");
+}
@@ -0,0 +1,175 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "test_util.h"
+#include "utils.h"
+
+void test_arena_alloc_and_release(void) {
+    log_msg(LOG_INFO, "Testing arena allocation, marks and release...");
+    Arena arena;
+    arena_init(&arena, 256);
+
+    char *name = arena_strdup(&arena, "hello");
+    assert_str_eq("hello", name, "arena_strdup should copy the string");
+    int *nums = arena_calloc(&arena, 16, sizeof(int));
+    assert_ptr_not_null(nums, "arena_calloc should succeed");
+    assert_int_eq(0, nums[15], "arena_calloc should zero memory");
+    assert_true(((uintptr_t)nums % _Alignof(max_align_t)) == 0,
+                "Arena allocations should be maximally aligned");
+
+    ArenaMark mark = arena_mark(&arena);
+    size_t used_at_mark = arena_bytes_used(&arena);
+    for (int i = 0; i < 100; i++)
+        arena_alloc(&arena, 100);
+    assert_true(arena_bytes_used(&arena) > used_at_mark, "Allocations should grow the arena");
+    void *big = arena_alloc(&arena, 4096);
+    assert_ptr_not_null(big, "Allocations larger than a block should get their own block");
+
+    arena_release(&arena, mark);
+    assert_true(arena_bytes_used(&arena) == used_at_mark,
+                "Release should roll the arena back to the mark");
+    assert_str_eq("hello", name, "Allocations before the mark should survive a release");
+
+    arena_reset(&arena);
+    assert_true(arena_bytes_used(&arena) == 0, "Reset should empty the arena");
+    assert_ptr_not_null(arena.head, "Reset should keep the first block for reuse");
+    arena_destroy(&arena);
+
+    Arena *owned = arena_create(0);
+    assert_ptr_not_null(owned, "arena_create should succeed");
+    assert_str_eq("abc", arena_strdup(owned, "abc"), "A created arena should allocate");
+    arena_destroy(owned);
+}
+
+void test_pool_reuse(void) {
+    log_msg(LOG_INFO, "Testing pool allocation and reuse...");
+    Pool pool;
+    pool_init(&pool, 3 * sizeof(Value));
+
+    void *slots[200];
+    for (int i = 0; i < 200; i++) {
+        slots[i] = pool_alloc(&pool);
+        assert_ptr_not_null(slots[i], "pool_alloc #%d should succeed", i);
+        memset(slots[i], 0xab, 3 * sizeof(Value));
+    }
+    assert_int_eq(200, pool.live, "Pool should count live elements");
+
+    void *freed = slots[42];
+    pool_free(&pool, freed);
+    assert_int_eq(199, pool.live, "pool_free should decrement live elements");
+    assert_true(pool_alloc(&pool) == freed, "The most recently freed slot should be reused");
+    pool_destroy(&pool);
+}
+
+void test_arena_backed_statements(void) {
+    log_msg(LOG_INFO, "Testing arena-backed AST, result and row storage...");
+    reset_database();
+    exec("CREATE TABLE people (name STRING, age INT, city STRING);");
+    exec("INSERT INTO people VALUES ('ann', 31, 'oslo'), ('bob', 25, 'rome'), "
+         "('cid', 40, 'oslo');");
+
+    Table *table = find_table_by_name("people");
+    assert_ptr_not_null(table, "Table should exist");
+    assert_int_eq(3, table->row_pool.live, "Each row should take one pool slot");
+
+    exec("INSERT INTO people VALUES ('dan', 20, 'nice', 'extra');");
+    assert_int_eq(3, table_row_count(table), "A rejected INSERT should not add a row");
+    assert_int_eq(3, table->row_pool.live, "A rejected INSERT should return its pool slot");
+
+    exec("DELETE FROM people WHERE age < 30;");
+    assert_int_eq(2, table->row_pool.live, "DELETE should return rows to the pool");
+    exec("INSERT INTO people VALUES ('eve', 22, 'bern');");
+    assert_int_eq(3, table->row_pool.live, "INSERT should reuse freed pool slots");
+
+    QueryResult *result = exec_query("SELECT name, city FROM people WHERE city = 'oslo' "
+                                     "ORDER BY name;");
+    assert_ptr_not_null(result, "SELECT should produce a result");
+    assert_int_eq(2, alist_length(&result->rows), "Two people live in oslo");
+    assert_str_eq("ann", ((Value *)alist_get(&result->values, 0))->char_val,
+                  "First row name should be copied into the result");
+    assert_str_eq("oslo", ((Value *)alist_get(&result->values, 3))->char_val,
+                  "Second row city should be copied into the result");
+    assert_str_eq("city", *(char **)alist_get(&result->column_names, 1),
+                  "Column names should live in the result");
+    exec("DELETE FROM people;");
+    assert_str_eq("cid", ((Value *)alist_get(&result->values, 2))->char_val,
+                  "Result values should outlive the rows they were read from");
+}
+
+void test_memory_accounting(void) {
+    log_msg(LOG_INFO, "Testing memory accounts, work_mem and memory_limit...");
+    MemoryAccount query, op;
+    memory_account_init(&query, memory_global());
+    memory_account_init(&op, &query);
+    size_t global = atomic_load(&memory_global()->used);
+
+    size_t charged = 0;
+    memory_track(&op, &charged, 1000);
+    memory_track(&op, &charged, 3000);
+    memory_track(&op, &charged, 2000);
+    assert_int_eq(2000, (int)atomic_load(&op.used), "memory_track charges the difference");
+    assert_int_eq(3000, (int)atomic_load(&op.peak), "The peak is kept");
+    assert_int_eq(2000, (int)atomic_load(&query.used), "Charges roll up to the parent");
+    assert_int_eq(2000, (int)(atomic_load(&memory_global()->used) - global),
+                  "and to the process-wide account");
+    atomic_store(&query.limit, 1000);
+    assert_true(memory_exceeded(&op), "A parent over its limit counts");
+    memory_track(&op, &charged, 0);
+    assert_false(memory_exceeded(&op), "Released charges bring it back under");
+    assert_int_eq(0, (int)atomic_load(&query.used), "Everything released");
+
+    Arena arena;
+    arena_init(&arena, 0);
+    arena.account = &query;
+    arena_alloc(&arena, 10);
+    assert_int_eq(ARENA_BLOCK_SIZE, (int)atomic_load(&query.used) - (int)sizeof(ArenaBlock),
+                  "Arena blocks are charged to the arena's account");
+    arena_destroy(&arena);
+    assert_int_eq(0, (int)atomic_load(&query.used), "and released with them");
+
+    /* Operators spill before work_mem is used up, or while the process is past its limit. */
+    ExecContext ctx = {0};
+    ctx.memory = &op;
+    exec("SET work_mem = 1024;");
+    assert_false(exec_memory_exceeded(&ctx, 1000 * 1024, 1), "Under work_mem");
+    assert_true(exec_memory_exceeded(&ctx, 1000 * 1024, 2), "A worker gets its share of it");
+    assert_false(exec_memory_exceeded(&ctx, WORK_MEM_MIN / 2, 1), "Small state never spills");
+    exec("SET memory_limit = 1;");
+    assert_true(exec_memory_exceeded(&ctx, WORK_MEM_MIN * 2, 1), "Past the process limit");
+    exec("SET memory_limit = 0;");
+    exec("SET work_mem = 0;");
+    assert_int_eq(WORK_MEM_DEFAULT, (int)exec_work_mem(), "0 restores the default");
+
+    reset_database();
+    exec("CREATE TABLE wide (id INT, grp INT);");
+    char sql[4096];
+    for (int start = 0; start < 4000; start += 200) {
+        string_format(sql, sizeof(sql), "INSERT INTO wide VALUES ");
+        for (int i = start; i < start + 200; i++) {
+            char row[32];
+            string_format(row, sizeof(row), "%s(%d, %d)", i == start ? "" : ", ", i, i % 10);
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+    exec("SET memory_limit = 1;");
+    QueryResult *result = exec_query("EXPLAIN ANALYZE SELECT a.id FROM wide a JOIN wide b "
+                                     "ON a.id = b.id;");
+    exec("SET memory_limit = 0;");
+    assert_ptr_not_null(result, "EXPLAIN ANALYZE result");
+    bool spilled = false, peak = false;
+    for (int i = 0; i < alist_length(&result->values); i++) {
+        const char *line = ((Value *)alist_get(&result->values, i))->char_val;
+        spilled = spilled || (strstr(line, "Hash Join") && strstr(line, "spilled="));
+        peak = peak || strncmp(line, "Peak memory: ", 13) == 0;
+    }
+    assert_true(spilled, "A join past the process limit spills and shows it");
+    assert_true(peak, "The statement's peak memory is shown");
+}
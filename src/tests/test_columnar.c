@@ -0,0 +1,232 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "logger.h"
+#include "table.h"
+#include "test_util.h"
+#include "utils.h"
+#include "values.h"
+
+static Value *result_value(QueryResult *result, int row, int col) {
+    return (Value *)alist_get(&result->values, row * result->col_count + col);
+}
+
+void test_columnar_create_and_insert(void) {
+    log_msg(LOG_INFO, "Testing columnar CREATE TABLE and INSERT...");
+
+    reset_database();
+
+    exec("CREATE TABLE metrics (id INT, name STRING, score FLOAT) STORAGE COLUMNAR;");
+    exec("INSERT INTO metrics VALUES (1, 'alpha', 1.5), (2, 'beta', 2.5), (3, NULL, 3);");
+
+    Table *table = find_table_by_name("metrics");
+    assert_ptr_not_null(table, "Table 'metrics' should exist");
+    assert_true(table->storage == STORAGE_COLUMNAR, "Table should use columnar storage");
+    assert_int_eq(3, table_row_count(table), "Table should have 3 rows");
+    assert_int_eq(0, alist_length(&table->rows), "Columnar table should not use row storage");
+
+    Value name = table_get_value(table, 1, 1);
+    assert_str_eq("beta", name.char_val, "Second name should be 'beta'");
+    Value null_name = table_get_value(table, 2, 1);
+    assert_true(null_name.type == TYPE_NULL, "Third name should be NULL");
+    Value score = table_get_value(table, 2, 2);
+    assert_true(score.type == TYPE_FLOAT, "INT literal should be stored as FLOAT");
+    assert_float_eq(3.0, score.float_val, 0.0001, "Third score should be 3.0");
+
+    log_msg(LOG_INFO, "Columnar CREATE TABLE and INSERT tests passed");
+}
+
+void test_columnar_select_where(void) {
+    log_msg(LOG_INFO, "Testing columnar SELECT with WHERE...");
+
+    reset_database();
+
+    exec("CREATE TABLE events (id INT, kind STRING) STORAGE COLUMNAR;");
+    exec("INSERT INTO events VALUES (1, 'click'), (2, 'view'), (3, 'click'), (4, 'view');");
+
+    QueryResult *result = exec_query("SELECT id, kind FROM events WHERE kind = 'click';");
+    assert_int_eq(2, alist_length(&result->rows), "Should return 2 click events");
+    assert_int_eq(1, (int)result_value(result, 0, 0)->int_val, "First click id should be 1");
+    assert_int_eq(3, (int)result_value(result, 1, 0)->int_val, "Second click id should be 3");
+    assert_str_eq("click", result_value(result, 1, 1)->char_val, "Kind should be 'click'");
+
+    log_msg(LOG_INFO, "Columnar SELECT with WHERE tests passed");
+}
+
+void test_columnar_aggregates(void) {
+    log_msg(LOG_INFO, "Testing columnar aggregates...");
+
+    reset_database();
+
+    exec("CREATE TABLE sales (id INT, amount INT) STORAGE COLUMNAR;");
+    exec("INSERT INTO sales VALUES (1, 10), (2, 20), (3, NULL), (4, 40);");
+
+    QueryResult *result =
+        exec_query("SELECT SUM(amount), AVG(amount), MIN(amount), MAX(amount) FROM sales;");
+    assert_int_eq(1, alist_length(&result->rows), "Aggregate should return 1 row");
+    assert_int_eq(70, (int)result_value(result, 0, 0)->int_val, "SUM should be 70");
+    assert_float_eq(70.0 / 3, result_value(result, 0, 1)->float_val, 0.0001,
+                    "AVG should skip NULL");
+    assert_int_eq(10, (int)result_value(result, 0, 2)->int_val, "MIN should be 10");
+    assert_int_eq(40, (int)result_value(result, 0, 3)->int_val, "MAX should be 40");
+
+    result = exec_query("SELECT SUM(amount) FROM sales WHERE id > 1;");
+    assert_int_eq(60, (int)result_value(result, 0, 0)->int_val, "Filtered SUM should be 60");
+
+    result = exec_query("SELECT COUNT(amount) FROM sales;");
+    assert_int_eq(3, (int)result_value(result, 0, 0)->int_val, "COUNT should skip NULL");
+
+    log_msg(LOG_INFO, "Columnar aggregate tests passed");
+}
+
+void test_columnar_update_delete(void) {
+    log_msg(LOG_INFO, "Testing columnar UPDATE and DELETE...");
+
+    reset_database();
+
+    exec("CREATE TABLE users (id INT, name STRING) STORAGE COLUMNAR;");
+    exec("INSERT INTO users VALUES (1, 'Alice'), (2, 'Bob'), (3, 'Carol');");
+    exec("UPDATE users SET name = 'Robert' WHERE id = 2;");
+
+    Table *table = find_table_by_name("users");
+    Value name = table_get_value(table, 1, 1);
+    assert_str_eq("Robert", name.char_val, "Name should be updated to 'Robert'");
+
+    exec("DELETE FROM users WHERE id = 1;");
+    assert_int_eq(2, table_row_count(table), "Table should have 2 rows after DELETE");
+    name = table_get_value(table, 0, 1);
+    assert_str_eq("Robert", name.char_val, "First remaining name should be 'Robert'");
+    name = table_get_value(table, 1, 1);
+    assert_str_eq("Carol", name.char_val, "Second remaining name should be 'Carol'");
+
+    exec("DELETE FROM users;");
+    assert_int_eq(0, table_row_count(table), "Table should be empty after DELETE");
+
+    log_msg(LOG_INFO, "Columnar UPDATE and DELETE tests passed");
+}
+
+void test_columnar_type_mismatch(void) {
+    log_msg(LOG_INFO, "Testing columnar type mismatch rejection...");
+
+    reset_database();
+
+    exec("CREATE TABLE typed (id INT, name STRING) STORAGE COLUMNAR;");
+    exec("INSERT INTO typed VALUES ('not a number', 'x');");
+    exec("INSERT INTO typed VALUES (1, 'ok');");
+
+    Table *table = find_table_by_name("typed");
+    assert_int_eq(1, table_row_count(table), "Mismatched row should be rejected");
+
+    log_msg(LOG_INFO, "Columnar type mismatch tests passed");
+}
+
+static int count_where(const char *table, const char *where) {
+    char sql[256];
+    snprintf(sql, sizeof(sql), "SELECT COUNT(*) FROM %s WHERE %s;", table, where);
+    QueryResult *result = exec_query(sql);
+    return (int)result_value(result, 0, 0)->int_val;
+}
+
+void test_columnar_compression(void) {
+    log_msg(LOG_INFO, "Testing sealed columnar segments...");
+
+    reset_database();
+
+    exec("CREATE TABLE readings (id INT, grp INT, flag BOOLEAN, kind STRING, score FLOAT) "
+         "STORAGE COLUMNAR;");
+    const char *kinds[] = {"debug", "info", "warn", "error"};
+    char sql[8192];
+    for (int i = 0; i < 10000;) {
+        string_format(sql, sizeof(sql), "INSERT INTO readings VALUES ");
+        for (int k = 0; k < 100; k++, i++) {
+            char row[96];
+            char kind[16];
+            string_format(kind, sizeof(kind), "'%s'", kinds[i % 4]);
+            string_format(row, sizeof(row), "%s(%d, %d, %s, %s, %d.5)", k ? ", " : "", i,
+                          i / 1000, i % 3 == 0 ? "TRUE" : "FALSE", i % 97 ? kind : "NULL", i % 10);
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+
+    Table *table = find_table_by_name("readings");
+    assert_int_eq(10000, table_row_count(table), "Every row should be stored");
+    const ColumnVector *id = &table->vectors[0];
+    assert_int_eq(8192, id->sealed, "Full segments should be sealed");
+    assert_int_eq(COLUMN_ENC_PACKED, id->segments[1].encoding, "Ascending ids are packed");
+    assert_int_eq(12, id->segments[1].width, "to 12 bits above the segment base");
+    assert_int_eq(COLUMN_ENC_RLE, table->vectors[1].segments[0].encoding, "Groups are runs");
+    assert_int_eq(5, table->vectors[1].segments[0].run_count, "Five groups in the first segment");
+    assert_int_eq(1, table->vectors[2].segments[0].width, "Booleans are a bitmap");
+    const ColumnSegment *kind = &table->vectors[3].segments[0];
+    assert_int_eq(4, (int)kind->dict_count, "Four distinct kinds");
+    assert_int_eq(2, kind->width, "Kinds are 2-bit codes");
+    assert_ptr_not_null(kind->nulls, "The segment keeps its NULLs");
+    size_t bytes = column_store_bytes(table);
+    assert_true(bytes * 6 < (size_t)10000 * 5 * sizeof(Value),
+                "The columns should take under a sixth of a Value a cell (%zu)", bytes);
+
+    Value v = table_get_value(table, 5003, 3);
+    assert_str_eq("error", value_str(&v), "Decoded string");
+    v = table_get_value(table, 97 * 40, 3);
+    assert_true(v.type == TYPE_NULL, "Decoded NULL");
+    v = table_get_value(table, 4321, 0);
+    assert_int_eq(4321, (int)v.int_val, "Decoded int");
+    v = table_get_value(table, 4321, 2);
+    assert_false(v.bool_val, "Decoded boolean");
+    v = table_get_value(table, 4321, 4);
+    assert_float_eq(1.5, v.float_val, 0.0001, "Decoded float");
+
+    assert_int_eq(2474, count_where("readings", "kind = 'info'"), "Dictionary equality");
+    assert_int_eq(4948, count_where("readings", "kind < 'info'"), "Dictionary range");
+    assert_int_eq(7422, count_where("readings", "kind != 'info'"), "Dictionary inequality");
+    assert_int_eq(2474, count_where("readings", "kind = 'warn'"), "Equality in the tail too");
+    assert_int_eq(0, count_where("readings", "kind = 'trace'"), "Unknown string");
+    assert_int_eq(2474, count_where("readings", "kind LIKE 'de%'"), "LIKE per dictionary entry");
+    assert_int_eq(4900, count_where("readings", "id >= 100 AND id < 5000"), "Packed range");
+    assert_int_eq(1000, count_where("readings", "grp = 3"), "Run equality");
+    assert_int_eq(6000, count_where("readings", "grp > 3"), "Run range");
+    assert_int_eq(2000, count_where("readings", "score < 2"), "Float rows");
+    assert_int_eq(3334, count_where("readings", "flag = TRUE"), "Boolean bitmap");
+    assert_int_eq(6, count_where("readings", "id IN (1, 2, 3, 4, 5, 6000, 6001, 6002) AND id < "
+                                                        "6001"),
+                  "IN over packed rows");
+
+    QueryResult *result = exec_query("SELECT SUM(grp), SUM(id), COUNT(kind) FROM readings;");
+    assert_int_eq(45000, (int)result_value(result, 0, 0)->int_val, "SUM over runs");
+    assert_int_eq(49995000, (int)result_value(result, 0, 1)->int_val, "SUM over packed rows");
+    assert_int_eq(9896, (int)result_value(result, 0, 2)->int_val, "COUNT skips sealed NULLs");
+
+    log_msg(LOG_INFO, "Testing writes to sealed rows...");
+    exec("UPDATE readings SET kind = 'zzz' WHERE id = 10;");
+    exec("UPDATE readings SET kind = 'aaa' WHERE id = 11;");
+    exec("UPDATE readings SET id = -5 WHERE id = 20;");
+    exec("UPDATE readings SET grp = NULL WHERE id = 30;");
+    exec("UPDATE readings SET kind = 'info' WHERE id = 97;");
+    assert_false(table->vectors[3].segments[0].dict_sorted, "'aaa' breaks the dictionary order");
+    assert_int_eq(1, count_where("readings", "kind = 'zzz'"), "Added dictionary string");
+    assert_int_eq(1, count_where("readings", "kind < 'b'"), "Unsorted dictionary range");
+    assert_int_eq(2475, count_where("readings", "kind = 'info'"), "A NULL became info");
+    assert_int_eq(1, count_where("readings", "id < 0"), "Negative id in a widened segment");
+    assert_int_eq(999, count_where("readings", "grp = 0"), "NULL written to a run");
+
+    exec("DELETE FROM readings WHERE id >= 0 AND id < 100;");
+    assert_int_eq(9901, table_live_row_count(table), "99 rows deleted, -5 kept");
+    table_purge_deleted(table);
+    assert_int_eq(9901, table_row_count(table), "The deleted rows are compacted away");
+    id = &table->vectors[0];
+    assert_int_eq(8192, id->sealed, "Compaction seals again");
+    assert_int_eq(13, id->segments[0].width, "-5 to 4194 packs into 13 bits");
+    assert_int_eq(COLUMN_ENC_RLE, table->vectors[1].segments[0].encoding, "Runs again");
+    assert_true(table->vectors[3].segments[0].dict_sorted, "The dictionary is sorted again");
+    v = table_get_value(table, 0, 0);
+    assert_int_eq(-5, (int)v.int_val, "First row after compaction");
+    v = table_get_value(table, 5000, 0);
+    assert_int_eq(5099, (int)v.int_val, "Rows move down across segments");
+    assert_int_eq(2450, count_where("readings", "kind = 'info'"), "Dictionary after compaction");
+
+    log_msg(LOG_INFO, "Sealed columnar segment tests passed");
+}
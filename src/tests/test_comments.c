@@ -1,3 +1,6 @@
+#include <stdio.h>
+#include <string.h>
+
 #include "test_util.h"
 #include "db.h"
 #include "logger.h"
@@ -36,6 +39,73 @@ void test_comments(void) {
     log_msg(LOG_INFO, "Comments tests passed");
 }
 
+void test_tokenizer(void) {
+    log_msg(LOG_INFO, "Testing tokens as views of the input...");
+
+    const char *sql = "SeLeCt `odd name`, COUNT(x) FROM t WHERE v >= -12.5 AND d = '2024-01-02';";
+    Token *tokens = tokenize(sql);
+    assert_ptr_not_null(tokens, "Tokenized");
+    assert_int_eq(TOKEN_KEYWORD, tokens[0].type, "Keywords match in any case");
+    assert_str_eq("SeLeCt", tokens[0].value, "Keyword text as written");
+    assert_int_eq(TOKEN_IDENTIFIER, tokens[1].type, "Backtick identifier");
+    assert_str_eq("odd name", tokens[1].value, "Backtick identifier text");
+    assert_int_eq(7, tokens[1].offset, "View starts at the quote");
+    assert_int_eq(8, tokens[1].length, "Length of the text");
+    assert_int_eq(TOKEN_AGGREGATE_FUNC, tokens[3].type, "Aggregate keyword");
+    Token *number = &tokens[12];
+    assert_int_eq(TOKEN_NUMBER, number->type, "Negative number");
+    assert_str_eq("-12.5", number->value, "Negative number text");
+    assert_int_eq((int)(strstr(sql, "-12.5") - sql), number->offset, "Number offset");
+    assert_int_eq(TOKEN_DATE, tokens[16].type, "Date literal");
+    assert_str_eq("2024-01-02", tokens[16].value, "Date text without quotes");
+    assert_int_eq(TOKEN_EOF, tokens[18].type, "Ends with EOF");
+    assert_int_eq((int)strlen(sql), tokens[18].offset, "EOF at the end of the input");
+    free_tokens(tokens);
+
+    tokens = tokenize("dictionary DICTIONARYX in_ inner select2 _select");
+    assert_int_eq(TOKEN_KEYWORD, tokens[0].type, "Longest keyword");
+    assert_int_eq(TOKEN_IDENTIFIER, tokens[1].type, "Longer than any keyword");
+    assert_int_eq(TOKEN_IDENTIFIER, tokens[2].type, "Keyword prefix");
+    assert_int_eq(TOKEN_INNER, tokens[3].type, "Keyword with its own token type");
+    assert_int_eq(TOKEN_IDENTIFIER, tokens[4].type, "Keyword with a digit");
+    assert_int_eq(TOKEN_IDENTIFIER, tokens[5].type, "Keyword with an underscore");
+    free_tokens(tokens);
+
+    /* One-character tokens outgrow the initial array, which regrows with its pool behind it. */
+    char list[401];
+    for (int i = 0; i < 200; i++) {
+        list[2 * i] = (char)('a' + i % 26);
+        list[2 * i + 1] = ',';
+    }
+    list[400] = '\0';
+    tokens = tokenize(list);
+    assert_ptr_not_null(tokens, "Tokenized a long list");
+    for (int t = 0; t < 400; t++) {
+        char text[2] = {list[t], '\0'};
+        assert_str_eq(text, tokens[t].value, "Token text survives the regrow");
+        assert_int_eq(t, tokens[t].offset, "Token offset survives the regrow");
+    }
+    assert_int_eq(TOKEN_EOF, tokens[400].type, "Long list ends with EOF");
+    free_tokens(tokens);
+
+    /* Literals are not capped at a token size. */
+    reset_database();
+    exec("CREATE TABLE notes (id INT, body STRING);");
+    char body[2048];
+    for (int i = 0; i < (int)sizeof(body) - 1; i++)
+        body[i] = (char)('a' + i % 26);
+    body[sizeof(body) - 1] = '\0';
+    char insert[2200];
+    snprintf(insert, sizeof(insert), "INSERT INTO notes VALUES (1, '%s');", body);
+    exec(insert);
+    Table *table = find_table_by_name("notes");
+    Row *row = (Row *)alist_get(&table->rows, 0);
+    Value *val = (Value *)alist_get(row, 1);
+    assert_str_eq(body, val->char_val, "Long literal stored whole");
+
+    log_msg(LOG_INFO, "Tokenizer tests passed");
+}
+
 void test_primary_key_definitions(void) {
     log_msg(LOG_INFO, "Running PRIMARY KEY definition tests...");
     reset_database();
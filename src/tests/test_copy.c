@@ -0,0 +1,306 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "dbapi.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "test_util.h"
+#include "thread_pool.h"
+#include "values.h"
+
+static char g_copy_dir[64];
+
+static void copy_dir_init(void) {
+    strcpy(g_copy_dir, "/tmp/db_copy_XXXXXX");
+    assert_true(mkdtemp(g_copy_dir) != NULL, "Failed to create a temporary directory");
+}
+
+static void copy_path(char *path, size_t size, const char *file) {
+    snprintf(path, size, "%s/%s", g_copy_dir, file);
+}
+
+static void write_file(const char *file, const char *contents) {
+    char path[128];
+    copy_path(path, sizeof(path), file);
+    FILE *out = fopen(path, "wb");
+    assert_ptr_not_null(out, "Cannot create %s", path);
+    fputs(contents, out);
+    fclose(out);
+}
+
+static void exec_copy(const char *table, const char *direction, const char *file,
+                      const char *options) {
+    char path[128];
+    char sql[512];
+    copy_path(path, sizeof(path), file);
+    snprintf(sql, sizeof(sql), "COPY %s %s '%s' %s;", table, direction, path, options);
+    exec(sql);
+}
+
+static void remove_copy_dir(const char *const *files, int count) {
+    char path[128];
+    for (int i = 0; i < count; i++) {
+        copy_path(path, sizeof(path), files[i]);
+        unlink(path);
+    }
+    rmdir(g_copy_dir);
+}
+
+static const Value *result_value(QueryResult *result, int row, int col) {
+    return (const Value *)alist_get(&result->values, row * result->col_count + col);
+}
+
+void test_copy_csv_types(void) {
+    log_msg(LOG_INFO, "Testing COPY FROM CSV with quoting, NULLs and every column type...");
+    reset_database();
+    copy_dir_init();
+    exec("CREATE TABLE items (id INT, name STRING, price FLOAT, ok BOOLEAN, day DATE, at TIME);");
+    write_file("items.csv", "id,name,price,ok,day,at\n"
+                            "1,plain,1.5,true,2024-01-31,08:30:00\n"
+                            "2,\"with, comma\",2,f,2024-02-29,23:59:59\r\n"
+                            "\n"
+                            "3,\"say \"\"hi\"\"\",,1,,\n"
+                            "4,\"two\nlines\",4.25,FALSE,1999-12-31,00:00:01\n"
+                            "5,\"\",0,0,2000-01-01,12:00:00");
+    exec_copy("items", "FROM", "items.csv", "(FORMAT CSV, HEADER)");
+
+    QueryResult *result = exec_query("SELECT * FROM items;");
+    assert_int_eq(5, alist_length(&result->rows), "Every record but the header is loaded");
+    assert_str_eq("with, comma", value_str(result_value(result, 1, 1)), "Quoted delimiter kept");
+    assert_str_eq("say \"hi\"", value_str(result_value(result, 2, 1)), "Doubled quotes unescaped");
+    assert_str_eq("two\nlines", value_str(result_value(result, 3, 1)), "Quoted newline kept");
+    assert_str_eq("", value_str(result_value(result, 4, 1)), "A quoted empty field is a string");
+    assert_true(result_value(result, 2, 2)->type == TYPE_NULL, "An empty field is NULL");
+    assert_true(result_value(result, 2, 4)->type == TYPE_NULL, "An empty DATE is NULL");
+    assert_float_eq(2.0, result_value(result, 1, 2)->float_val, 1e-9, "FLOAT parsed");
+    assert_true(result_value(result, 0, 3)->bool_val, "true parsed");
+    assert_false(result_value(result, 1, 3)->bool_val, "f parsed");
+    assert_true(result_value(result, 2, 3)->bool_val, "1 parsed");
+    assert_int_eq(2024, date_year(result_value(result, 1, 4)->date_val), "DATE year parsed");
+    assert_int_eq(29, date_day(result_value(result, 1, 4)->date_val), "DATE day parsed");
+    assert_int_eq(59, time_second(result_value(result, 1, 5)->time_val), "CR before LF dropped");
+
+    /* A column list fills the other columns with NULL; DELIMITER picks the separator. */
+    exec("CREATE TABLE pairs (a INT, b STRING, c INT);");
+    write_file("pairs.txt", "x|10\ny|20\n");
+    exec_copy("pairs (b, a)", "FROM", "pairs.txt", "WITH (DELIMITER '|')");
+    result = exec_query("SELECT a, b, c FROM pairs WHERE a = 20;");
+    assert_int_eq(1, alist_length(&result->rows), "Column list maps the fields");
+    assert_str_eq("y", value_str(result_value(result, 0, 1)), "Second field into b");
+    assert_true(result_value(result, 0, 2)->type == TYPE_NULL, "Unlisted column is NULL");
+
+    /* A malformed record fails the load; the records before it are taken back. */
+    write_file("bad.csv", "6,ok,1,true,2024-01-01,01:00:00\n7,bad,notanumber,true,,\n");
+    exec_copy("items", "FROM", "bad.csv", "");
+    result = exec_query("SELECT * FROM items;");
+    assert_int_eq(5, alist_length(&result->rows), "A malformed record fails the whole load");
+    assert_int_eq(0, alist_length(&exec_query("SELECT * FROM items WHERE id = 6;")->rows),
+                  "No row of the failed load stays");
+
+    const char *files[] = {"items.csv", "pairs.txt", "bad.csv"};
+    remove_copy_dir(files, 3);
+}
+
+void test_copy_round_trip(void) {
+    log_msg(LOG_INFO, "Testing COPY TO and back in CSV and binary formats...");
+    reset_database();
+    copy_dir_init();
+    exec("CREATE TABLE src (id INT, label STRING, score FLOAT, flag BOOLEAN, amount DECIMAL, "
+         "data BLOB, day DATE);");
+    exec("INSERT INTO src VALUES (1, 'a \"quoted\", label', 0.1, TRUE, NULL, NULL, "
+         "'2024-05-06');");
+    exec("INSERT INTO src VALUES (2, NULL, -3.75, FALSE, NULL, NULL, NULL);");
+    exec("INSERT INTO src VALUES (3, 'a string longer than the inline limit', 12345.678, TRUE, NULL, "
+         "NULL, '1970-01-01');");
+    exec("DELETE FROM src WHERE id = 2;");
+    exec("INSERT INTO src VALUES (4, '', 2.5, FALSE, NULL, NULL, '2000-02-02');");
+    write_file("amounts.csv", "5,,,,-12.345,\\x0a0b,\n6,x,,,0.07,,\n");
+    exec_copy("src", "FROM", "amounts.csv", "");
+    assert_int_eq(5, alist_length(&exec_query("SELECT * FROM src;")->rows), "DECIMALs loaded");
+
+    const char *formats[] = {"(FORMAT CSV, HEADER)", "(FORMAT BINARY)"};
+    const char *files[] = {"src.csv", "src.bin", "amounts.csv"};
+    for (int f = 0; f < 2; f++) {
+        if (f > 0)
+            exec("DROP TABLE dst;");
+        exec("CREATE TABLE dst (id INT, label STRING, score FLOAT, flag BOOLEAN, amount DECIMAL, "
+             "data BLOB, day DATE);");
+        exec_copy("src", "TO", files[f], formats[f]);
+        exec_copy("dst", "FROM", files[f], formats[f]);
+
+        QueryResult *expected = exec_query("SELECT * FROM src;");
+        int rows = alist_length(&expected->rows);
+        int cols = expected->col_count;
+        Value *values = malloc(sizeof(Value) * (size_t)(rows * cols));
+        for (int i = 0; i < rows * cols; i++)
+            values[i] = copy_value((const Value *)alist_get(&expected->values, i));
+        QueryResult *actual = exec_query("SELECT * FROM dst;");
+        assert_int_eq(5, rows, "Deleted rows are not exported");
+        assert_int_eq(rows, alist_length(&actual->rows), "%s keeps every row", files[f]);
+        for (int i = 0; i < rows * cols; i++) {
+            const Value *got = (const Value *)alist_get(&actual->values, i);
+            assert_true(value_equals(&values[i], got), "%s value %d round-trips: '%s'",
+                        files[f], i, repr(got));
+            free_value(&values[i]);
+        }
+        free(values);
+    }
+    remove_copy_dir(files, 3);
+}
+
+void test_copy_bulk_load_indexes(void) {
+    log_msg(LOG_INFO, "Testing parallel COPY parsing with indexes rebuilt after the load...");
+    reset_database();
+    copy_dir_init();
+    thread_pool_set_workers(4);
+    exec("CREATE TABLE events (id INT, kind STRING, weight INT);");
+    exec("CREATE INDEX idx_events_kind ON events (kind);");
+    exec("CREATE INDEX idx_events_id ON events USING BTREE (id);");
+    exec("INSERT INTO events VALUES (-1, 'seed', 0);");
+
+    const int row_count = 40000;
+    char path[128];
+    copy_path(path, sizeof(path), "events.csv");
+    FILE *out = fopen(path, "wb");
+    assert_ptr_not_null(out, "Cannot create %s", path);
+    for (int i = 0; i < row_count; i++)
+        fprintf(out, "%d,\"kind %d\",%d\n", i, i % 7, i % 100);
+    fclose(out);
+
+    CopyStats before;
+    copy_get_stats(&before);
+    exec_copy("events", "FROM", "events.csv", "");
+    CopyStats after;
+    copy_get_stats(&after);
+    assert_true(after.parse_tasks - before.parse_tasks > 1, "The file is parsed in pieces");
+    assert_int_eq(row_count, (int)(after.rows_in - before.rows_in), "Every row is loaded");
+    assert_int_eq(1, (int)(after.bulk_loads - before.bulk_loads), "Indexes built once");
+
+    Table *table = find_table_by_name("events");
+    assert_int_eq(row_count + 1, table_row_count(table), "Rows appended after the seed row");
+    Index *hash = find_index("idx_events_kind");
+    Index *btree = find_index("idx_events_id");
+    assert_int_eq(row_count + 1, hash->entry_count, "Hash index covers the new rows");
+    assert_int_eq(row_count + 1, btree->entry_count, "B+tree rebuilt over every row");
+
+    QueryResult *result = exec_query("SELECT id FROM events WHERE kind = 'kind 3';");
+    assert_int_eq(row_count / 7, alist_length(&result->rows), "Hash lookups find loaded rows");
+    result = exec_query("SELECT id, weight FROM events WHERE id >= 39990 AND id < 39993;");
+    assert_int_eq(3, alist_length(&result->rows), "B+tree range finds loaded rows");
+    assert_int_eq(90, (int)result_value(result, 0, 1)->int_val, "Row values in file order");
+    result = exec_query("SELECT id FROM events ORDER BY id DESC LIMIT 1;");
+    assert_int_eq(row_count - 1, (int)result_value(result, 0, 0)->int_val, "Ordered by index");
+
+    /* UNIQUE columns are checked row by row, including duplicates within the file. */
+    exec("CREATE TABLE keyed (id INT PRIMARY KEY, name STRING);");
+    exec("INSERT INTO keyed VALUES (1, 'one');");
+    write_file("keyed.csv", "2,two\n3,three\n2,again\n4,four\n");
+    copy_get_stats(&before);
+    exec_copy("keyed", "FROM", "keyed.csv", "");
+    copy_get_stats(&after);
+    assert_int_eq(0, (int)(after.bulk_loads - before.bulk_loads), "UNIQUE keeps the row path");
+    result = exec_query("SELECT * FROM keyed;");
+    assert_int_eq(1, alist_length(&result->rows), "A duplicate key fails the whole load");
+    write_file("keyed.csv", "2,two\n3,three\n4,four\n");
+    exec_copy("keyed", "FROM", "keyed.csv", "");
+    result = exec_query("SELECT name FROM keyed WHERE id = 3;");
+    assert_int_eq(1, alist_length(&result->rows), "Primary key index maintained per row");
+
+    /* In a transaction the failed load takes back its own rows and nothing else. */
+    write_file("keyed.csv", "5,five\n6,six\n5,again\n");
+    exec("BEGIN;");
+    exec("INSERT INTO keyed VALUES (7, 'seven');");
+    exec_copy("keyed", "FROM", "keyed.csv", "");
+    assert_int_eq(5, alist_length(&exec_query("SELECT id FROM keyed;")->rows),
+                  "The failed load leaves the transaction's INSERT");
+    exec("COMMIT;");
+    assert_int_eq(0, alist_length(&exec_query("SELECT id FROM keyed WHERE id = 5;")->rows),
+                  "The failed load's rows are not committed");
+    assert_int_eq(1, alist_length(&exec_query("SELECT id FROM keyed WHERE id = 7;")->rows),
+                  "The INSERT before it is");
+
+    /* Inside a transaction the loaded rows are versions that ROLLBACK removes. */
+    exec("BEGIN;");
+    exec_copy("events", "FROM", "events.csv", "");
+    assert_int_eq(2 * row_count + 1, alist_length(&exec_query("SELECT id FROM events;")->rows),
+                  "The transaction sees its load");
+    exec("ROLLBACK;");
+    assert_int_eq(row_count + 1, alist_length(&exec_query("SELECT id FROM events;")->rows),
+                  "ROLLBACK undoes the load");
+
+    thread_pool_set_workers(0);
+    const char *files[] = {"events.csv", "keyed.csv"};
+    remove_copy_dir(files, 2);
+}
+
+/* Streams a query's batches through a ResultWriter into file and returns what was written. */
+static char *write_query(const char *file, const char *sql, OutputFormat format) {
+    char path[128];
+    copy_path(path, sizeof(path), file);
+    FILE *out = fopen(path, "w+b");
+    assert_ptr_not_null(out, "Cannot create %s", path);
+    DbStatement *stmt = db_prepare(sql);
+    const ResultBatch *batch = db_step_batch(stmt);
+    int cols = db_column_count(stmt);
+    const char *names[8];
+    for (int j = 0; j < cols; j++)
+        names[j] = db_column_name(stmt, j);
+    ResultWriter writer;
+    result_writer_begin(&writer, out, format, cols, names);
+    for (; batch; batch = db_step_batch(stmt))
+        result_writer_batch(&writer, batch);
+    result_writer_end(&writer);
+    db_finalize(stmt);
+
+    long size = ftell(out);
+    char *text = calloc(1, (size_t)size + 1);
+    rewind(out);
+    assert_int_eq((int)size, (int)fread(text, 1, (size_t)size, out), "Read back %s", file);
+    fclose(out);
+    return text;
+}
+
+void test_result_writer(void) {
+    log_msg(LOG_INFO, "Testing streamed CSV, TSV, JSON lines and binary query output...");
+    reset_database();
+    copy_dir_init();
+    exec("CREATE TABLE notes (id INT, body STRING, score FLOAT, day DATE);");
+    exec("INSERT INTO notes VALUES (1, 'plain', 0.5, '2024-01-02');");
+    exec("INSERT INTO notes VALUES (2, 'a \"b\", c', NULL, NULL);");
+    exec("INSERT INTO notes VALUES (3, 'tab\there', -2.0, '1999-12-31');");
+    const char *sql = "SELECT id, body, score, day FROM notes;";
+
+    char *csv = write_query("notes.csv", sql, OUTPUT_CSV);
+    assert_str_eq("id,body,score,day\n1,plain,0.5,2024-01-02\n2,\"a \"\"b\"\", c\",,\n"
+                  "3,tab\there,-2,1999-12-31\n",
+                  csv, "CSV quotes like COPY TO");
+    char *tsv = write_query("notes.tsv", sql, OUTPUT_TSV);
+    assert_str_eq("id\tbody\tscore\tday\n1\tplain\t0.5\t2024-01-02\n2\ta \"b\", c\t\\N\t\\N\n"
+                  "3\ttab\\there\t-2\t1999-12-31\n",
+                  tsv, "TSV escapes tabs and writes NULL as \\N");
+    char *jsonl = write_query("notes.jsonl", "SELECT id, body, score FROM notes WHERE id = 2;",
+                              OUTPUT_JSONL);
+    assert_str_eq("{\"id\":2,\"body\":\"a \\\"b\\\", c\",\"score\":null}\n", jsonl,
+                  "One JSON object per row");
+    free(csv);
+    free(tsv);
+    free(jsonl);
+
+    /* Binary output is COPY's binary format, so COPY FROM loads it back. */
+    free(write_query("notes.bin", sql, OUTPUT_BINARY));
+    exec("CREATE TABLE loaded (id INT, body STRING, score FLOAT, day DATE);");
+    exec_copy("loaded", "FROM", "notes.bin", "(FORMAT BINARY)");
+    QueryResult *result = exec_query("SELECT * FROM loaded WHERE id = 3;");
+    assert_int_eq(1, alist_length(&result->rows), "Binary output loads with COPY FROM");
+    assert_str_eq("tab\there", value_str(result_value(result, 0, 1)), "Strings survive");
+
+    const char *files[] = {"notes.csv", "notes.tsv", "notes.jsonl", "notes.bin"};
+    remove_copy_dir(files, 4);
+}
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "db.h"
+#include "dbapi.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "test_util.h"
+#include "values.h"
+
+static void create_users(void) {
+    exec("CREATE TABLE users (id INT PRIMARY KEY, name STRING, score FLOAT);");
+    char sql[128];
+    for (int i = 1; i <= 50; i++) {
+        snprintf(sql, sizeof(sql), "INSERT INTO users VALUES (%d, 'user %d', %d.5);", i, i, i);
+        exec(sql);
+    }
+}
+
+void test_prepared_point_lookups(void) {
+    log_msg(LOG_INFO, "Testing db_prepare/db_bind/db_step point lookups...");
+    reset_database();
+    create_users();
+
+    DbStatement *stmt = db_prepare("SELECT name, score FROM users WHERE id = ?;");
+    assert_ptr_not_null(stmt, "SELECT with a parameter prepares");
+    assert_int_eq(1, db_bind_count(stmt), "One parameter");
+    for (int id = 1; id <= 50; id += 7) {
+        assert_true(db_bind_int(stmt, 1, id), "Bind id %d", id);
+        assert_true(db_step(stmt) == DB_ROW, "Row for id %d", id);
+        char expected[32];
+        snprintf(expected, sizeof(expected), "user %d", id);
+        assert_str_eq(expected, value_str(db_column_value(stmt, 0)), "Name of id %d", id);
+        assert_float_eq(id + 0.5, db_column_value(stmt, 1)->float_val, 1e-9, "Score");
+        assert_true(db_step(stmt) == DB_DONE, "Only one row for id %d", id);
+        assert_str_eq("name", db_column_name(stmt, 0), "Column names come from the result");
+        db_reset(stmt);
+    }
+
+    /* Unbound parameters are NULL, and bindings survive db_reset. */
+    DbStatement *range = db_prepare("SELECT id FROM users WHERE id > ? AND name != ?;");
+    assert_int_eq(2, db_bind_count(range), "Two parameters, numbered left to right");
+    db_bind_int(range, 1, 45);
+    int rows = 0;
+    while (db_step(range) == DB_ROW)
+        rows++;
+    assert_int_eq(0, rows, "A comparison with an unbound (NULL) parameter matches nothing");
+    db_reset(range);
+    db_bind_text(range, 2, "user 48");
+    while (db_step(range) == DB_ROW)
+        rows++;
+    assert_int_eq(4, rows, "The rebound text and the kept int both apply");
+    assert_false(db_bind_int(range, 3, 1), "Out of range parameter refused");
+    db_finalize(range);
+
+    /* Writes take parameters in VALUES, SET and WHERE. */
+    DbStatement *insert = db_prepare("INSERT INTO users VALUES (?, ?, ?);");
+    assert_int_eq(3, db_bind_count(insert), "INSERT parameters");
+    db_bind_int(insert, 1, 100);
+    db_bind_text(insert, 2, "a name longer than the inline string limit");
+    db_bind_null(insert, 3);
+    assert_true(db_step(insert) == DB_DONE, "INSERT has no rows");
+    assert_true(db_changes(insert) == 1, "INSERT changed one row");
+    db_finalize(insert);
+    DbStatement *update = db_prepare("UPDATE users SET score = ? WHERE id = ?;");
+    db_bind_float(update, 1, 7.25);
+    db_bind_int(update, 2, 100);
+    db_step(update);
+    assert_true(db_changes(update) == 1, "UPDATE through the index changed one row");
+    db_reset(update);
+    db_bind_int(update, 2, -1);
+    db_step(update);
+    assert_true(db_changes(update) == 0, "UPDATE of a missing id changed nothing");
+    db_finalize(update);
+    DbStatement *add = db_prepare("UPDATE users SET score = score + ? WHERE id = ?;");
+    assert_int_eq(2, db_bind_count(add), "Parameters inside a SET expression");
+    db_bind_float(add, 1, 0.5);
+    db_bind_int(add, 2, 100);
+    db_step(add);
+    assert_true(db_changes(add) == 1, "SET expression UPDATE changed one row");
+    db_finalize(add);
+
+    db_bind_int(stmt, 1, 100);
+    assert_true(db_step(stmt) == DB_ROW, "Inserted row found");
+    assert_str_eq("a name longer than the inline string limit",
+                  value_str(db_column_value(stmt, 0)), "Bound string was copied");
+    assert_float_eq(7.75, db_column_value(stmt, 1)->float_val, 1e-9, "Updated through SET ?");
+    db_finalize(stmt);
+}
+
+void test_prepared_reprepare(void) {
+    log_msg(LOG_INFO, "Testing prepared statements across DROP and CREATE TABLE...");
+    reset_database();
+    StmtCacheStats before;
+    db_stmt_cache_get_stats(&before);
+    exec("CREATE TABLE other (x INT);");
+    create_users();
+    DbStatement *stmt = db_prepare("SELECT name FROM users WHERE id = ?;");
+    db_bind_int(stmt, 1, 3);
+    assert_true(db_step(stmt) == DB_ROW, "Found before the DROP");
+    db_reset(stmt);
+
+    /* Recreated with another column order and table id; the bound 3 is kept. */
+    exec("DROP TABLE other;");
+    exec("DROP TABLE users;");
+    exec("CREATE TABLE users (name STRING, id INT);");
+    exec("INSERT INTO users VALUES ('new three', 3);");
+    assert_true(db_step(stmt) == DB_ROW, "Found after the table was recreated");
+    assert_str_eq("new three", value_str(db_column_value(stmt, 0)), "Reads the new table");
+    db_reset(stmt);
+
+    StmtCacheStats after;
+    db_stmt_cache_get_stats(&after);
+    assert_int_eq(1, (int)(after.reprepares - before.reprepares), "Parsed again once");
+
+    exec("DROP TABLE users;");
+    assert_true(db_step(stmt) == DB_ERROR, "A statement whose table is gone fails");
+    db_finalize(stmt);
+    assert_ptr_null(db_prepare("SELECT FROM WHERE;"), "A syntax error does not prepare");
+}
+
+void test_sql_prepare_execute(void) {
+    log_msg(LOG_INFO, "Testing PREPARE, EXECUTE and DEALLOCATE...");
+    reset_database();
+    create_users();
+
+    exec("PREPARE by_id AS SELECT users.name FROM users WHERE id = ? AND name != \"it's\";");
+    QueryResult *result = exec_query("EXECUTE by_id (12);");
+    assert_int_eq(1, alist_length(&result->rows), "EXECUTE runs the prepared SELECT");
+    assert_str_eq("user 12", value_str((const Value *)alist_get(&result->values, 0)),
+                  "EXECUTE binds its value");
+    result = exec_query("EXECUTE by_id (13);");
+    assert_str_eq("user 13", value_str((const Value *)alist_get(&result->values, 0)),
+                  "A second EXECUTE rebinds");
+
+    /* A short string is bound inline, not as a char_val. */
+    exec("PREPARE pick AS SELECT ? FROM users WHERE id = 12;");
+    result = exec_query("EXECUTE pick ('x');");
+    assert_int_eq(1, alist_length(&result->rows), "A parameter as the select list");
+    assert_str_eq("x", value_str((const Value *)alist_get(&result->values, 0)),
+                  "The bound string is the column");
+    exec("DEALLOCATE pick;");
+
+    exec("PREPARE ins AS INSERT INTO users (id, name) VALUES (?, ?);");
+    exec("EXECUTE ins (200, 'two hundred');");
+    exec("EXECUTE ins (201);");
+    result = exec_query("SELECT name FROM users WHERE id >= 200;");
+    assert_int_eq(1, alist_length(&result->rows), "A wrong parameter count is refused");
+
+    exec("DEALLOCATE PREPARE by_id;");
+    free_query_result(g_last_result);
+    g_last_result = NULL;
+    exec("EXECUTE by_id (12);");
+    assert_ptr_null(get_last_query_result(), "A deallocated statement no longer runs");
+    exec("DEALLOCATE ALL;");
+    exec("PREPARE ins AS DELETE FROM users WHERE id = ?;");
+    exec("EXECUTE ins (200);");
+    result = exec_query("SELECT name FROM users WHERE id >= 200;");
+    assert_int_eq(0, alist_length(&result->rows), "DEALLOCATE ALL frees the names");
+    exec("DEALLOCATE ins;");
+}
+
+void test_statement_cache(void) {
+    log_msg(LOG_INFO, "Testing the statement cache of db_exec...");
+    reset_database();
+    create_users();
+    db_stmt_cache_clear();
+
+    StmtCacheStats before;
+    db_stmt_cache_get_stats(&before);
+    assert_int_eq(0, before.entries, "Cleared cache is empty");
+    db_exec("SELECT name FROM users WHERE id = 5;");
+    db_exec("  SELECT name\t FROM users   WHERE id = 5  ; ");
+    assert_str_eq("user 5", value_str((const Value *)alist_get(&get_last_query_result()->values,
+                                                               0)),
+                  "A cached SELECT still sets the last result");
+    db_exec("SELECT name FROM users WHERE name = 'user  5';");
+    StmtCacheStats after;
+    db_stmt_cache_get_stats(&after);
+    assert_int_eq(1, (int)(after.hits - before.hits), "Whitespace differences share an entry");
+    assert_int_eq(2, (int)(after.misses - before.misses), "Another column is another entry");
+
+    db_exec("UPDATE users SET score = 0 WHERE id = 5;");
+    db_exec("UPDATE users SET score = 0 WHERE id = 5;");
+    db_exec("CREATE INDEX idx_users_name ON users (name);");
+    db_stmt_cache_get_stats(&after);
+    assert_int_eq(3, after.entries, "DDL is not cached");
+    QueryResult *result = exec_query("SELECT score FROM users WHERE id = 5;");
+    assert_float_eq(0.0, ((const Value *)alist_get(&result->values, 0))->float_val, 1e-9,
+                    "A cached UPDATE runs");
+
+    char sql[64];
+    for (int i = 0; i < STMT_CACHE_SIZE + 10; i++) {
+        snprintf(sql, sizeof(sql), "SELECT id AS id%d FROM users WHERE id = 1;", i);
+        db_exec(sql);
+    }
+    db_exec("SELECT id AS id70 FROM users WHERE id = 1;");
+    db_stmt_cache_get_stats(&after);
+    assert_int_eq(STMT_CACHE_SIZE, after.entries, "The cache is bounded");
+    assert_true(after.evictions - before.evictions >= 10, "Least recently used entries evicted");
+    assert_int_eq(3, (int)(after.hits - before.hits), "The recent statement is still cached");
+
+    assert_false(db_exec("SELEC id FROM users;"), "Parse errors are reported");
+    db_stmt_cache_clear();
+
+    /* Statements that differ only in their literals share an entry. */
+    db_stmt_cache_get_stats(&before);
+    db_exec("SELECT name, score FROM users WHERE id = 5;");
+    db_exec("SELECT name, score FROM users WHERE id = 7;");
+    assert_str_eq("user 7", value_str((const Value *)alist_get(&get_last_query_result()->values,
+                                                               0)),
+                  "The second statement's literal is bound");
+    assert_str_eq("name", *(char **)alist_get(&get_last_query_result()->column_names, 0),
+                  "Column names are unchanged");
+    db_exec("SELECT id FROM users WHERE name = 'user 3' AND score > 1.5;");
+    db_exec("SELECT id FROM users WHERE name = 'user 4' AND score > 2.5;");
+    result = get_last_query_result();
+    assert_int_eq(1, alist_length(&result->rows), "One user 4");
+    assert_int_eq(4, (int)((const Value *)alist_get(&result->values, 0))->int_val,
+                  "String and FLOAT literals are bound");
+    db_exec("UPDATE users SET score = 9.5 WHERE id = 3;");
+    db_exec("UPDATE users SET score = 8.5 WHERE id = 4;");
+    result = exec_query("SELECT score FROM users WHERE id = 4;");
+    assert_float_eq(8.5, ((const Value *)alist_get(&result->values, 0))->float_val, 1e-9,
+                    "UPDATE literals are bound");
+    db_stmt_cache_get_stats(&after);
+    assert_int_eq(3, (int)(after.hits - before.hits), "One entry per statement shape");
+    assert_int_eq(3, after.entries, "Three shapes");
+
+    /* Literals the plan is built from stay in the key. */
+    db_stmt_cache_get_stats(&before);
+    db_exec("SELECT id FROM users WHERE name LIKE 'user 1%' LIMIT 3;");
+    db_exec("SELECT id FROM users WHERE name LIKE 'user 2%' LIMIT 3;");
+    db_exec("SELECT id FROM users WHERE id IN (1, 2) LIMIT 5;");
+    db_exec("SELECT id FROM users WHERE id IN (1, 3) LIMIT 5;");
+    db_exec("SELECT id FROM users LIMIT 2;");
+    assert_int_eq(2, alist_length(&get_last_query_result()->rows), "LIMIT is kept");
+    db_exec("SELECT id FROM users LIMIT 4;");
+    assert_int_eq(4, alist_length(&get_last_query_result()->rows), "Another LIMIT, another entry");
+    db_stmt_cache_get_stats(&after);
+    assert_int_eq(0, (int)(after.hits - before.hits), "LIKE, IN and LIMIT literals are kept");
+    db_stmt_cache_clear();
+}
+
+void test_streaming_cursor(void) {
+    log_msg(LOG_INFO, "Testing batches streamed through db_step_batch...");
+    const char *storages[] = {"", " STORAGE COLUMNAR"};
+    for (int s = 0; s < 2; s++) {
+        reset_database();
+        char sql[128];
+        snprintf(sql, sizeof(sql), "CREATE TABLE points (id INT, label STRING, x FLOAT)%s;",
+                 storages[s]);
+        exec(sql);
+        for (int i = 0; i < 3000; i++) {
+            snprintf(sql, sizeof(sql),
+                     "INSERT INTO points VALUES (%d, 'a label longer than inline %d', %d.5);", i,
+                     i % 10, i);
+            exec(sql);
+        }
+        Table *table = find_table_by_name("points");
+
+        DbStatement *stmt = db_prepare("SELECT id, label, x * 2 FROM points WHERE id >= ?;");
+        db_bind_int(stmt, 1, 100);
+        const ResultBatch *batch;
+        int batches = 0, rows = 0;
+        long long ids = 0;
+        bool borrowed = true, doubled = true;
+        while ((batch = db_step_batch(stmt)) != NULL) {
+            assert_int_eq(3, batch->col_count, "Three columns (%d)", s);
+            assert_str_eq("label", db_column_name(stmt, 1), "Names while streaming (%d)", s);
+            const Value *id = db_batch_column(batch, 0);
+            const Value *label = db_batch_column(batch, 1);
+            const Value *x = db_batch_column(batch, 2);
+            for (int i = 0; i < batch->row_count; i++) {
+                ids += id[i].int_val;
+                Value stored = table_get_value(table, (int)id[i].int_val, 1);
+                borrowed &= value_str(&label[i]) == value_str(&stored);
+                doubled &= x[i].float_val == 2 * (id[i].int_val + 0.5);
+            }
+            rows += batch->row_count;
+            batches++;
+        }
+        assert_int_eq(2900, rows, "Every matching row (%d)", s);
+        assert_true(batches >= 3, "Rows arrive in several batches (%d)", s);
+        assert_true(ids == 2900LL * (100 + 2999) / 2, "Ids (%d)", s);
+        assert_true(borrowed, "Strings point into the table (%d)", s);
+        assert_true(doubled, "Computed columns (%d)", s);
+        assert_int_eq(3, db_column_count(stmt), "Columns after the last batch (%d)", s);
+
+        /* db_step walks the same batches a row at a time, and stops early on db_reset. */
+        db_reset(stmt);
+        db_bind_int(stmt, 1, 2990);
+        rows = 0;
+        while (db_step(stmt) == DB_ROW)
+            rows += db_column_value(stmt, 0)->int_val >= 2990;
+        assert_int_eq(10, rows, "Rows through db_step (%d)", s);
+        db_reset(stmt);
+        db_bind_int(stmt, 1, 0);
+        assert_true(db_step(stmt) == DB_ROW, "A first row (%d)", s);
+        db_reset(stmt);
+        db_finalize(stmt);
+
+        stmt = db_prepare("SELECT COUNT(*), MAX(id) FROM points;");
+        batch = db_step_batch(stmt);
+        assert_ptr_not_null((void *)batch, "An aggregate is one batch (%d)", s);
+        assert_int_eq(3000, (int)db_batch_column(batch, 0)[0].int_val, "COUNT(*) (%d)", s);
+        assert_int_eq(2999, (int)db_batch_column(batch, 1)[0].int_val, "MAX (%d)", s);
+        assert_ptr_null((void *)db_step_batch(stmt), "Then no more (%d)", s);
+        db_finalize(stmt);
+    }
+
+    DbStatement *insert = db_prepare("INSERT INTO points VALUES (1, 'x', 1.0);");
+    assert_ptr_null((void *)db_step_batch(insert), "Statements other than SELECT run whole");
+    assert_int_eq(3001, table_row_count(find_table_by_name("points")), "And do run");
+    db_finalize(insert);
+
+    db_set_print_results(false);
+    db_exec("SELECT id FROM points WHERE id = 7;");
+    db_set_print_results(true);
+    assert_int_eq(1, alist_length(&get_last_query_result()->rows),
+                  "Results are kept when they are not printed");
+}
@@ -264,3 +264,115 @@ void test_create_table_new_types(void) {
 
     log_msg(LOG_INFO, "CREATE TABLE with new data types tests passed");
 }
+
+void test_key_constraints_use_indexes(void) {
+    log_msg(LOG_INFO, "Testing index-backed PRIMARY KEY and UNIQUE constraints...");
+
+    reset_database();
+
+    exec("CREATE TABLE accounts (id INT PRIMARY KEY, email STRING UNIQUE, name STRING);");
+    Table *accounts = find_table_by_name("accounts");
+    assert_ptr_not_null(find_index_by_type(accounts->table_id, 0, INDEX_TYPE_HASH),
+                        "PRIMARY KEY should get a hash index");
+    assert_ptr_not_null(find_index_by_type(accounts->table_id, 1, INDEX_TYPE_HASH),
+                        "UNIQUE should get a hash index");
+    assert_true(find_index_by_table_column(accounts->table_id, 2) == NULL,
+                "Plain columns should not be indexed");
+
+    exec("INSERT INTO accounts VALUES (1, 'a@x.io', 'Ann'), (2, 'b@x.io', 'Bob');");
+    exec("INSERT INTO accounts VALUES (1, 'c@x.io', 'Cid');");
+    assert_int_eq(2, table_row_count(accounts), "Duplicate PRIMARY KEY should be rejected");
+    exec("INSERT INTO accounts VALUES (3, 'a@x.io', 'Cid');");
+    assert_int_eq(2, table_row_count(accounts), "Duplicate UNIQUE value should be rejected");
+    exec("INSERT INTO accounts VALUES (NULL, 'd@x.io', 'Dee');");
+    assert_int_eq(2, table_row_count(accounts), "NULL PRIMARY KEY should be rejected");
+    exec("INSERT INTO accounts (id, name) VALUES (4, 'Eve');");
+    exec("INSERT INTO accounts (id, name) VALUES (5, 'Fay');");
+    assert_int_eq(4, table_row_count(accounts), "UNIQUE should allow several NULLs");
+    exec("INSERT INTO accounts VALUES (6, 'g@x.io', 'Gus'), (6, 'h@x.io', 'Hal');");
+    assert_int_eq(5, table_row_count(accounts),
+                  "A duplicate within one INSERT should be rejected at its row");
+
+    exec("UPDATE accounts SET email = 'b@x.io' WHERE id = 1;");
+    QueryResult *result = exec_query("SELECT id FROM accounts WHERE email = 'b@x.io';");
+    assert_int_eq(1, alist_length(&result->rows), "UPDATE to a duplicate should be rejected");
+    exec("UPDATE accounts SET email = 'a@x.io' WHERE id = 1;");
+    result = exec_query("SELECT id FROM accounts WHERE email = 'a@x.io';");
+    assert_int_eq(1, alist_length(&result->rows), "UPDATE to a row's own value is allowed");
+
+    exec("DELETE FROM accounts WHERE id = 2;");
+    exec("INSERT INTO accounts VALUES (2, 'b@x.io', 'Bob');");
+    assert_int_eq(5, table_live_row_count(accounts), "A deleted key should be reusable");
+
+    log_msg(LOG_INFO, "Testing FOREIGN KEY checks through the referenced index...");
+    exec("CREATE TABLE tags (label STRING, weight INT);");
+    exec("INSERT INTO tags VALUES ('red', 1), ('blue', 2);");
+    exec("CREATE TABLE items (id INT PRIMARY KEY, tag STRING REFERENCES tags(label));");
+    Table *tags = find_table_by_name("tags");
+    assert_ptr_not_null(find_index_by_table_column(tags->table_id, 0),
+                        "A referenced column should get an index");
+    Table *items = find_table_by_name("items");
+    for (int i = 0; i < 2000; i++) {
+        char sql[96];
+        snprintf(sql, sizeof(sql), "INSERT INTO items VALUES (%d, '%s');", i,
+                 i % 2 ? "red" : "blue");
+        exec(sql);
+    }
+    assert_int_eq(2000, table_row_count(items), "Keyed bulk INSERT should keep every row");
+    exec("INSERT INTO items VALUES (2000, 'green');");
+    exec("INSERT INTO items VALUES (1999, 'red');");
+    assert_int_eq(2000, table_row_count(items), "FK and PK violations should still be caught");
+
+    log_msg(LOG_INFO, "Index-backed constraint tests passed");
+}
+
+void test_catalog_many_tables(void) {
+    log_msg(LOG_INFO, "Testing a catalog of hundreds of tables...");
+
+    reset_database();
+    char sql[128];
+    for (int i = 0; i < 300; i++) {
+        snprintf(sql, sizeof(sql), "CREATE TABLE part_%d (id INT PRIMARY KEY, v INT);", i);
+        exec(sql);
+    }
+    assert_int_eq(300, alist_length(&tables), "Every table should be created");
+    Table *last = find_table_by_name("part_299");
+    assert_ptr_not_null(last, "Tables past the old limit are found by name");
+    assert_int_eq(300, last->table_id, "Ids go past one byte");
+    assert_true(get_table_by_id(300) == last, "Found by id");
+    assert_int_eq(300, find_table_id_by_name("part_299"), "Id by name");
+    assert_int_eq(0, find_table_id_by_name("part_300"), "Missing names give id 0");
+
+    exec("INSERT INTO part_299 VALUES (1, 10), (2, 20);");
+    QueryResult *result = exec_query("SELECT v FROM part_299 WHERE id = 2;");
+    assert_int_eq(1, alist_length(&result->rows), "Point lookup on a high table id");
+
+    /* A dropped table's id goes to the next table created; the ids of the others hold. */
+    exec("DROP TABLE part_6;");
+    assert_true(get_table_by_id(7) == NULL, "The dropped id is free");
+    assert_true(find_table_by_name("part_299") != NULL, "Later tables survive the drop");
+    assert_int_eq(300, find_table_by_name("part_299")->table_id, "Their ids are unchanged");
+    exec("CREATE TABLE newcomer (id INT);");
+    assert_int_eq(7, find_table_id_by_name("newcomer"), "The lowest free id is reused");
+    assert_true(find_index_by_table_column(7, 0) == NULL,
+                "The new table does not inherit the dropped table's indexes");
+
+    /* A row goes into each index on its column once. */
+    exec("CREATE INDEX idx_newcomer_id ON newcomer USING BTREE (id);");
+    exec("CREATE INDEX idx_newcomer_hash ON newcomer USING HASH (id);");
+    exec("INSERT INTO newcomer VALUES (5), (6);");
+    Index *hash = find_index("idx_newcomer_hash");
+    assert_ptr_not_null(hash, "Index found by name");
+    assert_int_eq(7, hash->table_id, "Index of the new table");
+    Value key = {.type = TYPE_INT, .int_val = 5};
+    ArrayList rows;
+    alist_init(&rows, sizeof(int), NULL);
+    lookup_index_values(hash, &key, &rows);
+    assert_int_eq(1, alist_length(&rows), "One entry per row");
+    alist_destroy(&rows);
+    exec("DROP INDEX idx_newcomer_hash;");
+    assert_true(find_index("idx_newcomer_hash") == NULL, "Dropped index is gone");
+    assert_ptr_not_null(find_index("idx_newcomer_id"), "The other index stays");
+
+    log_msg(LOG_INFO, "Catalog tests passed");
+}
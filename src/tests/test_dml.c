@@ -6,6 +6,7 @@
 #include "logger.h"
 #include "table.h"
 #include "test_util.h"
+#include "values.h"
 
 void test_insert_single_row(void) {
     log_msg(LOG_INFO, "Testing INSERT single row...");
@@ -271,6 +272,37 @@ void test_update_with_expression(void) {
     log_msg(LOG_INFO, "UPDATE with expressions tests passed");
 }
 
+void test_update_expression_values(void) {
+    log_msg(LOG_INFO, "Testing UPDATE SET expression values...");
+
+    reset_database();
+
+    exec("CREATE TABLE accounts (id INT, balance INT, rate FLOAT);");
+    exec("INSERT INTO accounts VALUES (1, 10, 1.5);");
+    exec("INSERT INTO accounts VALUES (2, 20, 2.5);");
+
+    /* The WHERE after an expression still applies. */
+    exec("UPDATE accounts SET balance = balance + 5 WHERE id = 2;");
+    Table *table = find_table_by_name("accounts");
+    assert_int_eq(10, (int)table_get_value(table, 0, 1).int_val, "Other row untouched");
+    assert_int_eq(25, (int)table_get_value(table, 1, 1).int_val, "balance + 5");
+
+    /* Every expression reads the old row; results take the column's type. */
+    exec("UPDATE accounts SET balance = rate * 2, rate = balance WHERE id = 1;");
+    Value balance = table_get_value(table, 0, 1);
+    Value rate = table_get_value(table, 0, 2);
+    assert_true(balance.type == TYPE_INT, "An INT column stays INT");
+    assert_int_eq(3, (int)balance.int_val, "rate * 2 of the old row");
+    assert_true(rate.type == TYPE_FLOAT, "A FLOAT column stays FLOAT");
+    assert_float_eq(10.0, rate.float_val, 1e-9, "balance of the old row");
+
+    Token *tokens = tokenize("UPDATE accounts SET balance = 5 6 WHERE id = 1;");
+    assert_true(parse(tokens) == NULL, "Tokens left after a SET value are an error");
+    free_tokens(tokens);
+
+    log_msg(LOG_INFO, "UPDATE SET expression value tests passed");
+}
+
 void test_update_multiple_columns(void) {
     log_msg(LOG_INFO, "Testing UPDATE with multiple columns...");
 
@@ -404,7 +436,7 @@ void test_insert_select_new_types(void) {
 
     val = (Value *)alist_get(row, 3);
     assert_int_eq(TYPE_STRING, val->type, "Fourth value should be STRING");
-    assert_true(val->char_val && strcmp(val->char_val, "Product A") == 0,
+    assert_true(strcmp(value_str(val), "Product A") == 0,
                 "description should be 'Product A'");
 
     row = (Row *)alist_get(&table->rows, 1);
@@ -418,3 +450,59 @@ void test_insert_select_new_types(void) {
 
     log_msg(LOG_INFO, "INSERT and SELECT with new data types tests passed");
 }
+
+static int count_items(const char *where) {
+    char sql[128];
+    snprintf(sql, sizeof(sql), "SELECT id FROM items WHERE %s;", where);
+    QueryResult *result = exec_query(sql);
+    return alist_length(&result->rows);
+}
+
+void test_delete_in_place(void) {
+    log_msg(LOG_INFO, "Testing DELETE without compaction...");
+    const char *storages[] = {"", " STORAGE COLUMNAR"};
+    for (int s = 0; s < 2; s++) {
+        reset_database();
+        char sql[128];
+        snprintf(sql, sizeof(sql),
+                 "CREATE TABLE items (id INT PRIMARY KEY, tag STRING, qty INT)%s;", storages[s]);
+        exec(sql);
+        exec("CREATE INDEX idx_items_qty ON items USING BTREE (qty);");
+        for (int i = 0; i < 100; i++) {
+            snprintf(sql, sizeof(sql), "INSERT INTO items VALUES (%d, 't%d', %d);", i, i, i % 10);
+            exec(sql);
+        }
+        Table *table = find_table_by_name("items");
+
+        exec("DELETE FROM items WHERE id < 5;");
+        assert_int_eq(100, table_row_count(table), "A small DELETE leaves the rows (%d)", s);
+        assert_int_eq(95, table_live_row_count(table), "Five rows are deleted (%d)", s);
+        assert_true(table_row_deleted(table, 4) && !table_row_deleted(table, 5), "Marks");
+        assert_int_eq(50, (int)table_get_value(table, 50, 0).int_val, "Rows keep their numbers");
+        assert_int_eq(95, count_items("id >= 0"), "Scans skip deleted rows (%d)", s);
+        assert_int_eq(9, count_items("qty = 3"), "B-tree entries are removed (%d)", s);
+        assert_int_eq(0, count_items("id = 2"), "Hash entries are removed (%d)", s);
+
+        exec("INSERT INTO items VALUES (2, 'again', 2);");
+        assert_int_eq(96, table_live_row_count(table), "A deleted key can be reused (%d)", s);
+        assert_int_eq(1, count_items("id = 2"), "The new row is found (%d)", s);
+        exec("UPDATE items SET qty = 42 WHERE id = 50;");
+        assert_int_eq(1, count_items("qty = 42"), "UPDATE moves the index entry (%d)", s);
+        exec("DELETE FROM items WHERE id = 3;");
+        assert_int_eq(96, table_live_row_count(table), "Deleting a deleted row is a no-op");
+
+        exec("CREATE INDEX idx_items_tag ON items (tag);");
+        assert_int_eq(0, count_items("tag = 't1'"), "A new index skips deleted rows (%d)", s);
+        assert_int_eq(1, count_items("tag = 't7'"), "And holds the live ones (%d)", s);
+
+        /* 5 + 25 + the reinserted row reach a quarter of the 101 rows. */
+        exec("DELETE FROM items WHERE id < 30;");
+        assert_int_eq(70, table_row_count(table), "A large DELETE compacts (%d)", s);
+        assert_ptr_null(table->tombstones, "No marks are left (%d)", s);
+        assert_int_eq(30, (int)table_get_value(table, 0, 0).int_val, "Rows moved down");
+        assert_int_eq(7, count_items("qty = 3"), "Indexes follow the compaction (%d)", s);
+        assert_int_eq(1, count_items("tag = 't99'"), "Hash indexes too (%d)", s);
+    }
+
+    log_msg(LOG_INFO, "DELETE without compaction tests passed");
+}
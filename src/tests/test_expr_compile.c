@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "test_util.h"
+#include "values.h"
+
+static const Value *cell(QueryResult *result, int row, int col) {
+    return (const Value *)alist_get(&result->values, row * result->col_count + col);
+}
+
+static void fill_numbers(const char *storage) {
+    char sql[160];
+    snprintf(sql, sizeof(sql), "CREATE TABLE nums (a INT, b INT, f FLOAT, s STRING)%s;", storage);
+    exec(sql);
+    for (int i = 0; i < 600; i++) {
+        if (i % 100 == 7)
+            snprintf(sql, sizeof(sql), "INSERT INTO nums VALUES (NULL, %d, NULL, NULL);", i);
+        else
+            snprintf(sql, sizeof(sql), "INSERT INTO nums VALUES (%d, %d, %d.25, 'row %d');", i,
+                     i % 13, i, i);
+        exec(sql);
+    }
+}
+
+void test_compiled_projection(void) {
+    log_msg(LOG_INFO, "Testing compiled projections against their row-by-row values...");
+    const char *storages[] = {"", " STORAGE COLUMNAR"};
+    for (int s = 0; s < 2; s++) {
+        reset_database();
+        fill_numbers(storages[s]);
+        QueryResult *result = exec_query("SELECT a + b * 2, a - f, a * 3 < b, f >= a, "
+                                         "UPPER(s), LENGTH(s) + 1, a / 4, a % 5, NOT a FROM nums;");
+        assert_int_eq(600, alist_length(&result->rows), "Every row projected (%d)", s);
+        for (int i = 0; i < 600; i++) {
+            bool null_row = i % 100 == 7;
+            const Value *sum = cell(result, i, 0);
+            if (null_row) {
+                Value null_val = {0};
+                null_val.type = TYPE_NULL;
+                Value doubled = eval_binary_values(OP_MULTIPLY, (Value){.type = TYPE_INT,
+                                                                         .int_val = i},
+                                                   (Value){.type = TYPE_INT, .int_val = 2});
+                Value expected = eval_binary_values(OP_ADD, null_val, doubled);
+                assert_int_eq(expected.type, sum->type, "NULL operand keeps the generic result");
+                assert_int_eq(1, (int)cell(result, i, 8)->int_val, "NOT NULL is 1");
+                continue;
+            }
+            assert_int_eq(TYPE_INT, sum->type, "INT + INT stays INT");
+            assert_int_eq(i + (i % 13) * 2, (int)sum->int_val, "a + b * 2 at row %d", i);
+            assert_float_eq(-0.25, cell(result, i, 1)->float_val, 1e-9, "a - f at row %d", i);
+            assert_int_eq(i * 3 < i % 13, (int)cell(result, i, 2)->int_val, "a * 3 < b");
+            assert_int_eq(1, (int)cell(result, i, 3)->int_val, "f >= a");
+            char upper[32];
+            snprintf(upper, sizeof(upper), "ROW %d", i);
+            assert_str_eq(upper, value_str(cell(result, i, 4)), "UPPER(s) at row %d", i);
+            assert_int_eq((int)strlen(upper) + 1, (int)cell(result, i, 5)->int_val,
+                          "LENGTH(s) + 1");
+            assert_int_eq(i / 4, (int)cell(result, i, 6)->int_val, "a / 4");
+            assert_int_eq(i % 5, (int)cell(result, i, 7)->int_val, "a %% 5");
+            assert_int_eq(0, (int)cell(result, i, 8)->int_val, "NOT of a value is 0");
+        }
+    }
+}
+
+void test_compile_folding_and_sharing(void) {
+    log_msg(LOG_INFO, "Testing constant folding and shared subexpressions...");
+    reset_database();
+    fill_numbers("");
+
+    ExprCompileStats before;
+    expr_compile_get_stats(&before);
+    QueryResult *result = exec_query("SELECT 2 * 3 + a, UPPER('abc'), LOWER(UPPER('MiX')) "
+                                     "FROM nums WHERE a < 3;");
+    ExprCompileStats after;
+    expr_compile_get_stats(&after);
+    assert_int_eq(1, (int)(after.programs - before.programs), "One program per projection");
+    assert_int_eq(4, (int)(after.folded - before.folded), "2 * 3 and the three functions fold");
+    assert_int_eq(2, (int)(after.instructions - before.instructions), "Only a and + + a run");
+    assert_int_eq(3, alist_length(&result->rows), "Filtered rows projected");
+    assert_int_eq(8, (int)cell(result, 2, 0)->int_val, "2 * 3 + a");
+    assert_str_eq("ABC", value_str(cell(result, 1, 1)), "Folded string constant");
+    assert_str_eq("mix", value_str(cell(result, 0, 2)), "Nested folded functions");
+
+    expr_compile_get_stats(&before);
+    result = exec_query("SELECT a + b, (a + b) * 2, (a + b) * 2 - a FROM nums WHERE b = 12;");
+    expr_compile_get_stats(&after);
+    assert_int_eq(3, (int)(after.shared - before.shared), "a + b, (a + b) * 2 and a are reused");
+    assert_int_eq(5, (int)(after.instructions - before.instructions),
+                  "Two loads, one add, one multiply and one subtract");
+    assert_int_eq(3, (int)(after.typed - before.typed), "All INT operators are typed");
+    for (int i = 0; i < alist_length(&result->rows); i++) {
+        long long sum = cell(result, i, 0)->int_val;
+        assert_int_eq((int)(sum * 2), (int)cell(result, i, 1)->int_val, "Shared register read");
+        assert_int_eq((int)(sum * 2 - (sum - 12)), (int)cell(result, i, 2)->int_val,
+                      "Nested shared registers");
+    }
+
+    /* Plain column lists keep the copying path; aggregates are not compiled. */
+    expr_compile_get_stats(&before);
+    exec_query("SELECT a, s FROM nums WHERE a = 1;");
+    exec_query("SELECT b, COUNT(*) FROM nums GROUP BY b;");
+    expr_compile_get_stats(&after);
+    assert_int_eq(0, (int)(after.programs - before.programs), "Nothing to compile");
+}
+
+void test_compiled_join_projection(void) {
+    log_msg(LOG_INFO, "Testing compiled projections over joined rows...");
+    reset_database();
+    exec("CREATE TABLE orders (id INT, customer INT, amount FLOAT);");
+    exec("CREATE TABLE customers (id INT, name STRING, discount FLOAT);");
+    exec("INSERT INTO customers VALUES (1, 'ann', 0.5);");
+    exec("INSERT INTO customers VALUES (2, 'bob', 0.25);");
+    exec("INSERT INTO orders VALUES (10, 1, 100.0);");
+    exec("INSERT INTO orders VALUES (11, 2, 40.0);");
+    exec("INSERT INTO orders VALUES (12, 3, 10.0);");
+    QueryResult *result = exec_query("SELECT orders.id, orders.amount * customers.discount, "
+                                     "UPPER(customers.name) FROM orders LEFT JOIN customers ON "
+                                     "orders.customer = customers.id ORDER BY orders.id;");
+    assert_int_eq(3, alist_length(&result->rows), "LEFT JOIN rows");
+    assert_float_eq(50.0, cell(result, 0, 1)->float_val, 1e-9, "Columns of both tables");
+    assert_float_eq(10.0, cell(result, 1, 1)->float_val, 1e-9, "Second joined row");
+    assert_str_eq("BOB", value_str(cell(result, 1, 2)), "Function of a joined column");
+    assert_true(cell(result, 2, 2)->type == TYPE_NULL, "NULL side stays NULL");
+}
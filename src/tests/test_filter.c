@@ -0,0 +1,208 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "logger.h"
+#include "table.h"
+#include "test_util.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#define FILTER_TEST_ROWS 2500
+
+static void fill_filter_table(const char *storage) {
+    char sql[4096];
+    string_format(sql, sizeof(sql), "CREATE TABLE nums (id INT, val FLOAT, tag STRING)%s;",
+                  storage);
+    exec(sql);
+
+    for (int start = 0; start < FILTER_TEST_ROWS; start += 100) {
+        string_format(sql, sizeof(sql), "INSERT INTO nums VALUES ");
+        for (int i = start; i < start + 100; i++) {
+            char row[64];
+            string_format(row, sizeof(row), "%s(%d, %d.5, '%s')", i == start ? "" : ", ", i,
+                          i % 10, i % 2 == 0 ? "even" : "odd");
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+}
+
+static int count_rows(const char *where) {
+    char sql[256];
+    string_format(sql, sizeof(sql), "SELECT id FROM nums WHERE %s;", where);
+    QueryResult *result = exec_query(sql);
+    return alist_length(&result->rows);
+}
+
+static void check_filter_counts(void) {
+    assert_int_eq(100, count_rows("id < 100"), "id < 100");
+    assert_int_eq(2400, count_rows("100 <= id"), "100 <= id (constant on the left)");
+    assert_int_eq(1, count_rows("id = 2000"), "id = 2000");
+    assert_int_eq(2499, count_rows("id != 2000"), "id != 2000");
+    assert_int_eq(250, count_rows("val > 8.9"), "val > 8.9");
+    assert_int_eq(250, count_rows("val < 1"), "FLOAT column against INT constant");
+    assert_int_eq(25, count_rows("id >= 1000 AND id < 1250 AND val < 1"), "chained AND");
+    assert_int_eq(600, count_rows("id < 100 OR id >= 2000"), "OR across batches");
+    assert_int_eq(300, count_rows("(id < 100 OR id >= 2000) AND val < 5"), "OR under AND");
+    assert_int_eq(1250, count_rows("tag = 'even'"), "per-row fallback on strings");
+    assert_int_eq(50, count_rows("tag = 'odd' AND id < 100"), "mixed kernel and fallback");
+    assert_int_eq(2400, count_rows("NOT (id < 100)"), "NOT");
+}
+
+void test_batch_filter_row_storage(void) {
+    log_msg(LOG_INFO, "Testing batch filter on row storage...");
+
+    reset_database();
+    fill_filter_table("");
+    check_filter_counts();
+
+    log_msg(LOG_INFO, "Batch filter on row storage tests passed");
+}
+
+void test_batch_filter_columnar_storage(void) {
+    log_msg(LOG_INFO, "Testing batch filter on columnar storage...");
+
+    reset_database();
+    fill_filter_table(" STORAGE COLUMNAR");
+    check_filter_counts();
+
+    log_msg(LOG_INFO, "Batch filter on columnar storage tests passed");
+}
+
+/* v is NULL for every 4th id and id % 10 otherwise; s is NULL for every 5th id. */
+static void check_not_with_nulls(const char *storage) {
+    char sql[4096];
+    reset_database();
+    string_format(sql, sizeof(sql), "CREATE TABLE nums (id INT, v INT, s STRING)%s;", storage);
+    exec(sql);
+    string_format(sql, sizeof(sql), "INSERT INTO nums VALUES ");
+    for (int i = 0; i < 100; i++) {
+        char row[64];
+        char v[8], s[8];
+        string_format(v, sizeof(v), i % 4 == 0 ? "NULL" : "%d", i % 10);
+        string_format(s, sizeof(s), "%s", i % 5 == 0 ? "NULL" : (i % 2 == 0 ? "'x'" : "'y'"));
+        string_format(row, sizeof(row), "%s(%d, %s, %s)", i == 0 ? "" : ", ", i, v, s);
+        str_append(sql, sizeof(sql), row);
+    }
+    str_append(sql, sizeof(sql), ";");
+    exec(sql);
+
+    assert_int_eq(65, count_rows("NOT (v = 5)"), "NOT leaves out NULLs (%s)", storage);
+    assert_int_eq(10, count_rows("NOT (NOT (v = 5))"), "Double NOT");
+    assert_int_eq(69, count_rows("NOT (v = 5) OR id < 10"), "NOT under OR");
+    assert_int_eq(59, count_rows("NOT (v = 5 OR id < 10)"), "NOT over OR");
+    assert_int_eq(82, count_rows("NOT (v = 5 AND id < 50)"), "NOT over AND");
+    assert_int_eq(40, count_rows("NOT (s = 'x')"), "NOT over a per-row string comparison");
+    assert_int_eq(60, count_rows("NOT (v IN (1, 2))"), "NOT over IN");
+    assert_int_eq(75, count_rows("NOT (v > id)"), "NOT over a column comparison");
+}
+
+void test_batch_filter_not_nulls(void) {
+    log_msg(LOG_INFO, "Testing NOT over NULLs in the batch filter...");
+
+    check_not_with_nulls("");
+    check_not_with_nulls(" STORAGE COLUMNAR");
+
+    log_msg(LOG_INFO, "NOT over NULLs tests passed");
+}
+
+void test_batch_filter_dml(void) {
+    log_msg(LOG_INFO, "Testing batch filter in UPDATE and DELETE...");
+
+    reset_database();
+    fill_filter_table(" STORAGE COLUMNAR");
+
+    exec("UPDATE nums SET tag = 'low' WHERE id < 1500 AND val < 2;");
+    assert_int_eq(300, count_rows("tag = 'low'"), "UPDATE should touch 300 rows");
+
+    exec("DELETE FROM nums WHERE id >= 1024 OR val > 8;");
+    Table *table = find_table_by_name("nums");
+    assert_int_eq(820, table_row_count(table), "DELETE should keep 820 rows");
+    assert_int_eq(0, count_rows("id >= 1024"), "No rows past the first batch should remain");
+
+    log_msg(LOG_INFO, "Batch filter in UPDATE and DELETE tests passed");
+}
+
+#define ZONE_TEST_ROWS 40000 /* ten zone map blocks, the last one partial */
+
+/* Event ids and timestamps grow with the row number; note is NULL in the first two blocks. */
+static void fill_events(const char *storage) {
+    char sql[8192];
+    string_format(sql, sizeof(sql), "CREATE TABLE events (id INT, ts INT, note INT)%s;",
+                  storage);
+    exec(sql);
+    for (int start = 0; start < ZONE_TEST_ROWS; start += 200) {
+        string_format(sql, sizeof(sql), "INSERT INTO events VALUES ");
+        for (int i = start; i < start + 200; i++) {
+            char row[64];
+            if (i < 2 * ZONE_MAP_ROWS)
+                string_format(row, sizeof(row), "%s(%d, %d, NULL)", i == start ? "" : ", ", i,
+                              1700000000 + i * 60);
+            else
+                string_format(row, sizeof(row), "%s(%d, %d, %d)", i == start ? "" : ", ", i,
+                              1700000000 + i * 60, i % 7);
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+}
+
+static int count_events(const char *where, int *skipped) {
+    char sql[256];
+    string_format(sql, sizeof(sql), "SELECT id FROM events WHERE %s;", where);
+    ZoneMapStats before, after;
+    zone_map_get_stats(&before);
+    int rows = alist_length(&exec_query(sql)->rows);
+    zone_map_get_stats(&after);
+    *skipped = (int)(after.blocks_skipped - before.blocks_skipped);
+    return rows;
+}
+
+void test_zone_map_skipping(void) {
+    log_msg(LOG_INFO, "Testing zone map block skipping...");
+    const char *storages[] = {"", " STORAGE COLUMNAR"};
+    const char *workers[] = {"SET max_parallel_workers = 1;", "SET max_parallel_workers = 4;"};
+    for (int s = 0; s < 2; s++) {
+        for (int w = 0; w < 2; w++) {
+            reset_database();
+            fill_events(storages[s]);
+            exec(workers[w]);
+            int skipped;
+            assert_int_eq(1000, count_events("id >= 39000", &skipped), "Tail (%d, %d)", s, w);
+            assert_int_eq(9, skipped, "Only the last block is read");
+            assert_int_eq(60, count_events("ts >= 1700300000 AND ts <= 1700303540", &skipped),
+                          "Timestamp range");
+            assert_int_eq(9, skipped, "The range falls in one block");
+            assert_int_eq(20, count_events("id < 10 OR 39990 <= id", &skipped), "OR");
+            assert_int_eq(8, skipped, "OR reads the first and last blocks");
+            assert_int_eq(4544, count_events("note = 3", &skipped), "Equality");
+            assert_int_eq(2, skipped, "All-NULL blocks are skipped");
+            assert_int_eq(0, count_events("id > 40000", &skipped), "Past the end");
+            assert_int_eq(10, skipped, "Every block is skipped");
+            assert_int_eq(39999, count_events("id != 7", &skipped), "!=");
+            assert_int_eq(0, skipped, "!= rules out only single-valued blocks");
+
+            /* Updates widen a block's range and appends extend the last one. */
+            exec("UPDATE events SET id = 1000000 WHERE id = 5;");
+            assert_int_eq(1, count_events("id > 999999", &skipped), "Updated row is found");
+            assert_int_eq(9, skipped, "The updated block was widened");
+            exec("INSERT INTO events VALUES (6, 0, NULL);");
+            assert_int_eq(2, count_events("id = 6", &skipped), "Appended row is found");
+            assert_int_eq(8, skipped, "The appended row widened the last block");
+
+            /* DELETE skips blocks too, and the compacted table gets a fresh map. */
+            exec("DELETE FROM events WHERE id >= 30000 AND id < 1000000;");
+            Table *events = find_table_by_name("events");
+            assert_int_eq(30001, table_live_row_count(events), "DELETE");
+            table_purge_deleted(events);
+            assert_int_eq(1002, count_events("id >= 29000 OR ts < 1700000000", &skipped),
+                          "After compaction");
+            assert_int_eq(6, skipped, "Blocks of the compacted table");
+        }
+    }
+    thread_pool_set_workers(1);
+}
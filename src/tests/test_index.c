@@ -1,8 +1,12 @@
+#include <string.h>
+
 #include "arraylist.h"
 #include "db.h"
 #include "logger.h"
+#include "table.h"
 #include "utils.h"
 #include "test_util.h"
+#include "values.h"
 
 extern ArrayList indexes;
 
@@ -19,9 +23,9 @@ void test_create_index(void) {
     exec("CREATE INDEX idx_users_id ON users (id);");
 
     int index_count = alist_length(&indexes);
-    assert_int_eq(1, index_count, "Should have 1 index");
+    assert_int_eq(2, index_count, "Should have the PRIMARY KEY index and 1 created index");
 
-    Index *index = (Index *)alist_get(&indexes, 0);
+    Index *index = (Index *)alist_get(&indexes, 1);
     assert_ptr_not_null(index, "Index should exist");
     assert_true(index->index_name[0] != '\0', "Index name should be set");
     assert_str_eq("idx_users_id", index->index_name, "Index name should be 'idx_users_id'");
@@ -188,8 +192,9 @@ void test_hash_join_large_tables(void) {
         exec(sql);
     }
 
-    exec("SELECT * FROM orders JOIN customers ON orders.customer_id = customers.customer_id LIMIT "
-         "100;");
+    QueryResult *result = exec_query("SELECT * FROM orders JOIN customers ON orders.customer_id = "
+                                     "customers.customer_id LIMIT 100;");
+    assert_int_eq(100, alist_length(&result->rows), "LIMIT over a hash join");
 
     log_msg(LOG_INFO, "HASH JOIN with large tables tests passed");
 }
@@ -210,8 +215,9 @@ void test_hash_join_multiple_matches(void) {
     exec("INSERT INTO products VALUES (4, 'Novel', 2);");
     exec("INSERT INTO products VALUES (5, 'Magazine', 2);");
 
-    exec("SELECT c.name AS category, p.name AS product FROM categories c JOIN products p ON c.id = "
-         "p.category_id;");
+    QueryResult *result = exec_query("SELECT c.name AS category, p.name AS product FROM "
+                                     "categories c JOIN products p ON c.id = p.category_id;");
+    assert_int_eq(5, alist_length(&result->rows), "Every product joins its category");
 
     log_msg(LOG_INFO, "HASH JOIN with multiple matches tests passed");
 }
@@ -322,3 +328,454 @@ void test_complex_join_with_index(void) {
 
     log_msg(LOG_INFO, "Complex join with indexed columns tests passed");
 }
+
+static int count_index_rows(const char *sql) {
+    QueryResult *result = exec_query(sql);
+    return alist_length(&result->rows);
+}
+
+static Value *index_result_value(QueryResult *result, int row, int col) {
+    return (Value *)alist_get(&result->values, row * result->col_count + col);
+}
+
+static void fill_events(const char *storage, int rows) {
+    char sql[8192];
+    string_format(sql, sizeof(sql), "CREATE TABLE events (id INT, score FLOAT, kind STRING)%s;",
+                  storage);
+    exec(sql);
+    for (int start = 0; start < rows; start += 100) {
+        string_format(sql, sizeof(sql), "INSERT INTO events VALUES ");
+        for (int i = start; i < start + 100 && i < rows; i++) {
+            char row[96];
+            string_format(row, sizeof(row), "%s(%d, %d.5, '%s')", i == start ? "" : ", ", i,
+                          (i * 7) % 1000, i % 3 == 0 ? "a" : "b");
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+}
+
+void test_btree_basic(void) {
+    log_msg(LOG_INFO, "Testing B-tree insert, delete and ordered scan...");
+
+    Index index;
+    memclear(&index, sizeof(Index));
+    strcopy(index.index_name, sizeof(index.index_name), "idx_unit");
+    index.type = INDEX_TYPE_BTREE;
+
+    const int n = 20000;
+    for (int i = 0; i < n; i++) {
+        Value key = {.type = TYPE_INT, .int_val = (i * 7919) % n};
+        assert_true(btree_insert(&index, &key, i), "Insert should succeed");
+    }
+    assert_int_eq(n, (int)index.entry_count, "Tree should hold every key");
+    assert_true(!index.data.btree.root->is_leaf, "Tree should have grown inner levels");
+
+    BTreeCursor cursor;
+    btree_cursor_open(&index, false, &cursor);
+    int row_idx;
+    int seen = 0;
+    long long prev = -1;
+    while (btree_cursor_next(&cursor, &row_idx)) {
+        long long key = (row_idx * 7919LL) % n;
+        assert_true(key > prev, "Leaf chain should be in ascending key order");
+        prev = key;
+        seen++;
+    }
+    assert_int_eq(n, seen, "Ordered scan should visit every entry");
+
+    for (int i = 0; i < n; i += 2) {
+        Value key = {.type = TYPE_INT, .int_val = (i * 7919) % n};
+        assert_true(btree_delete(&index, &key, i), "Delete should find the entry");
+    }
+    assert_int_eq(n / 2, (int)index.entry_count, "Half of the entries should remain");
+
+    Value lo = {.type = TYPE_INT, .int_val = 100};
+    Value hi = {.type = TYPE_INT, .int_val = 199};
+    ArrayList *range = btree_find_range(&index, &lo, &hi);
+    assert_ptr_not_null(range, "Range scan should return a list");
+    for (int i = 0; i < alist_length(range); i++) {
+        int row = *(int *)alist_get(range, i);
+        long long key = (row * 7919LL) % n;
+        assert_true(row % 2 == 1 && key >= 100 && key <= 199, "Range should hold live keys only");
+    }
+    assert_int_eq(50, alist_length(range), "Range should hold the surviving half");
+    alist_destroy(range);
+    free(range);
+
+    btree_index_free(&index);
+
+    log_msg(LOG_INFO, "B-tree insert, delete and ordered scan tests passed");
+}
+
+static void check_range_counts(void) {
+    assert_int_eq(100, count_index_rows("SELECT id FROM events WHERE id < 100;"), "id < 100");
+    assert_int_eq(101, count_index_rows("SELECT id FROM events WHERE id <= 100;"), "id <= 100");
+    assert_int_eq(99, count_index_rows("SELECT id FROM events WHERE id > 2900;"), "id > 2900");
+    assert_int_eq(100, count_index_rows("SELECT id FROM events WHERE 2900 <= id;"),
+                  "constant on the left");
+    assert_int_eq(500, count_index_rows("SELECT id FROM events WHERE id > 1000 AND id <= 1500;"),
+                  "BETWEEN-style pair");
+    assert_int_eq(0, count_index_rows("SELECT id FROM events WHERE id > 1500 AND id < 1000;"),
+                  "empty range");
+    assert_int_eq(166, count_index_rows(
+                           "SELECT id FROM events WHERE id >= 1000 AND id < 1500 AND kind = 'a';"),
+                  "range with residual predicate");
+    assert_int_eq(1, count_index_rows("SELECT id FROM events WHERE id = 1234;"), "equality");
+}
+
+void test_btree_index_range_scan(void) {
+    log_msg(LOG_INFO, "Testing range scans through a B-tree index...");
+
+    reset_database();
+    fill_events("", 3000);
+    exec("CREATE INDEX idx_events_id ON events USING BTREE (id);");
+
+    Index *index = find_index("idx_events_id");
+    assert_ptr_not_null(index, "Index should exist");
+    assert_true(index->type == INDEX_TYPE_BTREE, "Index should be a B-tree");
+    assert_int_eq(3000, (int)index->entry_count, "Bulk load should index every row");
+    check_range_counts();
+
+    reset_database();
+    fill_events(" STORAGE COLUMNAR", 3000);
+    exec("CREATE INDEX idx_events_id ON events (id) USING BTREE;");
+    check_range_counts();
+
+    QueryResult *result = exec_query("SELECT SUM(id) FROM events WHERE id >= 10 AND id < 20;");
+    assert_int_eq(145, (int)index_result_value(result, 0, 0)->int_val,
+                  "Aggregate over an index range");
+
+    log_msg(LOG_INFO, "Range scans through a B-tree index tests passed");
+}
+
+void test_btree_index_maintenance(void) {
+    log_msg(LOG_INFO, "Testing B-tree maintenance on INSERT, UPDATE and DELETE...");
+
+    reset_database();
+    exec("CREATE TABLE events (id INT, score FLOAT, kind STRING);");
+    exec("CREATE INDEX idx_events_id ON events USING BTREE (id);");
+
+    for (int i = 0; i < 3000; i++) {
+        char sql[128];
+        string_format(sql, sizeof(sql), "INSERT INTO events VALUES (%d, %d.5, '%s');", i,
+                      (i * 7) % 1000, i % 3 == 0 ? "a" : "b");
+        exec(sql);
+    }
+    Index *index = find_index("idx_events_id");
+    assert_int_eq(3000, (int)index->entry_count, "Inserts should be indexed");
+    check_range_counts();
+
+    exec("UPDATE events SET id = 5000 WHERE id < 10;");
+    assert_int_eq(10, count_index_rows("SELECT id FROM events WHERE id = 5000;"),
+                  "Updated keys should be found");
+    assert_int_eq(90, count_index_rows("SELECT id FROM events WHERE id < 100;"),
+                  "Old keys should be gone");
+
+    exec("DELETE FROM events WHERE id >= 1000;");
+    assert_int_eq(1000 - 10, (int)index->entry_count, "Deleted rows should leave the index");
+    assert_int_eq(490, count_index_rows("SELECT id FROM events WHERE id >= 10 AND id < 500;"),
+                  "Row ids should be remapped after DELETE");
+
+    QueryResult *result = exec_query("SELECT id FROM events WHERE id >= 990;");
+    assert_int_eq(10, alist_length(&result->rows), "Tail range after DELETE");
+    assert_int_eq(990, (int)index_result_value(result, 0, 0)->int_val,
+                  "Remapped rows should point at the right values");
+
+    exec("DROP TABLE events;");
+    assert_true(find_index("idx_events_id") == NULL, "DROP TABLE should drop its indexes");
+
+    log_msg(LOG_INFO, "B-tree maintenance tests passed");
+}
+
+void test_btree_index_order_by(void) {
+    log_msg(LOG_INFO, "Testing ORDER BY through a B-tree index...");
+
+    reset_database();
+    exec("CREATE TABLE scores (id INT, score INT);");
+    exec("INSERT INTO scores VALUES (1, 30), (2, NULL), (3, 10), (4, 50), (5, 20), (6, 40);");
+    exec("CREATE INDEX idx_scores ON scores USING BTREE (score);");
+
+    QueryResult *result = exec_query("SELECT id, score FROM scores ORDER BY score;");
+    assert_int_eq(6, alist_length(&result->rows), "ORDER BY should return every row");
+    int expected_asc[] = {3, 5, 1, 6, 4, 2};
+    for (int i = 0; i < 6; i++)
+        assert_int_eq(expected_asc[i], (int)index_result_value(result, i, 0)->int_val,
+                      "Ascending order with NULL last");
+
+    result = exec_query("SELECT id FROM scores WHERE id > 1 ORDER BY score DESC LIMIT 3;");
+    assert_int_eq(3, alist_length(&result->rows), "LIMIT should stop the index walk");
+    int expected_desc[] = {2, 4, 6};
+    for (int i = 0; i < 3; i++)
+        assert_int_eq(expected_desc[i], (int)index_result_value(result, i, 0)->int_val,
+                      "Descending order with NULL first");
+
+    log_msg(LOG_INFO, "ORDER BY through a B-tree index tests passed");
+}
+
+static int hash_lookup_count(Index *index, const Value *key) {
+    ArrayList rows;
+    alist_init(&rows, sizeof(int), NULL);
+    hash_index_lookup(index, key, &rows);
+    int count = alist_length(&rows);
+    alist_destroy(&rows);
+    return count;
+}
+
+void test_hash_index_basic(void) {
+    log_msg(LOG_INFO, "Testing open-addressing hash index...");
+
+    Index index;
+    memclear(&index, sizeof(Index));
+    index.type = INDEX_TYPE_HASH;
+    assert_true(hash_index_init(&index), "Hash index should initialize");
+
+    const int n = 50000;
+    for (int i = 0; i < n; i++) {
+        Value key = {.type = TYPE_INT, .int_val = (long long)i * 1000003};
+        assert_true(hash_index_insert(&index, &key, i), "Insert should succeed");
+    }
+    for (int i = 0; i < 100; i++) {
+        Value key = {.type = TYPE_INT, .int_val = 7};
+        hash_index_insert(&index, &key, n + i);
+    }
+    assert_int_eq(n + 100, (int)index.entry_count, "Every row should be indexed");
+    assert_int_eq(n + 1, (int)index.data.hash.key_count, "Duplicates should share a slot");
+    assert_true(index.data.hash.used * 8 <= index.data.hash.capacity * 7,
+                "Table should stay under its load factor");
+
+    Value probe = {.type = TYPE_INT, .int_val = 1000003LL * 4321};
+    assert_int_eq(1, hash_lookup_count(&index, &probe), "Unique key lookup");
+    Value dup = {.type = TYPE_INT, .int_val = 7};
+    assert_int_eq(100, hash_lookup_count(&index, &dup), "Duplicate key lookup");
+    Value missing = {.type = TYPE_INT, .int_val = -1};
+    assert_int_eq(0, hash_lookup_count(&index, &missing), "Missing key lookup");
+    Value as_float = {.type = TYPE_FLOAT, .float_val = 7.0};
+    assert_int_eq(0, hash_lookup_count(&index, &as_float), "Keys of another type never match");
+
+    for (int i = 0; i < n; i += 2) {
+        Value key = {.type = TYPE_INT, .int_val = (long long)i * 1000003};
+        assert_true(hash_index_delete(&index, &key, i), "Delete should find the entry");
+    }
+    assert_true(hash_index_delete(&index, &dup, n + 50), "Delete from an overflow chain");
+    assert_true(!hash_index_delete(&index, &dup, n + 50), "Entries are deleted once");
+    assert_int_eq(n / 2 + 99, (int)index.entry_count, "Entries after deletes");
+    assert_int_eq(1, hash_lookup_count(&index, &probe), "Odd keys should survive");
+
+    /* Keep rows below n / 2 plus the duplicates and shift them down by one. */
+    int *new_rows = malloc(sizeof(int) * (size_t)(n + 100));
+    for (int i = 0; i < n + 100; i++)
+        new_rows[i] = (i < n / 2 || i >= n) ? i - 1 : -1;
+    new_rows[0] = -1;
+    hash_index_remap(&index, new_rows);
+    free(new_rows);
+    assert_int_eq(n / 4 + 99, (int)index.entry_count, "Entries after remap");
+    Value dropped = {.type = TYPE_INT, .int_val = 1000003LL * 30001};
+    assert_int_eq(0, hash_lookup_count(&index, &dropped), "Remapped-away rows are dropped");
+    Value kept = {.type = TYPE_INT, .int_val = 1000003LL * 4319};
+    ArrayList rows;
+    alist_init(&rows, sizeof(int), NULL);
+    hash_index_lookup(&index, &kept, &rows);
+    assert_int_eq(1, alist_length(&rows), "Kept key should remain");
+    assert_int_eq(4318, *(int *)alist_get(&rows, 0), "Kept row should be remapped");
+    alist_destroy(&rows);
+
+    unsigned char bytes_a[] = {0x0A, 0xBC, 0x00, 0x11};
+    unsigned char bytes_b[] = {0x0A, 0xBC, 0x00, 0x11};
+    Value blob = {.type = TYPE_BLOB, .blob_val = {.length = 4, .data = bytes_a}};
+    Value same_blob = {.type = TYPE_BLOB, .blob_val = {.length = 4, .data = bytes_b}};
+    Value short_blob = {.type = TYPE_BLOB, .blob_val = {.length = 3, .data = bytes_b}};
+    hash_index_insert(&index, &blob, 1);
+    assert_int_eq(1, hash_lookup_count(&index, &same_blob), "BLOB keys compare by content");
+    assert_int_eq(0, hash_lookup_count(&index, &short_blob), "BLOB length is part of the key");
+
+    alist_destroy(&index.columns);
+    hash_index_free(&index);
+
+    log_msg(LOG_INFO, "Open-addressing hash index tests passed");
+}
+
+void test_hash_index_all_types(void) {
+    log_msg(LOG_INFO, "Testing hash index equality on every column type...");
+
+    reset_database();
+    exec("CREATE TABLE typed (id INT, f FLOAT, d DATE, t TIME, amount DECIMAL, s STRING);");
+    exec("INSERT INTO typed VALUES (1, 1.5, '2024-01-15', '10:30:00', 12.34, 'one');");
+    exec("INSERT INTO typed VALUES (2, 2.5, '2024-02-15', '11:30:00', 56.78, 'two');");
+    exec("INSERT INTO typed VALUES (3, 1.5, '2024-01-15', '10:30:00', 12.34, NULL);");
+
+    const char *columns[] = {"f", "d", "t", "amount", "s"};
+    const char *keys[] = {"1.5", "'2024-01-15'", "'10:30:00'", "12.34", "'one'"};
+    const int expected[] = {2, 2, 2, 2, 1};
+    for (int i = 0; i < 5; i++) {
+        char sql[256];
+        string_format(sql, sizeof(sql), "SELECT id FROM typed WHERE %s = %s;", columns[i],
+                      keys[i]);
+        int without_index = count_index_rows(sql);
+
+        char ddl[128];
+        string_format(ddl, sizeof(ddl), "CREATE INDEX idx_typed_%s ON typed (%s);", columns[i],
+                      columns[i]);
+        exec(ddl);
+        assert_int_eq(expected[i], without_index, "Full scan match count");
+        assert_int_eq(expected[i], count_index_rows(sql), "Indexed match count");
+    }
+    Index *index = find_index("idx_typed_s");
+    assert_int_eq(2, (int)index->entry_count, "NULL keys are not indexed");
+
+    log_msg(LOG_INFO, "Hash index equality on every column type tests passed");
+}
+
+/* orders.created is NULL on every hundredth row from 13 on, all of them tenant 3. */
+static void fill_orders(void) {
+    exec("CREATE TABLE orders (tenant INT, created INT, amount INT);");
+    char sql[8192];
+    for (int start = 0; start < 3000; start += 100) {
+        string_format(sql, sizeof(sql), "INSERT INTO orders VALUES ");
+        for (int i = start; i < start + 100; i++) {
+            char row[64];
+            char created[16];
+            string_format(created, sizeof(created), "%d", i);
+            string_format(row, sizeof(row), "%s(%d, %s, %d)", i == start ? "" : ", ", i % 10,
+                          i % 100 == 13 ? "NULL" : created, i * 3);
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+}
+
+static bool plan_mentions(const char *sql, const char *text) {
+    QueryResult *result = exec_query(sql);
+    for (int i = 0; result && i < alist_length(&result->values); i++)
+        if (strstr(value_str((Value *)alist_get(&result->values, i)), text))
+            return true;
+    return false;
+}
+
+static void check_composite_counts(void) {
+    assert_int_eq(300, count_index_rows("SELECT amount FROM orders WHERE tenant = 3;"),
+                  "Leading column alone");
+    assert_int_eq(1, count_index_rows("SELECT amount FROM orders WHERE tenant = 3 AND "
+                                      "created = 1003;"),
+                  "Both columns equal");
+    assert_int_eq(90, count_index_rows("SELECT amount FROM orders WHERE tenant = 3 AND "
+                                       "created >= 1000 AND created < 2000;"),
+                  "Range on the second column");
+    assert_int_eq(9, count_index_rows("SELECT amount FROM orders WHERE tenant = 3 AND "
+                                      "created < 100;"),
+                  "NULLs in the second column are not below the bound");
+    assert_int_eq(9, count_index_rows("SELECT amount FROM orders WHERE created > 2900 AND "
+                                      "tenant = 3;"),
+                  "Open upper range");
+    assert_int_eq(270, count_index_rows("SELECT amount FROM orders WHERE tenant = 3 AND "
+                                        "created >= 0;"),
+                  "Every non-NULL second column");
+    assert_int_eq(0, count_index_rows("SELECT amount FROM orders WHERE tenant = 4 AND "
+                                      "created = 1003;"),
+                  "Mismatched prefix");
+}
+
+void test_composite_index(void) {
+    log_msg(LOG_INFO, "Testing composite B-tree and hash indexes...");
+
+    reset_database();
+    fill_orders();
+    check_composite_counts();
+    exec("CREATE INDEX idx_orders_tc ON orders USING BTREE (tenant, created);");
+    Index *index = find_index("idx_orders_tc");
+    assert_ptr_not_null(index, "Composite index should exist");
+    assert_int_eq(2, index->key_count, "Both columns are keys");
+    assert_int_eq(3000, (int)index->entry_count, "NULLs after the first column are indexed");
+    assert_true(plan_mentions("EXPLAIN SELECT amount FROM orders WHERE tenant = 3 AND "
+                              "created >= 1000 AND created < 2000;",
+                              "idx_orders_tc on orders (tenant = 3 AND created >= 1000 AND "
+                              "created < 2000)"),
+                "One scan answers the prefix and the range");
+    check_composite_counts();
+
+    exec("CREATE INDEX idx_orders_ta ON orders USING HASH (tenant, amount);");
+    assert_true(plan_mentions("EXPLAIN SELECT created FROM orders WHERE amount = 3009 AND "
+                              "tenant = 3;",
+                              "Index Scan using idx_orders_ta"),
+                "A hash index probes with every key column");
+    assert_int_eq(1, count_index_rows("SELECT created FROM orders WHERE amount = 3009 AND "
+                                      "tenant = 3;"),
+                  "Hash probe match");
+    exec("UPDATE orders SET amount = 1 WHERE created = 1003;");
+    exec("DELETE FROM orders WHERE created >= 2000;");
+    assert_int_eq(1, count_index_rows("SELECT created FROM orders WHERE amount = 1 AND "
+                                      "tenant = 3;"),
+                  "Updated key found");
+    assert_int_eq(0, count_index_rows("SELECT created FROM orders WHERE amount = 3009 AND "
+                                      "tenant = 3;"),
+                  "Old key gone");
+    assert_int_eq(90, count_index_rows("SELECT amount FROM orders WHERE tenant = 3 AND "
+                                       "created >= 1000;"),
+                  "Range after DELETE");
+
+    /* Unresolved columns reach the planner with id UINT16_MAX and must not index it. */
+    assert_int_eq(0, count_index_rows("SELECT amount FROM orders WHERE nosuchcol = 1;"),
+                  "An unknown column matches nothing");
+    exec("DELETE FROM orders WHERE nosuch.tenant = 3 AND created = 1000;");
+    assert_int_eq(90, count_index_rows("SELECT amount FROM orders WHERE tenant = 3 AND "
+                                       "created >= 1000;"),
+                  "A DELETE on an unknown column removes nothing");
+
+    Token *tokens = tokenize("CREATE INDEX idx_bad ON orders (tenant, tenant);");
+    assert_ptr_null(parse(tokens), "A column may appear once");
+    free_tokens(tokens);
+    tokens = tokenize("CREATE INDEX idx_bad ON orders USING HASH (tenant) INCLUDE (amount);");
+    assert_ptr_null(parse(tokens), "INCLUDE needs a B-tree");
+    free_tokens(tokens);
+
+    log_msg(LOG_INFO, "Composite B-tree and hash index tests passed");
+}
+
+void test_covering_index(void) {
+    log_msg(LOG_INFO, "Testing covering indexes and index-only scans...");
+
+    reset_database();
+    fill_orders();
+    exec("CREATE INDEX idx_orders_cover ON orders USING BTREE (created) INCLUDE (amount);");
+    Index *index = find_index("idx_orders_cover");
+    assert_int_eq(1, index->key_count, "One key column");
+    assert_int_eq(2, alist_length(&index->columns), "And one included column");
+
+    const char *query = "SELECT created, amount FROM orders WHERE created >= 100 AND "
+                        "created < 120;";
+    char explain[160];
+    string_format(explain, sizeof(explain), "EXPLAIN %s", query);
+    assert_true(plan_mentions(explain, "Index Only Scan using idx_orders_cover"),
+                "Covered columns are read from the index");
+    assert_true(!plan_mentions(explain, "Filter"), "The scan applies the whole WHERE");
+    QueryResult *result = exec_query(query);
+    assert_int_eq(19, alist_length(&result->rows), "NULL keys are not in the range");
+    assert_int_eq(100, (int)index_result_value(result, 0, 0)->int_val, "Key order");
+    assert_int_eq(300, (int)index_result_value(result, 0, 1)->int_val, "Included value");
+    assert_int_eq(114, (int)index_result_value(result, 13, 0)->int_val, "Row 113 skipped");
+
+    exec("UPDATE orders SET amount = 7 WHERE created = 101;");
+    exec("DELETE FROM orders WHERE created = 102;");
+    result = exec_query(query);
+    assert_int_eq(18, alist_length(&result->rows), "Deleted rows are not returned");
+    assert_int_eq(7, (int)index_result_value(result, 1, 1)->int_val,
+                  "Updates to included columns reach the index");
+
+    assert_true(plan_mentions("EXPLAIN SELECT amount FROM orders WHERE created = 200 LIMIT 1;",
+                              "Index Only Scan"),
+                "Equality with LIMIT");
+    assert_true(!plan_mentions("EXPLAIN SELECT tenant FROM orders WHERE created = 200;",
+                               "Index Only Scan"),
+                "Uncovered columns need the table");
+    assert_true(!plan_mentions("EXPLAIN SELECT amount FROM orders WHERE created < 50 AND "
+                               "amount > 3;",
+                               "Index Only Scan"),
+                "Predicates on included columns need a filter");
+    assert_int_eq(47, count_index_rows("SELECT amount FROM orders WHERE created < 50 AND "
+                                       "amount > 3;"),
+                  "Filtered covered scan");
+
+    log_msg(LOG_INFO, "Covering index tests passed");
+}
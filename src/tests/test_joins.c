@@ -3,9 +3,22 @@
 
 #include "arraylist.h"
 #include "db.h"
+#include "executor.h"
 #include "logger.h"
 #include "table.h"
 #include "test_util.h"
+#include "utils.h"
+#include "values.h"
+
+static int join_row_count(const char *sql) {
+    QueryResult *result = exec_query(sql);
+    assert_ptr_not_null(result, "Query failed: %s", sql);
+    return alist_length(&result->rows);
+}
+
+static Value join_result_value(QueryResult *result, int row, int col) {
+    return *(Value *)alist_get(&result->values, row * result->col_count + col);
+}
 
 void test_inner_join(void) {
     log_msg(LOG_INFO, "Testing INNER JOIN...");
@@ -22,7 +35,12 @@ void test_inner_join(void) {
     exec("INSERT INTO departments VALUES (2, 'Sales');");
     exec("INSERT INTO departments VALUES (3, 'Marketing');");
 
-    exec("SELECT * FROM employees JOIN departments ON employees.dept_id = departments.dept_id;");
+    assert_int_eq(3,
+                  join_row_count("SELECT * FROM employees JOIN departments ON employees.dept_id = "
+                                 "departments.dept_id;"),
+                  "INNER JOIN row count");
+    QueryResult *result = get_last_query_result();
+    assert_int_eq(5, result->col_count, "INNER JOIN column count");
 
     log_msg(LOG_INFO, "INNER JOIN tests passed");
 }
@@ -41,7 +59,15 @@ void test_left_join(void) {
     exec("INSERT INTO cities VALUES (1, 'New York');");
     exec("INSERT INTO cities VALUES (2, 'Los Angeles');");
 
-    exec("SELECT * FROM customers LEFT JOIN cities ON customers.city_id = cities.city_id;");
+    assert_int_eq(3,
+                  join_row_count("SELECT * FROM customers LEFT JOIN cities ON customers.city_id = "
+                                 "cities.city_id;"),
+                  "LEFT JOIN keeps every left row");
+    QueryResult *result = exec_query("SELECT name, city_name FROM customers LEFT JOIN cities ON "
+                                     "customers.city_id = cities.city_id WHERE id = 3;");
+    assert_int_eq(1, alist_length(&result->rows), "Unmatched left row");
+    Value city = join_result_value(result, 0, 1);
+    assert_true(is_null(&city), "Unmatched LEFT JOIN columns are NULL");
 
     log_msg(LOG_INFO, "LEFT JOIN tests passed");
 }
@@ -60,7 +86,15 @@ void test_join_multiple_matches(void) {
     exec("INSERT INTO customers VALUES (1, 'Alice');");
     exec("INSERT INTO customers VALUES (2, 'Bob');");
 
-    exec("SELECT * FROM orders JOIN customers ON orders.customer_id = customers.customer_id;");
+    assert_int_eq(3,
+                  join_row_count("SELECT * FROM orders JOIN customers ON orders.customer_id = "
+                                 "customers.customer_id;"),
+                  "Every order joins its customer");
+    assert_int_eq(2,
+                  join_row_count("SELECT product FROM orders JOIN customers ON "
+                                 "orders.customer_id = customers.customer_id WHERE name = "
+                                 "'Alice';"),
+                  "WHERE on the joined table");
 
     log_msg(LOG_INFO, "JOIN with multiple matches tests passed");
 }
@@ -78,7 +112,8 @@ void test_join_no_matches(void) {
     exec("INSERT INTO t2 VALUES (3, 'C');");
     exec("INSERT INTO t2 VALUES (4, 'D');");
 
-    exec("SELECT * FROM t1 JOIN t2 ON t1.id = t2.id;");
+    assert_int_eq(0, join_row_count("SELECT * FROM t1 JOIN t2 ON t1.id = t2.id;"),
+                  "Disjoint keys produce no rows");
 
     log_msg(LOG_INFO, "JOIN with no matches tests passed");
 }
@@ -94,7 +129,14 @@ void test_join_empty_table(void) {
 
     exec("CREATE TABLE right_table (id INT, value STRING);");
 
-    exec("SELECT * FROM left_table JOIN right_table ON left_table.id = right_table.id;");
+    assert_int_eq(0,
+                  join_row_count("SELECT * FROM left_table JOIN right_table ON left_table.id = "
+                                 "right_table.id;"),
+                  "INNER JOIN with an empty table");
+    assert_int_eq(2,
+                  join_row_count("SELECT * FROM left_table LEFT JOIN right_table ON "
+                                 "left_table.id = right_table.id;"),
+                  "LEFT JOIN with an empty table");
 
     log_msg(LOG_INFO, "JOIN with empty table tests passed");
 }
@@ -112,8 +154,11 @@ void test_join_syntax_variations(void) {
     exec("INSERT INTO b VALUES (1, 'B1');");
     exec("INSERT INTO b VALUES (2, 'B2');");
 
-    exec("SELECT * FROM a JOIN b ON a.id = b.id;");
-    exec("SELECT * FROM a INNER JOIN b ON a.id = b.id;");
+    assert_int_eq(2, join_row_count("SELECT * FROM a JOIN b ON a.id = b.id;"), "JOIN");
+    assert_int_eq(2, join_row_count("SELECT * FROM a INNER JOIN b ON a.id = b.id;"),
+                  "INNER JOIN");
+    assert_int_eq(1, join_row_count("SELECT * FROM a AS x JOIN b AS y ON x.id < y.id;"),
+                  "Non-equi join through aliases");
 
     log_msg(LOG_INFO, "JOIN syntax variations tests passed");
 }
@@ -129,8 +174,16 @@ void test_self_join(void) {
     exec("INSERT INTO employees VALUES (3, 'CFO', 1);");
     exec("INSERT INTO employees VALUES (4, 'Dev1', 2);");
 
-    exec("SELECT e.name AS employee, m.name AS manager FROM employees e JOIN employees m ON "
-         "e.manager_id = m.id;");
+    QueryResult *result = exec_query("SELECT e.name AS employee, m.name AS manager FROM "
+                                     "employees e JOIN employees m ON e.manager_id = m.id WHERE "
+                                     "e.id = 4;");
+    assert_int_eq(1, alist_length(&result->rows), "Self JOIN row count");
+    assert_str_eq("Dev1", join_result_value(result, 0, 0).char_val, "Aliased left side");
+    assert_str_eq("CTO", join_result_value(result, 0, 1).char_val, "Aliased right side");
+    assert_int_eq(3,
+                  join_row_count("SELECT e.name FROM employees e JOIN employees m ON "
+                                 "e.manager_id = m.id;"),
+                  "The CEO has no manager");
 
     log_msg(LOG_INFO, "Self JOIN tests passed");
 }
@@ -154,8 +207,169 @@ void test_three_table_join(void) {
     exec("INSERT INTO sales VALUES (2, 2, 5);");
     exec("INSERT INTO sales VALUES (3, 3, 8);");
 
-    exec("SELECT a.name, b.title, s.quantity FROM authors a JOIN books b ON a.author_id = "
-         "b.author_id JOIN sales s ON b.book_id = s.book_id;");
+    QueryResult *result = exec_query("SELECT a.name, b.title, s.quantity FROM authors a JOIN "
+                                     "books b ON a.author_id = b.author_id JOIN sales s ON "
+                                     "b.book_id = s.book_id WHERE s.quantity > 6;");
+    assert_int_eq(2, alist_length(&result->rows), "Three table JOIN row count");
+    for (int r = 0; r < 2; r++) {
+        const char *title = join_result_value(result, r, 1).char_val;
+        const char *name = join_result_value(result, r, 0).char_val;
+        assert_str_eq(strcmp(title, "Book C") == 0 ? "Bob" : "Alice", name,
+                      "Author of %s", title);
+    }
 
     log_msg(LOG_INFO, "Three table JOIN tests passed");
 }
+
+#define STAR_SALES 600
+
+static void fill_star_schema(void) {
+    exec("CREATE TABLE sales (id INT, store_id INT, product_id INT, qty INT);");
+    exec("CREATE TABLE stores (store_id INT, region STRING);");
+    exec("CREATE TABLE products (product_id INT, category STRING);");
+    for (int start = 0; start < STAR_SALES; start += 100) {
+        char sql[4096];
+        string_format(sql, sizeof(sql), "INSERT INTO sales VALUES ");
+        for (int i = start; i < start + 100; i++) {
+            char row[64];
+            string_format(row, sizeof(row), "%s(%d, %d, %d, %d)", i == start ? "" : ", ", i,
+                          i % 6, i % 20, i % 5 + 1);
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+    for (int i = 0; i < 6; i++) {
+        char sql[128];
+        string_format(sql, sizeof(sql), "INSERT INTO stores VALUES (%d, '%s');", i,
+                      i < 2 ? "north" : "south");
+        exec(sql);
+    }
+    for (int i = 0; i < 20; i++) {
+        char sql[128];
+        string_format(sql, sizeof(sql), "INSERT INTO products VALUES (%d, 'c%d');", i, i % 4);
+        exec(sql);
+    }
+}
+
+static void assert_star_totals(const char *sql, int count, int sum) {
+    QueryResult *result = exec_query(sql);
+    assert_int_eq(1, alist_length(&result->rows), "One row from: %s", sql);
+    assert_int_eq(count, (int)join_result_value(result, 0, 0).int_val, "COUNT of: %s", sql);
+    assert_int_eq(sum, (int)join_result_value(result, 0, 1).int_val, "SUM of: %s", sql);
+}
+
+void test_multi_way_join(void) {
+    log_msg(LOG_INFO, "Testing N-way JOINs...");
+
+    reset_database();
+    fill_star_schema();
+    int count = 0, sum = 0;
+    for (int i = 0; i < STAR_SALES; i++) {
+        if (i % 6 < 2 && i % 20 % 4 == 1) {
+            count++;
+            sum += i % 5 + 1;
+        }
+    }
+
+    /* The same star query written three ways, before and after indexes and statistics. */
+    const char *queries[] = {
+        "SELECT COUNT(*), SUM(s.qty) FROM sales s JOIN stores st ON s.store_id = st.store_id "
+        "JOIN products p ON s.product_id = p.product_id WHERE st.region = 'north' AND "
+        "p.category = 'c1';",
+        "SELECT COUNT(*), SUM(s.qty) FROM products p JOIN sales s ON s.product_id = "
+        "p.product_id JOIN stores st ON st.store_id = s.store_id WHERE p.category = 'c1' AND "
+        "st.region = 'north';",
+        "SELECT COUNT(*), SUM(s.qty) FROM stores st JOIN products p ON p.category = 'c1' JOIN "
+        "sales s ON s.store_id = st.store_id AND s.product_id = p.product_id WHERE st.region = "
+        "'north';",
+    };
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++)
+            assert_star_totals(queries[q], count, sum);
+        exec("CREATE INDEX idx_sales_store ON sales (store_id);");
+        exec("CREATE INDEX idx_sales_product ON sales USING BTREE (product_id);");
+        exec("ANALYZE;");
+    }
+
+    QueryResult *result = exec_query("SELECT s.id, st.region, p.category FROM sales s JOIN "
+                                     "stores st ON s.store_id = st.store_id JOIN products p ON "
+                                     "s.product_id = p.product_id WHERE s.id = 7;");
+    assert_int_eq(1, alist_length(&result->rows), "Point query over three tables");
+    assert_str_eq("north", join_result_value(result, 0, 1).char_val, "Region of sale 7");
+    assert_str_eq("c3", join_result_value(result, 0, 2).char_val, "Category of sale 7");
+
+    /* LEFT JOINs keep their order; an inner join above one drops its NULL rows. */
+    exec("INSERT INTO stores VALUES (6, 'east');");
+    assert_int_eq(STAR_SALES + 1,
+                  join_row_count("SELECT st.store_id FROM stores st LEFT JOIN sales s ON "
+                                 "s.store_id = st.store_id LEFT JOIN products p ON "
+                                 "p.product_id = s.product_id;"),
+                  "LEFT JOIN chain keeps the store without sales");
+    assert_int_eq(STAR_SALES,
+                  join_row_count("SELECT st.store_id FROM stores st LEFT JOIN sales s ON "
+                                 "s.store_id = st.store_id JOIN products p ON p.product_id = "
+                                 "s.product_id;"),
+                  "Inner join above a LEFT JOIN");
+    result = exec_query("SELECT st.store_id, p.category FROM stores st LEFT JOIN sales s ON "
+                        "s.store_id = st.store_id AND s.qty > 100 LEFT JOIN products p ON "
+                        "p.product_id = s.product_id;");
+    assert_int_eq(7, alist_length(&result->rows), "Unmatched LEFT JOIN chain");
+    Value category = join_result_value(result, 6, 1);
+    assert_true(is_null(&category), "NULL-extended category");
+
+    Token *tokens = tokenize("SELECT * FROM stores a JOIN stores b ON a.store_id = b.store_id "
+                             "JOIN stores c ON a.store_id = c.store_id JOIN stores d ON "
+                             "a.store_id = d.store_id JOIN stores e ON a.store_id = e.store_id "
+                             "JOIN stores f ON a.store_id = f.store_id JOIN stores g ON "
+                             "a.store_id = g.store_id JOIN stores h ON a.store_id = h.store_id "
+                             "JOIN stores i ON a.store_id = i.store_id;");
+    ASTNode *ast = parse(tokens);
+    assert_true(ast == NULL, "More than MAX_JOIN_TABLES tables should be rejected");
+    free_ast(ast);
+    free_tokens(tokens);
+
+    log_msg(LOG_INFO, "N-way JOIN tests passed");
+}
+
+void test_join_leaves_base_tables_intact(void) {
+    log_msg(LOG_INFO, "Testing that JOIN and WHERE do not modify base tables...");
+
+    reset_database();
+
+    exec("CREATE TABLE items (id INT, kind INT, price FLOAT);");
+    exec("CREATE TABLE kinds (kind INT, label STRING);");
+    exec("CREATE INDEX idx_items_kind ON items (kind);");
+    for (int i = 0; i < 200; i++) {
+        char sql[128];
+        string_format(sql, sizeof(sql), "INSERT INTO items VALUES (%d, %d, %d.5);", i, i % 4, i);
+        exec(sql);
+    }
+    exec("INSERT INTO kinds VALUES (0, 'zero'), (1, 'one'), (2, 'two');");
+
+    int table_count = alist_length(&tables);
+    assert_int_eq(50, join_row_count("SELECT id FROM items WHERE kind = 1;"), "Indexed WHERE");
+    assert_int_eq(150,
+                  join_row_count("SELECT * FROM items JOIN kinds ON items.kind = kinds.kind;"),
+                  "Hash join row count");
+    assert_int_eq(200,
+                  join_row_count("SELECT * FROM items LEFT JOIN kinds ON items.kind = "
+                                 "kinds.kind;"),
+                  "Hash LEFT JOIN row count");
+    assert_int_eq(10,
+                  join_row_count("SELECT label FROM items JOIN kinds ON items.kind = kinds.kind "
+                                 "WHERE price > 100 LIMIT 10;"),
+                  "LIMIT over a filtered join");
+
+    QueryResult *result = exec_query("SELECT COUNT(*), SUM(id) FROM items JOIN kinds ON "
+                                     "items.kind = kinds.kind WHERE label = 'two';");
+    assert_int_eq(50, (int)join_result_value(result, 0, 0).int_val, "COUNT over a join");
+    assert_int_eq(5000, (int)join_result_value(result, 0, 1).int_val, "SUM over a join");
+
+    assert_int_eq(table_count, alist_length(&tables), "Joins must not register tables");
+    assert_int_eq(200, table_row_count(find_table_by_name("items")), "items keeps its rows");
+    assert_int_eq(3, table_row_count(find_table_by_name("kinds")), "kinds keeps its rows");
+    assert_int_eq(200, join_row_count("SELECT * FROM items;"), "Base table still complete");
+
+    log_msg(LOG_INFO, "Base table integrity tests passed");
+}
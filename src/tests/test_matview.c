@@ -0,0 +1,256 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "storage.h"
+#include "table.h"
+#include "test_util.h"
+#include "values.h"
+
+#define VIEW_TEXT_ROWS 64
+#define VIEW_TEXT_ROW_LEN 128
+
+static int compare_lines(const void *a, const void *b) {
+    return strcmp((const char *)a, (const char *)b);
+}
+
+/* The rows of a query as sorted lines of values, so results compare whatever their order. */
+static void result_text(const char *sql, char *out, size_t size) {
+    static char lines[VIEW_TEXT_ROWS][VIEW_TEXT_ROW_LEN];
+    QueryResult *result = exec_query(sql);
+    int row_count = alist_length(&result->rows);
+    assert_true(row_count <= VIEW_TEXT_ROWS, "Too many rows from: %s", sql);
+    for (int r = 0; r < row_count; r++) {
+        lines[r][0] = '\0';
+        for (int c = 0; c < result->col_count; c++) {
+            const Value *val = (const Value *)alist_get(&result->values, r * result->col_count + c);
+            char buf[48];
+            size_t len = strlen(lines[r]);
+            snprintf(lines[r] + len, VIEW_TEXT_ROW_LEN - len, "%s%s", c ? "|" : "",
+                     repr_into(val, buf, sizeof(buf)));
+        }
+    }
+    qsort(lines, (size_t)row_count, VIEW_TEXT_ROW_LEN, compare_lines);
+    out[0] = '\0';
+    for (int r = 0; r < row_count; r++) {
+        size_t len = strlen(out);
+        snprintf(out + len, size - len, "%s\n", lines[r]);
+    }
+}
+
+static void assert_view_matches(const char *view, const char *query, const char *when) {
+    char expected[VIEW_TEXT_ROWS * VIEW_TEXT_ROW_LEN];
+    char actual[VIEW_TEXT_ROWS * VIEW_TEXT_ROW_LEN];
+    char sql[256];
+    result_text(query, expected, sizeof(expected));
+    snprintf(sql, sizeof(sql), "SELECT * FROM %s;", view);
+    result_text(sql, actual, sizeof(actual));
+    assert_str_eq(expected, actual, "View '%s' matches its query %s", view, when);
+}
+
+static void create_sales(void) {
+    exec("CREATE TABLE sales (id INT PRIMARY KEY, region STRING, amount INT);");
+    exec("INSERT INTO sales VALUES (1, 'north', 10), (2, 'north', 40), (3, 'south', 25), "
+         "(4, 'east', 5), (5, 'south', 60), (6, 'north', 40);");
+}
+
+static void fill_sales(void) {
+    reset_database();
+    create_sales();
+}
+
+#define TOTALS                                                                            \
+    "SELECT region, COUNT(*), SUM(amount), MIN(amount), MAX(amount) FROM sales GROUP BY " \
+    "region;"
+
+void test_matview_aggregates(void) {
+    log_msg(LOG_INFO, "Testing materialized aggregate views under inserts, updates, deletes...");
+    fill_sales();
+    exec("CREATE MATERIALIZED VIEW totals AS SELECT region, COUNT(*) AS n, SUM(amount) AS "
+         "total, MIN(amount) AS low, MAX(amount) AS high FROM sales GROUP BY region;");
+    exec("CREATE MATERIALIZED VIEW overall AS SELECT COUNT(*), SUM(amount), AVG(amount), "
+         "STDDEV(amount) FROM sales WHERE amount > 7;");
+    Table *table = find_table_by_name("totals");
+    assert_ptr_not_null(table, "The view has a table");
+    assert_int_eq(5, alist_length(&table->schema.columns), "One column per output");
+    assert_str_eq("total", ((ColumnDef *)alist_get(&table->schema.columns, 2))->name,
+                  "Columns take their aliases");
+
+    MatViewStats before, after;
+    matview_get_stats(&before);
+    assert_view_matches("totals", TOTALS, "when first read");
+    assert_view_matches("overall", "SELECT COUNT(*), SUM(amount), AVG(amount), STDDEV(amount) "
+                        "FROM sales WHERE amount > 7;", "when first read");
+    matview_get_stats(&after);
+    assert_int_eq(2, (int)(after.refreshes - before.refreshes), "The first read computes each");
+
+    /* Changes that keep every MIN and MAX are folded in without recomputing. */
+    exec("INSERT INTO sales VALUES (7, 'west', 15), (8, 'south', 30);");
+    exec("UPDATE sales SET amount = 35 WHERE id = 8;");
+    exec("DELETE FROM sales WHERE id = 8;");
+    matview_get_stats(&before);
+    assert_int_eq(7, alist_length(&exec_query("SELECT id FROM sales WHERE region IN "
+                                               "(SELECT region FROM totals);")->rows),
+                  "A subquery reads the view up to date");
+    assert_view_matches("totals", TOTALS, "after folded changes");
+    assert_view_matches("overall", "SELECT COUNT(*), SUM(amount), AVG(amount), STDDEV(amount) "
+                        "FROM sales WHERE amount > 7;", "after folded changes");
+    matview_get_stats(&after);
+    assert_true(after.deltas > 0, "Row changes are folded as deltas");
+    assert_int_eq(0, (int)(after.refreshes - before.refreshes), "No recompute for deltas");
+    assert_int_eq(2, (int)(after.rebuilds - before.rebuilds), "Both tables are rewritten");
+
+    /* Taking out a group's minimum needs the rows again. */
+    exec("DELETE FROM sales WHERE id = 1;");
+    exec("DELETE FROM sales WHERE region = 'east';");
+    matview_get_stats(&before);
+    assert_view_matches("totals", TOTALS, "after deleting a minimum");
+    matview_get_stats(&after);
+    assert_int_eq(1, (int)(after.refreshes - before.refreshes), "A lost minimum recomputes");
+    assert_int_eq(3, alist_length(&exec_query("SELECT * FROM totals;")->rows),
+                  "An emptied group leaves the view");
+    assert_view_matches("overall", "SELECT COUNT(*), SUM(amount), AVG(amount), STDDEV(amount) "
+                        "FROM sales WHERE amount > 7;", "after deletes");
+
+    exec("DELETE FROM sales;");
+    assert_view_matches("overall", "SELECT COUNT(*), SUM(amount), AVG(amount), STDDEV(amount) "
+                        "FROM sales WHERE amount > 7;", "over no rows");
+    assert_int_eq(0, alist_length(&exec_query("SELECT * FROM totals;")->rows),
+                  "No groups over no rows");
+
+    log_msg(LOG_INFO, "Materialized aggregate view tests passed");
+}
+
+#define BY_MANAGER                                                                      \
+    "SELECT regions.manager, COUNT(*), SUM(sales.amount) FROM sales JOIN regions ON " \
+    "sales.region = regions.name GROUP BY regions.manager;"
+
+void test_matview_filters_and_joins(void) {
+    log_msg(LOG_INFO, "Testing filter and join views under COPY and transactions...");
+    fill_sales();
+    exec("CREATE TABLE regions (name STRING PRIMARY KEY, manager STRING);");
+    exec("INSERT INTO regions VALUES ('north', 'ann'), ('south', 'bob'), ('east', 'ann');");
+    exec("CREATE MATERIALIZED VIEW big AS SELECT region, amount FROM sales WHERE amount >= 25;");
+    exec("CREATE MATERIALIZED VIEW by_manager AS " BY_MANAGER);
+    const char *big = "SELECT region, amount FROM sales WHERE amount >= 25;";
+    assert_view_matches("big", big, "when first read");
+    assert_view_matches("by_manager", BY_MANAGER, "when first read");
+
+    /* Equal rows are kept as many times as they match. */
+    exec("INSERT INTO sales VALUES (7, 'north', 40), (8, 'west', 90);");
+    exec("UPDATE sales SET amount = 20 WHERE id = 2;");
+    exec("INSERT INTO regions VALUES ('west', 'cid');");
+    assert_view_matches("big", big, "after changes");
+    assert_view_matches("by_manager", BY_MANAGER, "after changes to both tables");
+    exec("DELETE FROM regions WHERE name = 'north';");
+    assert_view_matches("by_manager", BY_MANAGER, "after a joined row goes");
+
+    char dir[] = "/tmp/db_matview_XXXXXX";
+    assert_true(mkdtemp(dir) != NULL, "Failed to create a temporary directory");
+    char path[128], sql[256];
+    snprintf(path, sizeof(path), "%s/sales.csv", dir);
+    FILE *out = fopen(path, "wb");
+    assert_ptr_not_null(out, "Cannot create %s", path);
+    fputs("9,south,45\n10,east,70\n11,north,3\n", out);
+    fclose(out);
+    snprintf(sql, sizeof(sql), "COPY sales FROM '%s';", path);
+    exec(sql);
+    unlink(path);
+    rmdir(dir);
+    assert_view_matches("big", big, "after COPY");
+    assert_view_matches("by_manager", BY_MANAGER, "after COPY");
+
+    exec("BEGIN;");
+    exec("INSERT INTO sales VALUES (12, 'south', 80);");
+    exec("DELETE FROM sales WHERE id = 5;");
+    exec("ROLLBACK;");
+    assert_view_matches("big", big, "after ROLLBACK");
+    assert_view_matches("by_manager", BY_MANAGER, "after ROLLBACK");
+
+    exec("BEGIN;");
+    exec("INSERT INTO sales VALUES (12, 'south', 80);");
+    exec("UPDATE sales SET amount = 26 WHERE id = 3;");
+    exec("DELETE FROM sales WHERE id = 5;");
+    exec("UPDATE regions SET manager = 'dee' WHERE name = 'east';");
+    exec("COMMIT;");
+    assert_view_matches("big", big, "after COMMIT");
+    assert_view_matches("by_manager", BY_MANAGER, "after COMMIT");
+
+    log_msg(LOG_INFO, "Filter and join view tests passed");
+}
+
+void test_matview_restrictions(void) {
+    log_msg(LOG_INFO, "Testing what materialized views refuse...");
+    fill_sales();
+    exec("CREATE MATERIALIZED VIEW totals AS SELECT region, SUM(amount) FROM sales "
+         "GROUP BY region;");
+    exec("CREATE MATERIALIZED VIEW sorted AS SELECT region FROM sales ORDER BY region;");
+    exec("CREATE MATERIALIZED VIEW loose AS SELECT region, amount FROM sales GROUP BY region;");
+    assert_ptr_null(find_table_by_name("sorted"), "ORDER BY is refused");
+    assert_ptr_null(find_table_by_name("loose"), "Ungrouped columns are refused");
+
+    exec("INSERT INTO totals VALUES ('x', 1.0);");
+    exec("DELETE FROM totals;");
+    exec("CREATE INDEX idx_totals ON totals (region);");
+    assert_int_eq(3, alist_length(&exec_query("SELECT * FROM totals;")->rows),
+                  "Writes to a view are refused");
+    exec("DROP TABLE sales;");
+    exec("DROP TABLE totals;");
+    assert_ptr_not_null(find_table_by_name("sales"), "A table a view reads stays");
+    assert_ptr_not_null(find_table_by_name("totals"), "DROP TABLE does not drop a view");
+    exec("DROP MATERIALIZED VIEW sales;");
+    assert_ptr_not_null(find_table_by_name("sales"), "DROP MATERIALIZED VIEW needs a view");
+
+    exec("DROP MATERIALIZED VIEW totals;");
+    assert_ptr_null(find_table_by_name("totals"), "DROP MATERIALIZED VIEW drops it");
+    exec("DROP TABLE sales;");
+    assert_ptr_null(find_table_by_name("sales"), "Its table can go after it");
+
+    log_msg(LOG_INFO, "Materialized view restriction tests passed");
+}
+
+void test_matview_storage(void) {
+    log_msg(LOG_INFO, "Testing materialized views across restarts...");
+    char dir[] = "/tmp/db_matview_XXXXXX";
+    assert_true(mkdtemp(dir) != NULL, "Failed to create a temporary data directory");
+    reset_database();
+    assert_true(storage_open(dir), "Opening an empty data directory should succeed");
+    create_sales();
+    exec("CREATE MATERIALIZED VIEW totals AS SELECT region, COUNT(*) AS n, SUM(amount) AS "
+         "total FROM sales GROUP BY region;");
+    const char *totals = "SELECT region, COUNT(*), SUM(amount) FROM sales GROUP BY region;";
+    assert_view_matches("totals", totals, "before a restart");
+
+    /* Once from the log, once from a snapshot. */
+    for (int checkpoint = 0; checkpoint < 2; checkpoint++) {
+        storage_close(checkpoint);
+        reset_database();
+        assert_true(storage_open(dir), "Reopening the data directory should succeed");
+        Table *table = find_table_by_name("totals");
+        assert_true(table && table->view, "The view comes back");
+        assert_view_matches("totals", totals, "after a restart");
+        char sql[64];
+        snprintf(sql, sizeof(sql), "INSERT INTO sales VALUES (%d, 'west', 7);", 20 + checkpoint);
+        exec(sql);
+        assert_view_matches("totals", totals, "after a restart and an insert");
+    }
+    storage_close(false);
+    reset_database();
+
+    const char *files[] = {STORAGE_SNAPSHOT_FILE, STORAGE_WAL_FILE, STORAGE_SNAPSHOT_FILE ".tmp"};
+    char path[128];
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+
+    log_msg(LOG_INFO, "Materialized view storage tests passed");
+}
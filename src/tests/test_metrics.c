@@ -0,0 +1,117 @@
+#include <string.h>
+
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "metrics.h"
+#include "table.h"
+#include "test_util.h"
+#include "utils.h"
+
+#define METRICS_TEST_ROWS 10000
+
+static int g_evaluations;
+
+static int count_evaluation(void) {
+    return ++g_evaluations;
+}
+
+void test_log_level_guard(void) {
+    log_msg(LOG_INFO, "Testing that filtered log messages are not evaluated...");
+
+    set_log_level(LOG_ERROR);
+    log_msg(LOG_INFO, "evaluated %d", count_evaluation());
+    log_msg(LOG_WARN, "evaluated %d", count_evaluation());
+    assert_int_eq(0, g_evaluations, "Arguments of filtered messages are not evaluated");
+
+    set_log_level(LOG_DEBUG);
+    log_msg(LOG_DEBUG, "evaluated %d", count_evaluation());
+    assert_int_eq(LOG_COMPILED_LEVEL <= LOG_DEBUG ? 1 : 0, g_evaluations,
+                  "DEBUG messages exist only in builds that compile them in");
+    assert_true(LOG_ENABLED(LOG_ERROR), "ERROR is always compiled in");
+
+    log_msg(LOG_INFO, "Log level guard tests passed");
+}
+
+static uint64_t counter_delta(const MetricsSnapshot *before, MetricCounter counter) {
+    MetricsSnapshot after;
+    metrics_snapshot(&after);
+    return after.counters[counter] - before->counters[counter];
+}
+
+void test_metrics_counters(void) {
+    log_msg(LOG_INFO, "Testing metrics counters and histograms...");
+
+    reset_database();
+    exec("CREATE TABLE metered (id INT PRIMARY KEY, grp INT);");
+    char sql[4096];
+    for (int start = 0; start < METRICS_TEST_ROWS; start += 200) {
+        string_format(sql, sizeof(sql), "INSERT INTO metered VALUES ");
+        for (int i = start; i < start + 200; i++) {
+            char row[32];
+            string_format(row, sizeof(row), "%s(%d, %d)", i == start ? "" : ", ", i, i % 50);
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+    exec("CREATE TABLE groups (g_id INT, g_name STRING);");
+    exec("INSERT INTO groups VALUES (1, 'one'), (2, 'two'), (3, 'three');");
+
+    MetricsSnapshot before;
+    metrics_snapshot(&before);
+    exec_query("SELECT COUNT(*) FROM metered WHERE grp = 7;");
+    assert_int_eq(1, (int)counter_delta(&before, METRIC_STATEMENTS), "One statement");
+    assert_int_eq(METRICS_TEST_ROWS, (int)counter_delta(&before, METRIC_ROWS_SCANNED),
+                  "A sequential scan reads every row");
+
+    /* Four workers split the scan; their blocks add up to the same rows. */
+    exec("SET max_parallel_workers = 4;");
+    metrics_snapshot(&before);
+    exec_query("SELECT id FROM metered WHERE grp < 3;");
+    assert_int_eq(METRICS_TEST_ROWS, (int)counter_delta(&before, METRIC_ROWS_SCANNED),
+                  "Workers count the rows of their morsels");
+    exec("SET max_parallel_workers = 1;");
+
+    metrics_snapshot(&before);
+    QueryResult *result = exec_query("SELECT grp FROM metered WHERE id = 42;");
+    assert_int_eq(1, alist_length(&result->rows), "Point lookup row");
+    assert_int_eq(1, (int)counter_delta(&before, METRIC_INDEX_PROBES), "One index probe");
+    assert_int_eq(1, (int)counter_delta(&before, METRIC_INDEX_ROWS), "One row id from it");
+    assert_int_eq(0, (int)counter_delta(&before, METRIC_ROWS_SCANNED), "No table scan");
+
+    metrics_snapshot(&before);
+    exec_query("SELECT id, g_name FROM metered JOIN groups ON grp = g_id;");
+    MetricsSnapshot after;
+    metrics_snapshot(&after);
+    uint64_t built = after.counters[METRIC_JOIN_BUILD_ROWS] -
+                     before.counters[METRIC_JOIN_BUILD_ROWS];
+    uint64_t probed = after.counters[METRIC_JOIN_PROBE_ROWS] -
+                      before.counters[METRIC_JOIN_PROBE_ROWS];
+    assert_int_eq(3, (int)built, "The small side is built");
+    assert_true(probed > 0 && probed <= METRICS_TEST_ROWS, "The large side is probed");
+    const HistogramSnapshot *sizes = &after.histograms[METRIC_JOIN_BUILD_SIZE];
+    assert_int_eq(1, (int)(sizes->count - before.histograms[METRIC_JOIN_BUILD_SIZE].count),
+                  "One build size recorded");
+    assert_true(sizes->max >= 3, "Largest build size");
+    assert_int_eq(1, (int)(after.histograms[METRIC_STATEMENT_US].count -
+                           before.histograms[METRIC_STATEMENT_US].count),
+                  "One statement latency");
+    assert_true(after.threads >= 1, "Recording threads");
+
+    HistogramSnapshot hist = {0};
+    hist.count = 4;
+    hist.buckets[0] = 1; /* 0 */
+    hist.buckets[2] = 2; /* 2..3 */
+    hist.buckets[7] = 1; /* 64..127 */
+    hist.max = 100;
+    assert_int_eq(3, (int)metrics_percentile(&hist, 0.50), "p50 bucket bound");
+    assert_int_eq(100, (int)metrics_percentile(&hist, 0.99), "Capped at the maximum");
+
+    metrics_reset();
+    metrics_snapshot(&after);
+    assert_int_eq(0, (int)after.counters[METRIC_STATEMENTS], "Reset clears counters");
+    assert_int_eq(0, (int)after.histograms[METRIC_STATEMENT_US].count, "Reset clears histograms");
+
+    log_msg(LOG_INFO, "Metrics tests passed");
+}
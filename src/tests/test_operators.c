@@ -0,0 +1,925 @@
+#include <stdio.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "test_util.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include "values.h"
+
+#define OPERATOR_TEST_ROWS 5000
+#define PARALLEL_TEST_ROWS 19600 /* not a whole number of morsels */
+
+static void fill_items(const char *storage, int rows) {
+    char sql[4096];
+    string_format(sql, sizeof(sql), "CREATE TABLE items (id INT, grp INT, price FLOAT)%s;",
+                  storage);
+    exec(sql);
+
+    for (int start = 0; start < rows; start += 100) {
+        string_format(sql, sizeof(sql), "INSERT INTO items VALUES ");
+        for (int i = start; i < start + 100; i++) {
+            char row[64];
+            char price[16];
+            if (i % 7 == 0)
+                string_format(price, sizeof(price), "NULL");
+            else
+                string_format(price, sizeof(price), "%d.5", i % 100);
+            string_format(row, sizeof(row), "%s(%d, %d, %s)", i == start ? "" : ", ", i, i % 10,
+                          price);
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+}
+
+static void fill_operator_table(const char *storage) {
+    fill_items(storage, OPERATOR_TEST_ROWS);
+}
+
+static Value result_value(QueryResult *result, int row, int col) {
+    return *(Value *)alist_get(&result->values, row * result->col_count + col);
+}
+
+static PlanNode *plan_for_sql(const char *sql, ASTNode **ast, Token **tokens) {
+    *tokens = tokenize(sql);
+    *ast = parse(*tokens);
+    assert_ptr_not_null(*ast, "Parsing failed for: %s", sql);
+    return plan_select(&(*ast)->select);
+}
+
+static const PlanNode *find_plan(const PlanNode *plan, PlanType type) {
+    if (!plan)
+        return NULL;
+    if (plan->type == type)
+        return plan;
+    const PlanNode *found = find_plan(plan->left, type);
+    return found ? found : find_plan(plan->right, type);
+}
+
+void test_operator_plan_shape(void) {
+    log_msg(LOG_INFO, "Testing SELECT operator plans...");
+
+    reset_database();
+    fill_operator_table("");
+    exec("CREATE TABLE groups (grp INT, name STRING);");
+    exec("INSERT INTO groups VALUES (1, 'one'), (2, 'two');");
+    exec("CREATE INDEX idx_items_id ON items USING BTREE (id);");
+
+    struct {
+        const char *sql;
+        int depth;
+        PlanType types[6];
+    } cases[] = {
+        {"SELECT * FROM items;", 2, {PLAN_PROJECT, PLAN_SEQ_SCAN}},
+        {"SELECT id FROM items WHERE grp = 3 LIMIT 5;",
+         4, {PLAN_PROJECT, PLAN_LIMIT, PLAN_FILTER, PLAN_SEQ_SCAN}},
+        {"SELECT id FROM items ORDER BY price DESC;", 3, {PLAN_PROJECT, PLAN_SORT, PLAN_SEQ_SCAN}},
+        {"SELECT id FROM items ORDER BY id LIMIT 3;",
+         3, {PLAN_PROJECT, PLAN_LIMIT, PLAN_INDEX_ORDER_SCAN}},
+        {"SELECT COUNT(*) FROM items WHERE id < 10;",
+         4, {PLAN_PROJECT, PLAN_AGGREGATE, PLAN_FILTER, PLAN_INDEX_SCAN}},
+        {"SELECT * FROM items JOIN groups ON items.grp = groups.grp WHERE items.id < 100;",
+         4, {PLAN_PROJECT, PLAN_HASH_JOIN, PLAN_FILTER, PLAN_INDEX_SCAN}},
+        {"SELECT * FROM items JOIN groups ON items.grp < groups.grp WHERE groups.name = 'one';",
+         3, {PLAN_PROJECT, PLAN_NESTED_LOOP_JOIN, PLAN_SEQ_SCAN}},
+    };
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        ASTNode *ast;
+        Token *tokens;
+        PlanNode *plan = plan_for_sql(cases[c].sql, &ast, &tokens);
+        const PlanNode *node = plan;
+        for (int depth = 0; depth < cases[c].depth; depth++) {
+            assert_true(node != NULL, "Plan too shallow at depth %d for: %s", depth,
+                                cases[c].sql);
+            assert_int_eq(cases[c].types[depth], node->type, "Node %d for: %s", depth,
+                          cases[c].sql);
+            node = node->left;
+        }
+        free_plan(plan);
+        free_ast(ast);
+        free_tokens(tokens);
+    }
+
+    ASTNode *ast;
+    Token *tokens;
+    PlanNode *plan = plan_for_sql(
+        "SELECT * FROM groups JOIN items ON groups.grp = items.grp;", &ast, &tokens);
+    const PlanNode *join = find_plan(plan, PLAN_HASH_JOIN);
+    assert_true(join != NULL, "Equi-join of same-typed columns should hash");
+    assert_true(join->plan.join.build_left, "Inner join should build on the smaller side");
+    free_plan(plan);
+    free_ast(ast);
+    free_tokens(tokens);
+
+    log_msg(LOG_INFO, "SELECT operator plan tests passed");
+}
+
+static uint16_t leftmost_table(const PlanNode *plan) {
+    while (plan->type != PLAN_SEQ_SCAN && plan->type != PLAN_INDEX_SCAN)
+        plan = plan->left;
+    return plan->type == PLAN_SEQ_SCAN ? plan->plan.seq_scan.table_id
+                                       : plan->plan.index_scan.table_id;
+}
+
+void test_operator_join_order(void) {
+    log_msg(LOG_INFO, "Testing join order selection...");
+
+    reset_database();
+    fill_operator_table("");
+    exec("CREATE TABLE groups (grp INT, name STRING);");
+    exec("CREATE TABLE labels (grp INT, label STRING);");
+    for (int g = 0; g < 10; g++) {
+        char sql[128];
+        string_format(sql, sizeof(sql), "INSERT INTO groups VALUES (%d, 'g%d');", g, g);
+        exec(sql);
+        string_format(sql, sizeof(sql), "INSERT INTO labels VALUES (%d, 'l%d');", g, g);
+        exec(sql);
+    }
+    exec("CREATE INDEX idx_items_grp ON items (grp);");
+    uint16_t groups_id = find_table_by_name("groups")->table_id;
+
+    /* However the query lists them, the filtered dimension drives and the fact table is
+       reached through its index. */
+    const char *queries[] = {
+        "SELECT items.id, labels.label FROM items JOIN groups ON items.grp = groups.grp JOIN "
+        "labels ON labels.grp = groups.grp WHERE groups.name = 'g3';",
+        "SELECT items.id, labels.label FROM labels JOIN items ON labels.grp = items.grp JOIN "
+        "groups ON items.grp = groups.grp WHERE groups.name = 'g3';",
+    };
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+        ASTNode *ast;
+        Token *tokens;
+        PlanNode *plan = plan_for_sql(queries[q], &ast, &tokens);
+        assert_int_eq(groups_id, leftmost_table(plan), "groups drives: %s", queries[q]);
+        const PlanNode *join = find_plan(plan, PLAN_INDEX_NESTED_LOOP_JOIN);
+        assert_true(join != NULL, "items is probed through its index: %s", queries[q]);
+        assert_true(join->right == NULL, "An index join reads no right input");
+        free_plan(plan);
+        free_ast(ast);
+        free_tokens(tokens);
+
+        QueryResult *result = exec_query(queries[q]);
+        assert_int_eq(OPERATOR_TEST_ROWS / 10, alist_length(&result->rows), "Rows of: %s",
+                      queries[q]);
+        for (int r = 0; r < alist_length(&result->rows); r++)
+            assert_str_eq("l3", result_value(result, r, 1).char_val, "Label of row %d", r);
+    }
+
+    /* A LEFT JOIN keeps the FROM table first. */
+    ASTNode *ast;
+    Token *tokens;
+    PlanNode *plan = plan_for_sql("SELECT * FROM items LEFT JOIN groups ON items.grp = "
+                                  "groups.grp WHERE items.id < 100;", &ast, &tokens);
+    assert_int_eq(find_table_by_name("items")->table_id, leftmost_table(plan),
+                  "LEFT JOIN keeps its order");
+    const PlanNode *join = find_plan(plan, PLAN_HASH_JOIN);
+    assert_true(join && join->plan.join.join_type == JOIN_LEFT && !join->plan.join.build_left,
+                "LEFT JOIN probes with the FROM side");
+    free_plan(plan);
+    free_ast(ast);
+    free_tokens(tokens);
+
+    log_msg(LOG_INFO, "Join order tests passed");
+}
+
+void test_operator_sort(void) {
+    log_msg(LOG_INFO, "Testing the Sort operator...");
+
+    reset_database();
+    exec("CREATE TABLE people (name STRING, age INT, score FLOAT);");
+    exec("INSERT INTO people VALUES ('ann', 30, 1.5), ('bob', 25, NULL), ('cid', 30, 0.5), "
+         "('dee', 41, 2.5), ('eve', 25, 3.5);");
+
+    QueryResult *result = exec_query("SELECT name FROM people ORDER BY age DESC, name;");
+    const char *by_age[] = {"dee", "ann", "cid", "bob", "eve"};
+    assert_int_eq(5, alist_length(&result->rows), "Sorted row count");
+    for (int i = 0; i < 5; i++)
+        assert_str_eq(by_age[i], result_value(result, i, 0).char_val, "Row %d by age", i);
+
+    result = exec_query("SELECT name FROM people ORDER BY score;");
+    assert_str_eq("cid", result_value(result, 0, 0).char_val, "Lowest score first");
+    assert_str_eq("bob", result_value(result, 4, 0).char_val, "NULL sorts last ascending");
+
+    result = exec_query("SELECT name FROM people ORDER BY score DESC LIMIT 2;");
+    assert_int_eq(2, alist_length(&result->rows), "LIMIT after sort");
+    assert_str_eq("bob", result_value(result, 0, 0).char_val, "NULL sorts first descending");
+    assert_str_eq("eve", result_value(result, 1, 0).char_val, "Highest score next");
+
+    result = exec_query("SELECT name FROM people WHERE age < 40 ORDER BY age, score DESC;");
+    const char *filtered[] = {"bob", "eve", "ann", "cid"};
+    assert_int_eq(4, alist_length(&result->rows), "Filtered sort row count");
+    for (int i = 0; i < 4; i++)
+        assert_str_eq(filtered[i], result_value(result, i, 0).char_val, "Filtered row %d", i);
+
+    log_msg(LOG_INFO, "Sort operator tests passed");
+}
+
+static void assert_ids_sorted(QueryResult *result, int expected_rows, bool desc) {
+    assert_int_eq(expected_rows, alist_length(&result->rows), "Sorted row count");
+    for (int i = 1; i < expected_rows; i++) {
+        long long prev = result_value(result, i - 1, 0).int_val;
+        long long cur = result_value(result, i, 0).int_val;
+        assert_true(desc ? prev >= cur : prev <= cur, "Rows %d and %d out of order", i - 1, i);
+    }
+}
+
+void test_operator_sort_keys(void) {
+    log_msg(LOG_INFO, "Testing normalized sort keys...");
+
+    reset_database();
+    exec("CREATE TABLE mixed (n INT, f FLOAT, s STRING, d DATE);");
+    exec("INSERT INTO mixed VALUES (-5, -0.5, 'b', '2020-01-02'), (3, 2.25, 'ab', NULL), "
+         "(-9000000000, -100.5, 'abc', '1999-12-31'), (0, 0, '', '2020-01-01'), "
+         "(9000000000, NULL, 'a', '2100-06-30'), (4, 1.0, 'ab', '1999-12-31');");
+
+    QueryResult *result = exec_query("SELECT n FROM mixed ORDER BY n;");
+    long long by_n[] = {-9000000000LL, -5, 0, 3, 4, 9000000000LL};
+    for (int i = 0; i < 6; i++)
+        assert_true(result_value(result, i, 0).int_val == by_n[i], "Row %d by n", i);
+
+    result = exec_query("SELECT f FROM mixed ORDER BY f DESC;");
+    assert_int_eq(TYPE_NULL, result_value(result, 0, 0).type, "NULL first descending");
+    assert_float_eq(2.25, result_value(result, 1, 0).float_val, 0.001, "Largest float next");
+    assert_float_eq(-100.5, result_value(result, 5, 0).float_val, 0.001, "Negative floats last");
+
+    result = exec_query("SELECT s, n FROM mixed ORDER BY s DESC;");
+    const char *by_s[] = {"b", "abc", "ab", "ab", "a", ""};
+    for (int i = 0; i < 6; i++)
+        assert_str_eq(by_s[i], result_value(result, i, 0).char_val, "Row %d by s DESC", i);
+    assert_int_eq(3, (int)result_value(result, 2, 1).int_val, "Equal keys keep input order");
+    assert_int_eq(4, (int)result_value(result, 3, 1).int_val, "Equal keys keep input order");
+
+    result = exec_query("SELECT n FROM mixed ORDER BY d, f DESC;");
+    long long by_d[] = {4, -9000000000LL, 0, -5, 9000000000LL, 3};
+    for (int i = 0; i < 6; i++)
+        assert_true(result_value(result, i, 0).int_val == by_d[i], "Row %d by d, f DESC", i);
+
+    log_msg(LOG_INFO, "Normalized sort key tests passed");
+}
+
+void test_operator_top_k(void) {
+    log_msg(LOG_INFO, "Testing ORDER BY ... LIMIT top-K...");
+
+    reset_database();
+    fill_operator_table("");
+    SortStats before, after;
+    sort_get_stats(&before);
+    QueryResult *result =
+        exec_query("SELECT id, price FROM items ORDER BY price DESC, id LIMIT 5;");
+    sort_get_stats(&after);
+    assert_int_eq(1, (int)(after.top_k - before.top_k), "LIMIT should use the bounded heap");
+    assert_int_eq(5, alist_length(&result->rows), "Top-K row count");
+    /* NULL prices come first descending, in id order */
+    for (int i = 0; i < 5; i++)
+        assert_int_eq(i * 7, (int)result_value(result, i, 0).int_val, "Top-K row %d", i);
+
+    result = exec_query("SELECT id FROM items WHERE price > 0 ORDER BY price DESC, id DESC "
+                        "LIMIT 3;");
+    assert_int_eq(4999, (int)result_value(result, 0, 0).int_val, "Highest price, last id");
+    assert_int_eq(4899, (int)result_value(result, 1, 0).int_val, "Ties order by id DESC");
+    assert_int_eq(4799, (int)result_value(result, 2, 0).int_val, "Third highest");
+
+    result = exec_query("SELECT id FROM items ORDER BY grp LIMIT 600;");
+    assert_int_eq(600, alist_length(&result->rows), "A large K returns K rows");
+    for (int i = 0; i < 500; i++)
+        assert_int_eq(i * 10, (int)result_value(result, i, 0).int_val, "grp 0 row %d", i);
+    assert_int_eq(1, (int)result_value(result, 500, 0).int_val, "grp 1 follows");
+
+    result = exec_query("SELECT id FROM items ORDER BY id DESC LIMIT 10000;");
+    assert_ids_sorted(result, OPERATOR_TEST_ROWS, true);
+    result = exec_query("SELECT id FROM items ORDER BY id LIMIT 3000000000;");
+    assert_ids_sorted(result, OPERATOR_TEST_ROWS, false);
+
+    Token *tokens = tokenize("SELECT id FROM items ORDER BY id LIMIT -1;");
+    assert_ptr_null(parse(tokens), "A negative LIMIT is rejected");
+    free_tokens(tokens);
+    tokens = tokenize("SELECT id FROM items ORDER BY id LIMIT 5000000000;");
+    assert_ptr_null(parse(tokens), "A LIMIT past 32 bits is rejected");
+    free_tokens(tokens);
+    log_msg(LOG_INFO, "Top-K tests passed");
+}
+
+void test_operator_external_sort(void) {
+    log_msg(LOG_INFO, "Testing external merge sort...");
+
+    reset_database();
+    fill_operator_table("");
+    exec_set_work_mem(WORK_MEM_MIN);
+    SortStats before, after;
+    sort_get_stats(&before);
+    QueryResult *result = exec_query("SELECT id FROM items ORDER BY grp DESC, id;");
+    sort_get_stats(&after);
+    assert_true(after.runs - before.runs > 1, "A small budget should spill several runs");
+    assert_true(after.spilled_bytes > before.spilled_bytes, "Runs should be written out");
+    assert_int_eq(OPERATOR_TEST_ROWS, alist_length(&result->rows), "Merged row count");
+    for (int i = 0; i < OPERATOR_TEST_ROWS; i++) {
+        int expected = (9 - i / 500) + (i % 500) * 10;
+        assert_int_eq(expected, (int)result_value(result, i, 0).int_val, "Merged row %d", i);
+    }
+
+    result = exec_query("SELECT id FROM items ORDER BY price, id DESC;");
+    assert_int_eq(OPERATOR_TEST_ROWS, alist_length(&result->rows), "Merged rows with NULLs");
+    assert_int_eq(4800, (int)result_value(result, 0, 0).int_val, "Lowest price, highest id");
+    assert_int_eq(0, (int)result_value(result, OPERATOR_TEST_ROWS - 1, 0).int_val,
+                  "NULL prices last, lowest id last");
+
+    exec("CREATE TABLE groups (grp INT, name STRING);");
+    exec("INSERT INTO groups VALUES (1, 'one'), (2, 'two');");
+    result = exec_query("SELECT items.id FROM items JOIN groups ON items.grp = groups.grp "
+                        "ORDER BY groups.name DESC, items.id;");
+    assert_int_eq(1000, alist_length(&result->rows), "Spilled join sort row count");
+    assert_int_eq(2, (int)result_value(result, 0, 0).int_val, "Joined rows sort by name");
+    assert_int_eq(1, (int)result_value(result, 500, 0).int_val, "then by the other group");
+
+    exec_set_work_mem(0);
+    log_msg(LOG_INFO, "External merge sort tests passed");
+}
+
+static uint64_t scanned_rows(const Operator *op) {
+    while (op->left)
+        op = op->left;
+    return op->rows_out;
+}
+
+/* Runs a SELECT through the operator tree directly so the scan's row count is observable. */
+static uint64_t run_and_count_scanned(const char *sql, int *result_rows) {
+    ASTNode *ast;
+    Token *tokens;
+    PlanNode *plan = plan_for_sql(sql, &ast, &tokens);
+
+    ExecContext ctx;
+    assert_true(exec_context_init(&ctx, &ast->select), "Context for: %s", sql);
+    Operator *root = operator_build(plan, &ctx);
+    assert_true(root && operator_open(root), "Opening operators for: %s", sql);
+    RowBatch batch;
+    row_batch_init(&batch);
+    while (operator_next(root, &batch))
+        ;
+    row_batch_free(&batch);
+    uint64_t scanned = scanned_rows(root);
+    *result_rows = alist_length(&ctx.result->rows);
+
+    operator_close(root);
+    free_query_result(ctx.result);
+    exec_context_free(&ctx);
+    free_plan(plan);
+    free_ast(ast);
+    free_tokens(tokens);
+    return scanned;
+}
+
+void test_operator_limit_stops_early(void) {
+    log_msg(LOG_INFO, "Testing LIMIT early termination...");
+
+    reset_database();
+    fill_operator_table("");
+    exec("CREATE INDEX idx_items_id ON items USING BTREE (id);");
+
+    int rows;
+    uint64_t scanned = run_and_count_scanned("SELECT * FROM items LIMIT 10;", &rows);
+    assert_int_eq(10, rows, "LIMIT row count");
+    assert_true(scanned <= FILTER_BATCH_SIZE, "LIMIT should stop the scan after one batch");
+
+    scanned = run_and_count_scanned("SELECT id FROM items WHERE grp = 4 LIMIT 25;", &rows);
+    assert_int_eq(25, rows, "Filtered LIMIT row count");
+    assert_true(scanned <= FILTER_BATCH_SIZE, "Filtered LIMIT should stop after one batch");
+
+    scanned = run_and_count_scanned("SELECT id FROM items ORDER BY id DESC LIMIT 3;", &rows);
+    assert_int_eq(3, rows, "Index-ordered LIMIT row count");
+    assert_true(scanned < OPERATOR_TEST_ROWS, "Index-ordered LIMIT should not walk the tree");
+
+    scanned = run_and_count_scanned("SELECT id FROM items;", &rows);
+    assert_int_eq(OPERATOR_TEST_ROWS, rows, "Full scan row count");
+    assert_int_eq(OPERATOR_TEST_ROWS, (int)scanned, "Full scan reads every row");
+
+    QueryResult *result = exec_query("SELECT id FROM items ORDER BY id DESC LIMIT 3;");
+    assert_int_eq(OPERATOR_TEST_ROWS - 1, (int)result_value(result, 0, 0).int_val,
+                  "Largest id first");
+
+    log_msg(LOG_INFO, "LIMIT early termination tests passed");
+}
+
+static void check_join_aggregates(void) {
+    QueryResult *result = exec_query(
+        "SELECT COUNT(*), COUNT(items.price), SUM(items.grp), MAX(groups.weight) FROM items "
+        "JOIN groups ON items.grp = groups.grp;");
+    /* grp 1 and 2 each cover a tenth of the rows */
+    int joined = OPERATOR_TEST_ROWS / 5;
+    assert_int_eq(1, alist_length(&result->rows), "Aggregate over join returns one row");
+    assert_int_eq(joined, (int)result_value(result, 0, 0).int_val, "COUNT(*) over join");
+    int non_null = 0;
+    for (int i = 0; i < OPERATOR_TEST_ROWS; i++)
+        if ((i % 10 == 1 || i % 10 == 2) && i % 7 != 0)
+            non_null++;
+    assert_int_eq(non_null, (int)result_value(result, 0, 1).int_val, "COUNT(col) skips NULLs");
+    assert_int_eq(joined / 2 * 3, (int)result_value(result, 0, 2).int_val, "SUM over join");
+    assert_float_eq(2.5, result_value(result, 0, 3).float_val, 0.001,
+                    "MAX from the joined table");
+
+    result = exec_query("SELECT COUNT(groups.weight) FROM items LEFT JOIN groups ON "
+                        "items.grp = groups.grp WHERE items.id < 100;");
+    assert_int_eq(20, (int)result_value(result, 0, 0).int_val,
+                  "COUNT skips the NULL side of a LEFT JOIN");
+}
+
+void test_operator_aggregates(void) {
+    log_msg(LOG_INFO, "Testing the Aggregate operator...");
+
+    const char *storages[] = {"", " STORAGE COLUMNAR"};
+    for (int s = 0; s < 2; s++) {
+        reset_database();
+        fill_operator_table(storages[s]);
+        exec("CREATE TABLE groups (grp INT, weight FLOAT);");
+        exec("INSERT INTO groups VALUES (1, 1.5), (2, 2.5);");
+        check_join_aggregates();
+
+        QueryResult *result =
+            exec_query("SELECT COUNT(*), AVG(price), MIN(price) FROM items WHERE grp = 3;");
+        assert_int_eq(OPERATOR_TEST_ROWS / 10, (int)result_value(result, 0, 0).int_val,
+                      "Filtered COUNT(*)");
+        assert_float_eq(3.5, result_value(result, 0, 2).float_val, 0.001, "Filtered MIN");
+
+        result = exec_query("SELECT COUNT(*), SUM(price) FROM items WHERE id < 0;");
+        assert_int_eq(1, alist_length(&result->rows), "Aggregate over no rows returns a row");
+        assert_int_eq(0, (int)result_value(result, 0, 0).int_val, "COUNT over no rows");
+        Value sum = result_value(result, 0, 1);
+        assert_true(is_null(&sum), "SUM over no rows is NULL");
+    }
+
+    exec("CREATE TABLE nothing (id INT);");
+    QueryResult *result = exec_query("SELECT COUNT(*) FROM nothing;");
+    assert_int_eq(1, alist_length(&result->rows), "Aggregate over an empty table");
+    assert_int_eq(0, (int)result_value(result, 0, 0).int_val, "COUNT over an empty table");
+    result = exec_query("SELECT SUM(id), AVG(id), MIN(id), MAX(id) FROM nothing;");
+    for (int c = 0; c < 4; c++) {
+        Value none = result_value(result, 0, c);
+        assert_true(is_null(&none), "Aggregate %d over an empty table is NULL", c);
+    }
+
+    /* Strings and dates keep their value; INTs stay INTs. */
+    exec("CREATE TABLE pets (name STRING, born DATE, age INT);");
+    exec("INSERT INTO pets VALUES ('rex', '2020-03-04', 3), ('ace', '2021-01-02', 9), "
+         "('zed', NULL, NULL);");
+    Value born = result_value(exec_query("SELECT born FROM pets WHERE name = 'ace';"), 0, 0);
+    result = exec_query("SELECT MIN(name), MAX(name), MAX(born), MAX(age), SUM(age) FROM pets;");
+    Value first = result_value(result, 0, 0);
+    Value last = result_value(result, 0, 1);
+    Value newest = result_value(result, 0, 2);
+    assert_str_eq("ace", value_str(&first), "MIN over strings");
+    assert_str_eq("zed", value_str(&last), "MAX over strings");
+    assert_true(newest.type == TYPE_DATE && compare_values(&newest, &born) == 0,
+                "MAX over dates");
+    assert_true(result_value(result, 0, 3).type == TYPE_INT, "MAX of INTs is an INT");
+    assert_int_eq(12, (int)result_value(result, 0, 4).int_val, "SUM of INTs is an INT");
+
+    /* A FLOAT column's aggregates are FLOATs even when it holds whole numbers. */
+    for (int st = 0; st < 2; st++) {
+        char sql[160];
+        snprintf(sql, sizeof(sql), "CREATE TABLE weights%d (k INT, w FLOAT)%s;", st,
+                 storages[st]);
+        exec(sql);
+        snprintf(sql, sizeof(sql), "INSERT INTO weights%d VALUES (1, 2), (1, 3), (2, 4.0);", st);
+        exec(sql);
+        snprintf(sql, sizeof(sql),
+                 "SELECT SUM(w), MIN(w), MAX(w), SUM(w + 1), SUM(k) FROM weights%d;", st);
+        result = exec_query(sql);
+        for (int c = 0; c < 4; c++)
+            assert_true(result_value(result, 0, c).type == TYPE_FLOAT,
+                        "Aggregate %d of a FLOAT column is a FLOAT (%d)", c, st);
+        assert_float_eq(9, result_value(result, 0, 0).float_val, 1e-9, "SUM of whole FLOATs");
+        assert_true(result_value(result, 0, 4).type == TYPE_INT, "SUM of an INT column");
+        snprintf(sql, sizeof(sql), "SELECT k, SUM(w), MAX(w) FROM weights%d GROUP BY k ORDER BY k;",
+                 st);
+        result = exec_query(sql);
+        for (int r = 0; r < 2; r++)
+            for (int c = 1; c < 3; c++)
+                assert_true(result_value(result, r, c).type == TYPE_FLOAT,
+                            "Grouped aggregate %d of a FLOAT column is a FLOAT (%d)", c, st);
+        assert_float_eq(5, result_value(result, 0, 1).float_val, 1e-9, "Grouped SUM");
+        snprintf(sql, sizeof(sql), "CREATE MATERIALIZED VIEW weight_totals%d AS SELECT k, "
+                 "SUM(w) AS total, MAX(w) AS heaviest FROM weights%d GROUP BY k;", st, st);
+        exec(sql);
+        snprintf(sql, sizeof(sql), "SELECT total, heaviest FROM weight_totals%d ORDER BY total;",
+                 st);
+        result = exec_query(sql);
+        for (int c = 0; c < 2; c++)
+            assert_true(result_value(result, 0, c).type == TYPE_FLOAT,
+                        "View aggregate %d of a FLOAT column is a FLOAT (%d)", c, st);
+        assert_float_eq(4, result_value(result, 0, 0).float_val, 1e-9, "View SUM");
+    }
+    result = exec_query("SELECT (SELECT MAX(age) FROM pets WHERE age > 100) FROM pets WHERE "
+                        "name = 'rex';");
+    Value missing = result_value(result, 0, 0);
+    assert_true(is_null(&missing), "A scalar subquery over no rows is NULL");
+
+    log_msg(LOG_INFO, "Aggregate operator tests passed");
+}
+
+static void check_grouped_items(const char *storage, int rows) {
+    long long counts[10] = {0}, non_null[10] = {0};
+    double sums[10] = {0};
+    for (int i = 0; i < rows; i++) {
+        counts[i % 10]++;
+        if (i % 7 != 0) {
+            non_null[i % 10]++;
+            sums[i % 10] += i % 100 + 0.5;
+        }
+    }
+
+    QueryResult *result = exec_query("SELECT grp, COUNT(*), COUNT(price), SUM(price), "
+                                     "COUNT(DISTINCT price) FROM items GROUP BY grp ORDER BY grp;");
+    assert_int_eq(10, alist_length(&result->rows), "One row per group (%s)", storage);
+    for (int g = 0; g < 10; g++) {
+        assert_int_eq(g, (int)result_value(result, g, 0).int_val, "Groups come out in order");
+        assert_int_eq((int)counts[g], (int)result_value(result, g, 1).int_val, "COUNT(*) of %d", g);
+        assert_int_eq((int)non_null[g], (int)result_value(result, g, 2).int_val,
+                      "COUNT(price) of %d", g);
+        assert_float_eq(sums[g], result_value(result, g, 3).float_val, 0.001, "SUM of %d", g);
+        assert_int_eq(10, (int)result_value(result, g, 4).int_val, "COUNT(DISTINCT) of %d", g);
+    }
+}
+
+void test_operator_group_by(void) {
+    log_msg(LOG_INFO, "Testing the Hash Aggregate operator...");
+
+    const char *storages[] = {"", " STORAGE COLUMNAR"};
+    for (int s = 0; s < 2; s++) {
+        reset_database();
+        fill_operator_table(storages[s]);
+        check_grouped_items(storages[s], OPERATOR_TEST_ROWS);
+
+        QueryResult *result =
+            exec_query("SELECT grp, MAX(price) FROM items WHERE id < 1000 GROUP BY grp "
+                       "HAVING MAX(price) > 95 ORDER BY grp DESC;");
+        assert_int_eq(5, alist_length(&result->rows), "HAVING keeps groups 5 to 9");
+        assert_int_eq(9, (int)result_value(result, 0, 0).int_val, "ORDER BY grp DESC");
+        assert_float_eq(99.5, result_value(result, 0, 1).float_val, 0.001, "MAX of group 9");
+
+        result = exec_query("SELECT grp FROM items GROUP BY grp HAVING COUNT(*) = 500 AND "
+                            "grp > 2 ORDER BY grp LIMIT 2;");
+        assert_int_eq(2, alist_length(&result->rows), "LIMIT applies to the groups");
+        assert_int_eq(3, (int)result_value(result, 0, 0).int_val, "HAVING can use group keys");
+        assert_int_eq(4, (int)result_value(result, 1, 0).int_val, "and aggregates");
+
+        result = exec_query("SELECT COUNT(DISTINCT grp), COUNT(DISTINCT price), "
+                            "SUM(DISTINCT grp) FROM items;");
+        assert_int_eq(1, alist_length(&result->rows), "DISTINCT aggregates without GROUP BY");
+        assert_int_eq(10, (int)result_value(result, 0, 0).int_val, "COUNT(DISTINCT grp)");
+        assert_int_eq(100, (int)result_value(result, 0, 1).int_val, "COUNT(DISTINCT price)");
+        assert_int_eq(45, (int)result_value(result, 0, 2).int_val, "SUM(DISTINCT grp)");
+
+        result = exec_query("SELECT grp, COUNT(*) FROM items WHERE id < 0 GROUP BY grp;");
+        assert_int_eq(0, alist_length(&result->rows), "No input rows make no groups");
+    }
+
+    ASTNode *ast;
+    Token *tokens;
+    PlanNode *plan = plan_for_sql("SELECT grp, COUNT(*) FROM items GROUP BY grp;", &ast, &tokens);
+    assert_true(find_plan(plan, PLAN_HASH_AGGREGATE) != NULL, "GROUP BY should hash aggregate");
+    assert_true(find_plan(plan, PLAN_AGGREGATE) == NULL, "GROUP BY needs no plain aggregate");
+    free_plan(plan);
+    free_ast(ast);
+    free_tokens(tokens);
+
+    log_msg(LOG_INFO, "Hash Aggregate operator tests passed");
+}
+
+void test_operator_group_by_keys(void) {
+    log_msg(LOG_INFO, "Testing GROUP BY keys...");
+    reset_database();
+    exec("CREATE TABLE pets (kind STRING, name STRING, age INT);");
+    exec("INSERT INTO pets VALUES ('dog', 'rex', 3), ('cat', 'tom', 5), ('dog', 'ace', 3), "
+         "(NULL, 'nobody', 1), ('cat', 'kit', 2), ('a much longer kind name', 'zed', 7), "
+         "(NULL, 'stray', 4);");
+
+    QueryResult *result = exec_query("SELECT kind, COUNT(*), MIN(name), MAX(age) FROM pets "
+                                     "GROUP BY kind ORDER BY kind;");
+    assert_int_eq(4, alist_length(&result->rows), "NULL kinds form one group");
+    assert_str_eq("a much longer kind name", result_value(result, 0, 0).char_val,
+                  "Groups are ordered by kind");
+    assert_str_eq("cat", result_value(result, 1, 0).char_val, "cat comes second");
+    assert_int_eq(2, (int)result_value(result, 1, 1).int_val, "Two cats");
+    assert_str_eq("kit", result_value(result, 1, 2).char_val, "MIN works on strings");
+    assert_int_eq(5, (int)result_value(result, 1, 3).int_val, "MAX(age) of the cats");
+    Value kind = result_value(result, 3, 0);
+    assert_true(is_null(&kind), "The NULL group sorts last");
+    assert_int_eq(2, (int)result_value(result, 3, 1).int_val, "Two pets have no kind");
+
+    result = exec_query("SELECT kind, age, COUNT(name) FROM pets GROUP BY kind, age "
+                        "HAVING COUNT(name) > 1;");
+    assert_int_eq(1, alist_length(&result->rows), "Only the dogs share a kind and an age");
+    assert_str_eq("dog", result_value(result, 0, 0).char_val, "The group is the dogs");
+    assert_int_eq(3, (int)result_value(result, 0, 1).int_val, "aged 3");
+
+    result = exec_query("SELECT kind, COUNT(DISTINCT age) FROM pets GROUP BY kind "
+                        "ORDER BY kind DESC;");
+    kind = result_value(result, 0, 0);
+    assert_true(is_null(&kind), "NULL sorts first descending");
+    assert_str_eq("dog", result_value(result, 1, 0).char_val, "dog is the last name");
+    assert_int_eq(1, (int)result_value(result, 1, 1).int_val, "The dogs have one age");
+
+    Token *tokens = tokenize("SELECT kind FROM pets GROUP kind;");
+    ASTNode *ast = parse(tokens);
+    assert_true(ast == NULL, "GROUP without BY should be rejected");
+    free_ast(ast);
+    free_tokens(tokens);
+    log_msg(LOG_INFO, "GROUP BY key tests passed");
+}
+
+/* Folds every value of the result, in order, into one hash. */
+static uint64_t result_fingerprint(QueryResult *result) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < alist_length(&result->values); i++) {
+        for (const char *c = repr((Value *)alist_get(&result->values, i)); *c; c++)
+            hash = (hash ^ (uint8_t)*c) * 1099511628211ULL;
+        hash = (hash ^ '|') * 1099511628211ULL;
+    }
+    return hash ^ (uint64_t)alist_length(&result->rows);
+}
+
+void test_operator_parallel_scan(void) {
+    log_msg(LOG_INFO, "Testing parallel scans...");
+
+    const char *queries[] = {
+        "SELECT id, price FROM items WHERE grp = 3 AND price > 20;",
+        "SELECT * FROM items WHERE price < 10 OR id > 19500;",
+        "SELECT COUNT(*), COUNT(price), SUM(price), MIN(price), MAX(id), AVG(price) FROM items "
+        "WHERE grp < 5;",
+        "SELECT grp, id FROM items WHERE id >= 0;",
+        "SELECT grp, COUNT(*), SUM(price), MIN(id), COUNT(DISTINCT price) FROM items GROUP BY grp;",
+        "SELECT price, id, COUNT(*) FROM items WHERE grp = 1 GROUP BY price HAVING COUNT(*) > 2;",
+        "SELECT id FROM items WHERE grp = 6 LIMIT 7;",
+    };
+    int query_count = (int)(sizeof(queries) / sizeof(queries[0]));
+    const char *storages[] = {"", " STORAGE COLUMNAR"};
+    for (int s = 0; s < 2; s++) {
+        reset_database();
+        fill_items(storages[s], PARALLEL_TEST_ROWS);
+
+        for (int q = 0; q < query_count; q++) {
+            exec("SET max_parallel_workers = 1;");
+            uint64_t serial = result_fingerprint(exec_query(queries[q]));
+            PoolStats before, after;
+            thread_pool_get_stats(&before);
+            exec("SET max_parallel_workers = 4;");
+            uint64_t parallel = result_fingerprint(exec_query(queries[q]));
+            thread_pool_get_stats(&after);
+            assert_true(serial == parallel, "Parallel result matches serial (%s): %s",
+                        storages[s], queries[q]);
+            assert_true(after.runs > before.runs, "Query ran on the pool: %s", queries[q]);
+        }
+
+        /* One partial group table per worker, merged back to the same groups. */
+        HashAggStats group_before, group_after;
+        hash_agg_get_stats(&group_before);
+        check_grouped_items(storages[s], PARALLEL_TEST_ROWS);
+        hash_agg_get_stats(&group_after);
+        assert_int_eq(4, (int)(group_after.partials - group_before.partials), "4 partials");
+        assert_int_eq(10, (int)(group_after.groups - group_before.groups), "10 groups");
+
+        /* A wave covers two morsels per worker, so LIMIT stops before the last morsel. */
+        exec("SET max_parallel_workers = 2;");
+        int rows;
+        uint64_t scanned = run_and_count_scanned("SELECT id FROM items WHERE grp = 4 LIMIT 25;",
+                                                 &rows);
+        assert_int_eq(25, rows, "Parallel LIMIT row count");
+        assert_int_eq(4 * PARALLEL_MORSEL_ROWS, (int)scanned, "Parallel LIMIT scans one wave");
+    }
+
+    exec("SET max_parallel_workers = 100;");
+    assert_int_eq(2, thread_pool_workers(), "Out of range settings are rejected");
+    exec("SET no_such_setting = 1;");
+    thread_pool_set_workers(1);
+
+    log_msg(LOG_INFO, "Parallel scan tests passed");
+}
+
+void test_operator_radix_hash_join(void) {
+    log_msg(LOG_INFO, "Testing the partitioned hash join...");
+
+    reset_database();
+    fill_items("", PARALLEL_TEST_ROWS);
+    exec("CREATE TABLE groups (grp INT, name STRING);");
+    exec("INSERT INTO groups VALUES (0, 'zero'), (1, 'one'), (2, 'two'), (3, 'three'), "
+         "(4, 'four'), (5, 'five'), (6, 'six'), (7, 'seven'), (3, 'tres');");
+
+    struct {
+        const char *sql;
+        int rows;
+    } cases[] = {
+        {"SELECT items.id, groups.name FROM items JOIN groups ON items.grp = groups.grp "
+         "WHERE items.price > 50;", -1},
+        {"SELECT items.id, groups.name FROM items LEFT JOIN groups ON items.grp = groups.grp;",
+         PARALLEL_TEST_ROWS + PARALLEL_TEST_ROWS / 10},
+        {"SELECT groups.name, items.id FROM groups JOIN items ON groups.grp = items.grp;",
+         PARALLEL_TEST_ROWS * 9 / 10},
+        {"SELECT a.id, b.price FROM items a JOIN items b ON a.id = b.id WHERE a.grp = 3;",
+         PARALLEL_TEST_ROWS / 10},
+        {"SELECT items.id FROM items JOIN groups ON items.grp = groups.grp LIMIT 5;", 5},
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        exec("SET max_parallel_workers = 1;");
+        QueryResult *result = exec_query(cases[c].sql);
+        if (cases[c].rows >= 0)
+            assert_int_eq(cases[c].rows, alist_length(&result->rows), "Rows of: %s",
+                          cases[c].sql);
+        uint64_t serial = result_fingerprint(result);
+
+        /* Tiny partitions and four workers must give the same rows in the same order. */
+        HashJoinStats before, after;
+        hash_join_get_stats(&before);
+        hash_join_set_partition_bytes(JOIN_MIN_PARTITION_BYTES);
+        exec("SET max_parallel_workers = 4;");
+        uint64_t parallel = result_fingerprint(exec_query(cases[c].sql));
+        hash_join_set_partition_bytes(0);
+        hash_join_get_stats(&after);
+        assert_true(serial == parallel, "Partitioned parallel join matches: %s", cases[c].sql);
+        assert_int_eq(1, (int)(after.joins - before.joins), "One hash join: %s", cases[c].sql);
+        assert_int_eq(1, (int)(after.parallel_probes - before.parallel_probes),
+                      "The probe ran on the pool: %s", cases[c].sql);
+    }
+
+    /* With statistics the filtered side is the smaller one and becomes the build side. */
+    exec("ANALYZE items;");
+    HashJoinStats before, after;
+    hash_join_get_stats(&before);
+    hash_join_set_partition_bytes(JOIN_MIN_PARTITION_BYTES);
+    exec_query(cases[3].sql);
+    hash_join_set_partition_bytes(0);
+    hash_join_get_stats(&after);
+    /* 1960 build rows of 16 bytes need 32 partitions of 1 KiB. */
+    assert_int_eq(32, (int)(after.partitions - before.partitions), "Build side partitions");
+
+    thread_pool_set_workers(1);
+    log_msg(LOG_INFO, "Partitioned hash join tests passed");
+}
+
+/* Runs sql serially and on four workers; both must give the same rows, and the join filters
+   must drop the same number of probe rows. Returns that number. */
+static int filtered_rows(const char *sql, int expected_rows, int expected_filters) {
+    int filtered = -1;
+    uint64_t serial = 0;
+    for (int w = 0; w < 2; w++) {
+        exec(w == 0 ? "SET max_parallel_workers = 1;" : "SET max_parallel_workers = 4;");
+        HashJoinStats before, after;
+        hash_join_get_stats(&before);
+        QueryResult *result = exec_query(sql);
+        hash_join_get_stats(&after);
+        assert_int_eq(expected_rows, alist_length(&result->rows), "Rows of: %s", sql);
+        assert_int_eq(expected_filters, (int)(after.join_filters - before.join_filters),
+                      "Join filters of: %s", sql);
+        int dropped = (int)(after.filtered_rows - before.filtered_rows);
+        if (w == 0) {
+            serial = result_fingerprint(result);
+            filtered = dropped;
+        } else {
+            assert_true(serial == result_fingerprint(result), "Parallel rows match: %s", sql);
+            assert_int_eq(filtered, dropped, "Parallel scan drops as many rows: %s", sql);
+        }
+    }
+    return filtered;
+}
+
+void test_operator_join_filters(void) {
+    log_msg(LOG_INFO, "Testing Bloom filters pushed from hash joins into scans...");
+
+    reset_database();
+    fill_items("", PARALLEL_TEST_ROWS);
+    exec("CREATE TABLE picked (grp INT, name STRING);");
+    exec("INSERT INTO picked VALUES (3, 'three'), (NULL, 'none');");
+    exec("CREATE TABLE every (grp INT);");
+    exec("INSERT INTO every VALUES (0), (1), (2), (3), (4), (5), (6), (7), (8), (9);");
+    exec("CREATE TABLE sevens (id INT);");
+    for (int i = 0; i < 700; i += 7) {
+        char sql[64];
+        string_format(sql, sizeof(sql), "INSERT INTO sevens VALUES (%d);", i);
+        exec(sql);
+    }
+
+    /* Only grp 3 gets past the filter (Bloom false positives aside, there are no other keys). */
+    int dropped = filtered_rows("SELECT items.id, picked.name FROM items JOIN picked ON "
+                                "items.grp = picked.grp;",
+                                PARALLEL_TEST_ROWS / 10, 1);
+    assert_int_eq(PARALLEL_TEST_ROWS * 9 / 10, dropped, "Nine in ten probe rows are dropped");
+
+    /* A filter that drops nothing is switched off after its sample. */
+    dropped = filtered_rows("SELECT items.id FROM items JOIN every ON items.grp = every.grp;",
+                            PARALLEL_TEST_ROWS, 1);
+    assert_int_eq(0, dropped, "Every probe key is in the build side");
+
+    /* A LEFT JOIN keeps unmatched probe rows, so nothing is pushed. */
+    filtered_rows("SELECT items.id FROM items LEFT JOIN picked ON items.grp = picked.grp;",
+                  PARALLEL_TEST_ROWS, 0);
+
+    /* Both dimensions of a star join filter the scan of the fact table. */
+    dropped = filtered_rows("SELECT items.id FROM items JOIN picked ON items.grp = picked.grp "
+                            "JOIN sevens ON items.id = sevens.id;",
+                            10, 2);
+    assert_true(dropped >= PARALLEL_TEST_ROWS - 100, "Rows outside both dimensions dropped");
+
+    /* A correlated EXISTS probes the Bloom filter of its semi join before the key set. */
+    SubqueryStats before, after;
+    subquery_get_stats(&before);
+    QueryResult *result = exec_query("SELECT id FROM items i WHERE EXISTS (SELECT name FROM "
+                                     "picked p WHERE p.grp = i.grp);");
+    subquery_get_stats(&after);
+    assert_int_eq(PARALLEL_TEST_ROWS / 10, alist_length(&result->rows), "Semi join rows");
+    assert_true(after.bloom_misses - before.bloom_misses >= PARALLEL_TEST_ROWS * 9 / 10 - 20,
+                "Most semi join probes stop at the Bloom filter");
+
+    thread_pool_set_workers(1);
+}
+
+/* Runs sql with the default work_mem and with the smallest on one and four workers; all three
+   must give the same rows in the same order. */
+static void check_spilled(const char *sql, int expected_rows) {
+    uint64_t expected = 0;
+    for (int run = 0; run < 3; run++) {
+        exec(run < 2 ? "SET max_parallel_workers = 1;" : "SET max_parallel_workers = 4;");
+        exec(run == 0 ? "SET work_mem = 0;" : "SET work_mem = 64;");
+        QueryResult *result = exec_query(sql);
+        assert_int_eq(expected_rows, alist_length(&result->rows), "Rows of: %s", sql);
+        if (run == 0)
+            expected = result_fingerprint(result);
+        else
+            assert_true(expected == result_fingerprint(result), "Spilled rows match: %s", sql);
+    }
+    exec("SET work_mem = 0;");
+    thread_pool_set_workers(1);
+}
+
+void test_operator_grace_hash_join(void) {
+    log_msg(LOG_INFO, "Testing hash joins that spill to temporary files...");
+
+    reset_database();
+    fill_items("", PARALLEL_TEST_ROWS);
+    exec("CREATE TABLE evens (id INT, tag INT);");
+    char sql[4096];
+    for (int start = 0; start < PARALLEL_TEST_ROWS; start += 200) {
+        string_format(sql, sizeof(sql), "INSERT INTO evens VALUES ");
+        for (int i = start; i < start + 200; i += 2) {
+            char row[32];
+            string_format(row, sizeof(row), "%s(%d, %d)", i == start ? "" : ", ", i, i % 3);
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+
+    HashJoinStats before, after;
+    hash_join_get_stats(&before);
+    check_spilled("SELECT a.id, b.price FROM items a JOIN items b ON a.id = b.id "
+                  "WHERE a.grp = 3 ORDER BY a.id;",
+                  PARALLEL_TEST_ROWS / 10);
+    hash_join_get_stats(&after);
+    assert_int_eq(2, (int)(after.spilled - before.spilled), "Both small budget joins spill");
+    assert_true(after.spill_partitions - before.spill_partitions >= 2 * SPILL_FANOUT - 2,
+                "Partition pairs joined from temporary files");
+
+    check_spilled("SELECT items.id, evens.tag FROM items LEFT JOIN evens ON items.id = evens.id "
+                  "ORDER BY items.id;",
+                  PARALLEL_TEST_ROWS);
+    check_spilled("SELECT COUNT(*), COUNT(evens.tag), SUM(evens.tag) FROM items "
+                  "JOIN evens ON items.id = evens.id;",
+                  1);
+    QueryResult *result = exec_query("SELECT COUNT(*) FROM items JOIN evens ON items.id = evens.id "
+                                     "WHERE items.grp = 1;");
+    assert_int_eq(0, (int)result_value(result, 0, 0).int_val, "Odd groups have no even ids");
+
+    /* NULL prices match nothing, on either side of the spilled join. */
+    check_spilled("SELECT a.id, b.id FROM items a JOIN items b ON a.price = b.price "
+                  "WHERE a.id < 40 AND b.id < 400 ORDER BY a.id, b.id;",
+                  119);
+
+    log_msg(LOG_INFO, "Spilling hash join tests passed");
+}
+
+void test_operator_group_by_spill(void) {
+    log_msg(LOG_INFO, "Testing GROUP BY that spills to temporary files...");
+
+    reset_database();
+    fill_items("", PARALLEL_TEST_ROWS);
+    HashAggStats before, after;
+    hash_agg_get_stats(&before);
+    check_spilled("SELECT id, COUNT(*), SUM(price), MIN(grp) FROM items GROUP BY id;",
+                  PARALLEL_TEST_ROWS);
+    hash_agg_get_stats(&after);
+    assert_int_eq(2, (int)(after.spilled - before.spilled), "Both small budget aggregates spill");
+    assert_true(after.spill_partitions - before.spill_partitions > 2 * SPILL_FANOUT,
+                "Partitions still too large spill again");
+    assert_int_eq(3 * PARALLEL_TEST_ROWS, (int)(after.groups - before.groups),
+                  "Every group is finished once");
+
+    check_spilled("SELECT price, grp, COUNT(*), MAX(id) FROM items GROUP BY price, grp "
+                  "HAVING COUNT(*) > 1 ORDER BY grp DESC;",
+                  110);
+    check_spilled("SELECT grp, COUNT(DISTINCT price), AVG(price) FROM items GROUP BY grp;", 10);
+
+    log_msg(LOG_INFO, "Spilling GROUP BY tests passed");
+}
@@ -1,14 +1,22 @@
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
 #include "db.h"
+#include "dbapi.h"
+#include "executor.h"
 #include "logger.h"
+#include "table.h"
+#include "test_util.h"
 #include "utils.h"
+#include "values.h"
+
+#define OPT_TEST_ROWS 10000
 
 void test_table_stats_functionality(void) {
     log_msg(LOG_INFO, "Testing TableStats functionality...");
 
     TableStats stats;
-    strcopy(stats.table_name, sizeof(stats.table_name), "test_table");
+    stats.table_id = 1;
     stats.total_rows = 1000;
     stats.has_stats = true;
 
@@ -18,7 +26,7 @@ void test_table_stats_functionality(void) {
 
     assert(stats.total_rows == 1000);
     assert(stats.has_stats == true);
-    assert(strcmp(stats.table_name, "test_table") == 0);
+    assert(stats.table_id == 1);
     assert(stats.distinct_values[0] == 100);
 
     log_msg(LOG_INFO, "TableStats functionality tests passed");
@@ -26,16 +34,22 @@ void test_table_stats_functionality(void) {
 
 void test_optimizer_support_functions(void) {
     log_msg(LOG_INFO, "Testing optimizer support functions...");
-    collect_table_stats("test_users");
-    collect_table_stats("test_orders");
 
-    TableStats *stats = get_table_stats("test_users");
-    assert(stats != NULL);
+    reset_database();
+    collect_table_stats(1);
+    assert(get_table_stats(1) == NULL);
 
-    double selectivity = estimate_selectivity(stats, 0, OP_EQUALS, NULL);
+    double selectivity = estimate_selectivity(NULL, 0, OP_EQUALS, NULL);
     assert(selectivity > 0.0 && selectivity <= 1.0);
 
-    Index *index = find_index_by_table_column("test_users", "id");
+    exec("CREATE TABLE small (id INT);");
+    exec("INSERT INTO small VALUES (1), (2), (3);");
+    collect_table_stats(1);
+    TableStats *stats = get_table_stats(1);
+    assert(stats != NULL && stats->has_stats);
+    assert(stats->total_rows == 3);
+
+    Index *index = find_index_by_table_column(1, 0);
     assert(index == NULL);
 
     log_msg(LOG_INFO, "Optimizer support function tests passed");
@@ -45,23 +59,19 @@ void test_plan_node_structures(void) {
     log_msg(LOG_INFO, "Testing PlanNode structures...");
 
     SeqScanPlan seq_plan;
-    strcopy(seq_plan.table_name, sizeof(seq_plan.table_name), "users");
     seq_plan.table_id = 1;
     seq_plan.where_clause = NULL;
 
-    assert(strcmp(seq_plan.table_name, "users") == 0);
     assert(seq_plan.table_id == 1);
     assert(seq_plan.where_clause == NULL);
 
     IndexScanPlan idx_plan;
-    strcopy(idx_plan.table_name, sizeof(idx_plan.table_name), "orders");
     idx_plan.table_id = 2;
     idx_plan.index = NULL;
     idx_plan.where_clause = NULL;
     idx_plan.op = OP_EQUALS;
     idx_plan.search_key = NULL;
 
-    assert(strcmp(idx_plan.table_name, "orders") == 0);
     assert(idx_plan.table_id == 2);
     assert(idx_plan.op == OP_EQUALS);
 
@@ -76,7 +86,206 @@ void test_plan_node_structures(void) {
     assert(plan.type == PLAN_SEQ_SCAN);
     assert(plan.cost == 100.0);
     assert(plan.estimated_rows == 1000);
-    assert(strcmp(plan.plan.seq_scan.table_name, "users") == 0);
+    assert(plan.plan.seq_scan.table_id == 1);
 
     log_msg(LOG_INFO, "PlanNode structure tests passed");
 }
+
+/* a = i % 100 and b = (i / 100) % 100 are independent; skew is 0 for 90% of the rows and
+   opt is NULL for every 4th row. */
+static void fill_planner_table(void) {
+    char sql[8192];
+    exec("CREATE TABLE planner (id INT, a INT, b INT, skew INT, opt FLOAT);");
+    for (int start = 0; start < OPT_TEST_ROWS; start += 100) {
+        string_format(sql, sizeof(sql), "INSERT INTO planner VALUES ");
+        for (int i = start; i < start + 100; i++) {
+            char row[96];
+            char opt[32];
+            if (i % 4 == 0)
+                string_format(opt, sizeof(opt), "NULL");
+            else
+                string_format(opt, sizeof(opt), "%d.25", i % 50);
+            string_format(row, sizeof(row), "%s(%d, %d, %d, %d, %s)", i == start ? "" : ", ", i,
+                          i % 100, (i / 100) % 100, i % 10 == 0 ? i : 0, opt);
+            str_append(sql, sizeof(sql), row);
+        }
+        str_append(sql, sizeof(sql), ";");
+        exec(sql);
+    }
+}
+
+void test_analyze_statistics(void) {
+    log_msg(LOG_INFO, "Testing ANALYZE statistics...");
+
+    reset_database();
+    fill_planner_table();
+    exec("ANALYZE planner;");
+
+    Table *table = find_table_by_name("planner");
+    TableStats *stats = get_table_stats(table->table_id);
+    assert_ptr_not_null(stats, "ANALYZE should store statistics");
+    assert_int_eq(OPT_TEST_ROWS, (int)stats->total_rows, "Row count");
+    assert_int_eq(5, stats->column_count, "Column count");
+
+    ColumnStats *id = &stats->column_stats[0];
+    assert_float_eq(OPT_TEST_ROWS, id->distinct_count, OPT_TEST_ROWS * 0.05, "NDV of id");
+    assert_int_eq(0, (int)id->min_val.int_val, "Min of id");
+    assert_int_eq(OPT_TEST_ROWS - 1, (int)id->max_val.int_val, "Max of id");
+    assert_int_eq(STATS_HISTOGRAM_BUCKETS + 1, id->histogram_count, "Histogram bounds");
+    assert_float_eq(100, stats->column_stats[1].distinct_count, 3, "NDV of a");
+    assert_int_eq(OPT_TEST_ROWS / 4, (int)stats->column_stats[4].null_count, "NULLs in opt");
+    assert_float_eq(50, stats->distinct_values[4], 2, "NDV of opt");
+
+    Value key = {.type = TYPE_INT, .int_val = 2000};
+    assert_float_eq(0.2, estimate_selectivity(stats, 0, OP_LESS, &key), 0.02, "id < 2000");
+    assert_float_eq(0.8, estimate_selectivity(stats, 0, OP_GREATER_EQUAL, &key), 0.02,
+                    "id >= 2000");
+    Value hi = {.type = TYPE_INT, .int_val = 2500};
+    assert_float_eq(0.05, estimate_range_selectivity(stats, 0, &key, true, &hi, false), 0.01,
+                    "2000 <= id < 2500");
+    Value a_key = {.type = TYPE_INT, .int_val = 42};
+    assert_float_eq(0.01, estimate_selectivity(stats, 1, OP_EQUALS, &a_key), 0.002, "a = 42");
+    Value zero = {.type = TYPE_INT, .int_val = 0};
+    assert_float_eq(0.9, estimate_selectivity(stats, 3, OP_EQUALS, &zero), 0.05,
+                    "Heavy hitter from repeated histogram bounds");
+    Value outside = {.type = TYPE_INT, .int_val = -5};
+    assert_float_eq(0.0, estimate_selectivity(stats, 0, OP_EQUALS, &outside), 0.0001,
+                    "Keys outside [min, max] match nothing");
+    Value f_key = {.type = TYPE_FLOAT, .float_val = 10.25};
+    assert_float_eq(0.75 / 50, estimate_selectivity(stats, 4, OP_EQUALS, &f_key), 0.003,
+                    "Equality scaled by the non-NULL fraction");
+
+    exec("DROP TABLE planner;");
+    assert_true(get_table_stats(table->table_id) == NULL, "DROP TABLE should drop statistics");
+
+    log_msg(LOG_INFO, "ANALYZE statistics tests passed");
+}
+
+static PlanNode *plan_for(const char *where) {
+    char sql[256];
+    string_format(sql, sizeof(sql), "SELECT id FROM planner WHERE %s;", where);
+    Token *tokens = tokenize(sql);
+    ASTNode *ast = parse(tokens);
+    assert_ptr_not_null(ast, "Parsing failed for: %s", sql);
+    PlanNode *plan = optimize_select(ast->select.table_id, ast->select.where_clause);
+    free_ast(ast);
+    free_tokens(tokens);
+    return plan;
+}
+
+static void check_plan(const char *where, PlanType expected, int expected_rows) {
+    PlanNode *plan = plan_for(where);
+    assert_int_eq(expected, plan->type, "Plan type for: %s", where);
+    free_plan(plan);
+
+    char sql[256];
+    string_format(sql, sizeof(sql), "SELECT id FROM planner WHERE %s;", where);
+    QueryResult *result = exec_query(sql);
+    assert_int_eq(expected_rows, alist_length(&result->rows), "Row count for: %s", where);
+}
+
+void test_optimizer_plan_choice(void) {
+    log_msg(LOG_INFO, "Testing cost-based plan choice...");
+
+    reset_database();
+    fill_planner_table();
+    exec("CREATE INDEX idx_planner_id ON planner USING BTREE (id);");
+    exec("CREATE INDEX idx_planner_a ON planner (a);");
+    exec("CREATE INDEX idx_planner_b ON planner (b);");
+    exec("CREATE INDEX idx_planner_skew ON planner (skew);");
+    exec("ANALYZE;");
+
+    check_plan("id < 50", PLAN_INDEX_SCAN, 50);
+    check_plan("id >= 0", PLAN_SEQ_SCAN, OPT_TEST_ROWS);
+    check_plan("id > 100 AND id <= 400", PLAN_INDEX_SCAN, 300);
+    check_plan("a = 5", PLAN_INDEX_SCAN, 100);
+    check_plan("skew = 0", PLAN_SEQ_SCAN, OPT_TEST_ROWS * 9 / 10 + 1);
+    check_plan("skew = 30", PLAN_INDEX_SCAN, 1);
+    check_plan("a = 5 AND b = 7", PLAN_INDEX_INTERSECT, 1);
+    check_plan("b = 7 AND 5 = a AND opt < 1", PLAN_INDEX_INTERSECT, 0);
+    check_plan("a = 5 AND id < 10", PLAN_INDEX_SCAN, 1);
+    check_plan("a = 5 OR b = 7", PLAN_SEQ_SCAN, 199);
+
+    exec("UPDATE planner SET b = 1000 WHERE a = 5 AND b = 7;");
+    check_plan("b = 1000", PLAN_INDEX_SCAN, 1);
+    exec("DELETE FROM planner WHERE a = 5 AND b < 50;");
+    check_plan("a = 5", PLAN_INDEX_SCAN, 51);
+
+    log_msg(LOG_INFO, "Cost-based plan choice tests passed");
+}
+
+static const char *plan_line(const QueryResult *result, int line) {
+    const Value *value = (const Value *)alist_get(&result->values, line);
+    return value ? value_str(value) : "";
+}
+
+static void assert_plan_contains(const QueryResult *result, int line, const char *text) {
+    assert_true(strstr(plan_line(result, line), text) != NULL, "Plan line %d '%s' lacks '%s'",
+                line, plan_line(result, line), text);
+}
+
+void test_explain(void) {
+    log_msg(LOG_INFO, "Testing EXPLAIN and EXPLAIN ANALYZE...");
+
+    reset_database();
+    fill_planner_table();
+    exec("CREATE INDEX idx_planner_a ON planner (a);");
+    exec("CREATE TABLE names (n_a INT PRIMARY KEY, n_name STRING);");
+    exec("INSERT INTO names VALUES (5, 'five'), (6, 'six');");
+    exec("ANALYZE;");
+
+    QueryResult *result = exec_query("EXPLAIN SELECT id FROM planner WHERE a = 5 AND b < 10;");
+    assert_int_eq(1, result->col_count, "EXPLAIN returns one column");
+    assert_str_eq("QUERY PLAN", *(char **)alist_get(&result->column_names, 0), "Column name");
+    assert_int_eq(3, alist_length(&result->rows), "One line per plan node");
+    assert_plan_contains(result, 0, "Project id  (cost=");
+    assert_plan_contains(result, 1, "  -> Filter ((a = 5) AND (b < 10))");
+    assert_plan_contains(result, 2, "    -> Index Scan using idx_planner_a on planner (a = 5)");
+    assert_true(strstr(plan_line(result, 2), "actual") == NULL, "EXPLAIN does not run");
+
+    result = exec_query("EXPLAIN ANALYZE SELECT id, n_name FROM planner JOIN names ON a = n_a "
+                        "WHERE b < 10 ORDER BY id LIMIT 5;");
+    int lines = alist_length(&result->rows);
+    assert_int_eq(7, lines, "Five nodes, the peak memory and the execution time");
+    assert_plan_contains(result, lines - 2, "Peak memory: ");
+    unsigned long long max_alloc = 0;
+    for (int i = 0; i < lines - 2; i++) {
+        const char *alloc = strstr(plan_line(result, i), "alloc=");
+        unsigned long long bytes = alloc ? strtoull(alloc + 6, NULL, 10) : 0;
+        if (bytes > max_alloc)
+            max_alloc = bytes;
+    }
+    unsigned long long peak_kb = strtoull(plan_line(result, lines - 2) + 13, NULL, 10);
+    assert_true(max_alloc > 0, "The operators allocated");
+    assert_true(peak_kb * 1024 >= max_alloc, "Peak memory %llu kB covers alloc=%llu B", peak_kb,
+                max_alloc);
+    assert_plan_contains(result, 0, "Project id, n_name");
+    assert_plan_contains(result, 0, "(actual rows=5 batches=1 time=");
+    assert_plan_contains(result, 1, "-> Limit 5");
+    assert_plan_contains(result, 2, "-> Sort id top 5");
+    assert_plan_contains(result, 3, "-> Index Nested Loop Join (names.n_a = planner.a) using "
+                                    "idx_planner_a filter (b < 10)");
+    assert_plan_contains(result, 3, "actual rows=20 ");
+    assert_plan_contains(result, 3, "index hits=200)");
+    assert_plan_contains(result, 4, "-> Seq Scan on names");
+    assert_plan_contains(result, lines - 1, "Execution time: ");
+
+    result = exec_query("EXPLAIN ANALYZE SELECT COUNT(*) FROM planner WHERE a = 7;");
+    assert_plan_contains(result, 1, "-> Aggregate COUNT(*)");
+    assert_plan_contains(result, 2, "-> Filter (a = 7)");
+    assert_plan_contains(result, 3, "-> Index Scan using idx_planner_a on planner (a = 7)");
+    assert_plan_contains(result, 3, "actual rows=100 batches=1");
+    assert_plan_contains(result, 3, "index hits=100)");
+
+    DbStatement *stmt = db_prepare("EXPLAIN SELECT n_name FROM names;");
+    assert_ptr_not_null(stmt, "EXPLAIN prepares");
+    assert_true(db_step(stmt) == DB_ROW, "EXPLAIN steps through its lines");
+    assert_true(strncmp(value_str(db_column_value(stmt, 0)), "Project n_name  (cost=", 22) == 0,
+                "First line is the root");
+    db_finalize(stmt);
+    Token *tokens = tokenize("EXPLAIN DELETE FROM names;");
+    assert_ptr_null(parse(tokens), "Only a SELECT is explained");
+    free_tokens(tokens);
+
+    log_msg(LOG_INFO, "EXPLAIN tests passed");
+}
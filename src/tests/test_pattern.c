@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+#include "db.h"
+#include "dbapi.h"
+#include "executor.h"
+#include "logger.h"
+#include "table.h"
+#include "test_util.h"
+#include "values.h"
+
+static bool compiled_match(Arena *arena, const char *pattern, const char *text) {
+    LikeMatcher *m = like_compile(arena, pattern);
+    assert_ptr_not_null(m, "'%s' compiles", pattern);
+    return like_match(m, text, strlen(text));
+}
+
+void test_like_matcher(void) {
+    log_msg(LOG_INFO, "Testing compiled LIKE patterns...");
+    Arena *arena = arena_create(ARENA_BLOCK_SIZE);
+
+    struct {
+        const char *pattern;
+        LikeKind kind;
+    } kinds[] = {{"abc", LIKE_EXACT},      {"abc%", LIKE_PREFIX}, {"%abc", LIKE_SUFFIX},
+                 {"%abc%", LIKE_CONTAINS}, {"a%b%c", LIKE_RUNS},  {"%%a%%", LIKE_CONTAINS},
+                 {"a_c%", LIKE_WILDCARD},  {"\\%x%", LIKE_PREFIX}};
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++)
+        assert_int_eq(kinds[i].kind, like_compile(arena, kinds[i].pattern)->kind, "Kind of '%s'",
+                      kinds[i].pattern);
+
+    assert_true(compiled_match(arena, "a%b%c", "axxbyyc"), "Runs in order");
+    assert_false(compiled_match(arena, "a%b%c", "axxcyyb"), "Runs out of order");
+    assert_false(compiled_match(arena, "ab%ba", "aba"), "Anchored runs may not overlap");
+    assert_true(compiled_match(arena, "%a_c", "abcabc"), "Backtracks over an earlier match");
+    assert_true(compiled_match(arena, "%", ""), "% matches the empty string");
+    assert_false(compiled_match(arena, "", "a"), "The empty pattern matches only ''");
+    assert_true(compiled_match(arena, "100\\%", "100%"), "Escaped %");
+    assert_false(compiled_match(arena, "100\\%", "1000"), "Escaped % is literal");
+    assert_true(compiled_match(arena, "a\\_b", "a_b"), "Escaped _");
+    assert_false(compiled_match(arena, "a\\_b", "axb"), "Escaped _ is literal");
+
+    LikeMatcher *prefix = like_compile(arena, "ab\xff%");
+    assert_str_eq("ab\xff", value_str(&prefix->prefix), "Prefix lower bound");
+    assert_str_eq("ac", value_str(prefix->prefix_end), "Upper bound carries past 0xFF");
+
+    /* The compiled and the run-time matcher agree on every pattern and text. */
+    const char *patterns[] = {"%",    "a",    "a%",  "%a",   "%ab%", "a%b",  "_",
+                              "__%", "%_b", "a_%b", "%a%a%", "b%a_", "%b_a%"};
+    const char *texts[] = {"", "a", "b", "ab", "ba", "aab", "abab", "bbab", "abba", "aaaa"};
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        LikeMatcher *m = like_compile(arena, patterns[p]);
+        for (size_t t = 0; t < sizeof(texts) / sizeof(texts[0]); t++) {
+            Value text = make_string_value(texts[t]);
+            assert_int_eq(like_match_pattern(&text, patterns[p]), like_match_value(m, &text),
+                          "'%s' LIKE '%s'", texts[t], patterns[p]);
+            free_value(&text);
+        }
+    }
+    arena_destroy(arena);
+}
+
+static void fill_logs(const char *storage) {
+    char sql[200];
+    snprintf(sql, sizeof(sql), "CREATE TABLE logs (id INT, level STRING, msg STRING)%s;",
+             storage);
+    exec(sql);
+    const char *levels[] = {"debug", "info", "warn", "error"};
+    for (int i = 0; i < 400; i++) {
+        if (i % 50 == 49)
+            snprintf(sql, sizeof(sql), "INSERT INTO logs VALUES (%d, NULL, NULL);", i);
+        else
+            snprintf(sql, sizeof(sql),
+                     "INSERT INTO logs VALUES (%d, '%s', 'request %d took %d ms');", i,
+                     levels[i % 4], i, i % 7);
+        exec(sql);
+    }
+}
+
+static int count_rows(const char *where) {
+    char sql[256];
+    snprintf(sql, sizeof(sql), "SELECT id FROM logs WHERE %s;", where);
+    QueryResult *result = exec_query(sql);
+    return alist_length(&result->rows);
+}
+
+void test_like_queries(void) {
+    log_msg(LOG_INFO, "Testing LIKE and NOT LIKE over row and columnar tables...");
+    const char *storages[] = {"", " STORAGE COLUMNAR"};
+    for (int s = 0; s < 2; s++) {
+        reset_database();
+        fill_logs(storages[s]);
+        assert_int_eq(96, count_rows("level LIKE 'err%'"), "Prefix (%d)", s);
+        assert_int_eq(96, count_rows("level LIKE '%ror'"), "Suffix (%d)", s);
+        assert_int_eq(56, count_rows("msg LIKE '%took 3 ms'"), "Suffix over a longer run");
+        assert_int_eq(10, count_rows("msg LIKE 'request 1_ took%'"), "_ wildcard (%d)", s);
+        assert_int_eq(296, count_rows("level NOT LIKE 'err%'"), "NOT LIKE skips NULLs");
+        assert_int_eq(0, count_rows("level LIKE NULL"), "NULL pattern");
+        assert_int_eq(10, count_rows("id LIKE '1_'"), "Numbers match their printed form");
+
+        QueryResult *result = exec_query("SELECT msg LIKE 'request 1%', level IN ('info', "
+                                         "'warn') FROM logs WHERE id < 3;");
+        assert_int_eq(0, (int)((Value *)alist_get(&result->values, 0))->int_val, "Row 0");
+        assert_int_eq(1, (int)((Value *)alist_get(&result->values, 2))->int_val, "Row 1");
+        assert_int_eq(1, (int)((Value *)alist_get(&result->values, 3))->int_val, "Row 1 IN");
+    }
+
+    /* A prefix pattern becomes a B-tree range; the LIKE still filters the candidates. */
+    exec("CREATE INDEX idx_logs_msg ON logs USING BTREE (msg);");
+    exec("ANALYZE;");
+    Token *tokens = tokenize("SELECT id FROM logs WHERE msg LIKE 'request 12%';");
+    ASTNode *ast = parse(tokens);
+    PlanNode *plan = optimize_select(ast->select.table_id, ast->select.where_clause);
+    assert_int_eq(PLAN_INDEX_SCAN, plan->type, "Prefix LIKE uses the B-tree");
+    free_plan(plan);
+    free_ast(ast);
+    free_tokens(tokens);
+    assert_int_eq(11, count_rows("msg LIKE 'request 12%'"), "request 12 and 120..129");
+    assert_int_eq(1, count_rows("msg LIKE 'request 12 %'"), "Range plus the pattern");
+}
+
+void test_in_lists(void) {
+    log_msg(LOG_INFO, "Testing hashed and linear IN lists...");
+    const char *storages[] = {"", " STORAGE COLUMNAR"};
+    for (int s = 0; s < 2; s++) {
+        reset_database();
+        fill_logs(storages[s]);
+        assert_int_eq(3, count_rows("id IN (1, 2, 3)"), "Short list (%d)", s);
+        assert_int_eq(10, count_rows("id IN (0, 10, 20, 30, 40, 50, 60, 70, 80, 90, 1000)"),
+                      "Hashed int list (%d)", s);
+        assert_int_eq(390, count_rows("id NOT IN (0, 10, 20, 30, 40, 50, 60, 70, 80, 90)"),
+                      "NOT IN");
+        assert_int_eq(0, count_rows("id NOT IN (1, 2, 3, 4, 5, 6, 7, 8, NULL)"),
+                      "NOT IN with a NULL in the list is never true");
+        assert_int_eq(8, count_rows("id IN (1, 2, 3, 4, 5, 6, 7, 8, NULL)"),
+                      "A NULL in the list does not match");
+        assert_int_eq(2, count_rows("id IN (1.0, 2.0, 2.5, 2.6, 2.7, 2.8, 2.9, 3.5)"),
+                      "Float lists compare with ints");
+        assert_int_eq(196, count_rows("level IN ('info', 'warn', 'a', 'b', 'c', 'd', 'e', "
+                                      "'f')"),
+                      "Hashed string list");
+        assert_int_eq(3, count_rows("id IN (1, 2) OR id IN (5)"), "IN under OR");
+        assert_int_eq(2, count_rows("id + 1 IN (2, 3)"), "IN over an expression");
+    }
+
+    Token *tokens = tokenize("SELECT id FROM logs WHERE id IN (1, 2, 3, 4, 5, 6, 7, 8);");
+    ASTNode *ast = parse(tokens);
+    Expr *where = ast->select.where_clause;
+    assert_int_eq(EXPR_LIST, where->binary.right->type, "IN parses into a value list");
+    assert_ptr_not_null((void *)where->binary.right->list.set, "Eight constants are hashed");
+    free_ast(ast);
+    free_tokens(tokens);
+
+    /* Parameters are bound into the list in place, so it is searched value by value. */
+    DbStatement *stmt = db_prepare("SELECT id FROM logs WHERE id IN (?, 5, 6, 7, 8, 9, 10, ?);");
+    assert_int_eq(2, db_bind_count(stmt), "Parameters inside IN");
+    db_bind_int(stmt, 1, 100);
+    db_bind_int(stmt, 2, 200);
+    int rows = 0;
+    while (db_step(stmt) == DB_ROW)
+        rows++;
+    assert_int_eq(8, rows, "Bound list values");
+    db_finalize(stmt);
+
+    tokens = tokenize("SELECT id FROM logs WHERE id IN (SELECT id, msg FROM logs);");
+    assert_ptr_null(parse(tokens), "IN subqueries return one column");
+    free_tokens(tokens);
+    tokens = tokenize("DELETE FROM logs WHERE id IN (SELECT id, msg FROM logs);");
+    assert_ptr_null(parse(tokens), "A WHERE that does not parse fails the DELETE");
+    free_tokens(tokens);
+}
@@ -4,6 +4,7 @@
 #include "db.h"
 #include "logger.h"
 #include "test_util.h"
+#include "values.h"
 
 void test_string_functions(void) {
     log_msg(LOG_INFO, "Testing string scalar functions...");
@@ -164,7 +165,7 @@ void test_coalesce_function(void) {
     assert(result1.int_val == 42);
 
     assert(result2.type == TYPE_STRING);
-    assert(strcmp(result2.char_val, "hello") == 0);
+    assert(strcmp(value_str(&result2), "hello") == 0);
 
     assert(result3.type == TYPE_NULL);
 
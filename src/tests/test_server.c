@@ -0,0 +1,273 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "dbapi.h"
+#include "logger.h"
+#include "server.h"
+#include "test_util.h"
+
+typedef struct {
+    uint8_t type;
+    uint8_t *payload;
+    uint32_t len;
+} Frame;
+
+static void *run_server(void *arg) {
+    server_run(arg);
+    return NULL;
+}
+
+static int client_connect(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert_true(fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0,
+                "Client connects");
+    return fd;
+}
+
+static void send_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        assert_true(n > 0, "Client sends");
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static bool recv_all(int fd, uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(fd, data, len, 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/* Appends a QUERY frame to buf at *len. */
+static void add_query(uint8_t *buf, size_t *len, const char *sql) {
+    uint32_t size = (uint32_t)strlen(sql) + 1;
+    for (int i = 0; i < 4; i++)
+        buf[*len + (size_t)i] = (uint8_t)(size >> (8 * i));
+    buf[*len + 4] = SERVER_MSG_QUERY;
+    memcpy(buf + *len + SERVER_FRAME_HEADER, sql, size - 1);
+    *len += 4 + size;
+}
+
+static void send_query(int fd, const char *sql) {
+    uint8_t buf[512];
+    size_t len = 0;
+    add_query(buf, &len, sql);
+    send_all(fd, buf, len);
+}
+
+static Frame read_frame(int fd) {
+    uint8_t header[SERVER_FRAME_HEADER];
+    Frame frame = {0};
+    assert_true(recv_all(fd, header, sizeof(header)), "Server answers");
+    uint32_t len = (uint32_t)header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 |
+                   (uint32_t)header[3] << 24;
+    frame.type = header[4];
+    frame.len = len - 1;
+    frame.payload = malloc(frame.len + 1);
+    assert_true(recv_all(fd, frame.payload, frame.len), "Whole response");
+    return frame;
+}
+
+static uint16_t u16_at(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t u32_at(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* The row count of a RESULT frame; *first gets the first value when it is an INT. */
+static int result_rows(const Frame *frame, long long *first) {
+    assert_int_eq(SERVER_MSG_RESULT, frame->type, "RESULT frame");
+    const uint8_t *p = frame->payload;
+    int cols = u16_at(p);
+    p += 2;
+    for (int i = 0; i < cols; i++)
+        p += 2 + u16_at(p);
+    uint32_t rows = u32_at(p);
+    p += 4;
+    if (first && rows > 0 && p[0] == TYPE_INT) {
+        uint64_t v = 0;
+        for (int i = 0; i < 8; i++)
+            v |= (uint64_t)p[1 + i] << (8 * i);
+        *first = (long long)v;
+    }
+    return (int)rows;
+}
+
+static long long query_int(int fd, const char *sql) {
+    send_query(fd, sql);
+    Frame frame = read_frame(fd);
+    long long value = -1;
+    assert_int_eq(1, result_rows(&frame, &value), "One row from: %s", sql);
+    free(frame.payload);
+    return value;
+}
+
+static void expect_result(int fd, const char *sql) {
+    send_query(fd, sql);
+    Frame frame = read_frame(fd);
+    assert_int_eq(SERVER_MSG_RESULT, frame.type, "Statement succeeds: %s", sql);
+    free(frame.payload);
+}
+
+void test_server_pipelining(void) {
+    log_msg(LOG_INFO, "Testing pipelined requests over the server protocol...");
+
+    reset_database();
+    Server *server = server_open("127.0.0.1:0", 2);
+    assert_ptr_not_null(server, "Server listens");
+    pthread_t loop;
+    pthread_create(&loop, NULL, run_server, server);
+    int fd = client_connect(server_port(server));
+
+    /* Five requests in one write; five responses, in order. */
+    uint8_t buf[1024];
+    size_t len = 0;
+    add_query(buf, &len, "CREATE TABLE wire (id INT, name STRING);");
+    add_query(buf, &len, "INSERT INTO wire VALUES (1, 'one'), (2, 'two'), (3, 'three');");
+    add_query(buf, &len, "SELECT id, name FROM wire WHERE id > 1 ORDER BY id;");
+    add_query(buf, &len, "SELEKT nothing;");
+    add_query(buf, &len, "SELECT COUNT(*) FROM wire;");
+    send_all(fd, buf, len);
+
+    Frame frames[5];
+    for (int i = 0; i < 5; i++)
+        frames[i] = read_frame(fd);
+    assert_int_eq(SERVER_MSG_RESULT, frames[0].type, "CREATE answered");
+    assert_int_eq(SERVER_MSG_RESULT, frames[1].type, "INSERT answered");
+    long long first = 0;
+    assert_int_eq(2, result_rows(&frames[2], &first), "Two rows selected");
+    assert_true(first == 2, "Rows come in order");
+    const uint8_t *p = frames[2].payload;
+    assert_int_eq(2, u16_at(p), "Two columns");
+    assert_int_eq(2, u16_at(p + 2), "First column name length");
+    assert_true(memcmp(p + 4, "id", 2) == 0, "First column name");
+    assert_int_eq(SERVER_MSG_ERROR, frames[3].type, "A bad statement gets an ERROR");
+    long long count = 0;
+    assert_int_eq(1, result_rows(&frames[4], &count), "The connection goes on after an error");
+    assert_true(count == 3, "COUNT(*) over the wire");
+    for (int i = 0; i < 5; i++)
+        free(frames[i].payload);
+
+    /* A statement that fails while it runs is answered with an ERROR too. */
+    expect_result(fd, "CREATE TABLE keyed (id INT PRIMARY KEY);");
+    expect_result(fd, "INSERT INTO keyed VALUES (1);");
+    send_query(fd, "INSERT INTO keyed VALUES (1);");
+    Frame dup = read_frame(fd);
+    assert_int_eq(SERVER_MSG_ERROR, dup.type, "A duplicate key is an ERROR");
+    free(dup.payload);
+
+    /* A request of several statements gets one RESULT holding a result set for each. */
+    send_query(fd, "INSERT INTO keyed VALUES (2); SELECT COUNT(*) FROM keyed;");
+    Frame sets = read_frame(fd);
+    assert_int_eq(SERVER_MSG_RESULT, sets.type, "Both statements answered");
+    assert_true(u16_at(sets.payload) == 0 && u32_at(sets.payload + 2) == 0,
+                "The INSERT's result set is empty");
+    Frame second = {.type = SERVER_MSG_RESULT, .payload = sets.payload + 6};
+    count = 0;
+    assert_int_eq(1, result_rows(&second, &count), "Then the SELECT's");
+    assert_true(count == 2, "The SELECT ran after the INSERT");
+    free(sets.payload);
+    send_query(fd, "INSERT INTO keyed VALUES (3); INSERT INTO keyed VALUES (3); "
+                   "INSERT INTO keyed VALUES (4);");
+    Frame failed = read_frame(fd);
+    assert_int_eq(SERVER_MSG_ERROR, failed.type, "A failing statement fails the request");
+    assert_true(failed.len > 11 && memcmp(failed.payload, "Statement 2", 11) == 0,
+                "The error names the statement");
+    free(failed.payload);
+    assert_true(query_int(fd, "SELECT COUNT(*) FROM keyed;") == 3,
+                "Statements before the failure stay, the ones after do not run");
+
+    /* An oversized frame is refused and the connection closed. */
+    uint8_t huge[SERVER_FRAME_HEADER] = {0xff, 0xff, 0xff, 0x7f, SERVER_MSG_QUERY};
+    send_all(fd, huge, sizeof(huge));
+    Frame refused = read_frame(fd);
+    assert_int_eq(SERVER_MSG_ERROR, refused.type, "Oversized frame refused");
+    free(refused.payload);
+    uint8_t byte;
+    assert_false(recv_all(fd, &byte, 1), "Then the connection closes");
+    close(fd);
+
+    ServerStats stats;
+    server_get_stats(server, &stats);
+    assert_int_eq(1, (int)stats.connections, "One connection accepted");
+    assert_int_eq(11, (int)stats.requests, "Every request answered");
+    assert_true(stats.batches >= 7 && stats.batches <= 12, "Pipelined requests share batches");
+    assert_true(stats.bytes_in > 0 && stats.bytes_out > 0, "Bytes counted");
+
+    server_stop(server);
+    pthread_join(loop, NULL);
+    server_close(server);
+    db_set_print_results(true);
+
+    log_msg(LOG_INFO, "Server pipelining tests passed");
+}
+
+void test_server_sessions(void) {
+    log_msg(LOG_INFO, "Testing server sessions and their transactions...");
+
+    reset_database();
+    Server *server = server_open("127.0.0.1:0", 3);
+    assert_ptr_not_null(server, "Server listens");
+    pthread_t loop;
+    pthread_create(&loop, NULL, run_server, server);
+    int port = server_port(server);
+    int a = client_connect(port);
+    int b = client_connect(port);
+
+    expect_result(a, "CREATE TABLE sessions (id INT);");
+    expect_result(a, "INSERT INTO sessions VALUES (1);");
+
+    /* Each connection keeps its own transaction between requests. */
+    expect_result(b, "BEGIN;");
+    expect_result(b, "INSERT INTO sessions VALUES (2);");
+    assert_true(query_int(b, "SELECT COUNT(*) FROM sessions;") == 2, "B sees its insert");
+    assert_true(query_int(a, "SELECT COUNT(*) FROM sessions;") == 1, "A does not see it yet");
+    expect_result(b, "COMMIT;");
+    assert_true(query_int(a, "SELECT COUNT(*) FROM sessions;") == 2, "A sees it once committed");
+
+    /* Closing a connection rolls back what it left open. */
+    expect_result(b, "BEGIN;");
+    expect_result(b, "INSERT INTO sessions VALUES (3);");
+    close(b);
+    struct timespec pause = {0, 1000000};
+    for (int i = 0; i < 2000; i++) {
+        ServerStats stats;
+        server_get_stats(server, &stats);
+        if (stats.open == 1)
+            break;
+        nanosleep(&pause, NULL);
+    }
+    assert_true(query_int(a, "SELECT COUNT(*) FROM sessions;") == 2, "Insert rolled back");
+    expect_result(a, "INSERT INTO sessions VALUES (4);");
+    assert_true(query_int(a, "SELECT COUNT(*) FROM sessions;") == 3, "The writer is free again");
+    close(a);
+
+    server_stop(server);
+    pthread_join(loop, NULL);
+    server_close(server);
+    db_set_print_results(true);
+
+    log_msg(LOG_INFO, "Server session tests passed");
+}
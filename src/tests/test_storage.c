@@ -0,0 +1,427 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "logger.h"
+#include "storage.h"
+#include "table.h"
+#include "test_util.h"
+#include "values.h"
+
+static char g_dir[64];
+
+static void make_storage_dir(void) {
+    strcpy(g_dir, "/tmp/db_storage_XXXXXX");
+    assert_true(mkdtemp(g_dir) != NULL, "Failed to create a temporary data directory");
+}
+
+static void remove_storage_dir(void) {
+    const char *files[] = {STORAGE_SNAPSHOT_FILE, STORAGE_WAL_FILE, STORAGE_SNAPSHOT_FILE ".tmp"};
+    char path[128];
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", g_dir, files[i]);
+        unlink(path);
+    }
+    rmdir(g_dir);
+}
+
+static long file_size(const char *file) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", g_dir, file);
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+/* Drops the in-memory catalog and loads it back, as a restart would. */
+static void reopen_storage(bool checkpoint) {
+    storage_close(checkpoint);
+    reset_database();
+    assert_true(storage_open(g_dir), "Reopening the data directory should succeed");
+}
+
+void test_storage_recovery(void) {
+    log_msg(LOG_INFO, "Testing write-ahead log recovery and snapshots...");
+    reset_database();
+    make_storage_dir();
+    assert_true(storage_open(g_dir), "Opening an empty data directory should succeed");
+    storage_set_group_commit(WAL_GROUP_COMMIT_MAX, 1000000000);
+
+    exec("CREATE TABLE users (id INT PRIMARY KEY, name STRING, city STRING DICTIONARY, "
+         "score FLOAT, born DATE);");
+    exec("CREATE TABLE events (user_id INT REFERENCES users(id), kind STRING) "
+         "STORAGE COLUMNAR;");
+    exec("INSERT INTO users VALUES (1, 'ann', 'oslo', 1.5, '1990-01-02'), "
+         "(2, 'a name long enough for the heap', 'rome', NULL, NULL), "
+         "(3, 'cid', 'oslo', 3.25, '2001-12-31');");
+    exec("INSERT INTO events VALUES (1, 'login'), (3, 'logout'), (1, 'click');");
+    exec("CREATE INDEX idx_users_name ON users USING BTREE (name);");
+    exec("UPDATE users SET score = 9.5 WHERE id = 2;");
+    exec("DELETE FROM users WHERE id = 3;");
+    exec("INSERT INTO users VALUES (4, 'dan', 'bern', 0.5, NULL);");
+    exec("CREATE TABLE scratch (x INT);");
+    exec("DROP TABLE scratch;");
+
+    StorageStats stats;
+    storage_get_stats(&stats);
+    assert_true(stats.commits >= 10, "Every changing statement should write a log frame");
+    assert_true(stats.syncs < stats.commits, "Log fsyncs should be shared between statements");
+
+    log_msg(LOG_INFO, "Testing recovery from the log alone...");
+    reopen_storage(false);
+    storage_get_stats(&stats);
+    assert_true(stats.replayed >= 10, "Recovery should replay the log");
+    Table *users = find_table_by_name("users");
+    assert_ptr_not_null(users, "users should be recovered");
+    assert_true(find_table_by_name("scratch") == NULL, "A dropped table should stay dropped");
+    assert_int_eq(3, table_row_count(users), "users should have 3 rows after recovery");
+    QueryResult *result = exec_query("SELECT name, score FROM users WHERE id = 2;");
+    assert_int_eq(1, alist_length(&result->rows), "Row 2 should be recovered");
+    assert_str_eq("a name long enough for the heap",
+                  ((Value *)alist_get(&result->values, 0))->char_val,
+                  "Long strings should be recovered");
+    assert_float_eq(9.5, ((Value *)alist_get(&result->values, 1))->float_val, 0.001,
+                    "The UPDATE should be replayed");
+    result = exec_query("SELECT id FROM users WHERE id = 3;");
+    assert_int_eq(0, alist_length(&result->rows), "The DELETE should be replayed");
+    assert_ptr_not_null(find_index("idx_users_name"), "CREATE INDEX should be replayed");
+    assert_ptr_not_null(find_index("pk_users_id"), "Constraint indexes should be rebuilt");
+    assert_int_eq(VALUE_STR_INTERNED, table_get_value(users, 0, 2).str_format,
+                  "DICTIONARY columns should be interned again");
+    result = exec_query("SELECT kind FROM events WHERE user_id = 1;");
+    assert_int_eq(2, alist_length(&result->rows), "Columnar rows should be recovered");
+
+    exec("INSERT INTO users VALUES (4, 'dup', 'oslo', 1.0, NULL);");
+    assert_int_eq(3, table_row_count(users), "Recovered indexes should enforce keys");
+
+    log_msg(LOG_INFO, "Testing checkpoints...");
+    assert_true(storage_checkpoint(), "Checkpoint should succeed");
+    assert_true(file_size(STORAGE_WAL_FILE) < 64, "A checkpoint should truncate the log");
+    assert_true(file_size(STORAGE_SNAPSHOT_FILE) % STORAGE_PAGE_SIZE == 0,
+                "The snapshot should be a whole number of pages");
+    exec("INSERT INTO users VALUES (5, 'eve', 'rome', 2.0, NULL);");
+    reopen_storage(false);
+    storage_get_stats(&stats);
+    assert_int_eq(1, (int)stats.replayed, "Only the frame after the checkpoint is replayed");
+    users = find_table_by_name("users");
+    assert_int_eq(4, table_row_count(users), "Snapshot plus log should hold every row");
+    result = exec_query("SELECT name FROM users WHERE name = 'dan';");
+    assert_int_eq(1, alist_length(&result->rows), "Snapshot rows should be queryable");
+
+    log_msg(LOG_INFO, "Testing a torn log tail...");
+    exec("INSERT INTO users VALUES (6, 'fay', 'oslo', 4.0, NULL);");
+    storage_close(false);
+    long intact = file_size(STORAGE_WAL_FILE);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", g_dir, STORAGE_WAL_FILE);
+    FILE *wal = fopen(path, "ab");
+    assert_ptr_not_null(wal, "The log should be writable");
+    fwrite("\x40\x00\x00\x00garbage", 1, 11, wal);
+    fclose(wal);
+    reset_database();
+    assert_true(storage_open(g_dir), "A torn tail should not prevent recovery");
+    assert_int_eq(5, table_row_count(find_table_by_name("users")),
+                  "Frames before the torn tail should be applied");
+    assert_true(file_size(STORAGE_WAL_FILE) == intact, "The torn tail should be truncated");
+
+    storage_set_group_commit(WAL_GROUP_COMMIT_MAX, WAL_GROUP_COMMIT_USEC);
+    storage_close(true);
+    reset_database();
+    remove_storage_dir();
+}
+
+void test_storage_group_commit(void) {
+    log_msg(LOG_INFO, "Testing group commit...");
+    reset_database();
+    make_storage_dir();
+    assert_true(storage_open(g_dir), "Opening the data directory should succeed");
+    storage_set_group_commit(8, 1000000000);
+
+    exec("CREATE TABLE log (n INT, msg STRING);");
+    StorageStats before;
+    storage_get_stats(&before);
+    for (int i = 0; i < 64; i++) {
+        char sql[96];
+        snprintf(sql, sizeof(sql), "INSERT INTO log VALUES (%d, 'message %d');", i, i);
+        exec(sql);
+    }
+    exec("SELECT * FROM log;");
+    StorageStats after;
+    storage_get_stats(&after);
+    assert_int_eq(64, (int)(after.commits - before.commits),
+                  "Each INSERT should commit once and SELECT should not write");
+    assert_int_eq(8, (int)(after.syncs - before.syncs), "64 commits should share 8 fsyncs");
+
+    /* A group that never fills is synced by the flusher once the interval passes. */
+    storage_set_group_commit(8, 2000);
+    exec("INSERT INTO log VALUES (100, 'alone');");
+    StorageStats idle = after;
+    for (int i = 0; i < 500 && (idle.syncs == after.syncs || idle.unsynced > 0); i++) {
+        struct timespec pause = {0, 2000000};
+        nanosleep(&pause, NULL);
+        storage_get_stats(&idle);
+    }
+    /* The statement thread may sync the frame itself if the interval ran out first. */
+    assert_true(idle.syncs > after.syncs, "An idle log is synced by the flusher");
+    assert_int_eq(0, (int)idle.unsynced, "Every frame is synced");
+
+    storage_set_group_commit(8, 1000000000);
+    exec("BEGIN;");
+    exec("INSERT INTO log VALUES (101, 'in a transaction');");
+    exec("COMMIT;");
+    storage_get_stats(&after);
+    assert_int_eq(1, (int)(after.syncs - idle.syncs), "An explicit COMMIT syncs its frame");
+
+    storage_set_group_commit(1, 0);
+    exec("INSERT INTO log VALUES (64, 'synchronous');");
+    storage_get_stats(&before);
+    assert_int_eq(1, (int)(before.syncs - after.syncs), "A group of one syncs every commit");
+
+    reopen_storage(true);
+    assert_int_eq(67, table_row_count(find_table_by_name("log")),
+                  "Every committed row should survive a restart");
+    storage_set_group_commit(WAL_GROUP_COMMIT_MAX, WAL_GROUP_COMMIT_USEC);
+    storage_close(true);
+    reset_database();
+    remove_storage_dir();
+}
+
+void test_storage_mapped_snapshot(void) {
+    log_msg(LOG_INFO, "Testing mapped snapshot segments...");
+    reset_database();
+    make_storage_dir();
+    assert_true(storage_open(g_dir), "Opening the data directory should succeed");
+    storage_set_group_commit(WAL_GROUP_COMMIT_MAX, 1000000000);
+
+    exec("CREATE TABLE metrics (id INT PRIMARY KEY, host STRING, load FLOAT, ok BOOLEAN) "
+         "STORAGE COLUMNAR;");
+    exec("CREATE TABLE notes (id INT, body STRING);");
+    for (int i = 0; i < 200; i++) {
+        char sql[128];
+        snprintf(sql, sizeof(sql), "INSERT INTO metrics VALUES (%d, 'host-%d', %d.5, %s);", i,
+                 i % 7, i, i % 2 ? "TRUE" : "NULL");
+        exec(sql);
+    }
+    exec("INSERT INTO notes VALUES (1, 'row tables are decoded from the mapping');");
+    exec("CREATE INDEX idx_metrics_host ON metrics (host);");
+    reopen_storage(true);
+
+    StorageStats stats;
+    storage_get_stats(&stats);
+    Table *metrics = find_table_by_name("metrics");
+    assert_ptr_not_null(metrics, "metrics should be loaded");
+    assert_int_eq(200, table_row_count(metrics), "Every mapped row should be visible");
+    assert_true(metrics->vectors[0].map != NULL && metrics->vectors[1].map != NULL,
+                "Columnar vectors should point into the snapshot");
+    assert_true(find_index("pk_metrics_id")->data.hash.map != NULL,
+                "Integer hash indexes should be mapped");
+    assert_true(find_index("idx_metrics_host")->data.hash.map != NULL,
+                "Hash indexes on short strings should be mapped");
+    assert_int_eq(6, (int)stats.mapped, "Four vectors and two indexes should be mapped");
+    assert_int_eq(0, (int)stats.replayed, "A clean shutdown leaves nothing to replay");
+
+    QueryResult *result = exec_query("SELECT host, load FROM metrics WHERE id = 42;");
+    assert_int_eq(1, alist_length(&result->rows), "Mapped index lookups should find the row");
+    assert_str_eq("host-0", ((Value *)alist_get(&result->values, 0))->char_val,
+                  "Mapped strings should read back");
+    assert_float_eq(42.5, ((Value *)alist_get(&result->values, 1))->float_val, 0.001,
+                    "Mapped floats should read back");
+    result = exec_query("SELECT id FROM metrics WHERE host = 'host-3';");
+    assert_int_eq(29, alist_length(&result->rows), "Mapped string indexes should match");
+    result = exec_query("SELECT id FROM metrics WHERE ok IS NULL;");
+    assert_int_eq(100, alist_length(&result->rows), "Mapped null bits should read back");
+    result = exec_query("SELECT body FROM notes;");
+    assert_int_eq(1, alist_length(&result->rows), "Row tables should load alongside segments");
+
+    log_msg(LOG_INFO, "Testing changes to mapped data...");
+    exec("UPDATE metrics SET load = 0.25 WHERE id = 7;");
+    exec("UPDATE metrics SET host = 'renamed host name' WHERE id = 8;");
+    assert_true(find_index("idx_metrics_host")->data.hash.map == NULL,
+                "A key the index owns moves a mapped index to the heap");
+    exec("INSERT INTO metrics VALUES (200, 'host-new', 1.0, TRUE);");
+    exec("INSERT INTO metrics VALUES (5, 'duplicate', 1.0, TRUE);");
+    exec("DELETE FROM metrics WHERE id < 5;");
+    assert_int_eq(196, table_live_row_count(metrics), "Mapped tables should take writes");
+    assert_true(metrics->vectors[0].map == NULL, "Appending should move a vector to the heap");
+    result = exec_query("SELECT load FROM metrics WHERE id = 7;");
+    assert_float_eq(0.25, ((Value *)alist_get(&result->values, 0))->float_val, 0.001,
+                    "Updates in place should be visible");
+    result = exec_query("SELECT id FROM metrics WHERE host = 'renamed host name';");
+    assert_int_eq(1, alist_length(&result->rows), "A longer string should be stored");
+
+    log_msg(LOG_INFO, "Testing a second checkpoint of mapped data...");
+    reopen_storage(true);
+    metrics = find_table_by_name("metrics");
+    assert_int_eq(196, table_row_count(metrics), "Rewritten snapshot should keep every row");
+    result = exec_query("SELECT id FROM metrics WHERE id = 200;");
+    assert_int_eq(1, alist_length(&result->rows), "Rows added after mapping should persist");
+    result = exec_query("SELECT load FROM metrics WHERE id = 7;");
+    assert_float_eq(0.25, ((Value *)alist_get(&result->values, 0))->float_val, 0.001,
+                    "Updates to mapped pages should persist");
+    exec("INSERT INTO metrics VALUES (200, 'again', 1.0, TRUE);");
+    assert_int_eq(196, table_row_count(metrics), "Mapped primary keys should be enforced");
+
+    storage_set_group_commit(WAL_GROUP_COMMIT_MAX, WAL_GROUP_COMMIT_USEC);
+    storage_close(true);
+    reset_database();
+    remove_storage_dir();
+}
+
+void test_storage_deleted_rows(void) {
+    log_msg(LOG_INFO, "Testing recovery of rows deleted in place...");
+    reset_database();
+    make_storage_dir();
+    assert_true(storage_open(g_dir), "Opening an empty data directory should succeed");
+    storage_set_group_commit(WAL_GROUP_COMMIT_MAX, 1000000000);
+
+    exec("CREATE TABLE stock (id INT PRIMARY KEY, qty INT);");
+    char sql[64];
+    for (int i = 0; i < 40; i++) {
+        snprintf(sql, sizeof(sql), "INSERT INTO stock VALUES (%d, %d);", i, i);
+        exec(sql);
+    }
+    exec("DELETE FROM stock WHERE id < 3;");
+    exec("UPDATE stock SET qty = 100 WHERE id = 20;");
+    exec("DELETE FROM stock WHERE id = 30;");
+
+    reopen_storage(false);
+    Table *stock = find_table_by_name("stock");
+    assert_int_eq(40, table_row_count(stock), "Replay leaves the deleted rows in place");
+    assert_int_eq(36, table_live_row_count(stock), "Replay marks the same rows");
+    QueryResult *result = exec_query("SELECT qty FROM stock WHERE id = 20;");
+    assert_int_eq(100, (int)((Value *)alist_get(&result->values, 0))->int_val,
+                  "An update after a delete replays onto the same row");
+
+    /* The replayed delete compacts where the original did, so later records still apply. */
+    exec("DELETE FROM stock WHERE id < 10;");
+    exec("UPDATE stock SET qty = 200 WHERE id = 39;");
+    reopen_storage(false);
+    stock = find_table_by_name("stock");
+    assert_int_eq(29, table_row_count(stock), "The threshold compaction replays");
+    result = exec_query("SELECT qty FROM stock WHERE id = 39;");
+    assert_int_eq(200, (int)((Value *)alist_get(&result->values, 0))->int_val,
+                  "Rows numbered after the compaction replay");
+
+    exec("DELETE FROM stock WHERE id = 15;");
+    assert_true(storage_checkpoint(), "Checkpoint should succeed");
+    assert_int_eq(28, table_row_count(stock), "A checkpoint compacts deleted rows");
+    exec("UPDATE stock SET qty = 300 WHERE id = 16;");
+    reopen_storage(false);
+    stock = find_table_by_name("stock");
+    assert_int_eq(28, table_row_count(stock), "The snapshot has no deleted rows");
+    result = exec_query("SELECT qty FROM stock WHERE id = 16;");
+    assert_int_eq(300, (int)((Value *)alist_get(&result->values, 0))->int_val,
+                  "The log after the checkpoint numbers rows as the snapshot does");
+
+    /* A failed COPY logs its rows, then their delete; replay ends without them. */
+    char path[128];
+    snprintf(path, sizeof(path), "%s/load.csv", g_dir);
+    FILE *file = fopen(path, "w");
+    assert_ptr_not_null(file, "Cannot create %s", path);
+    fputs("40,1\n41,1\n16,1\n", file);
+    fclose(file);
+    char copy[192];
+    snprintf(copy, sizeof(copy), "COPY stock FROM '%s';", path);
+    exec(copy);
+    unlink(path);
+    assert_int_eq(28, table_live_row_count(stock), "The failed COPY added no rows");
+    reopen_storage(false);
+    stock = find_table_by_name("stock");
+    assert_int_eq(28, table_live_row_count(stock), "Nor does its replay");
+    assert_int_eq(0, alist_length(&exec_query("SELECT id FROM stock WHERE id >= 40;")->rows),
+                  "The loaded rows stay deleted");
+
+    storage_set_group_commit(WAL_GROUP_COMMIT_MAX, WAL_GROUP_COMMIT_USEC);
+    storage_close(true);
+    reset_database();
+    remove_storage_dir();
+}
+
+void test_storage_wide_table_ids(void) {
+    log_msg(LOG_INFO, "Testing table ids past one byte in snapshots and the log...");
+    reset_database();
+    make_storage_dir();
+    assert_true(storage_open(g_dir), "Opening the data directory should succeed");
+
+    char sql[128];
+    for (int i = 0; i < 260; i++) {
+        snprintf(sql, sizeof(sql), "CREATE TABLE t_%d (id INT PRIMARY KEY, v STRING);", i);
+        exec(sql);
+    }
+    exec("INSERT INTO t_259 VALUES (1, 'kept in the snapshot');");
+    exec("INSERT INTO t_3 VALUES (1, 'not t_259');");
+    reopen_storage(true);
+    Table *table = find_table_by_name("t_259");
+    assert_ptr_not_null(table, "The table is restored");
+    assert_int_eq(260, table->table_id, "With its id");
+    assert_int_eq(1, table_row_count(table), "And its rows");
+    assert_ptr_not_null(find_index_by_table_column(260, 0), "And its key index");
+
+    exec("INSERT INTO t_259 VALUES (2, 'kept in the log');");
+    exec("UPDATE t_259 SET v = 'updated' WHERE id = 1;");
+    exec("DROP TABLE t_258;");
+    reopen_storage(false);
+    table = find_table_by_name("t_259");
+    assert_int_eq(2, table_row_count(table), "Logged rows replay into the right table");
+    QueryResult *result = exec_query("SELECT v FROM t_259 WHERE id = 1;");
+    assert_int_eq(1, alist_length(&result->rows), "Key lookup after replay");
+    assert_str_eq("updated", value_str((Value *)alist_get(&result->values, 0)),
+                  "Logged updates replay into the right table");
+    assert_true(find_table_by_name("t_258") == NULL, "Logged drops replay");
+    assert_int_eq(1, table_row_count(find_table_by_name("t_3")), "Other tables untouched");
+
+    storage_close(false);
+    reset_database();
+    remove_storage_dir();
+    log_msg(LOG_INFO, "Wide table id storage tests passed");
+}
+
+void test_storage_composite_indexes(void) {
+    log_msg(LOG_INFO, "Testing composite and covering indexes across restarts...");
+    reset_database();
+    make_storage_dir();
+    assert_true(storage_open(g_dir), "Opening the data directory should succeed");
+
+    exec("CREATE TABLE visits (site INT, day INT, hits INT);");
+    char sql[128];
+    for (int i = 0; i < 300; i++) {
+        snprintf(sql, sizeof(sql), "INSERT INTO visits VALUES (%d, %d, %d);", i % 3, i, i * 2);
+        exec(sql);
+    }
+    exec("CREATE INDEX idx_visits_sd ON visits USING BTREE (site, day) INCLUDE (hits);");
+    exec("CREATE INDEX idx_visits_hash ON visits USING HASH (site, hits);");
+    reopen_storage(true);
+
+    Index *index = find_index("idx_visits_sd");
+    assert_ptr_not_null(index, "The composite index is restored");
+    assert_int_eq(2, index->key_count, "With its key columns");
+    assert_int_eq(3, alist_length(&index->columns), "And its included column");
+    assert_int_eq(2, find_index("idx_visits_hash")->key_count, "Hash key columns restored");
+    QueryResult *result = exec_query("SELECT day, hits FROM visits WHERE site = 1 AND day < 30;");
+    assert_int_eq(10, alist_length(&result->rows), "Prefix and range after a checkpoint");
+    assert_int_eq(2, (int)((Value *)alist_get(&result->values, 1))->int_val,
+                  "Included values read back");
+    result = exec_query("SELECT day FROM visits WHERE hits = 20 AND site = 1;");
+    assert_int_eq(1, alist_length(&result->rows), "Composite hash probe after a checkpoint");
+
+    exec("UPDATE visits SET hits = 5 WHERE day = 1;");
+    exec("CREATE INDEX idx_visits_day ON visits (day) USING BTREE INCLUDE (site);");
+    reopen_storage(false);
+    assert_int_eq(1, find_index("idx_visits_day")->key_count, "Logged key count replays");
+    result = exec_query("SELECT hits FROM visits WHERE site = 1 AND day = 1;");
+    assert_int_eq(5, (int)((Value *)alist_get(&result->values, 0))->int_val,
+                  "Logged updates reach the replayed index");
+    result = exec_query("SELECT day FROM visits WHERE hits = 5 AND site = 1;");
+    assert_int_eq(1, alist_length(&result->rows), "And the hash index");
+
+    storage_close(false);
+    reset_database();
+    remove_storage_dir();
+    log_msg(LOG_INFO, "Composite index storage tests passed");
+}
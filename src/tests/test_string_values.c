@@ -0,0 +1,101 @@
+#include <string.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "logger.h"
+#include "table.h"
+#include "test_util.h"
+#include "values.h"
+
+void test_inline_strings(void) {
+    log_msg(LOG_INFO, "Testing inline small strings...");
+    Value small = make_string_value("fifteen chars!!");
+    assert_int_eq(VALUE_STR_INLINE, small.str_format, "15 characters should be stored inline");
+    assert_str_eq("fifteen chars!!", value_str(&small), "Inline string should round-trip");
+
+    Value large = make_string_value("sixteen chars!!!");
+    assert_int_eq(VALUE_STR_PTR, large.str_format, "16 characters should go to the heap");
+    assert_str_eq("sixteen chars!!!", value_str(&large), "Heap string should round-trip");
+
+    Value copy = copy_value(&small);
+    assert_true(value_equals(&small, &copy), "A copied inline string should be equal");
+    assert_true(value_hash(&small) != value_hash(&large),
+                "Different strings should hash differently");
+    Value heap_small = {0};
+    heap_small.type = TYPE_STRING;
+    heap_small.char_val = "fifteen chars!!";
+    assert_true(value_equals(&small, &heap_small), "Inline and heap strings should compare equal");
+    assert_true(value_hash(&small) == value_hash(&heap_small),
+                "Inline and heap strings should hash equally");
+    free_value(&small);
+    free_value(&large);
+    free_value(&copy);
+
+    reset_database();
+    exec("CREATE TABLE tags (id INT, tag STRING);");
+    exec("INSERT INTO tags VALUES (1, 'red'), (2, 'a much longer tag value'), (3, 'red');");
+    Table *table = find_table_by_name("tags");
+    Value first = table_get_value(table, 0, 1);
+    Value second = table_get_value(table, 1, 1);
+    assert_int_eq(VALUE_STR_INLINE, first.str_format, "Short values should be stored inline");
+    assert_int_eq(VALUE_STR_PTR, second.str_format, "Long values should be stored on the heap");
+
+    QueryResult *result = exec_query("SELECT id FROM tags WHERE tag = 'red';");
+    assert_int_eq(2, alist_length(&result->rows), "Inline strings should match in WHERE");
+    result = exec_query("SELECT tag FROM tags WHERE id = 1;");
+    assert_str_eq("red", ((Value *)alist_get(&result->values, 0))->char_val,
+                  "Result values should expose char_val");
+}
+
+void test_dictionary_columns(void) {
+    log_msg(LOG_INFO, "Testing DICTIONARY string columns...");
+    reset_database();
+    exec("CREATE TABLE orders (id INT, status STRING DICTIONARY, note STRING);");
+    exec("INSERT INTO orders VALUES (1, 'shipped', 'x'), (2, 'pending', 'y'), "
+         "(3, 'shipped', 'z'), (4, NULL, 'w');");
+
+    Table *table = find_table_by_name("orders");
+    const ColumnDef *status = (const ColumnDef *)alist_get(&table->schema.columns, 1);
+    assert_true((status->flags & COL_FLAG_DICTIONARY) != 0, "status should be a DICTIONARY column");
+
+    Value a = table_get_value(table, 0, 1);
+    Value b = table_get_value(table, 2, 1);
+    assert_int_eq(VALUE_STR_INTERNED, a.str_format, "Dictionary values should be interned");
+    assert_true(a.char_val == b.char_val, "Equal dictionary values should share storage");
+    assert_int_eq(VALUE_STR_INLINE, table_get_value(table, 0, 2).str_format,
+                  "Other STRING columns should not be interned");
+
+    QueryResult *result = exec_query("SELECT id FROM orders WHERE status = 'shipped';");
+    assert_int_eq(2, alist_length(&result->rows), "Two orders are shipped");
+    result = exec_query("SELECT id FROM orders WHERE status != 'shipped';");
+    assert_int_eq(1, alist_length(&result->rows), "One non-NULL order is not shipped");
+    result = exec_query("SELECT id FROM orders WHERE status = 'never stored';");
+    assert_int_eq(0, alist_length(&result->rows), "An unknown constant should match nothing");
+
+    exec("UPDATE orders SET status = 'pending' WHERE id = 1;");
+    Value updated = table_get_value(table, 0, 1);
+    Value pending = table_get_value(table, 1, 1);
+    assert_int_eq(VALUE_STR_INTERNED, updated.str_format, "UPDATE should intern the new value");
+    assert_true(updated.char_val == pending.char_val, "UPDATE should reuse the shared string");
+
+    exec("CREATE INDEX idx_status ON orders (status);");
+    result = exec_query("SELECT id FROM orders WHERE status = 'pending' ORDER BY id;");
+    assert_int_eq(2, alist_length(&result->rows), "Hash index lookups should find interned values");
+
+    exec("CREATE TABLE statuses (name STRING, label STRING);");
+    exec("INSERT INTO statuses VALUES ('pending', 'Waiting'), ('shipped', 'Sent');");
+    result = exec_query("SELECT orders.id, statuses.label FROM orders JOIN statuses "
+                        "ON orders.status = statuses.name;");
+    assert_int_eq(3, alist_length(&result->rows), "Interned values should join with plain ones");
+
+    int before = string_intern_count();
+    exec("INSERT INTO orders VALUES (5, 'shipped', 'v');");
+    assert_int_eq(before, string_intern_count(), "A known string should not grow the dictionary");
+
+    reset_database();
+    Token *tokens = tokenize("CREATE TABLE bad (id INT DICTIONARY);");
+    ASTNode *ast = parse(tokens);
+    assert_true(ast == NULL, "DICTIONARY on a non-STRING column should be rejected");
+    free_ast(ast);
+    free_tokens(tokens);
+}
@@ -3,9 +3,11 @@
 
 #include "arraylist.h"
 #include "db.h"
+#include "executor.h"
 #include "logger.h"
 #include "table.h"
 #include "test_util.h"
+#include "values.h"
 
 void test_subquery_with_comparison(void) {
     log_msg(LOG_INFO, "Testing subquery with comparison operators...");
@@ -143,3 +145,173 @@ void test_scalar_subquery(void) {
 
     log_msg(LOG_INFO, "Scalar subquery tests passed");
 }
+
+static int count_rows(const char *sql) {
+    return alist_length(&exec_query(sql)->rows);
+}
+
+static void fill_subquery_tables(void) {
+    char sql[160];
+    exec("CREATE TABLE items (id INT, grp INT, price FLOAT);");
+    exec("CREATE TABLE picks (item INT, grp INT, qty INT);");
+    for (int i = 0; i < 300; i++) {
+        if (i % 100 == 99)
+            snprintf(sql, sizeof(sql), "INSERT INTO items VALUES (%d, NULL, %d.5);", i, i);
+        else
+            snprintf(sql, sizeof(sql), "INSERT INTO items VALUES (%d, %d, %d.5);", i, i % 10, i);
+        exec(sql);
+    }
+    /* Items 0, 3, 6, ... 87 are picked, with qty = item % 4 (NULL for item 30). */
+    for (int i = 0; i < 90; i += 3) {
+        if (i == 30)
+            snprintf(sql, sizeof(sql), "INSERT INTO picks VALUES (%d, %d, NULL);", i, i % 10);
+        else
+            snprintf(sql, sizeof(sql), "INSERT INTO picks VALUES (%d, %d, %d);", i, i % 10,
+                     i % 4);
+        exec(sql);
+    }
+}
+
+void test_uncorrelated_subquery_cache(void) {
+    log_msg(LOG_INFO, "Testing that uncorrelated subqueries run once per statement...");
+    reset_database();
+    fill_subquery_tables();
+
+    SubqueryStats before, after;
+    subquery_get_stats(&before);
+    assert_int_eq(150, count_rows("SELECT id FROM items WHERE price > (SELECT AVG(price) FROM "
+                                  "items);"),
+                  "Scalar subquery in WHERE");
+    subquery_get_stats(&after);
+    assert_int_eq(1, (int)(after.runs - before.runs), "The scalar subquery ran once");
+    assert_int_eq(299, (int)(after.cache_hits - before.cache_hits), "Other rows hit the cache");
+
+    QueryResult *result = exec_query("SELECT id, (SELECT MAX(item) FROM picks) FROM items WHERE "
+                                     "id < 3;");
+    assert_int_eq(87, (int)((Value *)alist_get(&result->values, 5))->int_val,
+                  "Scalar subquery in the select list");
+
+    subquery_get_stats(&before);
+    assert_int_eq(30, count_rows("SELECT id FROM items WHERE id IN (SELECT item FROM picks);"),
+                  "IN (SELECT)");
+    assert_int_eq(270, count_rows("SELECT id FROM items WHERE id NOT IN (SELECT item FROM "
+                                  "picks);"),
+                  "NOT IN (SELECT)");
+    assert_int_eq(0, count_rows("SELECT id FROM items WHERE id NOT IN (SELECT qty FROM picks);"),
+                  "NOT IN is never true when the subquery returns a NULL");
+    assert_int_eq(300, count_rows("SELECT id FROM items WHERE grp NOT IN (SELECT item FROM "
+                                  "picks WHERE qty > 100);"),
+                  "NOT IN an empty result holds even for NULL");
+    assert_int_eq(300, count_rows("SELECT id FROM items WHERE EXISTS (SELECT item FROM picks);"),
+                  "Uncorrelated EXISTS");
+    assert_int_eq(0, count_rows("SELECT id FROM items WHERE NOT EXISTS (SELECT item FROM "
+                                "picks);"),
+                  "Uncorrelated NOT EXISTS");
+    subquery_get_stats(&after);
+    assert_int_eq(6, (int)(after.runs - before.runs), "One run per statement");
+
+    /* The cache ends with the statement, so the next one sees new rows. */
+    exec("INSERT INTO picks VALUES (299, 9, 1);");
+    assert_int_eq(31, count_rows("SELECT id FROM items WHERE id IN (SELECT item FROM picks);"),
+                  "A new statement runs the subquery again");
+    exec("DELETE FROM items WHERE id IN (SELECT item FROM picks WHERE qty = 0);");
+    assert_int_eq(292, count_rows("SELECT id FROM items;"), "IN (SELECT) in DELETE");
+}
+
+void test_semi_join_subqueries(void) {
+    log_msg(LOG_INFO, "Testing correlated EXISTS and IN as semi joins...");
+    reset_database();
+    fill_subquery_tables();
+
+    Token *tokens = tokenize("SELECT id FROM items i WHERE EXISTS (SELECT item FROM picks p "
+                             "WHERE p.item = i.id AND p.qty > 0);");
+    ASTNode *ast = parse(tokens);
+    const SubqueryState *state = ast->select.where_clause->subquery.state;
+    assert_int_eq(1, state->outer_count, "One outer column");
+    assert_ptr_not_null((void *)state->semi_join, "Equality correlation is a semi join");
+    assert_int_eq(1, state->semi_join->key_count, "Keyed on p.item");
+    assert_ptr_not_null((void *)state->semi_join->residual, "p.qty > 0 filters the build side");
+    free_ast(ast);
+    free_tokens(tokens);
+
+    SubqueryStats before, after;
+    subquery_get_stats(&before);
+    assert_int_eq(21, count_rows("SELECT id FROM items i WHERE EXISTS (SELECT item FROM picks p "
+                                 "WHERE p.item = i.id AND p.qty > 0);"),
+                  "Correlated EXISTS");
+    assert_int_eq(279, count_rows("SELECT id FROM items i WHERE NOT EXISTS (SELECT item FROM "
+                                  "picks p WHERE p.item = i.id AND p.qty > 0);"),
+                  "Correlated NOT EXISTS is an anti join");
+    assert_int_eq(30, count_rows("SELECT id FROM items i WHERE EXISTS (SELECT * FROM picks p "
+                                 "WHERE i.grp = p.grp AND i.id = p.item);"),
+                  "Two keys");
+    subquery_get_stats(&after);
+    assert_int_eq(0, (int)(after.runs - before.runs), "The subqueries never ran per row");
+    assert_int_eq(3, (int)(after.semi_joins - before.semi_joins), "One build per statement");
+    assert_int_eq(900, (int)(after.probes - before.probes), "One probe per outer row");
+
+    /* item IN picks of the same grp with qty 1: items 9, 21, 33, 45, 57, 69, 81. */
+    subquery_get_stats(&before);
+    assert_int_eq(7, count_rows("SELECT id FROM items i WHERE id IN (SELECT item FROM picks p "
+                                "WHERE p.grp = i.grp AND p.qty = 1);"),
+                  "Correlated IN");
+    /* Every operand is 1: groups 1, 3, 5, 7 and 9 have a qty of 1 and group 0 a NULL qty, so
+       only groups 2, 4, 6 and 8 and the rows with a NULL grp (which see no picks) pass. */
+    assert_int_eq(123, count_rows("SELECT id FROM items i WHERE price - 0.5 - id + 1 NOT IN "
+                                  "(SELECT qty FROM picks p WHERE p.grp = i.grp);"),
+                  "Correlated NOT IN");
+    subquery_get_stats(&after);
+    assert_int_eq(0, (int)(after.runs - before.runs), "IN probes its build side");
+
+    /* A correlation other than equality runs the subquery for each outer row. */
+    tokens = tokenize("SELECT id FROM items i WHERE EXISTS (SELECT item FROM picks p WHERE "
+                      "p.item > i.id);");
+    ast = parse(tokens);
+    assert_ptr_null((void *)ast->select.where_clause->subquery.state->semi_join,
+                    "Range correlation is not a semi join");
+    free_ast(ast);
+    free_tokens(tokens);
+    subquery_get_stats(&before);
+    assert_int_eq(87, count_rows("SELECT id FROM items i WHERE EXISTS (SELECT item FROM picks p "
+                                 "WHERE p.item > i.id);"),
+                  "Per-row correlated EXISTS");
+    subquery_get_stats(&after);
+    assert_int_eq(300, (int)(after.runs - before.runs), "One run per outer row");
+}
+
+void test_correlated_scalar_results(void) {
+    log_msg(LOG_INFO, "Testing correlated scalar subqueries...");
+    reset_database();
+    exec("CREATE TABLE employees (id INT, name STRING, department STRING, salary FLOAT);");
+    exec("INSERT INTO employees VALUES (1, 'Alice', 'Engineering', 80000);");
+    exec("INSERT INTO employees VALUES (2, 'Bob', 'Engineering', 75000);");
+    exec("INSERT INTO employees VALUES (3, 'Charlie', 'Sales', 70000);");
+    exec("INSERT INTO employees VALUES (4, 'Diana', 'Sales', 72000);");
+    exec("INSERT INTO employees VALUES (5, 'Eve', 'Legal', 90000);");
+
+    assert_int_eq(4, count_rows("SELECT name FROM employees e WHERE (SELECT COUNT(*) FROM "
+                                "employees e2 WHERE e2.department = e.department) > 1;"),
+                  "Departments with more than one employee");
+    QueryResult *result = exec_query("SELECT name FROM employees e WHERE salary = (SELECT "
+                                     "MAX(salary) FROM employees e2 WHERE e2.department = "
+                                     "e.department) ORDER BY name;");
+    assert_int_eq(3, alist_length(&result->rows), "Top earner of each department");
+    assert_str_eq("Alice", value_str((Value *)alist_get(&result->values, 0)), "Engineering");
+    assert_str_eq("Diana", value_str((Value *)alist_get(&result->values, 1)), "Sales");
+    result = exec_query("SELECT name, (SELECT COUNT(*) FROM employees e2 WHERE e2.salary > "
+                        "e.salary) FROM employees e WHERE id = 3;");
+    assert_int_eq(4, (int)((Value *)alist_get(&result->values, 1))->int_val,
+                  "Correlated scalar in the select list");
+
+    /* The outer column is bound into the subquery; a short string is held inline. */
+    exec("CREATE TABLE tags (id INT, tag STRING);");
+    exec("INSERT INTO tags VALUES (1, 'x');");
+    exec("INSERT INTO tags VALUES (2, 'yz');");
+    exec("CREATE TABLE one (id INT);");
+    exec("INSERT INTO one VALUES (1);");
+    result = exec_query("SELECT (SELECT t.tag FROM one) FROM tags t ORDER BY id;");
+    assert_int_eq(2, alist_length(&result->rows), "One row per outer row");
+    assert_str_eq("x", value_str((Value *)alist_get(&result->values, 0)),
+                  "An outer string as the subquery's column");
+    assert_str_eq("yz", value_str((Value *)alist_get(&result->values, 1)), "Second outer row");
+}
@@ -0,0 +1,69 @@
+#include <stdint.h>
+
+#include "db.h"
+#include "logger.h"
+#include "test_util.h"
+#include "thread_pool.h"
+
+#define POOL_TEST_TASKS 1000
+
+typedef struct {
+    int runs[POOL_TEST_TASKS];
+    int nested[POOL_TEST_TASKS];
+    int worker_of[POOL_TEST_TASKS];
+} PoolTestState;
+
+static void count_nested(void *arg, int worker, int task) {
+    int *count = arg;
+    (void)worker;
+    count[task]++;
+}
+
+/* The first tasks are slow, so whoever holds them falls behind and gets robbed. */
+static void count_task(void *arg, int worker, int task) {
+    PoolTestState *state = arg;
+    volatile uint64_t spin = 0;
+    for (int i = 0; i < (task < POOL_TEST_TASKS / 4 ? 20000 : 10); i++)
+        spin += (uint64_t)i;
+    state->runs[task]++;
+    state->worker_of[task] = worker;
+    if (task % 100 == 0) {
+        int inner[4] = {0};
+        thread_pool_run(4, count_nested, inner);
+        state->nested[task] = inner[0] + inner[1] + inner[2] + inner[3];
+    }
+}
+
+void test_thread_pool_runs_each_task_once(void) {
+    log_msg(LOG_INFO, "Testing the thread pool...");
+
+    static PoolTestState state;
+    PoolStats before, after;
+    thread_pool_get_stats(&before);
+    thread_pool_set_workers(4);
+    assert_int_eq(4, thread_pool_workers(), "Worker count is configurable");
+    thread_pool_run(POOL_TEST_TASKS, count_task, &state);
+
+    bool once = true, in_range = true, nested = true;
+    for (int t = 0; t < POOL_TEST_TASKS; t++) {
+        once = once && state.runs[t] == 1;
+        in_range = in_range && state.worker_of[t] >= 0 && state.worker_of[t] < 4;
+        if (t % 100 == 0)
+            nested = nested && state.nested[t] == 4;
+    }
+    assert_true(once, "Every task runs exactly once");
+    assert_true(in_range, "Tasks report the worker that ran them");
+    assert_true(nested, "Runs started inside a task complete on that worker");
+    thread_pool_get_stats(&after);
+    assert_int_eq(1, (int)(after.runs - before.runs), "Nested runs are not counted");
+    assert_int_eq(POOL_TEST_TASKS, (int)(after.tasks - before.tasks), "Tasks are counted");
+
+    thread_pool_set_workers(2);
+    int count[3] = {0};
+    thread_pool_run(3, count_nested, count);
+    assert_true(count[0] == 1 && count[1] == 1 && count[2] == 1, "Pool resizes between runs");
+
+    thread_pool_set_workers(1);
+    thread_pool_shutdown();
+    log_msg(LOG_INFO, "Thread pool tests passed");
+}
@@ -0,0 +1,256 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "logger.h"
+#include "storage.h"
+#include "table.h"
+#include "test_util.h"
+#include "thread_pool.h"
+#include "txn.h"
+#include "values.h"
+
+static int txn_row_count(const char *sql) {
+    QueryResult *result = exec_query(sql);
+    assert_ptr_not_null(result, "Query failed: %s", sql);
+    return alist_length(&result->rows);
+}
+
+static long long txn_int_value(const char *sql) {
+    QueryResult *result = exec_query(sql);
+    assert_int_eq(1, alist_length(&result->rows), "One row expected from: %s", sql);
+    return ((Value *)alist_get(&result->values, 0))->int_val;
+}
+
+static void fill_accounts(void) {
+    reset_database();
+    exec("CREATE TABLE accounts (id INT PRIMARY KEY, owner STRING, balance INT);");
+    exec("INSERT INTO accounts VALUES (1, 'ann', 100), (2, 'bob', 200), (3, 'cid', 300);");
+}
+
+void test_txn_snapshot_isolation(void) {
+    log_msg(LOG_INFO, "Testing snapshot isolation between a transaction and new commits...");
+    fill_accounts();
+    Table *table = find_table_by_name("accounts");
+
+    exec("BEGIN;");
+    assert_int_eq(3, txn_row_count("SELECT * FROM accounts;"), "Snapshot sees the table");
+    Transaction *reader = txn_detach();
+    assert_ptr_not_null(reader, "BEGIN attaches a transaction");
+
+    exec("INSERT INTO accounts VALUES (4, 'dee', 400);");
+    exec("UPDATE accounts SET balance = 150 WHERE id = 1;");
+    exec("DELETE FROM accounts WHERE id = 2;");
+    assert_int_eq(3, txn_row_count("SELECT * FROM accounts;"), "Autocommit sees its commits");
+    assert_int_eq(150, (int)txn_int_value("SELECT balance FROM accounts WHERE id = 1;"),
+                  "Autocommit sees the update");
+    assert_ptr_not_null(table->versions, "Writes under an open snapshot keep versions");
+    assert_int_eq(0, txn_row_count("SELECT * FROM accounts WHERE id = 2;"), "Row 2 is deleted");
+
+    txn_attach(reader);
+    assert_int_eq(3, txn_row_count("SELECT * FROM accounts;"), "Snapshot ignores later commits");
+    assert_int_eq(100, (int)txn_int_value("SELECT balance FROM accounts WHERE id = 1;"),
+                  "Index lookups return the version the snapshot sees");
+    assert_int_eq(1, txn_row_count("SELECT * FROM accounts WHERE id = 2;"),
+                  "A row deleted after the snapshot is still visible");
+    assert_int_eq(0, txn_row_count("SELECT * FROM accounts WHERE owner = 'dee';"),
+                  "A row inserted after the snapshot is not visible");
+    QueryResult *sum = exec_query("SELECT SUM(balance) FROM accounts;");
+    assert_int_eq(600, (int)((Value *)alist_get(&sum->values, 0))->int_val,
+                  "Aggregates read the snapshot");
+    exec("COMMIT;");
+
+    assert_ptr_null(txn_current(), "COMMIT detaches the transaction");
+    assert_ptr_null(table->versions, "Versions are dropped once no snapshot needs them");
+    assert_int_eq(3, table_row_count(table), "Dead versions are removed");
+    assert_int_eq(3, txn_row_count("SELECT * FROM accounts;"), "Latest state after COMMIT");
+    assert_int_eq(400, (int)txn_int_value("SELECT balance FROM accounts WHERE id = 4;"),
+                  "Primary key index still finds the new row");
+
+    log_msg(LOG_INFO, "Snapshot isolation tests passed");
+}
+
+void test_txn_commit_and_rollback(void) {
+    log_msg(LOG_INFO, "Testing COMMIT and ROLLBACK of transaction changes...");
+    fill_accounts();
+    Table *table = find_table_by_name("accounts");
+
+    exec("BEGIN TRANSACTION;");
+    exec("INSERT INTO accounts VALUES (4, 'dee', 400);");
+    exec("UPDATE accounts SET balance = 101 WHERE id <= 2;");
+    exec("DELETE FROM accounts WHERE id = 3;");
+    assert_int_eq(3, txn_row_count("SELECT * FROM accounts;"), "A transaction sees its changes");
+    assert_int_eq(101, (int)txn_int_value("SELECT balance FROM accounts WHERE id = 1;"),
+                  "A transaction sees its own updates");
+
+    Transaction *writer = txn_detach();
+    assert_int_eq(3, txn_row_count("SELECT * FROM accounts WHERE id <= 3;"),
+                  "Others do not see uncommitted changes");
+    assert_int_eq(0, txn_row_count("SELECT * FROM accounts WHERE id = 4;"),
+                  "Others do not see uncommitted inserts");
+    txn_attach(writer);
+    exec("ROLLBACK;");
+
+    assert_ptr_null(table->versions, "ROLLBACK leaves no versions behind");
+    assert_int_eq(3, table_row_count(table), "Rolled back rows are removed");
+    assert_int_eq(100, (int)txn_int_value("SELECT balance FROM accounts WHERE id = 1;"),
+                  "Rolled back update is undone");
+    assert_int_eq(1, txn_row_count("SELECT * FROM accounts WHERE id = 3;"),
+                  "Rolled back delete is undone");
+
+    log_msg(LOG_INFO, "Testing a key deleted and reinserted in one transaction...");
+    exec("BEGIN;");
+    exec("DELETE FROM accounts WHERE id = 1;");
+    exec("INSERT INTO accounts VALUES (1, 'amy', 10);");
+    exec("INSERT INTO accounts VALUES (2, 'dup', 20);");
+    assert_int_eq(1, txn_row_count("SELECT * FROM accounts WHERE id = 2;"),
+                  "UNIQUE still rejects a live duplicate");
+    exec("UPDATE accounts SET id = 3 WHERE id = 1;");
+    assert_int_eq(1, txn_row_count("SELECT * FROM accounts WHERE id = 1;"),
+                  "UNIQUE rejects an updated duplicate");
+    exec("COMMIT WORK;");
+    QueryResult *result = exec_query("SELECT owner FROM accounts WHERE id = 1;");
+    assert_int_eq(1, alist_length(&result->rows), "The reinserted key is committed");
+    assert_str_eq("amy", value_str((Value *)alist_get(&result->values, 0)),
+                  "The reinserted row replaced the deleted one");
+    assert_int_eq(3, (int)txn_int_value("SELECT COUNT(*) FROM accounts;"),
+                  "Three accounts after the commit");
+
+    log_msg(LOG_INFO, "COMMIT and ROLLBACK tests passed");
+}
+
+void test_txn_write_conflicts(void) {
+    log_msg(LOG_INFO, "Testing the single writer and lost update checks...");
+    fill_accounts();
+    TxnStats before, after;
+    txn_get_stats(&before);
+
+    exec("BEGIN;");
+    Transaction *first = txn_detach();
+    exec("UPDATE accounts SET balance = 111 WHERE id = 1;");
+    txn_attach(first);
+    exec("UPDATE accounts SET balance = 999 WHERE id = 1;");
+    exec("DELETE FROM accounts WHERE id = 1;");
+    assert_int_eq(100, (int)txn_int_value("SELECT balance FROM accounts WHERE id = 1;"),
+                  "Rows changed since the snapshot cannot be written");
+
+    exec("INSERT INTO accounts VALUES (5, 'eve', 500);");
+    first = txn_detach();
+    exec("INSERT INTO accounts VALUES (6, 'fay', 600);");
+    assert_int_eq(0, txn_row_count("SELECT * FROM accounts WHERE id = 6;"),
+                  "Other writers are refused while changes are uncommitted");
+    assert_int_eq(111, (int)txn_int_value("SELECT balance FROM accounts WHERE id = 1;"),
+                  "Readers never wait");
+    txn_attach(first);
+    exec("BEGIN;");
+    assert_ptr_not_null(txn_current(), "Nested BEGIN keeps the open transaction");
+    exec("COMMIT;");
+    exec("COMMIT;");
+
+    txn_get_stats(&after);
+    assert_true(after.conflicts - before.conflicts >= 3, "Conflicts are counted");
+    assert_int_eq(4, txn_row_count("SELECT * FROM accounts;"), "The insert was committed");
+    exec("INSERT INTO accounts VALUES (6, 'fay', 600);");
+    assert_int_eq(5, txn_row_count("SELECT * FROM accounts;"), "Writes resume after COMMIT");
+
+    log_msg(LOG_INFO, "Write conflict tests passed");
+}
+
+void test_txn_parallel_snapshot(void) {
+    log_msg(LOG_INFO, "Testing parallel scans of a columnar snapshot...");
+    reset_database();
+    thread_pool_set_workers(4);
+    exec("CREATE TABLE points (x INT, y INT) STORAGE COLUMNAR;");
+    char *insert = malloc(16384);
+    assert_ptr_not_null(insert, "Allocation failed");
+    for (int i = 0; i < 10000; i += 500) {
+        size_t used = (size_t)snprintf(insert, 16384, "INSERT INTO points VALUES ");
+        for (int k = i; k < i + 500; k++)
+            used += (size_t)snprintf(insert + used, 16384 - used, "%s(%d, %d)", k == i ? "" : ", ",
+                                     k, k % 7);
+        snprintf(insert + used, 16384 - used, ";");
+        exec(insert);
+    }
+    free(insert);
+
+    exec("BEGIN;");
+    Transaction *reader = txn_detach();
+    exec("DELETE FROM points WHERE x < 5000;");
+    exec("UPDATE points SET y = 100 WHERE x >= 9000;");
+    assert_int_eq(5000, txn_row_count("SELECT x FROM points WHERE y >= 0;"),
+                  "Autocommit scan sees the delete");
+    assert_int_eq(1000, txn_row_count("SELECT x FROM points WHERE y = 100;"),
+                  "Autocommit scan sees the update");
+    txn_attach(reader);
+    assert_int_eq(10000, txn_row_count("SELECT x FROM points WHERE y >= 0;"),
+                  "Parallel scan of the snapshot");
+    assert_int_eq(0, txn_row_count("SELECT x FROM points WHERE y = 100;"),
+                  "Snapshot does not see the update");
+    assert_int_eq(10000, (int)txn_int_value("SELECT COUNT(*) FROM points;"),
+                  "Parallel aggregate of the snapshot");
+    exec("ROLLBACK;");
+
+    Table *table = find_table_by_name("points");
+    assert_ptr_null(table->versions, "Versions are collected");
+    assert_int_eq(5000, table_row_count(table), "Only the live rows remain");
+    assert_int_eq(5000, (int)txn_int_value("SELECT COUNT(*) FROM points;"),
+                  "Latest state after the reader ends");
+    thread_pool_set_workers(1);
+
+    log_msg(LOG_INFO, "Parallel snapshot tests passed");
+}
+
+void test_txn_recovery(void) {
+    log_msg(LOG_INFO, "Testing that committed transactions are logged and replayed...");
+    reset_database();
+    char dir[64];
+    strcpy(dir, "/tmp/db_txn_XXXXXX");
+    assert_true(mkdtemp(dir) != NULL, "Failed to create a temporary data directory");
+    assert_true(storage_open(dir), "Opening an empty data directory should succeed");
+
+    exec("CREATE TABLE accounts (id INT PRIMARY KEY, owner STRING, balance INT);");
+    exec("INSERT INTO accounts VALUES (1, 'ann', 100), (2, 'bob', 200), (3, 'cid', 300);");
+    exec("BEGIN;");
+    exec("UPDATE accounts SET balance = 0 WHERE id = 2;");
+    exec("INSERT INTO accounts VALUES (4, 'dee', 400);");
+    exec("DELETE FROM accounts WHERE id = 1;");
+    exec("COMMIT;");
+
+    exec("BEGIN;");
+    Transaction *reader = txn_detach();
+    exec("DELETE FROM accounts WHERE id = 3;");
+    exec("INSERT INTO accounts VALUES (5, 'eve', 500);");
+    assert_false(storage_checkpoint(), "Checkpoints wait for the reader");
+    txn_attach(reader);
+    exec("INSERT INTO accounts VALUES (6, 'fay', 600);");
+    exec("ROLLBACK;");
+
+    storage_close(false);
+    reset_database();
+    assert_true(storage_open(dir), "Reopening the data directory should succeed");
+    assert_int_eq(3, txn_row_count("SELECT * FROM accounts;"), "Committed rows are replayed");
+    assert_int_eq(0, (int)txn_int_value("SELECT balance FROM accounts WHERE id = 2;"),
+                  "Committed update is replayed");
+    assert_int_eq(0, txn_row_count("SELECT * FROM accounts WHERE id = 1 OR id = 3 OR id = 6;"),
+                  "Deletes are replayed and rolled back rows are not");
+    assert_int_eq(500, (int)txn_int_value("SELECT balance FROM accounts WHERE id = 5;"),
+                  "Autocommit insert under a reader is replayed");
+    assert_true(storage_checkpoint(), "Checkpoint once no transaction is open");
+
+    storage_close(false);
+    reset_database();
+    const char *files[] = {STORAGE_SNAPSHOT_FILE, STORAGE_WAL_FILE};
+    char path[128];
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+
+    log_msg(LOG_INFO, "Transaction recovery tests passed");
+}
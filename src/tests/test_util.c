@@ -11,6 +11,7 @@
 #include "logger.h"
 #include "utils.h"
 #include "table.h"
+#include "txn.h"
 
 extern ArrayList tables;
 extern ArrayList indexes;
@@ -20,24 +21,15 @@ static void free_index(void *ptr) {
     if (!index)
         return;
 
-    if (index->buckets) {
-        for (int i = 0; i < index->bucket_count; i++) {
-            IndexEntry *entry = index->buckets[i];
-            while (entry) {
-                IndexEntry *next = entry->next;
-                if (entry->key.type == TYPE_STRING && entry->key.char_val) {
-                    free(entry->key.char_val);
-                }
-                free(entry);
-                entry = next;
-            }
-        }
-        free(index->buckets);
-        index->buckets = NULL;
-    }
+    alist_destroy(&index->columns);
+    if (index->type == INDEX_TYPE_BTREE)
+        btree_index_free(index);
+    else
+        hash_index_free(index);
 }
 
 void reset_database(void) {
+    txn_shutdown();
     if (tables.data != NULL) {
         alist_destroy(&tables);
     }
@@ -47,6 +39,9 @@ void reset_database(void) {
         alist_destroy(&indexes);
     }
     alist_init(&indexes, sizeof(Index), free_index);
+    catalog_changed();
+
+    init_stat();
 }
 
 bool exec(const char *sql) {
@@ -68,22 +63,18 @@ Table *find_table_by_name(const char *name) {
 }
 
 QueryResult *exec_query(const char *sql) {
-    static QueryResult *last_result = NULL;
+    static QueryResult empty = {0};
 
-    if (last_result) {
-        free_query_result(last_result);
-        g_last_result = NULL;
-    }
+    free_query_result(g_last_result);
+    g_last_result = NULL;
 
     assert_true(exec(sql), "Query execution failed: %s", sql);
 
-    last_result = g_last_result;
-    if (!last_result) {
-        static QueryResult empty = {0};
-        last_result = &empty;
+    if (!g_last_result) {
+        return &empty;
     }
 
-    return last_result;
+    return g_last_result;
 }
 
 static void format_message(char *buffer, size_t size, const char *format, va_list args) {
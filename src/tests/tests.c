@@ -8,6 +8,8 @@ void test_create_table_new_types(void);
 void test_foreign_key_validation(void);
 void test_foreign_key_self_reference(void);
 void test_foreign_key_multiple_references(void);
+void test_key_constraints_use_indexes(void);
+void test_catalog_many_tables(void);
 void test_primary_key_definitions(void);
 
 void test_insert_single_row(void);
@@ -24,12 +26,14 @@ void test_delete_all_rows(void);
 void test_insert_with_comments(void);
 void test_multiple_statements(void);
 void test_update_with_expression(void);
+void test_update_expression_values(void);
 void test_update_multiple_columns(void);
 void test_update_no_match(void);
 void test_delete_with_and_or(void);
 void test_insert_empty_values(void);
 void test_insert_string_with_spaces(void);
 void test_update_same_value(void);
+void test_delete_in_place(void);
 
 void test_select_all(void);
 void test_select_columns(void);
@@ -87,6 +91,8 @@ void test_join_empty_table(void);
 void test_join_syntax_variations(void);
 void test_self_join(void);
 void test_three_table_join(void);
+void test_multi_way_join(void);
+void test_join_leaves_base_tables_intact(void);
 
 void test_create_index(void);
 void test_create_multiple_indexes(void);
@@ -101,6 +107,19 @@ void test_hash_join_multiple_matches(void);
 void test_hash_join_no_matches(void);
 void test_index_with_string_equality(void);
 void test_index_rebuild(void);
+void test_btree_index_range_scan(void);
+void test_btree_index_maintenance(void);
+void test_btree_index_order_by(void);
+void test_hash_index_basic(void);
+void test_hash_index_all_types(void);
+void test_composite_index(void);
+void test_covering_index(void);
+void test_table_stats_functionality(void);
+void test_optimizer_support_functions(void);
+void test_plan_node_structures(void);
+void test_analyze_statistics(void);
+void test_optimizer_plan_choice(void);
+void test_explain(void);
 void test_complex_join_with_index(void);
 
 void test_subquery_with_comparison(void);
@@ -111,15 +130,105 @@ void test_exists_subquery(void);
 void test_nested_subquery(void);
 void test_subquery_with_join(void);
 void test_scalar_subquery(void);
+void test_uncorrelated_subquery_cache(void);
+void test_semi_join_subqueries(void);
+void test_correlated_scalar_results(void);
 void test_btree_basic(void);
 void test_query_stats_basic(void);
 void test_aggregation_improved(void);
 void test_new_features_simple(void);
 void test_comments(void);
+void test_tokenizer(void);
 void test_btree_basic(void);
 void test_query_stats_basic(void);
 void test_aggregation_improved(void);
 
+void test_columnar_create_and_insert(void);
+void test_columnar_select_where(void);
+void test_columnar_aggregates(void);
+void test_columnar_update_delete(void);
+void test_columnar_type_mismatch(void);
+void test_columnar_compression(void);
+
+void test_operator_plan_shape(void);
+void test_operator_join_order(void);
+void test_operator_sort(void);
+void test_operator_sort_keys(void);
+void test_operator_top_k(void);
+void test_operator_external_sort(void);
+void test_operator_limit_stops_early(void);
+void test_operator_aggregates(void);
+void test_operator_group_by(void);
+void test_operator_group_by_keys(void);
+void test_operator_parallel_scan(void);
+void test_operator_radix_hash_join(void);
+void test_operator_join_filters(void);
+void test_operator_grace_hash_join(void);
+void test_operator_group_by_spill(void);
+void test_thread_pool_runs_each_task_once(void);
+void test_arena_alloc_and_release(void);
+void test_pool_reuse(void);
+void test_arena_backed_statements(void);
+void test_memory_accounting(void);
+void test_inline_strings(void);
+void test_dictionary_columns(void);
+void test_storage_recovery(void);
+void test_storage_group_commit(void);
+void test_storage_mapped_snapshot(void);
+void test_storage_deleted_rows(void);
+void test_storage_wide_table_ids(void);
+void test_storage_composite_indexes(void);
+
+void test_txn_snapshot_isolation(void);
+void test_txn_commit_and_rollback(void);
+void test_txn_write_conflicts(void);
+void test_txn_parallel_snapshot(void);
+void test_txn_recovery(void);
+void test_copy_csv_types(void);
+void test_copy_round_trip(void);
+void test_copy_bulk_load_indexes(void);
+void test_result_writer(void);
+
+void test_prepared_point_lookups(void);
+void test_streaming_cursor(void);
+void test_prepared_reprepare(void);
+void test_sql_prepare_execute(void);
+void test_statement_cache(void);
+
+void test_compiled_projection(void);
+void test_compile_folding_and_sharing(void);
+void test_compiled_join_projection(void);
+void test_like_matcher(void);
+void test_like_queries(void);
+void test_in_lists(void);
+
+void test_batch_filter_row_storage(void);
+void test_batch_filter_columnar_storage(void);
+void test_batch_filter_dml(void);
+void test_batch_filter_not_nulls(void);
+void test_zone_map_skipping(void);
+
+void test_agg_kernels_row_storage(void);
+void test_agg_kernels_columnar_storage(void);
+void test_agg_kernels_merge(void);
+void test_agg_kernels_int_moments(void);
+
+void test_log_level_guard(void);
+void test_metrics_counters(void);
+
+void test_matview_aggregates(void);
+void test_matview_filters_and_joins(void);
+void test_matview_restrictions(void);
+void test_matview_storage(void);
+
+void test_sketch_merge(void);
+void test_approx_aggregates(void);
+void test_table_sample(void);
+void test_approx_views(void);
+
+void test_server_pipelining(void);
+void test_server_sessions(void);
+
 int main(void) {
     set_log_level(LOG_DEBUG);
     log_msg(LOG_INFO, "========================================");
@@ -135,6 +244,8 @@ int main(void) {
     test_foreign_key_validation();
     test_foreign_key_self_reference();
     test_foreign_key_multiple_references();
+    test_key_constraints_use_indexes();
+    test_catalog_many_tables();
 
     log_msg(LOG_INFO, "\n=== DML Tests ===");
     test_insert_single_row();
@@ -150,15 +261,18 @@ int main(void) {
     test_delete_all_rows();
     test_insert_with_comments();
     test_comments();
+    test_tokenizer();
     test_primary_key_definitions();
     test_multiple_statements();
     test_update_with_expression();
+    test_update_expression_values();
     test_update_multiple_columns();
     test_update_no_match();
     test_delete_with_and_or();
     test_insert_empty_values();
     test_insert_string_with_spaces();
     test_update_same_value();
+    test_delete_in_place();
 
     log_msg(LOG_INFO, "\n=== SELECT Tests ===");
     test_select_all();
@@ -205,11 +319,192 @@ int main(void) {
     test_string_copy();
     log_msg(LOG_INFO, "Utility tests passed!");
     log_msg(LOG_INFO, "========================================");
+    log_msg(LOG_INFO, "\n=== Join Tests ===");
+    test_inner_join();
+    test_left_join();
+    test_join_multiple_matches();
+    test_join_no_matches();
+    test_join_empty_table();
+    test_join_syntax_variations();
+    test_self_join();
+    test_three_table_join();
+    test_multi_way_join();
+    test_join_leaves_base_tables_intact();
+    test_hash_join_inner();
+    test_hash_join_left();
+    test_hash_join_large_tables();
+    test_hash_join_multiple_matches();
+    test_hash_join_no_matches();
+    log_msg(LOG_INFO, "Join tests passed!");
+    log_msg(LOG_INFO, "========================================");
     log_msg(LOG_INFO, "\n=== Index Tests ===");
     test_create_index();
+    test_create_multiple_indexes();
+    test_index_on_string_column();
+    test_drop_index();
     test_index_filter_equality();
+    test_index_filter_with_large_table();
+    test_index_with_string_equality();
+    test_index_rebuild();
+    test_btree_basic();
+    test_btree_index_range_scan();
+    test_btree_index_maintenance();
+    test_btree_index_order_by();
+    test_hash_index_basic();
+    test_hash_index_all_types();
+    test_composite_index();
+    test_covering_index();
     log_msg(LOG_INFO, "Index tests passed!");
     log_msg(LOG_INFO, "========================================");
+    log_msg(LOG_INFO, "\n=== Optimizer Tests ===");
+    test_table_stats_functionality();
+    test_optimizer_support_functions();
+    test_plan_node_structures();
+    test_analyze_statistics();
+    test_optimizer_plan_choice();
+    test_explain();
+    log_msg(LOG_INFO, "Optimizer tests passed!");
+    log_msg(LOG_INFO, "========================================");
+    log_msg(LOG_INFO, "\n=== Columnar Storage Tests ===");
+    test_columnar_create_and_insert();
+    test_columnar_select_where();
+    test_columnar_aggregates();
+    test_columnar_update_delete();
+    test_columnar_type_mismatch();
+    test_columnar_compression();
+    log_msg(LOG_INFO, "Columnar storage tests passed!");
+    log_msg(LOG_INFO, "========================================");
+    log_msg(LOG_INFO, "\n=== Batch Filter Tests ===");
+    test_batch_filter_row_storage();
+    test_batch_filter_columnar_storage();
+    test_batch_filter_dml();
+    test_batch_filter_not_nulls();
+    test_zone_map_skipping();
+    log_msg(LOG_INFO, "Batch filter tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Operator Tests ===");
+    test_operator_plan_shape();
+    test_operator_join_order();
+    test_operator_sort();
+    test_operator_sort_keys();
+    test_operator_top_k();
+    test_operator_external_sort();
+    test_operator_limit_stops_early();
+    test_operator_aggregates();
+    test_operator_group_by();
+    test_operator_group_by_keys();
+    log_msg(LOG_INFO, "Operator tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Parallel Scan Tests ===");
+    test_thread_pool_runs_each_task_once();
+    test_operator_parallel_scan();
+    test_operator_radix_hash_join();
+    test_operator_join_filters();
+    test_operator_grace_hash_join();
+    test_operator_group_by_spill();
+    log_msg(LOG_INFO, "Parallel scan tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Arena Tests ===");
+    test_arena_alloc_and_release();
+    test_pool_reuse();
+    test_arena_backed_statements();
+    test_memory_accounting();
+    log_msg(LOG_INFO, "Arena tests passed!");
+
+    log_msg(LOG_INFO, "\n=== String Value Tests ===");
+    test_inline_strings();
+    test_dictionary_columns();
+    log_msg(LOG_INFO, "String value tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Storage Tests ===");
+    test_storage_recovery();
+    test_storage_group_commit();
+    test_storage_mapped_snapshot();
+    test_storage_deleted_rows();
+    test_storage_wide_table_ids();
+    test_storage_composite_indexes();
+    log_msg(LOG_INFO, "Storage tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Transaction Tests ===");
+    test_txn_snapshot_isolation();
+    test_txn_commit_and_rollback();
+    test_txn_write_conflicts();
+    test_txn_parallel_snapshot();
+    test_txn_recovery();
+    log_msg(LOG_INFO, "Transaction tests passed!");
+
+    log_msg(LOG_INFO, "\n=== COPY Tests ===");
+    test_copy_csv_types();
+    test_copy_round_trip();
+    test_copy_bulk_load_indexes();
+    test_result_writer();
+    log_msg(LOG_INFO, "COPY tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Prepared Statement Tests ===");
+    test_prepared_point_lookups();
+    test_prepared_reprepare();
+    test_sql_prepare_execute();
+    test_statement_cache();
+    test_streaming_cursor();
+    log_msg(LOG_INFO, "Prepared statement tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Expression Compiler Tests ===");
+    test_compiled_projection();
+    test_compile_folding_and_sharing();
+    test_compiled_join_projection();
+    log_msg(LOG_INFO, "Expression compiler tests passed!");
+
+    log_msg(LOG_INFO, "\n=== LIKE and IN Tests ===");
+    test_like_matcher();
+    test_like_queries();
+    test_in_lists();
+    log_msg(LOG_INFO, "LIKE and IN tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Subquery Tests ===");
+    test_subquery_with_comparison();
+    test_correlated_subquery();
+    test_subquery_in_insert();
+    test_subquery_with_aggregates();
+    test_exists_subquery();
+    test_nested_subquery();
+    test_subquery_with_join();
+    test_scalar_subquery();
+    test_uncorrelated_subquery_cache();
+    test_semi_join_subqueries();
+    test_correlated_scalar_results();
+    log_msg(LOG_INFO, "Subquery tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Aggregate Kernel Tests ===");
+    test_agg_kernels_row_storage();
+    test_agg_kernels_columnar_storage();
+    test_agg_kernels_merge();
+    test_agg_kernels_int_moments();
+    log_msg(LOG_INFO, "Aggregate kernel tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Metrics Tests ===");
+    test_log_level_guard();
+    test_metrics_counters();
+    log_msg(LOG_INFO, "Metrics tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Materialized View Tests ===");
+    test_matview_aggregates();
+    test_matview_filters_and_joins();
+    test_matview_restrictions();
+    test_matview_storage();
+    log_msg(LOG_INFO, "Materialized view tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Approximate Query Tests ===");
+    test_sketch_merge();
+    test_approx_aggregates();
+    test_table_sample();
+    test_approx_views();
+    log_msg(LOG_INFO, "Approximate query tests passed!");
+
+    log_msg(LOG_INFO, "\n=== Server Tests ===");
+    test_server_pipelining();
+    test_server_sessions();
+    log_msg(LOG_INFO, "Server tests passed!");
+    log_msg(LOG_INFO, "========================================");
     log_msg(LOG_INFO, "All tests passed!");
     log_msg(LOG_INFO, "========================================");
 
@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+/* Unclaimed tasks [next, end) of one worker, guarded by its own lock so claiming and
+   stealing never serialize on a shared one. */
+typedef struct {
+    pthread_mutex_t lock;
+    int next;
+    int end;
+    uint64_t steals;
+} WorkRange;
+
+typedef struct {
+    int workers; /* configured, including the caller; 0 until first asked */
+    int thread_count;
+    pthread_t threads[MAX_PARALLEL_WORKERS];
+    uint64_t seen[MAX_PARALLEL_WORKERS]; /* last run each helper took part in */
+    WorkRange ranges[MAX_PARALLEL_WORKERS];
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    int participants;
+    int pending; /* helpers still in the current run */
+    bool stopping;
+    bool ranges_ready;
+    PoolTask task;
+    void *arg;
+    PoolStats stats;
+} ThreadPool;
+
+static ThreadPool g_pool = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                            .start = PTHREAD_COND_INITIALIZER,
+                            .done = PTHREAD_COND_INITIALIZER};
+static _Thread_local bool t_in_pool;
+
+static int default_workers(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        return 1;
+    return cpus > MAX_PARALLEL_WORKERS ? MAX_PARALLEL_WORKERS : (int)cpus;
+}
+
+/* 0 restores the default of one worker per online CPU. */
+void thread_pool_set_workers(int workers) {
+    if (workers <= 0)
+        workers = default_workers();
+    g_pool.workers = workers > MAX_PARALLEL_WORKERS ? MAX_PARALLEL_WORKERS : workers;
+}
+
+int thread_pool_workers(void) {
+    if (g_pool.workers == 0)
+        g_pool.workers = default_workers();
+    return g_pool.workers;
+}
+
+void thread_pool_get_stats(PoolStats *stats) {
+    *stats = g_pool.stats;
+}
+
+static bool claim(int worker, int *task) {
+    WorkRange *range = &g_pool.ranges[worker];
+    pthread_mutex_lock(&range->lock);
+    bool found = range->next < range->end;
+    if (found)
+        *task = range->next++;
+    pthread_mutex_unlock(&range->lock);
+    return found;
+}
+
+/* Moves the upper half of the largest other range to worker and claims its first task. */
+static bool steal(int worker, int *task) {
+    for (;;) {
+        int victim = -1, most = 0;
+        for (int w = 0; w < g_pool.participants; w++) {
+            WorkRange *range = &g_pool.ranges[w];
+            pthread_mutex_lock(&range->lock);
+            int left = range->end - range->next;
+            pthread_mutex_unlock(&range->lock);
+            if (w != worker && left > most) {
+                victim = w;
+                most = left;
+            }
+        }
+        if (victim < 0)
+            return false;
+
+        WorkRange *from = &g_pool.ranges[victim];
+        pthread_mutex_lock(&from->lock);
+        int left = from->end - from->next;
+        int lo = from->next + left / 2, hi = from->end;
+        if (left > 0)
+            from->end = lo;
+        from->steals += left > 0;
+        pthread_mutex_unlock(&from->lock);
+        if (left <= 0)
+            continue;
+
+        WorkRange *mine = &g_pool.ranges[worker];
+        pthread_mutex_lock(&mine->lock);
+        mine->next = lo + 1;
+        mine->end = hi;
+        pthread_mutex_unlock(&mine->lock);
+        *task = lo;
+        return true;
+    }
+}
+
+static void work(int worker) {
+    int task;
+    while (claim(worker, &task) || steal(worker, &task))
+        g_pool.task(g_pool.arg, worker, task);
+}
+
+static void *helper_main(void *param) {
+    int worker = (int)(intptr_t)param;
+    t_in_pool = true;
+    pthread_mutex_lock(&g_pool.lock);
+    for (;;) {
+        while (!g_pool.stopping && g_pool.generation == g_pool.seen[worker])
+            pthread_cond_wait(&g_pool.start, &g_pool.lock);
+        if (g_pool.stopping)
+            break;
+        g_pool.seen[worker] = g_pool.generation;
+        bool participate = worker < g_pool.participants;
+        pthread_mutex_unlock(&g_pool.lock);
+        if (participate)
+            work(worker);
+        pthread_mutex_lock(&g_pool.lock);
+        if (--g_pool.pending == 0)
+            pthread_cond_signal(&g_pool.done);
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+    return NULL;
+}
+
+void thread_pool_shutdown(void) {
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.stopping = true;
+    pthread_cond_broadcast(&g_pool.start);
+    pthread_mutex_unlock(&g_pool.lock);
+    for (int i = 1; i <= g_pool.thread_count; i++)
+        pthread_join(g_pool.threads[i], NULL);
+    g_pool.thread_count = 0;
+    g_pool.stopping = false;
+}
+
+/* Starts or stops helpers until there are workers - 1 of them. */
+static int ensure_helpers(int workers) {
+    if (g_pool.thread_count == workers - 1)
+        return g_pool.thread_count;
+    thread_pool_shutdown();
+    if (!g_pool.ranges_ready) {
+        for (int w = 0; w < MAX_PARALLEL_WORKERS; w++)
+            pthread_mutex_init(&g_pool.ranges[w].lock, NULL);
+        g_pool.ranges_ready = true;
+    }
+    for (int i = 1; i < workers; i++) {
+        g_pool.seen[i] = g_pool.generation;
+        if (pthread_create(&g_pool.threads[i], NULL, helper_main, (void *)(intptr_t)i) != 0) {
+            log_msg(LOG_WARN, "thread_pool_run: Started only %d of %d workers", i, workers);
+            break;
+        }
+        g_pool.thread_count = i;
+    }
+    return g_pool.thread_count;
+}
+
+/* Runs task(arg, worker, t) for every t in [0, task_count) and returns when all are done.
+   Tasks run concurrently and must only share read-only state or their worker's slot. */
+void thread_pool_run(int task_count, PoolTask task, void *arg) {
+    int workers = t_in_pool ? 1 : thread_pool_workers();
+    if (workers > 1 && task_count > 1)
+        workers = ensure_helpers(workers) + 1;
+    if (workers > task_count)
+        workers = task_count;
+    if (workers <= 1) {
+        for (int t = 0; t < task_count; t++)
+            task(arg, 0, t);
+        return;
+    }
+
+    for (int w = 0; w < workers; w++) {
+        g_pool.ranges[w].next = (int)((int64_t)task_count * w / workers);
+        g_pool.ranges[w].end = (int)((int64_t)task_count * (w + 1) / workers);
+        g_pool.ranges[w].steals = 0;
+    }
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.task = task;
+    g_pool.arg = arg;
+    g_pool.participants = workers;
+    g_pool.pending = g_pool.thread_count;
+    g_pool.generation++;
+    pthread_cond_broadcast(&g_pool.start);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    t_in_pool = true;
+    work(0);
+    t_in_pool = false;
+
+    pthread_mutex_lock(&g_pool.lock);
+    while (g_pool.pending > 0)
+        pthread_cond_wait(&g_pool.done, &g_pool.lock);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    g_pool.stats.runs++;
+    g_pool.stats.tasks += (uint64_t)task_count;
+    for (int w = 0; w < workers; w++)
+        g_pool.stats.steals += g_pool.ranges[w].steals;
+}
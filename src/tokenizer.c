@@ -1,11 +1,12 @@
 #include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
 
-#include "arraylist.h"
 #include "db.h"
 #include "logger.h"
 #include "utils.h"
@@ -24,12 +25,15 @@ static const KeywordMap keywords[] = {{"CREATE", TOKEN_KEYWORD},
                                       {"TABLE", TOKEN_KEYWORD},
                                       {"INDEX", TOKEN_KEYWORD},
                                       {"ON", TOKEN_KEYWORD},
+                                      {"USING", TOKEN_KEYWORD},
                                       {"INSERT", TOKEN_KEYWORD},
                                       {"INTO", TOKEN_KEYWORD},
                                       {"VALUES", TOKEN_KEYWORD},
                                       {"SELECT", TOKEN_KEYWORD},
                                       {"FROM", TOKEN_KEYWORD},
                                       {"DROP", TOKEN_KEYWORD},
+                                      {"ANALYZE", TOKEN_KEYWORD},
+                                      {"EXPLAIN", TOKEN_KEYWORD},
                                       {"EXIT", TOKEN_KEYWORD},
                                       {"INT", TOKEN_KEYWORD},
                                       {"INTEGER", TOKEN_KEYWORD},
@@ -39,7 +43,14 @@ static const KeywordMap keywords[] = {{"CREATE", TOKEN_KEYWORD},
                                       {"WHERE", TOKEN_KEYWORD},
                                       {"UPDATE", TOKEN_KEYWORD},
                                       {"SET", TOKEN_KEYWORD},
+                                      {"BEGIN", TOKEN_KEYWORD},
+                                      {"COMMIT", TOKEN_KEYWORD},
+                                      {"ROLLBACK", TOKEN_KEYWORD},
                                       {"DELETE", TOKEN_KEYWORD},
+                                      {"COPY", TOKEN_KEYWORD},
+                                      {"PREPARE", TOKEN_KEYWORD},
+                                      {"EXECUTE", TOKEN_KEYWORD},
+                                      {"DEALLOCATE", TOKEN_KEYWORD},
                                       {"DISTINCT", TOKEN_DISTINCT},
                                       {"TIME", TOKEN_TIME},
                                       {"DATE", TOKEN_DATE},
@@ -55,7 +66,10 @@ static const KeywordMap keywords[] = {{"CREATE", TOKEN_KEYWORD},
                                       {"LIKE", TOKEN_LIKE},
                                       {"ORDER", TOKEN_ORDER},
                                       {"BY", TOKEN_BY},
+                                      {"GROUP", TOKEN_KEYWORD},
+                                      {"HAVING", TOKEN_KEYWORD},
                                       {"LIMIT", TOKEN_KEYWORD},
+                                      {"TABLESAMPLE", TOKEN_KEYWORD},
                                       {"ASC", TOKEN_KEYWORD},
                                       {"DESC", TOKEN_KEYWORD},
                                       {"SUM", TOKEN_AGGREGATE_FUNC},
@@ -63,6 +77,11 @@ static const KeywordMap keywords[] = {{"CREATE", TOKEN_KEYWORD},
                                       {"AVG", TOKEN_AGGREGATE_FUNC},
                                       {"MIN", TOKEN_AGGREGATE_FUNC},
                                       {"MAX", TOKEN_AGGREGATE_FUNC},
+                                      {"STDDEV", TOKEN_AGGREGATE_FUNC},
+                                      {"VARIANCE", TOKEN_AGGREGATE_FUNC},
+                                      {"APPROX_COUNT_DISTINCT", TOKEN_AGGREGATE_FUNC},
+                                      {"APPROX_PERCENTILE", TOKEN_AGGREGATE_FUNC},
+                                      {"APPROX_MEDIAN", TOKEN_AGGREGATE_FUNC},
                                       {"ABS", TOKEN_SCALAR_FUNC},
                                       {"MID", TOKEN_SCALAR_FUNC},
                                       {"RIGHT", TOKEN_SCALAR_FUNC},
@@ -91,155 +110,227 @@ static const KeywordMap keywords[] = {{"CREATE", TOKEN_KEYWORD},
                                       {"JOIN", TOKEN_JOIN},
                                       {"INNER", TOKEN_INNER},
                                       {"LEFT", TOKEN_LEFT},
-                                      {"STRICT", TOKEN_STRICT}};
+                                      {"STRICT", TOKEN_STRICT},
+                                      {"STORAGE", TOKEN_KEYWORD},
+                                      {"DICTIONARY", TOKEN_KEYWORD}};
 
 static const OperatorMap operators[] = {{"==", TOKEN_EQUALS},     {"!=", TOKEN_NOT_EQUALS},
                                         {"<=", TOKEN_LESS_EQUAL}, {">=", TOKEN_GREATER_EQUAL},
                                         {"<", TOKEN_LESS},        {">", TOKEN_GREATER},
                                         {"=", TOKEN_EQUALS},      {"LIKE", TOKEN_LIKE}};
 
-static TokenType lookup_keyword(const char *str) {
-    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
-        if (strcasecmp(str, keywords[i].name) == 0) {
-            return keywords[i].type;
-        }
-    }
-    return TOKEN_IDENTIFIER;
+/* Keywords are found with a perfect hash: the first seed under which every keyword lands in a
+   slot of its own is searched once, so a lookup is one hash and at most one compare. */
+#define KEYWORD_COUNT (sizeof(keywords) / sizeof(keywords[0]))
+#define KEYWORD_SLOTS 2048
+#define KEYWORD_SEED_TRIES 65536
+
+static uint8_t keyword_slots[KEYWORD_SLOTS]; /* keyword index + 1, 0 when empty */
+static uint8_t keyword_lengths[KEYWORD_COUNT];
+static int max_keyword_length;
+static uint32_t keyword_seed;
+static bool keyword_hash_found;
+static pthread_once_t keyword_once = PTHREAD_ONCE_INIT;
+
+/* FNV-1a over the bytes with the lower-case bit cleared, which folds the case of letters. */
+static uint32_t keyword_hash(const char *str, int length, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 2654435761u);
+    for (int i = 0; i < length; i++)
+        h = (h ^ (uint8_t)(str[i] & 0xDF)) * 16777619u;
+    return (h ^ (h >> 16)) & (KEYWORD_SLOTS - 1);
 }
 
-static void add_token(ArrayList *tokens, TokenType type, const char *value) {
-    Token *token = (Token *)alist_append(tokens);
-    token->type = type;
-    strcopy(token->value, sizeof(token->value), value);
-}
-
-static int tokenize_string(const char *input, int i, ArrayList *tokens) {
-    char quote = input[i++];
-    int j = 0;
-    int len = strlen(input);
-
-    Token *token = (Token *)alist_append(tokens);
-
-    while (i < len && input[i] != quote && j < MAX_TOKEN_LEN - 1) {
-        token->value[j++] = input[i++];
+static void build_keyword_hash(void) {
+    for (size_t k = 0; k < KEYWORD_COUNT; k++) {
+        keyword_lengths[k] = (uint8_t)strlen(keywords[k].name);
+        if (keyword_lengths[k] > max_keyword_length)
+            max_keyword_length = keyword_lengths[k];
     }
-    if (i < len && input[i] == quote)
-        i++;
-
-    token->value[j] = '\0';
-
-    if (j == 10 && token->value[4] == '-' && token->value[7] == '-') {
-        bool is_date = true;
-        for (int k = 0; k < 10; k++) {
-            if (k == 4 || k == 7)
-                continue;
-            if (!isdigit(token->value[k])) {
-                is_date = false;
+    for (uint32_t seed = 0; seed < KEYWORD_SEED_TRIES; seed++) {
+        memset(keyword_slots, 0, sizeof(keyword_slots));
+        size_t k = 0;
+        for (; k < KEYWORD_COUNT; k++) {
+            uint32_t slot = keyword_hash(keywords[k].name, keyword_lengths[k], seed);
+            if (keyword_slots[slot])
                 break;
-            }
+            keyword_slots[slot] = (uint8_t)(k + 1);
         }
-        if (is_date) {
-            token->type = TOKEN_DATE;
-            return i;
+        if (k == KEYWORD_COUNT) {
+            keyword_seed = seed;
+            keyword_hash_found = true;
+            return;
         }
     }
+    log_msg(LOG_ERROR, "tokenize: No perfect hash for the keyword table, is a keyword listed "
+                       "twice? Falling back to a linear search");
+}
 
-    if (j == 8 && token->value[2] == ':' && token->value[5] == ':') {
-        bool is_time = true;
-        for (int k = 0; k < 8; k++) {
-            if (k == 2 || k == 5)
-                continue;
-            if (!isdigit(token->value[k])) {
-                is_time = false;
-                break;
-            }
-        }
-        if (is_time) {
-            token->type = TOKEN_TIME;
-            return i;
-        }
+static TokenType lookup_keyword(const char *str, int length) {
+    pthread_once(&keyword_once, build_keyword_hash);
+    if (length > max_keyword_length)
+        return TOKEN_IDENTIFIER;
+    if (!keyword_hash_found) {
+        for (size_t k = 0; k < KEYWORD_COUNT; k++)
+            if (keyword_lengths[k] == length && strncasecmp(str, keywords[k].name, length) == 0)
+                return keywords[k].type;
+        return TOKEN_IDENTIFIER;
     }
-
-    token->type = TOKEN_STRING;
-    return i;
+    int k = keyword_slots[keyword_hash(str, length, keyword_seed)] - 1;
+    if (k >= 0 && keyword_lengths[k] == length && strncasecmp(str, keywords[k].name, length) == 0)
+        return keywords[k].type;
+    return TOKEN_IDENTIFIER;
 }
 
-static int tokenize_backtick(const char *input, int i, ArrayList *tokens) {
-    char quote = input[i++];
-    int j = 0;
-    int len = strlen(input);
+/* Tokens are views of the input: where each starts and how long its text is. The text itself
+   is NUL-terminated in a pool that shares one allocation with the token array, so the parser can
+   keep treating it as a string and free_tokens stays a single free. The block is the token
+   array followed by the pool; every token's text is no longer than the input it spans, so the
+   pool never needs more than 2 * length + 2 bytes. Texts are written in token order, which is
+   how tokenize points each token at its own once lexing is done. */
+typedef struct {
+    const char *input;
+    int length;
+    Token *tokens;
+    int count;
+    int capacity;
+    size_t pool_size;
+    int pool_used;
+    bool failed;
+} Lexer;
+
+static char *lexer_pool(const Lexer *lex) {
+    return (char *)(lex->tokens + lex->capacity);
+}
 
-    Token *token = (Token *)alist_append(tokens);
+/* Doubles the token array in place and slides the pool up behind it. */
+static bool lexer_grow(Lexer *lex) {
+    int capacity = lex->capacity * 2;
+    Token *tokens = realloc(lex->tokens, (size_t)capacity * sizeof(Token) + lex->pool_size);
+    if (!tokens)
+        return false;
+    lex->tokens = tokens;
+    memmove(tokens + capacity, tokens + lex->capacity, (size_t)lex->pool_used);
+    lex->capacity = capacity;
+    return true;
+}
 
-    while (i < len && input[i] != quote && j < MAX_TOKEN_LEN - 1) {
-        token->value[j++] = input[i++];
+static void emit(Lexer *lex, TokenType type, int offset, const char *text, int length) {
+    if (lex->failed || (lex->count == lex->capacity && !lexer_grow(lex))) {
+        lex->failed = true;
+        return;
     }
-    if (i < len && input[i] == quote)
+    Token *token = &lex->tokens[lex->count++];
+    char *value = lexer_pool(lex) + lex->pool_used;
+    memcpy(value, text, (size_t)length);
+    value[length] = '\0';
+    lex->pool_used += length + 1;
+    token->type = type;
+    token->offset = offset;
+    token->length = length;
+    token->value = NULL;
+}
+
+static bool all_digits(const char *text, int length, int sep1, int sep2) {
+    for (int k = 0; k < length; k++)
+        if (k != sep1 && k != sep2 && !isdigit((unsigned char)text[k]))
+            return false;
+    return true;
+}
+
+static int tokenize_string(Lexer *lex, int i) {
+    const char *input = lex->input;
+    int start = i;
+    char quote = input[i++];
+    int text = i;
+    while (i < lex->length && input[i] != quote)
+        i++;
+    int n = i - text;
+    if (i < lex->length)
         i++;
 
-    token->value[j] = '\0';
-    token->type = TOKEN_IDENTIFIER;
+    TokenType type = TOKEN_STRING;
+    if (n == 10 && input[text + 4] == '-' && input[text + 7] == '-' &&
+        all_digits(input + text, n, 4, 7))
+        type = TOKEN_DATE;
+    else if (n == 8 && input[text + 2] == ':' && input[text + 5] == ':' &&
+             all_digits(input + text, n, 2, 5))
+        type = TOKEN_TIME;
+    emit(lex, type, start, input + text, n);
     return i;
 }
 
-static int tokenize_number(const char *input, int i, ArrayList *tokens) {
-    int j = 0;
-    bool has_dot = false;
-    int len = strlen(input);
-
-    Token *token = (Token *)alist_append(tokens);
+static int tokenize_backtick(Lexer *lex, int i) {
+    int start = i;
+    char quote = lex->input[i++];
+    int text = i;
+    while (i < lex->length && lex->input[i] != quote)
+        i++;
+    emit(lex, TOKEN_IDENTIFIER, start, lex->input + text, i - text);
+    return i < lex->length ? i + 1 : i;
+}
 
-    while (i < len && (isdigit(input[i]) || (input[i] == '.' && !has_dot)) &&
-           j < MAX_TOKEN_LEN - 1) {
-        if (input[i] == '.')
+/* Also takes the sign of a negative literal, which the caller has seen is followed by a digit. */
+static int tokenize_number(Lexer *lex, int i) {
+    int start = i;
+    bool has_dot = false;
+    if (lex->input[i] == '-')
+        i++;
+    while (i < lex->length && (isdigit((unsigned char)lex->input[i]) ||
+                               (lex->input[i] == '.' && !has_dot))) {
+        if (lex->input[i] == '.')
             has_dot = true;
-        token->value[j++] = input[i++];
+        i++;
     }
-
-    token->value[j] = '\0';
-    token->type = TOKEN_NUMBER;
+    emit(lex, TOKEN_NUMBER, start, lex->input + start, i - start);
     return i;
 }
 
-static int tokenize_identifier(const char *input, int i, ArrayList *tokens) {
-    int j = 0;
-    int len = strlen(input);
-
-    Token *token = (Token *)alist_append(tokens);
-
-    while (i < len && (isalpha(input[i]) || isdigit(input[i]) || input[i] == '_') &&
-           j < MAX_TOKEN_LEN - 1) {
-        token->value[j++] = input[i++];
-    }
-
-    token->value[j] = '\0';
-    token->type = lookup_keyword(token->value);
+static int tokenize_identifier(Lexer *lex, int i) {
+    int start = i;
+    while (i < lex->length &&
+           (isalnum((unsigned char)lex->input[i]) || lex->input[i] == '_'))
+        i++;
+    const char *text = lex->input + start;
+    emit(lex, lookup_keyword(text, i - start), start, text, i - start);
     return i;
 }
 
-static int tokenize_operator(const char *input, int i, ArrayList *tokens) {
-    int len = strlen(input);
-
+static int tokenize_operator(Lexer *lex, int i) {
+    const char *input = lex->input;
     for (size_t k = 0; k < sizeof(operators) / sizeof(operators[0]); k++) {
         int op_len = strlen(operators[k].op);
         if (strncmp(&input[i], operators[k].op, op_len) == 0) {
-            if (op_len == 2 && i + 1 < len && isalnum(input[i + 2]))
+            if (op_len == 2 && i + 1 < lex->length && isalnum((unsigned char)input[i + 2]))
                 continue;
-            add_token(tokens, operators[k].type, operators[k].op);
+            emit(lex, operators[k].type, i, operators[k].op, op_len);
             return i + op_len;
         }
     }
 
-    int j = 0;
-    Token *token = (Token *)alist_append(tokens);
-    while (i < len && is_operator_char(input[i]) && j < MAX_TOKEN_LEN - 1) {
-        token->value[j++] = input[i++];
-    }
-    token->value[j] = '\0';
-    token->type = TOKEN_OPERATOR;
+    int start = i;
+    while (i < lex->length && is_operator_char(input[i]))
+        i++;
+    emit(lex, TOKEN_OPERATOR, start, input + start, i - start);
     return i;
 }
 
+static TokenType punctuation_type(char c) {
+    switch (c) {
+    case '(':
+        return TOKEN_LPAREN;
+    case ')':
+        return TOKEN_RPAREN;
+    case ',':
+        return TOKEN_COMMA;
+    case ';':
+        return TOKEN_SEMICOLON;
+    case '?':
+        return TOKEN_PARAM;
+    default:
+        return TOKEN_ERROR;
+    }
+}
+
 Token *tokenize(const char *input) {
     if (!input) {
         log_msg(LOG_WARN, "tokenize: Called with NULL input");
@@ -248,93 +339,68 @@ Token *tokenize(const char *input) {
 
     log_msg(LOG_DEBUG, "tokenize: Tokenizing input: '%s'", input);
 
-    ArrayList tokens;
-    alist_init(&tokens, sizeof(Token), NULL);
+    Lexer lex = {input, (int)strlen(input), NULL, 0, 0, 0, 0, false};
+    int len = lex.length;
+    /* Sized for a token every few characters, so typical statements never regrow. */
+    lex.capacity = len / 4 + 8;
+    lex.pool_size = (size_t)len * 2 + 2;
+    lex.tokens = malloc((size_t)lex.capacity * sizeof(Token) + lex.pool_size);
+    if (!lex.tokens) {
+        log_msg(LOG_ERROR, "tokenize: Out of memory for %d bytes of input", len);
+        return NULL;
+    }
 
     int i = 0;
-    int len = strlen(input);
-
     while (i < len) {
-        if (isspace(input[i])) {
-            i++;
-            continue;
-        }
-
-        if (input[i] == '(') {
-            add_token(&tokens, TOKEN_LPAREN, "(");
-            i++;
-        } else if (input[i] == ')') {
-            add_token(&tokens, TOKEN_RPAREN, ")");
+        char c = input[i];
+        char next = input[i + 1];
+        if (isspace((unsigned char)c)) {
             i++;
-        } else if (input[i] == ',') {
-            add_token(&tokens, TOKEN_COMMA, ",");
+        } else if (punctuation_type(c) != TOKEN_ERROR) {
+            emit(&lex, punctuation_type(c), i, input + i, 1);
             i++;
-        } else if (input[i] == ';') {
-            add_token(&tokens, TOKEN_SEMICOLON, ";");
+        } else if (c == '.' && (isalpha((unsigned char)next) || next == '_')) {
+            emit(&lex, TOKEN_DOT, i, input + i, 1);
             i++;
-        } else if (input[i] == '\'' || input[i] == '"') {
-            i = tokenize_string(input, i, &tokens);
-        } else if (input[i] == '`') {
-            i = tokenize_backtick(input, i, &tokens);
-        } else if (input[i] == '-' && input[i + 1] == '-') {
-            while (i < len && input[i] != '\n' && input[i] != '\r') {
+        } else if (c == '\'' || c == '"') {
+            i = tokenize_string(&lex, i);
+        } else if (c == '`') {
+            i = tokenize_backtick(&lex, i);
+        } else if (c == '-' && next == '-') {
+            while (i < len && input[i] != '\n' && input[i] != '\r')
                 i++;
-            }
-        } else if (input[i] == '/' && input[i + 1] == '*') {
-            i += 2;
-            while (i < len && !(input[i] == '*' && input[i + 1] == '/')) {
-                i++;
-            }
-            if (i < len && input[i] == '*' && input[i + 1] == '/') {
-                i += 2;
-            }
-        } else if (input[i] == '-' &&
-                   (isdigit(input[i + 1]) || (input[i + 1] == '.' && isdigit(input[i + 2])))) {
-            char neg_value[32];
-            int j = 1;
-            len = strlen(input);
-            bool has_dot = false;
-
-            neg_value[0] = '-';
-            i++;
-
-            while (i < len && (isdigit(input[i]) || (input[i] == '.' && !has_dot)) && j < 30) {
-                if (input[i] == '.')
-                    has_dot = true;
-                neg_value[j++] = input[i++];
-            }
-            neg_value[j] = '\0';
-
-            Token *token = (Token *)alist_append(&tokens);
-            strcopy(token->value, sizeof(token->value), neg_value);
-            token->type = TOKEN_NUMBER;
-        } else if (isdigit(input[i]) || (input[i] == '.' && isdigit(input[i + 1]))) {
-            i = tokenize_number(input, i, &tokens);
-        } else if (is_operator_char(input[i])) {
-            i = tokenize_operator(input, i, &tokens);
-        } else if (isalpha(input[i]) || input[i] == '_') {
-            i = tokenize_identifier(input, i, &tokens);
+        } else if (c == '/' && next == '*') {
+            const char *end = strstr(input + i + 2, "*/");
+            i = end ? (int)(end - input) + 2 : len;
+        } else if (isdigit((unsigned char)c) || (c == '.' && isdigit((unsigned char)next)) ||
+                   (c == '-' && (isdigit((unsigned char)next) ||
+                                 (next == '.' && isdigit((unsigned char)input[i + 2]))))) {
+            i = tokenize_number(&lex, i);
+        } else if (is_operator_char(c)) {
+            i = tokenize_operator(&lex, i);
+        } else if (isalpha((unsigned char)c) || c == '_') {
+            i = tokenize_identifier(&lex, i);
         } else {
-            Token *token = (Token *)alist_append(&tokens);
-            token->type = TOKEN_ERROR;
-            token->value[0] = input[i];
-            token->value[1] = '\0';
+            emit(&lex, TOKEN_ERROR, i, input + i, 1);
             i++;
         }
     }
 
-    add_token(&tokens, TOKEN_EOF, "");
+    emit(&lex, TOKEN_EOF, len, "", 0);
 
-    log_msg(LOG_DEBUG, "tokenize: Tokenization completed: %d tokens generated",
-            alist_length(&tokens));
+    if (lex.failed) {
+        log_msg(LOG_ERROR, "tokenize: Out of memory for %d tokens", lex.count);
+        free(lex.tokens);
+        return NULL;
+    }
+    log_msg(LOG_DEBUG, "tokenize: Tokenization completed: %d tokens generated", lex.count);
 
-    int token_count = alist_length(&tokens);
-    Token *result = realloc(tokens.data, token_count * sizeof(Token));
-    if (!result)
-        result = tokens.data;
-    tokens.data = NULL;
-    alist_destroy(&tokens);
-    return result;
+    const char *text = lexer_pool(&lex);
+    for (int t = 0; t < lex.count; t++) {
+        lex.tokens[t].value = text;
+        text += lex.tokens[t].length + 1;
+    }
+    return lex.tokens;
 }
 
 void free_tokens(Token *tokens) {
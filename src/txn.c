@@ -0,0 +1,538 @@
+#include "txn.h"
+
+#include <stdlib.h>
+
+#include "arraylist.h"
+#include "executor.h"
+#include "logger.h"
+#include "storage.h"
+#include "table.h"
+#include "utils.h"
+
+/* A row written by a transaction; its stamps tell whether it was inserted or deleted. */
+typedef struct {
+    uint16_t table_id;
+    int row_idx;
+} TxnWrite;
+
+struct Transaction {
+    uint64_t id;
+    uint64_t snapshot; /* clock at BEGIN */
+    ArrayList writes;  /* TxnWrite, in write order */
+    Transaction *next; /* in the open list */
+};
+
+typedef struct {
+    uint64_t clock;
+    uint64_t next_id;
+    Transaction *open;       /* explicit transactions, newest first */
+    Transaction *writer;     /* the one holding uncommitted changes, if any */
+    Transaction autocommit;  /* a statement outside BEGIN that writes row versions */
+    bool autocommit_active;
+    bool collect;            /* versions may have become reclaimable */
+    Snapshot snapshot;       /* what the running statement reads */
+    TxnStats stats;
+} TxnManager;
+
+#define SNAPSHOT_LATEST (TXN_PENDING - 1)
+
+static TxnManager g_txn = {.snapshot = {SNAPSHOT_LATEST, 0}};
+static _Thread_local Transaction *t_current;
+
+static uint64_t pending_stamp(const Transaction *txn) {
+    return TXN_PENDING | txn->id;
+}
+
+/* Statements outside a transaction read the latest commits; the executor runs one
+   statement at a time, so nothing commits while they run. */
+static void set_snapshot(const Transaction *txn) {
+    g_txn.snapshot.ts = txn ? txn->snapshot : SNAPSHOT_LATEST;
+    g_txn.snapshot.self = txn ? pending_stamp(txn) : 0;
+}
+
+/* Row stamps. */
+
+static bool row_versions_reserve(Table *table, int count) {
+    RowVersions *versions = table->versions;
+    if (count <= versions->capacity)
+        return true;
+    int capacity = versions->capacity > 0 ? versions->capacity * 2 : 64;
+    while (capacity < count)
+        capacity *= 2;
+    uint64_t *begin = realloc(versions->begin, sizeof(uint64_t) * (size_t)capacity);
+    if (begin)
+        versions->begin = begin;
+    uint64_t *end = begin ? realloc(versions->end, sizeof(uint64_t) * (size_t)capacity) : NULL;
+    if (!end) {
+        log_msg(LOG_ERROR, "row_versions_reserve: Failed to grow the stamps of '%s'",
+                table->name);
+        return false;
+    }
+    versions->end = end;
+    versions->capacity = capacity;
+    return true;
+}
+
+/* Stamps every existing row as visible to everyone. */
+static bool row_versions_init(Table *table) {
+    table->versions = calloc(1, sizeof(RowVersions));
+    int row_count = table_row_count(table);
+    if (!table->versions || !row_versions_reserve(table, row_count + 1)) {
+        row_versions_free(table);
+        log_msg(LOG_ERROR, "row_versions_init: Failed to version table '%s'", table->name);
+        return false;
+    }
+    for (int i = 0; i < row_count; i++) {
+        table->versions->begin[i] = 0;
+        table->versions->end[i] = TXN_INFINITY;
+    }
+    return true;
+}
+
+/* Called by table_append_row: the new row starts out visible to everyone. */
+void row_versions_append(Table *table) {
+    int row = table_row_count(table) - 1;
+    if (!table->versions || !row_versions_reserve(table, row + 1))
+        return;
+    table->versions->begin[row] = 0;
+    table->versions->end[row] = TXN_INFINITY;
+}
+
+void row_versions_compact(Table *table, const bool *keep) {
+    RowVersions *versions = table->versions;
+    if (!versions)
+        return;
+    int old_count = table_row_count(table);
+    int dst = 0;
+    for (int i = 0; i < old_count; i++) {
+        if (!keep[i])
+            continue;
+        versions->begin[dst] = versions->begin[i];
+        versions->end[dst] = versions->end[i];
+        dst++;
+    }
+}
+
+void row_versions_free(Table *table) {
+    if (!table->versions)
+        return;
+    free(table->versions->begin);
+    free(table->versions->end);
+    free(table->versions);
+    table->versions = NULL;
+}
+
+/* Visibility. */
+
+static bool version_visible(const Snapshot *snap, uint64_t begin, uint64_t end) {
+    bool born = begin <= snap->ts || begin == snap->self;
+    bool dead = end <= snap->ts || end == snap->self;
+    return born && !dead;
+}
+
+const Snapshot *txn_snapshot(void) {
+    return &g_txn.snapshot;
+}
+
+bool table_row_visible(const Table *table, int row_idx) {
+    const RowVersions *versions = table->versions;
+    if (table_row_deleted(table, row_idx))
+        return false;
+    return !versions ||
+           version_visible(&g_txn.snapshot, versions->begin[row_idx], versions->end[row_idx]);
+}
+
+/* Whether the row is part of the latest state, as constraint checks must see it: committed
+   or written by the running writer, and not deleted by either. */
+bool table_row_live(const Table *table, int row_idx) {
+    const RowVersions *versions = table->versions;
+    if (table_row_deleted(table, row_idx))
+        return false;
+    if (!versions)
+        return true;
+    uint64_t begin = versions->begin[row_idx];
+    return (begin < TXN_PENDING || begin == g_txn.snapshot.self) &&
+           versions->end[row_idx] == TXN_INFINITY;
+}
+
+/* Compacts sel[0..n) to the rows the running statement can see and returns their count. */
+int table_visible_rows(const Table *table, int *sel, int n) {
+    const RowVersions *versions = table->versions;
+    if (!versions && !table->tombstones)
+        return n;
+    const Snapshot *snap = &g_txn.snapshot;
+    int count = 0;
+    for (int k = 0; k < n; k++) {
+        int row = sel[k];
+        sel[count] = row;
+        count += !table_row_deleted(table, row) &&
+                 (!versions || version_visible(snap, versions->begin[row], versions->end[row]));
+    }
+    return count;
+}
+
+/* Garbage collection. */
+
+static uint64_t oldest_snapshot(void) {
+    uint64_t oldest = g_txn.clock;
+    for (const Transaction *txn = g_txn.open; txn; txn = txn->next)
+        if (txn->snapshot < oldest)
+            oldest = txn->snapshot;
+    return oldest;
+}
+
+/* Removes the versions deleted before the oldest open snapshot and those of rolled back
+   inserts, and drops the stamps of tables whose rows every snapshot sees. Row numbers move,
+   so this only runs between statements and while no transaction has uncommitted changes. */
+static void collect_versions(void) {
+    if (!g_txn.collect || g_txn.writer)
+        return;
+    g_txn.collect = false;
+    uint64_t horizon = oldest_snapshot();
+    for (int t = 0; t < alist_length(&tables); t++) {
+        Table *table = (Table *)alist_get(&tables, t);
+        RowVersions *versions = table->versions;
+        if (!versions)
+            continue;
+        int row_count = table_row_count(table);
+        int dead = 0;
+        bool settled = true;
+        for (int i = 0; i < row_count; i++) {
+            bool gone = versions->end[i] <= horizon || versions->begin[i] == TXN_INFINITY;
+            dead += gone;
+            settled &= gone || (versions->begin[i] <= horizon && versions->end[i] == TXN_INFINITY);
+        }
+        if (dead > 0) {
+            bool *keep = malloc(sizeof(bool) * (size_t)row_count);
+            if (!keep) {
+                log_msg(LOG_ERROR, "collect_versions: Failed to allocate row mask");
+                g_txn.collect = true;
+                return;
+            }
+            for (int i = 0; i < row_count; i++)
+                keep[i] = !(versions->end[i] <= horizon || versions->begin[i] == TXN_INFINITY);
+            table_compact_rows(table, keep);
+            free(keep);
+            g_txn.stats.reclaimed += (uint64_t)dead;
+            log_msg(LOG_DEBUG, "collect_versions: Removed %d dead versions from '%s'", dead,
+                    table->name);
+        }
+        if (settled)
+            row_versions_free(table);
+    }
+}
+
+/* Commit and rollback. */
+
+/* The log holds the committed rows without their versions, so a commit is logged as the
+   committed rows it deleted, numbered as the log knows them, then the rows it inserted,
+   which sit after every committed row since there is only one writer at a time. */
+static void log_table_commit(const Transaction *txn, Table *table) {
+    const RowVersions *versions = table->versions;
+    uint64_t self = pending_stamp(txn);
+    int row_count = table_row_count(table);
+    bool deletes = false;
+    for (int w = 0; w < alist_length(&txn->writes) && !deletes; w++) {
+        const TxnWrite *write = (const TxnWrite *)alist_get(&txn->writes, w);
+        deletes = write->table_id == table->table_id && versions->end[write->row_idx] == self &&
+                  versions->begin[write->row_idx] < TXN_PENDING;
+    }
+    if (deletes) {
+        bool *keep = malloc(sizeof(bool) * (size_t)(row_count > 0 ? row_count : 1));
+        if (!keep) {
+            log_msg(LOG_ERROR, "log_table_commit: Failed to allocate row mask");
+            return;
+        }
+        int committed = 0;
+        for (int i = 0; i < row_count; i++) {
+            if (versions->begin[i] >= TXN_PENDING || versions->end[i] < TXN_PENDING)
+                continue;
+            keep[committed++] = versions->end[i] != self;
+        }
+        wal_log_delete(table, keep, committed);
+        free(keep);
+    }
+    for (int w = 0; w < alist_length(&txn->writes); w++) {
+        const TxnWrite *write = (const TxnWrite *)alist_get(&txn->writes, w);
+        if (write->table_id == table->table_id && versions->begin[write->row_idx] == self &&
+            versions->end[write->row_idx] != self)
+            wal_log_insert(table, write->row_idx);
+    }
+}
+
+static void commit_writes(Transaction *txn) {
+    int write_count = alist_length(&txn->writes);
+    if (write_count == 0)
+        return;
+    if (storage_is_open()) {
+        bool logged[256] = {false};
+        for (int w = 0; w < write_count; w++) {
+            const TxnWrite *write = (const TxnWrite *)alist_get(&txn->writes, w);
+            Table *table = get_table_by_id(write->table_id);
+            if (table && table->versions && !logged[write->table_id])
+                log_table_commit(txn, table);
+            logged[write->table_id] = true;
+        }
+    }
+
+    uint64_t self = pending_stamp(txn);
+    uint64_t ts = ++g_txn.clock;
+    for (int w = 0; w < write_count; w++) {
+        const TxnWrite *write = (const TxnWrite *)alist_get(&txn->writes, w);
+        Table *table = get_table_by_id(write->table_id);
+        if (!table || !table->versions)
+            continue;
+        RowVersions *versions = table->versions;
+        bool inserted = versions->begin[write->row_idx] == self;
+        bool deleted = versions->end[write->row_idx] == self;
+        if (inserted)
+            versions->begin[write->row_idx] = ts;
+        if (deleted) {
+            versions->end[write->row_idx] = ts;
+            g_txn.collect = true;
+        }
+        /* A row both added and ended by the transaction never showed. */
+        if (inserted != deleted)
+            matview_row_committed(table, write->row_idx, inserted);
+    }
+    alist_clear(&txn->writes);
+    g_txn.writer = NULL;
+    g_txn.stats.commits++;
+    g_txn.stats.clock = g_txn.clock;
+}
+
+/* Undone newest first, so a row inserted and deleted again ends up rolled back. */
+/* Undoes the writes of txn from the mark-th on, newest first. */
+static void rollback_writes_from(Transaction *txn, int mark) {
+    uint64_t self = pending_stamp(txn);
+    for (int w = alist_length(&txn->writes) - 1; w >= mark; w--) {
+        const TxnWrite *write = (const TxnWrite *)alist_get(&txn->writes, w);
+        Table *table = get_table_by_id(write->table_id);
+        if (!table || !table->versions)
+            continue;
+        RowVersions *versions = table->versions;
+        if (versions->end[write->row_idx] == self) {
+            versions->end[write->row_idx] = TXN_INFINITY;
+        } else if (versions->begin[write->row_idx] == self) {
+            versions->begin[write->row_idx] = TXN_INFINITY;
+            versions->end[write->row_idx] = 0;
+        }
+    }
+    if (alist_length(&txn->writes) > mark)
+        g_txn.collect = true;
+    txn->writes.length = mark;
+    if (mark == 0 && g_txn.writer == txn)
+        g_txn.writer = NULL;
+}
+
+static void rollback_writes(Transaction *txn) {
+    rollback_writes_from(txn, 0);
+}
+
+static void close_transaction(Transaction *txn) {
+    for (Transaction **link = &g_txn.open; *link; link = &(*link)->next) {
+        if (*link == txn) {
+            *link = txn->next;
+            break;
+        }
+    }
+    if (t_current == txn)
+        t_current = NULL;
+    alist_destroy(&txn->writes);
+    free(txn);
+    g_txn.stats.open--;
+    g_txn.collect = true;
+    set_snapshot(t_current);
+    collect_versions();
+}
+
+bool txn_begin(void) {
+    if (t_current) {
+        log_msg(LOG_ERROR, "BEGIN: A transaction is already open");
+        return false;
+    }
+    Transaction *txn = calloc(1, sizeof(Transaction));
+    if (!txn) {
+        log_msg(LOG_ERROR, "BEGIN: Failed to allocate the transaction");
+        return false;
+    }
+    txn->id = ++g_txn.next_id;
+    txn->snapshot = g_txn.clock;
+    alist_init(&txn->writes, sizeof(TxnWrite), NULL);
+    txn->next = g_txn.open;
+    g_txn.open = txn;
+    g_txn.stats.open++;
+    t_current = txn;
+    set_snapshot(txn);
+    log_msg(LOG_INFO, "Transaction %llu started at snapshot %llu", (unsigned long long)txn->id,
+            (unsigned long long)txn->snapshot);
+    return true;
+}
+
+bool txn_commit(void) {
+    Transaction *txn = t_current;
+    if (!txn) {
+        log_msg(LOG_WARN, "COMMIT: No transaction is open");
+        return false;
+    }
+    int write_count = alist_length(&txn->writes);
+    commit_writes(txn);
+    log_msg(LOG_INFO, "Transaction %llu committed %d row changes", (unsigned long long)txn->id,
+            write_count);
+    close_transaction(txn);
+    return true;
+}
+
+bool txn_rollback(void) {
+    Transaction *txn = t_current;
+    if (!txn) {
+        log_msg(LOG_WARN, "ROLLBACK: No transaction is open");
+        return false;
+    }
+    int write_count = alist_length(&txn->writes);
+    rollback_writes(txn);
+    g_txn.stats.rollbacks++;
+    log_msg(LOG_INFO, "Transaction %llu rolled back %d row changes", (unsigned long long)txn->id,
+            write_count);
+    close_transaction(txn);
+    return true;
+}
+
+Transaction *txn_current(void) {
+    return t_current;
+}
+
+/* A statement that fails part way takes back its own writes: it notes txn_write_mark
+   before writing and hands it to txn_rollback_to, leaving the transaction's earlier writes. */
+int txn_write_mark(const Transaction *txn) {
+    return alist_length(&txn->writes);
+}
+
+void txn_rollback_to(Transaction *txn, int mark) {
+    rollback_writes_from(txn, mark);
+}
+
+/* Sessions: a caller serving several clients detaches one client's transaction and attaches
+   another's between statements. */
+Transaction *txn_detach(void) {
+    Transaction *txn = t_current;
+    t_current = NULL;
+    set_snapshot(NULL);
+    return txn;
+}
+
+void txn_attach(Transaction *txn) {
+    t_current = txn;
+    set_snapshot(txn);
+}
+
+/* Rolls back every open transaction, e.g. before the final checkpoint. */
+void txn_shutdown(void) {
+    while (g_txn.open) {
+        Transaction *txn = g_txn.open;
+        rollback_writes(txn);
+        g_txn.stats.rollbacks++;
+        close_transaction(txn);
+    }
+    collect_versions();
+}
+
+void txn_get_stats(TxnStats *stats) {
+    *stats = g_txn.stats;
+}
+
+/* Statements. */
+
+void txn_statement_begin(void) {
+    set_snapshot(t_current);
+}
+
+/* Commits what a statement outside BEGIN wrote as row versions, then reclaims versions. */
+void txn_statement_end(void) {
+    if (g_txn.autocommit_active) {
+        commit_writes(&g_txn.autocommit);
+        alist_destroy(&g_txn.autocommit.writes);
+        g_txn.autocommit_active = false;
+        set_snapshot(t_current);
+    }
+    collect_versions();
+}
+
+/* Decides how a statement writes table. *writer is NULL when it may change rows in place,
+   because no open snapshot could tell; otherwise the statement writes row versions for
+   *writer. Fails when another transaction holds uncommitted changes. */
+bool txn_write_access(Table *table, Transaction **writer) {
+    *writer = NULL;
+    Transaction *txn = t_current;
+    if (!txn && !g_txn.open && !table->versions && !g_txn.autocommit_active)
+        return true;
+    if (!txn) {
+        txn = &g_txn.autocommit;
+        if (!g_txn.autocommit_active) {
+            txn->id = ++g_txn.next_id;
+            txn->snapshot = g_txn.clock;
+            alist_init(&txn->writes, sizeof(TxnWrite), NULL);
+            g_txn.autocommit_active = true;
+        }
+    }
+    if (g_txn.writer && g_txn.writer != txn) {
+        g_txn.stats.conflicts++;
+        log_msg(LOG_ERROR, "Table '%s' is locked by transaction %llu, which has uncommitted "
+                "changes", table->name, (unsigned long long)g_txn.writer->id);
+        return false;
+    }
+    if (!table->versions && !row_versions_init(table))
+        return false;
+    g_txn.writer = txn;
+    g_txn.snapshot.self = pending_stamp(txn);
+    *writer = txn;
+    return true;
+}
+
+static bool record_write(Transaction *txn, const Table *table, int row_idx) {
+    TxnWrite *write = (TxnWrite *)alist_append(&txn->writes);
+    if (!write) {
+        log_msg(LOG_ERROR, "record_write: Failed to record a change to '%s'", table->name);
+        return false;
+    }
+    write->table_id = table->table_id;
+    write->row_idx = row_idx;
+    return true;
+}
+
+/* Appends row as a version only txn sees until it commits. Takes ownership of row. */
+bool txn_insert_row(Transaction *txn, Table *table, Row *row) {
+    int row_idx = table_row_count(table);
+    if (!row_versions_reserve(table, row_idx + 1) || !table_append_row(table, row))
+        return false;
+    table->versions->begin[row_idx] = pending_stamp(txn);
+    if (!record_write(txn, table, row_idx)) {
+        table->versions->begin[row_idx] = TXN_INFINITY;
+        table->versions->end[row_idx] = 0;
+        g_txn.collect = true;
+        return false;
+    }
+    return true;
+}
+
+/* Ends the version row_idx for everyone who starts after txn commits. The row must be
+   visible to txn; if a later commit already ended it, the change would be lost, so this
+   fails with a serialization error instead. */
+bool txn_delete_row(Transaction *txn, Table *table, int row_idx) {
+    RowVersions *versions = table->versions;
+    if (versions->end[row_idx] != TXN_INFINITY) {
+        g_txn.stats.conflicts++;
+        log_msg(LOG_ERROR, "Could not serialize access to '%s': row changed by a concurrent "
+                "transaction", table->name);
+        return false;
+    }
+    if (!record_write(txn, table, row_idx))
+        return false;
+    versions->end[row_idx] = pending_stamp(txn);
+    return true;
+}
+
+/* True while some snapshot may still see row versions of table. */
+bool txn_table_busy(const Table *table) {
+    return table->versions != NULL;
+}
@@ -1,5 +1,6 @@
 #include "values.h"
 
+#include <ctype.h>
 #include <limits.h>
 #include <math.h>
 #include <stdio.h>
@@ -8,6 +9,7 @@
 
 #include "db.h"
 #include "logger.h"
+#include "sketch.h"
 #include "utils.h"
 #include "table.h"
 
@@ -32,6 +34,59 @@ int date_month(unsigned int date_val) {
 int date_day(unsigned int date_val) {
     return date_val & 0x1F;
 }
+unsigned int make_time(int hour, int minute, int second) {
+    return ((hour & 0xFF) << 12) | ((minute & 0x3F) << 6) | (second & 0x3F);
+}
+unsigned int make_date(int year, int month, int day) {
+    return ((year & 0x3FFFFF) << 9) | ((month & 0xF) << 5) | (day & 0x1F);
+}
+
+bool parse_date_literal(const char *value, int *year, int *month, int *day) {
+    if (!value || !year || !month || !day) {
+        return false;
+    }
+    if (strlen(value) != 10 || value[4] != '-' || value[7] != '-') {
+        return false;
+    }
+    for (int i = 0; i < 10; i++) {
+        if (i == 4 || i == 7)
+            continue;
+        if (!isdigit((unsigned char)value[i])) {
+            return false;
+        }
+    }
+    *year =
+        (value[0] - '0') * 1000 + (value[1] - '0') * 100 + (value[2] - '0') * 10 + (value[3] - '0');
+    *month = (value[5] - '0') * 10 + (value[6] - '0');
+    *day = (value[8] - '0') * 10 + (value[9] - '0');
+    if (*month < 1 || *month > 12 || *day < 1 || *day > 31) {
+        return false;
+    }
+    return true;
+}
+
+bool parse_time_literal(const char *value, int *hour, int *minute, int *second) {
+    if (!value || !hour || !minute || !second) {
+        return false;
+    }
+    if (strlen(value) != 8 || value[2] != ':' || value[5] != ':') {
+        return false;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (i == 2 || i == 5)
+            continue;
+        if (!isdigit((unsigned char)value[i])) {
+            return false;
+        }
+    }
+    *hour = (value[0] - '0') * 10 + (value[1] - '0');
+    *minute = (value[3] - '0') * 10 + (value[4] - '0');
+    *second = (value[6] - '0') * 10 + (value[7] - '0');
+    if (*hour < 0 || *hour > 23 || *minute < 0 || *minute > 59 || *second < 0 || *second > 59) {
+        return false;
+    }
+    return true;
+}
 
 bool is_null(const Value *val) {
     if (!val)
@@ -43,55 +98,74 @@ bool is_null(const Value *val) {
     return val->type == TYPE_NULL;
 }
 
-const char *repr(const Value *val) {
-    static char buffer[MAX_STRING_LEN];
+/* An owned string value: short strings are stored inline, longer ones on the heap. */
+Value make_string_value(const char *str) {
+    Value val = {0};
+    val.type = TYPE_STRING;
+    size_t len = strlen(str);
+    if (len <= VALUE_INLINE_STR_LEN) {
+        val.str_format = VALUE_STR_INLINE;
+        memcopy(val.inline_str, str, len + 1);
+        return val;
+    }
+    val.char_val = malloc(len + 1);
+    if (val.char_val)
+        memcopy(val.char_val, str, len + 1);
+    return val;
+}
 
+const char *repr_into(const Value *val, char *buffer, size_t size) {
     if (!val || is_null(val)) {
-        strcopy(buffer, sizeof(buffer), "NULL");
+        strcopy(buffer, size, "NULL");
         return buffer;
     }
 
     switch (val->type) {
     case TYPE_INT:
-        string_format(buffer, sizeof(buffer), "%lld", (long long)val->int_val);
+        string_format(buffer, size, "%lld", (long long)val->int_val);
         break;
     case TYPE_FLOAT:
-        string_format(buffer, sizeof(buffer), "%.2f", val->float_val);
+        string_format(buffer, size, "%.2f", val->float_val);
         break;
     case TYPE_BOOLEAN:
-        strcopy(buffer, sizeof(buffer), val->bool_val ? "TRUE" : "FALSE");
+        strcopy(buffer, size, val->bool_val ? "TRUE" : "FALSE");
         break;
     case TYPE_DECIMAL: {
         int scale = val->decimal_val.scale > 0 ? val->decimal_val.scale : 2;
         double d = (double)val->decimal_val.value / (double)pow(10, scale);
-        string_format(buffer, sizeof(buffer), "%.2f", d);
+        string_format(buffer, size, "%.2f", d);
         break;
     }
     case TYPE_BLOB:
-        string_format(buffer, sizeof(buffer), "<BLOB:%zu bytes>", val->blob_val.length);
+        string_format(buffer, size, "<BLOB:%zu bytes>", val->blob_val.length);
         break;
     case TYPE_STRING:
-        strcopy(buffer, sizeof(buffer), val->char_val);
+        strcopy(buffer, size, value_str(val));
         break;
     case TYPE_TIME:
-        string_format(buffer, sizeof(buffer), "%02d:%02d:%02d", time_hour(val->time_val),
+        string_format(buffer, size, "%02d:%02d:%02d", time_hour(val->time_val),
                       time_minute(val->time_val), time_second(val->time_val));
         break;
     case TYPE_DATE:
-        string_format(buffer, sizeof(buffer), "%04d-%02d-%02d", date_year(val->date_val),
+        string_format(buffer, size, "%04d-%02d-%02d", date_year(val->date_val),
                       date_month(val->date_val), date_day(val->date_val));
         break;
     case TYPE_ERROR:
-        strcopy(buffer, sizeof(buffer), "ERROR");
+        strcopy(buffer, size, "ERROR");
         break;
     default:
-        strcopy(buffer, sizeof(buffer), "UNKNOWN");
+        strcopy(buffer, size, "UNKNOWN");
         break;
     }
 
     return buffer;
 }
 
+const char *repr(const Value *val) {
+    static char buffer[MAX_STRING_LEN];
+    return repr_into(val, buffer, sizeof(buffer));
+}
+
 static int compare_numeric(double left_val, double right_val) {
     if (left_val < right_val)
         return -1;
@@ -157,7 +231,10 @@ static int compare_values_local(const Value *left, const Value *right) {
     }
 
     if (left->type == TYPE_STRING && right->type == TYPE_STRING) {
-        return strcmp(left->char_val, right->char_val);
+        if (left->str_format == VALUE_STR_INTERNED && right->str_format == VALUE_STR_INTERNED &&
+            left->char_val == right->char_val)
+            return 0;
+        return strcmp(value_str(left), value_str(right));
     }
 
     /* Dates and time are stored as integers, where later datetimes are always larger
@@ -183,51 +260,18 @@ static int compare_values_local(const Value *left, const Value *right) {
 
 /* LIKE pattern matching */
 static bool eval_like_expression(const Value *left, const Value *right) {
-    if (right->type != TYPE_STRING) {
-        log_msg(LOG_ERROR, "Right hand side of LIKE expression (expected: %s, got: %s)",
-                TYPE_STRING, right->type);
-        return false;
-    }
-
     if (is_null(left) || is_null(right))
         return false;
-
-    const char *text = repr(left);
-    const char *pattern = right->char_val;
-    const char *p = pattern;
-    bool match = true;
-
-    while (*p && *text) {
-        if (*p == '%' || *p == '*') {
-            p++;
-            while (*text && *text != *p)
-                text++;
-        } else if (*p == '_' || *p == '?') {
-            p++;
-            text++;
-        } else if (*p == '\\') {
-            p++;
-            text++;
-        } else {
-            if (*text == *p) {
-                p++;
-                text++;
-            } else {
-                match = false;
-                break;
-            }
-        }
-    }
-
-    while (match && (*p == '%' || *p == '*')) {
-        p++;
+    if (right->type != TYPE_STRING) {
+        log_msg(LOG_ERROR, "Right hand side of LIKE expression must be a string");
+        return false;
     }
-
-    match = match && (*p == '\0' && *text == '\0');
-    return match;
+    return like_match_pattern(left, value_str(right));
 }
 
 bool eval_comparison(Value left, Value right, OperatorType op) {
+    if (is_null(&left) || is_null(&right))
+        return false;
     int cmp = compare_values_local(&left, &right);
     switch (op) {
     case OP_EQUALS:
@@ -244,6 +288,8 @@ bool eval_comparison(Value left, Value right, OperatorType op) {
         return cmp >= 0;
     case OP_LIKE:
         return eval_like_expression(&left, &right);
+    case OP_NOT_LIKE:
+        return right.type == TYPE_STRING && !eval_like_expression(&left, &right);
     default:
         return false;
     }
@@ -292,6 +338,14 @@ Value compute_aggregate(AggFuncType func_type, AggState *state, DataType return_
         } else {
             return state->data.max.max_val;
         }
+    } else if (func_type == FUNC_VARIANCE || func_type == FUNC_STDDEV) {
+        if (state->count < 2) {
+            return VAL_NULL;
+        }
+        double variance = state->m2 / (state->count - 1);
+        result.type = TYPE_FLOAT;
+        result.float_val = func_type == FUNC_STDDEV ? sqrt(variance) : variance;
+        return result;
     }
 
     return VAL_ERROR;
@@ -299,7 +353,13 @@ Value compute_aggregate(AggFuncType func_type, AggState *state, DataType return_
 
 void agg_init(AggState *state, AggFuncType func_type, bool distinct) {
     state->sum = 0.0;
+    state->mean = 0.0;
+    state->m2 = 0.0;
+    state->int_sum = 0;
+    state->has_float = false;
+    state->int_overflow = false;
     state->count = 0;
+    state->sketch = sketch_function(func_type) ? sketch_create(func_type) : NULL;
 
     if (distinct) {
         state->type = AGG_DISTINCT;
@@ -334,21 +394,70 @@ void agg_add_value(AggState *state, Value *value) {
     }
 
     state->count++;
-    if (value->type == TYPE_INT) {
-        state->sum += value->int_val;
-    } else if (value->type == TYPE_FLOAT) {
-        state->sum += value->float_val;
+    if (state->sketch && !sketch_add(state->sketch, value))
+        log_msg(LOG_ERROR, "agg_add_value: Out of memory for the sketch");
+    if (value->type == TYPE_INT || value->type == TYPE_FLOAT) {
+        double x = value->type == TYPE_INT ? (double)value->int_val : value->float_val;
+        double delta = x - state->mean;
+        state->sum += x;
+        state->mean += delta / state->count;
+        state->m2 += delta * (x - state->mean);
+        if (value->type == TYPE_FLOAT)
+            state->has_float = true;
+        else if (__builtin_add_overflow(state->int_sum, value->int_val, &state->int_sum))
+            state->int_overflow = true;
     }
 
-    if (state->type == AGG_MIN && !state->data.min.has_min) {
+    if (state->type == AGG_MIN && (!state->data.min.has_min ||
+                                   compare_values(value, &state->data.min.min_val) < 0)) {
+        if (state->data.min.has_min)
+            free_value(&state->data.min.min_val);
         state->data.min.min_val = copy_value(value);
         state->data.min.has_min = true;
-    } else if (state->type == AGG_MAX && !state->data.max.has_max) {
+    } else if (state->type == AGG_MAX && (!state->data.max.has_max ||
+                                          compare_values(value, &state->data.max.max_val) > 0)) {
+        if (state->data.max.has_max)
+            free_value(&state->data.max.max_val);
         state->data.max.max_val = copy_value(value);
         state->data.max.has_max = true;
     }
 }
 
+/* Takes a value agg_add_value added back out, running the Welford update in reverse. Fails
+   when what is left cannot be known from the state: a DISTINCT set, a sketch, or the MIN or
+   MAX itself being removed. */
+bool agg_remove_value(AggState *state, const Value *value) {
+    if (is_null(value))
+        return true;
+    if (state->type == AGG_DISTINCT || state->sketch || state->count == 0)
+        return false;
+    if (state->type == AGG_MIN && compare_values(value, &state->data.min.min_val) <= 0)
+        return false;
+    if (state->type == AGG_MAX && compare_values(value, &state->data.max.max_val) >= 0)
+        return false;
+
+    state->count--;
+    if (value->type == TYPE_INT || value->type == TYPE_FLOAT) {
+        double x = value->type == TYPE_INT ? (double)value->int_val : value->float_val;
+        state->sum -= x;
+        /* An overflow stays: the exact sum is lost once it happened. */
+        if (value->type == TYPE_INT &&
+            __builtin_sub_overflow(state->int_sum, value->int_val, &state->int_sum))
+            state->int_overflow = true;
+        if (state->count == 0) {
+            state->mean = 0.0;
+            state->m2 = 0.0;
+        } else {
+            double delta = x - state->mean;
+            state->mean -= delta / state->count;
+            state->m2 -= delta * (x - state->mean);
+            if (state->m2 < 0.0)
+                state->m2 = 0.0;
+        }
+    }
+    return true;
+}
+
 Value agg_get_result(AggState *state) {
     Value result = {0};
 
@@ -379,6 +488,8 @@ Value agg_get_result(AggState *state) {
 }
 
 void agg_cleanup(AggState *state) {
+    sketch_free(state->sketch);
+    state->sketch = NULL;
     if (state->type == AGG_DISTINCT) {
         for (int i = 0; i < state->data.distinct.seen_values.length; i++) {
             Value *val = alist_get(&state->data.distinct.seen_values, i);
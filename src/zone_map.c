@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arraylist.h"
+#include "db.h"
+#include "logger.h"
+#include "table.h"
+#include "utils.h"
+#include "values.h"
+
+/* Zone maps: per block of ZONE_MAP_ROWS rows, the NULL count and the min/max of every column.
+   A table gets one the first time a filtered scan asks for it; from then on appends extend
+   it and updates widen it. Compaction drops it, and the next scan builds it again. */
+
+static ZoneMapStats g_zone_stats;
+
+static bool is_ranged_type(DataType type) {
+    return type == TYPE_INT || type == TYPE_FLOAT || type == TYPE_DATE || type == TYPE_TIME;
+}
+
+/* Orders two values of ranged types; false when they cannot be compared (a DATE and an INT). */
+static bool zone_compare(const Value *a, const Value *b, int *cmp) {
+    if (a->type == TYPE_INT && b->type == TYPE_INT) {
+        *cmp = a->int_val < b->int_val ? -1 : (a->int_val > b->int_val ? 1 : 0);
+    } else if ((a->type == TYPE_INT || a->type == TYPE_FLOAT) &&
+               (b->type == TYPE_INT || b->type == TYPE_FLOAT)) {
+        double l = a->type == TYPE_INT ? (double)a->int_val : a->float_val;
+        double r = b->type == TYPE_INT ? (double)b->int_val : b->float_val;
+        *cmp = l < r ? -1 : (l > r ? 1 : 0);
+    } else if (a->type == TYPE_DATE && b->type == TYPE_DATE) {
+        *cmp = a->date_val < b->date_val ? -1 : (a->date_val > b->date_val ? 1 : 0);
+    } else if (a->type == TYPE_TIME && b->type == TYPE_TIME) {
+        *cmp = a->time_val < b->time_val ? -1 : (a->time_val > b->time_val ? 1 : 0);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void zone_reset(ColumnZone *zone) {
+    memclear(zone, sizeof(ColumnZone));
+    zone->min.type = TYPE_NULL;
+    zone->max.type = TYPE_NULL;
+    zone->ranged = true;
+}
+
+static void zone_add(ColumnZone *zone, const Value *val) {
+    if (is_null(val)) {
+        zone->null_count++;
+        return;
+    }
+    if (!zone->ranged)
+        return;
+    if (!is_ranged_type(val->type)) {
+        zone->ranged = false;
+        return;
+    }
+    if (zone->min.type == TYPE_NULL) {
+        zone->min = *val;
+        zone->max = *val;
+        return;
+    }
+    int lo, hi;
+    if (!zone_compare(val, &zone->min, &lo) || !zone_compare(val, &zone->max, &hi)) {
+        zone->ranged = false;
+        return;
+    }
+    if (lo < 0)
+        zone->min = *val;
+    if (hi > 0)
+        zone->max = *val;
+}
+
+static bool reserve_blocks(ZoneMap *map, int blocks) {
+    if (blocks <= map->block_capacity)
+        return true;
+    int capacity = map->block_capacity > 0 ? map->block_capacity * 2 : 8;
+    while (capacity < blocks)
+        capacity *= 2;
+    ColumnZone *zones = realloc(map->zones, sizeof(ColumnZone) * (size_t)capacity *
+                                                (size_t)(map->column_count > 0 ? map->column_count
+                                                                               : 1));
+    if (!zones)
+        return false;
+    map->zones = zones;
+    map->block_capacity = capacity;
+    return true;
+}
+
+/* Folds the next row (row_count) into the map, opening a block at each ZONE_MAP_ROWS. */
+static bool add_row(ZoneMap *map, const Table *table) {
+    int row = map->row_count;
+    int block = row / ZONE_MAP_ROWS;
+    if (!reserve_blocks(map, block + 1))
+        return false;
+    ColumnZone *zones = map->zones + (size_t)block * (size_t)map->column_count;
+    for (int c = 0; c < map->column_count; c++) {
+        if (row % ZONE_MAP_ROWS == 0)
+            zone_reset(&zones[c]);
+        Value val = table_get_value(table, row, (uint16_t)c);
+        zone_add(&zones[c], &val);
+    }
+    map->row_count++;
+    return true;
+}
+
+/* The map is a cache beside the rows, so it is built through a const table. A map that does
+   not cover the table is rebuilt in place, since a running scan may hold it. Returns NULL
+   when it cannot be built; callers then scan every block. */
+const ZoneMap *zone_map_get(const Table *table) {
+    Table *owner = (Table *)table;
+    if (!owner->zones)
+        owner->zones = calloc(1, sizeof(ZoneMap));
+    ZoneMap *map = owner->zones;
+    if (!map)
+        return NULL;
+    int rows = table_row_count(table);
+    int columns = alist_length(&table->schema.columns);
+    if (map->row_count == rows && map->column_count == columns)
+        return map;
+
+    if (map->column_count != columns) {
+        map->column_count = columns;
+        map->block_capacity = 0;
+    }
+    map->row_count = 0;
+    while (map->row_count < rows) {
+        if (!add_row(map, table)) {
+            log_msg(LOG_WARN, "zone_map_get: Out of memory building the zone map of '%s'",
+                    table->name);
+            map->row_count = 0;
+            return NULL;
+        }
+    }
+    log_msg(LOG_DEBUG, "zone_map_get: Built %d blocks for '%s'",
+            (rows + ZONE_MAP_ROWS - 1) / ZONE_MAP_ROWS, table->name);
+    return map;
+}
+
+/* Called by table_append_row for the row just appended. A map that falls behind is emptied
+   and rebuilt by the next zone_map_get. */
+void zone_map_append(Table *table) {
+    ZoneMap *map = table->zones;
+    if (map && (map->row_count != table_row_count(table) - 1 || !add_row(map, table)))
+        map->row_count = 0;
+}
+
+/* Called by table_set_value once the new value is stored; was_null is the old value's. */
+void zone_map_update(Table *table, int row_idx, uint16_t column_id, bool was_null) {
+    ZoneMap *map = table->zones;
+    if (!map || row_idx >= map->row_count || column_id >= map->column_count)
+        return;
+    ColumnZone *zone =
+        &map->zones[(size_t)(row_idx / ZONE_MAP_ROWS) * (size_t)map->column_count + column_id];
+    Value val = table_get_value(table, row_idx, column_id);
+    if (was_null && zone->null_count > 0)
+        zone->null_count--;
+    zone_add(zone, &val);
+}
+
+void zone_map_free(Table *table) {
+    if (!table->zones)
+        return;
+    free(table->zones->zones);
+    free(table->zones);
+    table->zones = NULL;
+}
+
+const ColumnZone *zone_map_column(const ZoneMap *map, int block, uint16_t column_id) {
+    if (!map || block < 0 || block * ZONE_MAP_ROWS >= map->row_count ||
+        column_id >= map->column_count)
+        return NULL;
+    return &map->zones[(size_t)block * (size_t)map->column_count + column_id];
+}
+
+int zone_map_block_rows(const ZoneMap *map, int block) {
+    int rows = map->row_count - block * ZONE_MAP_ROWS;
+    return rows < ZONE_MAP_ROWS ? rows : ZONE_MAP_ROWS;
+}
+
+void zone_map_count_blocks(uint64_t checked, uint64_t skipped) {
+    g_zone_stats.blocks_checked += checked;
+    g_zone_stats.blocks_skipped += skipped;
+}
+
+void zone_map_get_stats(ZoneMapStats *out) {
+    *out = g_zone_stats;
+}